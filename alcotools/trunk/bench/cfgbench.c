@@ -0,0 +1,140 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Configuration Benchmark
+
+Abstract:
+    Measures the start-up cost of the configuration reader, with and without
+    a current snapshot, and the cost of each lookup. Run it from a directory
+    containing AlcoTools.conf.
+
+    Usage:
+      cfgbench [iterations]
+
+--*/
+
+#include "alcoholicz.h"
+
+// Keys looked up by a typical event
+static const char *keys[][2] = {
+    {SectionGeneral,   GeneralLogLevel},
+    {SectionGeneral,   GeneralDataPath},
+    {SectionDupeCheck, DupeSearchLimit},
+    {SectionDupeCheck, DupeCompactRecords},
+    {SectionDupeCheck, DupeCheckDirs},
+    {SectionDupeCheck, DupeIgnoreDirs},
+    {SectionDupeCheck, DupeExcludeCheck},
+    {SectionDupeCheck, DupeExcludeLog}
+};
+
+/*++
+
+InitTime
+
+    Measures the time taken to initialize the configuration reader.
+
+Arguments:
+    pool        - Pool to create sub-pools from.
+
+    iterations  - Number of times to initialize it.
+
+    cold        - Remove the snapshot before each initialization.
+
+Return Values:
+    Average time, in microseconds.
+
+--*/
+static
+double
+InitTime(
+    apr_pool_t *pool,
+    int iterations,
+    bool_t cold
+    )
+{
+    apr_pool_t *subPool;
+    apr_status_t status;
+    apr_time_t total = 0;
+    apr_time_t start;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        if (cold) {
+            apr_file_remove(CONFIG_SNAPSHOT, pool);
+        }
+        apr_pool_create(&subPool, pool);
+
+        start = apr_time_now();
+        status = ConfigInit(subPool);
+        total += apr_time_now() - start;
+
+        if (status != APR_SUCCESS) {
+            printf("Unable to read configuration file: %s\n", GetErrorMessage(status));
+            exit(1);
+        }
+        apr_pool_destroy(subPool);
+    }
+
+    return (double)total / iterations;
+}
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_size_t elements;
+    apr_size_t length;
+    apr_time_t start;
+    apr_uint32_t integer;
+    bool_t boolean;
+    char **array;
+    char *string;
+    int i;
+    int iterations;
+    int j;
+    unsigned long checksum = 0;
+
+    iterations = (argc > 1) ? atoi(argv[1]) : 1000;
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+
+    printf("ConfigInit, parse:     %10.1f us\n", InitTime(pool, iterations, TRUE));
+    printf("ConfigInit, snapshot:  %10.1f us\n", InitTime(pool, iterations, FALSE));
+
+    ConfigInit(pool);
+    LogInit(pool);
+    start = apr_time_now();
+    for (i = 0; i < iterations * 100; i++) {
+        for (j = 0; j < ARRAYSIZE(keys); j++) {
+            if (ConfigGetString(keys[j][0], keys[j][1], &string, &length) == APR_SUCCESS) {
+                checksum += length;
+            }
+            if (ConfigGetInt(keys[j][0], keys[j][1], &integer) == APR_SUCCESS) {
+                checksum += integer;
+            }
+            if (ConfigGetBool(keys[j][0], keys[j][1], &boolean) == APR_SUCCESS) {
+                checksum += boolean;
+            }
+            if (ConfigGetArray(keys[j][0], keys[j][1], &array, &elements) == APR_SUCCESS) {
+                checksum += elements;
+            }
+        }
+    }
+    printf("ConfigGet*, lookup:    %10.1f ns (checksum %lu)\n",
+        (double)(apr_time_now() - start) * 1000.0 / (iterations * 100.0 * ARRAYSIZE(keys) * 4), checksum);
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Dupe Database Benchmark
+
+Abstract:
+    Builds a dupe database of generated release names and measures the
+    latency of each search type. The database is built in batches, each one
+    appended to the log and then compacted into the index, so the log's tail
+    never holds more than one batch.
+
+    Exact, prefix, and prefixed wildcard searches are binary searches of the
+    index. Substring searches and wildcards that begin with '*' or '?' scan
+    the index newest first: they stop at the limit when only the first
+    results are needed, but a pattern with few matches, or a search that
+    counts every match (as SITE DUPE does), reads the whole index.
+
+    Usage:
+      dupebench <database> [entries] [queries]
+
+      database - Path of the database, without an extension. Existing files
+                 are replaced.
+      entries  - Number of directories to add (default 10000000).
+      queries  - Number of indexed searches per search type (default 10000).
+
+--*/
+
+#include "alcoholicz.h"
+
+// Directories added per batch, before the log is compacted
+#define BATCH_SIZE  1000000
+
+// Maximum number of results returned by a search, as searchLimit
+#define SEARCH_LIMIT 10
+
+static const char *words[] = {
+    "Alpha", "Black", "Crystal", "Dark", "Echo", "Fallen", "Golden", "Hidden",
+    "Iron", "Jade", "Killer", "Lost", "Midnight", "Neon", "Open", "Purple",
+    "Quiet", "Red", "Silver", "Twisted", "Urban", "Velvet", "White", "Young"
+};
+
+static const char *groups[] = {
+    "AMOK", "BPM", "CMS", "DNR", "EGO", "FiH", "GCP", "HB", "JUST", "KOUALA",
+    "LiR", "MOD", "NBD", "PsyCZ", "RAGEMP3", "SRP", "TiMES", "UME", "WHOA"
+};
+
+/*++
+
+NameFormat
+
+    Formats the release name of a directory. The same number always gives
+    the same name, so searches can look up names that were added.
+
+Arguments:
+    buffer  - Buffer to receive the name.
+
+    length  - Length of the buffer, in bytes.
+
+    number  - Directory number.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+NameFormat(
+    char *buffer,
+    apr_size_t length,
+    apr_uint32_t number
+    )
+{
+    apr_uint32_t hash = number * 2654435761U;
+
+    apr_snprintf(buffer, length, "%s_%s-%s_%s-%08X-%u-%s",
+        words[hash % ARRAYSIZE(words)],
+        words[(hash >> 5) % ARRAYSIZE(words)],
+        words[(hash >> 10) % ARRAYSIZE(words)],
+        words[(hash >> 15) % ARRAYSIZE(words)],
+        number, 1995 + (hash >> 20) % 12,
+        groups[(hash >> 24) % ARRAYSIZE(groups)]);
+}
+
+/*++
+
+Build
+
+    Creates the dupe database.
+
+Arguments:
+    path    - Path of the database, without an extension.
+
+    entries - Number of directories to add.
+
+    pool    - Pool to create sub-pools from.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+Build(
+    const char *path,
+    apr_uint32_t entries,
+    apr_pool_t *pool
+    )
+{
+    apr_pool_t *subPool;
+    apr_status_t status;
+    apr_time_t start;
+    apr_time_t time;
+    apr_uint32_t i;
+    char name[128];
+    char virtualPath[160];
+    DUPE_DB *db;
+
+    apr_file_remove(apr_pstrcat(pool, path, ".log", NULL), pool);
+    apr_file_remove(apr_pstrcat(pool, path, ".idx", NULL), pool);
+
+    status = apr_pool_create(&subPool, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    start = apr_time_now();
+    time = start - apr_time_from_sec(entries);
+
+    for (i = 0; i < entries; ) {
+        status = DupeOpen(&db, path, subPool);
+        if (status != APR_SUCCESS) {
+            break;
+        }
+
+        // Add a batch of directories, one second apart
+        do {
+            NameFormat(name, ARRAYSIZE(name), i);
+            apr_snprintf(virtualPath, ARRAYSIZE(virtualPath), "/MP3/%04u/%s", (i / 1000) % 10000, name);
+
+            status = DupeAdd(db, virtualPath, "user", "group", time + apr_time_from_sec(i));
+        } while (status == APR_SUCCESS && ++i < entries && i % BATCH_SIZE != 0);
+        DupeClose(db);
+
+        // Compaction merges the tail that was read when the database was opened
+        if (status == APR_SUCCESS) {
+            status = DupeOpen(&db, path, subPool);
+            if (status == APR_SUCCESS) {
+                status = DupeCompact(db);
+                DupeClose(db);
+            }
+        }
+        apr_pool_clear(subPool);
+
+        if (status != APR_SUCCESS) {
+            break;
+        }
+        printf("\rAdded %u of %u directories...", i, entries);
+        fflush(stdout);
+    }
+
+    printf("\nBuilt in %.1f seconds.\n\n", (double)(apr_time_now() - start) / APR_USEC_PER_SEC);
+    apr_pool_destroy(subPool);
+    return status;
+}
+
+/*++
+
+SearchTime
+
+    Measures the time taken by a search.
+
+Arguments:
+    db          - Pointer to a dupe database.
+
+    label       - Description of the search.
+
+    type        - Search type, DUPE_MATCH_*.
+
+    patterns    - Array of patterns, each one searched once.
+
+    count       - Number of patterns.
+
+    counted     - Count every match, as SITE DUPE does.
+
+    pool        - Pool to create sub-pools from.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+SearchTime(
+    DUPE_DB *db,
+    const char *label,
+    int type,
+    char **patterns,
+    int count,
+    bool_t counted,
+    apr_pool_t *pool
+    )
+{
+    apr_pool_t *subPool;
+    apr_time_t elapsed;
+    apr_time_t start;
+    apr_uint32_t found;
+    apr_uint32_t total = 0;
+    apr_uint64_t matches = 0;
+    int i;
+    DUPE_ENTRY entries[SEARCH_LIMIT];
+
+    apr_pool_create(&subPool, pool);
+
+    start = apr_time_now();
+    for (i = 0; i < count; i++) {
+        DupeSearch(db, type, patterns[i], SEARCH_LIMIT, entries, &found, counted ? &total : NULL, subPool);
+        matches += counted ? total : found;
+        apr_pool_clear(subPool);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-32s %12.1f us per search, %8.1f %s\n", label,
+        (double)elapsed / (double)count, (double)matches / (double)count,
+        counted ? "matches" : "results");
+
+    apr_pool_destroy(subPool);
+}
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_status_t status;
+    apr_uint32_t entries;
+    apr_uint32_t found;
+    char buffer[128];
+    char **exact;
+    char **glob;
+    char **prefix;
+    char *scanGlob[] = {"*-1999-tiMES", "*_velvet-*-2003-*"};
+    char *scanSubstr[] = {"midnight_neon", "velvet_echo-lost"};
+    char *rareSubstr[] = {"not-a-release", "zzz"};
+    int i;
+    int queries;
+    DUPE_DB *db;
+
+    if (argc < 2) {
+        printf("Usage: %s <database> [entries] [queries]\n", argv[0]);
+        return 1;
+    }
+    entries = (argc > 2) ? (apr_uint32_t)strtoul(argv[2], NULL, 10) : 10000000;
+    queries = (argc > 3) ? atoi(argv[3]) : 10000;
+    if (entries == 0 || queries <= 0) {
+        printf("Usage: %s <database> [entries] [queries]\n", argv[0]);
+        return 1;
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+
+    status = Build(argv[1], entries, pool);
+    if (status != APR_SUCCESS) {
+        printf("Unable to build database: %s\n", GetErrorMessage(status));
+        return 1;
+    }
+
+    status = DupeOpen(&db, argv[1], pool);
+    if (status != APR_SUCCESS) {
+        printf("Unable to open database: %s\n", GetErrorMessage(status));
+        return 1;
+    }
+
+    // Look up names spread over the whole database
+    exact  = apr_palloc(pool, queries * sizeof(char *));
+    prefix = apr_palloc(pool, queries * sizeof(char *));
+    glob   = apr_palloc(pool, queries * sizeof(char *));
+
+    for (i = 0; i < queries; i++) {
+        NameFormat(buffer, ARRAYSIZE(buffer), (apr_uint32_t)(((apr_uint64_t)i * 2654435761U) % entries));
+        exact[i]  = apr_pstrdup(pool, buffer);
+        prefix[i] = apr_pstrndup(pool, buffer, strchr(buffer, '-') - buffer + 1);
+        glob[i]   = apr_pstrcat(pool, prefix[i], "*-", strrchr(buffer, '-') + 1, NULL);
+    }
+
+    // Read the whole index once, so it is timed from the page cache
+    DupeSearch(db, DUPE_MATCH_SUBSTR, rareSubstr[0], 0, NULL, &found, NULL, pool);
+
+    printf("Directories: %u, %d results per search\n\n", entries, SEARCH_LIMIT);
+    SearchTime(db, "Exact",                          DUPE_MATCH_EXACT,  exact,  queries, FALSE, pool);
+    SearchTime(db, "Prefix",                         DUPE_MATCH_PREFIX, prefix, queries, FALSE, pool);
+    SearchTime(db, "Glob, literal prefix",           DUPE_MATCH_GLOB,   glob,   queries, FALSE, pool);
+    SearchTime(db, "Glob, literal prefix, counted",  DUPE_MATCH_GLOB,   glob,   queries, TRUE,  pool);
+    SearchTime(db, "Glob, no prefix",                DUPE_MATCH_GLOB,   scanGlob,   ARRAYSIZE(scanGlob),   FALSE, pool);
+    SearchTime(db, "Glob, no prefix, counted",       DUPE_MATCH_GLOB,   scanGlob,   ARRAYSIZE(scanGlob),   TRUE,  pool);
+    SearchTime(db, "Substring",                      DUPE_MATCH_SUBSTR, scanSubstr, ARRAYSIZE(scanSubstr), FALSE, pool);
+    SearchTime(db, "Substring, counted",             DUPE_MATCH_SUBSTR, scanSubstr, ARRAYSIZE(scanSubstr), TRUE,  pool);
+    SearchTime(db, "Substring, no match",            DUPE_MATCH_SUBSTR, rareSubstr, ARRAYSIZE(rareSubstr), FALSE, pool);
+
+    DupeClose(db);
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
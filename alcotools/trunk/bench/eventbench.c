@@ -0,0 +1,437 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Event Latency Benchmark
+
+Abstract:
+    Fires synthetic UPLOAD, POSTMKD and DUPE events at AlcoTools at a fixed
+    rate, the way an FTP server would, and reports the latency percentiles
+    and throughput. Run it from a directory containing AlcoTools.conf; the
+    dupe database and race statistics are written to the configured data path.
+
+    With a target rate, events are scheduled at fixed intervals and latency
+    is measured from the scheduled time, so time spent waiting for a free
+    slot counts against the event. Each event process appends its phase timings (ALCOTOOLS_TIMING)
+    to "eventbench.timing", which are summarized as well.
+
+    Usage:
+      eventbench <alcotools> [events] [rate] [concurrency] [mix] [--client]
+
+      events      - Number of events to fire (default 1000).
+      rate        - Events per second, 0 to fire as fast as possible (default 0).
+      concurrency - Maximum events running at once (default 8).
+      mix         - Comma-separated event types: upload, postmkd, dupe
+                    (default upload,postmkd,dupe).
+      --client    - Forward the events to a daemon started beforehand with
+                    "alcotools --daemon", to compare against a new process
+                    per event.
+
+--*/
+
+#include "alcoholicz.h"
+
+#define TIMING_FILE     "eventbench.timing"
+#define UPLOAD_FILE     "eventbench.dat"
+#define UPLOAD_SIZE     (256 * 1024)
+
+// Files uploaded to each synthetic release
+#define RELEASE_FILES   20
+
+#define TYPE_UPLOAD     0
+#define TYPE_POSTMKD    1
+#define TYPE_DUPE       2
+
+static const char *typeNames[] = {"upload", "postmkd", "dupe"};
+
+// Phase names written by AlcoTools, in order
+static const char *phaseNames[] = {
+    "total", "init", "forward", "config", "log", "streams", "event", "deferred", "cleanup"
+};
+
+static const char *binary;
+static const char *uploadPath;
+static bool_t client;
+static int events;
+static int mix[8];
+static int mixCount;
+static apr_time_t interval;
+static apr_time_t start;
+static apr_file_t *nullFile;
+
+// Next event to fire, shared by the worker threads
+static volatile apr_uint32_t next;
+
+// Latency of each event, and the number that failed
+static apr_time_t *latency;
+static volatile apr_uint32_t failed;
+
+
+/*++
+
+FireEvent
+
+    Runs AlcoTools for one synthetic event.
+
+Arguments:
+    index   - Index of the event.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+FireEvent(
+    int index,
+    apr_pool_t *pool
+    )
+{
+    apr_exit_why_e why;
+    apr_proc_t proc;
+    apr_procattr_t *attr;
+    apr_status_t status;
+    int argc = 0;
+    int code;
+    int release = index / RELEASE_FILES;
+    const char *args[8];
+    const char *env[8];
+
+    // Racers change with every file, the way they do on a busy site
+    env[0] = apr_psprintf(pool, "USER=racer%02d", index % 12);
+    env[1] = apr_psprintf(pool, "GROUP=group%d", index % 5);
+    env[2] = apr_psprintf(pool, "SPEED=%d", 2000 + (index % 7) * 1500);
+    env[3] = "ALCOTOOLS_TIMING=" TIMING_FILE;
+    env[4] = NULL;
+
+    args[argc++] = binary;
+    if (client) {
+        args[argc++] = "--client";
+    }
+    switch (mix[index % mixCount]) {
+        case TYPE_UPLOAD:
+            args[argc++] = "UPLOAD";
+            args[argc++] = uploadPath;
+            args[argc++] = "DEADBEEF";
+            args[argc++] = apr_psprintf(pool, "/BENCH/Bench.Release.%05d-GRP/bench-grp.r%02d",
+                release, index % RELEASE_FILES);
+            break;
+        case TYPE_POSTMKD:
+            args[argc++] = "POSTMKD";
+            args[argc++] = apr_psprintf(pool, "/BENCH/Bench.Release.%05d-GRP", index);
+            break;
+        case TYPE_DUPE:
+            args[argc++] = "DUPE";
+            args[argc++] = apr_psprintf(pool, "Release.%03d", index % 1000);
+            break;
+    }
+    args[argc] = NULL;
+
+    status = apr_procattr_create(&attr, pool);
+    if (status == APR_SUCCESS) {
+        apr_procattr_cmdtype_set(attr, APR_PROGRAM);
+        apr_procattr_child_out_set(attr, nullFile, NULL);
+        status = apr_proc_create(&proc, binary, args, env, attr, pool);
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = apr_proc_wait(&proc, &code, &why, APR_WAIT);
+    if (status != APR_CHILD_DONE) {
+        return status;
+    }
+    return (why == APR_PROC_EXIT && code == 0) ? APR_SUCCESS : APR_EGENERAL;
+}
+
+/*++
+
+WorkerThread
+
+    Fires events at their scheduled times until all have been fired.
+
+Arguments:
+    thread  - Pointer to the thread.
+
+    data    - Not used.
+
+Return Values:
+    None.
+
+--*/
+static
+void *
+APR_THREAD_FUNC
+WorkerThread(
+    apr_thread_t *thread,
+    void *data
+    )
+{
+    apr_pool_t *pool;
+    apr_time_t now;
+    apr_time_t scheduled;
+    apr_uint32_t index;
+
+    apr_pool_create(&pool, NULL);
+
+    while ((index = apr_atomic_inc32(&next)) < (apr_uint32_t)events) {
+        // Without a target rate, events are timed from when they are fired
+        now = apr_time_now();
+        scheduled = (interval > 0) ? start + interval * index : now;
+        if (scheduled > now) {
+            apr_sleep(scheduled - now);
+        }
+
+        if (FireEvent((int)index, pool) != APR_SUCCESS) {
+            apr_atomic_inc32(&failed);
+        }
+        latency[index] = apr_time_now() - scheduled;
+        apr_pool_clear(pool);
+    }
+
+    apr_pool_destroy(pool);
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+/*++
+
+CompareTimes
+
+    Orders times ascending. Used with qsort().
+
+Arguments:
+    elem1   - Pointer to the first apr_time_t.
+
+    elem2   - Pointer to the second apr_time_t.
+
+Return Values:
+    Less than, equal to, or greater than zero.
+
+--*/
+static
+int
+CompareTimes(
+    const void *elem1,
+    const void *elem2
+    )
+{
+    apr_time_t time1 = *(const apr_time_t *)elem1;
+    apr_time_t time2 = *(const apr_time_t *)elem2;
+
+    return (time1 < time2) ? -1 : (time1 > time2) ? 1 : 0;
+}
+
+/*++
+
+PrintPercentiles
+
+    Sorts a list of times and prints their percentiles.
+
+Arguments:
+    label   - Pointer to a null-terminated string that labels the line.
+
+    times   - Array of times, in microseconds.
+
+    count   - Number of times.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+PrintPercentiles(
+    const char *label,
+    apr_time_t *times,
+    int count
+    )
+{
+    if (count == 0) {
+        return;
+    }
+    qsort(times, count, sizeof(apr_time_t), CompareTimes);
+
+    printf("%-10s %9.3f %9.3f %9.3f %9.3f   (%d)\n", label,
+        times[count * 50 / 100] / 1000.0, times[count * 90 / 100] / 1000.0,
+        times[count * 99 / 100] / 1000.0, times[count - 1] / 1000.0, count);
+}
+
+/*++
+
+PrintPhases
+
+    Summarizes the phase timings written by the event processes.
+
+Arguments:
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+PrintPhases(
+    apr_pool_t *pool
+    )
+{
+    apr_time_t *times[ARRAYSIZE(phaseNames)];
+    char line[512];
+    char *name;
+    char *state;
+    char *value;
+    int counts[ARRAYSIZE(phaseNames)];
+    int i;
+    FILE *file;
+
+    file = fopen(TIMING_FILE, "r");
+    if (file == NULL) {
+        return;
+    }
+    for (i = 0; i < ARRAYSIZE(phaseNames); i++) {
+        times[i]  = apr_palloc(pool, events * sizeof(apr_time_t));
+        counts[i] = 0;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        for (name = apr_strtok(line, " \r\n", &state); name != NULL; name = apr_strtok(NULL, " \r\n", &state)) {
+            value = strchr(name, '=');
+            if (value == NULL) {
+                continue;
+            }
+            *value++ = '\0';
+
+            for (i = 0; i < ARRAYSIZE(phaseNames); i++) {
+                if (strcmp(name, phaseNames[i]) == 0 && counts[i] < events) {
+                    times[i][counts[i]++] = (apr_time_t)apr_atoi64(value);
+                    break;
+                }
+            }
+        }
+    }
+    fclose(file);
+
+    printf("\nPhase           p50       p90       p99       max   (samples), ms in process\n");
+    for (i = 0; i < ARRAYSIZE(phaseNames); i++) {
+        PrintPercentiles(phaseNames[i], times[i], counts[i]);
+    }
+}
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_size_t written;
+    apr_status_t status;
+    apr_time_t elapsed;
+    apr_file_t *file;
+    char *buffer;
+    char *state;
+    char *type;
+    int concurrency;
+    int i;
+    int rate;
+    apr_thread_t *threads[64];
+
+    if (argc > 1 && strcmp(argv[argc-1], "--client") == 0) {
+        client = TRUE;
+        argc--;
+    }
+    if (argc < 2) {
+        printf("Usage: %s <alcotools> [events] [rate] [concurrency] [mix] [--client]\n", argv[0]);
+        return 1;
+    }
+    events      = (argc > 2) ? atoi(argv[2]) : 1000;
+    rate        = (argc > 3) ? atoi(argv[3]) : 0;
+    concurrency = (argc > 4) ? atoi(argv[4]) : 8;
+    if (events <= 0 || rate < 0 || concurrency <= 0 || concurrency > ARRAYSIZE(threads)) {
+        printf("Invalid arguments.\n");
+        return 1;
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+
+    // Resolve the binary, the event processes run with their own environment
+    status = apr_filepath_merge((char **)&binary, NULL, argv[1], 0, pool);
+    if (status == APR_SUCCESS) {
+        status = apr_filepath_merge((char **)&uploadPath, NULL, UPLOAD_FILE, 0, pool);
+    }
+    if (status != APR_SUCCESS) {
+        printf("Unable to resolve paths: %s\n", GetErrorMessage(status));
+        return 1;
+    }
+
+    buffer = apr_pstrdup(pool, (argc > 5) ? argv[5] : "upload,postmkd,dupe");
+    for (type = apr_strtok(buffer, ",", &state); type != NULL && mixCount < ARRAYSIZE(mix);
+            type = apr_strtok(NULL, ",", &state)) {
+        for (i = 0; i < ARRAYSIZE(typeNames); i++) {
+            if (strcasecmp(type, typeNames[i]) == 0) {
+                mix[mixCount++] = i;
+                break;
+            }
+        }
+        if (i == ARRAYSIZE(typeNames)) {
+            printf("Unknown event type: %s\n", type);
+            return 1;
+        }
+    }
+
+    // File uploaded by every UPLOAD event
+    buffer = apr_pcalloc(pool, UPLOAD_SIZE);
+    status = apr_file_open(&file, uploadPath, APR_FOPEN_WRITE|APR_FOPEN_CREATE|
+        APR_FOPEN_TRUNCATE|APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, buffer, UPLOAD_SIZE, &written);
+        apr_file_close(file);
+    }
+#ifdef WINDOWS
+    if (status == APR_SUCCESS) {
+        status = apr_file_open(&nullFile, "NUL", APR_FOPEN_WRITE, APR_OS_DEFAULT, pool);
+    }
+#else
+    if (status == APR_SUCCESS) {
+        status = apr_file_open(&nullFile, "/dev/null", APR_FOPEN_WRITE, APR_OS_DEFAULT, pool);
+    }
+#endif
+    if (status != APR_SUCCESS) {
+        printf("Unable to create files: %s\n", GetErrorMessage(status));
+        return 1;
+    }
+    apr_file_remove(TIMING_FILE, pool);
+
+    latency  = apr_pcalloc(pool, events * sizeof(apr_time_t));
+    interval = (rate > 0) ? APR_USEC_PER_SEC / rate : 0;
+    start    = apr_time_now();
+
+    for (i = 0; i < concurrency; i++) {
+        apr_thread_create(&threads[i], NULL, WorkerThread, NULL, pool);
+    }
+    for (i = 0; i < concurrency; i++) {
+        apr_thread_join(&status, threads[i]);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("Events:     %d (%s%s), %d failed\n", events, (argc > 5) ? argv[5] : "upload,postmkd,dupe",
+        client ? ", daemon" : "", failed);
+    printf("Target:     %s\n", (rate > 0) ? apr_psprintf(pool, "%d events/s", rate) : "unlimited");
+    printf("Throughput: %.1f events/s, %d concurrent\n",
+        (double)events * APR_USEC_PER_SEC / (double)elapsed, concurrency);
+
+    printf("\nLatency         p50       p90       p99       max   (samples), ms from schedule\n");
+    PrintPercentiles("event", latency, events);
+    PrintPhases(pool);
+
+    apr_file_remove(uploadPath, pool);
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Logging Benchmark
+
+Abstract:
+    Measures the cost of logging a message from one or more threads, and the
+    total time until every message is written. Run it from a directory
+    containing AlcoTools.conf, with "logLevel" set to 3 or higher. Build it
+    with LOG_ASYNC defined as TRUE and FALSE to compare both writers.
+
+    Usage:
+      logbench [messages] [threads]
+
+--*/
+
+#include "alcoholicz.h"
+
+static int messages;
+
+/*++
+
+LogThread
+
+    Logs messages similar to the argument list written on start-up.
+
+Arguments:
+    thread  - Pointer to the thread, null when called from the main thread.
+
+    data    - Pointer to an apr_time_t that receives the time taken.
+
+Return Values:
+    None.
+
+--*/
+static
+void *
+APR_THREAD_FUNC
+LogThread(
+    apr_thread_t *thread,
+    void *data
+    )
+{
+    apr_time_t start;
+    int i;
+
+    start = apr_time_now();
+    for (i = 0; i < messages; i++) {
+        LOG_VERBOSE("Argument %d = \"/site/incoming/Some.Release.Name-GROUP/file%04d.rar\"", i, i);
+    }
+    *(apr_time_t *)data = apr_time_now() - start;
+
+#if APR_HAS_THREADS
+    if (thread != NULL) {
+        apr_thread_exit(thread, APR_SUCCESS);
+    }
+#endif
+    return NULL;
+}
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_status_t status;
+    apr_time_t elapsed[64];
+    apr_time_t start;
+    apr_time_t total;
+    int i;
+    int threads;
+#if APR_HAS_THREADS
+    apr_thread_t *handles[64];
+#endif
+
+    messages = (argc > 1) ? atoi(argv[1]) : 100000;
+    threads  = (argc > 2) ? atoi(argv[2]) : 1;
+    if (messages <= 0 || threads <= 0 || threads > ARRAYSIZE(elapsed)) {
+        printf("Usage: %s [messages] [threads]\n", argv[0]);
+        return 1;
+    }
+#if !APR_HAS_THREADS
+    threads = 1;
+#endif
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+
+    if ((status = ConfigInit(pool)) != APR_SUCCESS || (status = LogInit(pool)) != APR_SUCCESS) {
+        printf("Unable to initialize: %s\n", GetErrorMessage(status));
+        return 1;
+    }
+    if (logMaxLevel < LOG_LEVEL_VERBOSE) {
+        printf("The \"logLevel\" option must be 3 or higher.\n");
+        return 1;
+    }
+
+    start = apr_time_now();
+#if APR_HAS_THREADS
+    for (i = 1; i < threads; i++) {
+        apr_thread_create(&handles[i], NULL, LogThread, &elapsed[i], pool);
+    }
+#endif
+    LogThread(NULL, &elapsed[0]);
+#if APR_HAS_THREADS
+    for (i = 1; i < threads; i++) {
+        apr_thread_join(&status, handles[i]);
+    }
+#endif
+
+    // Destroying the pool writes any buffered messages
+    apr_pool_destroy(pool);
+    total = apr_time_now() - start;
+
+    for (i = 1; i < threads; i++) {
+        elapsed[0] += elapsed[i];
+    }
+    printf("Writer:           %s\n", (LOG_ASYNC == TRUE) ? "asynchronous" : "synchronous");
+    printf("LOG_VERBOSE:      %10.1f ns per call\n",
+        (double)elapsed[0] * 1000.0 / ((double)messages * threads));
+    printf("Throughput:       %10.0f messages per second\n",
+        (double)messages * threads * 1000000.0 / (double)total);
+    printf("Total, flushed:   %10.1f ms\n", (double)total / 1000.0);
+
+    apr_terminate();
+    return 0;
+}
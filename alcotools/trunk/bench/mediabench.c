@@ -0,0 +1,82 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Media Probe Benchmark
+
+Abstract:
+    Measures the number of MPEG audio files probed per second. The files are
+    probed once before timing, so they are read from the page cache.
+
+    Usage:
+      mediabench <iterations> <file> [file ...]
+
+--*/
+
+#include "alcoholicz.h"
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_pool_t *subPool;
+    apr_status_t status;
+    apr_time_t elapsed;
+    apr_time_t start;
+    int files;
+    int i;
+    int iterations;
+    int j;
+    MEDIA_INFO media;
+
+    iterations = (argc > 2) ? atoi(argv[1]) : 0;
+    if (iterations <= 0) {
+        printf("Usage: %s <iterations> <file> [file ...]\n", argv[0]);
+        return 1;
+    }
+    files = argc - 2;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+    apr_pool_create(&subPool, pool);
+
+    // Warm the page cache, and show what was found
+    for (i = 0; i < files; i++) {
+        status = MediaProbe(argv[i+2], &media, subPool);
+        if (status != APR_SUCCESS) {
+            printf("Unable to probe \"%s\": %s\n", argv[i+2], GetErrorMessage(status));
+            return 1;
+        }
+        if (i < 5) {
+            printf("%s: %s Layer %u, %u kbit/s %s, %u Hz, %s, %u ms, %s - %s (%s, %u)\n",
+                argv[i+2], MediaVersionName(&media), media.layer, media.bitrate,
+                media.vbr ? "VBR" : "CBR", media.sampleRate, MediaChannelName(&media),
+                media.duration, media.artist, media.title, media.genre, media.year);
+        }
+        apr_pool_clear(subPool);
+    }
+
+    start = apr_time_now();
+    for (j = 0; j < iterations; j++) {
+        for (i = 0; i < files; i++) {
+            MediaProbe(argv[i+2], &media, subPool);
+            apr_pool_clear(subPool);
+        }
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("Files:            %10d\n", files * iterations);
+    printf("MediaProbe:       %10.1f us per file\n",
+        (double)elapsed / ((double)files * iterations));
+    printf("Throughput:       %10.0f files per second\n",
+        (double)files * iterations * 1000000.0 / (double)elapsed);
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
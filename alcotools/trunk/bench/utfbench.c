@@ -0,0 +1,218 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    UTF Conversion Benchmark
+
+Abstract:
+    Measures the throughput of the UTF converters, with and without the fast
+    paths (utfref.c), and of the encoding conversions, on text that is all
+    ASCII and on text with one non-ASCII character in twenty. Throughput is
+    in megabytes of source text per second.
+
+    Usage:
+      utfbench [iterations] [size-kb]
+
+--*/
+
+#include "alcoholicz.h"
+#include "utfref.h"
+
+typedef CONVERSION_RESULT (*CONVERTER)(const void **, const void *, void **, void *, CONVERSION_FLAGS);
+
+/*++
+
+ConvertRate
+
+    Measures the throughput of a converter.
+
+Arguments:
+    convert     - Converter to measure.
+
+    source      - Pointer to the source text.
+
+    length      - Length of the source text, in bytes.
+
+    target      - Buffer large enough for the converted text.
+
+    iterations  - Number of times to convert the text.
+
+Return Values:
+    Throughput, in megabytes per second.
+
+--*/
+static
+double
+ConvertRate(
+    CONVERTER convert,
+    const void *source,
+    apr_size_t length,
+    void *target,
+    int iterations
+    )
+{
+    apr_time_t elapsed;
+    apr_time_t start;
+    const void *sourcePos;
+    void *targetPos;
+    int i;
+
+    start = apr_time_now();
+    for (i = 0; i < iterations; i++) {
+        sourcePos = source;
+        targetPos = target;
+        convert(&sourcePos, (const apr_byte_t *)source + length, &targetPos, (apr_byte_t *)target + length * 4, strictConversion);
+    }
+    elapsed = MAX(apr_time_now() - start, 1);
+
+    return (double)length * iterations / (double)elapsed;
+}
+
+/*++
+
+EncodingRate
+
+    Measures the throughput of an encoding conversion.
+
+Arguments:
+    inEnc       - Encoding of the source text.
+
+    source      - Pointer to the source text.
+
+    length      - Length of the source text, in bytes.
+
+    outEnc      - Encoding to convert to.
+
+    target      - Buffer large enough for the converted text.
+
+    iterations  - Number of times to convert the text.
+
+Return Values:
+    Throughput, in megabytes per second.
+
+--*/
+static
+double
+EncodingRate(
+    encoding_t inEnc,
+    const apr_byte_t *source,
+    apr_size_t length,
+    encoding_t outEnc,
+    apr_byte_t *target,
+    int iterations
+    )
+{
+    apr_time_t elapsed;
+    apr_time_t start;
+    const apr_byte_t *sourcePos;
+    apr_byte_t *targetPos;
+    int i;
+
+    start = apr_time_now();
+    for (i = 0; i < iterations; i++) {
+        sourcePos = source;
+        targetPos = target;
+        EncConvertBuffer(inEnc, &sourcePos, source + length, outEnc, &targetPos, target + length * 4);
+    }
+    elapsed = MAX(apr_time_now() - start, 1);
+
+    return (double)length * iterations / (double)elapsed;
+}
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_size_t chars;
+    apr_size_t i;
+    apr_size_t length8;
+    apr_size_t length16;
+    apr_size_t length32;
+    int iterations;
+    int pass;
+    const utf8_t *source8;
+    const utf16_t *source16;
+    const utf32_t *source32;
+    void *target;
+    utf8_t *utf8;
+    utf16_t *utf16;
+    utf32_t *utf32;
+    void *pos;
+
+    iterations = (argc > 1) ? atoi(argv[1]) : 200;
+    chars = (argc > 2) ? (apr_size_t)atoi(argv[2]) * 1024 : 1024 * 1024;
+    if (iterations <= 0 || chars == 0) {
+        printf("Usage: %s [iterations] [size-kb]\n", argv[0]);
+        return 1;
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+
+    utf8   = apr_palloc(pool, chars * 3);
+    utf16  = apr_palloc(pool, chars * sizeof(utf16_t));
+    utf32  = apr_palloc(pool, chars * sizeof(utf32_t));
+    target = apr_palloc(pool, chars * sizeof(utf32_t) * 4);
+
+    printf("%u KB of text, %d iterations, MB/s without -> with fast paths\n", (unsigned)(chars / 1024), iterations);
+
+    for (pass = 0; pass < 2; pass++) {
+        // Printable ASCII, or one character in twenty from the rest of the BMP
+        for (i = 0; i < chars; i++) {
+            utf32[i] = 0x20 + (i * 7) % 0x5F;
+            if (pass == 1 && i % 20 == 19) {
+                utf32[i] = 0xA0 + (i * 31) % 0x2000;
+            }
+        }
+
+        // The other forms are converted from the UTF-32 text
+        source32 = utf32;
+        pos = utf8;
+        RefConvertUTF32toUTF8(&source32, utf32 + chars, (utf8_t **)&pos, utf8 + chars * 3, strictConversion);
+        length8 = (apr_size_t)((utf8_t *)pos - utf8);
+
+        source32 = utf32;
+        pos = utf16;
+        RefConvertUTF32toUTF16(&source32, utf32 + chars, (utf16_t **)&pos, utf16 + chars, strictConversion);
+        length16 = (apr_size_t)((utf16_t *)pos - utf16) * sizeof(utf16_t);
+        length32 = chars * sizeof(utf32_t);
+
+        source8  = utf8;
+        source16 = utf16;
+
+        printf("\n%s:\n", (pass == 0) ? "All ASCII" : "95% ASCII");
+        printf("  UTF-8 to UTF-16     %8.0f -> %8.0f\n",
+            ConvertRate((CONVERTER)RefConvertUTF8toUTF16, source8, length8, target, iterations),
+            ConvertRate((CONVERTER)ConvertUTF8toUTF16, source8, length8, target, iterations));
+        printf("  UTF-8 to UTF-32     %8.0f -> %8.0f\n",
+            ConvertRate((CONVERTER)RefConvertUTF8toUTF32, source8, length8, target, iterations),
+            ConvertRate((CONVERTER)ConvertUTF8toUTF32, source8, length8, target, iterations));
+        printf("  UTF-16 to UTF-8     %8.0f -> %8.0f\n",
+            ConvertRate((CONVERTER)RefConvertUTF16toUTF8, source16, length16, target, iterations),
+            ConvertRate((CONVERTER)ConvertUTF16toUTF8, source16, length16, target, iterations));
+        printf("  UTF-16 to UTF-32    %8.0f -> %8.0f\n",
+            ConvertRate((CONVERTER)RefConvertUTF16toUTF32, source16, length16, target, iterations),
+            ConvertRate((CONVERTER)ConvertUTF16toUTF32, source16, length16, target, iterations));
+        printf("  UTF-32 to UTF-8     %8.0f -> %8.0f\n",
+            ConvertRate((CONVERTER)RefConvertUTF32toUTF8, utf32, length32, target, iterations),
+            ConvertRate((CONVERTER)ConvertUTF32toUTF8, utf32, length32, target, iterations));
+        printf("  UTF-32 to UTF-16    %8.0f -> %8.0f\n",
+            ConvertRate((CONVERTER)RefConvertUTF32toUTF16, utf32, length32, target, iterations),
+            ConvertRate((CONVERTER)ConvertUTF32toUTF16, utf32, length32, target, iterations));
+
+        // The encoding conversions only exist with the fast paths
+        printf("  UTF-16LE to UTF-8   %8s    %8.0f\n", "",
+            EncodingRate(ENCODING_UTF16_LE, (const apr_byte_t *)source16, length16, ENCODING_UTF8, target, iterations));
+        printf("  UTF-8 to Latin-1    %8s    %8.0f\n", "",
+            EncodingRate(ENCODING_UTF8, source8, length8, ENCODING_LATIN1, target, iterations));
+    }
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
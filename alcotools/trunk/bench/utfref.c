@@ -0,0 +1,27 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Reference UTF Converters
+
+Abstract:
+    Builds utfconvert.c a second time without the fast paths, under other
+    names, for the conversion test and benchmark to compare against. See
+    utfref.h for the prototypes.
+
+--*/
+
+#define UNI_NO_FAST_PATHS
+
+#define ConvertUTF8toUTF16  RefConvertUTF8toUTF16
+#define ConvertUTF16toUTF8  RefConvertUTF16toUTF8
+#define ConvertUTF8toUTF32  RefConvertUTF8toUTF32
+#define ConvertUTF32toUTF8  RefConvertUTF32toUTF8
+#define ConvertUTF16toUTF32 RefConvertUTF16toUTF32
+#define ConvertUTF32toUTF16 RefConvertUTF32toUTF16
+#define CountASCII          RefCountASCII
+#define IsLegalUTF8Sequence RefIsLegalUTF8Sequence
+
+#include "utfconvert.c"
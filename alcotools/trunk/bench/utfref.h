@@ -0,0 +1,71 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Reference UTF Converters
+
+Abstract:
+    Prototypes of the converters without the fast paths, see utfref.c.
+
+--*/
+
+#ifndef _UTFREF_H_
+#define _UTFREF_H_
+
+CONVERSION_RESULT
+RefConvertUTF8toUTF16(
+    const utf8_t **sourceStart,
+    const utf8_t *sourceEnd,
+    utf16_t **targetStart,
+    utf16_t *targetEnd,
+    CONVERSION_FLAGS flags
+    );
+
+CONVERSION_RESULT
+RefConvertUTF16toUTF8(
+    const utf16_t **sourceStart,
+    const utf16_t *sourceEnd,
+    utf8_t **targetStart,
+    utf8_t *targetEnd,
+    CONVERSION_FLAGS flags
+    );
+
+CONVERSION_RESULT
+RefConvertUTF8toUTF32(
+    const utf8_t **sourceStart,
+    const utf8_t *sourceEnd,
+    utf32_t **targetStart,
+    utf32_t *targetEnd,
+    CONVERSION_FLAGS flags
+    );
+
+CONVERSION_RESULT
+RefConvertUTF32toUTF8(
+    const utf32_t **sourceStart,
+    const utf32_t *sourceEnd,
+    utf8_t **targetStart,
+    utf8_t *targetEnd,
+    CONVERSION_FLAGS flags
+    );
+
+CONVERSION_RESULT
+RefConvertUTF16toUTF32(
+    const utf16_t **sourceStart,
+    const utf16_t *sourceEnd,
+    utf32_t **targetStart,
+    utf32_t *targetEnd,
+    CONVERSION_FLAGS flags
+    );
+
+CONVERSION_RESULT
+RefConvertUTF32toUTF16(
+    const utf32_t **sourceStart,
+    const utf32_t *sourceEnd,
+    utf16_t **targetStart,
+    utf16_t *targetEnd,
+    CONVERSION_FLAGS flags
+    );
+
+#endif // _UTFREF_H_
@@ -0,0 +1,749 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    UTF Conversion Test
+
+Abstract:
+    Randomized differential test of the UTF converters and the encoding
+    conversions. Each converter is compared with the same converter built
+    without the fast paths (utfref.c), on generated text with long ASCII
+    runs, multi-byte and supplementary characters, illegal sequences, and
+    targets too short for the result. The result, both pointers, and the
+    whole target buffer must be identical.
+
+    EncConvertBuffer is compared with the reference converters, and with
+    itself when the input and output are split into random pieces.
+
+    The fast paths depend on the instruction set the compiler targets, so
+    run the test from an SSE2 build, an AVX2 build (/arch:AVX2 or -mavx2),
+    and a build without SSE2.
+
+    Usage:
+      utftest [iterations] [seed]
+
+--*/
+
+#include "alcoholicz.h"
+#include "utfref.h"
+
+// Maximum number of characters in a generated text
+#define MAX_CHARS   300
+
+// Bytes past the end of the target that must not be written
+#define GUARD_SIZE  64
+
+typedef CONVERSION_RESULT (*CONVERTER)(const void **, const void *, void **, void *, CONVERSION_FLAGS);
+
+static apr_uint32_t randomState;
+static apr_uint32_t compared = 0;
+static apr_uint32_t failures = 0;
+
+/*++
+
+Random
+
+    Returns a pseudo-random number (xorshift).
+
+Arguments:
+    range   - Upper bound of the number, exclusive.
+
+Return Values:
+    A number from zero to range-1.
+
+--*/
+static
+apr_uint32_t
+Random(
+    apr_uint32_t range
+    )
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState % range;
+}
+
+/*++
+
+Failed
+
+    Reports a mismatch.
+
+Arguments:
+    name    - Name of the conversion.
+
+    what    - What was different.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+Failed(
+    const char *name,
+    const char *what
+    )
+{
+    if (++failures <= 20) {
+        printf("Mismatch in %s: %s (conversion %u).\n", name, what, compared);
+    }
+}
+
+/*++
+
+GenerateText
+
+    Generates a random sequence of characters, most of them in ASCII runs.
+
+Arguments:
+    chars   - Array of MAX_CHARS characters to receive the text.
+
+    illegal - Include surrogates and values above U+10FFFF.
+
+Return Values:
+    Number of characters generated.
+
+--*/
+static
+apr_size_t
+GenerateText(
+    utf32_t *chars,
+    bool_t illegal
+    )
+{
+    apr_size_t count = Random(MAX_CHARS);
+    apr_size_t i = 0;
+    apr_size_t run;
+
+    while (i < count) {
+        switch (Random(8)) {
+            case 0:
+                chars[i++] = 0x80 + Random(0x80);
+                break;
+            case 1:
+                chars[i++] = 0x100 + Random(0xD800 - 0x100);
+                break;
+            case 2:
+                chars[i++] = 0x10000 + Random(0x100000);
+                break;
+            case 3:
+                if (illegal) {
+                    chars[i++] = Random(2) ? 0xD800 + Random(0x800) : 0x110000 + Random(0x7FEF0000);
+                    break;
+                }
+                // Fall through
+            default:
+                // Runs long enough for every vector width, ending anywhere in a block
+                for (run = Random(80) + 1; run > 0 && i < count; run--) {
+                    chars[i++] = Random(0x80);
+                }
+        }
+    }
+    return count;
+}
+
+/*++
+
+EncodeUTF8
+
+    Encodes characters as UTF-8, including values that are not legal.
+
+Arguments:
+    chars   - Array of characters.
+
+    count   - Number of characters.
+
+    buffer  - Buffer of at least count*6 bytes to receive the text.
+
+Return Values:
+    Length of the encoded text, in bytes.
+
+--*/
+static
+apr_size_t
+EncodeUTF8(
+    const utf32_t *chars,
+    apr_size_t count,
+    utf8_t *buffer
+    )
+{
+    apr_size_t i;
+    apr_size_t length = 0;
+    int bytes;
+    int j;
+    utf32_t ch;
+    static const utf8_t marks[7] = {0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC};
+
+    for (i = 0; i < count; i++) {
+        ch = chars[i];
+        bytes = (ch < 0x80) ? 1 : (ch < 0x800) ? 2 : (ch < 0x10000) ? 3 :
+                (ch < 0x200000) ? 4 : (ch < 0x4000000) ? 5 : 6;
+
+        for (j = bytes - 1; j > 0; j--) {
+            buffer[length + j] = (utf8_t)(0x80 | (ch & 0x3F));
+            ch >>= 6;
+        }
+        buffer[length] = (utf8_t)(ch | marks[bytes]);
+        length += bytes;
+    }
+    return length;
+}
+
+/*++
+
+EncodeUTF16
+
+    Encodes characters as UTF-16. Surrogates are written as single units,
+    and values above U+10FFFF as random units.
+
+Arguments:
+    chars   - Array of characters.
+
+    count   - Number of characters.
+
+    buffer  - Buffer of at least count*2 units to receive the text.
+
+Return Values:
+    Length of the encoded text, in units.
+
+--*/
+static
+apr_size_t
+EncodeUTF16(
+    const utf32_t *chars,
+    apr_size_t count,
+    utf16_t *buffer
+    )
+{
+    apr_size_t i;
+    apr_size_t length = 0;
+    utf32_t ch;
+
+    for (i = 0; i < count; i++) {
+        ch = chars[i];
+        if (ch < 0x10000) {
+            buffer[length++] = (utf16_t)ch;
+        } else if (ch <= 0x10FFFF) {
+            ch -= 0x10000;
+            buffer[length++] = (utf16_t)(0xD800 + (ch >> 10));
+            buffer[length++] = (utf16_t)(0xDC00 + (ch & 0x3FF));
+        } else {
+            buffer[length++] = (utf16_t)Random(0x10000);
+        }
+    }
+    return length;
+}
+
+/*++
+
+Corrupt
+
+    Overwrites a few random bytes of a buffer, or none.
+
+Arguments:
+    buffer  - Buffer to corrupt.
+
+    length  - Length of the buffer, in bytes.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+Corrupt(
+    apr_byte_t *buffer,
+    apr_size_t length
+    )
+{
+    apr_uint32_t count;
+
+    if (length == 0 || Random(4) != 0) {
+        return;
+    }
+    for (count = Random(3) + 1; count > 0; count--) {
+        buffer[Random((apr_uint32_t)length)] = (apr_byte_t)Random(0x100);
+    }
+}
+
+/*++
+
+Compare
+
+    Runs a conversion and its reference, and compares the results.
+
+Arguments:
+    name        - Name of the conversion.
+
+    convert     - Converter to test.
+
+    reference   - Reference converter.
+
+    source      - Pointer to the source text.
+
+    units       - Length of the source text, in units.
+
+    inSize      - Size of a source unit, in bytes.
+
+    outSize     - Size of a target unit, in bytes.
+
+    flags       - Conversion flags.
+
+    pool        - Pool to allocate the targets from.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+Compare(
+    const char *name,
+    CONVERTER convert,
+    CONVERTER reference,
+    const void *source,
+    apr_size_t units,
+    apr_size_t inSize,
+    apr_size_t outSize,
+    CONVERSION_FLAGS flags,
+    apr_pool_t *pool
+    )
+{
+    apr_size_t capacity;
+    apr_byte_t *target[2];
+    const void *sourcePos[2];
+    void *targetPos[2];
+    CONVERSION_RESULT result[2];
+    int i;
+
+    // Enough room for every character, or a random amount less
+    capacity = units * 4;
+    if (Random(2)) {
+        capacity = Random((apr_uint32_t)capacity + 1);
+    }
+
+    for (i = 0; i < 2; i++) {
+        target[i] = apr_palloc(pool, capacity * outSize + GUARD_SIZE);
+        memset(target[i], 0xCD, capacity * outSize + GUARD_SIZE);
+
+        sourcePos[i] = source;
+        targetPos[i] = target[i];
+        result[i] = (i == 0 ? convert : reference)(&sourcePos[i], (const apr_byte_t *)source + units * inSize,
+            &targetPos[i], target[i] + capacity * outSize, flags);
+    }
+    compared++;
+
+    if (result[0] != result[1]) {
+        Failed(name, "result");
+    } else if (sourcePos[0] != sourcePos[1]) {
+        Failed(name, "source position");
+    } else if ((apr_byte_t *)targetPos[0] - target[0] != (apr_byte_t *)targetPos[1] - target[1]) {
+        Failed(name, "target position");
+    } else if (memcmp(target[0], target[1], capacity * outSize + GUARD_SIZE) != 0) {
+        Failed(name, "target buffer");
+    }
+}
+
+/*++
+
+TestConverters
+
+    Compares every UTF converter with its reference on one generated text.
+
+Arguments:
+    pool    - Pool to allocate buffers from.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+TestConverters(
+    apr_pool_t *pool
+    )
+{
+    apr_size_t count;
+    apr_size_t length;
+    CONVERSION_FLAGS flags;
+    utf8_t *utf8;
+    utf16_t *utf16;
+    utf32_t *utf32;
+    utf32_t chars[MAX_CHARS];
+
+    count = GenerateText(chars, Random(2));
+    flags = Random(2) ? strictConversion : lenientConversion;
+
+    // The sources are allocated to their exact size, to catch reads past the end
+    utf8 = apr_palloc(pool, count * 6 + 1);
+    length = EncodeUTF8(chars, count, utf8);
+    Corrupt(utf8, length);
+    utf8 = apr_pmemdup(pool, utf8, length + 1);
+    Compare("UTF-8 to UTF-16", (CONVERTER)ConvertUTF8toUTF16, (CONVERTER)RefConvertUTF8toUTF16, utf8, length, 1, 2, flags, pool);
+    Compare("UTF-8 to UTF-32", (CONVERTER)ConvertUTF8toUTF32, (CONVERTER)RefConvertUTF8toUTF32, utf8, length, 1, 4, flags, pool);
+
+    utf16 = apr_palloc(pool, count * 2 * sizeof(utf16_t) + 1);
+    length = EncodeUTF16(chars, count, utf16);
+    Corrupt((apr_byte_t *)utf16, length * sizeof(utf16_t));
+    utf16 = apr_pmemdup(pool, utf16, length * sizeof(utf16_t) + 1);
+    Compare("UTF-16 to UTF-8", (CONVERTER)ConvertUTF16toUTF8, (CONVERTER)RefConvertUTF16toUTF8, utf16, length, 2, 1, flags, pool);
+    Compare("UTF-16 to UTF-32", (CONVERTER)ConvertUTF16toUTF32, (CONVERTER)RefConvertUTF16toUTF32, utf16, length, 2, 4, flags, pool);
+
+    utf32 = apr_pmemdup(pool, chars, count * sizeof(utf32_t) + 1);
+    Corrupt((apr_byte_t *)utf32, count * sizeof(utf32_t));
+    Compare("UTF-32 to UTF-8", (CONVERTER)ConvertUTF32toUTF8, (CONVERTER)RefConvertUTF32toUTF8, utf32, count, 4, 1, flags, pool);
+    Compare("UTF-32 to UTF-16", (CONVERTER)ConvertUTF32toUTF16, (CONVERTER)RefConvertUTF32toUTF16, utf32, count, 4, 2, flags, pool);
+}
+
+/*++
+
+ExpectedStatus
+
+    Translates the result of a reference converter to the status code that
+    EncConvertBuffer returns.
+
+Arguments:
+    result  - Conversion result.
+
+    partial - The input ends with a partial unit.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+ExpectedStatus(
+    CONVERSION_RESULT result,
+    bool_t partial
+    )
+{
+    switch (result) {
+        case conversionOK:
+            return partial ? APR_INCOMPLETE : APR_SUCCESS;
+        case sourceExhausted:
+            return APR_INCOMPLETE;
+        case targetExhausted:
+            return APR_ENOSPC;
+        default:
+            return APR_EINVAL;
+    }
+}
+
+/*++
+
+ConvertSplit
+
+    Converts a buffer with EncConvertBuffer, in random pieces.
+
+Arguments:
+    inEnc       - Encoding of the input buffer.
+
+    in          - Pointer to the input buffer.
+
+    inLength    - Length of the input buffer, in bytes.
+
+    outEnc      - Encoding of the output buffer.
+
+    out         - Buffer to receive the output.
+
+    outLength   - Length of the output buffer, updated to the length of the
+                  converted data.
+
+    consumed    - Location to store the number of input bytes converted.
+
+Return Values:
+    Returns the status of the last call.
+
+--*/
+static
+apr_status_t
+ConvertSplit(
+    encoding_t inEnc,
+    const apr_byte_t *in,
+    apr_size_t inLength,
+    encoding_t outEnc,
+    apr_byte_t *out,
+    apr_size_t *outLength,
+    apr_size_t *consumed
+    )
+{
+    apr_byte_t *outPos = out;
+    apr_byte_t *outEnd;
+    apr_status_t status;
+    const apr_byte_t *inPos = in;
+    const apr_byte_t *inEnd = in;
+
+    for (;;) {
+        // The input window only grows, the rest of a partial character follows
+        inEnd  = MAX(inEnd, inPos) + Random(16) + 1;
+        inEnd  = MIN(inEnd, in + inLength);
+        outEnd = outPos + Random(16) + 4;
+        outEnd = MIN(outEnd, out + *outLength);
+
+        status = EncConvertBuffer(inEnc, &inPos, inEnd, outEnc, &outPos, outEnd);
+        if (inEnd < in + inLength && (status == APR_SUCCESS || status == APR_INCOMPLETE)) {
+            continue;
+        }
+        if (status == APR_ENOSPC && outEnd < out + *outLength) {
+            continue;
+        }
+        break;
+    }
+
+    *outLength = (apr_size_t)(outPos - out);
+    *consumed  = (apr_size_t)(inPos - in);
+    return status;
+}
+
+/*++
+
+CompareEncoding
+
+    Compares the result of EncConvertBuffer with the expected result, and with
+    the result of converting the input in pieces.
+
+Arguments:
+    name        - Name of the conversion.
+
+    inEnc       - Encoding of the input buffer.
+
+    in          - Pointer to the input buffer.
+
+    inLength    - Length of the input buffer, in bytes.
+
+    outEnc      - Encoding of the output buffer.
+
+    expected    - Expected output.
+
+    expectedLength - Length of the expected output, in bytes.
+
+    expectedUsed - Expected number of input bytes converted.
+
+    expectedStatus - Expected status code.
+
+    pool        - Pool to allocate buffers from.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+CompareEncoding(
+    const char *name,
+    encoding_t inEnc,
+    const apr_byte_t *in,
+    apr_size_t inLength,
+    encoding_t outEnc,
+    const apr_byte_t *expected,
+    apr_size_t expectedLength,
+    apr_size_t expectedUsed,
+    apr_status_t expectedStatus,
+    apr_pool_t *pool
+    )
+{
+    apr_byte_t *out;
+    apr_byte_t *outPos;
+    apr_size_t consumed;
+    apr_size_t length;
+    apr_status_t status;
+    const apr_byte_t *inPos = in;
+
+    length = inLength * 4 + 4;
+    out = apr_palloc(pool, length);
+    outPos = out;
+
+    status = EncConvertBuffer(inEnc, &inPos, in + inLength, outEnc, &outPos, out + length);
+    compared++;
+
+    if (status != expectedStatus) {
+        Failed(name, "status");
+    } else if ((apr_size_t)(inPos - in) != expectedUsed) {
+        Failed(name, "input position");
+    } else if ((apr_size_t)(outPos - out) != expectedLength || memcmp(out, expected, expectedLength) != 0) {
+        Failed(name, "output");
+    }
+
+    // Split into pieces, the same text must come out
+    status = ConvertSplit(inEnc, in, inLength, outEnc, out, &length, &consumed);
+    compared++;
+
+    if (status != expectedStatus) {
+        Failed(name, "status when split");
+    } else if (consumed != expectedUsed) {
+        Failed(name, "input position when split");
+    } else if (length != expectedLength || memcmp(out, expected, expectedLength) != 0) {
+        Failed(name, "output when split");
+    }
+}
+
+/*++
+
+TestEncodings
+
+    Compares each encoding conversion with the reference converters on one
+    generated text.
+
+Arguments:
+    pool    - Pool to allocate buffers from.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+TestEncodings(
+    apr_pool_t *pool
+    )
+{
+    apr_byte_t *in;
+    apr_byte_t *out;
+    apr_size_t count;
+    apr_size_t i;
+    apr_size_t length;
+    apr_size_t units;
+    bool_t bigEndian;
+    bool_t partial;
+    CONVERSION_RESULT result;
+    const utf8_t *utf8Pos;
+    const utf16_t *utf16Pos;
+    const utf32_t *utf32Pos;
+    utf8_t *utf8;
+    utf8_t *outPos;
+    utf16_t *utf16;
+    utf32_t *utf32;
+    utf32_t *utf32Out;
+    utf32_t chars[MAX_CHARS];
+
+    count = GenerateText(chars, Random(2));
+    bigEndian = Random(2);
+    partial = (Random(4) == 0);
+
+    // UTF-16 to UTF-8, the reference reads the units in host byte order
+    utf16 = apr_palloc(pool, count * 2 * sizeof(utf16_t) + 1);
+    units = EncodeUTF16(chars, count, utf16);
+    Corrupt((apr_byte_t *)utf16, units * sizeof(utf16_t));
+
+    in = apr_palloc(pool, units * 2 + 1);
+    for (i = 0; i < units; i++) {
+        in[i*2 + (bigEndian ? 0 : 1)] = (apr_byte_t)(utf16[i] >> 8);
+        in[i*2 + (bigEndian ? 1 : 0)] = (apr_byte_t)utf16[i];
+    }
+    in[units * 2] = (apr_byte_t)Random(0x100);
+
+    out = apr_palloc(pool, units * 4 + 1);
+    utf16Pos = utf16;
+    outPos = out;
+    result = RefConvertUTF16toUTF8(&utf16Pos, utf16 + units, &outPos, out + units * 4, strictConversion);
+    CompareEncoding("UTF-16 to UTF-8", bigEndian ? ENCODING_UTF16_BE : ENCODING_UTF16_LE,
+        in, units * 2 + partial, ENCODING_UTF8, out, (apr_size_t)(outPos - out),
+        (apr_size_t)(utf16Pos - utf16) * 2, ExpectedStatus(result, partial && result == conversionOK), pool);
+
+    // UTF-32 to UTF-8
+    utf32 = apr_pmemdup(pool, chars, count * sizeof(utf32_t) + 1);
+    Corrupt((apr_byte_t *)utf32, count * sizeof(utf32_t));
+
+    in = apr_palloc(pool, count * 4 + 3);
+    for (i = 0; i < count; i++) {
+        in[i*4 + (bigEndian ? 0 : 3)] = (apr_byte_t)(utf32[i] >> 24);
+        in[i*4 + (bigEndian ? 1 : 2)] = (apr_byte_t)(utf32[i] >> 16);
+        in[i*4 + (bigEndian ? 2 : 1)] = (apr_byte_t)(utf32[i] >> 8);
+        in[i*4 + (bigEndian ? 3 : 0)] = (apr_byte_t)utf32[i];
+    }
+    in[count * 4] = in[count * 4 + 1] = in[count * 4 + 2] = (apr_byte_t)Random(0x100);
+
+    // Values above U+10FFFF are reported where they are, not replaced
+    for (units = 0; units < count && utf32[units] <= 0x10FFFF; units++);
+
+    out = apr_palloc(pool, count * 4 + 1);
+    utf32Pos = utf32;
+    outPos = out;
+    result = RefConvertUTF32toUTF8(&utf32Pos, utf32 + units, &outPos, out + count * 4, strictConversion);
+    if (result == conversionOK && units < count) {
+        result = sourceIllegal;
+    }
+    CompareEncoding("UTF-32 to UTF-8", bigEndian ? ENCODING_UTF32_BE : ENCODING_UTF32_LE,
+        in, count * 4 + (partial ? Random(3) + 1 : 0), ENCODING_UTF8, out, (apr_size_t)(outPos - out),
+        (apr_size_t)(utf32Pos - utf32) * 4, ExpectedStatus(result, partial && result == conversionOK), pool);
+
+    // UTF-8 to Latin-1 and ASCII, characters that do not fit are replaced
+    utf8 = apr_palloc(pool, count * 6 + 1);
+    length = EncodeUTF8(chars, count, utf8);
+    Corrupt(utf8, length);
+
+    utf32Out = apr_palloc(pool, length * sizeof(utf32_t) + 1);
+    utf8Pos = utf8;
+    utf32 = utf32Out;
+    result = RefConvertUTF8toUTF32(&utf8Pos, utf8 + length, &utf32, utf32Out + length, strictConversion);
+    units = (apr_size_t)(utf32 - utf32Out);
+
+    out = apr_palloc(pool, units + 1);
+    for (i = 0; i < units; i++) {
+        out[i] = (apr_byte_t)((utf32Out[i] <= 0xFF) ? utf32Out[i] : '?');
+    }
+    CompareEncoding("UTF-8 to Latin-1", ENCODING_UTF8, utf8, length, ENCODING_LATIN1,
+        out, units, (apr_size_t)(utf8Pos - utf8), ExpectedStatus(result, FALSE), pool);
+
+    for (i = 0; i < units; i++) {
+        out[i] = (apr_byte_t)((utf32Out[i] <= 0x7F) ? utf32Out[i] : '?');
+    }
+    CompareEncoding("UTF-8 to ASCII", ENCODING_UTF8, utf8, length, ENCODING_ASCII,
+        out, units, (apr_size_t)(utf8Pos - utf8), ExpectedStatus(result, FALSE), pool);
+
+    // Latin-1 to UTF-8, every byte is a character
+    in = apr_palloc(pool, count + 1);
+    out = apr_palloc(pool, count * 2 + 1);
+    for (i = 0, length = 0; i < count; i++) {
+        in[i] = (apr_byte_t)chars[i];
+        if (in[i] < 0x80) {
+            out[length++] = in[i];
+        } else {
+            out[length++] = (apr_byte_t)(0xC0 | in[i] >> 6);
+            out[length++] = (apr_byte_t)(0x80 | (in[i] & 0x3F));
+        }
+    }
+    CompareEncoding("Latin-1 to UTF-8", ENCODING_LATIN1, in, count, ENCODING_UTF8,
+        out, length, count, APR_SUCCESS, pool);
+}
+
+int
+main(
+    int argc,
+    const char **argv
+    )
+{
+    apr_pool_t *pool;
+    apr_pool_t *subPool;
+    apr_uint32_t i;
+    apr_uint32_t iterations;
+
+    iterations  = (argc > 1) ? (apr_uint32_t)strtoul(argv[1], NULL, 10) : 100000;
+    randomState = (argc > 2) ? (apr_uint32_t)strtoul(argv[2], NULL, 10) : (apr_uint32_t)apr_time_now() | 1;
+    if (iterations == 0 || randomState == 0) {
+        printf("Usage: %s [iterations] [seed]\n", argv[0]);
+        return 1;
+    }
+    printf("Seed %u, %u iterations.\n", randomState, iterations);
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+    apr_pool_create(&subPool, pool);
+
+    for (i = 0; i < iterations; i++) {
+        TestConverters(subPool);
+        TestEncodings(subPool);
+        apr_pool_clear(subPool);
+    }
+
+    printf("Compared %u conversions, %u mismatches.\n", compared, failures);
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return (failures > 0) ? 1 : 0;
+}
@@ -38,14 +38,23 @@ Abstract:
 #   define APR_DECLARE_STATIC 1
 #endif
 #include "apr.h"
+#include "apr_atomic.h"
 #include "apr_env.h"
 #include "apr_errno.h"
 #include "apr_general.h"
 #include "apr_file_info.h"
 #include "apr_file_io.h"
+#include "apr_fnmatch.h"
+#include "apr_lib.h"
+#include "apr_mmap.h"
+#include "apr_network_io.h"
 #include "apr_strings.h"
 #include "apr_pools.h"
+#include "apr_thread_cond.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_proc.h"
 #include "apr_time.h"
+#include "apr_user.h"
 #ifdef WINDOWS
 #   include "arch/win32/apr_arch_utf8.h"
 #endif
@@ -65,11 +74,16 @@ typedef apr_byte_t bool_t;
 #include "zlib.h"
 
 // Functions and subsystems
+#include "archive.h"
 #include "cfgread.h"
 #include "crc32.h"
+#include "daemon.h"
+#include "dupedb.h"
 #include "dynstring.h"
 #include "encoding.h"
 #include "events.h"
+#include "media.h"
+#include "racestats.h"
 #include "logging.h"
 #include "stream.h"
 #include "template.h"
@@ -0,0 +1,1171 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Archive
+
+Abstract:
+    This module checks the integrity of uploaded ZIP and RAR archives,
+    without extracting them to disk.
+
+    ZIP - The central directory is read, and every member's local header is
+          checked against it. Stored and deflated members are decompressed
+          in memory and their CRC-32 checksums verified.
+
+    RAR - Every block header's checksum is verified, along with the volume
+          flags expected from the file name. Stored files, and the packed
+          data of files continued in the next volume, are checksummed.
+          Compressed files are not decompressed.
+
+    Archives are read through a fixed-size buffer, so checking a file takes
+    the same amount of memory regardless of its size.
+
+--*/
+
+#include "alcoholicz.h"
+
+// Size of the read buffer, large enough for the biggest ZIP end record
+// (including its comment) and the biggest RAR 1.5-4.x block header
+#define READ_BUFFER     (68 * 1024)
+
+// Size of the buffer that members are decompressed into
+#define INFLATE_BUFFER  (32 * 1024)
+
+// Internal status code, returned once the archive is found to be corrupt
+#define ARCHIVE_CORRUPT (APR_OS_START_USERERR + 1)
+
+// Reads little-endian integers
+#define GET16(p)    ((apr_uint16_t)((p)[0] | ((p)[1] << 8)))
+#define GET32(p)    ((apr_uint32_t)(p)[0] | ((apr_uint32_t)(p)[1] << 8) | \
+                     ((apr_uint32_t)(p)[2] << 16) | ((apr_uint32_t)(p)[3] << 24))
+#define GET64(p)    ((apr_uint64_t)GET32(p) | ((apr_uint64_t)GET32((p)+4) << 32))
+
+// Archive types
+#define TYPE_NONE       0
+#define TYPE_ZIP        1
+#define TYPE_RAR        2
+
+// Volume positions, from the file name
+#define VOLUME_ANY      0   // Single archive or unknown
+#define VOLUME_FIRST    1   // First volume (name.part1.rar)
+#define VOLUME_NEXT     2   // Later volume (name.r00, name.part2.rar)
+
+//
+// ZIP format
+//
+
+#define ZIP_LOCAL_SIG       0x04034B50
+#define ZIP_CENTRAL_SIG     0x02014B50
+#define ZIP_END_SIG         0x06054B50
+#define ZIP64_END_SIG       0x06064B50
+#define ZIP64_LOCATOR_SIG   0x07064B50
+
+#define ZIP_LOCAL_SIZE      30
+#define ZIP_CENTRAL_SIZE    46
+#define ZIP_END_SIZE        22
+#define ZIP64_END_SIZE      56
+#define ZIP64_LOCATOR_SIZE  20
+#define ZIP64_EXTRA_ID      0x0001
+
+#define ZIP_FLAG_ENCRYPTED  0x0001
+
+#define ZIP_METHOD_STORE    0
+#define ZIP_METHOD_DEFLATE  8
+
+//
+// RAR 1.5-4.x format
+//
+
+#define RAR_MAIN_HEAD       0x73
+#define RAR_FILE_HEAD       0x74
+#define RAR_NEWSUB_HEAD     0x7A
+#define RAR_END_HEAD        0x7B
+
+#define RAR_MAIN_VOLUME     0x0001
+#define RAR_MAIN_PASSWORD   0x0080
+#define RAR_MAIN_FIRSTVOL   0x0100
+
+#define RAR_FILE_SPLITBEFORE 0x0001
+#define RAR_FILE_SPLITAFTER 0x0002
+#define RAR_FILE_PASSWORD   0x0004
+#define RAR_FILE_LARGE      0x0100
+#define RAR_LONG_BLOCK      0x8000
+
+#define RAR_BLOCK_SIZE      7
+#define RAR_FILE_SIZE       32
+#define RAR_METHOD_STORE    0x30
+
+//
+// RAR 5.0 format
+//
+
+#define RAR5_MAIN_HEAD      1
+#define RAR5_FILE_HEAD      2
+#define RAR5_SERVICE_HEAD   3
+#define RAR5_CRYPT_HEAD     4
+#define RAR5_END_HEAD       5
+
+#define RAR5_HEAD_EXTRA     0x0001
+#define RAR5_HEAD_DATA      0x0002
+#define RAR5_HEAD_SPLITAFTER 0x0008
+#define RAR5_HEAD_SPLITBEFORE 0x0010
+
+#define RAR5_MAIN_VOLUME    0x0001
+#define RAR5_MAIN_NUMBER    0x0002
+
+#define RAR5_FILE_TIME      0x0002
+#define RAR5_FILE_CRC       0x0004
+
+#define RAR5_EXTRA_CRYPT    0x01
+
+typedef struct {
+    apr_file_t  *file;      // Archive file handle
+    apr_off_t   size;       // Size of the archive
+    apr_byte_t  *buffer;    // Read buffer, READ_BUFFER bytes
+    apr_byte_t  *output;    // Decompression buffer, INFLATE_BUFFER bytes
+    const char  *reason;    // Description of the corruption
+    apr_pool_t  *pool;      // Pool used for the description
+} ARCHIVE;
+
+
+/*++
+
+Corrupt
+
+    Records why an archive is corrupt.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    format  - Pointer to a buffer containing a printf-style format string.
+
+    ...     - Arguments to insert into 'format'.
+
+Return Values:
+    Always returns ARCHIVE_CORRUPT.
+
+--*/
+static
+apr_status_t
+Corrupt(
+    ARCHIVE *archive,
+    const char *format,
+    ...
+    )
+{
+    va_list argList;
+
+    va_start(argList, format);
+    archive->reason = apr_pvsprintf(archive->pool, format, argList);
+    va_end(argList);
+    return ARCHIVE_CORRUPT;
+}
+
+/*++
+
+ReadAt
+
+    Reads part of the archive into the read buffer.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    offset  - Offset of the data.
+
+    length  - Number of bytes to read, at most READ_BUFFER.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the data is past the
+    end of the archive.
+
+--*/
+static
+apr_status_t
+ReadAt(
+    ARCHIVE *archive,
+    apr_uint64_t offset,
+    apr_size_t length
+    )
+{
+    apr_off_t position = (apr_off_t)offset;
+    apr_status_t status;
+
+    ASSERT(length <= READ_BUFFER);
+
+    if (offset > (apr_uint64_t)archive->size || length > (apr_uint64_t)archive->size - offset) {
+        return Corrupt(archive, "truncated at offset %" APR_UINT64_T_FMT, offset);
+    }
+
+    status = apr_file_seek(archive->file, APR_SET, &position);
+    if (status == APR_SUCCESS) {
+        status = apr_file_read_full(archive->file, archive->buffer, length, NULL);
+    }
+    return status;
+}
+
+/*++
+
+CrcRange
+
+    Calculates the CRC-32 checksum of part of the archive.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    offset  - Offset of the data.
+
+    length  - Length of the data.
+
+    crc     - Pointer to a variable that receives the checksum.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+CrcRange(
+    ARCHIVE *archive,
+    apr_uint64_t offset,
+    apr_uint64_t length,
+    apr_uint32_t *crc
+    )
+{
+    apr_size_t chunk;
+    apr_status_t status = APR_SUCCESS;
+    uLong value = crc32(0L, Z_NULL, 0);
+
+    while (length > 0) {
+        chunk = (apr_size_t)MIN(length, READ_BUFFER);
+
+        status = ReadAt(archive, offset, chunk);
+        if (status != APR_SUCCESS) {
+            break;
+        }
+        value = crc32(value, archive->buffer, (uInt)chunk);
+
+        offset += chunk;
+        length -= chunk;
+    }
+
+    *crc = (apr_uint32_t)value;
+    return status;
+}
+
+/*++
+
+InflateRange
+
+    Decompresses a raw deflate stream from the archive, calculating the
+    CRC-32 checksum of the decompressed data.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    name    - Pointer to a null-terminated string that specifies the member name.
+
+    offset  - Offset of the compressed data.
+
+    length  - Length of the compressed data.
+
+    crc     - Pointer to a variable that receives the checksum.
+
+    outSize - Pointer to a variable that receives the decompressed size.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the stream is invalid.
+
+--*/
+static
+apr_status_t
+InflateRange(
+    ARCHIVE *archive,
+    const char *name,
+    apr_uint64_t offset,
+    apr_uint64_t length,
+    apr_uint32_t *crc,
+    apr_uint64_t *outSize
+    )
+{
+    apr_size_t chunk;
+    apr_status_t status = APR_SUCCESS;
+    int result = Z_OK;
+    uLong value = crc32(0L, Z_NULL, 0);
+    z_stream stream;
+
+    memset(&stream, 0, sizeof(z_stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return APR_ENOMEM;
+    }
+    *outSize = 0;
+
+    while (length > 0 && result != Z_STREAM_END) {
+        chunk = (apr_size_t)MIN(length, READ_BUFFER);
+
+        status = ReadAt(archive, offset, chunk);
+        if (status != APR_SUCCESS) {
+            break;
+        }
+        offset += chunk;
+        length -= chunk;
+
+        stream.next_in  = archive->buffer;
+        stream.avail_in = (uInt)chunk;
+        do {
+            stream.next_out  = archive->output;
+            stream.avail_out = INFLATE_BUFFER;
+
+            result = inflate(&stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                status = Corrupt(archive, "invalid compressed data in \"%s\" (%s)",
+                    name, (stream.msg != NULL) ? stream.msg : "unknown error");
+                goto done;
+            }
+
+            chunk = INFLATE_BUFFER - stream.avail_out;
+            value = crc32(value, archive->output, (uInt)chunk);
+            *outSize += chunk;
+        } while (stream.avail_out == 0 && result != Z_STREAM_END);
+    }
+
+    if (status == APR_SUCCESS && result != Z_STREAM_END) {
+        status = Corrupt(archive, "compressed data of \"%s\" is truncated", name);
+    }
+
+done:
+    inflateEnd(&stream);
+    *crc = (apr_uint32_t)value;
+    return status;
+}
+
+/*++
+
+CheckZipMember
+
+    Checks a ZIP member's local header and data against its central
+    directory entry.
+
+Arguments:
+    archive     - Pointer to an ARCHIVE structure.
+
+    name        - Pointer to a null-terminated string that specifies the member name.
+
+    entry       - Pointer to the member's central directory entry.
+
+    compSize    - Compressed size.
+
+    uncompSize  - Uncompressed size.
+
+    localOffset - Offset of the local header, adjusted for any leading data.
+
+    dataLimit   - Offset where member data must end (start of the central directory).
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the member is corrupt.
+
+--*/
+static
+apr_status_t
+CheckZipMember(
+    ARCHIVE *archive,
+    const char *name,
+    const apr_byte_t *entry,
+    apr_uint64_t compSize,
+    apr_uint64_t uncompSize,
+    apr_uint64_t localOffset,
+    apr_uint64_t dataLimit
+    )
+{
+    apr_status_t status;
+    apr_uint16_t flags;
+    apr_uint16_t method;
+    apr_uint32_t crc;
+    apr_uint32_t expected;
+    apr_uint64_t dataOffset;
+    apr_uint64_t outSize;
+
+    flags    = GET16(entry + 8);
+    method   = GET16(entry + 10);
+    expected = GET32(entry + 16);
+
+    status = ReadAt(archive, localOffset, ZIP_LOCAL_SIZE);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    if (GET32(archive->buffer) != ZIP_LOCAL_SIG) {
+        return Corrupt(archive, "missing local header for \"%s\"", name);
+    }
+    if (GET16(archive->buffer + 8) != method) {
+        return Corrupt(archive, "local header of \"%s\" does not match the central directory", name);
+    }
+
+    dataOffset = localOffset + ZIP_LOCAL_SIZE + GET16(archive->buffer + 26) + GET16(archive->buffer + 28);
+    if (dataOffset > dataLimit || compSize > dataLimit - dataOffset) {
+        return Corrupt(archive, "data of \"%s\" overlaps the central directory", name);
+    }
+
+    // Encrypted members cannot be checked without the password
+    if (flags & ZIP_FLAG_ENCRYPTED) {
+        LOG_DEBUG("Not checking encrypted ZIP member \"%s\".", name);
+        return APR_SUCCESS;
+    }
+
+    switch (method) {
+        case ZIP_METHOD_STORE:
+            if (compSize != uncompSize) {
+                return Corrupt(archive, "stored member \"%s\" has mismatched sizes", name);
+            }
+            status = CrcRange(archive, dataOffset, compSize, &crc);
+            break;
+
+        case ZIP_METHOD_DEFLATE:
+            status = InflateRange(archive, name, dataOffset, compSize, &crc, &outSize);
+            if (status == APR_SUCCESS && outSize != uncompSize) {
+                return Corrupt(archive, "size mismatch in \"%s\"", name);
+            }
+            break;
+
+        default:
+            LOG_DEBUG("Not checking ZIP member \"%s\" with method %u.", name, method);
+            return APR_SUCCESS;
+    }
+
+    if (status == APR_SUCCESS && crc != expected) {
+        status = Corrupt(archive, "CRC mismatch in \"%s\" (0x%08X, expected 0x%08X)", name, crc, expected);
+    }
+    return status;
+}
+
+/*++
+
+CheckZip
+
+    Checks the integrity of a ZIP archive.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the archive is corrupt.
+
+--*/
+static
+apr_status_t
+CheckZip(
+    ARCHIVE *archive
+    )
+{
+    apr_size_t length;
+    apr_size_t position;
+    apr_status_t status;
+    apr_uint16_t extraLength;
+    apr_uint16_t nameLength;
+    apr_uint64_t cdOffset;
+    apr_uint64_t cdSize;
+    apr_uint64_t compSize;
+    apr_uint64_t delta;
+    apr_uint64_t endOffset;
+    apr_uint64_t entries;
+    apr_uint64_t i;
+    apr_uint64_t localOffset;
+    apr_uint64_t offset;
+    apr_uint64_t uncompSize;
+    const apr_byte_t *end;
+    const apr_byte_t *extra;
+    apr_byte_t entry[ZIP_CENTRAL_SIZE];
+    char name[256];
+
+    // The end record is at the end of the file, followed by a comment
+    length = (apr_size_t)MIN(archive->size, READ_BUFFER);
+    if (length < ZIP_END_SIZE) {
+        return Corrupt(archive, "too small for a ZIP archive");
+    }
+    status = ReadAt(archive, archive->size - length, length);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    for (position = length - ZIP_END_SIZE; ; position--) {
+        if (GET32(archive->buffer + position) == ZIP_END_SIG &&
+                position + ZIP_END_SIZE + GET16(archive->buffer + position + 20) <= length) {
+            break;
+        }
+        if (position == 0) {
+            return Corrupt(archive, "end of central directory not found");
+        }
+    }
+    end       = archive->buffer + position;
+    endOffset = archive->size - length + position;
+
+    // Spanned archives cannot be checked one file at a time
+    if (GET16(end + 4) != 0 || GET16(end + 6) != 0) {
+        LOG_DEBUG("Not checking spanned ZIP archive.", 0);
+        return APR_SUCCESS;
+    }
+    entries  = GET16(end + 10);
+    cdSize   = GET32(end + 12);
+    cdOffset = GET32(end + 16);
+
+    if (entries == 0xFFFF || cdSize == 0xFFFFFFFF || cdOffset == 0xFFFFFFFF) {
+        // ZIP64 archive, the real values are in the ZIP64 end record
+        if (endOffset < ZIP64_LOCATOR_SIZE) {
+            return Corrupt(archive, "ZIP64 end locator not found");
+        }
+        status = ReadAt(archive, endOffset - ZIP64_LOCATOR_SIZE, ZIP64_LOCATOR_SIZE);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (GET32(archive->buffer) != ZIP64_LOCATOR_SIG) {
+            return Corrupt(archive, "ZIP64 end locator not found");
+        }
+        offset = GET64(archive->buffer + 8);
+
+        status = ReadAt(archive, offset, ZIP64_END_SIZE);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (GET32(archive->buffer) != ZIP64_END_SIG) {
+            return Corrupt(archive, "ZIP64 end record not found");
+        }
+        entries   = GET64(archive->buffer + 32);
+        cdSize    = GET64(archive->buffer + 40);
+        cdOffset  = GET64(archive->buffer + 48);
+        endOffset = offset;
+    }
+
+    // Data prepended to the archive (e.g. a self-extractor) shifts every offset
+    if (cdOffset > endOffset || cdSize > endOffset - cdOffset) {
+        return Corrupt(archive, "central directory is past the end of the archive");
+    }
+    delta  = endOffset - (cdOffset + cdSize);
+    offset = cdOffset + delta;
+
+    for (i = 0; i < entries; i++) {
+        if (offset + ZIP_CENTRAL_SIZE > endOffset) {
+            return Corrupt(archive, "central directory is truncated");
+        }
+        status = ReadAt(archive, offset, ZIP_CENTRAL_SIZE);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (GET32(archive->buffer) != ZIP_CENTRAL_SIG) {
+            return Corrupt(archive, "invalid central directory entry");
+        }
+        memcpy(entry, archive->buffer, ZIP_CENTRAL_SIZE);
+
+        nameLength  = GET16(entry + 28);
+        extraLength = GET16(entry + 30);
+        compSize    = GET32(entry + 20);
+        uncompSize  = GET32(entry + 24);
+        localOffset = GET32(entry + 42);
+
+        // Read the name and extra field, which follow the entry
+        length = (apr_size_t)MIN((apr_uint32_t)nameLength + extraLength, READ_BUFFER);
+        status = ReadAt(archive, offset + ZIP_CENTRAL_SIZE, length);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        apr_cpystrn(name, (const char *)archive->buffer, MIN(sizeof(name), (apr_size_t)nameLength + 1));
+
+        // Sizes and offsets that do not fit are in the ZIP64 extra field
+        if (compSize == 0xFFFFFFFF || uncompSize == 0xFFFFFFFF || localOffset == 0xFFFFFFFF) {
+            extra = archive->buffer + nameLength;
+            while (extra + 4 <= archive->buffer + length) {
+                if (GET16(extra) == ZIP64_EXTRA_ID) {
+                    const apr_byte_t *field = extra + 4;
+                    const apr_byte_t *fieldEnd = field + GET16(extra + 2);
+
+                    if (uncompSize == 0xFFFFFFFF && field + 8 <= fieldEnd) {
+                        uncompSize = GET64(field);
+                        field += 8;
+                    }
+                    if (compSize == 0xFFFFFFFF && field + 8 <= fieldEnd) {
+                        compSize = GET64(field);
+                        field += 8;
+                    }
+                    if (localOffset == 0xFFFFFFFF && field + 8 <= fieldEnd) {
+                        localOffset = GET64(field);
+                    }
+                    break;
+                }
+                extra += 4 + GET16(extra + 2);
+            }
+        }
+
+        offset += ZIP_CENTRAL_SIZE + nameLength + extraLength + GET16(entry + 32);
+
+        status = CheckZipMember(archive, name, entry, compSize, uncompSize,
+            localOffset + delta, cdOffset + delta);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+/*++
+
+CheckRarFile
+
+    Checks the data of a file block in a RAR 1.5-4.x archive.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    header  - Pointer to the file header, in the read buffer.
+
+    flags   - Block flags.
+
+    offset  - Offset of the file data.
+
+    size    - Size of the file data.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the file is corrupt.
+
+--*/
+static
+apr_status_t
+CheckRarFile(
+    ARCHIVE *archive,
+    const apr_byte_t *header,
+    apr_uint16_t flags,
+    apr_uint64_t offset,
+    apr_uint64_t size
+    )
+{
+    apr_size_t nameOffset;
+    apr_status_t status;
+    apr_uint32_t crc;
+    apr_uint32_t expected;
+    char name[256];
+
+    nameOffset = (flags & RAR_FILE_LARGE) ? RAR_FILE_SIZE + 8 : RAR_FILE_SIZE;
+    if (nameOffset + GET16(header + 26) > GET16(header + 5)) {
+        return Corrupt(archive, "invalid file header");
+    }
+    apr_cpystrn(name, (const char *)header + nameOffset, MIN(sizeof(name), (apr_size_t)GET16(header + 26) + 1));
+
+    expected = GET32(header + 16);
+
+    if (flags & RAR_FILE_SPLITAFTER) {
+        // Parts continued in the next volume store the packed data's checksum
+        // (since RAR 2.0, older versions store 0xFFFFFFFF)
+        if (header[24] < 20 || expected == 0xFFFFFFFF) {
+            return APR_SUCCESS;
+        }
+    } else if ((flags & (RAR_FILE_SPLITBEFORE|RAR_FILE_PASSWORD)) || header[25] != RAR_METHOD_STORE) {
+        // Only whole, stored, unencrypted files can be checked
+        return APR_SUCCESS;
+    }
+
+    status = CrcRange(archive, offset, size, &crc);
+    if (status == APR_SUCCESS && crc != expected) {
+        status = Corrupt(archive, "CRC mismatch in \"%s\" (0x%08X, expected 0x%08X)", name, crc, expected);
+    }
+    return status;
+}
+
+/*++
+
+CheckRar
+
+    Checks the integrity of a RAR 1.5-4.x archive.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    volume  - Volume position expected from the file name.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the archive is corrupt.
+
+--*/
+static
+apr_status_t
+CheckRar(
+    ARCHIVE *archive,
+    int volume
+    )
+{
+    apr_byte_t type;
+    apr_status_t status;
+    apr_uint16_t flags;
+    apr_uint16_t size;
+    apr_uint64_t dataSize;
+    apr_uint64_t offset = 7;
+    bool_t mainFound = FALSE;
+
+    while (offset < (apr_uint64_t)archive->size) {
+        status = ReadAt(archive, offset, RAR_BLOCK_SIZE);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        type  = archive->buffer[2];
+        flags = GET16(archive->buffer + 3);
+        size  = GET16(archive->buffer + 5);
+        if (size < RAR_BLOCK_SIZE) {
+            return Corrupt(archive, "invalid block header at offset %" APR_UINT64_T_FMT, offset);
+        }
+
+        status = ReadAt(archive, offset, size);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if ((crc32(0L, archive->buffer + 2, size - 2) & 0xFFFF) != GET16(archive->buffer)) {
+            return Corrupt(archive, "header CRC mismatch at offset %" APR_UINT64_T_FMT, offset);
+        }
+
+        // File blocks are always followed by data
+        dataSize = 0;
+        if (type == RAR_FILE_HEAD || type == RAR_NEWSUB_HEAD) {
+            if (size < RAR_FILE_SIZE || ((flags & RAR_FILE_LARGE) && size < RAR_FILE_SIZE + 8)) {
+                return Corrupt(archive, "invalid file header at offset %" APR_UINT64_T_FMT, offset);
+            }
+            dataSize = GET32(archive->buffer + 7);
+            if (flags & RAR_FILE_LARGE) {
+                dataSize |= (apr_uint64_t)GET32(archive->buffer + RAR_FILE_SIZE) << 32;
+            }
+        } else if (flags & RAR_LONG_BLOCK) {
+            if (size < RAR_BLOCK_SIZE + 4) {
+                return Corrupt(archive, "invalid block header at offset %" APR_UINT64_T_FMT, offset);
+            }
+            dataSize = GET32(archive->buffer + 7);
+        }
+
+        if (!mainFound && type != RAR_MAIN_HEAD) {
+            return Corrupt(archive, "archive header not found");
+        }
+        if (offset + size > (apr_uint64_t)archive->size ||
+                dataSize > (apr_uint64_t)archive->size - offset - size) {
+            return Corrupt(archive, "truncated at offset %" APR_UINT64_T_FMT, offset);
+        }
+
+        switch (type) {
+            case RAR_MAIN_HEAD:
+                mainFound = TRUE;
+                if (volume != VOLUME_ANY && !(flags & RAR_MAIN_VOLUME)) {
+                    return Corrupt(archive, "not a volume");
+                }
+                if (volume == VOLUME_NEXT && (flags & RAR_MAIN_FIRSTVOL)) {
+                    return Corrupt(archive, "first volume named as a later volume");
+                }
+                if (flags & RAR_MAIN_PASSWORD) {
+                    // The remaining headers are encrypted
+                    return APR_SUCCESS;
+                }
+                break;
+
+            case RAR_FILE_HEAD:
+                status = CheckRarFile(archive, archive->buffer, flags, offset + size, dataSize);
+                if (status != APR_SUCCESS) {
+                    return status;
+                }
+                break;
+
+            case RAR_END_HEAD:
+                return APR_SUCCESS;
+        }
+
+        offset += size + dataSize;
+    }
+
+    return mainFound ? APR_SUCCESS : Corrupt(archive, "archive header not found");
+}
+
+/*++
+
+GetVint
+
+    Reads a variable-length integer from a RAR 5.0 header.
+
+Arguments:
+    data    - Pointer to the current position, updated past the integer.
+
+    end     - Pointer to the end of the header.
+
+    value   - Pointer to a variable that receives the integer.
+
+Return Values:
+    If the integer is valid, the return is nonzero (true).
+
+    If the integer extends past the header, the return is zero (false).
+
+--*/
+static
+bool_t
+GetVint(
+    const apr_byte_t **data,
+    const apr_byte_t *end,
+    apr_uint64_t *value
+    )
+{
+    const apr_byte_t *p = *data;
+    int shift;
+
+    *value = 0;
+    for (shift = 0; p < end && shift < 64; shift += 7) {
+        *value |= (apr_uint64_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80)) {
+            *data = p;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*++
+
+CheckRar5File
+
+    Checks the data of a file block in a RAR 5.0 archive.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    data    - Pointer to the type-specific part of the file header.
+
+    end     - Pointer to the end of the type-specific part (start of the extra area).
+
+    extraEnd - Pointer to the end of the extra area.
+
+    flags   - Header flags.
+
+    offset  - Offset of the file data.
+
+    size    - Size of the file data.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the file is corrupt.
+
+--*/
+static
+apr_status_t
+CheckRar5File(
+    ARCHIVE *archive,
+    const apr_byte_t *data,
+    const apr_byte_t *end,
+    const apr_byte_t *extraEnd,
+    apr_uint64_t flags,
+    apr_uint64_t offset,
+    apr_uint64_t size
+    )
+{
+    apr_status_t status;
+    apr_uint32_t crc;
+    apr_uint32_t expected = 0;
+    apr_uint64_t compInfo;
+    apr_uint64_t fileFlags;
+    apr_uint64_t length;
+    apr_uint64_t type;
+    apr_uint64_t value;
+    const apr_byte_t *next;
+    char name[256];
+
+    if (!GetVint(&data, end, &fileFlags) || !GetVint(&data, end, &value) ||
+            !GetVint(&data, end, &value)) {
+        return Corrupt(archive, "invalid file header");
+    }
+    if (fileFlags & RAR5_FILE_TIME) {
+        data += 4;
+    }
+    if (fileFlags & RAR5_FILE_CRC) {
+        if (data + 4 > end) {
+            return Corrupt(archive, "invalid file header");
+        }
+        expected = GET32(data);
+        data += 4;
+    }
+    if (data > end || !GetVint(&data, end, &compInfo) || !GetVint(&data, end, &value) ||
+            !GetVint(&data, end, &length) || length > (apr_uint64_t)(end - data)) {
+        return Corrupt(archive, "invalid file header");
+    }
+    apr_cpystrn(name, (const char *)data, (apr_size_t)MIN(sizeof(name), length + 1));
+
+    // Encrypted files store a keyed checksum
+    for (data = end; data < extraEnd; data = next) {
+        if (!GetVint(&data, extraEnd, &length) || length > (apr_uint64_t)(extraEnd - data)) {
+            return Corrupt(archive, "invalid extra area in \"%s\"", name);
+        }
+        next = data + length;
+        if (GetVint(&data, next, &type) && type == RAR5_EXTRA_CRYPT) {
+            return APR_SUCCESS;
+        }
+    }
+
+    if (!(fileFlags & RAR5_FILE_CRC)) {
+        return APR_SUCCESS;
+    }
+    if (!(flags & RAR5_HEAD_SPLITAFTER)) {
+        // Only whole, stored files can be checked
+        if ((flags & RAR5_HEAD_SPLITBEFORE) || ((compInfo >> 7) & 7) != 0) {
+            return APR_SUCCESS;
+        }
+    }
+
+    status = CrcRange(archive, offset, size, &crc);
+    if (status == APR_SUCCESS && crc != expected) {
+        status = Corrupt(archive, "CRC mismatch in \"%s\" (0x%08X, expected 0x%08X)", name, crc, expected);
+    }
+    return status;
+}
+
+/*++
+
+CheckRar5
+
+    Checks the integrity of a RAR 5.0 archive.
+
+Arguments:
+    archive - Pointer to an ARCHIVE structure.
+
+    volume  - Volume position expected from the file name.
+
+Return Values:
+    Returns an APR status code, or ARCHIVE_CORRUPT if the archive is corrupt.
+
+--*/
+static
+apr_status_t
+CheckRar5(
+    ARCHIVE *archive,
+    int volume
+    )
+{
+    apr_size_t length;
+    apr_status_t status;
+    apr_uint64_t dataSize;
+    apr_uint64_t extraSize;
+    apr_uint64_t flags;
+    apr_uint64_t offset = 8;
+    apr_uint64_t size;
+    apr_uint64_t type;
+    apr_uint64_t value;
+    const apr_byte_t *data;
+    const apr_byte_t *end;
+    bool_t mainFound = FALSE;
+
+    while (offset < (apr_uint64_t)archive->size) {
+        // Header CRC-32 and size, the size is at most three bytes long
+        length = (apr_size_t)MIN((apr_uint64_t)archive->size - offset, 7);
+        status = ReadAt(archive, offset, length);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        data = archive->buffer + 4;
+        if (length < 5 || !GetVint(&data, archive->buffer + length, &size) || size == 0) {
+            return Corrupt(archive, "invalid block header at offset %" APR_UINT64_T_FMT, offset);
+        }
+        length = (apr_size_t)(data - archive->buffer);
+
+        if (length + size > READ_BUFFER) {
+            LOG_DEBUG("Not checking RAR block larger than %u bytes.", READ_BUFFER);
+            return APR_SUCCESS;
+        }
+        status = ReadAt(archive, offset, length + (apr_size_t)size);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if ((apr_uint32_t)crc32(0L, archive->buffer + 4, (uInt)(length - 4 + size)) != GET32(archive->buffer)) {
+            return Corrupt(archive, "header CRC mismatch at offset %" APR_UINT64_T_FMT, offset);
+        }
+
+        data = archive->buffer + length;
+        end  = data + size;
+        extraSize = dataSize = 0;
+        if (!GetVint(&data, end, &type) || !GetVint(&data, end, &flags) ||
+                ((flags & RAR5_HEAD_EXTRA) && !GetVint(&data, end, &extraSize)) ||
+                ((flags & RAR5_HEAD_DATA) && !GetVint(&data, end, &dataSize)) ||
+                extraSize > (apr_uint64_t)(end - data)) {
+            return Corrupt(archive, "invalid block header at offset %" APR_UINT64_T_FMT, offset);
+        }
+
+        if (!mainFound && type != RAR5_MAIN_HEAD && type != RAR5_CRYPT_HEAD) {
+            return Corrupt(archive, "archive header not found");
+        }
+        offset += length + size;
+        if (dataSize > (apr_uint64_t)archive->size - offset) {
+            return Corrupt(archive, "truncated at offset %" APR_UINT64_T_FMT, offset);
+        }
+
+        switch (type) {
+            case RAR5_MAIN_HEAD:
+                mainFound = TRUE;
+                if (!GetVint(&data, end, &value)) {
+                    return Corrupt(archive, "invalid archive header");
+                }
+                if (volume != VOLUME_ANY && !(value & RAR5_MAIN_VOLUME)) {
+                    return Corrupt(archive, "not a volume");
+                }
+                if (volume == VOLUME_NEXT && !(value & RAR5_MAIN_NUMBER)) {
+                    return Corrupt(archive, "first volume named as a later volume");
+                }
+                if (volume == VOLUME_FIRST && (value & RAR5_MAIN_NUMBER)) {
+                    return Corrupt(archive, "later volume named as the first volume");
+                }
+                break;
+
+            case RAR5_FILE_HEAD:
+                status = CheckRar5File(archive, data, end - extraSize, end, flags, offset, dataSize);
+                if (status != APR_SUCCESS) {
+                    return status;
+                }
+                break;
+
+            case RAR5_CRYPT_HEAD:
+                // The remaining headers are encrypted
+                return APR_SUCCESS;
+
+            case RAR5_END_HEAD:
+                return APR_SUCCESS;
+        }
+
+        offset += dataSize;
+    }
+
+    return mainFound ? APR_SUCCESS : Corrupt(archive, "archive header not found");
+}
+
+/*++
+
+GetArchiveType
+
+    Determines the archive type and volume position from a file name.
+
+Arguments:
+    path    - Pointer to a null-terminated string that specifies the file path.
+
+    volume  - Pointer to a variable that receives the volume position.
+
+Return Values:
+    Archive type, TYPE_NONE if the file is not a supported archive.
+
+--*/
+static
+int
+GetArchiveType(
+    const char *path,
+    int *volume
+    )
+{
+    const char *ext;
+    const char *part;
+    const char *name = apr_filepath_name_get(path);
+
+    *volume = VOLUME_ANY;
+    ext = strrchr(name, '.');
+    if (ext == NULL) {
+        return TYPE_NONE;
+    }
+
+    if (strcasecmp(ext, ".zip") == 0) {
+        return TYPE_ZIP;
+    }
+
+    if (strcasecmp(ext, ".rar") == 0) {
+        // New volume naming: name.part01.rar, name.part02.rar, ...
+        for (part = ext; part > name && apr_isdigit(part[-1]); part--);
+        if (part < ext && part - name >= 5 && strncasecmp(part - 5, ".part", 5) == 0) {
+            *volume = (strtoul(part, NULL, 10) > 1) ? VOLUME_NEXT : VOLUME_FIRST;
+        }
+        return TYPE_RAR;
+    }
+
+    // Old volume naming: name.rar, name.r00, ..., name.r99, name.s00, ...
+    if ((ext[1] == 'r' || ext[1] == 'R' || ext[1] == 's' || ext[1] == 'S') &&
+            apr_isdigit(ext[2]) && apr_isdigit(ext[3]) && ext[4] == '\0') {
+        *volume = VOLUME_NEXT;
+        return TYPE_RAR;
+    }
+
+    return TYPE_NONE;
+}
+
+/*++
+
+ArchiveCheck
+
+    Checks the integrity of a ZIP or RAR archive.
+
+Arguments:
+    path    - Pointer to a null-terminated string that specifies the file path.
+
+    reason  - Pointer to a variable that receives a description of the
+              corruption, or null if the archive is intact, or is not an
+              archive.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code. A corrupt archive is not an error, check
+    the 'reason' argument.
+
+--*/
+apr_status_t
+ArchiveCheck(
+    const char *path,
+    const char **reason,
+    apr_pool_t *pool
+    )
+{
+    apr_finfo_t info;
+    apr_status_t status;
+    int type;
+    int volume;
+    ARCHIVE archive;
+
+    ASSERT(path   != NULL);
+    ASSERT(reason != NULL);
+    ASSERT(pool   != NULL);
+
+    *reason = NULL;
+    type = GetArchiveType(path, &volume);
+    if (type == TYPE_NONE) {
+        return APR_SUCCESS;
+    }
+
+    status = apr_file_open(&archive.file, path, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, archive.file);
+    if (status != APR_SUCCESS) {
+        apr_file_close(archive.file);
+        return status;
+    }
+
+    archive.size   = info.size;
+    archive.buffer = apr_palloc(pool, READ_BUFFER + INFLATE_BUFFER);
+    archive.output = archive.buffer + READ_BUFFER;
+    archive.reason = NULL;
+    archive.pool   = pool;
+    if (archive.buffer == NULL) {
+        apr_file_close(archive.file);
+        return APR_ENOMEM;
+    }
+
+    // The name determines the expected type, the signature the RAR format
+    status = ReadAt(&archive, 0, (apr_size_t)MIN(info.size, 8));
+    if (status == APR_SUCCESS) {
+        if (type == TYPE_ZIP) {
+            // ZIP archives are read from the end, they may start with a self-extractor
+            status = CheckZip(&archive);
+        } else if (info.size >= 7 && memcmp(archive.buffer, "Rar!\x1A\x07\x00", 7) == 0) {
+            status = CheckRar(&archive, volume);
+        } else if (info.size >= 8 && memcmp(archive.buffer, "Rar!\x1A\x07\x01\x00", 8) == 0) {
+            status = CheckRar5(&archive, volume);
+        } else {
+            status = Corrupt(&archive, "not a RAR archive");
+        }
+    }
+    apr_file_close(archive.file);
+
+    if (status == ARCHIVE_CORRUPT) {
+        *reason = archive.reason;
+        status  = APR_SUCCESS;
+    }
+    return status;
+}
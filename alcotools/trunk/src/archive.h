@@ -0,0 +1,24 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Archive
+
+Abstract:
+    Archive integrity checking function prototypes.
+
+--*/
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+apr_status_t
+ArchiveCheck(
+    const char *path,
+    const char **reason,
+    apr_pool_t *pool
+    );
+
+#endif // _ARCHIVE_H_
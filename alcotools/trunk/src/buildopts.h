@@ -48,6 +48,14 @@ Abstract:
 #   define CONFIG_FILE      "AlcoTools.conf"
 #endif
 
+//
+// CONFIG_SNAPSHOT <string>
+//  - Compiled configuration file name.
+//
+#ifndef CONFIG_SNAPSHOT
+#   define CONFIG_SNAPSHOT  CONFIG_FILE ".bin"
+#endif
+
 //
 // LOG_FILE     <string>
 //  - Log file name.
@@ -56,4 +64,25 @@ Abstract:
 #   define LOG_FILE         "AlcoTools.log"
 #endif
 
+//
+// LOG_ASYNC    <TRUE/FALSE>
+//  - Buffer log messages and write them in batches, instead of writing
+//    each message as it is logged.
+//
+#ifndef LOG_ASYNC
+#   define LOG_ASYNC        TRUE
+#endif
+
+//
+// DAEMON_SOCKET <string>
+//  - Local socket used to forward events to the resident daemon, it must be
+//    an absolute path and "%u" is replaced with the user ID. The socket's
+//    directory must belong to the user and not be writable by others; the
+//    daemon creates it if it does not exist. The ALCOTOOLS_SOCKET environment
+//    variable overrides it.
+//
+#ifndef DAEMON_SOCKET
+#   define DAEMON_SOCKET    "/tmp/AlcoTools-%u/AlcoTools.sock"
+#endif
+
 #endif // _BUILDOPTS_H_
@@ -15,15 +15,28 @@ Abstract:
     This is not the most foolproof scheme (e.g. CRC-32 checksum collisions),
     but it is "good enough" for this application.
 
+    The parsed file is compiled into a snapshot: a single file, mapped into
+    memory, where every key is found through a perfect hash of its checksums
+    and every value is already converted to each type. Later processes map
+    the snapshot instead of parsing the file, as long as the file is unchanged.
+
 --*/
 
+
 #include "alcoholicz.h"
 
-// Value types
-#define TYPE_ARRAY      1
-#define TYPE_BOOLEAN    2
-#define TYPE_INTEGER    3
-#define TYPE_STRING     4
+// Snapshot file magic ("ACFG") and format version
+#define SNAPSHOT_MAGIC      0x47464341
+#define SNAPSHOT_VERSION    1
+
+// Snapshot slot flags
+#define SLOT_USED           0x01    // Slot contains a key
+#define SLOT_BOOLEAN        0x02    // Value is a valid boolean
+#define SLOT_INTEGER        0x04    // Value is a valid integer
+#define SLOT_TRUE           0x08    // Boolean value, if valid
+
+// Number of perfect hash seeds to try before giving up
+#define HASH_ATTEMPTS       64
 
 // Forward type declarations
 typedef struct CONFIG_KEY CONFIG_KEY;
@@ -34,14 +47,8 @@ typedef struct CONFIG_SECTION_HEAD CONFIG_SECTION_HEAD;
 struct CONFIG_KEY {
     LIST_ENTRY(CONFIG_KEY)  link;   // Pointer to next section structure
     apr_uint32_t            crc;    // CRC-32 checksum of the key name.
-    apr_size_t              length; // Length of the string or number of array elements.
-    union {
-        char         **array;
-        bool_t       boolean;
-        apr_uint32_t integer;
-        char         *string;
-    }                       value;  // Internal value representation.
-    apr_byte_t              type;   // Value type.
+    apr_size_t              length; // Length of the value string.
+    char                    *value; // Value string.
 };
 LIST_HEAD(CONFIG_KEY_HEAD, CONFIG_KEY);
 
@@ -52,13 +59,65 @@ struct CONFIG_SECTION {
 };
 SLIST_HEAD(CONFIG_SECTION_HEAD, CONFIG_SECTION);
 
-// Section structure list head
+//
+// Snapshot layout:
+//
+// SNAPSHOT_HEADER
+// apr_uint32_t  displace[bucketCount]  - Perfect hash displacement of each bucket
+// SNAPSHOT_SLOT slots[tableSize]       - Keys, addressed by their perfect hash
+// apr_uint32_t  elements[elementCount] - Offsets of the array element strings
+// char          strings[]              - Null-terminated value and element strings
+//
+// The snapshot is written in the host's byte order, it is only a cache of
+// the configuration file and is rebuilt whenever the file changes.
+//
+
+typedef struct {
+    apr_uint32_t    magic;          // Snapshot magic
+    apr_uint32_t    version;        // Snapshot format version
+    apr_uint32_t    size;           // Size of the snapshot, in bytes
+    apr_uint32_t    seed;           // Perfect hash seed
+    apr_uint32_t    tableSize;      // Number of slots, a power of two
+    apr_uint32_t    bucketCount;    // Number of displacement buckets
+    apr_uint32_t    keyCount;       // Number of keys
+    apr_uint32_t    elementCount;   // Number of array elements, for all keys
+    apr_uint64_t    sourceSize;     // Size of the configuration file
+    apr_time_t      sourceTime;     // Modification time of the configuration file
+} SNAPSHOT_HEADER;
+
+typedef struct {
+    apr_uint32_t    sectionCrc;     // CRC-32 checksum of the section name
+    apr_uint32_t    keyCrc;         // CRC-32 checksum of the key name
+    apr_uint32_t    string;         // Offset of the value string
+    apr_uint32_t    length;         // Length of the value string
+    apr_uint32_t    elements;       // Index of the first array element
+    apr_uint32_t    count;          // Number of array elements
+    apr_uint32_t    integer;        // Integer value, if valid
+    apr_uint32_t    flags;          // Slot flags
+} SNAPSHOT_SLOT;
+
+typedef struct {
+    apr_uint32_t    bucket;         // Displacement bucket
+    apr_uint32_t    first;          // First slot probed
+    apr_uint32_t    step;           // Distance between probed slots, always odd
+} SNAPSHOT_HASH;
+
+// Section structure list head, only used while parsing
 static CONFIG_SECTION_HEAD sectionHead;
 
 // Sub-pool used for config allocations
 static apr_pool_t *cfgPool;
 
-
+// Snapshot in use, mapped from disk or built from the configuration file
+static char *snapBase;
+static const SNAPSHOT_HEADER *snapHeader;
+static const apr_uint32_t *snapDisplace;
+static const SNAPSHOT_SLOT *snapSlots;
+
+// Array element pointers, resolved from the snapshot's element offsets
+static char **snapElements;
+
+
 /*++
 
 CreateSection
@@ -184,83 +243,31 @@ CreateKey(
         }
 
         // Initialize key structure
-        key->value.string = apr_palloc(cfgPool, valueLength + 1);
-        if (key->value.string == NULL) {
+        key->value = apr_palloc(cfgPool, valueLength + 1);
+        if (key->value == NULL) {
             return;
         }
-        key->crc  = keyCrc;
-        key->type = TYPE_STRING;
+        key->crc = keyCrc;
 
         // Insert key at the list's head
         LIST_INSERT_HEAD(&section->keys, key, link);
 
     } else if (key->length < valueLength) {
         // Allocate a memory block to accommodate the larger string.
-        key->value.string = apr_palloc(cfgPool, valueLength + 1);
+        key->value = apr_palloc(cfgPool, valueLength + 1);
 
-        if (key->value.string == NULL) {
+        if (key->value == NULL) {
             LIST_REMOVE(key, link);
             return;
         }
     }
 
     // Update the key's value and length.
-    memcpy(key->value.string, value, valueLength);
-    key->value.string[valueLength] = '\0';
+    memcpy(key->value, value, valueLength);
+    key->value[valueLength] = '\0';
     key->length = valueLength;
 }
 
-/*++
-
-GetKey
-
-    Locates the data structure for the specified key.
-
-Arguments:
-    sectionName - Pointer to a null-terminated string that specifies the section name.
-
-    keyName     - Pointer to a null-terminated string that specifies the key name.
-
-Return Value:
-    If the key exists, the return value is a pointer to a CONFIG_KEY structure.
-
-    If the key does not exist, the return value is null.
-
---*/
-static
-CONFIG_KEY *
-GetKey(
-    const char *sectionName,
-    const char *keyName
-    )
-{
-    CONFIG_KEY *key;
-    CONFIG_SECTION *section;
-    apr_uint32_t keyCrc;
-    apr_uint32_t sectionCrc;
-
-    ASSERT(sectionName != NULL);
-    ASSERT(keyName     != NULL);
-
-    keyCrc = Crc32String(keyName);
-    sectionCrc = Crc32String(sectionName);
-    LOG_VERBOSE("Looking up key \"%s\" (0x%08X) in section \"%s\" (0x%08X).",
-        keyName, keyCrc, sectionName, sectionCrc);
-
-    SLIST_FOREACH(section, &sectionHead, link) {
-        if (section->crc == sectionCrc) {
-            LIST_FOREACH(key, &section->keys, link) {
-                if (key->crc == keyCrc) {
-                    return key;
-                }
-            }
-            break;
-        }
-    }
-
-    LOG_WARNING("Unable to find key \"%s\" in section \"%s\".", keyName, sectionName);
-    return NULL;
-}
 
 /*++
 
@@ -479,7 +486,607 @@ ParseBuffer(
     }
 }
 
-
+
+/*++
+
+ParseBoolean
+
+    Converts a value string to a boolean.
+
+Arguments:
+    value   - Pointer to the value string.
+
+    length  - Length of the value string, in characters.
+
+    boolean - Location to store the boolean value.
+
+Return Value:
+    If the value is a valid boolean, the return is nonzero (true).
+
+    If the value is not a valid boolean, the return is zero (false).
+
+Remarks:
+    Accepted boolean values are: 1, 0, yes, no, on, off, true, or false.
+
+--*/
+static
+bool_t
+ParseBoolean(
+    const char *value,
+    apr_size_t length,
+    bool_t *boolean
+    )
+{
+    apr_byte_t i;
+    static const char text[] = "01onoffalseyestrue";
+    static const struct {
+        apr_byte_t offset;
+        apr_byte_t length;
+        bool_t  value;
+    } values[] = {
+        {0,  1, FALSE}, // "0"
+        {1,  1, TRUE},  // "1"
+        {2,  2, TRUE},  // "on"
+        {3,  2, FALSE}, // "no"
+        {4,  3, FALSE}, // "off"
+        {6,  5, FALSE}, // "false"
+        {11, 3, TRUE},  // "yes"
+        {14, 4, TRUE}   // "true"
+    };
+
+    for (i = 0; i < ARRAYSIZE(values); i++) {
+        if (length == values[i].length && strncasecmp(&text[values[i].offset], value, length) == 0) {
+            *boolean = values[i].value;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*++
+
+GetHash
+
+    Calculates the perfect hash components of a key.
+
+Arguments:
+    header      - Pointer to the snapshot header.
+
+    sectionCrc  - CRC-32 checksum of the section name.
+
+    keyCrc      - CRC-32 checksum of the key name.
+
+    hash        - Location to store the hash components.
+
+Return Value:
+    None.
+
+--*/
+static
+void
+GetHash(
+    const SNAPSHOT_HEADER *header,
+    apr_uint32_t sectionCrc,
+    apr_uint32_t keyCrc,
+    SNAPSHOT_HASH *hash
+    )
+{
+    apr_uint64_t value;
+
+    // The checksums are already well distributed, so a 64-bit finalizer
+    // mix (from MurmurHash3) of both, with the seed, is sufficient.
+    value = ((apr_uint64_t)sectionCrc << 32 | keyCrc) ^ ((apr_uint64_t)header->seed * 0x9E3779B97F4A7C15);
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCD;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53;
+    value ^= value >> 33;
+
+    hash->bucket = (apr_uint32_t)value % header->bucketCount;
+    hash->first  = (apr_uint32_t)(value >> 32);
+    hash->step   = ((apr_uint32_t)value * 0x2545F491) | 1;
+}
+
+/*++
+
+GetKey
+
+    Locates the snapshot slot for the specified key.
+
+Arguments:
+    sectionName - Pointer to a null-terminated string that specifies the section name.
+
+    keyName     - Pointer to a null-terminated string that specifies the key name.
+
+Return Value:
+    If the key exists, the return value is a pointer to a SNAPSHOT_SLOT structure.
+
+    If the key does not exist, the return value is null.
+
+--*/
+static
+const SNAPSHOT_SLOT *
+GetKey(
+    const char *sectionName,
+    const char *keyName
+    )
+{
+    apr_uint32_t keyCrc;
+    apr_uint32_t sectionCrc;
+    const SNAPSHOT_SLOT *slot;
+    SNAPSHOT_HASH hash;
+
+    ASSERT(sectionName != NULL);
+    ASSERT(keyName     != NULL);
+    ASSERT(snapHeader  != NULL);
+
+    keyCrc = Crc32String(keyName);
+    sectionCrc = Crc32String(sectionName);
+    LOG_VERBOSE("Looking up key \"%s\" (0x%08X) in section \"%s\" (0x%08X).",
+        keyName, keyCrc, sectionName, sectionCrc);
+
+    // A key can only be in the one slot its perfect hash leads to
+    GetHash(snapHeader, sectionCrc, keyCrc, &hash);
+    slot = &snapSlots[(hash.first + snapDisplace[hash.bucket] * hash.step) & (snapHeader->tableSize - 1)];
+
+    if ((slot->flags & SLOT_USED) && slot->sectionCrc == sectionCrc && slot->keyCrc == keyCrc) {
+        return slot;
+    }
+
+    LOG_WARNING("Unable to find key \"%s\" in section \"%s\".", keyName, sectionName);
+    return NULL;
+}
+
+/*++
+
+PlaceKeys
+
+    Finds a perfect hash for the keys, assigning each key to a slot.
+
+Arguments:
+    header      - Pointer to the snapshot header. The seed, table size, and
+                  bucket count must be set.
+
+    displace    - Pointer to the bucket displacement array.
+
+    hashes      - Pointer to the hash components of each key.
+
+    order       - Pointer to the key indexes, sorted by bucket size (largest
+                  first) and grouped by bucket.
+
+    slots       - Location to store the slot of each key.
+
+    used        - Pointer to a zeroed array, one flag per slot.
+
+Return Value:
+    If all keys were placed, the return is nonzero (true).
+
+    If a bucket could not be placed, the return is zero (false).
+
+--*/
+static
+bool_t
+PlaceKeys(
+    const SNAPSHOT_HEADER *header,
+    apr_uint32_t *displace,
+    const SNAPSHOT_HASH *hashes,
+    const apr_uint32_t *order,
+    apr_uint32_t *slots,
+    apr_byte_t *used
+    )
+{
+    apr_uint32_t bucket;
+    apr_uint32_t end;
+    apr_uint32_t i;
+    apr_uint32_t j;
+    apr_uint32_t mask = header->tableSize - 1;
+    apr_uint32_t shift;
+    apr_uint32_t start;
+
+    for (start = 0; start < header->keyCount; start = end) {
+        bucket = hashes[order[start]].bucket;
+        for (end = start + 1; end < header->keyCount && hashes[order[end]].bucket == bucket; end++);
+
+        // Try displacements until every key of the bucket lands on a free slot
+        for (shift = 0; shift < header->tableSize * 2; shift++) {
+            for (i = start; i < end; i++) {
+                j = order[i];
+                slots[j] = (hashes[j].first + shift * hashes[j].step) & mask;
+                if (used[slots[j]]) {
+                    break;
+                }
+                used[slots[j]] = 1;
+            }
+            if (i == end) {
+                break;
+            }
+
+            // Release the slots taken by this attempt
+            while (i-- > start) {
+                used[slots[order[i]]] = 0;
+            }
+        }
+
+        if (shift == header->tableSize * 2) {
+            return FALSE;
+        }
+        displace[bucket] = shift;
+    }
+    return TRUE;
+}
+
+/*++
+
+BuildSnapshot
+
+    Builds a snapshot from the parsed configuration file.
+
+Arguments:
+    source  - Pointer to the configuration file's information.
+
+    image   - Location to store the snapshot.
+
+    size    - Location to store the size of the snapshot, in bytes.
+
+Return Value:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+BuildSnapshot(
+    const apr_finfo_t *source,
+    char **image,
+    apr_size_t *size
+    )
+{
+    apr_byte_t *used;
+    apr_size_t charCount;
+    apr_size_t elementCount;
+    apr_size_t length;
+    apr_size_t offset;
+    apr_uint32_t *bucketSizes;
+    apr_uint32_t *displace;
+    apr_uint32_t *elements;
+    apr_uint32_t *order;
+    apr_uint32_t *sectionCrcs;
+    apr_uint32_t *slots;
+    apr_uint32_t attempt;
+    apr_uint32_t i;
+    apr_uint32_t j;
+    apr_uint32_t value;
+    bool_t boolean;
+    char *base;
+    char *data;
+    char **array;
+    CONFIG_KEY *key;
+    CONFIG_KEY **keys;
+    CONFIG_SECTION *section;
+    SNAPSHOT_HASH *hashes;
+    SNAPSHOT_HASH *prev;
+    SNAPSHOT_HEADER header;
+    SNAPSHOT_SLOT *slot;
+
+    memset(&header, 0, sizeof(SNAPSHOT_HEADER));
+    header.magic      = SNAPSHOT_MAGIC;
+    header.version    = SNAPSHOT_VERSION;
+    header.sourceSize = (apr_uint64_t)source->size;
+    header.sourceTime = source->mtime;
+
+    // Count the keys, their array elements, and the space needed for strings
+    length = 0;
+    SLIST_FOREACH(section, &sectionHead, link) {
+        LIST_FOREACH(key, &section->keys, link) {
+            ParseArray(key->value, NULL, &elementCount, NULL, &charCount);
+            header.keyCount++;
+            header.elementCount += (apr_uint32_t)elementCount;
+            length += key->length + 1 + charCount;
+        }
+    }
+
+    // Keep the table at most 80% full, with about two keys per bucket
+    for (header.tableSize = 1; header.tableSize < header.keyCount + header.keyCount/4; header.tableSize <<= 1);
+    header.bucketCount = header.keyCount/2 + 1;
+
+    offset = sizeof(SNAPSHOT_HEADER) + header.bucketCount * sizeof(apr_uint32_t);
+    length += offset + header.tableSize * sizeof(SNAPSHOT_SLOT) + header.elementCount * sizeof(apr_uint32_t);
+    if (length > APR_UINT32_MAX) {
+        return APR_ENOSPC;
+    }
+    header.size = (apr_uint32_t)length;
+
+    base        = apr_pcalloc(cfgPool, length);
+    array       = apr_palloc(cfgPool, (header.elementCount + 1) * sizeof(char *));
+    keys        = apr_palloc(cfgPool, (header.keyCount + 1) * sizeof(CONFIG_KEY *));
+    sectionCrcs = apr_palloc(cfgPool, (header.keyCount + 1) * sizeof(apr_uint32_t));
+    hashes      = apr_palloc(cfgPool, (header.keyCount + 1) * sizeof(SNAPSHOT_HASH));
+    order       = apr_palloc(cfgPool, (header.keyCount + 1) * sizeof(apr_uint32_t));
+    slots       = apr_palloc(cfgPool, (header.keyCount + 1) * sizeof(apr_uint32_t));
+    bucketSizes = apr_palloc(cfgPool, header.bucketCount * sizeof(apr_uint32_t));
+    used        = apr_palloc(cfgPool, header.tableSize);
+    if (base == NULL || array == NULL || keys == NULL || sectionCrcs == NULL || hashes == NULL ||
+            order == NULL || slots == NULL || bucketSizes == NULL || used == NULL) {
+        return APR_ENOMEM;
+    }
+    displace = (apr_uint32_t *)(base + sizeof(SNAPSHOT_HEADER));
+
+    i = 0;
+    SLIST_FOREACH(section, &sectionHead, link) {
+        LIST_FOREACH(key, &section->keys, link) {
+            keys[i] = key;
+            sectionCrcs[i] = section->crc;
+            i++;
+        }
+    }
+
+    //
+    // Find a perfect hash using "hash and displace": keys are grouped into
+    // buckets, and each bucket (largest first) is assigned the smallest
+    // displacement that moves all of its keys onto free slots.
+    //
+    for (attempt = 1; attempt <= HASH_ATTEMPTS; attempt++) {
+        header.seed = attempt;
+        memset(bucketSizes, 0, header.bucketCount * sizeof(apr_uint32_t));
+
+        for (i = 0; i < header.keyCount; i++) {
+            GetHash(&header, sectionCrcs[i], keys[i]->crc, &hashes[i]);
+            bucketSizes[hashes[i].bucket]++;
+        }
+
+        // Order the keys by bucket size and bucket. An insertion sort is
+        // fine, since configuration files only contain a few dozen keys.
+        for (i = 0; i < header.keyCount; i++) {
+            for (j = i; j > 0; j--) {
+                prev = &hashes[order[j-1]];
+                if (bucketSizes[prev->bucket] > bucketSizes[hashes[i].bucket] ||
+                        (bucketSizes[prev->bucket] == bucketSizes[hashes[i].bucket] && prev->bucket <= hashes[i].bucket)) {
+                    break;
+                }
+                order[j] = order[j-1];
+            }
+            order[j] = i;
+        }
+
+        memset(displace, 0, header.bucketCount * sizeof(apr_uint32_t));
+        memset(used, 0, header.tableSize);
+        if (PlaceKeys(&header, displace, hashes, order, slots, used)) {
+            break;
+        }
+    }
+    if (attempt > HASH_ATTEMPTS) {
+        return APR_EGENERAL;
+    }
+
+    // Fill in the slots, followed by the array elements and strings
+    elements = (apr_uint32_t *)(base + offset + header.tableSize * sizeof(SNAPSHOT_SLOT));
+    data = (char *)(elements + header.elementCount);
+    value = 0;
+
+    for (i = 0; i < header.keyCount; i++) {
+        key = keys[i];
+        slot = (SNAPSHOT_SLOT *)(base + offset) + slots[i];
+
+        slot->flags      = SLOT_USED;
+        slot->sectionCrc = sectionCrcs[i];
+        slot->keyCrc     = key->crc;
+        slot->string     = (apr_uint32_t)(data - base);
+        slot->length     = (apr_uint32_t)key->length;
+        memcpy(data, key->value, key->length + 1);
+        data += key->length + 1;
+
+        // Convert the value to every representation up front
+        if (ParseBoolean(key->value, key->length, &boolean)) {
+            slot->flags |= SLOT_BOOLEAN | (boolean ? SLOT_TRUE : 0);
+        }
+        slot->integer = (apr_uint32_t)strtoul(key->value, NULL, 10);
+        if (slot->integer != ULONG_MAX) {
+            slot->flags |= SLOT_INTEGER;
+        }
+
+        ParseArray(key->value, array, &elementCount, data, &charCount);
+        slot->elements = value;
+        slot->count    = (apr_uint32_t)elementCount;
+        for (j = 0; j < slot->count; j++) {
+            elements[value++] = (apr_uint32_t)(array[j] - base);
+        }
+        data += charCount;
+    }
+    ASSERT(data == base + length);
+
+    memcpy(base, &header, sizeof(SNAPSHOT_HEADER));
+    *image = base;
+    *size = length;
+    return APR_SUCCESS;
+}
+
+/*++
+
+UseSnapshot
+
+    Validates a snapshot and makes it the current configuration.
+
+Arguments:
+    image   - Pointer to the snapshot.
+
+    size    - Size of the snapshot, in bytes.
+
+Return Value:
+    Returns an APR status code.
+
+Remarks:
+    Snapshots are checked for consistency, not integrity; the bounds of every
+    offset are validated so a truncated or damaged file cannot be read past.
+
+--*/
+static
+apr_status_t
+UseSnapshot(
+    char *image,
+    apr_size_t size
+    )
+{
+    apr_size_t offset;
+    apr_uint32_t i;
+    apr_uint32_t j;
+    const apr_uint32_t *elements;
+    const SNAPSHOT_HEADER *header = (const SNAPSHOT_HEADER *)image;
+    const SNAPSHOT_SLOT *slots;
+
+    if (size < sizeof(SNAPSHOT_HEADER) || header->magic != SNAPSHOT_MAGIC ||
+            header->version != SNAPSHOT_VERSION || header->size != size ||
+            header->tableSize == 0 || (header->tableSize & (header->tableSize - 1)) != 0 ||
+            header->bucketCount == 0 || header->keyCount > header->tableSize) {
+        return APR_EINVAL;
+    }
+
+    offset = sizeof(SNAPSHOT_HEADER) + header->bucketCount * sizeof(apr_uint32_t);
+    if (offset + (apr_uint64_t)header->tableSize * sizeof(SNAPSHOT_SLOT) +
+            (apr_uint64_t)header->elementCount * sizeof(apr_uint32_t) > size) {
+        return APR_EINVAL;
+    }
+    slots = (const SNAPSHOT_SLOT *)(image + offset);
+    elements = (const apr_uint32_t *)(slots + header->tableSize);
+
+    // Every string must be terminated within the snapshot
+    if (size > 0 && image[size - 1] != '\0') {
+        return APR_EINVAL;
+    }
+    for (i = 0; i < header->tableSize; i++) {
+        if ((slots[i].flags & SLOT_USED) && (slots[i].string >= size ||
+                slots[i].elements + (apr_uint64_t)slots[i].count > header->elementCount)) {
+            return APR_EINVAL;
+        }
+    }
+
+    // Resolve the element offsets, so arrays can be returned as-is
+    snapElements = apr_palloc(cfgPool, (header->elementCount + 1) * sizeof(char *));
+    if (snapElements == NULL) {
+        return APR_ENOMEM;
+    }
+    for (j = 0; j < header->elementCount; j++) {
+        if (elements[j] >= size) {
+            return APR_EINVAL;
+        }
+        snapElements[j] = image + elements[j];
+    }
+
+    snapBase     = image;
+    snapHeader   = header;
+    snapDisplace = (const apr_uint32_t *)(image + sizeof(SNAPSHOT_HEADER));
+    snapSlots    = slots;
+    return APR_SUCCESS;
+}
+
+/*++
+
+LoadSnapshot
+
+    Maps the snapshot file, if it matches the configuration file.
+
+Arguments:
+    source  - Pointer to the configuration file's information.
+
+Return Value:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+LoadSnapshot(
+    const apr_finfo_t *source
+    )
+{
+    apr_file_t *file;
+    apr_finfo_t info;
+    apr_mmap_t *map;
+    apr_status_t status;
+    const SNAPSHOT_HEADER *header;
+
+    status = apr_file_open(&file, CONFIG_SNAPSHOT, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, cfgPool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, file);
+    if (status == APR_SUCCESS) {
+        if (info.size < sizeof(SNAPSHOT_HEADER) || info.size > APR_UINT32_MAX) {
+            status = APR_EINVAL;
+        } else {
+            status = apr_mmap_create(&map, file, 0, (apr_size_t)info.size, APR_MMAP_READ, cfgPool);
+        }
+    }
+    apr_file_close(file);
+
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // The snapshot is only current if it was built from this exact file
+    header = map->mm;
+    if (header->magic != SNAPSHOT_MAGIC || header->sourceSize != (apr_uint64_t)source->size ||
+            header->sourceTime != source->mtime) {
+        apr_mmap_delete(map);
+        return APR_EINVAL;
+    }
+
+    status = UseSnapshot(map->mm, map->size);
+    if (status != APR_SUCCESS) {
+        apr_mmap_delete(map);
+    }
+    return status;
+}
+
+/*++
+
+WriteSnapshot
+
+    Writes a snapshot file, replacing the previous one atomically.
+
+Arguments:
+    image   - Pointer to the snapshot.
+
+    size    - Size of the snapshot, in bytes.
+
+Return Value:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+WriteSnapshot(
+    const char *image,
+    apr_size_t size
+    )
+{
+    apr_file_t *file;
+    apr_status_t status;
+    char *path;
+
+    // Write to a unique file first, concurrent processes may be doing the same
+    path = apr_pstrdup(cfgPool, CONFIG_SNAPSHOT ".XXXXXX");
+    status = apr_file_mktemp(&file, path, APR_FOPEN_CREATE|APR_FOPEN_WRITE|
+        APR_FOPEN_EXCL|APR_FOPEN_BINARY, cfgPool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = apr_file_write_full(file, image, size, NULL);
+    apr_file_close(file);
+
+    // Temporary files are only readable by their owner
+    if (status == APR_SUCCESS) {
+        status = apr_file_perms_set(path, APR_FPROT_UREAD|APR_FPROT_UWRITE|APR_FPROT_GREAD|APR_FPROT_WREAD);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(path, CONFIG_SNAPSHOT, cfgPool);
+    }
+    if (status != APR_SUCCESS) {
+        apr_file_remove(path, cfgPool);
+    }
+    return status;
+}
+
+
 /*++
 
 ConfigInit
@@ -492,6 +1099,10 @@ Arguments:
 Return Values:
     Returns an APR status code.
 
+Remarks:
+    The configuration file is only parsed when its snapshot is missing or
+    out of date, in which case the snapshot is rebuilt for the next process.
+
 --*/
 apr_status_t
 ConfigInit(
@@ -499,8 +1110,10 @@ ConfigInit(
     )
 {
     apr_byte_t *buffer;
+    apr_finfo_t source;
     apr_size_t length;
     apr_status_t status;
+    char *image;
 
     // Initialize section list head
     SLIST_INIT(&sectionHead);
@@ -511,13 +1124,31 @@ ConfigInit(
         return status;
     }
 
+    status = apr_stat(&source, CONFIG_FILE, APR_FINFO_SIZE|APR_FINFO_MTIME, cfgPool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Use the snapshot when it was built from the current configuration file
+    if (LoadSnapshot(&source) == APR_SUCCESS) {
+        return APR_SUCCESS;
+    }
+
     // Buffer configuration file
     status = BufferFile(CONFIG_FILE, &buffer, &length, cfgPool);
     if (status != APR_SUCCESS) {
         return status;
     }
-
     ParseBuffer((char *)buffer, length);
+
+    status = BuildSnapshot(&source, &image, &length);
+    if (status == APR_SUCCESS) {
+        status = UseSnapshot(image, length);
+    }
+    if (status == APR_SUCCESS) {
+        // Failing to save the snapshot is not an error, e.g. a read-only directory
+        WriteSnapshot(image, length);
+    }
     return status;
 }
 
@@ -533,7 +1164,7 @@ Arguments:
     keyName     - Pointer to a null-terminated string that specifies the key name.
 
     array       - Location to store the address of the array of null-terminated
-                  strings. Do not attempt to free this value.
+                  strings. Do not attempt to free or modify this value.
 
     elements    - Location to store the number of elements in the array.
 
@@ -552,47 +1183,20 @@ ConfigGetArray(
     apr_size_t *elements
     )
 {
-    CONFIG_KEY *key;
-    char **buffer;
-    char *offset;
-    apr_size_t bufferChars;
-    apr_size_t bufferElements;
+    const SNAPSHOT_SLOT *slot;
 
     ASSERT(sectionName != NULL);
     ASSERT(keyName     != NULL);
     ASSERT(array       != NULL);
     ASSERT(elements    != NULL);
 
-    key = GetKey(sectionName, keyName);
-    if (key == NULL) {
+    slot = GetKey(sectionName, keyName);
+    if (slot == NULL) {
         return APR_EINVAL;
     }
-    ASSERT(key->type == TYPE_ARRAY || key->type == TYPE_STRING);
 
-    if (key->type == TYPE_ARRAY) {
-        *array = key->value.array;
-        *elements = key->length;
-        return APR_SUCCESS;
-    } else if (key->type != TYPE_STRING) {
-        return APR_EINVAL;
-    }
-
-    // Calculate the required space to store the array and its elements.
-    ParseArray(key->value.string, NULL, &bufferElements, NULL, &bufferChars);
-
-    buffer = apr_palloc(cfgPool, (bufferElements * sizeof(char *)) + bufferChars);
-    if (buffer == NULL) {
-        return APR_ENOMEM;
-    }
-
-    // Convert the buffer into an array.
-    offset = (char *)buffer + (bufferElements * sizeof(char *));
-    ParseArray(key->value.string, buffer, &bufferElements, offset, &bufferChars);
-
-    // Change the key's internal value representation to an array.
-    key->type = TYPE_ARRAY;
-    key->length = *elements = bufferElements;
-    key->value.array = *array = buffer;
+    *array = snapElements + slot->elements;
+    *elements = slot->count;
     return APR_SUCCESS;
 }
 
@@ -626,51 +1230,19 @@ ConfigGetBool(
     bool_t *boolean
     )
 {
-    CONFIG_KEY *key;
-    apr_byte_t i;
-    static const char text[] = "01onoffalseyestrue";
-    static const struct {
-        apr_byte_t offset;
-        apr_byte_t length;
-        bool_t  value;
-    } values[] = {
-        {0,  1, FALSE}, // "0"
-        {1,  1, TRUE},  // "1"
-        {2,  2, TRUE},  // "on"
-        {3,  2, FALSE}, // "no"
-        {4,  3, FALSE}, // "off"
-        {6,  5, FALSE}, // "false"
-        {11, 3, TRUE},  // "yes"
-        {14, 4, TRUE}   // "true"
-    };
+    const SNAPSHOT_SLOT *slot;
 
     ASSERT(sectionName != NULL);
     ASSERT(keyName     != NULL);
     ASSERT(boolean     != NULL);
 
-    key = GetKey(sectionName, keyName);
-    if (key == NULL) {
-        return APR_EINVAL;
-    }
-    ASSERT(key->type == TYPE_BOOLEAN || key->type == TYPE_STRING);
-
-    if (key->type == TYPE_BOOLEAN) {
-        *boolean = key->value.boolean;
-        return APR_SUCCESS;
-    } else if (key->type != TYPE_STRING) {
+    slot = GetKey(sectionName, keyName);
+    if (slot == NULL || !(slot->flags & SLOT_BOOLEAN)) {
         return APR_EINVAL;
     }
 
-    for (i = 0; i < ARRAYSIZE(values); i++) {
-        if (key->length == values[i].length && strncasecmp(&text[values[i].offset], key->value.string, key->length) == 0) {
-            // Change the key's internal value representation to a boolean.
-            key->type = TYPE_BOOLEAN;
-            key->value.boolean = *boolean = values[i].value;
-            return APR_SUCCESS;
-        }
-    }
-
-    return APR_EINVAL;
+    *boolean = (slot->flags & SLOT_TRUE) ? TRUE : FALSE;
+    return APR_SUCCESS;
 }
 
 /*++
@@ -700,34 +1272,18 @@ ConfigGetInt(
     apr_uint32_t *integer
     )
 {
-    CONFIG_KEY *key;
-    apr_uint32_t value;
+    const SNAPSHOT_SLOT *slot;
 
     ASSERT(sectionName != NULL);
     ASSERT(keyName     != NULL);
     ASSERT(integer     != NULL);
 
-    key = GetKey(sectionName, keyName);
-    if (key == NULL) {
+    slot = GetKey(sectionName, keyName);
+    if (slot == NULL || !(slot->flags & SLOT_INTEGER)) {
         return APR_EINVAL;
     }
-    ASSERT(key->type == TYPE_INTEGER || key->type == TYPE_STRING);
 
-    if (key->type == TYPE_INTEGER) {
-        *integer = key->value.integer;
-        return APR_SUCCESS;
-    } else if (key->type != TYPE_STRING) {
-        return APR_EINVAL;
-    }
-
-    value = (apr_uint32_t)strtoul(key->value.string, NULL, 10);
-    if (value == ULONG_MAX) {
-        return APR_EINVAL;
-    }
-
-    // Change the key's internal value representation to an integer.
-    key->type = TYPE_INTEGER;
-    key->value.integer = *integer = value;
+    *integer = slot->integer;
     return APR_SUCCESS;
 }
 
@@ -743,7 +1299,7 @@ Arguments:
     keyName     - Pointer to a null-terminated string that specifies the key name.
 
     string      - Location to store the null-terminated string's address.
-                  Do NOT attempt to free this value.
+                  Do NOT attempt to free or modify this value.
 
     length      - Location to store the string's length. This argument can be null.
 
@@ -761,25 +1317,20 @@ ConfigGetString(
     apr_size_t *length
     )
 {
-    CONFIG_KEY *key;
+    const SNAPSHOT_SLOT *slot;
 
     ASSERT(sectionName != NULL);
     ASSERT(keyName     != NULL);
     ASSERT(string      != NULL);
 
-    key = GetKey(sectionName, keyName);
-    if (key == NULL) {
+    slot = GetKey(sectionName, keyName);
+    if (slot == NULL) {
         return APR_EINVAL;
     }
-    ASSERT(key->type == TYPE_STRING);
 
-    if (key->type == TYPE_STRING) {
-        *string = key->value.string;
-        if (length != NULL) {
-            *length = key->length;
-        }
-        return APR_SUCCESS;
+    *string = snapBase + slot->string;
+    if (length != NULL) {
+        *length = slot->length;
     }
-
-    return APR_EINVAL;
+    return APR_SUCCESS;
 }
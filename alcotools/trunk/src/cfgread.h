@@ -27,7 +27,7 @@ ConfigGetArray(
     const char *sectionName,
     const char *keyName,
     char ***array,
-    apr_uint32_t *elements
+    apr_size_t *elements
     );
 
 int
@@ -49,7 +49,7 @@ ConfigGetString(
     const char *sectionName,
     const char *keyName,
     char **string,
-    apr_uint32_t *length
+    apr_size_t *length
     );
 
 
@@ -68,10 +68,12 @@ ConfigGetString(
 
 #define DupeCheckDirs           "checkDirs"           // BOOL
 #define DupeCheckFiles          "checkFiles"          // BOOL
+#define DupeCompactRecords      "compactRecords"      // INTEGER
 #define DupeExcludeCheck        "excludeCheck"        // ARRAY
 #define DupeExcludeLog          "excludeLog"          // ARRAY
 #define DupeIgnoreDirs          "ignoreDirs"          // ARRAY
 #define DupeIgnoreFiles         "ignoreFiles"         // ARRAY
+#define DupeSearchLimit         "searchLimit"         // INTEGER
 
 #define ForceExcludePaths       "excludePaths"        // ARRAY
 #define ForceFilePaths          "filePaths"           // ARRAY
@@ -80,17 +82,21 @@ ConfigGetString(
 #define ForceSamplePaths        "samplePaths"         // ARRAY
 #define ForceSfvFirst           "sfvFirst"            // BOOL
 
+#define GeneralDaemonThreads    "daemonThreads"       // INTEGER
 #define GeneralDataPath         "dataPath"            // STRING
 #define GeneralLogLevel         "logLevel"            // INTEGER
 #define GeneralMsgWindow        "msgWindow"           // STRING
 #define GeneralTextPath         "textPath"            // STRING
 
+#define ZsCheckArchives         "checkArchives"       // BOOL
 #define ZsExcludePaths          "excludePaths"        // ARRAY
 #define ZsExtractDiz            "extractDiz"          // BOOL
 #define ZsExtractNfo            "extractNfo"          // BOOL
 #define ZsGroupPaths            "groupPaths"          // ARRAY
 #define ZsHalfwayFiles          "halfwayFiles"        // INTEGER
 #define ZsLeaderFiles           "leaderFiles"         // INTEGER
+#define ZsMediaFiles            "mediaFiles"          // ARRAY
+#define ZsProbeMedia            "probeMedia"          // BOOL
 #define ZsTagComplete           "tagComplete"         // STRING
 #define ZsTagCompleteMP3        "tagCompleteMP3"      // STRING
 #define ZsTagIncomplete         "tagIncomplete"       // STRING
@@ -0,0 +1,1006 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Daemon
+
+Abstract:
+    This module implements the resident daemon and its client. The daemon
+    initializes once and handles events forwarded by clients over a local
+    socket, so each event no longer pays the process start-up cost.
+
+    Request (client to daemon):
+        REQUEST header, followed by 'length' bytes of null-terminated
+        strings: the client's working directory, the event's arguments,
+        and then the client's environment.
+
+    Reply (daemon to client):
+        A sequence of MESSAGE headers. Output messages are followed by
+        'value' bytes of data, the exit message carries the event's status
+        in 'value' and ends the reply. The reject message ends the reply
+        without processing the event, the client then processes it itself.
+
+    Relative paths, in the event's arguments and in the configuration file,
+    resolve against the working directory. The daemon only processes events
+    from clients in its own working directory, and the socket has an
+    absolute path so clients in other directories still reach it.
+
+    Clients only forward events to a socket in a directory owned by their
+    user and not writable by others, so another user cannot receive their
+    events by binding the socket first.
+
+--*/
+
+#include "alcoholicz.h"
+
+#if APR_HAS_THREADS && defined(APR_UNIX)
+
+#ifdef WINDOWS
+#   define environ _environ
+#else
+extern char **environ;
+#endif
+
+// Request header magic ("ADRQ")
+#define REQUEST_MAGIC   0x51524441
+
+// Maximum length of a request's strings
+#define REQUEST_MAX     (256 * 1024)
+
+// Reply message types
+#define MESSAGE_STDOUT  1
+#define MESSAGE_STDERR  2
+#define MESSAGE_EXIT    3
+#define MESSAGE_REJECT  4
+
+// Default number of worker threads
+#define THREADS_DEFAULT 4
+
+typedef struct {
+    apr_uint32_t magic;     // Request header magic
+    apr_uint32_t argc;      // Number of arguments
+    apr_uint32_t envc;      // Number of environment variables
+    apr_uint32_t length;    // Length of the strings that follow
+} REQUEST;
+
+typedef struct {
+    apr_uint32_t type;      // Message type
+    apr_uint32_t value;     // Length of the data that follows, or the exit status
+} MESSAGE;
+
+typedef struct {
+    apr_pool_t      *pool;      // Connection memory pool
+    apr_socket_t    *socket;    // Client socket
+    const char      *cwd;       // Client's working directory
+    int             argc;       // Number of event arguments
+    char            **argv;     // Event arguments
+    int             envc;       // Number of environment variables
+    char            **envp;     // Environment variables, as "name=value"
+    bool_t          broken;     // Set when the client has gone away
+} CONNECTION;
+
+// Listening socket, shared by all worker threads
+static apr_socket_t *listener;
+
+// Working directory of the daemon
+static char *workPath;
+
+// Held while the daemon runs, guards the socket against other daemons
+static apr_file_t *lockFile;
+
+// Serializes deferred work, which takes process-wide file locks
+static apr_thread_mutex_t *deferMutex;
+
+// Connection being handled by the current thread
+static apr_threadkey_t *connKey;
+
+// Console streams, used outside of a connection
+static STREAM *consoleErr;
+static STREAM *consoleOut;
+
+// Reply message types for the redirected streams
+static const apr_uint32_t typeStdout = MESSAGE_STDOUT;
+static const apr_uint32_t typeStderr = MESSAGE_STDERR;
+
+
+/*++
+
+SendFull
+
+    Sends an entire buffer over a socket.
+
+Arguments:
+    socket  - Pointer to a socket.
+
+    buffer  - Pointer to the buffer containing the data to be sent.
+
+    length  - Number of bytes to send.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+SendFull(
+    apr_socket_t *socket,
+    const void *buffer,
+    apr_size_t length
+    )
+{
+    apr_size_t sent;
+    apr_status_t status;
+    const char *offset = buffer;
+
+    while (length > 0) {
+        sent = length;
+        status = apr_socket_send(socket, offset, &sent);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        offset += sent;
+        length -= sent;
+    }
+    return APR_SUCCESS;
+}
+
+/*++
+
+RecvFull
+
+    Receives an entire buffer from a socket.
+
+Arguments:
+    socket  - Pointer to a socket.
+
+    buffer  - Pointer to the buffer that receives the data.
+
+    length  - Number of bytes to receive.
+
+Return Values:
+    Returns an APR status code; APR_EOF if the peer closed the connection.
+
+--*/
+static
+apr_status_t
+RecvFull(
+    apr_socket_t *socket,
+    void *buffer,
+    apr_size_t length
+    )
+{
+    apr_size_t received;
+    apr_status_t status;
+    char *offset = buffer;
+
+    while (length > 0) {
+        received = length;
+        status = apr_socket_recv(socket, offset, &received);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (received == 0) {
+            return APR_EOF;
+        }
+        offset += received;
+        length -= received;
+    }
+    return APR_SUCCESS;
+}
+
+/*++
+
+SendMessage
+
+    Sends a reply message to a client.
+
+Arguments:
+    conn    - Pointer to the client connection.
+
+    type    - Message type.
+
+    data    - Pointer to the message data. This argument can be null if
+              'value' is not a length.
+
+    value   - Length of the message data, or the exit status.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+SendMessage(
+    CONNECTION *conn,
+    apr_uint32_t type,
+    const void *data,
+    apr_uint32_t value
+    )
+{
+    apr_status_t status;
+    MESSAGE message;
+
+    if (conn->broken) {
+        return APR_EOF;
+    }
+    message.type  = type;
+    message.value = value;
+
+    status = SendFull(conn->socket, &message, sizeof(MESSAGE));
+    if (status == APR_SUCCESS && data != NULL) {
+        status = SendFull(conn->socket, data, value);
+    }
+    if (status != APR_SUCCESS) {
+        // Discard further output, the event still runs to completion
+        conn->broken = TRUE;
+    }
+    return status;
+}
+
+/*++
+
+RedirectWrite
+
+    Writes to the output stream of the client handled by the current thread.
+
+Arguments:
+    opaque       - Pointer to the reply message type.
+
+    buffer       - Pointer to the buffer containing the data to be written.
+
+    bytesToWrite - Number of bytes to write.
+
+    bytesWritten - Location to store the number of bytes written.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+RedirectWrite(
+    void *opaque,
+    const apr_byte_t *buffer,
+    apr_size_t bytesToWrite,
+    apr_size_t *bytesWritten
+    )
+{
+    apr_status_t status;
+    apr_uint32_t type = *(const apr_uint32_t *)opaque;
+    CONNECTION *conn;
+
+    ASSERT(buffer != NULL);
+
+    if (apr_threadkey_private_get((void **)&conn, connKey) != APR_SUCCESS || conn == NULL) {
+        return StreamWrite((type == MESSAGE_STDOUT) ? consoleOut : consoleErr,
+            buffer, bytesToWrite, bytesWritten);
+    }
+
+    status = SendMessage(conn, type, buffer, (apr_uint32_t)bytesToWrite);
+    if (bytesWritten != NULL) {
+        *bytesWritten = (status == APR_SUCCESS) ? bytesToWrite : 0;
+    }
+    return status;
+}
+
+/*++
+
+ReadRequest
+
+    Reads and unpacks a client's request.
+
+Arguments:
+    conn    - Pointer to the client connection.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+ReadRequest(
+    CONNECTION *conn
+    )
+{
+    apr_status_t status;
+    apr_uint32_t i;
+    char *buffer;
+    char *end;
+    char *offset;
+    REQUEST request;
+
+    status = RecvFull(conn->socket, &request, sizeof(REQUEST));
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    if (request.magic != REQUEST_MAGIC || request.argc < 1 ||
+            request.length > REQUEST_MAX || request.argc + request.envc + 1 > request.length) {
+        return APR_EINVAL;
+    }
+
+    buffer = apr_palloc(conn->pool, request.length + 1);
+    conn->argv = apr_palloc(conn->pool, (request.argc + request.envc + 1) * sizeof(char *));
+    if (buffer == NULL || conn->argv == NULL) {
+        return APR_ENOMEM;
+    }
+
+    status = RecvFull(conn->socket, buffer, request.length);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Split the null-terminated strings, guarding against a missing terminator
+    buffer[request.length] = '\0';
+    end = buffer + request.length;
+
+    conn->cwd = buffer;
+    offset = buffer + strlen(buffer) + 1;
+
+    for (i = 0; i < request.argc + request.envc; i++) {
+        if (offset >= end) {
+            return APR_EINVAL;
+        }
+        conn->argv[i] = offset;
+        offset += strlen(offset) + 1;
+    }
+    conn->argv[i] = NULL;
+
+    conn->argc = (int)request.argc;
+    conn->envc = (int)request.envc;
+    conn->envp = conn->argv + request.argc;
+    return APR_SUCCESS;
+}
+
+/*++
+
+HandleConnection
+
+    Processes a client's event and performs any deferred work afterwards.
+
+Arguments:
+    conn    - Pointer to the client connection.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+HandleConnection(
+    CONNECTION *conn
+    )
+{
+    apr_status_t status;
+    apr_pool_t *eventPool;
+
+    status = ReadRequest(conn);
+    if (status != APR_SUCCESS) {
+        // Connections closed without a request only check if the daemon is running
+        if (status != APR_EOF) {
+            LOG_ERROR("Unable to read daemon request: %s", GetErrorMessage(status));
+        }
+        return;
+    }
+
+    if (strcmp(conn->cwd, workPath) != 0) {
+        LOG_VERBOSE("Daemon rejected event \"%s\" from \"%s\", it runs in \"%s\".",
+            conn->argv[0], conn->cwd, workPath);
+        SendMessage(conn, MESSAGE_REJECT, NULL, 0);
+        return;
+    }
+
+    LOG_VERBOSE("Daemon received event \"%s\" with %d arguments.", conn->argv[0], conn->argc);
+
+    status = apr_pool_create(&eventPool, conn->pool);
+    if (status == APR_SUCCESS) {
+        apr_threadkey_private_set(conn, connKey);
+        status = EventDispatch(conn->argc, conn->argv, eventPool);
+        apr_threadkey_private_set(NULL, connKey);
+    }
+
+    // Release the client before doing any deferred work
+    SendMessage(conn, MESSAGE_EXIT, NULL, (status == APR_SUCCESS) ? 0 : 1);
+
+    apr_thread_mutex_lock(deferMutex);
+    EventDeferred(conn->pool);
+    apr_thread_mutex_unlock(deferMutex);
+}
+
+/*++
+
+WorkerThread
+
+    Worker thread procedure, accepts and handles connections.
+
+Arguments:
+    thread  - Pointer to the thread. This argument is null for the main thread.
+
+    data    - Pointer to the thread's memory pool.
+
+Return Values:
+    Never returns.
+
+Remarks:
+    Every worker waits in accept() on the shared listening socket, so a
+    connection is handed directly to an idle thread.
+
+--*/
+static
+void *
+APR_THREAD_FUNC
+WorkerThread(
+    apr_thread_t *thread,
+    void *data
+    )
+{
+    apr_pool_t *pool = data;
+    apr_socket_t *socket;
+    apr_status_t status;
+    CONNECTION *conn;
+
+    for (;;) {
+        apr_pool_clear(pool);
+
+        status = apr_socket_accept(&socket, listener, pool);
+        if (status != APR_SUCCESS) {
+            LOG_WARNING("Unable to accept connection: %s", GetErrorMessage(status));
+
+            // Avoid spinning on persistent errors (e.g. out of descriptors)
+            apr_sleep(APR_USEC_PER_SEC / 10);
+            continue;
+        }
+
+        conn = apr_pcalloc(pool, sizeof(CONNECTION));
+        conn->pool   = pool;
+        conn->socket = socket;
+
+        HandleConnection(conn);
+        apr_socket_close(socket);
+    }
+    return NULL;
+}
+
+/*++
+
+GetSocketPath
+
+    Retrieves the path of the daemon's socket.
+
+Arguments:
+    path    - Location to store the socket path.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code; APR_EBADPATH if the path is not absolute.
+
+Remarks:
+    The ALCOTOOLS_SOCKET environment variable overrides DAEMON_SOCKET, and
+    "%u" in the path is replaced with the user ID. The path is not read from
+    the configuration file, since clients forward events before reading it.
+
+--*/
+static
+apr_status_t
+GetSocketPath(
+    char **path,
+    apr_pool_t *pool
+    )
+{
+    apr_gid_t gid;
+    apr_uid_t uid;
+    apr_status_t status;
+    char *marker;
+
+    if (apr_env_get(path, "ALCOTOOLS_SOCKET", pool) != APR_SUCCESS || **path == '\0') {
+        *path = DAEMON_SOCKET;
+    }
+
+    marker = strstr(*path, "%u");
+    if (marker != NULL) {
+        status = apr_uid_current(&uid, &gid, pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        *path = apr_psprintf(pool, "%.*s%u%s", (int)(marker - *path), *path,
+            (unsigned int)uid, marker + 2);
+    }
+    return (**path == '/') ? APR_SUCCESS : APR_EBADPATH;
+}
+
+/*++
+
+GetSocketDir
+
+    Retrieves the directory containing the daemon's socket.
+
+Arguments:
+    path    - Pointer to a null-terminated string that specifies the socket path.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Pointer to the directory path.
+
+--*/
+static
+char *
+GetSocketDir(
+    const char *path,
+    apr_pool_t *pool
+    )
+{
+    const char *end = strrchr(path, '/');
+
+    return (end == path) ? "/" : apr_pstrndup(pool, path, end - path);
+}
+
+/*++
+
+CheckPrivate
+
+    Checks that a file belongs to the current user and is not writable by others.
+
+Arguments:
+    path    - Pointer to a null-terminated string that specifies the file path.
+
+    type    - Required file type. Symbolic links are not followed.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code; APR_EACCES if the file is of another type,
+    belongs to another user, or is writable by others.
+
+--*/
+static
+apr_status_t
+CheckPrivate(
+    const char *path,
+    apr_filetype_e type,
+    apr_pool_t *pool
+    )
+{
+    apr_finfo_t info;
+    apr_gid_t gid;
+    apr_uid_t uid;
+    apr_status_t status;
+
+    status = apr_uid_current(&uid, &gid, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = apr_stat(&info, path, APR_FINFO_LINK|APR_FINFO_TYPE|APR_FINFO_OWNER|APR_FINFO_PROT, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    if (info.filetype != type || info.user != uid ||
+            (info.protection & (APR_FPROT_GWRITE|APR_FPROT_WWRITE)) != 0) {
+        return APR_EACCES;
+    }
+    return APR_SUCCESS;
+}
+
+/*++
+
+GetDaemonAddress
+
+    Retrieves the address of the daemon's socket.
+
+Arguments:
+    address - Location to store the socket address.
+
+    path    - Pointer to a null-terminated string that specifies the socket path.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+GetDaemonAddress(
+    apr_sockaddr_t **address,
+    const char *path,
+    apr_pool_t *pool
+    )
+{
+    return apr_sockaddr_info_get(address, path, APR_UNIX, 0, 0, pool);
+}
+
+/*++
+
+Connect
+
+    Connects to the daemon's socket.
+
+Arguments:
+    socket  - Location to store the connected socket.
+
+    path    - Pointer to a null-terminated string that specifies the socket path.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+Connect(
+    apr_socket_t **socket,
+    const char *path,
+    apr_pool_t *pool
+    )
+{
+    apr_sockaddr_t *address;
+    apr_status_t status;
+
+    status = GetDaemonAddress(&address, path, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = apr_socket_create(socket, APR_UNIX, SOCK_STREAM, 0, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = apr_socket_connect(*socket, address);
+    if (status != APR_SUCCESS) {
+        apr_socket_close(*socket);
+    }
+    return status;
+}
+
+/*++
+
+DaemonClient
+
+    Forwards an event to the resident daemon and relays its output.
+
+Arguments:
+    argc        - Number of event arguments, including the event name.
+
+    argv        - Array of pointers to the event arguments.
+
+    exitStatus  - Location to store the process exit status.
+
+    pool        - Pointer to a memory pool.
+
+Return Values:
+    If the event was forwarded, the return value is APR_SUCCESS. The event's
+    outcome is returned in 'exitStatus'.
+
+    If the daemon is not running, its socket could have been bound by another
+    user, or it rejected the event since it runs in another working directory,
+    the return value is an APR status code and the event must be processed by
+    the caller.
+
+--*/
+apr_status_t
+DaemonClient(
+    int argc,
+    char **argv,
+    int *exitStatus,
+    apr_pool_t *pool
+    )
+{
+    apr_file_t *output[2];
+    apr_byte_t chunk[4096];
+    apr_size_t length;
+    apr_size_t size;
+    apr_socket_t *socket;
+    apr_status_t status;
+    char *buffer;
+    char *cwd;
+    char *offset;
+    char *path;
+    int envc;
+    int i;
+    MESSAGE message;
+    REQUEST *request;
+
+    ASSERT(argc > 0);
+    ASSERT(argv != NULL);
+    ASSERT(exitStatus != NULL);
+
+    // Nothing is sent to a socket that another user could have bound
+    if ((status = GetSocketPath(&path, pool)) != APR_SUCCESS ||
+        (status = CheckPrivate(GetSocketDir(path, pool), APR_DIR, pool)) != APR_SUCCESS ||
+        (status = CheckPrivate(path, APR_SOCK, pool)) != APR_SUCCESS ||
+        (status = apr_filepath_get(&cwd, 0, pool)) != APR_SUCCESS ||
+        (status = Connect(&socket, path, pool)) != APR_SUCCESS) {
+        return status;
+    }
+
+    // Pack the working directory, arguments, and environment after the request header
+    length = strlen(cwd) + 1;
+    for (i = 0; i < argc; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+    for (envc = 0; environ[envc] != NULL; envc++) {
+        length += strlen(environ[envc]) + 1;
+    }
+
+    buffer = apr_palloc(pool, sizeof(REQUEST) + length);
+    request = (REQUEST *)buffer;
+    request->magic  = REQUEST_MAGIC;
+    request->argc   = (apr_uint32_t)argc;
+    request->envc   = (apr_uint32_t)envc;
+    request->length = (apr_uint32_t)length;
+
+    offset = buffer + sizeof(REQUEST);
+    size = strlen(cwd) + 1;
+    memcpy(offset, cwd, size);
+    offset += size;
+    for (i = 0; i < argc; i++) {
+        size = strlen(argv[i]) + 1;
+        memcpy(offset, argv[i], size);
+        offset += size;
+    }
+    for (i = 0; i < envc; i++) {
+        size = strlen(environ[i]) + 1;
+        memcpy(offset, environ[i], size);
+        offset += size;
+    }
+
+    apr_file_open_stdout(&output[0], pool);
+    apr_file_open_stderr(&output[1], pool);
+
+    //
+    // From here on, the daemon may have started processing the event and
+    // it must not be processed again by the caller.
+    //
+    *exitStatus = 1;
+    status = SendFull(socket, buffer, sizeof(REQUEST) + length);
+
+    while (status == APR_SUCCESS) {
+        status = RecvFull(socket, &message, sizeof(MESSAGE));
+        if (status != APR_SUCCESS) {
+            break;
+        }
+
+        if (message.type == MESSAGE_EXIT) {
+            *exitStatus = (int)message.value;
+            break;
+        } else if (message.type == MESSAGE_REJECT) {
+            // The event was not processed, the caller processes it instead
+            apr_socket_close(socket);
+            return APR_EBADPATH;
+        } else if (message.type != MESSAGE_STDOUT && message.type != MESSAGE_STDERR) {
+            status = APR_EINVAL;
+            break;
+        }
+
+        // Relay the output in chunks
+        while (message.value > 0) {
+            size = MIN(message.value, sizeof(chunk));
+            status = RecvFull(socket, chunk, size);
+            if (status != APR_SUCCESS) {
+                break;
+            }
+            apr_file_write_full(output[message.type - MESSAGE_STDOUT], chunk, size, NULL);
+            message.value -= (apr_uint32_t)size;
+        }
+    }
+    apr_socket_close(socket);
+
+    if (status != APR_SUCCESS) {
+        printf("Lost connection to the daemon: %s\n", GetErrorMessage(status));
+    }
+    return APR_SUCCESS;
+}
+
+/*++
+
+DaemonGetEnv
+
+    Retrieves an environment variable forwarded by the client.
+
+Arguments:
+    name    - Pointer to a null-terminated string that specifies the variable name.
+
+Return Values:
+    If the current thread is handling a client, the return value is a pointer
+    to the variable's value, or an empty string if the client did not set it.
+
+    If the current thread is not handling a client, the return value is null.
+
+--*/
+const char *
+DaemonGetEnv(
+    const char *name
+    )
+{
+    apr_size_t length;
+    int i;
+    CONNECTION *conn;
+
+    ASSERT(name != NULL);
+
+    if (connKey == NULL || apr_threadkey_private_get((void **)&conn, connKey) != APR_SUCCESS || conn == NULL) {
+        return NULL;
+    }
+
+    length = strlen(name);
+    for (i = 0; i < conn->envc; i++) {
+        if (strncmp(conn->envp[i], name, length) == 0 && conn->envp[i][length] == '=') {
+            return conn->envp[i] + length + 1;
+        }
+    }
+    return "";
+}
+
+/*++
+
+DaemonRun
+
+    Runs the resident daemon, accepting events from clients.
+
+Arguments:
+    pool    - Main application pool, to create sub-pools from.
+
+Return Values:
+    Returns an APR status code if the daemon could not be started; otherwise,
+    the function does not return.
+
+--*/
+apr_status_t
+DaemonRun(
+    apr_pool_t *pool
+    )
+{
+    apr_pool_t *workerPool;
+    apr_sockaddr_t *address;
+    apr_socket_t *socket;
+    apr_status_t status;
+    apr_thread_t *thread;
+    apr_uint32_t i;
+    apr_uint32_t threads;
+    char *dirPath;
+    char *lockPath;
+    char *path;
+
+    if (ConfigGetInt(SectionGeneral, GeneralDaemonThreads, &threads) != APR_SUCCESS || threads < 1) {
+        threads = THREADS_DEFAULT;
+    }
+
+    status = GetSocketPath(&path, pool);
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Daemon socket \"%s\" is not an absolute path.", path);
+        return status;
+    }
+    status = apr_filepath_get(&workPath, 0, pool);
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Unable to retrieve the working directory: %s", GetErrorMessage(status));
+        return status;
+    }
+
+    // Clients only trust the socket in a directory no other user can write to
+    dirPath = GetSocketDir(path, pool);
+    status = apr_dir_make(dirPath, APR_FPROT_UREAD|APR_FPROT_UWRITE|APR_FPROT_UEXECUTE, pool);
+    if (status == APR_SUCCESS || APR_STATUS_IS_EEXIST(status)) {
+        status = CheckPrivate(dirPath, APR_DIR, pool);
+    }
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Daemon socket directory \"%s\" must belong to this user and not be writable by others: %s",
+            dirPath, GetErrorMessage(status));
+        return status;
+    }
+
+    //
+    // The lock is held until the daemon exits. A daemon starting while another
+    // holds it would otherwise remove the socket the other one listens on.
+    //
+    lockPath = apr_pstrcat(pool, path, ".lock", NULL);
+    status = apr_file_open(&lockFile, lockPath, APR_FOPEN_WRITE|APR_FOPEN_CREATE, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Unable to open \"%s\": %s", lockPath, GetErrorMessage(status));
+        return status;
+    }
+    if (apr_file_lock(lockFile, APR_FLOCK_EXCLUSIVE|APR_FLOCK_NONBLOCK) != APR_SUCCESS) {
+        printf("The daemon is already running.\n");
+        return APR_EEXIST;
+    }
+
+    // Refuse to replace a socket that still accepts connections, but remove a stale one
+    if (Connect(&socket, path, pool) == APR_SUCCESS) {
+        apr_socket_close(socket);
+        printf("The daemon is already running.\n");
+        return APR_EEXIST;
+    }
+    apr_file_remove(path, pool);
+
+    status = GetDaemonAddress(&address, path, pool);
+    if (status == APR_SUCCESS) {
+        status = apr_socket_create(&listener, APR_UNIX, SOCK_STREAM, 0, pool);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_socket_bind(listener, address);
+    }
+    if (status == APR_SUCCESS) {
+        // Events run with the daemon's privileges, only its owner may connect
+        status = apr_file_perms_set(path, APR_FPROT_UREAD|APR_FPROT_UWRITE);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_socket_listen(listener, SOMAXCONN);
+    }
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Unable to listen on \"%s\": %s", path, GetErrorMessage(status));
+        return status;
+    }
+
+    if ((status = apr_thread_mutex_create(&deferMutex, APR_THREAD_MUTEX_DEFAULT, pool)) != APR_SUCCESS ||
+        (status = apr_threadkey_private_create(&connKey, NULL, pool)) != APR_SUCCESS) {
+        return status;
+    }
+
+    // Redirect the standard streams to the client handled by each thread
+    consoleErr = streamErr;
+    consoleOut = streamOut;
+    streamErr = StreamCreate((void *)&typeStderr, NULL, RedirectWrite, NULL, NULL, pool);
+    streamOut = StreamCreate((void *)&typeStdout, NULL, RedirectWrite, NULL, NULL, pool);
+    if (streamErr == NULL || streamOut == NULL) {
+        return APR_ENOMEM;
+    }
+
+    //
+    // Each worker has its own pool, since pools are not thread-safe. The main
+    // thread becomes the last worker.
+    //
+    for (i = 0; i < threads; i++) {
+        status = apr_pool_create(&workerPool, pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (i == threads - 1) {
+            break;
+        }
+
+        status = apr_thread_create(&thread, NULL, WorkerThread, workerPool, pool);
+        if (status != APR_SUCCESS) {
+            LOG_ERROR("Unable to create worker thread: %s", GetErrorMessage(status));
+            return status;
+        }
+    }
+    LOG_VERBOSE("Daemon listening on \"%s\" in \"%s\" with %u worker threads.", path, workPath, threads);
+
+    WorkerThread(NULL, workerPool);
+    return APR_SUCCESS;
+}
+
+#else // APR_HAS_THREADS && APR_UNIX
+
+apr_status_t
+DaemonClient(
+    int argc,
+    char **argv,
+    int *exitStatus,
+    apr_pool_t *pool
+    )
+{
+    return APR_ENOTIMPL;
+}
+
+apr_status_t
+DaemonRun(
+    apr_pool_t *pool
+    )
+{
+    printf("Daemon mode requires APR with thread and Unix domain socket support.\n");
+    return APR_ENOTIMPL;
+}
+
+const char *
+DaemonGetEnv(
+    const char *name
+    )
+{
+    return NULL;
+}
+
+#endif // APR_HAS_THREADS && APR_UNIX
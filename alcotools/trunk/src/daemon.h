@@ -0,0 +1,35 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Daemon
+
+Abstract:
+    Resident daemon and client function prototypes.
+
+--*/
+
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+apr_status_t
+DaemonClient(
+    int argc,
+    char **argv,
+    int *exitStatus,
+    apr_pool_t *pool
+    );
+
+apr_status_t
+DaemonRun(
+    apr_pool_t *pool
+    );
+
+const char *
+DaemonGetEnv(
+    const char *name
+    );
+
+#endif // _DAEMON_H_
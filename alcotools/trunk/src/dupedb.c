@@ -0,0 +1,1842 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Dupe Database
+
+Abstract:
+    This module implements an embedded dupe database. It consists of two files:
+
+    Log   - Append-only journal of directory creations and removals. Every
+            record is checksummed, so a torn write only loses that record.
+
+    Index - Memory mapped snapshot of the log, sorted by lower-cased name and
+            then by time (newest first). A second array orders the entries by
+            time, for listing new directories. The index is rebuilt from the
+            previous index and the log's tail by DupeCompact.
+
+    Records appended after the index was built (the tail) are read into memory
+    when the database is opened. Removals are recorded as tombstones, which
+    hide every older record with the same name (or beneath the same path).
+
+    Both files are in host byte order; they are not portable across platforms.
+
+--*/
+
+#include "alcoholicz.h"
+
+#define LOG_MAGIC       0x4C504441  // "ADPL"
+#define INDEX_MAGIC     0x58494441  // "ADIX"
+#define INDEX_VERSION   1
+
+// Record types
+#define RECORD_CREATE       1
+#define RECORD_DELETE       2
+#define RECORD_DELETE_PATH  3       // Internal, tombstone for a path
+
+// Lower-case an ASCII character
+#define TOLOWER(ch)     (((ch) >= 'A' && (ch) <= 'Z') ? ((ch) - 'A' + 'a') : (ch))
+
+typedef struct {
+    apr_uint32_t magic;         // Record signature, LOG_MAGIC
+    apr_uint32_t crc;           // CRC-32 checksum of the following fields and data
+    apr_int64_t  time;          // Time the record was written
+    apr_uint16_t type;          // Record type
+    apr_uint16_t pathLength;    // Length of the path, in bytes
+    apr_byte_t   userLength;    // Length of the user name, in bytes
+    apr_byte_t   groupLength;   // Length of the group name, in bytes
+    apr_uint16_t reserved;      // Reserved, must be zero
+} LOG_RECORD;
+
+typedef struct {
+    apr_uint32_t magic;         // Index signature, INDEX_MAGIC
+    apr_uint32_t version;       // Index format version, INDEX_VERSION
+    apr_uint64_t logLength;     // Length of the log covered by the index
+    apr_uint64_t count;         // Number of index entries
+    apr_uint64_t stringsLength; // Length of the string table, in bytes
+} INDEX_HEADER;
+
+typedef struct {
+    apr_uint64_t offset;        // Offset of the entry's strings in the string table
+    apr_int64_t  time;          // Time the directory was created
+    apr_uint16_t nameLength;    // Length of the lower-cased name, in bytes
+    apr_uint16_t pathLength;    // Length of the path, in bytes
+    apr_byte_t   userLength;    // Length of the user name, in bytes
+    apr_byte_t   groupLength;   // Length of the group name, in bytes
+    apr_uint16_t reserved;      // Reserved, must be zero
+} INDEX_ENTRY;
+
+typedef struct {
+    const char   *name;         // Lower-cased name (not null-terminated)
+    const char   *path;         // Virtual path (not null-terminated)
+    const char   *user;         // User name (not null-terminated)
+    const char   *group;        // Group name (not null-terminated)
+    apr_int64_t  time;          // Time the record was written
+    apr_uint64_t position;      // Offset in the log, zero for indexed records
+    apr_uint32_t slot;          // Position in the rebuilt index (compaction only)
+    apr_uint16_t nameLength;    // Length of the name, in bytes
+    apr_uint16_t pathLength;    // Length of the path, in bytes
+    apr_byte_t   userLength;    // Length of the user name, in bytes
+    apr_byte_t   groupLength;   // Length of the group name, in bytes
+    apr_byte_t   type;          // Record type
+} RECORD;
+
+typedef struct {
+    int          type;          // Search type, DUPE_MATCH_* or zero to match all
+    const char   *key;          // Lower-cased pattern
+    apr_size_t   keyLength;     // Length of the pattern, in bytes
+    bool_t       path;          // Match against the path instead of the name
+} MATCH;
+
+struct DUPE_DB {
+    char               *logPath;        // Path to the log file
+    char               *indexPath;      // Path to the index file
+    char               *lockPath;       // Path to the compaction lock file
+    apr_file_t         *logFile;        // Handle to the log file
+    apr_mmap_t         *indexMap;       // Mapped view of the index, null if none
+    const INDEX_ENTRY  *entries;        // Index entries, sorted by name
+    const apr_uint32_t *timeOrder;      // Index entry numbers, newest first
+    const char         *strings;        // Index string table
+    apr_uint32_t       count;           // Number of index entries
+    apr_uint64_t       indexLength;     // Length of the log covered by the index
+    apr_uint64_t       logLength;       // Length of the log read when opened
+    RECORD             *tail;           // Records following the indexed log
+    RECORD             **created;       // Tail creations, newest first
+    RECORD             **deleted;       // Tail tombstones, in log order
+    apr_uint32_t       tailCount;       // Number of tail records
+    apr_uint32_t       createdCount;    // Number of tail creations
+    apr_uint32_t       deletedCount;    // Number of tail tombstones
+    apr_uint32_t       appended;        // Records appended through this handle
+    apr_pool_t         *pool;           // Pool the database was opened with
+};
+
+
+/*++
+
+GetIndexed
+
+    Retrieves a record view of an index entry.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    number  - Index entry number.
+
+    record  - Pointer to the record structure to populate.
+
+Return Values:
+    None.
+
+--*/
+static
+inline
+void
+GetIndexed(
+    const DUPE_DB *db,
+    apr_uint32_t number,
+    RECORD *record
+    )
+{
+    const INDEX_ENTRY *entry = &db->entries[number];
+
+    ASSERT(number < db->count);
+
+    record->name        = db->strings + entry->offset;
+    record->path        = record->name + entry->nameLength;
+    record->user        = record->path + entry->pathLength;
+    record->group       = record->user + entry->userLength;
+    record->time        = entry->time;
+    record->position    = 0;
+    record->nameLength  = entry->nameLength;
+    record->pathLength  = entry->pathLength;
+    record->userLength  = entry->userLength;
+    record->groupLength = entry->groupLength;
+    record->type        = RECORD_CREATE;
+}
+
+/*++
+
+GetName
+
+    Retrieves the last component of a path.
+
+Arguments:
+    path    - Pointer to the path (need not be null-terminated).
+
+    length  - Length of the path, in bytes.
+
+    name    - Location to store the length of the name, in bytes.
+
+Return Values:
+    Pointer to the name within the path.
+
+--*/
+static
+const char *
+GetName(
+    const char *path,
+    apr_size_t length,
+    apr_size_t *nameLength
+    )
+{
+    apr_size_t i = length;
+
+    // Ignore trailing slashes
+    while (i > 0 && (path[i-1] == '/' || path[i-1] == '\\')) {
+        i--;
+    }
+    length = i;
+
+    while (i > 0 && path[i-1] != '/' && path[i-1] != '\\') {
+        i--;
+    }
+
+    *nameLength = length - i;
+    return path + i;
+}
+
+/*++
+
+LowerCopy
+
+    Copies a string, converting ASCII characters to lower-case.
+
+Arguments:
+    dest    - Pointer to the destination buffer.
+
+    src     - Pointer to the source buffer.
+
+    length  - Number of bytes to copy.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+LowerCopy(
+    char *dest,
+    const char *src,
+    apr_size_t length
+    )
+{
+    while (length--) {
+        *dest++ = TOLOWER(*src);
+        src++;
+    }
+}
+
+/*++
+
+GlobMatch
+
+    Matches a string against a wildcard pattern.
+
+Arguments:
+    pattern - Pointer to a null-terminated, lower-cased pattern. The asterisk
+              matches any sequence of characters and the question mark matches
+              any single character.
+
+    string  - Pointer to the string (need not be null-terminated). The string
+              is compared case-insensitively.
+
+    length  - Length of the string, in bytes.
+
+Return Values:
+    If the string matches the pattern, the return is nonzero (true).
+
+    If the string does not match the pattern, the return is zero (false).
+
+--*/
+static
+bool_t
+GlobMatch(
+    const char *pattern,
+    const char *string,
+    apr_size_t length
+    )
+{
+    const char *end = string + length;
+    const char *starPattern = NULL;
+    const char *starString = NULL;
+
+    while (string < end) {
+        if (*pattern == '*') {
+            // Remember the position after the asterisk, for backtracking
+            starPattern = ++pattern;
+            starString = string;
+
+        } else if (*pattern == '?' || *pattern == TOLOWER(*string)) {
+            pattern++;
+            string++;
+
+        } else if (starPattern != NULL) {
+            // Let the last asterisk consume one more character
+            pattern = starPattern;
+            string = ++starString;
+
+        } else {
+            return FALSE;
+        }
+    }
+
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return (*pattern == '\0');
+}
+
+/*++
+
+MatchRecord
+
+    Tests if a record matches the search criteria.
+
+Arguments:
+    record  - Pointer to the record.
+
+    match   - Pointer to the search criteria.
+
+Return Values:
+    If the record matches, the return is nonzero (true).
+
+    If the record does not match, the return is zero (false).
+
+--*/
+static
+bool_t
+MatchRecord(
+    const RECORD *record,
+    const MATCH *match
+    )
+{
+    apr_size_t i;
+    apr_size_t length;
+    const char *string;
+
+    if (match->path) {
+        string = record->path;
+        length = record->pathLength;
+    } else {
+        string = record->name;
+        length = record->nameLength;
+    }
+
+    switch (match->type) {
+        case 0:
+            return TRUE;
+
+        case DUPE_MATCH_EXACT:
+            return (length == match->keyLength && !memcmp(string, match->key, length));
+
+        case DUPE_MATCH_PATH:
+            // Paths are stored as given, not lower-cased
+            return (length == match->keyLength && !strncasecmp(string, match->key, length));
+
+        case DUPE_MATCH_PREFIX:
+            return (length >= match->keyLength && !memcmp(string, match->key, match->keyLength));
+
+        case DUPE_MATCH_GLOB:
+            return GlobMatch(match->key, string, length);
+
+        case DUPE_MATCH_SUBSTR:
+            if (match->keyLength == 0) {
+                return TRUE;
+            }
+            for (i = 0; i + match->keyLength <= length; i++) {
+                if (string[i] == match->key[0] && !memcmp(string + i, match->key, match->keyLength)) {
+                    return TRUE;
+                }
+            }
+            return FALSE;
+    }
+
+    ASSERT(0);
+    return FALSE;
+}
+
+/*++
+
+IsDeleted
+
+    Tests if a record is hidden by a tombstone written after it.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    record  - Pointer to the record.
+
+Return Values:
+    If the record was deleted, the return is nonzero (true).
+
+    If the record was not deleted, the return is zero (false).
+
+--*/
+static
+bool_t
+IsDeleted(
+    const DUPE_DB *db,
+    const RECORD *record
+    )
+{
+    apr_uint32_t i;
+    const RECORD *tomb;
+
+    for (i = 0; i < db->deletedCount; i++) {
+        tomb = db->deleted[i];
+        if (tomb->position <= record->position) {
+            continue;
+        }
+
+        if (tomb->type == RECORD_DELETE_PATH) {
+            // Matches the path itself and everything beneath it
+            if (record->pathLength >= tomb->pathLength &&
+                    strncasecmp(record->path, tomb->path, tomb->pathLength) == 0 &&
+                    (record->pathLength == tomb->pathLength || record->path[tomb->pathLength] == '/')) {
+                return TRUE;
+            }
+        } else if (record->nameLength == tomb->nameLength &&
+                memcmp(record->name, tomb->name, tomb->nameLength) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*++
+
+CompareName
+
+    Compares an index entry's name with a search key.
+
+Arguments:
+    name        - Pointer to the lower-cased name.
+
+    nameLength  - Length of the name, in bytes.
+
+    key         - Pointer to the lower-cased key.
+
+    keyLength   - Length of the key, in bytes.
+
+    prefix      - Names beginning with the key compare equal to it.
+
+Return Values:
+    Less than, equal to, or greater than zero if the name is found
+    to be less than, equal to, or greater than the key.
+
+--*/
+static
+inline
+int
+CompareName(
+    const char *name,
+    apr_size_t nameLength,
+    const char *key,
+    apr_size_t keyLength,
+    bool_t prefix
+    )
+{
+    int result = memcmp(name, key, MIN(nameLength, keyLength));
+
+    if (result != 0) {
+        return result;
+    }
+    if (nameLength < keyLength) {
+        return -1;
+    }
+    if (nameLength > keyLength && !prefix) {
+        return 1;
+    }
+    return 0;
+}
+
+/*++
+
+CompareRecords
+
+    Orders records by name (ascending) then by time (descending). Used
+    with qsort() when rebuilding the index.
+
+Arguments:
+    elem1   - Pointer to the first record pointer.
+
+    elem2   - Pointer to the second record pointer.
+
+Return Values:
+    Less than, equal to, or greater than zero.
+
+--*/
+static
+int
+CompareRecords(
+    const void *elem1,
+    const void *elem2
+    )
+{
+    const RECORD *record1 = *(const RECORD **)elem1;
+    const RECORD *record2 = *(const RECORD **)elem2;
+    int result;
+
+    result = CompareName(record1->name, record1->nameLength,
+        record2->name, record2->nameLength, FALSE);
+
+    if (result == 0) {
+        if (record1->time != record2->time) {
+            result = (record1->time > record2->time) ? -1 : 1;
+        } else if (record1->position != record2->position) {
+            result = (record1->position > record2->position) ? -1 : 1;
+        }
+    }
+    return result;
+}
+
+/*++
+
+CompareTimes
+
+    Orders records by time (descending). Used with qsort().
+
+Arguments:
+    elem1   - Pointer to the first record pointer.
+
+    elem2   - Pointer to the second record pointer.
+
+Return Values:
+    Less than, equal to, or greater than zero.
+
+--*/
+static
+int
+CompareTimes(
+    const void *elem1,
+    const void *elem2
+    )
+{
+    const RECORD *record1 = *(const RECORD **)elem1;
+    const RECORD *record2 = *(const RECORD **)elem2;
+
+    if (record1->time != record2->time) {
+        return (record1->time > record2->time) ? -1 : 1;
+    }
+    if (record1->position != record2->position) {
+        return (record1->position > record2->position) ? -1 : 1;
+    }
+    return 0;
+}
+
+/*++
+
+Bound
+
+    Binary search of the name-ordered index entries.
+
+Arguments:
+    db          - Pointer to a dupe database.
+
+    key         - Pointer to the lower-cased key.
+
+    keyLength   - Length of the key, in bytes.
+
+    prefix      - Names beginning with the key compare equal to it.
+
+    upper       - Find the upper bound instead of the lower bound.
+
+Return Values:
+    The first entry number comparing greater than or equal to the key (lower
+    bound), or the first entry number comparing greater than the key (upper).
+
+--*/
+static
+apr_uint32_t
+Bound(
+    const DUPE_DB *db,
+    const char *key,
+    apr_size_t keyLength,
+    bool_t prefix,
+    bool_t upper
+    )
+{
+    apr_uint32_t low = 0;
+    apr_uint32_t high = db->count;
+    apr_uint32_t middle;
+    const INDEX_ENTRY *entry;
+    int result;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        entry = &db->entries[middle];
+
+        result = CompareName(db->strings + entry->offset,
+            entry->nameLength, key, keyLength, prefix);
+
+        if (result < 0 || (upper && result == 0)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*++
+
+KeepNewest
+
+    Inserts a record into a list of the newest records.
+
+Arguments:
+    results - Array of records, ordered newest first.
+
+    found   - Pointer to the number of records in the array.
+
+    limit   - Capacity of the array.
+
+    record  - Pointer to the record to insert.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+KeepNewest(
+    RECORD *results,
+    apr_uint32_t *found,
+    apr_uint32_t limit,
+    const RECORD *record
+    )
+{
+    apr_uint32_t i = *found;
+
+    if (i == limit) {
+        if (limit == 0 || results[limit-1].time >= record->time) {
+            return;
+        }
+        // Drop the oldest record
+        i--;
+    } else {
+        ++*found;
+    }
+
+    // Shift older records down
+    while (i > 0 && results[i-1].time < record->time) {
+        results[i] = results[i-1];
+        i--;
+    }
+    results[i] = *record;
+}
+
+/*++
+
+SearchRange
+
+    Searches a range of the name-ordered index, and the tail.
+
+Arguments:
+    db          - Pointer to a dupe database.
+
+    match       - Pointer to the search criteria.
+
+    rangeKey    - Pointer to the lower-cased name, or literal prefix of the
+                  names, that all matching records have.
+
+    rangeLength - Length of the range key, in bytes.
+
+    limit       - Maximum number of records to return.
+
+    results     - Array to receive the newest matching records.
+
+    found       - Location to store the number of records returned.
+
+    total       - Location to store the number of matching records. This
+                  argument can be null if not required.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+SearchRange(
+    const DUPE_DB *db,
+    const MATCH *match,
+    const char *rangeKey,
+    apr_size_t rangeLength,
+    apr_uint32_t limit,
+    RECORD *results,
+    apr_uint32_t *found,
+    apr_uint32_t *total
+    )
+{
+    apr_uint32_t count = 0;
+    apr_uint32_t i;
+    apr_uint32_t low;
+    apr_uint32_t high;
+    bool_t prefix;
+    RECORD record;
+
+    prefix = (match->type == DUPE_MATCH_PREFIX || match->type == DUPE_MATCH_GLOB);
+    low  = Bound(db, rangeKey, rangeLength, prefix, FALSE);
+    high = Bound(db, rangeKey, rangeLength, prefix, TRUE);
+    LOG_DEBUG("Searching index range %u-%u for \"%s\".", low, high, match->key);
+
+    for (i = low; i < high; i++) {
+        GetIndexed(db, i, &record);
+
+        if ((match->type == DUPE_MATCH_GLOB || match->type == DUPE_MATCH_PATH) && !MatchRecord(&record, match)) {
+            continue;
+        }
+        if (!IsDeleted(db, &record)) {
+            KeepNewest(results, found, limit, &record);
+            count++;
+        }
+    }
+
+    for (i = 0; i < db->createdCount; i++) {
+        if (MatchRecord(db->created[i], match) && !IsDeleted(db, db->created[i])) {
+            KeepNewest(results, found, limit, db->created[i]);
+            count++;
+        }
+    }
+
+    if (total != NULL) {
+        *total = count;
+    }
+}
+
+/*++
+
+SearchTime
+
+    Searches the index and tail, newest records first.
+
+Arguments:
+    db          - Pointer to a dupe database.
+
+    match       - Pointer to the search criteria.
+
+    limit       - Maximum number of records to return.
+
+    results     - Array to receive the newest matching records.
+
+    found       - Location to store the number of records returned.
+
+    total       - Location to store the number of matching records. This
+                  argument can be null if not required, in which case the
+                  search stops once the limit is reached.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+SearchTime(
+    const DUPE_DB *db,
+    const MATCH *match,
+    apr_uint32_t limit,
+    RECORD *results,
+    apr_uint32_t *found,
+    apr_uint32_t *total
+    )
+{
+    apr_uint32_t count = 0;
+    apr_uint32_t i = 0;
+    apr_uint32_t j = 0;
+    RECORD indexed;
+    const RECORD *record;
+
+    while (i < db->count || j < db->createdCount) {
+        // Merge the two time-ordered lists; tail records win ties
+        if (i < db->count) {
+            GetIndexed(db, db->timeOrder[i], &indexed);
+        }
+        if (j < db->createdCount && (i >= db->count || db->created[j]->time >= indexed.time)) {
+            record = db->created[j++];
+        } else {
+            record = &indexed;
+            i++;
+        }
+
+        if (!MatchRecord(record, match) || IsDeleted(db, record)) {
+            continue;
+        }
+
+        count++;
+        if (*found < limit) {
+            results[(*found)++] = *record;
+        } else if (total == NULL) {
+            break;
+        }
+    }
+
+    if (total != NULL) {
+        *total = count;
+    }
+}
+
+/*++
+
+CopyResults
+
+    Copies records into caller-visible dupe entries.
+
+Arguments:
+    results - Array of records.
+
+    count   - Number of records.
+
+    entries - Array of dupe entries to populate.
+
+    pool    - Pointer to the memory pool to allocate strings from.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+CopyResults(
+    const RECORD *results,
+    apr_uint32_t count,
+    DUPE_ENTRY *entries,
+    apr_pool_t *pool
+    )
+{
+    apr_size_t nameLength;
+    apr_uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        entries[i].time  = results[i].time;
+        entries[i].path  = apr_pstrndup(pool, results[i].path,  results[i].pathLength);
+        entries[i].user  = apr_pstrndup(pool, results[i].user,  results[i].userLength);
+        entries[i].group = apr_pstrndup(pool, results[i].group, results[i].groupLength);
+
+        if (entries[i].path == NULL || entries[i].user == NULL || entries[i].group == NULL) {
+            return APR_ENOMEM;
+        }
+        entries[i].name = GetName(entries[i].path, results[i].pathLength, &nameLength);
+    }
+    return APR_SUCCESS;
+}
+
+/*++
+
+ParseRecord
+
+    Validates and parses a log record.
+
+Arguments:
+    buffer  - Pointer to the record's data.
+
+    length  - Number of bytes available in the buffer.
+
+    record  - Pointer to the record structure to populate. The name field
+              is not set.
+
+Return Values:
+    If the record is valid, the return value is its length, in bytes.
+
+    If the record is invalid or incomplete, the return value is zero.
+
+--*/
+static
+apr_size_t
+ParseRecord(
+    const apr_byte_t *buffer,
+    apr_size_t length,
+    RECORD *record
+    )
+{
+    apr_size_t size;
+    LOG_RECORD header;
+
+    if (length < sizeof(LOG_RECORD)) {
+        return 0;
+    }
+
+    // Records are not aligned in the log
+    memcpy(&header, buffer, sizeof(LOG_RECORD));
+    if (header.magic != LOG_MAGIC) {
+        return 0;
+    }
+
+    size = sizeof(LOG_RECORD) + header.pathLength + header.userLength + header.groupLength;
+    if (size > length || header.pathLength == 0 ||
+            (header.type != RECORD_CREATE && header.type != RECORD_DELETE)) {
+        return 0;
+    }
+
+    if (Crc32Memory(buffer + 8, (apr_uint32_t)(size - 8)) != header.crc) {
+        return 0;
+    }
+
+    record->path        = (const char *)buffer + sizeof(LOG_RECORD);
+    record->user        = record->path + header.pathLength;
+    record->group       = record->user + header.userLength;
+    record->time        = header.time;
+    record->pathLength  = header.pathLength;
+    record->userLength  = header.userLength;
+    record->groupLength = header.groupLength;
+    record->type        = (apr_byte_t)header.type;
+    return size;
+}
+
+/*++
+
+ReadTail
+
+    Reads the log records that follow the indexed portion of the log.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+Return Values:
+    Returns an APR status code.
+
+Remarks:
+    The log must be locked by the caller.
+
+--*/
+static
+apr_status_t
+ReadTail(
+    DUPE_DB *db
+    )
+{
+    apr_byte_t *buffer;
+    apr_off_t offset;
+    apr_size_t length;
+    apr_size_t position;
+    apr_size_t size;
+    apr_size_t nameLength;
+    apr_status_t status;
+    apr_uint32_t skipped = 0;
+    const char *name;
+    char *lower;
+    RECORD *record;
+
+    length = (apr_size_t)(db->logLength - db->indexLength);
+    db->tailCount = db->createdCount = db->deletedCount = 0;
+    if (length == 0) {
+        return APR_SUCCESS;
+    }
+
+    buffer = apr_palloc(db->pool, length);
+
+    // Every record is at least as large as its header
+    db->tail    = apr_palloc(db->pool, (length / sizeof(LOG_RECORD)) * sizeof(RECORD));
+    db->created = apr_palloc(db->pool, (length / sizeof(LOG_RECORD)) * sizeof(RECORD *));
+    db->deleted = apr_palloc(db->pool, (length / sizeof(LOG_RECORD)) * sizeof(RECORD *));
+    if (buffer == NULL || db->tail == NULL || db->created == NULL || db->deleted == NULL) {
+        return APR_ENOMEM;
+    }
+
+    offset = (apr_off_t)db->indexLength;
+    status = apr_file_seek(db->logFile, APR_SET, &offset);
+    if (status == APR_SUCCESS) {
+        status = apr_file_read_full(db->logFile, buffer, length, &length);
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    for (position = 0; position < length; position += size) {
+        record = &db->tail[db->tailCount];
+
+        size = ParseRecord(buffer + position, length - position, record);
+        if (size == 0) {
+            // Skip damaged data until the next valid record
+            skipped++;
+            size = 1;
+            continue;
+        }
+
+        // Positions are one-based, so indexed records (zero) precede them all
+        record->position = db->indexLength + position + 1;
+
+        if (record->type == RECORD_DELETE && memchr(record->path, '/', record->pathLength) != NULL) {
+            record->type = RECORD_DELETE_PATH;
+            name = record->path;
+            nameLength = record->pathLength;
+        } else if (record->type == RECORD_DELETE) {
+            name = record->path;
+            nameLength = record->pathLength;
+        } else {
+            name = GetName(record->path, record->pathLength, &nameLength);
+        }
+
+        lower = apr_palloc(db->pool, nameLength + 1);
+        if (lower == NULL) {
+            return APR_ENOMEM;
+        }
+        LowerCopy(lower, name, nameLength);
+        lower[nameLength] = '\0';
+        record->name = lower;
+        record->nameLength = (apr_uint16_t)nameLength;
+
+        if (record->type == RECORD_CREATE) {
+            db->created[db->createdCount++] = record;
+        } else {
+            db->deleted[db->deletedCount++] = record;
+        }
+        db->tailCount++;
+    }
+
+    if (skipped > 0) {
+        LOG_ERROR("Skipped %u damaged bytes in dupe log \"%s\".", skipped, db->logPath);
+    }
+
+    qsort(db->created, db->createdCount, sizeof(RECORD *), CompareTimes);
+    return APR_SUCCESS;
+}
+
+/*++
+
+OpenIndex
+
+    Maps the index file into memory and validates it.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+Return Values:
+    Returns an APR status code. A missing or invalid index is not an error,
+    the entire log is treated as the tail instead.
+
+--*/
+static
+apr_status_t
+OpenIndex(
+    DUPE_DB *db
+    )
+{
+    apr_file_t *file;
+    apr_finfo_t info;
+    apr_status_t status;
+    apr_uint64_t expected;
+    const INDEX_HEADER *header;
+
+    status = apr_file_open(&file, db->indexPath, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, db->pool);
+    if (APR_STATUS_IS_ENOENT(status)) {
+        return APR_SUCCESS;
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, file);
+    if (status != APR_SUCCESS || info.size < (apr_off_t)sizeof(INDEX_HEADER)) {
+        goto invalid;
+    }
+
+    status = apr_mmap_create(&db->indexMap, file, 0, (apr_size_t)info.size, APR_MMAP_READ, db->pool);
+    if (status != APR_SUCCESS) {
+        apr_file_close(file);
+        return status;
+    }
+
+    // Validate the header before trusting any offsets
+    header = db->indexMap->mm;
+    expected = sizeof(INDEX_HEADER) + header->count * (sizeof(INDEX_ENTRY) + sizeof(apr_uint32_t)) + header->stringsLength;
+
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION ||
+            header->count > APR_UINT32_MAX || expected != (apr_uint64_t)info.size ||
+            header->logLength > db->logLength) {
+        apr_mmap_delete(db->indexMap);
+        db->indexMap = NULL;
+        goto invalid;
+    }
+
+    db->count       = (apr_uint32_t)header->count;
+    db->indexLength = header->logLength;
+    db->entries     = (const INDEX_ENTRY *)(header + 1);
+    db->timeOrder   = (const apr_uint32_t *)(db->entries + db->count);
+    db->strings     = (const char *)(db->timeOrder + db->count);
+
+    // The mapping remains valid after the file is closed
+    apr_file_close(file);
+    return APR_SUCCESS;
+
+invalid:
+    LOG_WARNING("Ignoring invalid dupe index \"%s\".", db->indexPath);
+    apr_file_close(file);
+    return APR_SUCCESS;
+}
+
+/*++
+
+DupeOpen
+
+    Opens a dupe database, creating it if necessary.
+
+Arguments:
+    db      - Location to store the dupe database handle.
+
+    path    - Pointer to a null-terminated string that specifies the database
+              path, without an extension.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+DupeOpen(
+    DUPE_DB **db,
+    const char *path,
+    apr_pool_t *pool
+    )
+{
+    apr_finfo_t info;
+    apr_status_t status;
+    DUPE_DB *dupeDb;
+
+    ASSERT(db   != NULL);
+    ASSERT(path != NULL);
+    ASSERT(pool != NULL);
+
+    dupeDb = apr_pcalloc(pool, sizeof(DUPE_DB));
+    if (dupeDb == NULL) {
+        return APR_ENOMEM;
+    }
+    dupeDb->pool      = pool;
+    dupeDb->logPath   = apr_pstrcat(pool, path, ".log", NULL);
+    dupeDb->indexPath = apr_pstrcat(pool, path, ".idx", NULL);
+    dupeDb->lockPath  = apr_pstrcat(pool, path, ".lck", NULL);
+    LOG_DEBUG("Opening dupe database \"%s\".", path);
+
+    status = apr_file_open(&dupeDb->logFile, dupeDb->logPath, APR_FOPEN_READ|APR_FOPEN_WRITE|
+        APR_FOPEN_CREATE|APR_FOPEN_APPEND|APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Writers hold an exclusive lock while appending a record
+    status = apr_file_lock(dupeDb->logFile, APR_FLOCK_SHARED);
+    if (status != APR_SUCCESS) {
+        apr_file_close(dupeDb->logFile);
+        return status;
+    }
+
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, dupeDb->logFile);
+    if (status == APR_SUCCESS) {
+        dupeDb->logLength = (apr_uint64_t)info.size;
+
+        status = OpenIndex(dupeDb);
+        if (status == APR_SUCCESS) {
+            status = ReadTail(dupeDb);
+        }
+    }
+    apr_file_unlock(dupeDb->logFile);
+
+    if (status != APR_SUCCESS) {
+        DupeClose(dupeDb);
+        return status;
+    }
+
+    LOG_DEBUG("Dupe database has %u indexed and %u pending records.", dupeDb->count, dupeDb->tailCount);
+    *db = dupeDb;
+    return APR_SUCCESS;
+}
+
+/*++
+
+DupeClose
+
+    Closes a dupe database.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+DupeClose(
+    DUPE_DB *db
+    )
+{
+    ASSERT(db != NULL);
+
+    if (db->indexMap != NULL) {
+        apr_mmap_delete(db->indexMap);
+        db->indexMap = NULL;
+    }
+    if (db->logFile != NULL) {
+        apr_file_close(db->logFile);
+        db->logFile = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+/*++
+
+AppendRecord
+
+    Appends a record to the log.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    type    - Record type.
+
+    path    - Pointer to a null-terminated string that specifies the path.
+
+    user    - Pointer to a null-terminated string that specifies the user name.
+
+    group   - Pointer to a null-terminated string that specifies the group name.
+
+    time    - Time of the event.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+AppendRecord(
+    DUPE_DB *db,
+    apr_uint16_t type,
+    const char *path,
+    const char *user,
+    const char *group,
+    apr_time_t time
+    )
+{
+    apr_byte_t buffer[sizeof(LOG_RECORD) + 0xFFFF + 0xFF + 0xFF];
+    apr_byte_t *data;
+    apr_size_t size;
+    apr_status_t status;
+    LOG_RECORD header;
+
+    memset(&header, 0, sizeof(LOG_RECORD));
+    header.magic       = LOG_MAGIC;
+    header.time        = time;
+    header.type        = type;
+    header.pathLength  = (apr_uint16_t)MIN(strlen(path),  0xFFFF);
+    header.userLength  = (apr_byte_t)MIN(strlen(user),  0xFF);
+    header.groupLength = (apr_byte_t)MIN(strlen(group), 0xFF);
+
+    if (header.pathLength == 0) {
+        return APR_EINVAL;
+    }
+
+    // Build the record in one buffer, so it is appended with a single write
+    data = buffer + sizeof(LOG_RECORD);
+    memcpy(data, path, header.pathLength);
+    data += header.pathLength;
+    memcpy(data, user, header.userLength);
+    data += header.userLength;
+    memcpy(data, group, header.groupLength);
+    data += header.groupLength;
+
+    size = data - buffer;
+    memcpy(buffer, &header, sizeof(LOG_RECORD));
+    header.crc = Crc32Memory(buffer + 8, (apr_uint32_t)(size - 8));
+    memcpy(buffer, &header, sizeof(LOG_RECORD));
+
+    status = apr_file_lock(db->logFile, APR_FLOCK_EXCLUSIVE);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = apr_file_write_full(db->logFile, buffer, size, NULL);
+    apr_file_unlock(db->logFile);
+
+    if (status == APR_SUCCESS) {
+        db->appended++;
+    }
+    return status;
+}
+
+/*++
+
+DupeAdd
+
+    Records the creation of a directory.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    path    - Pointer to a null-terminated string that specifies the virtual
+              path of the directory.
+
+    user    - Pointer to a null-terminated string that specifies the creator.
+
+    group   - Pointer to a null-terminated string that specifies the creator's group.
+
+    time    - Time the directory was created.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+DupeAdd(
+    DUPE_DB *db,
+    const char *path,
+    const char *user,
+    const char *group,
+    apr_time_t time
+    )
+{
+    ASSERT(db    != NULL);
+    ASSERT(path  != NULL);
+    ASSERT(user  != NULL);
+    ASSERT(group != NULL);
+
+    LOG_DEBUG("Adding dupe entry \"%s\".", path);
+    return AppendRecord(db, RECORD_CREATE, path, user, group, time);
+}
+
+/*++
+
+DupeRemove
+
+    Records a tombstone, hiding all previously recorded matching directories.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    target  - Pointer to a null-terminated string. If it contains a slash, it
+              is a virtual path and the directory and everything beneath it
+              is removed. Otherwise, every directory with that name is removed.
+
+    time    - Time of the removal.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+DupeRemove(
+    DUPE_DB *db,
+    const char *target,
+    apr_time_t time
+    )
+{
+    ASSERT(db     != NULL);
+    ASSERT(target != NULL);
+
+    LOG_DEBUG("Removing dupe entry \"%s\".", target);
+    return AppendRecord(db, RECORD_DELETE, target, "", "", time);
+}
+
+/*++
+
+DupeSearch
+
+    Searches for directories by name, newest first.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    type    - Search type (DUPE_MATCH_EXACT, DUPE_MATCH_PREFIX, DUPE_MATCH_GLOB,
+              DUPE_MATCH_SUBSTR, or DUPE_MATCH_PATH). Names and paths are
+              compared case-insensitively.
+
+    pattern - Pointer to a null-terminated string that specifies the pattern.
+
+    limit   - Maximum number of entries to return.
+
+    entries - Array of at least 'limit' entries to receive the results.
+
+    found   - Location to store the number of entries returned.
+
+    total   - Location to store the total number of matches. This argument can
+              be null if not required, which may end the search sooner.
+
+    pool    - Pointer to the memory pool to allocate result strings from.
+
+Return Values:
+    Returns an APR status code.
+
+Remarks:
+    Exact, prefix, and path searches, and wildcard patterns that begin with
+    literal characters, are binary searches of the index. Other patterns scan the
+    index newest first, stopping at the limit unless a total is requested.
+
+--*/
+apr_status_t
+DupeSearch(
+    DUPE_DB *db,
+    int type,
+    const char *pattern,
+    apr_uint32_t limit,
+    DUPE_ENTRY *entries,
+    apr_uint32_t *found,
+    apr_uint32_t *total,
+    apr_pool_t *pool
+    )
+{
+    apr_size_t rangeLength;
+    apr_pool_t *subPool;
+    apr_status_t status;
+    char *key;
+    const char *rangeKey;
+    MATCH match;
+    RECORD *results;
+
+    ASSERT(db      != NULL);
+    ASSERT(pattern != NULL);
+    ASSERT(entries != NULL || limit == 0);
+    ASSERT(found   != NULL);
+    ASSERT(pool    != NULL);
+
+    *found = 0;
+    if (total != NULL) {
+        *total = 0;
+    }
+
+    status = apr_pool_create(&subPool, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    match.type      = type;
+    match.keyLength = strlen(pattern);
+    match.path      = (type == DUPE_MATCH_PATH);
+    match.key = key = apr_palloc(subPool, match.keyLength + 1);
+    results = apr_palloc(subPool, MAX(limit, 1) * sizeof(RECORD));
+
+    if (key == NULL || results == NULL) {
+        apr_pool_destroy(subPool);
+        return APR_ENOMEM;
+    }
+    LowerCopy(key, pattern, match.keyLength + 1);
+
+    switch (type) {
+        case DUPE_MATCH_EXACT:
+        case DUPE_MATCH_PREFIX:
+            SearchRange(db, &match, key, match.keyLength, limit, results, found, total);
+            break;
+
+        case DUPE_MATCH_PATH:
+            // Search the index range of the path's name
+            rangeKey = GetName(key, match.keyLength, &rangeLength);
+            SearchRange(db, &match, rangeKey, rangeLength, limit, results, found, total);
+            break;
+
+        case DUPE_MATCH_GLOB:
+            // Use the literal prefix of the pattern to narrow the index range
+            rangeLength = strcspn(key, "*?");
+            if (rangeLength > 0) {
+                SearchRange(db, &match, key, rangeLength, limit, results, found, total);
+            } else {
+                SearchTime(db, &match, limit, results, found, total);
+            }
+            break;
+
+        case DUPE_MATCH_SUBSTR:
+            SearchTime(db, &match, limit, results, found, total);
+            break;
+
+        default:
+            apr_pool_destroy(subPool);
+            return APR_EINVAL;
+    }
+
+    status = CopyResults(results, *found, entries, pool);
+    apr_pool_destroy(subPool);
+    return status;
+}
+
+/*++
+
+DupeNewest
+
+    Retrieves the most recently created directories.
+
+Arguments:
+    db          - Pointer to a dupe database.
+
+    pathPattern - Pointer to a null-terminated string that specifies a wildcard
+                  pattern the virtual paths must match. This argument can be
+                  null to list all directories.
+
+    limit       - Maximum number of entries to return.
+
+    entries     - Array of at least 'limit' entries to receive the results.
+
+    found       - Location to store the number of entries returned.
+
+    pool        - Pointer to the memory pool to allocate result strings from.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+DupeNewest(
+    DUPE_DB *db,
+    const char *pathPattern,
+    apr_uint32_t limit,
+    DUPE_ENTRY *entries,
+    apr_uint32_t *found,
+    apr_pool_t *pool
+    )
+{
+    apr_pool_t *subPool;
+    apr_status_t status;
+    char *key = NULL;
+    MATCH match;
+    RECORD *results;
+
+    ASSERT(db      != NULL);
+    ASSERT(entries != NULL || limit == 0);
+    ASSERT(found   != NULL);
+    ASSERT(pool    != NULL);
+
+    *found = 0;
+
+    status = apr_pool_create(&subPool, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    match.type      = 0;
+    match.keyLength = 0;
+    match.path      = TRUE;
+
+    if (pathPattern != NULL) {
+        match.type      = DUPE_MATCH_GLOB;
+        match.keyLength = strlen(pathPattern);
+        key = apr_palloc(subPool, match.keyLength + 1);
+        if (key != NULL) {
+            LowerCopy(key, pathPattern, match.keyLength + 1);
+        }
+    }
+    match.key = key;
+    results = apr_palloc(subPool, MAX(limit, 1) * sizeof(RECORD));
+
+    if ((pathPattern != NULL && key == NULL) || results == NULL) {
+        apr_pool_destroy(subPool);
+        return APR_ENOMEM;
+    }
+
+    SearchTime(db, &match, limit, results, found, NULL);
+
+    status = CopyResults(results, *found, entries, pool);
+    apr_pool_destroy(subPool);
+    return status;
+}
+
+/*++
+
+DupeGetPending
+
+    Retrieves the number of log records not yet merged into the index.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+Return Values:
+    Number of pending log records.
+
+--*/
+apr_uint32_t
+DupeGetPending(
+    DUPE_DB *db
+    )
+{
+    ASSERT(db != NULL);
+    return db->tailCount + db->appended;
+}
+
+/*++
+
+WriteStrings
+
+    Writes a record's strings to the rebuilt index and fills in its entry.
+
+Arguments:
+    file    - Handle to the index file, positioned in the string table.
+
+    record  - Pointer to the record.
+
+    entry   - Pointer to the index entry to populate.
+
+    offset  - Pointer to the current length of the string table.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+WriteStrings(
+    apr_file_t *file,
+    const RECORD *record,
+    INDEX_ENTRY *entry,
+    apr_uint64_t *offset
+    )
+{
+    apr_status_t status;
+
+    entry->offset      = *offset;
+    entry->time        = record->time;
+    entry->nameLength  = record->nameLength;
+    entry->pathLength  = record->pathLength;
+    entry->userLength  = record->userLength;
+    entry->groupLength = record->groupLength;
+    entry->reserved    = 0;
+
+    status = apr_file_write_full(file, record->name, record->nameLength, NULL);
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, record->path, record->pathLength, NULL);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, record->user, record->userLength, NULL);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, record->group, record->groupLength, NULL);
+    }
+
+    *offset += record->nameLength + record->pathLength + record->userLength + record->groupLength;
+    return status;
+}
+
+/*++
+
+WriteIndex
+
+    Writes a new index, merging the current index with the log's tail.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+    file    - Handle to the new index file.
+
+    pool    - Pointer to a memory pool for temporary allocations.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+WriteIndex(
+    DUPE_DB *db,
+    apr_file_t *file,
+    apr_pool_t *pool
+    )
+{
+    apr_off_t offset;
+    apr_status_t status;
+    apr_uint32_t *slots;
+    apr_uint32_t count = 0;
+    apr_uint32_t created = 0;
+    apr_uint32_t i;
+    apr_uint32_t j;
+    apr_uint32_t slot;
+    INDEX_ENTRY *entries;
+    INDEX_HEADER header;
+    RECORD indexed;
+    RECORD *indexedPtr = &indexed;
+    RECORD **sorted;
+
+    // Map old entry numbers to new ones, dropping deleted entries
+    slots = apr_palloc(pool, MAX(db->count, 1) * sizeof(apr_uint32_t));
+    sorted = apr_palloc(pool, MAX(db->createdCount, 1) * sizeof(RECORD *));
+    if (slots == NULL || sorted == NULL) {
+        return APR_ENOMEM;
+    }
+
+    for (i = 0; i < db->count; i++) {
+        GetIndexed(db, i, &indexed);
+        if (IsDeleted(db, &indexed)) {
+            slots[i] = APR_UINT32_MAX;
+        } else {
+            slots[i] = 0;
+            count++;
+        }
+    }
+    for (i = 0; i < db->createdCount; i++) {
+        if (!IsDeleted(db, db->created[i])) {
+            sorted[created++] = db->created[i];
+        }
+    }
+    qsort(sorted, created, sizeof(RECORD *), CompareRecords);
+    count += created;
+
+    entries = apr_palloc(pool, MAX(count, 1) * sizeof(INDEX_ENTRY));
+    if (entries == NULL) {
+        return APR_ENOMEM;
+    }
+
+    memset(&header, 0, sizeof(INDEX_HEADER));
+    header.magic     = INDEX_MAGIC;
+    header.version   = INDEX_VERSION;
+    header.logLength = db->logLength;
+    header.count     = count;
+
+    // The string table follows the entries and the time-ordered array
+    offset = sizeof(INDEX_HEADER) + (apr_off_t)count * (sizeof(INDEX_ENTRY) + sizeof(apr_uint32_t));
+    status = apr_file_seek(file, APR_SET, &offset);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Merge the name-ordered index with the name-ordered tail
+    slot = 0;
+    i = j = 0;
+    while (status == APR_SUCCESS && (i < db->count || j < created)) {
+        if (i < db->count && slots[i] == APR_UINT32_MAX) {
+            i++;
+            continue;
+        }
+        if (i < db->count) {
+            GetIndexed(db, i, &indexed);
+        }
+
+        if (j < created && (i >= db->count || CompareRecords(&sorted[j], &indexedPtr) <= 0)) {
+            sorted[j]->slot = slot;
+            status = WriteStrings(file, sorted[j++], &entries[slot], &header.stringsLength);
+        } else {
+            slots[i++] = slot;
+            status = WriteStrings(file, &indexed, &entries[slot], &header.stringsLength);
+        }
+        slot++;
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Merge the time-ordered index with the tail (already newest first)
+    offset = sizeof(INDEX_HEADER) + (apr_off_t)count * sizeof(INDEX_ENTRY);
+    status = apr_file_seek(file, APR_SET, &offset);
+
+    i = j = 0;
+    while (status == APR_SUCCESS && (i < db->count || j < db->createdCount)) {
+        if (j < db->createdCount && IsDeleted(db, db->created[j])) {
+            j++;
+            continue;
+        }
+        if (i < db->count && slots[db->timeOrder[i]] == APR_UINT32_MAX) {
+            i++;
+            continue;
+        }
+
+        if (j < db->createdCount && (i >= db->count ||
+                db->created[j]->time >= db->entries[db->timeOrder[i]].time)) {
+            slot = db->created[j++]->slot;
+        } else {
+            slot = slots[db->timeOrder[i++]];
+        }
+        status = apr_file_write_full(file, &slot, sizeof(apr_uint32_t), NULL);
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Write the entries, then the header last
+    offset = 0;
+    status = apr_file_seek(file, APR_SET, &offset);
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, &header, sizeof(INDEX_HEADER), NULL);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, entries, count * sizeof(INDEX_ENTRY), NULL);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_flush(file);
+    }
+
+    LOG_VERBOSE("Rebuilt dupe index with %u entries (%u dropped).", count,
+        (db->count + db->createdCount) - count);
+    return status;
+}
+
+/*++
+
+DupeCompact
+
+    Merges the log's tail into a new index, dropping deleted entries.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+Return Values:
+    Returns an APR status code. If another process is already compacting the
+    database, the return value is APR_EAGAIN.
+
+Remarks:
+    The index is written to a temporary file and renamed over the old one,
+    so readers always see a complete index. Records appended while compacting
+    remain in the tail. On Windows, the rename fails while other processes
+    have the old index mapped; compaction is then retried later.
+
+--*/
+apr_status_t
+DupeCompact(
+    DUPE_DB *db
+    )
+{
+    apr_file_t *file;
+    apr_file_t *lock;
+    apr_pool_t *pool;
+    apr_size_t length;
+    apr_status_t status;
+    char *tempPath;
+    INDEX_HEADER header;
+
+    ASSERT(db != NULL);
+
+    status = apr_pool_create(&pool, db->pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = apr_file_open(&lock, db->lockPath, APR_FOPEN_WRITE|APR_FOPEN_CREATE, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return status;
+    }
+    status = apr_file_lock(lock, APR_FLOCK_EXCLUSIVE|APR_FLOCK_NONBLOCK);
+    if (status != APR_SUCCESS) {
+        apr_file_close(lock);
+        apr_pool_destroy(pool);
+        return APR_EAGAIN;
+    }
+
+    // Another process may have compacted since this database was opened
+    status = apr_file_open(&file, db->indexPath, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    if (status == APR_SUCCESS) {
+        status = apr_file_read_full(file, &header, sizeof(INDEX_HEADER), &length);
+        apr_file_close(file);
+
+        if (status == APR_SUCCESS && header.magic == INDEX_MAGIC &&
+                header.version == INDEX_VERSION && header.logLength >= db->logLength) {
+            LOG_VERBOSE("Dupe index \"%s\" is already up to date.", db->indexPath);
+            goto done;
+        }
+    }
+
+    tempPath = apr_pstrcat(pool, db->indexPath, ".tmp", NULL);
+    status = apr_file_open(&file, tempPath, APR_FOPEN_WRITE|APR_FOPEN_CREATE|
+        APR_FOPEN_TRUNCATE|APR_FOPEN_BINARY|APR_FOPEN_BUFFERED, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        goto done;
+    }
+
+    status = WriteIndex(db, file, pool);
+    apr_file_close(file);
+
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(tempPath, db->indexPath, pool);
+    }
+    if (status != APR_SUCCESS) {
+        apr_file_remove(tempPath, pool);
+    }
+
+done:
+    apr_file_unlock(lock);
+    apr_file_close(lock);
+    apr_pool_destroy(pool);
+    return status;
+}
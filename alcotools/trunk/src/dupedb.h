@@ -0,0 +1,97 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Dupe Database
+
+Abstract:
+    Dupe database function prototypes and structures.
+
+--*/
+
+#ifndef _DUPEDB_H_
+#define _DUPEDB_H_
+
+typedef struct DUPE_DB DUPE_DB;
+
+typedef struct {
+    apr_time_t  time;   // Time the directory was created
+    const char  *path;  // Virtual path of the directory
+    const char  *name;  // Name of the directory, points into 'path'
+    const char  *user;  // Name of the creator
+    const char  *group; // Group of the creator
+} DUPE_ENTRY;
+
+//
+// Search types
+//
+
+#define DUPE_MATCH_EXACT    1   // Name equals the pattern
+#define DUPE_MATCH_PREFIX   2   // Name begins with the pattern
+#define DUPE_MATCH_GLOB     3   // Name matches the wildcard pattern (* and ?)
+#define DUPE_MATCH_SUBSTR   4   // Name contains the pattern
+#define DUPE_MATCH_PATH     5   // Virtual path equals the pattern
+
+apr_status_t
+DupeOpen(
+    DUPE_DB **db,
+    const char *path,
+    apr_pool_t *pool
+    );
+
+apr_status_t
+DupeClose(
+    DUPE_DB *db
+    );
+
+apr_status_t
+DupeAdd(
+    DUPE_DB *db,
+    const char *path,
+    const char *user,
+    const char *group,
+    apr_time_t time
+    );
+
+apr_status_t
+DupeRemove(
+    DUPE_DB *db,
+    const char *target,
+    apr_time_t time
+    );
+
+apr_status_t
+DupeSearch(
+    DUPE_DB *db,
+    int type,
+    const char *pattern,
+    apr_uint32_t limit,
+    DUPE_ENTRY *entries,
+    apr_uint32_t *found,
+    apr_uint32_t *total,
+    apr_pool_t *pool
+    );
+
+apr_status_t
+DupeNewest(
+    DUPE_DB *db,
+    const char *pathPattern,
+    apr_uint32_t limit,
+    DUPE_ENTRY *entries,
+    apr_uint32_t *found,
+    apr_pool_t *pool
+    );
+
+apr_uint32_t
+DupeGetPending(
+    DUPE_DB *db
+    );
+
+apr_status_t
+DupeCompact(
+    DUPE_DB *db
+    );
+
+#endif // _DUPEDB_H_
@@ -22,6 +22,9 @@ static encoding_t currEncoding;
 // Combine encoding types for switch efficiency (endianness doesn't matter here)
 #define MAKE_ENC(from, to) ((apr_uint16_t)(((apr_byte_t)from) | ((apr_uint16_t)((apr_byte_t)to)) << 8))
 
+// Number of UTF-16 or UTF-32 characters converted at a time
+#define ENC_BLOCK 256
+
 
 /*++
 
@@ -86,44 +89,309 @@ EncInit(
 
 /*++
 
-EncConvert
+ConvertResult
 
-    Converts a buffer from one encoding to another.
+    Translates the result of a UTF conversion routine to an APR status code.
 
 Arguments:
-    inEnc       - Encoding of the input buffer.
+    result  - Conversion result.
 
-    inBuffer    - Pointer to the input buffer (data to be converted).
+Return Values:
+    Returns an APR status code.
 
-    inLength    - Length of the input buffer, in bytes.
+--*/
+static
+apr_status_t
+ConvertResult(
+    CONVERSION_RESULT result
+    )
+{
+    switch (result) {
+        case conversionOK:
+            return APR_SUCCESS;
+        case sourceExhausted:
+            return APR_INCOMPLETE;
+        case targetExhausted:
+            return APR_ENOSPC;
+        case sourceIllegal:
+            break;
+    }
+    return APR_EINVAL;
+}
 
-    outEnc      - Encoding of the output buffer.
+/*++
 
-    outBuffer   - Pointer to the pointer that receives the output buffer.
+ConvertFromUTF16
 
-    outLength   - Length of the output buffer, in bytes.
+    Converts a UTF-16 buffer, of either byte order, to UTF-8.
 
-    pool        - Pointer to a memory pool.
+Arguments:
+    bigEndian   - Byte order of the input buffer.
+
+    inBuffer    - Pointer to the pointer to the input buffer; updated to the
+                  first byte that was not converted.
+
+    inEnd       - Pointer to the end of the input buffer.
+
+    outBuffer   - Pointer to the pointer to the output buffer; updated to the
+                  end of the converted data.
+
+    outEnd      - Pointer to the end of the output buffer.
 
 Return Values:
     Returns an APR status code.
 
 --*/
+static
 apr_status_t
-EncConvert(
+ConvertFromUTF16(
+    bool_t bigEndian,
+    const apr_byte_t **inBuffer,
+    const apr_byte_t *inEnd,
+    apr_byte_t **outBuffer,
+    apr_byte_t *outEnd
+    )
+{
+    apr_size_t i;
+    apr_size_t units;
+    bool_t partial;
+    const apr_byte_t *in = *inBuffer;
+    const utf16_t *source;
+    utf16_t block[ENC_BLOCK];
+    CONVERSION_RESULT result = conversionOK;
+
+    while (inEnd - in >= 2) {
+        // Read the characters in host byte order
+        units = MIN((apr_size_t)(inEnd - in) / 2, ARRAYSIZE(block));
+        partial = ((apr_size_t)(inEnd - in) / 2 > units);
+        if (bigEndian) {
+            for (i = 0; i < units; i++) {
+                block[i] = (utf16_t)(in[i*2] << 8 | in[i*2+1]);
+            }
+        } else {
+            for (i = 0; i < units; i++) {
+                block[i] = (utf16_t)(in[i*2+1] << 8 | in[i*2]);
+            }
+        }
+
+        source = block;
+        result = ConvertUTF16toUTF8(&source, block + units, (utf8_t **)outBuffer, (utf8_t *)outEnd, strictConversion);
+        in += (source - block) * 2;
+
+        // A surrogate pair split between blocks is converted with the next block
+        if (result != conversionOK && !(result == sourceExhausted && partial)) {
+            break;
+        }
+    }
+
+    *inBuffer = in;
+    if (result == conversionOK && in != inEnd) {
+        return APR_INCOMPLETE;
+    }
+    return ConvertResult(result);
+}
+
+/*++
+
+ConvertFromUTF32
+
+    Converts a UTF-32 buffer, of either byte order, to UTF-8.
+
+Arguments:
+    bigEndian   - Byte order of the input buffer.
+
+    inBuffer    - Pointer to the pointer to the input buffer; updated to the
+                  first byte that was not converted.
+
+    inEnd       - Pointer to the end of the input buffer.
+
+    outBuffer   - Pointer to the pointer to the output buffer; updated to the
+                  end of the converted data.
+
+    outEnd      - Pointer to the end of the output buffer.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+ConvertFromUTF32(
+    bool_t bigEndian,
+    const apr_byte_t **inBuffer,
+    const apr_byte_t *inEnd,
+    apr_byte_t **outBuffer,
+    apr_byte_t *outEnd
+    )
+{
+    apr_size_t i;
+    apr_size_t units;
+    bool_t illegal;
+    const apr_byte_t *in = *inBuffer;
+    const utf32_t *source;
+    utf32_t block[ENC_BLOCK];
+    CONVERSION_RESULT result = conversionOK;
+
+    while (inEnd - in >= 4) {
+        // Read the characters in host byte order
+        units = MIN((apr_size_t)(inEnd - in) / 4, ARRAYSIZE(block));
+        if (bigEndian) {
+            for (i = 0; i < units; i++) {
+                block[i] = (utf32_t)in[i*4] << 24 | (utf32_t)in[i*4+1] << 16 | (utf32_t)in[i*4+2] << 8 | in[i*4+3];
+            }
+        } else {
+            for (i = 0; i < units; i++) {
+                block[i] = (utf32_t)in[i*4+3] << 24 | (utf32_t)in[i*4+2] << 16 | (utf32_t)in[i*4+1] << 8 | in[i*4];
+            }
+        }
+
+        // The converter replaces values above U+10FFFF and carries on, stop at them instead
+        for (i = 0; i < units && block[i] <= 0x10FFFF; i++);
+        illegal = (i < units);
+        units = i;
+
+        source = block;
+        result = ConvertUTF32toUTF8(&source, block + units, (utf8_t **)outBuffer, (utf8_t *)outEnd, strictConversion);
+        in += (source - block) * 4;
+
+        if (result == conversionOK && illegal) {
+            result = sourceIllegal;
+        }
+        if (result != conversionOK) {
+            break;
+        }
+    }
+
+    *inBuffer = in;
+    if (result == conversionOK && in != inEnd) {
+        return APR_INCOMPLETE;
+    }
+    return ConvertResult(result);
+}
+
+/*++
+
+ConvertFromUTF8
+
+    Converts a UTF-8 buffer to a single-byte encoding.
+
+Arguments:
+    maxChar     - Highest character in the output encoding; characters above
+                  it are replaced by a question mark.
+
+    inBuffer    - Pointer to the pointer to the input buffer; updated to the
+                  first byte that was not converted.
+
+    inEnd       - Pointer to the end of the input buffer.
+
+    outBuffer   - Pointer to the pointer to the output buffer; updated to the
+                  end of the converted data.
+
+    outEnd      - Pointer to the end of the output buffer.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+ConvertFromUTF8(
+    utf32_t maxChar,
+    const apr_byte_t **inBuffer,
+    const apr_byte_t *inEnd,
+    apr_byte_t **outBuffer,
+    apr_byte_t *outEnd
+    )
+{
+    apr_size_t length;
+    apr_byte_t *out = *outBuffer;
+    const apr_byte_t *in = *inBuffer;
+    utf32_t ch;
+    utf32_t *target;
+    CONVERSION_RESULT result = conversionOK;
+
+    while (in < inEnd) {
+        // Copy runs of ASCII characters as-is
+        length = MIN(CountASCII(in, inEnd), (apr_size_t)(outEnd - out));
+        memcpy(out, in, length);
+        in  += length;
+        out += length;
+
+        if (in == inEnd) {
+            break;
+        }
+        if (out == outEnd) {
+            result = targetExhausted;
+            break;
+        }
+
+        // Decode one character; stopping at the next one is not an error
+        target = &ch;
+        result = ConvertUTF8toUTF32(&in, inEnd, &target, target + 1, strictConversion);
+        if (target == &ch) {
+            break;
+        }
+        *out++ = (apr_byte_t)((ch <= maxChar) ? ch : '?');
+        result = conversionOK;
+    }
+
+    *inBuffer = in;
+    *outBuffer = out;
+    return ConvertResult(result);
+}
+
+/*++
+
+EncConvertBuffer
+
+    Converts as much of a buffer as possible from one encoding to another.
+
+Arguments:
+    inEnc       - Encoding of the input buffer.
+
+    inBuffer    - Pointer to the pointer to the input buffer. On return, it
+                  points to the first byte that was not converted.
+
+    inEnd       - Pointer to the end of the input buffer.
+
+    outEnc      - Encoding of the output buffer.
+
+    outBuffer   - Pointer to the pointer to the output buffer. On return, it
+                  points to the end of the converted data.
+
+    outEnd      - Pointer to the end of the output buffer.
+
+Return Values:
+    APR_SUCCESS     - The entire input buffer was converted.
+
+    APR_INCOMPLETE  - The input buffer ends with a partial character.
+
+    APR_ENOSPC      - The output buffer is full.
+
+    APR_EINVAL      - The input buffer contains an illegal sequence.
+
+    APR_ENOTIMPL    - The conversion is not supported.
+
+Remarks:
+    The input is converted in one pass; an illegal sequence is reported the
+    same way as by the ConvertUTF* routines. Runs of ASCII characters, which
+    most text consists of, are converted in blocks.
+
+--*/
+apr_status_t
+EncConvertBuffer(
     encoding_t inEnc,
-    const apr_byte_t *inBuffer,
-    apr_size_t inLength,
+    const apr_byte_t **inBuffer,
+    const apr_byte_t *inEnd,
     encoding_t outEnc,
     apr_byte_t **outBuffer,
-    apr_size_t *outLength,
-    apr_pool_t *pool
+    apr_byte_t *outEnd
     )
 {
+    apr_size_t length;
+
     ASSERT(inBuffer != NULL);
     ASSERT(outBuffer != NULL);
-    ASSERT(outLength != NULL);
-    ASSERT(pool != NULL);
 
     // Use the current encoding
     if (inEnc == ENCODING_DEFAULT) {
@@ -133,28 +401,139 @@ EncConvert(
         outEnc = EncGetCurrent();
     }
 
+    // Nothing to convert
+    if (inEnc == outEnc && inEnc > ENCODING_DEFAULT && inEnc <= ENCODING_UTF32_LE) {
+        length = MIN((apr_size_t)(inEnd - *inBuffer), (apr_size_t)(outEnd - *outBuffer));
+        memcpy(*outBuffer, *inBuffer, length);
+        *inBuffer  += length;
+        *outBuffer += length;
+        return (*inBuffer == inEnd) ? APR_SUCCESS : APR_ENOSPC;
+    }
+
     switch (MAKE_ENC(inEnc, outEnc)) {
         // To UTF-8
         case MAKE_ENC(ENCODING_ASCII, ENCODING_UTF8):
-            break;
+            length = MIN(CountASCII(*inBuffer, inEnd), (apr_size_t)(outEnd - *outBuffer));
+            memcpy(*outBuffer, *inBuffer, length);
+            *inBuffer  += length;
+            *outBuffer += length;
+
+            if (*inBuffer == inEnd) {
+                return APR_SUCCESS;
+            }
+            return (**inBuffer < 0x80) ? APR_ENOSPC : APR_EINVAL;
+
         case MAKE_ENC(ENCODING_LATIN1, ENCODING_UTF8):
-            break;
+            while (*inBuffer < inEnd) {
+                length = MIN(CountASCII(*inBuffer, inEnd), (apr_size_t)(outEnd - *outBuffer));
+                memcpy(*outBuffer, *inBuffer, length);
+                *inBuffer  += length;
+                *outBuffer += length;
+
+                if (*inBuffer == inEnd) {
+                    break;
+                }
+                if (outEnd - *outBuffer < 2) {
+                    return APR_ENOSPC;
+                }
+                *(*outBuffer)++ = (apr_byte_t)(0xC0 | **inBuffer >> 6);
+                *(*outBuffer)++ = (apr_byte_t)(0x80 | (**inBuffer & 0x3F));
+                (*inBuffer)++;
+            }
+            return APR_SUCCESS;
+
         case MAKE_ENC(ENCODING_UTF16_BE, ENCODING_UTF8):
-            break;
         case MAKE_ENC(ENCODING_UTF16_LE, ENCODING_UTF8):
-            break;
+            return ConvertFromUTF16(inEnc == ENCODING_UTF16_BE, inBuffer, inEnd, outBuffer, outEnd);
+
         case MAKE_ENC(ENCODING_UTF32_BE, ENCODING_UTF8):
-            break;
         case MAKE_ENC(ENCODING_UTF32_LE, ENCODING_UTF8):
-            break;
+            return ConvertFromUTF32(inEnc == ENCODING_UTF32_BE, inBuffer, inEnd, outBuffer, outEnd);
+
         // From UTF-8
         case MAKE_ENC(ENCODING_UTF8, ENCODING_ASCII):
-            break;
+            return ConvertFromUTF8(0x7F, inBuffer, inEnd, outBuffer, outEnd);
+
         case MAKE_ENC(ENCODING_UTF8, ENCODING_LATIN1):
+            return ConvertFromUTF8(0xFF, inBuffer, inEnd, outBuffer, outEnd);
+    }
+
+    return APR_ENOTIMPL;
+}
+
+/*++
+
+EncConvert
+
+    Converts a buffer from one encoding to another.
+
+Arguments:
+    inEnc       - Encoding of the input buffer.
+
+    inBuffer    - Pointer to the input buffer (data to be converted).
+
+    inLength    - Length of the input buffer, in bytes.
+
+    outEnc      - Encoding of the output buffer.
+
+    outBuffer   - Pointer to the pointer that receives the output buffer.
+
+    outLength   - Length of the output buffer, in bytes.
+
+    pool        - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+Remarks:
+    The output buffer is null-terminated; the terminator is not included
+    in the output length.
+
+--*/
+apr_status_t
+EncConvert(
+    encoding_t inEnc,
+    const apr_byte_t *inBuffer,
+    apr_size_t inLength,
+    encoding_t outEnc,
+    apr_byte_t **outBuffer,
+    apr_size_t *outLength,
+    apr_pool_t *pool
+    )
+{
+    apr_byte_t *out;
+    apr_size_t length;
+    apr_status_t status;
+
+    ASSERT(inBuffer != NULL);
+    ASSERT(outBuffer != NULL);
+    ASSERT(outLength != NULL);
+    ASSERT(pool != NULL);
+
+    // None of the supported conversions more than double the length
+    length = inLength * 2;
+    *outBuffer = apr_palloc(pool, length + 1);
+    if (*outBuffer == NULL) {
+        return APR_ENOMEM;
+    }
+
+    out = *outBuffer;
+    status = EncConvertBuffer(inEnc, &inBuffer, inBuffer + inLength, outEnc, &out, out + length);
+    *out = '\0';
+    *outLength = (apr_size_t)(out - *outBuffer);
+
+    switch (status) {
+        case APR_SUCCESS:
             break;
-        default:
+        case APR_ENOTIMPL:
             LOG_ERROR("Unsupported encoding conversion, %s to %s.", EncGetName(inEnc), EncGetName(outEnc));
             return APR_EINVAL;
+        case APR_INCOMPLETE:
+            // The buffer ends with a partial character
+            return APR_EINVAL;
+        default:
+            ASSERT(status != APR_ENOSPC);
+            return status;
     }
 
     return APR_SUCCESS;
@@ -58,6 +58,16 @@ EncConvert(
     apr_pool_t *pool
     );
 
+apr_status_t
+EncConvertBuffer(
+    encoding_t inEnc,
+    const apr_byte_t **inBuffer,
+    const apr_byte_t *inEnd,
+    encoding_t outEnc,
+    apr_byte_t **outBuffer,
+    apr_byte_t *outEnd
+    );
+
 encoding_t
 EncDetect(
     const apr_byte_t *buffer,
@@ -16,6 +16,456 @@ Abstract:
 
 #include "alcoholicz.h"
 
+// Default and maximum number of SITE DUPE/NEW results
+#define SEARCH_LIMIT_DEFAULT    10
+#define SEARCH_LIMIT_MAX        100
+
+// Default number of pending dupe log records before compacting
+#define COMPACT_RECORDS_DEFAULT 5000
+
+// Set when the dupe database should be compacted after detaching
+static bool_t compactPending = FALSE;
+
+
+/*++
+
+GetEnv
+
+    Retrieves an environment variable set by the FTP server.
+
+Arguments:
+    name    - Pointer to a null-terminated string that specifies the variable name.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Pointer to the variable's value, or an empty string if it is not set.
+
+--*/
+static
+const char *
+GetEnv(
+    const char *name,
+    apr_pool_t *pool
+    )
+{
+    const char *forwarded;
+    char *value;
+
+    // Events forwarded to the daemon carry the client's environment
+    forwarded = DaemonGetEnv(name);
+    if (forwarded != NULL) {
+        return forwarded;
+    }
+
+    if (apr_env_get(&value, name, pool) != APR_SUCCESS) {
+        return "";
+    }
+    return value;
+}
+
+/*++
+
+MatchList
+
+    Matches a path against a list of wildcard patterns from the configuration.
+
+Arguments:
+    sectionName - Pointer to a null-terminated string that specifies the section name.
+
+    keyName     - Pointer to a null-terminated string that specifies the key name.
+
+    path        - Pointer to a null-terminated string that specifies the path.
+
+    noCase      - Compare case-insensitively.
+
+Return Values:
+    If the path matches a pattern, the return is nonzero (true).
+
+    If the path does not match or the key does not exist, the return is zero (false).
+
+--*/
+static
+bool_t
+MatchList(
+    const char *sectionName,
+    const char *keyName,
+    const char *path,
+    bool_t noCase
+    )
+{
+    apr_size_t elements;
+    apr_size_t i;
+    char **array;
+
+    if (ConfigGetArray(sectionName, keyName, &array, &elements) == APR_SUCCESS) {
+        for (i = 0; i < elements; i++) {
+            if (apr_fnmatch(array[i], path, noCase ? APR_FNM_CASE_BLIND : 0) == APR_SUCCESS) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/*++
+
+DupeDbOpen
+
+    Opens the directory dupe database in the configured data path.
+
+Arguments:
+    db      - Location to store the dupe database handle.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+DupeDbOpen(
+    DUPE_DB **db,
+    apr_pool_t *pool
+    )
+{
+    apr_status_t status;
+    char *dataPath;
+    char *path;
+
+    if (ConfigGetString(SectionGeneral, GeneralDataPath, &dataPath, NULL) != APR_SUCCESS) {
+        dataPath = ".";
+    }
+
+    status = apr_filepath_merge(&path, dataPath, "DupeDirs", 0, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = DupeOpen(db, path, pool);
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Unable to open dupe database \"%s\": %s", path, GetErrorMessage(status));
+    }
+    return status;
+}
+
+/*++
+
+DupeDbClose
+
+    Closes the directory dupe database, scheduling compaction if needed.
+
+Arguments:
+    db      - Pointer to a dupe database.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+DupeDbClose(
+    DUPE_DB *db
+    )
+{
+    apr_uint32_t threshold;
+
+    if (ConfigGetInt(SectionDupeCheck, DupeCompactRecords, &threshold) != APR_SUCCESS) {
+        threshold = COMPACT_RECORDS_DEFAULT;
+    }
+    if (DupeGetPending(db) >= threshold) {
+        compactPending = TRUE;
+    }
+    DupeClose(db);
+}
+
+/*++
+
+GetLimit
+
+    Parses the optional "-max <limit>" switch of SITE commands.
+
+Arguments:
+    argc    - Pointer to the number of arguments, updated past the switch.
+
+    argv    - Pointer to the argument array, updated past the switch.
+
+Return Values:
+    Maximum number of results to display.
+
+--*/
+static
+apr_uint32_t
+GetLimit(
+    int *argc,
+    char ***argv
+    )
+{
+    apr_uint32_t limit;
+
+    if (ConfigGetInt(SectionDupeCheck, DupeSearchLimit, &limit) != APR_SUCCESS || limit == 0) {
+        limit = SEARCH_LIMIT_DEFAULT;
+    }
+
+    if (*argc >= 2 && strcasecmp((*argv)[0], "-max") == 0) {
+        limit = (apr_uint32_t)strtoul((*argv)[1], NULL, 10);
+        *argc -= 2;
+        *argv += 2;
+    }
+    return MIN(MAX(limit, 1), SEARCH_LIMIT_MAX);
+}
+
+/*++
+
+GetRaceDir
+
+    Retrieves the path of the race statistics directory, in the configured data path.
+
+Arguments:
+    path    - Location to store the directory path.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+GetRaceDir(
+    char **path,
+    apr_pool_t *pool
+    )
+{
+    char *dataPath;
+
+    if (ConfigGetString(SectionGeneral, GeneralDataPath, &dataPath, NULL) != APR_SUCCESS) {
+        dataPath = ".";
+    }
+    return apr_filepath_merge(path, dataPath, "Races", 0, pool);
+}
+
+/*++
+
+GetParentPath
+
+    Retrieves the parent directory of a virtual path.
+
+Arguments:
+    path    - Pointer to a null-terminated string that specifies the virtual path.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Pointer to the parent directory, without a trailing slash, or null if
+    the path is in the root directory.
+
+--*/
+static
+char *
+GetParentPath(
+    const char *path,
+    apr_pool_t *pool
+    )
+{
+    const char *slash = strrchr(path, '/');
+
+    if (slash == NULL || slash == path) {
+        return NULL;
+    }
+    return apr_pstrndup(pool, path, slash - path);
+}
+
+/*++
+
+CompareRaceEntries
+
+    Orders race entries by the number of bytes uploaded (descending). Used
+    with qsort().
+
+Arguments:
+    elem1   - Pointer to the first RACE_ENTRY structure.
+
+    elem2   - Pointer to the second RACE_ENTRY structure.
+
+Return Values:
+    Less than, equal to, or greater than zero.
+
+--*/
+static
+int
+CompareRaceEntries(
+    const void *elem1,
+    const void *elem2
+    )
+{
+    const RACE_ENTRY *entry1 = elem1;
+    const RACE_ENTRY *entry2 = elem2;
+
+    if (entry1->bytes != entry2->bytes) {
+        return (entry1->bytes < entry2->bytes) ? 1 : -1;
+    }
+    return strcmp(entry1->name, entry2->name);
+}
+
+/*++
+
+FormatSize
+
+    Formats a size in bytes as kilobytes, megabytes, or gigabytes.
+
+Arguments:
+    buffer  - Pointer to the buffer that receives the text.
+
+    length  - Size of the buffer.
+
+    bytes   - Size in bytes.
+
+Return Values:
+    Pointer to the buffer.
+
+--*/
+static
+char *
+FormatSize(
+    char *buffer,
+    apr_size_t length,
+    apr_uint64_t bytes
+    )
+{
+    if (bytes < 1024 * 1024) {
+        apr_snprintf(buffer, length, "%.1f KB", bytes / 1024.0);
+    } else if (bytes < 1024 * 1024 * 1024) {
+        apr_snprintf(buffer, length, "%.1f MB", bytes / (1024.0 * 1024.0));
+    } else {
+        apr_snprintf(buffer, length, "%.2f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+    }
+    return buffer;
+}
+
+/*++
+
+FormatSpeed
+
+    Formats the average transfer speed of an upload total.
+
+Arguments:
+    buffer   - Pointer to the buffer that receives the text.
+
+    length   - Size of the buffer.
+
+    bytes    - Bytes uploaded.
+
+    duration - Transfer time in milliseconds, zero if unknown.
+
+Return Values:
+    Pointer to the buffer.
+
+--*/
+static
+char *
+FormatSpeed(
+    char *buffer,
+    apr_size_t length,
+    apr_uint64_t bytes,
+    apr_uint64_t duration
+    )
+{
+    double speed;
+
+    if (duration == 0) {
+        apr_cpystrn(buffer, "-", length);
+    } else {
+        // Kilobytes per second
+        speed = (bytes / 1024.0) / (duration / 1000.0);
+        if (speed < 1024.0) {
+            apr_snprintf(buffer, length, "%.0f KB/s", speed);
+        } else {
+            apr_snprintf(buffer, length, "%.2f MB/s", speed / 1024.0);
+        }
+    }
+    return buffer;
+}
+
+/*++
+
+WriteEntry
+
+    Writes a dupe entry to standard output.
+
+Arguments:
+    number  - Result number.
+
+    entry   - Pointer to a dupe entry.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+WriteEntry(
+    apr_uint32_t number,
+    const DUPE_ENTRY *entry
+    )
+{
+    apr_time_exp_t created;
+
+    apr_time_exp_lt(&created, entry->time);
+    StreamPrintf(streamOut, "| %02u | %02d/%02d/%02d | %-8.8s | %-43.43s |" APR_EOL_STR,
+        number, created.tm_mon + 1, created.tm_mday, created.tm_year % 100,
+        entry->user, entry->path);
+}
+
+/*++
+
+EventDeferred
+
+    Performs deferred work once the FTP server is no longer waiting on this
+    process (i.e. after detaching). Currently, this compacts the dupe database.
+
+Arguments:
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+EventDeferred(
+    apr_pool_t *pool
+    )
+{
+    apr_status_t status;
+    apr_time_t start;
+    DUPE_DB *db;
+
+    if (!compactPending) {
+        return APR_SUCCESS;
+    }
+    compactPending = FALSE;
+
+    status = DupeDbOpen(&db, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    start = apr_time_now();
+    status = DupeCompact(db);
+    DupeClose(db);
+
+    if (status == APR_SUCCESS) {
+        LOG_VERBOSE("Compacted dupe database in %.3f ms.", (apr_time_now() - start)/1000.0);
+    } else if (status == APR_EAGAIN) {
+        // Another process is already compacting
+        status = APR_SUCCESS;
+    } else {
+        LOG_ERROR("Unable to compact dupe database: %s", GetErrorMessage(status));
+    }
+    return status;
+}
+
 apr_status_t
 EventPostDele(
     int argc,
@@ -27,6 +477,9 @@ EventPostDele(
     return APR_SUCCESS;
 }
 
+//
+// POSTMKD <virtual path>
+//
 apr_status_t
 EventPostMkd(
     int argc,
@@ -34,8 +487,26 @@ EventPostMkd(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    bool_t checkDirs;
+    DUPE_DB *db;
+
     LOG_DEBUG("Event: post-MKD with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    if (argc < 1 || ConfigGetBool(SectionDupeCheck, DupeCheckDirs, &checkDirs) != APR_SUCCESS || !checkDirs) {
+        return APR_SUCCESS;
+    }
+    if (MatchList(SectionDupeCheck, DupeExcludeLog, argv[0], FALSE) ||
+            MatchList(SectionDupeCheck, DupeIgnoreDirs, argv[0], TRUE)) {
+        return APR_SUCCESS;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status == APR_SUCCESS) {
+        status = DupeAdd(db, argv[0], GetEnv("USER", pool), GetEnv("GROUP", pool), apr_time_now());
+        DupeDbClose(db);
+    }
+    return status;
 }
 
 apr_status_t
@@ -49,6 +520,9 @@ EventPostRnfr(
     return APR_SUCCESS;
 }
 
+//
+// POSTRNTO <old virtual path> <new virtual path>
+//
 apr_status_t
 EventPostRnto(
     int argc,
@@ -56,10 +530,57 @@ EventPostRnto(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    apr_uint32_t found;
+    bool_t checkDirs;
+    char *dirPath;
+    DUPE_DB *db;
+    DUPE_ENTRY entry;
+
     LOG_DEBUG("Event: post-RNTO with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    if (argc < 2) {
+        return APR_SUCCESS;
+    }
+
+    // Race statistics follow the release
+    status = GetRaceDir(&dirPath, pool);
+    if (status == APR_SUCCESS) {
+        status = RaceRename(dirPath, argv[0], argv[1], pool);
+    }
+    if (status != APR_SUCCESS) {
+        LOG_WARNING("Unable to move race statistics for \"%s\": %s", argv[0], GetErrorMessage(status));
+    }
+
+    if (ConfigGetBool(SectionDupeCheck, DupeCheckDirs, &checkDirs) != APR_SUCCESS || !checkDirs) {
+        return APR_SUCCESS;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Only directories are in the database, so look up the old path to tell
+    // if a logged directory was renamed (and not a file, or another directory
+    // with the same name).
+    status = DupeSearch(db, DUPE_MATCH_PATH, argv[0], 1, &entry, &found, NULL, pool);
+    if (status == APR_SUCCESS && found > 0) {
+        status = DupeRemove(db, argv[0], apr_time_now());
+
+        if (status == APR_SUCCESS && !MatchList(SectionDupeCheck, DupeExcludeLog, argv[1], FALSE) &&
+                !MatchList(SectionDupeCheck, DupeIgnoreDirs, argv[1], TRUE)) {
+            status = DupeAdd(db, argv[1], entry.user, entry.group, apr_time_now());
+        }
+    }
+
+    DupeDbClose(db);
+    return status;
 }
 
+//
+// POSTRMD <virtual path>
+//
 apr_status_t
 EventPostRmd(
     int argc,
@@ -67,10 +588,40 @@ EventPostRmd(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    bool_t checkDirs;
+    char *dirPath;
+    DUPE_DB *db;
+
     LOG_DEBUG("Event: post-RMD with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    if (argc < 1) {
+        return APR_SUCCESS;
+    }
+
+    status = GetRaceDir(&dirPath, pool);
+    if (status == APR_SUCCESS) {
+        status = RaceRemove(dirPath, argv[0], pool);
+    }
+    if (status != APR_SUCCESS) {
+        LOG_WARNING("Unable to remove race statistics for \"%s\": %s", argv[0], GetErrorMessage(status));
+    }
+
+    if (ConfigGetBool(SectionDupeCheck, DupeCheckDirs, &checkDirs) != APR_SUCCESS || !checkDirs) {
+        return APR_SUCCESS;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status == APR_SUCCESS) {
+        status = DupeRemove(db, argv[0], apr_time_now());
+        DupeDbClose(db);
+    }
+    return status;
 }
 
+//
+// PREMKD <virtual path>
+//
 apr_status_t
 EventPreMkd(
     int argc,
@@ -78,8 +629,38 @@ EventPreMkd(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    apr_uint32_t found;
+    bool_t checkDirs;
+    DUPE_DB *db;
+    DUPE_ENTRY entry;
+
     LOG_DEBUG("Event: pre-MKD with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    if (argc < 1 || ConfigGetBool(SectionDupeCheck, DupeCheckDirs, &checkDirs) != APR_SUCCESS || !checkDirs) {
+        return APR_SUCCESS;
+    }
+    if (MatchList(SectionDupeCheck, DupeExcludeCheck, argv[0], FALSE) ||
+            MatchList(SectionDupeCheck, DupeIgnoreDirs, argv[0], TRUE)) {
+        return APR_SUCCESS;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = DupeSearch(db, DUPE_MATCH_EXACT, apr_filepath_name_get(argv[0]), 1, &entry, &found, NULL, pool);
+    DupeDbClose(db);
+
+    if (status == APR_SUCCESS && found > 0) {
+        StreamPrintf(streamOut, "Dupe: %s (created by %s/%s)" APR_EOL_STR,
+            entry.path, entry.user, entry.group);
+
+        // A non-zero exit status denies the directory creation
+        status = APR_EEXIST;
+    }
+    return status;
 }
 
 apr_status_t
@@ -93,6 +674,9 @@ EventPreStor(
     return APR_SUCCESS;
 }
 
+//
+// UPLOAD <physical path> <CRC-32> <virtual path>
+//
 apr_status_t
 EventUpload(
     int argc,
@@ -100,8 +684,68 @@ EventUpload(
     apr_pool_t *pool
     )
 {
+    apr_finfo_t info;
+    apr_status_t status;
+    apr_uint32_t speed;
+    bool_t check;
+    bool_t probed;
+    char *dirPath;
+    char *release;
+    const char *reason;
+    MEDIA_INFO media;
+
     LOG_DEBUG("EventUpload with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    if (argc < 3 || MatchList(SectionZipScript, ZsExcludePaths, argv[2], FALSE)) {
+        return APR_SUCCESS;
+    }
+    release = GetParentPath(argv[2], pool);
+    if (release == NULL) {
+        return APR_SUCCESS;
+    }
+
+    status = apr_stat(&info, argv[0], APR_FINFO_SIZE, pool);
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Unable to stat uploaded file \"%s\": %s", argv[0], GetErrorMessage(status));
+        return status;
+    }
+
+    // Reject corrupt archives before they are counted
+    if (ConfigGetBool(SectionZipScript, ZsCheckArchives, &check) == APR_SUCCESS && check) {
+        status = ArchiveCheck(argv[0], &reason, pool);
+        if (status != APR_SUCCESS) {
+            LOG_ERROR("Unable to check archive \"%s\": %s", argv[0], GetErrorMessage(status));
+        } else if (reason != NULL) {
+            LOG_WARNING("Corrupt archive \"%s\": %s", argv[2], reason);
+            StreamPrintf(streamOut, "Corrupt archive: %s" APR_EOL_STR, reason);
+            return APR_EGENERAL;
+        }
+    }
+
+    // Probe audio files, so their properties are part of the release
+    probed = FALSE;
+    if (ConfigGetBool(SectionZipScript, ZsProbeMedia, &check) == APR_SUCCESS && check &&
+            MatchList(SectionZipScript, ZsMediaFiles, argv[0], TRUE)) {
+        status = MediaProbe(argv[0], &media, pool);
+        if (status != APR_SUCCESS) {
+            LOG_WARNING("Unable to probe media file \"%s\": %s", argv[0], GetErrorMessage(status));
+        } else {
+            probed = TRUE;
+        }
+    }
+
+    // Transfer speed in kilobytes per second, if the server provides it
+    speed = (apr_uint32_t)strtoul(GetEnv("SPEED", pool), NULL, 10);
+
+    status = GetRaceDir(&dirPath, pool);
+    if (status == APR_SUCCESS) {
+        status = RaceAdd(dirPath, release, GetEnv("USER", pool), GetEnv("GROUP", pool),
+            (apr_uint64_t)info.size, speed, apr_time_now(), probed ? &media : NULL, pool);
+    }
+    if (status != APR_SUCCESS) {
+        LOG_ERROR("Unable to update race statistics for \"%s\": %s", release, GetErrorMessage(status));
+    }
+    return status;
 }
 
 apr_status_t
@@ -115,6 +759,9 @@ EventUploadError(
     return APR_SUCCESS;
 }
 
+//
+// SITE DUPE [-max <limit>] <pattern>
+//
 apr_status_t
 EventSiteDupe(
     int argc,
@@ -122,8 +769,50 @@ EventSiteDupe(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    apr_uint32_t found;
+    apr_uint32_t i;
+    apr_uint32_t limit;
+    apr_uint32_t total;
+    int type;
+    DUPE_DB *db;
+    DUPE_ENTRY *entries;
+
     LOG_DEBUG("Event: SITE DUPE with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    limit = GetLimit(&argc, &argv);
+    if (argc < 1) {
+        StreamPuts(streamOut, "Syntax: SITE DUPE [-max <limit>] <pattern>" APR_EOL_STR);
+        return APR_SUCCESS;
+    }
+
+    // Wildcard patterns are matched against the whole name, plain text anywhere in it
+    type = (strpbrk(argv[0], "*?") != NULL) ? DUPE_MATCH_GLOB : DUPE_MATCH_SUBSTR;
+
+    entries = apr_palloc(pool, limit * sizeof(DUPE_ENTRY));
+    if (entries == NULL) {
+        return APR_ENOMEM;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = DupeSearch(db, type, argv[0], limit, entries, &found, &total, pool);
+    DupeDbClose(db);
+
+    if (status == APR_SUCCESS) {
+        StreamPuts(streamOut, ".-[Dupe]-----------------------------------------------------------------." APR_EOL_STR);
+        for (i = 0; i < found; i++) {
+            WriteEntry(i + 1, &entries[i]);
+        }
+        if (found == 0) {
+            StreamPuts(streamOut, "| No results found.                                                      |" APR_EOL_STR);
+        }
+        StreamPrintf(streamOut, "| Displayed %-3u of %-6u matching results.%30s|" APR_EOL_STR, found, total, "");
+        StreamPuts(streamOut, "'------------------------------------------------------------------------'" APR_EOL_STR);
+    }
+    return status;
 }
 
 apr_status_t
@@ -137,6 +826,9 @@ EventSiteFileDupe(
     return APR_SUCCESS;
 }
 
+//
+// SITE NEW [-max <limit>] [path pattern]
+//
 apr_status_t
 EventSiteNew(
     int argc,
@@ -144,7 +836,134 @@ EventSiteNew(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    apr_uint32_t found;
+    apr_uint32_t i;
+    apr_uint32_t limit;
+    DUPE_DB *db;
+    DUPE_ENTRY *entries;
+
     LOG_DEBUG("Event: SITE NEW with %d argument(s).", argc);
+
+    limit = GetLimit(&argc, &argv);
+    entries = apr_palloc(pool, limit * sizeof(DUPE_ENTRY));
+    if (entries == NULL) {
+        return APR_ENOMEM;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = DupeNewest(db, (argc > 0) ? argv[0] : NULL, limit, entries, &found, pool);
+    DupeDbClose(db);
+
+    if (status == APR_SUCCESS) {
+        StreamPuts(streamOut, ".-[New]------------------------------------------------------------------." APR_EOL_STR);
+        for (i = 0; i < found; i++) {
+            WriteEntry(i + 1, &entries[i]);
+        }
+        if (found == 0) {
+            StreamPuts(streamOut, "| No results found.                                                      |" APR_EOL_STR);
+        }
+        StreamPuts(streamOut, "'------------------------------------------------------------------------'" APR_EOL_STR);
+    }
+    return status;
+}
+
+//
+// SITE RACESTATS <virtual path>
+//
+apr_status_t
+EventSiteRaceStats(
+    int argc,
+    char **argv,
+    apr_pool_t *pool
+    )
+{
+    apr_status_t status;
+    apr_size_t length;
+    apr_uint32_t i;
+    char *dirPath;
+    char *release;
+    char line[80];
+    char size[16];
+    char speed[16];
+    RACE_STATS *stats;
+
+    LOG_DEBUG("Event: SITE RACESTATS with %d argument(s).", argc);
+
+    if (argc < 1) {
+        StreamPuts(streamOut, "Syntax: SITE RACESTATS <path>" APR_EOL_STR);
+        return APR_SUCCESS;
+    }
+
+    // Statistics are stored under the path without a trailing slash
+    release = apr_pstrdup(pool, argv[0]);
+    length = strlen(release);
+    while (length > 1 && release[length-1] == '/') {
+        release[--length] = '\0';
+    }
+
+    stats = apr_palloc(pool, sizeof(RACE_STATS));
+    if (stats == NULL) {
+        return APR_ENOMEM;
+    }
+    status = GetRaceDir(&dirPath, pool);
+    if (status == APR_SUCCESS) {
+        status = RaceRead(dirPath, release, stats, pool);
+    }
+    if (APR_STATUS_IS_ENOENT(status)) {
+        StreamPrintf(streamOut, "No race statistics for \"%s\"." APR_EOL_STR, release);
+        return APR_SUCCESS;
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    qsort(stats->user,  stats->users,  sizeof(RACE_ENTRY), CompareRaceEntries);
+    qsort(stats->group, stats->groups, sizeof(RACE_ENTRY), CompareRaceEntries);
+
+    StreamPuts(streamOut, ".-[RaceStats]------------------------------------------------------------." APR_EOL_STR);
+    StreamPrintf(streamOut, "| Release: %-61.61s |" APR_EOL_STR, stats->path);
+    apr_snprintf(line, sizeof(line), "Files: %u  Size: %s  Speed: %s  Time: %us  Racers: %u/%u",
+        stats->files, FormatSize(size, sizeof(size), stats->bytes),
+        FormatSpeed(speed, sizeof(speed), stats->bytes, stats->duration),
+        (apr_uint32_t)apr_time_sec(stats->last - stats->first), stats->users, stats->groups);
+    StreamPrintf(streamOut, "| %-70.70s |" APR_EOL_STR, line);
+
+    if (stats->media.version != 0) {
+        apr_snprintf(line, sizeof(line), "Audio: %s Layer %u  %u kbit/s %s  %u Hz  %s  %u:%02u",
+            MediaVersionName(&stats->media), stats->media.layer, stats->media.bitrate,
+            stats->media.vbr ? "VBR" : "CBR", stats->media.sampleRate, MediaChannelName(&stats->media),
+            stats->media.duration / 60000, (stats->media.duration / 1000) % 60);
+        StreamPrintf(streamOut, "| %-70.70s |" APR_EOL_STR, line);
+        apr_snprintf(line, sizeof(line), "Genre: %s  Year: %u  Artist: %s",
+            stats->media.genre[0] ? stats->media.genre : "Unknown", stats->media.year,
+            stats->media.artist[0] ? stats->media.artist : "Unknown");
+        StreamPrintf(streamOut, "| %-70.70s |" APR_EOL_STR, line);
+    }
+
+    StreamPuts(streamOut, "|------------------------------------------------------------------------|" APR_EOL_STR);
+    StreamPuts(streamOut, "| ## | User         | Group      | Files |      Size |      Speed |    % |" APR_EOL_STR);
+    for (i = 0; i < stats->users; i++) {
+        StreamPrintf(streamOut, "| %02u | %-12.12s | %-10.10s | %5u | %9s | %10s | %3u%% |" APR_EOL_STR,
+            i + 1, stats->user[i].name, stats->user[i].group, stats->user[i].files,
+            FormatSize(size, sizeof(size), stats->user[i].bytes),
+            FormatSpeed(speed, sizeof(speed), stats->user[i].bytes, stats->user[i].duration),
+            (apr_uint32_t)(stats->bytes ? stats->user[i].bytes * 100 / stats->bytes : 0));
+    }
+
+    StreamPuts(streamOut, "|------------------------------------------------------------------------|" APR_EOL_STR);
+    StreamPuts(streamOut, "| ## | Group                     | Files |      Size |      Speed |    % |" APR_EOL_STR);
+    for (i = 0; i < stats->groups; i++) {
+        StreamPrintf(streamOut, "| %02u | %-25.25s | %5u | %9s | %10s | %3u%% |" APR_EOL_STR,
+            i + 1, stats->group[i].name, stats->group[i].files,
+            FormatSize(size, sizeof(size), stats->group[i].bytes),
+            FormatSpeed(speed, sizeof(speed), stats->group[i].bytes, stats->group[i].duration),
+            (apr_uint32_t)(stats->bytes ? stats->group[i].bytes * 100 / stats->bytes : 0));
+    }
+    StreamPuts(streamOut, "'------------------------------------------------------------------------'" APR_EOL_STR);
     return APR_SUCCESS;
 }
 
@@ -159,6 +978,9 @@ EventSiteRescan(
     return APR_SUCCESS;
 }
 
+//
+// SITE UNDUPE <pattern>
+//
 apr_status_t
 EventSiteUndupe(
     int argc,
@@ -166,6 +988,51 @@ EventSiteUndupe(
     apr_pool_t *pool
     )
 {
+    apr_status_t status;
+    apr_uint32_t found;
+    apr_uint32_t i;
+    apr_uint32_t total;
+    apr_time_t now;
+    DUPE_DB *db;
+    DUPE_ENTRY *entries = NULL;
+
     LOG_DEBUG("Event: SITE UNDUPE with %d argument(s).", argc);
-    return APR_SUCCESS;
+
+    if (argc < 1) {
+        StreamPuts(streamOut, "Syntax: SITE UNDUPE <pattern>" APR_EOL_STR);
+        return APR_SUCCESS;
+    }
+
+    status = DupeDbOpen(&db, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // Count the matches first, so all of them can be listed and removed
+    status = DupeSearch(db, DUPE_MATCH_GLOB, argv[0], 0, NULL, &found, &total, pool);
+    if (status == APR_SUCCESS && total > 0) {
+        entries = apr_palloc(pool, total * sizeof(DUPE_ENTRY));
+        if (entries == NULL) {
+            status = APR_ENOMEM;
+        } else {
+            status = DupeSearch(db, DUPE_MATCH_GLOB, argv[0], total, entries, &found, NULL, pool);
+        }
+    } else {
+        found = 0;
+    }
+
+    // Tombstones remove every entry with the same name, so write one per name
+    now = apr_time_now();
+    for (i = 0; status == APR_SUCCESS && i < found; i++) {
+        StreamPrintf(streamOut, "Unduped: %s" APR_EOL_STR, entries[i].path);
+        if (i == 0 || strcasecmp(entries[i].name, entries[i-1].name) != 0) {
+            status = DupeRemove(db, entries[i].name, now);
+        }
+    }
+    DupeDbClose(db);
+
+    if (status == APR_SUCCESS) {
+        StreamPrintf(streamOut, "Unduped %u entries." APR_EOL_STR, found);
+    }
+    return status;
 }
@@ -38,7 +38,22 @@ EVENT_PROC EventUploadError;
 EVENT_PROC EventSiteDupe;
 EVENT_PROC EventSiteFileDupe;
 EVENT_PROC EventSiteNew;
+EVENT_PROC EventSiteRaceStats;
 EVENT_PROC EventSiteRescan;
 EVENT_PROC EventSiteUndupe;
 
+// Event dispatcher, implemented in main.c
+apr_status_t
+EventDispatch(
+    int argc,
+    char **argv,
+    apr_pool_t *pool
+    );
+
+// Deferred maintenance, performed after detaching
+apr_status_t
+EventDeferred(
+    apr_pool_t *pool
+    );
+
 #endif // _EVENTS_H_
@@ -13,17 +13,291 @@ Abstract:
     This module implements a logging interface to redirect information
     to a file or a standard output device (stdout or stderr).
 
+    When LOG_ASYNC is enabled, messages are formatted by the calling thread
+    into its own ring buffer, and written in batches: by a background writer
+    thread, when a ring fills up, or when the application exits. Each ring
+    has one producer (its thread) and one consumer (whoever holds the drain
+    mutex), so logging a message takes no locks and no system calls.
+
 --*/
 
 #include "alcoholicz.h"
 
 #if (LOG_LEVEL > 0)
 
+// Maximum length of a formatted message, including the time stamp
+#define LOG_MESSAGE_MAX     2048
+
+#if (LOG_ASYNC == TRUE)
+
+// Size of each thread's ring buffer, in bytes (must be a power of two)
+#define LOG_RING_SIZE       65536
+
+// Pending bytes in a ring that cause it to be written early
+#define LOG_FLUSH_SIZE      16384
+
+// Maximum time a message waits to be written once the writer is running, in milliseconds
+#define LOG_FLUSH_INTERVAL  250
+
+// Number of buffers written per system call; each ring uses up to two
+#define LOG_IOV_MAX         64
+
+typedef struct LOG_RING LOG_RING;
+
+struct LOG_RING {
+    apr_uint32_t head;          // Bytes written into the ring (producer)
+    apr_uint32_t tail;          // Bytes written to the log file (consumer)
+    LOG_RING     *next;         // Next ring in the list
+    char         data[LOG_RING_SIZE];
+};
+
+static LOG_RING *ringHead;      // List of every thread's ring buffer
+static apr_uint32_t lastDrain;  // Time the rings were last written, in milliseconds
+static bool_t direct;           // Write messages directly, after the writer stops
+static THREAD_LOCAL LOG_RING *threadRing;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *drainMutex; // Serializes writing the rings, and the ring list
+static apr_thread_mutex_t *wakeMutex;  // Protects the writer's state
+static apr_thread_cond_t *wakeCond;    // Signals the writer thread
+static apr_thread_t *writer;           // Background writer thread
+static bool_t stopping;                // Writer thread should exit
+#endif
+
+#endif // LOG_ASYNC
+
 static apr_file_t *handle;      // Handle to the log file
-static apr_pool_t *msgPool;     // Sub-pool used for formatting log messages
-static apr_uint32_t maxLevel;   // Maximum log verbosity level
+static apr_pool_t *logPool;     // Sub-pool used for the log buffers
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *mutex; // Serializes direct writes to the file
+#endif
+
+apr_uint32_t logMaxLevel;       // Maximum log verbosity level
+
+// Cached time stamp of the current second, for each thread
+static THREAD_LOCAL apr_time_t stampTime = -1;
+static THREAD_LOCAL char stamp[24];
+
+
+#if (LOG_ASYNC == TRUE)
+/*++
+
+LogDrain
+
+    Writes the contents of every ring buffer to the log file.
+
+Arguments:
+    None.
+
+Return Values:
+    None.
+
+Remarks:
+    Records are written in the order they were logged for each thread, but
+    records from different threads may be interleaved by the batch.
+
+--*/
+static
+void
+LogDrain(
+    void
+    )
+{
+    apr_size_t count;
+    apr_size_t written;
+    apr_uint32_t head[LOG_IOV_MAX / 2];
+    apr_uint32_t offset;
+    apr_uint32_t i;
+    LOG_RING *batch[LOG_IOV_MAX / 2];
+    LOG_RING *ring;
+    struct iovec vec[LOG_IOV_MAX];
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(drainMutex);
+#endif
+    ring = ringHead;
+    do {
+        // Collect the pending data of each ring, up to two buffers per ring
+        count = 0;
+        for (i = 0; ring != NULL && i < ARRAYSIZE(batch); ring = ring->next) {
+            head[i] = apr_atomic_read32(&ring->head);
+            if (head[i] == ring->tail) {
+                continue;
+            }
+
+            offset = ring->tail & (LOG_RING_SIZE - 1);
+            vec[count].iov_base = ring->data + offset;
+            if (offset + (head[i] - ring->tail) <= LOG_RING_SIZE) {
+                vec[count++].iov_len = head[i] - ring->tail;
+            } else {
+                vec[count++].iov_len = LOG_RING_SIZE - offset;
+                vec[count].iov_base  = ring->data;
+                vec[count++].iov_len = (head[i] - ring->tail) - (LOG_RING_SIZE - offset);
+            }
+            batch[i++] = ring;
+        }
+
+        if (count > 0) {
+            // The data is discarded on failure, so the rings cannot stall
+            apr_file_writev_full(handle, vec, count, &written);
+
+            while (i-- > 0) {
+                apr_atomic_add32(&batch[i]->tail, head[i] - batch[i]->tail);
+            }
+        }
+    } while (ring != NULL);
+
+    apr_atomic_set32(&lastDrain, (apr_uint32_t)apr_time_as_msec(apr_time_now()));
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(drainMutex);
+#endif
+}
+
+#if APR_HAS_THREADS
+static
+void *
+APR_THREAD_FUNC
+LogWriter(
+    apr_thread_t *thread,
+    void *data
+    )
+{
+    apr_thread_mutex_lock(wakeMutex);
+    while (!stopping) {
+        apr_thread_mutex_unlock(wakeMutex);
+        LogDrain();
+
+        apr_thread_mutex_lock(wakeMutex);
+        if (!stopping) {
+            apr_thread_cond_timedwait(wakeCond, wakeMutex, apr_time_from_msec(LOG_FLUSH_INTERVAL));
+        }
+    }
+    apr_thread_mutex_unlock(wakeMutex);
+
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+/*++
+
+LogWake
+
+    Starts the background writer thread, or wakes it if it is running.
+
+Arguments:
+    None.
+
+Return Values:
+    None.
+
+Remarks:
+    Short-lived processes never start the writer, their messages are written
+    when a ring fills up or when the application exits.
+
+--*/
+static
+void
+LogWake(
+    void
+    )
+{
+    apr_thread_mutex_lock(wakeMutex);
+    if (writer != NULL) {
+        apr_thread_cond_signal(wakeCond);
+    } else if (!stopping) {
+        if (apr_thread_create(&writer, NULL, LogWriter, NULL, logPool) != APR_SUCCESS) {
+            writer = NULL;
+        }
+    }
+    apr_thread_mutex_unlock(wakeMutex);
+}
+#endif // APR_HAS_THREADS
+
+/*++
+
+LogGetRing
+
+    Retrieves the calling thread's ring buffer, creating it if necessary.
+
+Arguments:
+    None.
+
+Return Values:
+    If the function succeeds, the return value is a pointer to a LOG_RING structure.
+
+    If the function fails, the return value is null.
+
+--*/
+static
+LOG_RING *
+LogGetRing(
+    void
+    )
+{
+    LOG_RING *ring = threadRing;
+
+    if (ring == NULL) {
+#if APR_HAS_THREADS
+        apr_thread_mutex_lock(drainMutex);
+#endif
+        ring = apr_palloc(logPool, sizeof(LOG_RING));
+        if (ring != NULL) {
+            ring->head = 0;
+            ring->tail = 0;
+            ring->next = ringHead;
+            ringHead = ring;
+        }
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(drainMutex);
+#endif
+        threadRing = ring;
+    }
+    return ring;
+}
+
+/*++
+
+LogCleanup
+
+    Stops the writer thread and writes all buffered messages.
+
+Arguments:
+    data    - Not used.
+
+Return Values:
+    Always returns APR_SUCCESS.
+
+Remarks:
+    This is a pre-cleanup of the main pool: it runs before the sub-pools
+    are destroyed, and before the log file is closed. Messages logged after
+    it are written directly.
+
+--*/
+static
+apr_status_t
+LogCleanup(
+    void *data
+    )
+{
+#if APR_HAS_THREADS
+    apr_status_t status;
+
+    apr_thread_mutex_lock(wakeMutex);
+    stopping = TRUE;
+    apr_thread_cond_signal(wakeCond);
+    apr_thread_mutex_unlock(wakeMutex);
+
+    if (writer != NULL) {
+        apr_thread_join(&status, writer);
+        writer = NULL;
+    }
+#endif
+
+    LogDrain();
+    direct = TRUE;
+    return APR_SUCCESS;
+}
+#endif // LOG_ASYNC
 
-
 /*++
 
 LogInit
@@ -46,21 +320,55 @@ LogInit(
 
     // Initialize static variables
     handle = NULL;
-    maxLevel = LOG_LEVEL_OFF;
+    logMaxLevel = LOG_LEVEL_OFF;
 
-    if (ConfigGetInt(SectionGeneral, GeneralLogLevel, &maxLevel) != APR_SUCCESS || !maxLevel) {
+    if (ConfigGetInt(SectionGeneral, GeneralLogLevel, &logMaxLevel) != APR_SUCCESS || !logMaxLevel) {
+        logMaxLevel = LOG_LEVEL_OFF;
         return APR_SUCCESS;
     }
 
-    // Create a sub-pool for log message allocations
-    status = apr_pool_create(&msgPool, pool);
+    // Create a sub-pool for log buffer allocations
+    status = apr_pool_create(&logPool, pool);
+    if (status != APR_SUCCESS) {
+        goto error;
+    }
+
+#if APR_HAS_THREADS
+    status = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, pool);
     if (status != APR_SUCCESS) {
-        return status;
+        goto error;
     }
+#if (LOG_ASYNC == TRUE)
+    if ((status = apr_thread_mutex_create(&drainMutex, APR_THREAD_MUTEX_DEFAULT, pool)) != APR_SUCCESS ||
+        (status = apr_thread_mutex_create(&wakeMutex, APR_THREAD_MUTEX_DEFAULT, pool)) != APR_SUCCESS ||
+        (status = apr_thread_cond_create(&wakeCond, pool)) != APR_SUCCESS) {
+        goto error;
+    }
+    writer = NULL;
+    stopping = FALSE;
+#endif
+#endif
 
     // Open log file for writing
-    return apr_file_open(&handle, LOG_FILE, APR_FOPEN_WRITE|
+    status = apr_file_open(&handle, LOG_FILE, APR_FOPEN_WRITE|
         APR_FOPEN_CREATE|APR_FOPEN_APPEND, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        goto error;
+    }
+
+#if (LOG_ASYNC == TRUE)
+    ringHead = NULL;
+    lastDrain = (apr_uint32_t)apr_time_as_msec(apr_time_now());
+    direct = FALSE;
+    apr_pool_pre_cleanup_register(pool, NULL, LogCleanup);
+#endif
+    return APR_SUCCESS;
+
+error:
+    // Messages must not be logged to a partially initialized subsystem
+    handle = NULL;
+    logMaxLevel = LOG_LEVEL_OFF;
+    return status;
 }
 
 /*++
@@ -115,6 +423,8 @@ Return Values:
 Remarks:
     This function could be called before the logging subsystem is initialized.
 
+    Messages longer than LOG_MESSAGE_MAX characters are truncated.
+
 --*/
 void
 LogFormatV(
@@ -123,29 +433,89 @@ LogFormatV(
     va_list argList
     )
 {
-    apr_time_exp_t now;
-    char *message;
+    apr_size_t length;
+    apr_size_t space;
+    apr_time_t now;
+    apr_time_exp_t local;
+    char buffer[LOG_MESSAGE_MAX];
+    int result;
+#if (LOG_ASYNC == TRUE)
+    apr_uint32_t offset;
+    apr_uint32_t pending;
+    LOG_RING *ring;
+#endif
 
     ASSERT(format != NULL);
 
-    if (level <= maxLevel && handle != NULL) {
-        // Write local time
-        apr_time_exp_lt(&now, apr_time_now());
-        apr_file_printf(handle, "%04d-%02d-%02d %02d:%02d:%02d - ",
-            now.tm_year+1900, now.tm_mon, now.tm_mday,
-            now.tm_hour, now.tm_min, now.tm_sec);
-
-        // Format and write log message
-        message = apr_pvsprintf(msgPool, format, argList);
-        if (message == NULL) {
-            message = "Unable to format message." APR_EOL_STR;
+    if (level > logMaxLevel || handle == NULL) {
+        return;
+    }
+
+    // The time stamp only changes once a second
+    now = apr_time_now();
+    if (apr_time_sec(now) != stampTime) {
+        stampTime = apr_time_sec(now);
+        apr_time_exp_lt(&local, now);
+        apr_snprintf(stamp, sizeof(stamp), "%04d-%02d-%02d %02d:%02d:%02d - ",
+            local.tm_year+1900, local.tm_mon+1, local.tm_mday,
+            local.tm_hour, local.tm_min, local.tm_sec);
+    }
+    length = strlen(stamp);
+    memcpy(buffer, stamp, length);
+
+    // Format the message after the time stamp
+    space = sizeof(buffer) - length;
+    result = apr_vsnprintf(buffer + length, space, format, argList);
+    if (result < 0) {
+        result = 0;
+    }
+    if ((apr_size_t)result >= space - 1) {
+        // The message was truncated, end the line
+        result = (int)(space - sizeof(APR_EOL_STR));
+        memcpy(buffer + length + result, APR_EOL_STR, sizeof(APR_EOL_STR) - 1);
+        result += sizeof(APR_EOL_STR) - 1;
+    }
+    length += result;
+
+#if (LOG_ASYNC == TRUE)
+    ring = direct ? NULL : LogGetRing();
+    if (ring != NULL) {
+        // Make room by writing the rings when this one is full
+        if (LOG_RING_SIZE - (ring->head - apr_atomic_read32(&ring->tail)) < length) {
+            LogDrain();
         }
-        apr_file_puts(message, handle);
-        apr_file_flush(handle);
 
-        // Clear memory allocated when formatting the message
-        apr_pool_clear(msgPool);
+        offset = ring->head & (LOG_RING_SIZE - 1);
+        if (offset + length <= LOG_RING_SIZE) {
+            memcpy(ring->data + offset, buffer, length);
+        } else {
+            memcpy(ring->data + offset, buffer, LOG_RING_SIZE - offset);
+            memcpy(ring->data, buffer + (LOG_RING_SIZE - offset), length - (LOG_RING_SIZE - offset));
+        }
+
+        // Publish the record, the addition is a full memory barrier
+        apr_atomic_add32(&ring->head, (apr_uint32_t)length);
+
+        pending = ring->head - apr_atomic_read32(&ring->tail);
+        if ((pending >= LOG_FLUSH_SIZE && pending - length < LOG_FLUSH_SIZE) ||
+                (apr_uint32_t)apr_time_as_msec(now) - apr_atomic_read32(&lastDrain) >= LOG_FLUSH_INTERVAL) {
+#if APR_HAS_THREADS
+            LogWake();
+#else
+            LogDrain();
+#endif
+        }
+        return;
     }
+#endif // LOG_ASYNC
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(mutex);
+#endif
+    apr_file_write_full(handle, buffer, length, NULL);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(mutex);
+#endif
 }
 
 #endif // LOG_LEVEL
@@ -18,20 +18,21 @@ Abstract:
 #define _LOGGING_H_
 
 //
-// Message levels, ordered in increasing severity.
+// Message levels, ordered in increasing severity. These are macros so the
+// preprocessor can compare them against LOG_LEVEL.
 //
 
-enum {
-    LOG_LEVEL_OFF = 0,
-    LOG_LEVEL_ERROR,
-    LOG_LEVEL_WARNING,
-    LOG_LEVEL_VERBOSE,
-    LOG_LEVEL_DEBUG
-};
+#define LOG_LEVEL_OFF       0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_VERBOSE   3
+#define LOG_LEVEL_DEBUG     4
+
 
-
 //
-// Redefine logging macros for debug and release builds.
+// Redefine logging macros for debug and release builds. Levels above
+// LOG_LEVEL are compiled out, and the arguments of the remaining levels
+// are only evaluated when the level is enabled in the configuration.
 //
 
 #undef LOG_ERROR
@@ -39,37 +40,43 @@ enum {
 #undef LOG_VERBOSE
 #undef LOG_DEBUG
 
+#define LOG_WRITE(level, format, ...) \
+    (((level) <= logMaxLevel) ? LogFormat(level, format APR_EOL_STR, __VA_ARGS__) : (void)0)
+
 #if (LOG_LEVEL >= LOG_LEVEL_ERROR)
-#   define LOG_ERROR(format, ...)   LogFormat(LOG_LEVEL_ERROR, format APR_EOL_STR, __VA_ARGS__)
+#   define LOG_ERROR(format, ...)   LOG_WRITE(LOG_LEVEL_ERROR, format, __VA_ARGS__)
 #else
 #   define LOG_ERROR(format, ...)   ((void)0)
 #endif
 
 #if (LOG_LEVEL >= LOG_LEVEL_WARNING)
-#   define LOG_WARNING(format, ...) LogFormat(LOG_LEVEL_WARNING, format APR_EOL_STR, __VA_ARGS__)
+#   define LOG_WARNING(format, ...) LOG_WRITE(LOG_LEVEL_WARNING, format, __VA_ARGS__)
 #else
 #   define LOG_WARNING(format, ...) ((void)0)
 #endif
 
 #if (LOG_LEVEL >= LOG_LEVEL_VERBOSE)
-#   define LOG_VERBOSE(format, ...) LogFormat(LOG_LEVEL_VERBOSE, format APR_EOL_STR, __VA_ARGS__)
+#   define LOG_VERBOSE(format, ...) LOG_WRITE(LOG_LEVEL_VERBOSE, format, __VA_ARGS__)
 #else
 #   define LOG_VERBOSE(format, ...) ((void)0)
 #endif
 
-#if (LOG_LEVEL >= LOG_LEVEL_FATAL)
-#   define LOG_DEBUG(format, ...)   LogFormat(LOG_LEVEL_DEBUG, format APR_EOL_STR, __VA_ARGS__)
+#if (LOG_LEVEL >= LOG_LEVEL_DEBUG)
+#   define LOG_DEBUG(format, ...)   LOG_WRITE(LOG_LEVEL_DEBUG, format, __VA_ARGS__)
 #else
 #   define LOG_DEBUG(format, ...)   ((void)0)
 #endif
 
-
+
 //
 // Logging functions
 //
 
 #if (LOG_LEVEL > 0)
 
+// Maximum log verbosity level, from the configuration file
+extern apr_uint32_t logMaxLevel;
+
 apr_status_t
 LogInit(
     apr_pool_t *pool
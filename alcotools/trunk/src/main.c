@@ -27,24 +27,180 @@ struct {
     apr_uint32_t crc;   // CRC-32 checksum of the event name
 } static const events[] = {
     // Command-based events
-    {EventPostDele,     "POSTDELE",    0xFD930F3A},
-    {EventPostMkd,      "POSTMKD",     0x6115AE4A},
-    {EventPostRnfr,     "POSTRNFR",    0xFD8885D5},
-    {EventPostRnto,     "POSTRNTO",    0xE67A99DF},
-    {EventPostRmd,      "POSTRMD",     0x2035ED81},
-    {EventPreMkd,       "PREMKD",      0x492B9024},
-    {EventPreStor,      "PRESTOR",     0x2F650D3E},
-    {EventUpload,       "UPLOAD",      0xE7452199},
-    {EventUploadError,  "UPLOADERROR", 0x097FD9FB},
+    {EventPostDele,      "POSTDELE",    0xFD930F3A},
+    {EventPostMkd,       "POSTMKD",     0x6115AE4A},
+    {EventPostRnfr,      "POSTRNFR",    0xFD8885D5},
+    {EventPostRnto,      "POSTRNTO",    0xE67A99DF},
+    {EventPostRmd,       "POSTRMD",     0x2035ED81},
+    {EventPreMkd,        "PREMKD",      0x492B9024},
+    {EventPreStor,       "PRESTOR",     0x2F650D3E},
+    {EventUpload,        "UPLOAD",      0xE7452199},
+    {EventUploadError,   "UPLOADERROR", 0x097FD9FB},
 
     // SITE commands
-    {EventSiteDupe,     "DUPE",        0xE3481466},
-    {EventSiteFileDupe, "FILEDUPE",    0x71C6F2FD},
-    {EventSiteNew,      "NEW",         0xFD4406CF},
-    {EventSiteRescan,   "RESCAN",      0xB3F55E60},
-    {EventSiteUndupe,   "UNDUPE",      0xC84E15B5}
+    {EventSiteDupe,      "DUPE",        0xE3481466},
+    {EventSiteFileDupe,  "FILEDUPE",    0x71C6F2FD},
+    {EventSiteNew,       "NEW",         0xFD4406CF},
+    {EventSiteRaceStats, "RACESTATS",   0x13DD1911},
+    {EventSiteRescan,    "RESCAN",      0xB3F55E60},
+    {EventSiteUndupe,    "UNDUPE",      0xC84E15B5}
 };
 
+// Phases of an event, timed when the ALCOTOOLS_TIMING variable is set
+#define PHASE_INIT      0   // APR initialization
+#define PHASE_FORWARD   1   // Forwarding the event to the daemon
+#define PHASE_CONFIG    2   // Encoding and configuration
+#define PHASE_LOG       3   // Log file
+#define PHASE_STREAMS   4   // Standard streams
+#define PHASE_EVENT     5   // Event callback
+#define PHASE_DEFERRED  6   // Deferred work
+#define PHASE_CLEANUP   7   // Pool destruction and APR termination
+
+static const char *phaseNames[] = {
+    "init", "forward", "config", "log", "streams", "event", "deferred", "cleanup"
+};
+
+// Time each phase completed, zero if it did not run
+static apr_time_t phaseEnd[ARRAYSIZE(phaseNames)];
+
+/*++
+
+PhaseDone
+
+    Records the completion of a phase.
+
+Arguments:
+    phase   - Phase that completed (PHASE_*).
+
+Return Values:
+    None.
+
+--*/
+static
+inline
+void
+PhaseDone(
+    int phase
+    )
+{
+    phaseEnd[phase] = apr_time_now();
+}
+
+/*++
+
+PhaseWrite
+
+    Writes the phase timings of an event as a single line of "name=value"
+    pairs, times in microseconds. The line is appended to the file named by
+    ALCOTOOLS_TIMING, or written to standard error if it is "-".
+
+Arguments:
+    target  - Pointer to a null-terminated string that specifies the target.
+
+    event   - Pointer to a null-terminated string that specifies the event name.
+
+    start   - Time the process started running.
+
+    status  - Exit status.
+
+Return Values:
+    None.
+
+Remarks:
+    This is called after APR has terminated, so it must not use memory pools.
+
+--*/
+static
+void
+PhaseWrite(
+    const char *target,
+    const char *event,
+    apr_time_t start,
+    int status
+    )
+{
+    apr_size_t length;
+    apr_time_t previous = start;
+    char line[512];
+    int i;
+    FILE *file;
+
+    length = apr_snprintf(line, sizeof(line), "event=%s status=%d total=%" APR_TIME_T_FMT,
+        event, status, phaseEnd[PHASE_CLEANUP] - start);
+
+    for (i = 0; i < ARRAYSIZE(phaseNames); i++) {
+        if (phaseEnd[i] != 0) {
+            length += apr_snprintf(line + length, sizeof(line) - length, " %s=%" APR_TIME_T_FMT,
+                phaseNames[i], phaseEnd[i] - previous);
+            previous = phaseEnd[i];
+        }
+    }
+
+    if (strcmp(target, "-") == 0) {
+        fprintf(stderr, "%s\n", line);
+    } else if ((file = fopen(target, "a")) != NULL) {
+        // One write per line, so concurrent processes do not interleave
+        setvbuf(file, NULL, _IOFBF, sizeof(line) + 1);
+        fprintf(file, "%s\n", line);
+        fclose(file);
+    }
+}
+
+/*++
+
+EventDispatch
+
+    Dispatches an event to its callback.
+
+Arguments:
+    argc    - Number of event arguments, including the event name.
+
+    argv    - Array of pointers to the event arguments; the first is the event name.
+
+    pool    - Pointer to a memory pool, used by the event callback.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+EventDispatch(
+    int argc,
+    char **argv,
+    apr_pool_t *pool
+    )
+{
+    apr_status_t status;
+    apr_uint32_t crc;
+    int i;
+
+    ASSERT(argc > 0);
+    ASSERT(argv != NULL);
+
+    //
+    // Calculate the CRC-32 checksum of the first command-line argument and
+    // compare it with the pre-computed checksums in the event table. This
+    // method is marginally faster than performing strcmp() multiple times.
+    //
+    crc = Crc32UpperString(argv[0]);
+    LOG_VERBOSE("CRC-32 checksum for event \"%s\" is 0x%08X.", argv[0], crc);
+
+    for (i = 0; i < ARRAYSIZE(events); i++) {
+        if (crc == events[i].crc) {
+            status = events[i].proc(argc-1, argv+1, pool);
+
+            if (status != APR_SUCCESS) {
+                LOG_ERROR("Event callback returned %d: %s", status, GetErrorMessage(status));
+            }
+            return status;
+        }
+    }
+
+    StreamPrintf(streamOut, "Unknown event: %s" APR_EOL_STR, argv[0]);
+    LOG_ERROR("Unknown event: %s", argv[0]);
+    return APR_EINVAL;
+}
+
 /*++
 
 main
@@ -70,10 +226,14 @@ main(
 {
     int i;
     apr_pool_t *pool;
-    apr_pool_t *eventPool;
+    apr_pool_t *eventPool = NULL;
     apr_status_t status;
     apr_time_t counter;
+    char event[32];
+    const char *timing;
+#ifdef DEBUG
     apr_uint32_t crc;
+#endif
 
     // Count the time elapsed while running
     counter = apr_time_now();
@@ -83,6 +243,13 @@ main(
         return -1;
     }
 
+    // The arguments do not outlive APR, keep the event name for the timings
+    timing = getenv("ALCOTOOLS_TIMING");
+    if (timing != NULL) {
+        i = (strcmp(argv[1], "--client") == 0 && argc > 2) ? 2 : 1;
+        apr_cpystrn(event, argv[i], sizeof(event));
+    }
+
     // Initialize APR memory pools and convert arguments to UTF8
     status = apr_app_initialize(&argc, &argv, NULL);
     if (status != APR_SUCCESS) {
@@ -97,6 +264,26 @@ main(
         apr_terminate();
         return -1;
     }
+    PhaseDone(PHASE_INIT);
+
+    // Forward the event to the resident daemon, before initializing anything else
+    if (strcmp(argv[1], "--client") == 0) {
+        argc--;
+        argv++;
+
+        if (argc >= 2 && DaemonClient(argc-1, argv+1, &i, pool) == APR_SUCCESS) {
+            status = (i != 0) ? 1 : 0;
+            PhaseDone(PHASE_FORWARD);
+            goto detach;
+        }
+
+        // The daemon is not running, process the event here instead
+        if (argc < 2) {
+            printf("No event specified.\n");
+            status = 1;
+            goto detach;
+        }
+    }
 
     // Initialize subsystems
     status = EncInit(pool);
@@ -109,12 +296,14 @@ main(
          printf("Unable to read configuration file: %s\n", GetErrorMessage(status));
          goto exit;
     }
+    PhaseDone(PHASE_CONFIG);
 #if (LOG_LEVEL > 0)
     status = LogInit(pool);
     if (status != APR_SUCCESS) {
         printf("Unable to open log file: %s\n", GetErrorMessage(status));
         goto exit;
     }
+    PhaseDone(PHASE_LOG);
 #endif
 
     // Create standard streams
@@ -125,6 +314,7 @@ main(
         status = APR_ENOMEM;
         goto exit;
     }
+    PhaseDone(PHASE_STREAMS);
 
     LOG_VERBOSE("AlcoTools v%s starting, received %d arguments:", APR_STRINGIFY(VERSION), argc);
     for (i = 0; i < argc; i++) {
@@ -143,6 +333,12 @@ main(
     }
 #endif
 
+    // Run as a resident daemon until terminated
+    if (strcmp(argv[1], "--daemon") == 0) {
+        status = DaemonRun(pool);
+        goto exit;
+    }
+
     // Create a sub-pool for the event callback
     status = apr_pool_create(&eventPool, pool);
     if (status != APR_SUCCESS) {
@@ -150,30 +346,8 @@ main(
         goto exit;
     }
 
-    //
-    // Calculate the CRC-32 checksum of the first command-line argument and
-    // compare it with the pre-computed checksums in the event table. This
-    // method is marginally faster than performing strcmp() multiple times.
-    //
-    crc = Crc32UpperString(argv[1]);
-    LOG_VERBOSE("CRC-32 checksum for event \"%s\" is 0x%08X.", argv[1], crc);
-
-    for (i = 0; i < ARRAYSIZE(events); i++) {
-        if (crc == events[i].crc) {
-            status = events[i].proc(argc-2, argv+2, eventPool);
-
-            if (status != APR_SUCCESS) {
-                LOG_ERROR("Event callback returned %d: %s", status, GetErrorMessage(status));
-            }
-            break;
-        }
-    }
-
-    if (i >= ARRAYSIZE(events)) {
-        printf("Unknown event: %s\n", argv[1]);
-        LOG_ERROR("Unknown event: %s", argv[1]);
-        status = APR_EINVAL;
-    }
+    status = EventDispatch(argc-1, argv+1, eventPool);
+    PhaseDone(PHASE_EVENT);
 
     LOG_VERBOSE("Time taken: %.3f ms", (apr_time_now() - counter)/1000.0);
     LOG_VERBOSE("Exit status: %d", status);
@@ -183,13 +357,25 @@ exit:
         status = 1;
     }
 
+detach:
 #ifdef WINDOWS
     // Detach from ioFTPD before finalizing subsystems
     printf("!detach %d\n", status);
     fflush(stdout);
 #endif
 
+    // Perform deferred work after the server has stopped waiting on us
+    if (eventPool != NULL) {
+        EventDeferred(eventPool);
+        PhaseDone(PHASE_DEFERRED);
+    }
+
     apr_pool_destroy(pool);
     apr_terminate();
+    PhaseDone(PHASE_CLEANUP);
+
+    if (timing != NULL) {
+        PhaseWrite(timing, event, counter, status);
+    }
     return status;
 }
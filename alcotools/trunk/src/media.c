@@ -0,0 +1,739 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Media Probe
+
+Abstract:
+    This module probes MPEG audio files for their properties and tags:
+    the ID3v2 tag at the start of the file, the ID3v1 tag at the end, and
+    the first audio frame, along with its Xing or VBRI header.
+
+    A file is probed with at most three reads: the start of the file, the
+    start of the audio if a large ID3v2 tag (e.g. with cover art) precedes
+    it, and the last 128 bytes. Nothing else is read, so the cost of a probe
+    does not depend on the size of the file.
+
+--*/
+
+#include "alcoholicz.h"
+
+// Size of the buffer read at the start of the file and the audio
+#define PROBE_BUFFER    (16 * 1024)
+
+#define ID3V1_SIZE      128
+#define ID3V2_SIZE      10
+
+// Reads big-endian integers
+#define GET_BE24(p)     (((apr_uint32_t)(p)[0] << 16) | ((apr_uint32_t)(p)[1] << 8) | (apr_uint32_t)(p)[2])
+#define GET_BE32(p)     (((apr_uint32_t)(p)[0] << 24) | GET_BE24((p)+1))
+
+// Frame identifiers are three characters long in ID3v2.2, four afterwards
+#define MATCH_ID(id, major, v22, v23) \
+    ((major) == 2 ? memcmp(id, v22, 3) == 0 : memcmp(id, v23, 4) == 0)
+
+// Reads a synchsafe integer, seven bits per byte
+#define GET_SYNCSAFE(p) (((apr_uint32_t)((p)[0] & 0x7F) << 21) | ((apr_uint32_t)((p)[1] & 0x7F) << 14) | \
+                         ((apr_uint32_t)((p)[2] & 0x7F) << 7)  |  (apr_uint32_t)((p)[3] & 0x7F))
+
+typedef struct {
+    apr_uint32_t bitrate;       // Bitrate in kbit/s
+    apr_uint32_t sampleRate;    // Sampling rate in Hz
+    apr_uint32_t length;        // Frame length in bytes
+    apr_uint32_t samples;       // Samples per frame
+    apr_byte_t   version;       // MEDIA_MPEG*
+    apr_byte_t   layer;         // Layer, 1 to 3
+    apr_byte_t   channelMode;   // MEDIA_* channel mode
+} FRAME;
+
+// Bitrates in kbit/s, by MPEG-1 layer and MPEG-2/2.5 layer
+static const apr_uint16_t bitrates[6][15] = {
+    {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+    {0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384},
+    {0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320},
+    {0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256},
+    {0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160},
+    {0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160}
+};
+
+// Sampling rates in Hz, for MPEG-1
+static const apr_uint32_t sampleRates[3] = {44100, 48000, 32000};
+
+// ID3v1 genres, including the Winamp extensions
+static const char *genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge",
+    "Hip-Hop", "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B",
+    "Rap", "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska",
+    "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop",
+    "Vocal", "Jazz+Funk", "Fusion", "Trance", "Classical", "Instrumental",
+    "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise", "Alt. Rock",
+    "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop",
+    "Instrumental Rock", "Ethnic", "Gothic", "Darkwave", "Techno-Industrial",
+    "Electronic", "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy",
+    "Cult", "Gangsta Rap", "Top 40", "Christian Rap", "Pop Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychedelic", "Rave", "Showtunes",
+    "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro",
+    "Musical", "Rock & Roll", "Hard Rock", "Folk", "Folk Rock", "National Folk",
+    "Swing", "Fast-Fusion", "Bebob", "Latin", "Revival", "Celtic", "Bluegrass",
+    "Avantgarde", "Gothic Rock", "Progressive Rock", "Psychedelic Rock",
+    "Symphonic Rock", "Slow Rock", "Big Band", "Chorus", "Easy Listening",
+    "Acoustic", "Humour", "Speech", "Chanson", "Opera", "Chamber Music",
+    "Sonata", "Symphony", "Booty Bass", "Primus", "Porn Groove", "Satire",
+    "Slow Jam", "Club", "Tango", "Samba", "Folklore", "Ballad", "Power Ballad",
+    "Rhythmic Soul", "Freestyle", "Duet", "Punk Rock", "Drum Solo", "A Cappella",
+    "Euro-House", "Dance Hall", "Goa", "Drum & Bass", "Club-House", "Hardcore",
+    "Terror", "Indie", "BritPop", "Negerpunk", "Polsk Punk", "Beat",
+    "Christian Gangsta Rap", "Heavy Metal", "Black Metal", "Crossover",
+    "Contemporary Christian", "Christian Rock", "Merengue", "Salsa",
+    "Thrash Metal", "Anime", "JPop", "Synthpop"
+};
+
+
+/*++
+
+ReadAt
+
+    Reads part of a file.
+
+Arguments:
+    file    - Pointer to an APR file handle.
+
+    offset  - Offset of the data.
+
+    buffer  - Pointer to a buffer that receives the data.
+
+    length  - Number of bytes to read.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+ReadAt(
+    apr_file_t *file,
+    apr_off_t offset,
+    void *buffer,
+    apr_size_t length
+    )
+{
+    apr_status_t status;
+
+    status = apr_file_seek(file, APR_SET, &offset);
+    if (status == APR_SUCCESS) {
+        status = apr_file_read_full(file, buffer, length, NULL);
+    }
+    return status;
+}
+
+/*++
+
+TrimText
+
+    Removes trailing spaces from a tag.
+
+Arguments:
+    text    - Pointer to a null-terminated string.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+TrimText(
+    char *text
+    )
+{
+    apr_size_t length = strlen(text);
+
+    while (length > 0 && text[length-1] == ' ') {
+        text[--length] = '\0';
+    }
+}
+
+/*++
+
+CopyText
+
+    Copies a tag to a buffer, converting it to UTF-8.
+
+Arguments:
+    dest     - Pointer to the buffer that receives the tag.
+
+    destSize - Size of the buffer, in bytes.
+
+    encoding - ID3v2 text encoding (0 = ISO-8859-1, 1 = UTF-16 with a byte
+               order mark, 2 = UTF-16BE, 3 = UTF-8).
+
+    data     - Pointer to the tag.
+
+    length   - Length of the tag, in bytes.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+CopyText(
+    char *dest,
+    apr_size_t destSize,
+    int encoding,
+    const apr_byte_t *data,
+    apr_size_t length
+    )
+{
+    apr_size_t i;
+    apr_size_t j = 0;
+
+    ASSERT(destSize > 0);
+
+    if (encoding == 1 || encoding == 2) {
+        bool_t bigEndian = TRUE;
+        const utf16_t *source;
+        utf16_t units[MEDIA_TAG_LENGTH];
+        utf8_t *target = (utf8_t *)dest;
+
+        if (encoding == 1 && length >= 2) {
+            bigEndian = (data[0] == 0xFE && data[1] == 0xFF);
+            data   += 2;
+            length -= 2;
+        }
+        for (i = 0; i + 1 < length && j < ARRAYSIZE(units); i += 2, j++) {
+            units[j] = bigEndian ? (data[i] << 8 | data[i+1]) : (data[i+1] << 8 | data[i]);
+            if (units[j] == 0) {
+                break;
+            }
+        }
+        source = units;
+        ConvertUTF16toUTF8(&source, units + j, &target, (utf8_t *)dest + destSize - 1, lenientConversion);
+        *target = '\0';
+
+    } else if (encoding == 3) {
+        for (i = 0; i < length && data[i] != '\0' && i < destSize - 1; i++) {
+            dest[i] = (char)data[i];
+        }
+        // Do not end in the middle of a character
+        if (i < length && data[i] != '\0') {
+            while (i > 0 && (data[i] & 0xC0) == 0x80) {
+                i--;
+            }
+        }
+        dest[i] = '\0';
+
+    } else {
+        for (i = 0; i < length && data[i] != '\0'; i++) {
+            if (data[i] < 0x80) {
+                if (j + 1 >= destSize) {
+                    break;
+                }
+                dest[j++] = (char)data[i];
+            } else {
+                if (j + 2 >= destSize) {
+                    break;
+                }
+                dest[j++] = (char)(0xC0 | (data[i] >> 6));
+                dest[j++] = (char)(0x80 | (data[i] & 0x3F));
+            }
+        }
+        dest[j] = '\0';
+    }
+
+    TrimText(dest);
+}
+
+/*++
+
+ResolveGenre
+
+    Replaces numeric genre references, "(17)" or "17", with the genre name.
+
+Arguments:
+    genre   - Pointer to the genre buffer, MEDIA_GENRE_LENGTH bytes.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+ResolveGenre(
+    char *genre
+    )
+{
+    char *end;
+    const char *p = genre;
+    unsigned long index;
+
+    if (*p == '(') {
+        p++;
+    }
+    if (!apr_isdigit(*p)) {
+        return;
+    }
+    index = strtoul(p, &end, 10);
+
+    if (genre[0] == '(') {
+        if (*end != ')') {
+            return;
+        }
+        // A refinement may follow the reference, e.g. "(4)Eurodisco"
+        if (end[1] != '\0') {
+            memmove(genre, end + 1, strlen(end + 1) + 1);
+            return;
+        }
+    } else if (*end != '\0') {
+        return;
+    }
+
+    if (index < ARRAYSIZE(genres)) {
+        apr_cpystrn(genre, genres[index], MEDIA_GENRE_LENGTH);
+    }
+}
+
+/*++
+
+ParseId3v1
+
+    Reads an ID3v1 tag, filling in the tags missing from the ID3v2 tag.
+
+Arguments:
+    media   - Pointer to a MEDIA_INFO structure.
+
+    tag     - Pointer to the tag, ID3V1_SIZE bytes.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+ParseId3v1(
+    MEDIA_INFO *media,
+    const apr_byte_t *tag
+    )
+{
+    char year[5];
+
+    if (media->title[0] == '\0') {
+        CopyText(media->title, MEDIA_TAG_LENGTH, 0, tag + 3, 30);
+    }
+    if (media->artist[0] == '\0') {
+        CopyText(media->artist, MEDIA_TAG_LENGTH, 0, tag + 33, 30);
+    }
+    if (media->album[0] == '\0') {
+        CopyText(media->album, MEDIA_TAG_LENGTH, 0, tag + 63, 30);
+    }
+    if (media->year == 0) {
+        memcpy(year, tag + 93, 4);
+        year[4] = '\0';
+        media->year = (apr_uint16_t)atoi(year);
+    }
+    if (media->genre[0] == '\0' && tag[127] < ARRAYSIZE(genres)) {
+        apr_cpystrn(media->genre, genres[tag[127]], MEDIA_GENRE_LENGTH);
+    }
+}
+
+/*++
+
+ParseId3v2
+
+    Reads the text frames of an ID3v2.2, 2.3 or 2.4 tag.
+
+Arguments:
+    media   - Pointer to a MEDIA_INFO structure.
+
+    tag     - Pointer to the tag, starting with its header.
+
+    length  - Length of the tag available in the buffer.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+ParseId3v2(
+    MEDIA_INFO *media,
+    const apr_byte_t *tag,
+    apr_size_t length
+    )
+{
+    apr_byte_t major = tag[3];
+    apr_byte_t flags = tag[5];
+    apr_size_t headerLength = (major == 2) ? 6 : 10;
+    apr_size_t offset = ID3V2_SIZE;
+    apr_uint32_t size;
+    const apr_byte_t *frame;
+    const apr_byte_t *id;
+    char text[MEDIA_TAG_LENGTH];
+
+    // Unsynchronised tags must be decoded first, which is not worth it for a probe
+    if ((flags & 0x80) && major < 4) {
+        return;
+    }
+    if ((flags & 0x40) && major > 2 && offset + 4 <= length) {
+        offset += (major == 3) ? GET_BE32(tag + offset) + 4 : GET_SYNCSAFE(tag + offset);
+    }
+
+    while (offset + headerLength <= length && tag[offset] != '\0') {
+        id = tag + offset;
+        if (major == 2) {
+            size = GET_BE24(id + 3);
+        } else if (major == 3) {
+            size = GET_BE32(id + 4);
+        } else {
+            size = GET_SYNCSAFE(id + 4);
+        }
+        offset += headerLength;
+        if (size > length - offset) {
+            break;
+        }
+        frame   = tag + offset;
+        offset += size;
+
+        // Skip compressed, encrypted, and unsynchronised frames
+        if (size < 2 || id[0] != 'T' || (major == 3 && (id[9] & 0xC0)) ||
+                (major == 4 && (id[9] & 0x0F))) {
+            continue;
+        }
+
+        if (MATCH_ID(id, major, "TT2", "TIT2")) {
+            CopyText(media->title, MEDIA_TAG_LENGTH, frame[0], frame + 1, size - 1);
+        } else if (MATCH_ID(id, major, "TP1", "TPE1")) {
+            CopyText(media->artist, MEDIA_TAG_LENGTH, frame[0], frame + 1, size - 1);
+        } else if (MATCH_ID(id, major, "TAL", "TALB")) {
+            CopyText(media->album, MEDIA_TAG_LENGTH, frame[0], frame + 1, size - 1);
+        } else if (MATCH_ID(id, major, "TCO", "TCON")) {
+            CopyText(media->genre, MEDIA_GENRE_LENGTH, frame[0], frame + 1, size - 1);
+            ResolveGenre(media->genre);
+        } else if (MATCH_ID(id, major, "TYE", "TYER") || MATCH_ID(id, major, "TYE", "TDRC")) {
+            CopyText(text, sizeof(text), frame[0], frame + 1, size - 1);
+            media->year = (apr_uint16_t)atoi(text);
+        }
+    }
+}
+
+/*++
+
+DecodeFrame
+
+    Decodes an MPEG audio frame header.
+
+Arguments:
+    data    - Pointer to the frame header, four bytes.
+
+    frame   - Pointer to a FRAME structure that receives the frame properties.
+
+Return Values:
+    If the header is valid, the return is nonzero (true).
+
+    If the header is invalid, the return is zero (false).
+
+--*/
+static
+inline
+bool_t
+DecodeFrame(
+    const apr_byte_t *data,
+    FRAME *frame
+    )
+{
+    int bitrateIndex;
+    int layerBits;
+    int rateIndex;
+    int versionBits;
+
+    if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0) {
+        return FALSE;
+    }
+    versionBits  = (data[1] >> 3) & 3;
+    layerBits    = (data[1] >> 1) & 3;
+    bitrateIndex = data[2] >> 4;
+    rateIndex    = (data[2] >> 2) & 3;
+
+    // Reserved values, and free-format streams which have no fixed frame length
+    if (versionBits == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) {
+        return FALSE;
+    }
+
+    frame->version     = (versionBits == 3) ? MEDIA_MPEG1 : (versionBits == 2) ? MEDIA_MPEG2 : MEDIA_MPEG25;
+    frame->layer       = (apr_byte_t)(4 - layerBits);
+    frame->channelMode = data[3] >> 6;
+    frame->bitrate     = bitrates[(frame->version == MEDIA_MPEG1 ? 0 : 3) + frame->layer - 1][bitrateIndex];
+    frame->sampleRate  = sampleRates[rateIndex] >> (frame->version - 1);
+
+    if (frame->layer == 1) {
+        frame->samples = 384;
+        frame->length  = (12000 * frame->bitrate / frame->sampleRate + ((data[2] >> 1) & 1)) * 4;
+    } else {
+        frame->samples = (frame->layer == 3 && frame->version != MEDIA_MPEG1) ? 576 : 1152;
+        frame->length  = frame->samples * 125 * frame->bitrate / frame->sampleRate + ((data[2] >> 1) & 1);
+    }
+    return TRUE;
+}
+
+/*++
+
+ParseAudio
+
+    Finds the first audio frame and calculates the stream properties.
+
+Arguments:
+    media      - Pointer to a MEDIA_INFO structure.
+
+    data       - Pointer to the start of the audio.
+
+    length     - Length of the audio available in the buffer.
+
+    audioBytes - Total length of the audio, excluding tags.
+
+Return Values:
+    None.
+
+--*/
+static
+void
+ParseAudio(
+    MEDIA_INFO *media,
+    const apr_byte_t *data,
+    apr_size_t length,
+    apr_uint64_t audioBytes
+    )
+{
+    apr_size_t offset;
+    apr_size_t next;
+    apr_size_t xing;
+    apr_uint32_t flags;
+    apr_uint64_t frames = 0;
+    const apr_byte_t *p;
+    FRAME frame;
+    FRAME second;
+
+    // A header is only accepted if the following frame's header agrees with it
+    for (offset = 0; offset + 4 <= length; offset++) {
+        if (!DecodeFrame(data + offset, &frame)) {
+            continue;
+        }
+        next = offset + frame.length;
+        if (next + 4 > length || (DecodeFrame(data + next, &second) &&
+                second.version == frame.version && second.layer == frame.layer &&
+                second.sampleRate == frame.sampleRate)) {
+            break;
+        }
+    }
+    if (offset + 4 > length) {
+        return;
+    }
+    p = data + offset;
+    audioBytes = (audioBytes > offset) ? audioBytes - offset : 0;
+
+    // The Xing header follows the side information of the first frame
+    if (frame.version == MEDIA_MPEG1) {
+        xing = (frame.channelMode == MEDIA_MONO) ? 4 + 17 : 4 + 32;
+    } else {
+        xing = (frame.channelMode == MEDIA_MONO) ? 4 + 9 : 4 + 17;
+    }
+
+    if (offset + xing + 16 <= length && (memcmp(p + xing, "Xing", 4) == 0 || memcmp(p + xing, "Info", 4) == 0)) {
+        media->vbr = (p[xing] == 'X');
+        flags = GET_BE32(p + xing + 4);
+        xing += 8;
+        if (flags & 0x1) {
+            frames = GET_BE32(p + xing);
+            xing += 4;
+        }
+        if ((flags & 0x2) && GET_BE32(p + xing) > 0) {
+            audioBytes = GET_BE32(p + xing);
+        }
+    } else if (offset + 4 + 32 + 18 <= length && memcmp(p + 4 + 32, "VBRI", 4) == 0) {
+        media->vbr = TRUE;
+        if (GET_BE32(p + 4 + 32 + 10) > 0) {
+            audioBytes = GET_BE32(p + 4 + 32 + 10);
+        }
+        frames = GET_BE32(p + 4 + 32 + 14);
+    }
+
+    media->version     = frame.version;
+    media->layer       = frame.layer;
+    media->channelMode = frame.channelMode;
+    media->sampleRate  = frame.sampleRate;
+
+    if (frames > 0) {
+        // Xing and VBRI headers count the frames, the duration follows from them
+        media->frames   = (apr_uint32_t)frames;
+        media->duration = (apr_uint32_t)(frames * frame.samples * 1000 / frame.sampleRate);
+        media->bitrate  = media->duration ? (apr_uint32_t)(audioBytes * 8 / media->duration) : frame.bitrate;
+    } else {
+        // Constant bitrate, the duration follows from the size
+        media->frames   = (apr_uint32_t)(audioBytes / frame.length);
+        media->duration = (apr_uint32_t)(audioBytes * 8 / frame.bitrate);
+        media->bitrate  = frame.bitrate;
+    }
+}
+
+/*++
+
+MediaProbe
+
+    Probes an MPEG audio file for its properties and tags.
+
+Arguments:
+    path    - Pointer to a null-terminated string that specifies the file path.
+
+    media   - Pointer to a MEDIA_INFO structure that receives the properties.
+              If the file is not MPEG audio, the 'version' member is zero.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+MediaProbe(
+    const char *path,
+    MEDIA_INFO *media,
+    apr_pool_t *pool
+    )
+{
+    apr_byte_t *buffer;
+    apr_byte_t *data;
+    apr_file_t *file;
+    apr_finfo_t info;
+    apr_size_t available;
+    apr_size_t length;
+    apr_status_t status;
+    apr_uint64_t audioEnd;
+    apr_uint64_t audioStart = 0;
+
+    ASSERT(path  != NULL);
+    ASSERT(media != NULL);
+    ASSERT(pool  != NULL);
+
+    memset(media, 0, sizeof(MEDIA_INFO));
+
+    status = apr_file_open(&file, path, APR_FOPEN_READ|APR_FOPEN_BINARY, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, file);
+    if (status != APR_SUCCESS) {
+        goto done;
+    }
+
+    buffer = apr_palloc(pool, PROBE_BUFFER + ID3V1_SIZE);
+    if (buffer == NULL) {
+        status = APR_ENOMEM;
+        goto done;
+    }
+    length = (apr_size_t)MIN(info.size, PROBE_BUFFER);
+    status = ReadAt(file, 0, buffer, length);
+    if (status != APR_SUCCESS) {
+        goto done;
+    }
+
+    if (length >= ID3V2_SIZE && memcmp(buffer, "ID3", 3) == 0 && buffer[3] >= 2 && buffer[3] <= 4 &&
+            !((buffer[6] | buffer[7] | buffer[8] | buffer[9]) & 0x80)) {
+        audioStart = ID3V2_SIZE + GET_SYNCSAFE(buffer + 6);
+        if (buffer[5] & 0x10) {
+            audioStart += ID3V2_SIZE; // Footer
+        }
+        ParseId3v2(media, buffer, (apr_size_t)MIN(length, audioStart));
+    }
+    if (audioStart >= (apr_uint64_t)info.size) {
+        goto done;
+    }
+
+    // ID3v1 tag at the end of the file
+    audioEnd = info.size;
+    if ((apr_uint64_t)info.size >= audioStart + ID3V1_SIZE) {
+        data = buffer + PROBE_BUFFER;
+        if ((apr_uint64_t)info.size <= length) {
+            memcpy(data, buffer + info.size - ID3V1_SIZE, ID3V1_SIZE);
+        } else {
+            status = ReadAt(file, info.size - ID3V1_SIZE, data, ID3V1_SIZE);
+            if (status != APR_SUCCESS) {
+                goto done;
+            }
+        }
+        if (memcmp(data, "TAG", 3) == 0) {
+            ParseId3v1(media, data);
+            audioEnd -= ID3V1_SIZE;
+        }
+    }
+
+    // Read the start of the audio again if the tag filled most of the buffer
+    if (audioStart + PROBE_BUFFER / 2 > length) {
+        available = (apr_size_t)MIN(audioEnd - audioStart, PROBE_BUFFER);
+        status = ReadAt(file, (apr_off_t)audioStart, buffer, available);
+        if (status != APR_SUCCESS) {
+            goto done;
+        }
+        data = buffer;
+    } else {
+        available = (apr_size_t)MIN(audioEnd, length) - (apr_size_t)audioStart;
+        data = buffer + audioStart;
+    }
+    ParseAudio(media, data, available, audioEnd - audioStart);
+
+done:
+    apr_file_close(file);
+    return status;
+}
+
+/*++
+
+MediaVersionName
+
+    Retrieves the name of an MPEG audio version.
+
+Arguments:
+    media   - Pointer to a MEDIA_INFO structure.
+
+Return Values:
+    Pointer to a null-terminated string.
+
+--*/
+const char *
+MediaVersionName(
+    const MEDIA_INFO *media
+    )
+{
+    switch (media->version) {
+        case MEDIA_MPEG1:  return "MPEG-1";
+        case MEDIA_MPEG2:  return "MPEG-2";
+        case MEDIA_MPEG25: return "MPEG-2.5";
+    }
+    return "Unknown";
+}
+
+/*++
+
+MediaChannelName
+
+    Retrieves the name of a channel mode.
+
+Arguments:
+    media   - Pointer to a MEDIA_INFO structure.
+
+Return Values:
+    Pointer to a null-terminated string.
+
+--*/
+const char *
+MediaChannelName(
+    const MEDIA_INFO *media
+    )
+{
+    switch (media->channelMode) {
+        case MEDIA_STEREO:       return "Stereo";
+        case MEDIA_JOINT_STEREO: return "Joint Stereo";
+        case MEDIA_DUAL_CHANNEL: return "Dual Channel";
+        case MEDIA_MONO:         return "Mono";
+    }
+    return "Unknown";
+}
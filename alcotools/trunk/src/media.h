@@ -0,0 +1,72 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Media Probe
+
+Abstract:
+    Media probing function prototypes and structures.
+
+--*/
+
+#ifndef _MEDIA_H_
+#define _MEDIA_H_
+
+// MPEG audio versions
+#define MEDIA_MPEG1         1
+#define MEDIA_MPEG2         2
+#define MEDIA_MPEG25        3
+
+// Channel modes
+#define MEDIA_STEREO        0
+#define MEDIA_JOINT_STEREO  1
+#define MEDIA_DUAL_CHANNEL  2
+#define MEDIA_MONO          3
+
+// Size of tag buffers, including the terminator
+#define MEDIA_TAG_LENGTH    64
+#define MEDIA_GENRE_LENGTH  32
+
+//
+// Properties of an MPEG audio file. This structure is stored in the race
+// statistics file, so it must only contain fixed-size members. Tags are
+// UTF-8 encoded.
+//
+
+typedef struct {
+    apr_uint32_t duration;                    // Duration in milliseconds
+    apr_uint32_t bitrate;                     // Average bitrate in kbit/s
+    apr_uint32_t sampleRate;                  // Sampling rate in Hz
+    apr_uint32_t frames;                      // Number of audio frames
+    apr_uint16_t year;                        // Year from the tag, zero if unknown
+    apr_byte_t   version;                     // MEDIA_MPEG*, zero if not MPEG audio
+    apr_byte_t   layer;                       // Layer, 1 to 3
+    apr_byte_t   channelMode;                 // MEDIA_* channel mode
+    apr_byte_t   vbr;                         // Variable bitrate
+    apr_byte_t   reserved[2];
+    char         artist[MEDIA_TAG_LENGTH];
+    char         album[MEDIA_TAG_LENGTH];
+    char         title[MEDIA_TAG_LENGTH];
+    char         genre[MEDIA_GENRE_LENGTH];
+} MEDIA_INFO;
+
+apr_status_t
+MediaProbe(
+    const char *path,
+    MEDIA_INFO *media,
+    apr_pool_t *pool
+    );
+
+const char *
+MediaVersionName(
+    const MEDIA_INFO *media
+    );
+
+const char *
+MediaChannelName(
+    const MEDIA_INFO *media
+    );
+
+#endif // _MEDIA_H_
@@ -72,4 +72,7 @@ Abstract:
 #   endif
 #endif // HAVE_DIRENT_H
 
+// Thread-local storage
+#define THREAD_LOCAL __thread
+
 #endif // _PLATUNIX_H_
@@ -38,4 +38,7 @@ Abstract:
 #   endif
 #endif // inline
 
+// Thread-local storage
+#define THREAD_LOCAL __declspec(thread)
+
 #endif // _PLATWIN_H_
@@ -0,0 +1,616 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Race Statistics
+
+Abstract:
+    This module maintains the race statistics of each release: the files,
+    bytes and transfer time of every user and group, and the times of the
+    first and last upload.
+
+    The statistics of a release are kept in a small fixed-size file, named
+    after the CRC-32 checksum of the release's virtual path. Each upload
+    maps the file and updates it in place under an exclusive lock, so the
+    cost of an upload does not depend on the number of files in the release.
+
+    Renames and removals also take the exclusive lock, and move or remove
+    the file itself. A process that opened the file before it was moved
+    notices once it holds the lock, and opens the path again.
+
+    The file is in host byte order; it is not portable across platforms.
+
+--*/
+
+#include "alcoholicz.h"
+
+#define RACE_MAGIC      0x43524441  // "ADRC"
+#define RACE_VERSION    2
+
+
+/*++
+
+GetFilePath
+
+    Builds the path of a release's statistics file.
+
+Arguments:
+    dirPath - Pointer to a null-terminated string that specifies the directory
+              containing the statistics files.
+
+    release - Pointer to a null-terminated string that specifies the virtual
+              path of the release.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Pointer to the file path.
+
+--*/
+static
+char *
+GetFilePath(
+    const char *dirPath,
+    const char *release,
+    apr_pool_t *pool
+    )
+{
+    // Virtual paths are case-insensitive
+    return apr_psprintf(pool, "%s/%08X.race", dirPath, Crc32UpperString(release));
+}
+
+/*++
+
+GetEntry
+
+    Finds an entry by name, adding it if it does not exist.
+
+Arguments:
+    entries - Pointer to an array of entries.
+
+    count   - Pointer to the number of entries used, updated if one is added.
+
+    max     - Number of entries in the array.
+
+    name    - Pointer to a null-terminated string that specifies the name.
+
+Return Values:
+    Pointer to the entry. If the array is full, the last entry collects
+    the remaining names.
+
+--*/
+static
+RACE_ENTRY *
+GetEntry(
+    RACE_ENTRY *entries,
+    apr_uint32_t *count,
+    apr_uint32_t max,
+    const char *name
+    )
+{
+    apr_uint32_t i;
+
+    for (i = 0; i < *count && i < max; i++) {
+        if (strncmp(entries[i].name, name, RACE_NAME_LENGTH-1) == 0) {
+            return &entries[i];
+        }
+    }
+
+    // The last entry is reserved for the remaining names
+    if (*count < max - 1) {
+        i = (*count)++;
+        apr_cpystrn(entries[i].name, name, RACE_NAME_LENGTH);
+    } else {
+        i = max - 1;
+        if (*count < max) {
+            *count = max;
+            apr_cpystrn(entries[i].name, RACE_OTHERS, RACE_NAME_LENGTH);
+        }
+    }
+    return &entries[i];
+}
+
+/*++
+
+AddTransfer
+
+    Adds a transfer to an entry.
+
+Arguments:
+    entry    - Pointer to the entry.
+
+    bytes    - Size of the file, in bytes.
+
+    duration - Transfer time in milliseconds, zero if unknown.
+
+Return Values:
+    None.
+
+--*/
+static
+inline
+void
+AddTransfer(
+    RACE_ENTRY *entry,
+    apr_uint64_t bytes,
+    apr_uint64_t duration
+    )
+{
+    entry->files++;
+    entry->bytes    += bytes;
+    entry->duration += duration;
+}
+
+/*++
+
+OpenLocked
+
+    Opens and locks a release's statistics file.
+
+Arguments:
+    file    - Location to store the opened file.
+
+    path    - Pointer to a null-terminated string that specifies the file path.
+
+    flags   - File open flags.
+
+    lock    - Lock type, APR_FLOCK_SHARED or APR_FLOCK_EXCLUSIVE.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+Remarks:
+    If the file was renamed or removed while waiting for the lock, the path
+    is opened again; the locked file is always the one at the path.
+
+--*/
+static
+apr_status_t
+OpenLocked(
+    apr_file_t **file,
+    const char *path,
+    apr_int32_t flags,
+    int lock,
+    apr_pool_t *pool
+    )
+{
+    apr_finfo_t current;
+    apr_finfo_t locked;
+    apr_status_t status;
+
+    for (;;) {
+        status = apr_file_open(file, path, flags, APR_OS_DEFAULT, pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+
+        status = apr_file_lock(*file, lock);
+        if (status == APR_SUCCESS) {
+            status = apr_file_info_get(&locked, APR_FINFO_IDENT, *file);
+        }
+        if (status == APR_SUCCESS) {
+            status = apr_stat(&current, path, APR_FINFO_IDENT, pool);
+            if (status == APR_SUCCESS && current.inode == locked.inode && current.device == locked.device) {
+                return APR_SUCCESS;
+            }
+            apr_file_unlock(*file);
+        }
+        apr_file_close(*file);
+
+        if (status != APR_SUCCESS && !APR_STATUS_IS_ENOENT(status)) {
+            return status;
+        }
+    }
+}
+
+/*++
+
+ReadLocked
+
+    Reads the statistics of a release from its locked file.
+
+Arguments:
+    file    - Pointer to the locked statistics file.
+
+    release - Pointer to a null-terminated string that specifies the virtual
+              path of the release.
+
+    stats   - Pointer to a RACE_STATS structure that receives the statistics.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code. If the file does not hold the release's
+    statistics, the return value is APR_ENOENT.
+
+--*/
+static
+apr_status_t
+ReadLocked(
+    apr_file_t *file,
+    const char *release,
+    RACE_STATS *stats,
+    apr_pool_t *pool
+    )
+{
+    apr_finfo_t info;
+    apr_mmap_t *map;
+    apr_status_t status;
+
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, file);
+    if (status == APR_SUCCESS) {
+        if (info.size != (apr_off_t)sizeof(RACE_STATS)) {
+            status = APR_ENOENT;
+        } else {
+            status = apr_mmap_create(&map, file, 0, sizeof(RACE_STATS), APR_MMAP_READ, pool);
+            if (status == APR_SUCCESS) {
+                memcpy(stats, map->mm, sizeof(RACE_STATS));
+                apr_mmap_delete(map);
+            }
+        }
+    }
+
+    // A checksum collision leaves another release's statistics in the file
+    if (status == APR_SUCCESS && (stats->magic != RACE_MAGIC || stats->version != RACE_VERSION ||
+            stats->users > RACE_MAX_USERS || stats->groups > RACE_MAX_GROUPS ||
+            strncasecmp(stats->path, release, RACE_PATH_LENGTH-1) != 0)) {
+        status = APR_ENOENT;
+    }
+    return status;
+}
+
+/*++
+
+WritePath
+
+    Writes the virtual path of a release to its locked statistics file.
+
+Arguments:
+    file    - Pointer to the locked statistics file.
+
+    release - Pointer to a null-terminated string that specifies the virtual
+              path of the release.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+static
+apr_status_t
+WritePath(
+    apr_file_t *file,
+    const char *release
+    )
+{
+    apr_off_t offset = APR_OFFSETOF(RACE_STATS, path);
+    apr_status_t status;
+    char path[RACE_PATH_LENGTH];
+
+    memset(path, 0, RACE_PATH_LENGTH);
+    apr_cpystrn(path, release, RACE_PATH_LENGTH);
+
+    status = apr_file_seek(file, APR_SET, &offset);
+    if (status == APR_SUCCESS) {
+        status = apr_file_write_full(file, path, RACE_PATH_LENGTH, NULL);
+    }
+    return status;
+}
+
+/*++
+
+RaceAdd
+
+    Adds an upload to the statistics of a release.
+
+Arguments:
+    dirPath - Pointer to a null-terminated string that specifies the directory
+              containing the statistics files.
+
+    release - Pointer to a null-terminated string that specifies the virtual
+              path of the release.
+
+    user    - Pointer to a null-terminated string that specifies the uploader.
+
+    group   - Pointer to a null-terminated string that specifies the uploader's group.
+
+    bytes   - Size of the uploaded file, in bytes.
+
+    speed   - Transfer speed in kilobytes per second, zero if unknown.
+
+    time    - Time the upload completed.
+
+    media   - Pointer to a MEDIA_INFO structure describing the file, null if
+              the file was not probed.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code.
+
+--*/
+apr_status_t
+RaceAdd(
+    const char *dirPath,
+    const char *release,
+    const char *user,
+    const char *group,
+    apr_uint64_t bytes,
+    apr_uint32_t speed,
+    apr_time_t time,
+    const MEDIA_INFO *media,
+    apr_pool_t *pool
+    )
+{
+    apr_file_t *file;
+    apr_finfo_t info;
+    apr_mmap_t *map;
+    apr_status_t status;
+    apr_uint64_t duration;
+    char *path;
+    RACE_ENTRY *entry;
+    RACE_STATS *stats;
+
+    ASSERT(dirPath != NULL);
+    ASSERT(release != NULL);
+    ASSERT(user    != NULL);
+    ASSERT(group   != NULL);
+    ASSERT(pool    != NULL);
+
+    path = GetFilePath(dirPath, release, pool);
+    status = OpenLocked(&file, path, APR_FOPEN_READ|APR_FOPEN_WRITE|
+        APR_FOPEN_CREATE|APR_FOPEN_BINARY, APR_FLOCK_EXCLUSIVE, pool);
+
+    if (APR_STATUS_IS_ENOENT(status)) {
+        // Create the directory on the first upload
+        status = apr_dir_make(dirPath, APR_OS_DEFAULT, pool);
+        if (status == APR_SUCCESS || APR_STATUS_IS_EEXIST(status)) {
+            status = OpenLocked(&file, path, APR_FOPEN_READ|APR_FOPEN_WRITE|
+                APR_FOPEN_CREATE|APR_FOPEN_BINARY, APR_FLOCK_EXCLUSIVE, pool);
+        }
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    // New files are extended with zeros, which is an empty release
+    status = apr_file_info_get(&info, APR_FINFO_SIZE, file);
+    if (status == APR_SUCCESS && info.size != (apr_off_t)sizeof(RACE_STATS)) {
+        status = apr_file_trunc(file, (apr_off_t)sizeof(RACE_STATS));
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_mmap_create(&map, file, 0, sizeof(RACE_STATS), APR_MMAP_READ|APR_MMAP_WRITE, pool);
+    }
+    if (status != APR_SUCCESS) {
+        goto done;
+    }
+    stats = map->mm;
+
+    if (stats->magic != RACE_MAGIC || stats->version != RACE_VERSION ||
+            stats->users > RACE_MAX_USERS || stats->groups > RACE_MAX_GROUPS ||
+            strncasecmp(stats->path, release, RACE_PATH_LENGTH-1) != 0) {
+        if (stats->magic != 0) {
+            LOG_WARNING("Resetting race statistics \"%s\" for \"%s\".", path, release);
+        }
+        memset(stats, 0, sizeof(RACE_STATS));
+        apr_cpystrn(stats->path, release, RACE_PATH_LENGTH);
+        stats->version = RACE_VERSION;
+        stats->magic   = RACE_MAGIC;
+        stats->first   = time;
+    }
+
+    duration = (speed > 0) ? (bytes * 1000 / ((apr_uint64_t)speed * 1024)) : 0;
+
+    stats->files++;
+    stats->bytes    += bytes;
+    stats->duration += duration;
+    stats->last      = time;
+
+    // Releases are described by their first audio file
+    if (media != NULL && media->version != 0 && stats->media.version == 0) {
+        memcpy(&stats->media, media, sizeof(MEDIA_INFO));
+    }
+
+    entry = GetEntry(stats->user, &stats->users, RACE_MAX_USERS, user);
+    if (entry->group[0] == '\0' && strcmp(entry->name, RACE_OTHERS) != 0) {
+        apr_cpystrn(entry->group, group, RACE_NAME_LENGTH);
+    }
+    AddTransfer(entry, bytes, duration);
+    AddTransfer(GetEntry(stats->group, &stats->groups, RACE_MAX_GROUPS, group), bytes, duration);
+
+    apr_mmap_delete(map);
+
+done:
+    apr_file_unlock(file);
+    apr_file_close(file);
+    return status;
+}
+
+/*++
+
+RaceRead
+
+    Reads the statistics of a release.
+
+Arguments:
+    dirPath - Pointer to a null-terminated string that specifies the directory
+              containing the statistics files.
+
+    release - Pointer to a null-terminated string that specifies the virtual
+              path of the release.
+
+    stats   - Pointer to a RACE_STATS structure that receives the statistics.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code. If the release has no statistics, the return
+    value is APR_ENOENT.
+
+--*/
+apr_status_t
+RaceRead(
+    const char *dirPath,
+    const char *release,
+    RACE_STATS *stats,
+    apr_pool_t *pool
+    )
+{
+    apr_file_t *file;
+    apr_status_t status;
+
+    ASSERT(dirPath != NULL);
+    ASSERT(release != NULL);
+    ASSERT(stats   != NULL);
+    ASSERT(pool    != NULL);
+
+    status = OpenLocked(&file, GetFilePath(dirPath, release, pool),
+        APR_FOPEN_READ|APR_FOPEN_BINARY, APR_FLOCK_SHARED, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    status = ReadLocked(file, release, stats, pool);
+
+    apr_file_unlock(file);
+    apr_file_close(file);
+    return status;
+}
+
+/*++
+
+RaceRemove
+
+    Removes the statistics of a release.
+
+Arguments:
+    dirPath - Pointer to a null-terminated string that specifies the directory
+              containing the statistics files.
+
+    release - Pointer to a null-terminated string that specifies the virtual
+              path of the release.
+
+    pool    - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code. Releases without statistics are not an error.
+
+--*/
+apr_status_t
+RaceRemove(
+    const char *dirPath,
+    const char *release,
+    apr_pool_t *pool
+    )
+{
+    apr_file_t *file;
+    apr_status_t status;
+    char *path;
+    RACE_STATS *stats;
+
+    ASSERT(dirPath != NULL);
+    ASSERT(release != NULL);
+    ASSERT(pool    != NULL);
+
+    stats = apr_palloc(pool, sizeof(RACE_STATS));
+    if (stats == NULL) {
+        return APR_ENOMEM;
+    }
+
+    path = GetFilePath(dirPath, release, pool);
+    status = OpenLocked(&file, path, APR_FOPEN_READ|APR_FOPEN_WRITE|
+        APR_FOPEN_BINARY, APR_FLOCK_EXCLUSIVE, pool);
+    if (status != APR_SUCCESS) {
+        return APR_STATUS_IS_ENOENT(status) ? APR_SUCCESS : status;
+    }
+
+    // Only remove the file if it belongs to this release
+    status = ReadLocked(file, release, stats, pool);
+    if (status == APR_SUCCESS) {
+        status = apr_file_remove(path, pool);
+    }
+
+    apr_file_unlock(file);
+    apr_file_close(file);
+    return APR_STATUS_IS_ENOENT(status) ? APR_SUCCESS : status;
+}
+
+/*++
+
+RaceRename
+
+    Moves the statistics of a release after it was renamed.
+
+Arguments:
+    dirPath     - Pointer to a null-terminated string that specifies the
+                  directory containing the statistics files.
+
+    oldRelease  - Pointer to a null-terminated string that specifies the
+                  previous virtual path of the release.
+
+    newRelease  - Pointer to a null-terminated string that specifies the
+                  new virtual path of the release.
+
+    pool        - Pointer to a memory pool.
+
+Return Values:
+    Returns an APR status code. Releases without statistics are not an error.
+
+--*/
+apr_status_t
+RaceRename(
+    const char *dirPath,
+    const char *oldRelease,
+    const char *newRelease,
+    apr_pool_t *pool
+    )
+{
+    apr_file_t *file;
+    apr_status_t status;
+    char *oldPath;
+    char *newPath;
+    RACE_STATS *stats;
+
+    ASSERT(dirPath    != NULL);
+    ASSERT(oldRelease != NULL);
+    ASSERT(newRelease != NULL);
+    ASSERT(pool       != NULL);
+
+    stats = apr_palloc(pool, sizeof(RACE_STATS));
+    if (stats == NULL) {
+        return APR_ENOMEM;
+    }
+
+    oldPath = GetFilePath(dirPath, oldRelease, pool);
+    newPath = GetFilePath(dirPath, newRelease, pool);
+
+    status = OpenLocked(&file, oldPath, APR_FOPEN_READ|APR_FOPEN_WRITE|
+        APR_FOPEN_BINARY, APR_FLOCK_EXCLUSIVE, pool);
+    if (status != APR_SUCCESS) {
+        return APR_STATUS_IS_ENOENT(status) ? APR_SUCCESS : status;
+    }
+
+    //
+    // The file is updated and moved while it is locked, so uploads waiting
+    // for the lock are neither lost nor counted under the previous path.
+    //
+    status = ReadLocked(file, oldRelease, stats, pool);
+    if (status == APR_SUCCESS) {
+        status = WritePath(file, newRelease);
+    }
+
+    // Renames that only change the case use the same file
+    if (status == APR_SUCCESS && strcmp(oldPath, newPath) != 0) {
+        status = apr_file_rename(oldPath, newPath, pool);
+        if (status != APR_SUCCESS) {
+            WritePath(file, stats->path);
+        }
+    }
+
+    apr_file_unlock(file);
+    apr_file_close(file);
+    return APR_STATUS_IS_ENOENT(status) ? APR_SUCCESS : status;
+}
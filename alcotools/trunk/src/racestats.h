@@ -0,0 +1,96 @@
+/*++
+
+AlcoTools - Alcoholicz dupe checker, zipscript, and utilities.
+Copyright (c) 2005-2006 Alcoholicz Scripting Team
+
+Module Name:
+    Race Statistics
+
+Abstract:
+    Race statistics function prototypes and structures.
+
+--*/
+
+#ifndef _RACESTATS_H_
+#define _RACESTATS_H_
+
+// Maximum number of users and groups tracked per release, the last
+// entry collects everyone who does not fit
+#define RACE_MAX_USERS      32
+#define RACE_MAX_GROUPS     16
+
+// Size of name buffers, including the terminator
+#define RACE_NAME_LENGTH    32
+#define RACE_PATH_LENGTH    256
+
+// Name of the entry that collects the remaining users or groups
+#define RACE_OTHERS         "(others)"
+
+typedef struct {
+    char         name[RACE_NAME_LENGTH];  // User or group name
+    char         group[RACE_NAME_LENGTH]; // User's group, empty for group entries
+    apr_uint64_t bytes;                   // Bytes uploaded
+    apr_uint64_t duration;                // Transfer time in milliseconds, zero if unknown
+    apr_uint32_t files;                   // Files uploaded
+    apr_uint32_t reserved;
+} RACE_ENTRY;
+
+//
+// Statistics of one release. This is also the layout of the statistics
+// file, so it must only contain fixed-size members.
+//
+
+typedef struct {
+    apr_uint32_t magic;                   // RACE_MAGIC
+    apr_uint32_t version;                 // RACE_VERSION
+    apr_uint32_t users;                   // Number of user entries used
+    apr_uint32_t groups;                  // Number of group entries used
+    apr_uint64_t bytes;                   // Bytes uploaded
+    apr_uint64_t duration;                // Transfer time in milliseconds, zero if unknown
+    apr_time_t   first;                   // Time the first upload completed
+    apr_time_t   last;                    // Time the last upload completed
+    apr_uint32_t files;                   // Files uploaded
+    apr_uint32_t reserved;
+    char         path[RACE_PATH_LENGTH];  // Virtual path of the release
+    MEDIA_INFO   media;                   // Audio properties of the first probed file
+    RACE_ENTRY   user[RACE_MAX_USERS];
+    RACE_ENTRY   group[RACE_MAX_GROUPS];
+} RACE_STATS;
+
+apr_status_t
+RaceAdd(
+    const char *dirPath,
+    const char *release,
+    const char *user,
+    const char *group,
+    apr_uint64_t bytes,
+    apr_uint32_t speed,
+    apr_time_t time,
+    const MEDIA_INFO *media,
+    apr_pool_t *pool
+    );
+
+apr_status_t
+RaceRead(
+    const char *dirPath,
+    const char *release,
+    RACE_STATS *stats,
+    apr_pool_t *pool
+    );
+
+apr_status_t
+RaceRemove(
+    const char *dirPath,
+    const char *release,
+    apr_pool_t *pool
+    );
+
+apr_status_t
+RaceRename(
+    const char *dirPath,
+    const char *oldRelease,
+    const char *newRelease,
+    apr_pool_t *pool
+    );
+
+#endif // _RACESTATS_H_
@@ -184,6 +184,47 @@ StreamPuts(
 
 /*++
 
+StreamPrintf
+
+    Writes a formatted string to an I/O stream.
+
+Arguments:
+    stream  - Pointer to a stream.
+
+    format  - Pointer to a buffer containing a printf-style format string.
+
+    ...     - Arguments to insert into 'format'.
+
+Return Values:
+    Returns an APR status code.
+
+Remarks:
+    The formatted string is truncated to 1024 characters.
+
+--*/
+apr_status_t
+StreamPrintf(
+    STREAM *stream,
+    const char *format,
+    ...
+    )
+{
+    char buffer[1024];
+    int length;
+    va_list argList;
+
+    ASSERT(stream != NULL);
+    ASSERT(format != NULL);
+
+    va_start(argList, format);
+    length = apr_vsnprintf(buffer, ARRAYSIZE(buffer), format, argList);
+    va_end(argList);
+
+    return StreamWrite(stream, (const apr_byte_t *)buffer, (apr_size_t)length, NULL);
+}
+
+/*++
+
 StreamFlush
 
     Flushes an I/O stream.
@@ -540,11 +581,59 @@ StreamCreateFile(
 }
 
 
+// Size of the encoding stream buffers, in bytes
+#define ENCODE_BUFFER 4096
+
 typedef struct {
-    encoding_t  readEnc;
-    encoding_t  writeEnc;
+    STREAM      *stream;        // Underlying stream
+    encoding_t  readEnc;        // Encoding of data read from the underlying stream
+    encoding_t  writeEnc;       // Encoding of data written to the underlying stream
+    apr_size_t  readStart;      // Offset of the unconverted data in the read buffer
+    apr_size_t  readEnd;        // Offset of the end of the data in the read buffer
+    apr_size_t  writeLength;    // Length of the data in the write buffer
+    apr_byte_t  readBuffer[ENCODE_BUFFER];
+    apr_byte_t  writeBuffer[ENCODE_BUFFER];
+    apr_byte_t  convBuffer[ENCODE_BUFFER];
 } ENCODE_STREAM;
 
+static
+apr_status_t
+EncodeDrain(
+    ENCODE_STREAM *encode
+    )
+{
+    apr_byte_t *out;
+    apr_status_t result;
+    apr_status_t status;
+    const apr_byte_t *in = encode->writeBuffer;
+
+    // Convert the write buffer, one conversion buffer at a time
+    do {
+        out = encode->convBuffer;
+        status = EncConvertBuffer(ENCODING_DEFAULT, &in, encode->writeBuffer + encode->writeLength,
+            encode->writeEnc, &out, encode->convBuffer + ENCODE_BUFFER);
+
+        if (out != encode->convBuffer) {
+            result = StreamWrite(encode->stream, encode->convBuffer, (apr_size_t)(out - encode->convBuffer), NULL);
+            if (result != APR_SUCCESS) {
+                status = result;
+                break;
+            }
+        }
+    } while (status == APR_ENOSPC);
+
+    if (status == APR_SUCCESS || status == APR_INCOMPLETE) {
+        // Keep a partial character, the next write completes it
+        encode->writeLength -= (apr_size_t)(in - encode->writeBuffer);
+        memmove(encode->writeBuffer, in, encode->writeLength);
+        status = APR_SUCCESS;
+    } else {
+        // Discard the data, so the stream remains usable
+        encode->writeLength = 0;
+    }
+    return status;
+}
+
 static
 apr_status_t
 EncodeRead(
@@ -554,10 +643,59 @@ EncodeRead(
     apr_size_t *bytesRead
     )
 {
+    apr_byte_t *out = buffer;
+    apr_size_t length;
+    apr_status_t status = APR_SUCCESS;
+    bool_t refill;
+    const apr_byte_t *in;
+    ENCODE_STREAM *encode = opaque;
+
     ASSERT(opaque != NULL);
     ASSERT(buffer != NULL);
 
-    return APR_SUCCESS;
+    refill = (encode->readStart == encode->readEnd);
+    while (out < buffer + bytesToRead) {
+        if (refill) {
+            // Move a partial character to the start of the buffer
+            length = encode->readEnd - encode->readStart;
+            memmove(encode->readBuffer, encode->readBuffer + encode->readStart, length);
+            encode->readStart = 0;
+            encode->readEnd   = length;
+
+            status = StreamRead(encode->stream, encode->readBuffer + encode->readEnd,
+                ENCODE_BUFFER - encode->readEnd, &length);
+            encode->readEnd += length;
+
+            if (length == 0) {
+                if (status == APR_SUCCESS) {
+                    status = APR_EOF;
+                }
+                break;
+            }
+        }
+
+        in = encode->readBuffer + encode->readStart;
+        status = EncConvertBuffer(encode->readEnc, &in, encode->readBuffer + encode->readEnd,
+            ENCODING_DEFAULT, &out, buffer + bytesToRead);
+        encode->readStart = (apr_size_t)(in - encode->readBuffer);
+
+        if (status != APR_SUCCESS && status != APR_INCOMPLETE) {
+            break;
+        }
+        refill = TRUE;
+    }
+
+    // Return the data read so far, errors are reported by the next call
+    if (out != buffer && (status == APR_ENOSPC || APR_STATUS_IS_EOF(status))) {
+        status = APR_SUCCESS;
+    } else if (status == APR_INCOMPLETE) {
+        status = APR_SUCCESS;
+    }
+
+    if (bytesRead != NULL) {
+        *bytesRead = (apr_size_t)(out - buffer);
+    }
+    return status;
 }
 
 static
@@ -569,10 +707,35 @@ EncodeWrite(
     apr_size_t *bytesWritten
     )
 {
+    apr_size_t length;
+    apr_size_t remaining = bytesToWrite;
+    apr_status_t status = APR_SUCCESS;
+    ENCODE_STREAM *encode = opaque;
+
     ASSERT(opaque != NULL);
     ASSERT(buffer != NULL);
 
-    return APR_SUCCESS;
+    // Data is only converted when the buffer fills up, or when flushed
+    while (remaining > 0) {
+        if (encode->writeLength == ENCODE_BUFFER) {
+            status = EncodeDrain(encode);
+            if (status != APR_SUCCESS) {
+                break;
+            }
+        }
+
+        length = MIN(remaining, ENCODE_BUFFER - encode->writeLength);
+        memcpy(encode->writeBuffer + encode->writeLength, buffer, length);
+        encode->writeLength += length;
+
+        buffer    += length;
+        remaining -= length;
+    }
+
+    if (bytesWritten != NULL) {
+        *bytesWritten = bytesToWrite - remaining;
+    }
+    return status;
 }
 
 static
@@ -581,9 +744,16 @@ EncodeFlush(
     void *opaque
     )
 {
+    apr_status_t status;
+    ENCODE_STREAM *encode = opaque;
+
     ASSERT(opaque != NULL);
 
-    return APR_SUCCESS;
+    status = EncodeDrain(encode);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    return StreamFlush(encode->stream);
 }
 
 static
@@ -592,11 +762,68 @@ EncodeClose(
     void *opaque
     )
 {
+    apr_status_t status;
+    ENCODE_STREAM *encode = opaque;
+
     ASSERT(opaque != NULL);
 
-    return APR_SUCCESS;
+    status = EncodeDrain(encode);
+    if (status == APR_SUCCESS && encode->writeLength != 0) {
+        // The data ended with a partial character
+        status = APR_EINVAL;
+    }
+
+    if (status == APR_SUCCESS) {
+        status = StreamClose(encode->stream);
+    } else {
+        StreamClose(encode->stream);
+    }
+    return status;
 }
 
+static
+bool_t
+EncodeSupported(
+    encoding_t inEnc,
+    encoding_t outEnc
+    )
+{
+    apr_byte_t buffer[1];
+    apr_byte_t *out = buffer;
+    const apr_byte_t *in = buffer;
+
+    // Converting nothing only fails when the conversion is not supported
+    return (EncConvertBuffer(inEnc, &in, in, outEnc, &out, out) == APR_SUCCESS) ? TRUE : FALSE;
+}
+
+/*++
+
+StreamCreateEncoding
+
+    Creates an encoding translation I/O stream.
+
+Arguments:
+    stream      - Pointer to the underlying stream. It is closed when the
+                  encoding stream is closed.
+
+    readEnc     - Encoding of the data read from the underlying stream.
+
+    writeEnc    - Encoding of the data written to the underlying stream.
+
+    pool        - Pointer to a memory pool.
+
+Return Values:
+    If the function succeeds, the return value is a pointer to a STREAM structure.
+
+    If the function fails, the return value is null.
+
+Remarks:
+    Data is read and written in the current encoding. Written data is
+    buffered and converted in batches, when the buffer is full or when the
+    stream is flushed or closed; an illegal sequence is reported by the call
+    that converts it.
+
+--*/
 STREAM *
 StreamCreateEncoding(
     STREAM *stream,
@@ -605,8 +832,26 @@ StreamCreateEncoding(
     apr_pool_t *pool
     )
 {
+    ENCODE_STREAM *encode;
+
     ASSERT(stream != NULL);
     ASSERT(pool != NULL);
 
-    return APR_SUCCESS;
+    if (!EncodeSupported(readEnc, ENCODING_DEFAULT) || !EncodeSupported(ENCODING_DEFAULT, writeEnc)) {
+        LOG_ERROR("Unsupported encoding stream, %s to %s.", EncGetName(readEnc), EncGetName(writeEnc));
+        return NULL;
+    }
+
+    encode = apr_palloc(pool, sizeof(ENCODE_STREAM));
+    if (encode == NULL) {
+        return NULL;
+    }
+    encode->stream      = stream;
+    encode->readEnc     = readEnc;
+    encode->writeEnc    = writeEnc;
+    encode->readStart   = 0;
+    encode->readEnd     = 0;
+    encode->writeLength = 0;
+
+    return StreamCreate(encode, EncodeRead, EncodeWrite, EncodeFlush, EncodeClose, pool);
 }
@@ -81,6 +81,13 @@ StreamPuts(
     const char *str
     );
 
+apr_status_t
+StreamPrintf(
+    STREAM *stream,
+    const char *format,
+    ...
+    );
+
 apr_status_t
 StreamFlush(
     STREAM *stream
@@ -53,6 +53,227 @@
 #define UNI_SUR_LOW_START       ((utf32_t)0xDC00)
 #define UNI_SUR_LOW_END         ((utf32_t)0xDFFF)
 
+/*
+ * Vector instructions used for the fast paths below. SSE2 is part of
+ * every x86-64 processor; AVX2 is only used when the compiler targets it.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define UNI_SSE2
+#   include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#   define UNI_AVX2
+#   include <immintrin.h>
+#endif
+
+/* ---------------------------------------------------------------------
+
+    Fast paths.
+
+    Each routine converts up to "count" characters from the start of the
+    source and returns how many it converted, stopping before the first
+    character it does not handle. Those characters, and all validation,
+    are left to the regular conversion loops; the fast paths only take
+    characters whose conversion can never fail or differ, so the result
+    of a conversion is the same with or without them.
+
+    Nearly all text written to the console and log files is ASCII, which
+    is represented identically in every form.
+
+    Defining UNI_NO_FAST_PATHS leaves only the regular conversion loops,
+    the converters as they were before the fast paths. The conversion test
+    and benchmark in the bench directory compare the two.
+
+------------------------------------------------------------------------ */
+
+static
+inline
+apr_size_t
+FastUTF8toUTF16(
+    const utf8_t *source,
+    utf16_t *target,
+    apr_size_t count
+    )
+{
+    apr_size_t i = 0;
+#ifdef UNI_AVX2
+    for (; i + 32 <= count; i += 32) {
+        __m256i chars = _mm256_loadu_si256((const __m256i *)(source + i));
+        if (_mm256_movemask_epi8(chars) != 0) {
+            break;
+        }
+        _mm256_storeu_si256((__m256i *)(target + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chars)));
+        _mm256_storeu_si256((__m256i *)(target + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chars, 1)));
+    }
+#endif
+#ifdef UNI_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)(source + i));
+        if (_mm_movemask_epi8(chars) != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(target + i), _mm_unpacklo_epi8(chars, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(target + i + 8), _mm_unpackhi_epi8(chars, _mm_setzero_si128()));
+    }
+#endif
+    for (; i < count && source[i] < 0x80; i++) {
+        target[i] = source[i];
+    }
+    return i;
+}
+
+static
+inline
+apr_size_t
+FastUTF8toUTF32(
+    const utf8_t *source,
+    utf32_t *target,
+    apr_size_t count
+    )
+{
+    apr_size_t i = 0;
+#ifdef UNI_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i low, high;
+        if (_mm_movemask_epi8(chars) != 0) {
+            break;
+        }
+        low  = _mm_unpacklo_epi8(chars, _mm_setzero_si128());
+        high = _mm_unpackhi_epi8(chars, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(target + i),      _mm_unpacklo_epi16(low, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(target + i + 4),  _mm_unpackhi_epi16(low, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(target + i + 8),  _mm_unpacklo_epi16(high, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(target + i + 12), _mm_unpackhi_epi16(high, _mm_setzero_si128()));
+    }
+#endif
+    for (; i < count && source[i] < 0x80; i++) {
+        target[i] = source[i];
+    }
+    return i;
+}
+
+static
+inline
+apr_size_t
+FastUTF16toUTF8(
+    const utf16_t *source,
+    utf8_t *target,
+    apr_size_t count
+    )
+{
+    apr_size_t i = 0;
+#ifdef UNI_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i low  = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i high = _mm_loadu_si128((const __m128i *)(source + i + 8));
+        __m128i over = _mm_and_si128(_mm_or_si128(low, high), _mm_set1_epi16((short)0xFF80));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(over, _mm_setzero_si128())) != 0xFFFF) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(target + i), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; i < count && source[i] < 0x80; i++) {
+        target[i] = (utf8_t)source[i];
+    }
+    return i;
+}
+
+static
+inline
+apr_size_t
+FastUTF32toUTF8(
+    const utf32_t *source,
+    utf8_t *target,
+    apr_size_t count
+    )
+{
+    apr_size_t i = 0;
+#ifdef UNI_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(source + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(source + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *)(source + i + 12));
+        __m128i over = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        over = _mm_and_si128(over, _mm_set1_epi32((int)0xFFFFFF80));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(over, _mm_setzero_si128())) != 0xFFFF) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(target + i),
+            _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+#endif
+    for (; i < count && source[i] < 0x80; i++) {
+        target[i] = (utf8_t)source[i];
+    }
+    return i;
+}
+
+/*
+ * UTF-16 to UTF-32 also takes every character outside of the surrogate
+ * range, since those are converted as-is.
+ */
+static
+inline
+apr_size_t
+FastUTF16toUTF32(
+    const utf16_t *source,
+    utf32_t *target,
+    apr_size_t count
+    )
+{
+    apr_size_t i = 0;
+#ifdef UNI_SSE2
+    for (; i + 8 <= count; i += 8) {
+        __m128i units = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i surrogates = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xF800)),
+            _mm_set1_epi16((short)0xD800));
+        if (_mm_movemask_epi8(surrogates) != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(target + i),     _mm_unpacklo_epi16(units, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i *)(target + i + 4), _mm_unpackhi_epi16(units, _mm_setzero_si128()));
+    }
+#endif
+    for (; i < count && (source[i] & 0xF800) != 0xD800; i++) {
+        target[i] = source[i];
+    }
+    return i;
+}
+
+/* --------------------------------------------------------------------- */
+
+/*
+ * Exported function to return the number of ASCII characters at the
+ * start of a buffer.
+ */
+apr_size_t
+CountASCII(
+    const utf8_t *source,
+    const utf8_t *sourceEnd
+    )
+{
+    apr_size_t count = (apr_size_t)(sourceEnd - source);
+    apr_size_t i = 0;
+#ifdef UNI_SSE2
+    for (; i + 16 <= count; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(source + i)));
+        if (mask != 0) {
+            /* Skip to the first non-ASCII character in this block. */
+            while (!(mask & 1)) {
+                mask >>= 1;
+                i++;
+            }
+            return i;
+        }
+    }
+#endif
+    for (; i < count && source[i] < 0x80; i++);
+    return i;
+}
+
 /* --------------------------------------------------------------------- */
 
 CONVERSION_RESULT
@@ -126,8 +347,17 @@ ConvertUTF16toUTF32(
     const utf16_t *source = *sourceStart;
     utf32_t *target = *targetStart;
     utf32_t ch, ch2;
+    apr_size_t count;
     while (source < sourceEnd) {
         const utf16_t *oldSource = source; /*  In case we have to back up because of target overflow. */
+#ifndef UNI_NO_FAST_PATHS
+        if (target < targetEnd && (*source & 0xF800) != 0xD800) {
+            count = FastUTF16toUTF32(source, target, MIN(sourceEnd - source, targetEnd - target));
+            source += count;
+            target += count;
+            continue;
+        }
+#endif
         ch = *source++;
         /* If we have a surrogate pair, convert to UTF32 first. */
         if (ch >= UNI_SUR_HIGH_START && ch <= UNI_SUR_HIGH_END) {
@@ -235,12 +465,21 @@ ConvertUTF16toUTF8(
     CONVERSION_RESULT result = conversionOK;
     const utf16_t *source = *sourceStart;
     utf8_t *target = *targetStart;
+    apr_size_t count;
     while (source < sourceEnd) {
         utf32_t ch;
         unsigned short bytesToWrite = 0;
         const utf32_t byteMask = 0xBF;
         const utf32_t byteMark = 0x80;
         const utf16_t *oldSource = source; /* In case we have to back up because of target overflow. */
+#ifndef UNI_NO_FAST_PATHS
+        if (*source < 0x80 && target < targetEnd) {
+            count = FastUTF16toUTF8(source, target, MIN(sourceEnd - source, targetEnd - target));
+            source += count;
+            target += count;
+            continue;
+        }
+#endif
         ch = *source++;
         /* If we have a surrogate pair, convert to UTF32 first. */
         if (ch >= UNI_SUR_HIGH_START && ch <= UNI_SUR_HIGH_END) {
@@ -425,9 +664,19 @@ ConvertUTF8toUTF16(
     CONVERSION_RESULT result = conversionOK;
     const utf8_t *source = *sourceStart;
     utf16_t *target = *targetStart;
+    apr_size_t count;
     while (source < sourceEnd) {
         utf32_t ch = 0;
-        unsigned short extraBytesToRead = trailingBytesForUTF8[*source];
+        unsigned short extraBytesToRead;
+#ifndef UNI_NO_FAST_PATHS
+        if (*source < 0x80 && target < targetEnd) {
+            count = FastUTF8toUTF16(source, target, MIN(sourceEnd - source, targetEnd - target));
+            source += count;
+            target += count;
+            continue;
+        }
+#endif
+        extraBytesToRead = trailingBytesForUTF8[*source];
         if (source + extraBytesToRead >= sourceEnd) {
             result = sourceExhausted;
             break;
@@ -519,11 +768,20 @@ ConvertUTF32toUTF8(
     CONVERSION_RESULT result = conversionOK;
     const utf32_t *source = *sourceStart;
     utf8_t *target = *targetStart;
+    apr_size_t count;
     while (source < sourceEnd) {
         utf32_t ch;
         unsigned short bytesToWrite = 0;
         const utf32_t byteMask = 0xBF;
         const utf32_t byteMark = 0x80;
+#ifndef UNI_NO_FAST_PATHS
+        if (*source < 0x80 && target < targetEnd) {
+            count = FastUTF32toUTF8(source, target, MIN(sourceEnd - source, targetEnd - target));
+            source += count;
+            target += count;
+            continue;
+        }
+#endif
         ch = *source++;
         if (flags == strictConversion) {
             /* UTF-16 surrogate values are illegal in UTF-32 */
@@ -593,9 +851,19 @@ ConvertUTF8toUTF32(
     CONVERSION_RESULT result = conversionOK;
     const utf8_t *source = *sourceStart;
     utf32_t *target = *targetStart;
+    apr_size_t count;
     while (source < sourceEnd) {
         utf32_t ch = 0;
-        unsigned short extraBytesToRead = trailingBytesForUTF8[*source];
+        unsigned short extraBytesToRead;
+#ifndef UNI_NO_FAST_PATHS
+        if (*source < 0x80 && target < targetEnd) {
+            count = FastUTF8toUTF32(source, target, MIN(sourceEnd - source, targetEnd - target));
+            source += count;
+            target += count;
+            continue;
+        }
+#endif
+        extraBytesToRead = trailingBytesForUTF8[*source];
         if (source + extraBytesToRead >= sourceEnd) {
             result = sourceExhausted;
             break;
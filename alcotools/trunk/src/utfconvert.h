@@ -151,4 +151,10 @@ IsLegalUTF8Sequence(
     const utf8_t *sourceEnd
     );
 
+apr_size_t
+CountASCII(
+    const utf8_t *source,
+    const utf8_t *sourceEnd
+    );
+
 /* --------------------------------------------------------------------- */
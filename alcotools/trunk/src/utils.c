@@ -100,7 +100,7 @@ Return Values:
     must not be modified.
 
 Remarks:
-    This function is not thread-safe.
+    Each thread has its own buffer, which is overwritten by the next call.
 
 --*/
 const char *
@@ -108,7 +108,7 @@ GetErrorMessage(
     apr_status_t status
     )
 {
-    static char message[512]; // THREADING: Static variable not thread-safe.
+    static THREAD_LOCAL char message[512];
     return apr_strerror(status, message, ARRAYSIZE(message));
 }
 
@@ -396,6 +396,20 @@ proc ::nxAutoNuke::CheckMP3 {options realPath} {
             set found 1; break
         }
     }
+
+    # Not every zipscript tag includes the bitrate, so read whatever the tag
+    # does not provide from the MP3 files of a completed release.
+    if {[IsTrue $anuke(MP3Scan)] && (!$found || ![string is double -strict $bitrate] || $bitrate <= 0) &&
+            ![CheckInc $realPath] && [ScanMP3 $realPath mp3]} {
+        if {![string is double -strict $bitrate] || $bitrate <= 0} {
+            set bitrate $mp3(bitrate)
+        }
+        if {!$found} {
+            set genre $mp3(genre)
+            set year $mp3(year)
+            set found 1
+        }
+    }
     if {!$found} {return 0}
 
     foreach {type value} $options {
@@ -505,6 +519,25 @@ proc ::nxAutoNuke::FindTags {realPath {tagTemplate "*"}} {
     return [glob -nocomplain -types d -directory $realPath -- $tagTemplate]
 }
 
+proc ::nxAutoNuke::ScanMP3 {realPath varName} {
+    upvar $varName mp3
+    if {[catch {::nx::mp3 -scan $realPath} fileList] || ![llength $fileList]} {return 0}
+
+    # Read all MP3 files in one call, the bitrate is averaged over the files
+    # and the genre and year are taken from the first tagged file.
+    set mp3(bitrate) 0; set mp3(genre) ""; set mp3(year) ""
+    set total 0; set count 0
+    foreach {fileName fields} $fileList {
+        array set info $fields
+        incr total $info(bitrate); incr count
+
+        if {$mp3(genre) eq "" && $info(genre) ne "unknown"} {set mp3(genre) $info(genre)}
+        if {$mp3(year) eq "" && $info(year) > 0} {set mp3(year) $info(year)}
+    }
+    set mp3(bitrate) [expr {$total / $count}]
+    return 1
+}
+
 proc ::nxAutoNuke::SplitOptions {type options} {
     set result [list]
     foreach entry $options {
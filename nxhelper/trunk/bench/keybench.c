@@ -0,0 +1,248 @@
+/*
+ * nxHelper - Tcl extension for nxTools.
+ * Copyright (c) 2004-2008 neoxed
+ *
+ * File Name:
+ *   keybench.c
+ *
+ * Abstract:
+ *   Measures contention on the "::nx::key" command. Each thread creates its
+ *   own interpreter, as the ftpd's threads do, and calls the command as fast
+ *   as it can on randomly chosen keys. The "keybench-1" build uses a single
+ *   shard, for comparison with one mutex for all keys.
+ *
+ *   Workloads:
+ *     incr  - Every call increments a counter; the counters' sum is checked.
+ *     get   - Every call reads a key.
+ *     mixed - 80% reads, 15% writes, and 5% increments.
+ *
+ *   Usage:
+ *     keybench [-w workload] [-t threads] [-n calls] [-k keys]
+ */
+
+#include <nxHelper.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+    WORKLOAD_INCR = 0,
+    WORKLOAD_GET,
+    WORKLOAD_MIXED
+} Workload;
+
+typedef struct {
+    int index;              /* Thread index. */
+    int calls;              /* Calls to make. */
+    long increments;        /* Increments made. */
+} BenchThread;
+
+static int keyCount = 1000;
+static Workload workload = WORKLOAD_INCR;
+static const char *workloadNames[] = {"incr", "get", "mixed", NULL};
+
+
+static double
+TimeNow(
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static Tcl_Interp *
+CreateInterp(
+    void
+    )
+{
+    Tcl_Interp *interp = Tcl_CreateInterp();
+
+    Tcl_CreateObjCommand(interp, "::nx::key", KeyObjCmd, NULL, NULL);
+    return interp;
+}
+
+static void *
+BenchThreadProc(
+    void *arg
+    )
+{
+    BenchThread *thread = arg;
+    char name[32];
+    int i;
+    int key;
+    int roll;
+    unsigned int seed;
+    Tcl_Interp *interp;
+    Tcl_Obj **names;
+    Tcl_Obj *getObj;
+    Tcl_Obj *incrObj;
+    Tcl_Obj *objv[4];
+    Tcl_Obj *setObj;
+
+    interp = CreateInterp();
+
+    /* Key names are created once, as a script would keep them in variables. */
+    names = (Tcl_Obj **)ckalloc(keyCount * sizeof(Tcl_Obj *));
+    for (i = 0; i < keyCount; i++) {
+        snprintf(name, sizeof(name), "counter%d", i);
+        names[i] = Tcl_NewStringObj(name, -1);
+        Tcl_IncrRefCount(names[i]);
+    }
+
+    /* Arguments keep their internal representation between calls. */
+    objv[0] = Tcl_NewStringObj("::nx::key", -1);
+    objv[3] = Tcl_NewStringObj("0", -1);
+    getObj  = Tcl_NewStringObj("get", -1);
+    incrObj = Tcl_NewStringObj("incr", -1);
+    setObj  = Tcl_NewStringObj("set", -1);
+    Tcl_IncrRefCount(objv[0]);
+    Tcl_IncrRefCount(objv[3]);
+    Tcl_IncrRefCount(getObj);
+    Tcl_IncrRefCount(incrObj);
+    Tcl_IncrRefCount(setObj);
+
+    seed = 2463534242U + thread->index;
+    for (i = 0; i < thread->calls; i++) {
+        /* Xorshift, the C library's rand() takes a lock. */
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        key  = (int)(seed % (unsigned int)keyCount);
+        roll = (int)((seed >> 8) % 100);
+
+        objv[2] = names[key];
+        if (workload == WORKLOAD_INCR || (workload == WORKLOAD_MIXED && roll >= 95)) {
+            objv[1] = incrObj;
+            Tcl_EvalObjv(interp, 3, objv, 0);
+            thread->increments++;
+        } else if (workload == WORKLOAD_MIXED && roll >= 80) {
+            objv[1] = setObj;
+            Tcl_EvalObjv(interp, 4, objv, 0);
+        } else {
+            objv[1] = getObj;
+            Tcl_EvalObjv(interp, 3, objv, 0);
+        }
+    }
+
+    for (i = 0; i < keyCount; i++) {
+        Tcl_DecrRefCount(names[i]);
+    }
+    ckfree((char *)names);
+    Tcl_DecrRefCount(objv[0]);
+    Tcl_DecrRefCount(objv[3]);
+    Tcl_DecrRefCount(getObj);
+    Tcl_DecrRefCount(incrObj);
+    Tcl_DecrRefCount(setObj);
+
+    Tcl_DeleteInterp(interp);
+    Tcl_FinalizeThread();
+    return NULL;
+}
+
+static void
+Usage(
+    const char *argv0
+    )
+{
+    printf("Usage: %s [-w incr|get|mixed] [-t threads] [-n calls] [-k keys]\n", argv0);
+}
+
+int
+main(
+    int argc,
+    char **argv
+    )
+{
+    BenchThread *threads;
+    char script[64];
+    double elapsed;
+    double start;
+    int calls = 200000;
+    int i;
+    int opt;
+    int threadCount = 8;
+    long increments = 0;
+    pthread_t *handles;
+    Tcl_Interp *interp;
+    Tcl_WideInt sum = 0;
+    Tcl_WideInt value;
+
+    while ((opt = getopt(argc, argv, "w:t:n:k:")) != -1) {
+        switch (opt) {
+            case 'w':
+                for (i = 0; workloadNames[i] != NULL && strcmp(optarg, workloadNames[i]) != 0; i++);
+                if (workloadNames[i] == NULL) {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                workload = (Workload)i;
+                break;
+            case 't': threadCount = atoi(optarg); break;
+            case 'n': calls       = atoi(optarg); break;
+            case 'k': keyCount    = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (threadCount <= 0 || calls <= 0 || keyCount <= 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    Tcl_FindExecutable(argv[0]);
+    KeyInit();
+
+    /* Every key exists before the threads start. */
+    interp = CreateInterp();
+    for (i = 0; i < keyCount; i++) {
+        snprintf(script, sizeof(script), "::nx::key set counter%d 0", i);
+        Tcl_Eval(interp, script);
+    }
+
+    printf("Workload: %s, %d threads, %d calls each, %d keys\n\n",
+        workloadNames[workload], threadCount, calls, keyCount);
+
+    threads = (BenchThread *)calloc(threadCount, sizeof(BenchThread));
+    handles = (pthread_t *)calloc(threadCount, sizeof(pthread_t));
+
+    start = TimeNow();
+    for (i = 0; i < threadCount; i++) {
+        threads[i].index = i;
+        threads[i].calls = calls;
+        pthread_create(&handles[i], NULL, BenchThreadProc, &threads[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(handles[i], NULL);
+        increments += threads[i].increments;
+    }
+    elapsed = TimeNow() - start;
+
+    printf("Elapsed:  %9.1f ms  %10.0f calls/s  %6.0f ns/call per thread\n",
+        elapsed * 1000.0, ((double)calls * threadCount) / elapsed,
+        (elapsed * 1e9) / calls);
+
+    /* Increments are atomic, so none may be lost. */
+    for (i = 0; i < keyCount; i++) {
+        snprintf(script, sizeof(script), "::nx::key get counter%d", i);
+        if (Tcl_Eval(interp, script) == TCL_OK &&
+                Tcl_GetWideIntFromObj(NULL, Tcl_GetObjResult(interp), &value) == TCL_OK) {
+            sum += value;
+        }
+    }
+    Tcl_DeleteInterp(interp);
+    KeyFinalize();
+
+    if (workload != WORKLOAD_INCR) {
+        return 0;
+    }
+    printf("Counters: %ld increments, sum %" TCL_LL_MODIFIER "d\n", increments, sum);
+    if (sum != increments) {
+        fprintf(stderr, "Lost %ld increments.\n", increments - (long)sum);
+        return 1;
+    }
+    return 0;
+}
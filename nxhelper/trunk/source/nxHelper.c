@@ -15,12 +15,15 @@
 #include <nxHelper.h>
 
 /* Initialise global variables */
+#ifdef _WIN32
 Fn_GetDiskFreeSpaceEx getDiskFreeSpaceExPtr = NULL;
-Tcl_HashTable *keyTable = NULL;
+#endif /* _WIN32 */
 
 /* Local variables */
-static BOOL initialised = FALSE;
+static int initialised = 0;
+#ifdef _WIN32
 static HMODULE kernelModule;
+#endif /* _WIN32 */
 static Tcl_Mutex initMutex;
 
 EXTERN Tcl_PackageInitProc Nxhelper_Init;
@@ -32,6 +35,7 @@ ExitHandler(
     );
 
 
+#ifdef _WIN32
 /*
  * DllMain
  *
@@ -54,6 +58,7 @@ DllMain(
 {
     return TRUE;
 }
+#endif /* _WIN32 */
 
 
 /*
@@ -90,6 +95,7 @@ Nxhelper_Init(
 
         /* Check initialisation status again now that we're in the mutex. */
         if (!initialised) {
+#ifdef _WIN32
             /* Initialise the OS version structure. */
             osVersion.dwOSVersionInfoSize = sizeof(OSVERSIONINFO);
             GetVersionEx(&osVersion);
@@ -115,35 +121,28 @@ Nxhelper_Init(
              * asking the user to insert one.
              */
             SetErrorMode(SetErrorMode(0) | SEM_FAILCRITICALERRORS);
+#endif /* _WIN32 */
+
+            /* Create the hash tables used for the "::nx::key" command. */
+            KeyInit();
 
             /* An exit handler should be registered once. */
             Tcl_CreateExitHandler(ExitHandler, NULL);
 
-            initialised = TRUE;
+            initialised = 1;
         }
         Tcl_MutexUnlock(&initMutex);
     }
 
-    /* Create the hash table used for the "::nx::key" command. */
-    if (keyTable == NULL) {
-        Tcl_MutexLock(&keyMutex);
-
-        /* Check again now that we're in the mutex. */
-        if (keyTable == NULL) {
-            keyTable = (Tcl_HashTable *)ckalloc(sizeof(Tcl_HashTable));
-            Tcl_InitHashTable(keyTable, TCL_STRING_KEYS);
-        }
-
-        Tcl_MutexUnlock(&keyMutex);
-    }
-
     Tcl_CreateObjCommand(interp, "::nx::base64", Base64ObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::nx::key",    KeyObjCmd,    NULL, NULL);
     Tcl_CreateObjCommand(interp, "::nx::mp3",    Mp3ObjCmd,    NULL, NULL);
+#ifdef _WIN32
     Tcl_CreateObjCommand(interp, "::nx::sleep",  SleepObjCmd,  NULL, NULL);
     Tcl_CreateObjCommand(interp, "::nx::time",   TimeObjCmd,   NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::nx::touch",  TouchObjCmd,  NULL, NULL);
     Tcl_CreateObjCommand(interp, "::nx::volume", VolumeObjCmd, NULL, NULL);
+#endif /* _WIN32 */
+    Tcl_CreateObjCommand(interp, "::nx::touch",  TouchObjCmd,  NULL, NULL);
     Tcl_CreateObjCommand(interp, "::nx::zlib",   ZlibObjCmd,   NULL, NULL);
 
     return TCL_OK;
@@ -186,27 +185,21 @@ ExitHandler(
 {
     /* Init clean-up. */
     Tcl_MutexLock(&initMutex);
+#ifdef _WIN32
     if (kernelModule != NULL) {
         FreeLibrary(kernelModule);
         kernelModule = NULL;
     }
 
     getDiskFreeSpaceExPtr = NULL;
-    initialised = FALSE;
-    Tcl_MutexUnlock(&initMutex);
-    Tcl_MutexFinalize(&initMutex);
+#endif /* _WIN32 */
 
     /* Key clean-up. */
-    Tcl_MutexLock(&keyMutex);
-    if (keyTable != NULL) {
-        KeyClearTable();
-        Tcl_DeleteHashTable(keyTable);
+    KeyFinalize();
 
-        ckfree((char *)keyTable);
-        keyTable = NULL;
-    }
-    Tcl_MutexUnlock(&keyMutex);
-    Tcl_MutexFinalize(&keyMutex);
+    initialised = 0;
+    Tcl_MutexUnlock(&initMutex);
+    Tcl_MutexFinalize(&initMutex);
 
 #ifdef TCL_MEM_DEBUG
     Tcl_DumpActiveMemory("MemDump.txt");
@@ -15,12 +15,15 @@
 #ifndef _NXHELPER_H_
 #define _NXHELPER_H_
 
+#ifdef _WIN32
 #define UNICODE
 #define _UNICODE
+#endif /* _WIN32 */
 
 /*
  * System includes
  */
+#ifdef _WIN32
 #define STRSAFE_LIB
 #define STRSAFE_NO_CB_FUNCTIONS
 #define _WIN32_WINNT 0x0400
@@ -30,6 +33,12 @@
 #include <windows.h>
 #include <shlwapi.h>
 #include <strsafe.h>
+#else /* _WIN32 */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif /* _WIN32 */
 
 /*
  * Library includes
@@ -53,19 +62,21 @@
 Tcl_ObjCmdProc Base64ObjCmd;
 Tcl_ObjCmdProc KeyObjCmd;
 Tcl_ObjCmdProc Mp3ObjCmd;
+Tcl_ObjCmdProc TouchObjCmd;
+Tcl_ObjCmdProc ZlibObjCmd;
+#ifdef _WIN32
 Tcl_ObjCmdProc SleepObjCmd;
 Tcl_ObjCmdProc TimeObjCmd;
-Tcl_ObjCmdProc TouchObjCmd;
 Tcl_ObjCmdProc VolumeObjCmd;
-Tcl_ObjCmdProc ZlibObjCmd;
+#endif /* _WIN32 */
 
 /*
  * Key globals
  */
-Tcl_Mutex keyMutex;
-Tcl_HashTable *keyTable;
-void KeyClearTable(void);
+void KeyInit(void);
+void KeyFinalize(void);
 
+#ifdef _WIN32
 /*
  * Volume globals
  */
@@ -78,5 +89,6 @@ typedef BOOL (WINAPI *Fn_GetDiskFreeSpaceEx)(
 
 Fn_GetDiskFreeSpaceEx getDiskFreeSpaceExPtr;
 OSVERSIONINFO osVersion;
+#endif /* _WIN32 */
 
 #endif /* _NXHELPER_H_ */
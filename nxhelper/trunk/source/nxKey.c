@@ -11,22 +11,295 @@
  * Abstract:
  *   Implements key functions, to share data between interpreters.
  *
+ *   Keys are spread over several hash tables (shards), each with its own
+ *   mutex, so interpreters using different keys rarely wait on each other.
+ *   Counters are kept as wide integers, an increment never converts the
+ *   value to a string and back.
+ *
  *   Tcl Commands:
+ *     ::nx::key append [-ttl <seconds>] <name> <value>
+ *       - Appends to the key's value and returns its new length, in bytes.
+ *       - A new key expires after the given seconds.
+ *
  *     ::nx::key exists <name>
  *     ::nx::key get    <name>
+ *
+ *     ::nx::key incr   [-ttl <seconds>] <name> [increment]
+ *       - Adds to the key's integer value and returns the result. A missing
+ *         key is created with the value zero first.
+ *       - A new key expires after the given seconds.
+ *
  *     ::nx::key list
- *     ::nx::key set    <name> <value>
+ *
+ *     ::nx::key set    [-ttl <seconds>] <name> <value>
+ *       - The key expires after the given seconds, or never by default.
+ *
  *     ::nx::key unset  [-nocomplain] <name>
  */
 
 #include <nxHelper.h>
 
+/* Number of shards, must be a power of two. */
+#ifndef KEY_SHARDS
+#define KEY_SHARDS 16
+#endif
+
+#if (KEY_SHARDS & (KEY_SHARDS - 1)) != 0
+#error "KEY_SHARDS must be a power of two."
+#endif
+
+typedef enum {
+    KEY_TYPE_STRING = 0,    /* Value is a string. */
+    KEY_TYPE_WIDE           /* Value is a wide integer. */
+} KeyType;
+
 typedef struct {
-    int length;             /* Length of data, in bytes. */
-    unsigned char *data;    /* Value, do NOT free this member. */
+    KeyType type;           /* Type of value. */
+    int length;             /* Length of the string, in bytes. */
+    int size;               /* Size of the string buffer, in bytes. */
+    Tcl_WideInt wide;       /* Value, for wide integers. */
+    Tcl_WideInt expires;    /* Expiry time in milliseconds, zero if the key never expires. */
+    char *data;             /* Value, for strings; do NOT free this member. */
 } KeyValue;
 
-
+typedef struct {
+    Tcl_Mutex mutex;        /* Mutex protecting the shard's table. */
+    Tcl_HashTable table;    /* Keys in this shard. */
+} KeyShard;
+
+static KeyShard keyShards[KEY_SHARDS];
+
+
+/*
+ * KeyGetShard
+ *
+ *   Retrieves the shard for a key, using the FNV-1a hash of its name.
+ *
+ * Arguments:
+ *   name - Name of the key.
+ *
+ * Returns:
+ *   The key's shard.
+ */
+static KeyShard *
+KeyGetShard(
+    const char *name
+    )
+{
+    unsigned int hash = 2166136261U;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619U;
+    }
+    return &keyShards[hash & (KEY_SHARDS - 1)];
+}
+
+/*
+ * KeyGetTime
+ *
+ *   Retrieves the current time.
+ *
+ * Arguments:
+ *   None.
+ *
+ * Returns:
+ *   The time in milliseconds.
+ */
+static Tcl_WideInt
+KeyGetTime(
+    void
+    )
+{
+    Tcl_Time now;
+
+    Tcl_GetTime(&now);
+    return ((Tcl_WideInt)now.sec * 1000) + (now.usec / 1000);
+}
+
+/*
+ * KeyFind
+ *
+ *   Looks up a key, deleting it if it has expired. The shard's mutex
+ *   must be held by the caller.
+ *
+ * Arguments:
+ *   shard - Shard the key is in.
+ *   name  - Name of the key.
+ *
+ * Returns:
+ *   The key's hash table entry, or NULL if it does not exist.
+ */
+static Tcl_HashEntry *
+KeyFind(
+    KeyShard *shard,
+    const char *name
+    )
+{
+    KeyValue *value;
+    Tcl_HashEntry *hashEntry;
+
+    hashEntry = Tcl_FindHashEntry(&shard->table, name);
+    if (hashEntry != NULL) {
+        value = (KeyValue *)Tcl_GetHashValue(hashEntry);
+
+        if (value->expires != 0 && value->expires <= KeyGetTime()) {
+            ckfree((char *)value);
+            Tcl_DeleteHashEntry(hashEntry);
+            hashEntry = NULL;
+        }
+    }
+    return hashEntry;
+}
+
+/*
+ * KeyResize
+ *
+ *   Allocates or grows a value structure, its string buffer is allocated
+ *   with the structure.
+ *
+ * Arguments:
+ *   value  - Value structure to grow, NULL to allocate a new one.
+ *   size   - Minimum size of the string buffer, in bytes.
+ *
+ * Returns:
+ *   The new value structure; the old one must not be used.
+ */
+static KeyValue *
+KeyResize(
+    KeyValue *value,
+    int size
+    )
+{
+    if (value == NULL) {
+        value = (KeyValue *)ckalloc(sizeof(KeyValue) + size);
+        value->type    = KEY_TYPE_STRING;
+        value->length  = 0;
+        value->wide    = 0;
+        value->expires = 0;
+    } else {
+        /* Appending to a key doubles its buffer, like a Tcl_DString. */
+        if (size < value->size * 2) {
+            size = value->size * 2;
+        }
+        value = (KeyValue *)ckrealloc((char *)value, sizeof(KeyValue) + size);
+    }
+    value->data = (char *)&value[1];
+    value->size = size;
+    return value;
+}
+
+/*
+ * KeyParseTtl
+ *
+ *   Parses the "-ttl <seconds>" switch.
+ *
+ * Arguments:
+ *   interp  - Current interpreter.
+ *   objc    - Number of arguments.
+ *   objv    - Argument objects.
+ *   index   - Receives the index of the first argument after the switch.
+ *   expires - Receives the expiry time in milliseconds, zero if not given.
+ *
+ * Returns:
+ *   A standard Tcl result.
+ */
+static int
+KeyParseTtl(
+    Tcl_Interp *interp,
+    int objc,
+    Tcl_Obj *CONST objv[],
+    int *index,
+    Tcl_WideInt *expires
+    )
+{
+    int seconds;
+
+    *index = 2;
+    *expires = 0;
+
+    if (objc > 4 && TclSwitchCompare(objv[2], "-ttl")) {
+        if (Tcl_GetIntFromObj(interp, objv[3], &seconds) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (seconds <= 0) {
+            Tcl_AppendResult(interp, "expected a positive number of seconds but got \"",
+                Tcl_GetString(objv[3]), "\"", NULL);
+            return TCL_ERROR;
+        }
+        *index = 4;
+        *expires = KeyGetTime() + ((Tcl_WideInt)seconds * 1000);
+    }
+    return TCL_OK;
+}
+
+
+/* ::nx::key append [-ttl <seconds>] <name> <value> */
+static int
+KeyAppend(
+    Tcl_Interp *interp,
+    int objc,
+    Tcl_Obj *CONST objv[]
+    )
+{
+    char *data;
+    char *name;
+    char wideString[TCL_INTEGER_SPACE * 2];
+    int dataLength;
+    int index;
+    int newEntry;
+    int wideLength;
+    KeyShard *shard;
+    KeyValue *value;
+    Tcl_HashEntry *hashEntry;
+    Tcl_WideInt expires;
+
+    if (KeyParseTtl(interp, objc, objv, &index, &expires) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc != index + 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-ttl seconds? name value");
+        return TCL_ERROR;
+    }
+    name = Tcl_GetString(objv[index]);
+    data = Tcl_GetStringFromObj(objv[index+1], &dataLength);
+    shard = KeyGetShard(name);
+
+    Tcl_MutexLock(&shard->mutex);
+    hashEntry = KeyFind(shard, name);
+
+    if (hashEntry == NULL) {
+        hashEntry = Tcl_CreateHashEntry(&shard->table, name, &newEntry);
+        value = KeyResize(NULL, dataLength);
+        value->expires = expires;
+    } else {
+        value = (KeyValue *)Tcl_GetHashValue(hashEntry);
+
+        /* Counters are converted to a string before appending. */
+        if (value->type == KEY_TYPE_WIDE) {
+            wideLength = sprintf(wideString, "%" TCL_LL_MODIFIER "d", value->wide);
+            if (value->size < wideLength) {
+                value = KeyResize(value, wideLength);
+            }
+            memcpy(value->data, wideString, wideLength);
+            value->type = KEY_TYPE_STRING;
+            value->length = wideLength;
+        }
+        if (value->size - value->length < dataLength) {
+            value = KeyResize(value, value->length + dataLength);
+        }
+    }
+
+    memcpy(value->data + value->length, data, dataLength);
+    value->length += dataLength;
+    Tcl_SetHashValue(hashEntry, (ClientData)value);
+
+    Tcl_SetIntObj(Tcl_GetObjResult(interp), value->length);
+    Tcl_MutexUnlock(&shard->mutex);
+
+    return TCL_OK;
+}
+
 /* ::nx::key exists <name> */
 static int
 KeyExists(
@@ -36,6 +309,7 @@ KeyExists(
     )
 {
     char *name;
+    KeyShard *shard;
     Tcl_HashEntry *hashEntry;
     Tcl_Obj *resultObj;
 
@@ -45,11 +319,12 @@ KeyExists(
     }
     name = Tcl_GetString(objv[2]);
     resultObj = Tcl_GetObjResult(interp);
+    shard = KeyGetShard(name);
 
     /* Look-up the key's hash table entry. */
-    Tcl_MutexLock(&keyMutex);
-    hashEntry = Tcl_FindHashEntry(keyTable, name);
-    Tcl_MutexUnlock(&keyMutex);
+    Tcl_MutexLock(&shard->mutex);
+    hashEntry = KeyFind(shard, name);
+    Tcl_MutexUnlock(&shard->mutex);
 
     Tcl_SetBooleanObj(resultObj, (hashEntry != NULL) ? 1 : 0);
     return TCL_OK;
@@ -64,6 +339,7 @@ KeyGet(
     )
 {
     char *name;
+    KeyShard *shard;
     KeyValue *value;
     Tcl_HashEntry *hashEntry;
     Tcl_Obj *resultObj;
@@ -74,17 +350,22 @@ KeyGet(
     }
     name = Tcl_GetString(objv[2]);
     resultObj = Tcl_GetObjResult(interp);
+    shard = KeyGetShard(name);
 
     /* Look-up the key's hash table entry. */
-    Tcl_MutexLock(&keyMutex);
-    hashEntry = Tcl_FindHashEntry(keyTable, name);
+    Tcl_MutexLock(&shard->mutex);
+    hashEntry = KeyFind(shard, name);
 
     if (hashEntry != NULL) {
         /* Copy value to the result object. */
         value = (KeyValue *)Tcl_GetHashValue(hashEntry);
-        Tcl_SetByteArrayObj(resultObj, value->data, value->length);
+        if (value->type == KEY_TYPE_WIDE) {
+            Tcl_SetWideIntObj(resultObj, value->wide);
+        } else {
+            Tcl_SetStringObj(resultObj, value->data, value->length);
+        }
     }
-    Tcl_MutexUnlock(&keyMutex);
+    Tcl_MutexUnlock(&shard->mutex);
 
     if (hashEntry == NULL) {
         Tcl_AppendResult(interp, "invalid key name \"", name, "\"", NULL);
@@ -93,6 +374,74 @@ KeyGet(
     return TCL_OK;
 }
 
+/* ::nx::key incr [-ttl <seconds>] <name> [increment] */
+static int
+KeyIncr(
+    Tcl_Interp *interp,
+    int objc,
+    Tcl_Obj *CONST objv[]
+    )
+{
+    char *name;
+    int index;
+    int newEntry;
+    int result = TCL_OK;
+    KeyShard *shard;
+    KeyValue *value;
+    Tcl_HashEntry *hashEntry;
+    Tcl_Obj *stringObj;
+    Tcl_WideInt expires;
+    Tcl_WideInt increment = 1;
+    Tcl_WideInt wide;
+
+    if (KeyParseTtl(interp, objc, objv, &index, &expires) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc != index + 1 && objc != index + 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-ttl seconds? name ?increment?");
+        return TCL_ERROR;
+    }
+    if (objc == index + 2 && Tcl_GetWideIntFromObj(interp, objv[index+1], &increment) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    name = Tcl_GetString(objv[index]);
+    shard = KeyGetShard(name);
+
+    Tcl_MutexLock(&shard->mutex);
+    hashEntry = KeyFind(shard, name);
+
+    if (hashEntry == NULL) {
+        hashEntry = Tcl_CreateHashEntry(&shard->table, name, &newEntry);
+        value = KeyResize(NULL, 0);
+        value->type = KEY_TYPE_WIDE;
+        value->expires = expires;
+        Tcl_SetHashValue(hashEntry, (ClientData)value);
+    } else {
+        value = (KeyValue *)Tcl_GetHashValue(hashEntry);
+
+        /* A string value is converted once, later increments use the integer. */
+        if (value->type == KEY_TYPE_STRING) {
+            stringObj = Tcl_NewStringObj(value->data, value->length);
+            Tcl_IncrRefCount(stringObj);
+            result = Tcl_GetWideIntFromObj(interp, stringObj, &wide);
+            Tcl_DecrRefCount(stringObj);
+
+            if (result == TCL_OK) {
+                value->type = KEY_TYPE_WIDE;
+                value->wide = wide;
+            }
+        }
+    }
+
+    if (result == TCL_OK) {
+        value->wide += increment;
+        Tcl_SetWideIntObj(Tcl_GetObjResult(interp), value->wide);
+    }
+    Tcl_MutexUnlock(&shard->mutex);
+
+    return result;
+}
+
 /* ::nx::key list */
 static int
 KeyList(
@@ -102,31 +451,44 @@ KeyList(
     )
 {
     char *name;
+    int i;
+    KeyValue *value;
     Tcl_HashEntry *hashEntry;
     Tcl_HashSearch hashSearch;
     Tcl_Obj *resultObj;
+    Tcl_WideInt now;
 
     if (objc != 2) {
         Tcl_WrongNumArgs(interp, 2, objv, NULL);
         return TCL_ERROR;
     }
     resultObj = Tcl_GetObjResult(interp);
-
-    /* Create a list of all key names. */
-    Tcl_MutexLock(&keyMutex);
-    for (hashEntry = Tcl_FirstHashEntry(keyTable, &hashSearch);
-            hashEntry != NULL;
-            hashEntry = Tcl_NextHashEntry(&hashSearch)) {
-
-        name = Tcl_GetHashKey(keyTable, hashEntry);
-        Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj(name, -1));
+    now = KeyGetTime();
+
+    /* Create a list of all key names, deleting expired keys. */
+    for (i = 0; i < KEY_SHARDS; i++) {
+        Tcl_MutexLock(&keyShards[i].mutex);
+        hashEntry = Tcl_FirstHashEntry(&keyShards[i].table, &hashSearch);
+
+        while (hashEntry != NULL) {
+            value = (KeyValue *)Tcl_GetHashValue(hashEntry);
+
+            if (value->expires != 0 && value->expires <= now) {
+                ckfree((char *)value);
+                Tcl_DeleteHashEntry(hashEntry);
+            } else {
+                name = Tcl_GetHashKey(&keyShards[i].table, hashEntry);
+                Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj(name, -1));
+            }
+            hashEntry = Tcl_NextHashEntry(&hashSearch);
+        }
+        Tcl_MutexUnlock(&keyShards[i].mutex);
     }
-    Tcl_MutexUnlock(&keyMutex);
 
     return TCL_OK;
 }
 
-/* ::nx::key set <name> <value> */
+/* ::nx::key set [-ttl <seconds>] <name> <value> */
 static int
 KeySet(
     Tcl_Interp *interp,
@@ -134,35 +496,42 @@ KeySet(
     Tcl_Obj *CONST objv[]
     )
 {
+    char *data;
     char *name;
     int dataLength;
+    int index;
     int newEntry;
+    KeyShard *shard;
     KeyValue *value;
     Tcl_HashEntry *hashEntry;
-    unsigned char *data;
+    Tcl_WideInt expires;
 
-    if (objc != 4) {
-        Tcl_WrongNumArgs(interp, 2, objv, "name value");
+    if (KeyParseTtl(interp, objc, objv, &index, &expires) != TCL_OK) {
         return TCL_ERROR;
     }
-    name = Tcl_GetString(objv[2]);
-    data = Tcl_GetByteArrayFromObj(objv[3], &dataLength);
+    if (objc != index + 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-ttl seconds? name value");
+        return TCL_ERROR;
+    }
+    name = Tcl_GetString(objv[index]);
+    data = Tcl_GetStringFromObj(objv[index+1], &dataLength);
+    shard = KeyGetShard(name);
 
-    /* Allocate and fill the value structure. */
-    value = (KeyValue *)ckalloc(sizeof(KeyValue) + dataLength);
-    value->data = (unsigned char *)&value[1];
+    /* Allocate and fill the value structure, outside of the mutex. */
+    value = KeyResize(NULL, dataLength);
     value->length = dataLength;
+    value->expires = expires;
     memcpy(value->data, data, dataLength);
 
     /* Create a hash table entry and update its value. */
-    Tcl_MutexLock(&keyMutex);
-    hashEntry = Tcl_CreateHashEntry(keyTable, name, &newEntry);
+    Tcl_MutexLock(&shard->mutex);
+    hashEntry = Tcl_CreateHashEntry(&shard->table, name, &newEntry);
     if (newEntry == 0) {
         /* Free the current value. */
         ckfree((char *)Tcl_GetHashValue(hashEntry));
     }
     Tcl_SetHashValue(hashEntry, (ClientData)value);
-    Tcl_MutexUnlock(&keyMutex);
+    Tcl_MutexUnlock(&shard->mutex);
 
     return TCL_OK;
 }
@@ -177,6 +546,7 @@ KeyUnset(
 {
     char *name;
     int complain = 1;
+    KeyShard *shard;
     Tcl_HashEntry *hashEntry;
 
     switch (objc) {
@@ -195,16 +565,17 @@ KeyUnset(
         }
     }
     name = Tcl_GetString(objv[objc-1]);
+    shard = KeyGetShard(name);
 
     /* Remove the hash table entry. */
-    Tcl_MutexLock(&keyMutex);
-    hashEntry = Tcl_FindHashEntry(keyTable, name);
+    Tcl_MutexLock(&shard->mutex);
+    hashEntry = KeyFind(shard, name);
 
     if (hashEntry != NULL) {
         ckfree((char *)Tcl_GetHashValue(hashEntry));
         Tcl_DeleteHashEntry(hashEntry);
     }
-    Tcl_MutexUnlock(&keyMutex);
+    Tcl_MutexUnlock(&shard->mutex);
 
     if (complain && hashEntry == NULL) {
         Tcl_AppendResult(interp, "invalid key name \"", name, "\"", NULL);
@@ -213,11 +584,36 @@ KeyUnset(
     return TCL_OK;
 }
 
-
+
+/*
+ * KeyInit
+ *
+ *   Initialises the key hash tables.
+ *
+ * Arguments:
+ *   None.
+ *
+ * Returns:
+ *   None.
+ */
+void
+KeyInit(
+    void
+    )
+{
+    int i;
+
+    for (i = 0; i < KEY_SHARDS; i++) {
+        Tcl_MutexLock(&keyShards[i].mutex);
+        Tcl_InitHashTable(&keyShards[i].table, TCL_STRING_KEYS);
+        Tcl_MutexUnlock(&keyShards[i].mutex);
+    }
+}
+
 /*
- * KeyClearTable
+ * KeyFinalize
  *
- *   Clear all key hash table entries.
+ *   Frees all key hash table entries and the tables.
  *
  * Arguments:
  *   None.
@@ -226,19 +622,25 @@ KeyUnset(
  *   None.
  */
 void
-KeyClearTable(
+KeyFinalize(
     void
     )
 {
+    int i;
     Tcl_HashSearch search;
     Tcl_HashEntry *hashEntry;
 
-    for (hashEntry = Tcl_FirstHashEntry(keyTable, &search);
-            hashEntry != NULL;
-            hashEntry = Tcl_NextHashEntry(&search)) {
+    for (i = 0; i < KEY_SHARDS; i++) {
+        Tcl_MutexLock(&keyShards[i].mutex);
+        for (hashEntry = Tcl_FirstHashEntry(&keyShards[i].table, &search);
+                hashEntry != NULL;
+                hashEntry = Tcl_NextHashEntry(&search)) {
 
-        ckfree((char *)Tcl_GetHashValue(hashEntry));
-        Tcl_DeleteHashEntry(hashEntry);
+            ckfree((char *)Tcl_GetHashValue(hashEntry));
+        }
+        Tcl_DeleteHashTable(&keyShards[i].table);
+        Tcl_MutexUnlock(&keyShards[i].mutex);
+        Tcl_MutexFinalize(&keyShards[i].mutex);
     }
 }
 
@@ -266,10 +668,11 @@ KeyObjCmd(
 {
     int index;
     static const char *options[] = {
-        "exists", "get", "list", "set", "unset", NULL
+        "append", "exists", "get", "incr", "list", "set", "unset", NULL
     };
     enum optionIndices {
-        OPTION_EXISTS = 0, OPTION_GET, OPTION_LIST, OPTION_SET, OPTION_UNSET
+        OPTION_APPEND = 0, OPTION_EXISTS, OPTION_GET, OPTION_INCR,
+        OPTION_LIST, OPTION_SET, OPTION_UNSET
     };
 
     if (objc < 2) {
@@ -282,8 +685,10 @@ KeyObjCmd(
     }
 
     switch ((enum optionIndices) index) {
+        case OPTION_APPEND: return KeyAppend(interp, objc, objv);
         case OPTION_EXISTS: return KeyExists(interp, objc, objv);
         case OPTION_GET:    return KeyGet(interp, objc, objv);
+        case OPTION_INCR:   return KeyIncr(interp, objc, objv);
         case OPTION_LIST:   return KeyList(interp, objc, objv);
         case OPTION_SET:    return KeySet(interp, objc, objv);
         case OPTION_UNSET:  return KeyUnset(interp, objc, objv);
@@ -12,10 +12,11 @@
  *   Implements an interface to retrieve information from MP3 files.
  *
  *   Tcl Commands:
- *     ::nx::mp3 <file> <varName>
+ *     ::nx::mp3 [--] <file> <varName>
  *      - Retrieves the ID3/MP3 header info for "file" and uses
  *        the array given by "varName" to store information.
  *      - An error is raised if the file is invalid or cannot be opened for reading.
+ *      - A file name beginning with a dash must follow the "--" switch.
  *      - Array Contents:
  *        bitrate   - Average audio bitrate, in Kbit/s.
  *        frames    - Number of frames.
@@ -34,9 +35,224 @@
  *        year      - Release year.
  *        id3       - ID3 tag version.
  *
+ *     ::nx::mp3 -scan [--] <dir>
+ *      - Retrieves the ID3/MP3 header info for every ".mp3" file in "dir",
+ *        which saves a script from calling the command once per file.
+ *      - Returns a list of file names and their array contents, as a list of
+ *        field and value pairs. Invalid files are not included.
+ *      - An error is raised if the directory cannot be read.
+ *
  */
 
 #include <nxHelper.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <strings.h>
+#endif /* _WIN32 */
+
+/*
+ * Mp3GetFields
+ *
+ *   Retrieves the ID3/MP3 header info from an MP3 file.
+ *
+ * Arguments:
+ *   filePath - Path of the MP3 file.
+ *   listObj  - List to append the field and value pairs to.
+ *
+ * Returns:
+ *   0 if the file was read, -1 if it cannot be opened, and 1 if it is not
+ *   a valid MP3 file.
+ */
+static int
+Mp3GetFields(
+    const TCHAR *filePath,
+    Tcl_Obj *listObj
+    )
+{
+    int status = 1;
+    MP3INFO MP3Info;
+
+    if (!MP3OpenFile(filePath, &MP3Info)) {
+        return -1;
+    }
+
+    if (MP3LoadHeader(&MP3Info)) {
+        MP3TAG MP3Tag;
+        BOOL isTagged = MP3GetTag(&MP3Info, &MP3Tag);
+        static char *unknown = "unknown";
+        unsigned long i;
+
+        /* List of 'double' fields. */
+        struct {
+            char *field;
+            double value;
+        } doubleValues[] = {
+            {"version",   (double)MP3GetVersion(&MP3Info)},
+            {"id3",       isTagged ? (double)MP3Tag.Version : (double)0.0},
+            {NULL}
+        };
+
+        /* List of 'long' fields. */
+        struct {
+            char *field;
+            long value;
+        } longValues[] = {
+            {"bitrate",   MP3GetBitrate(&MP3Info)},
+            {"frames",    MP3GetFrames(&MP3Info)},
+            {"frequency", MP3GetFrequency(&MP3Info)},
+            {"layer",     MP3GetLayer(&MP3Info)},
+            {"length",    MP3GetLength(&MP3Info)},
+            {"year",      isTagged ? MP3Tag.Year : 0},
+            {"track",     isTagged ? MP3Tag.Track : 0},
+            {NULL}
+        };
+
+        /* List of 'string' fields. */
+        struct {
+            char *field;
+            char *value;
+        } stringValues[] = {
+            {"mode",      MP3GetMode(&MP3Info)},
+            {"type",      MP3Info.IsVbr ? "VBR" : "CBR"},
+            {"title",     isTagged ? MP3Tag.Title : unknown},
+            {"artist",    isTagged ? MP3Tag.Artist : unknown},
+            {"album",     isTagged ? MP3Tag.Album : unknown},
+            {"genre",     isTagged ? MP3Tag.Genre : unknown},
+            {"comment",   isTagged ? MP3Tag.Comment : unknown},
+            {NULL}
+        };
+
+        for (i = 0; doubleValues[i].field != NULL; i++) {
+            Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewStringObj(doubleValues[i].field, -1));
+            Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewDoubleObj(doubleValues[i].value));
+        }
+
+        for (i = 0; longValues[i].field != NULL; i++) {
+            Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewStringObj(longValues[i].field, -1));
+            Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewLongObj(longValues[i].value));
+        }
+
+        for (i = 0; stringValues[i].field != NULL; i++) {
+            Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewStringObj(stringValues[i].field, -1));
+            Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewStringObj(stringValues[i].value, -1));
+        }
+
+        status = 0;
+    }
+
+    MP3CloseFile(&MP3Info);
+    return status;
+}
+
+/*
+ * Mp3Scan
+ *
+ *   Retrieves the ID3/MP3 header info for every MP3 file in a directory.
+ *
+ * Arguments:
+ *   interp  - Current interpreter.
+ *   pathObj - Path of the directory.
+ *
+ * Returns:
+ *   A standard Tcl result.
+ */
+static int
+Mp3Scan(
+    Tcl_Interp *interp,
+    Tcl_Obj *pathObj
+    )
+{
+    Tcl_Obj *fieldsObj;
+    Tcl_Obj *resultObj;
+#ifdef _WIN32
+    HANDLE findHandle;
+    TCHAR *dirPath = Tcl_GetTString(pathObj);
+    TCHAR filePath[MAX_PATH];
+    WIN32_FIND_DATA findData;
+
+    if (!PathCombine(filePath, dirPath, TEXT("*.mp3"))) {
+        Tcl_AppendResult(interp, "unable to scan \"", Tcl_GetString(pathObj),
+            "\": invalid path", NULL);
+        return TCL_ERROR;
+    }
+
+    findHandle = FindFirstFile(filePath, &findData);
+    if (findHandle == INVALID_HANDLE_VALUE) {
+        DWORD error = GetLastError();
+
+        /* An empty directory is not an error. */
+        if (error == ERROR_FILE_NOT_FOUND) {
+            return TCL_OK;
+        }
+        Tcl_AppendResult(interp, "unable to scan \"", Tcl_GetString(pathObj),
+            "\": ", TclSetWinError(interp, error), NULL);
+        return TCL_ERROR;
+    }
+
+    resultObj = Tcl_NewObj();
+    do {
+        if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+            !PathCombine(filePath, dirPath, findData.cFileName)) {
+            continue;
+        }
+
+        fieldsObj = Tcl_NewObj();
+        if (Mp3GetFields(filePath, fieldsObj) == 0) {
+            Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewTStringObj(findData.cFileName, -1));
+            Tcl_ListObjAppendElement(NULL, resultObj, fieldsObj);
+        } else {
+            Tcl_DecrRefCount(fieldsObj);
+        }
+    } while (FindNextFile(findHandle, &findData));
+
+    FindClose(findHandle);
+#else
+    const char *dirPath = Tcl_GetString(pathObj);
+    size_t length;
+    DIR *dir;
+    struct dirent *entry;
+    Tcl_DString filePath;
+
+    dir = opendir(dirPath);
+    if (dir == NULL) {
+        Tcl_SetErrno(errno);
+        Tcl_AppendResult(interp, "unable to scan \"", dirPath, "\": ",
+            Tcl_PosixError(interp), NULL);
+        return TCL_ERROR;
+    }
+
+    Tcl_DStringInit(&filePath);
+    resultObj = Tcl_NewObj();
+
+    while ((entry = readdir(dir)) != NULL) {
+        length = strlen(entry->d_name);
+        if (length < 4 || strcasecmp(entry->d_name + length - 4, ".mp3") != 0 ||
+            entry->d_type == DT_DIR) {
+            continue;
+        }
+
+        Tcl_DStringSetLength(&filePath, 0);
+        Tcl_DStringAppend(&filePath, dirPath, -1);
+        Tcl_DStringAppend(&filePath, "/", 1);
+        Tcl_DStringAppend(&filePath, entry->d_name, (int)length);
+
+        fieldsObj = Tcl_NewObj();
+        if (Mp3GetFields(Tcl_DStringValue(&filePath), fieldsObj) == 0) {
+            Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj(entry->d_name, (int)length));
+            Tcl_ListObjAppendElement(NULL, resultObj, fieldsObj);
+        } else {
+            Tcl_DecrRefCount(fieldsObj);
+        }
+    }
+
+    Tcl_DStringFree(&filePath);
+    closedir(dir);
+#endif /* _WIN32 */
+
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
 
 /*
  * Mp3ObjCmd
@@ -60,109 +276,77 @@ Mp3ObjCmd(
     Tcl_Obj *CONST objv[]
     )
 {
-    int status = TCL_ERROR;
-    MP3INFO MP3Info;
-    TCHAR *filePath;
+    int i;
+    int index;
+    int listLength;
+    int scan = 0;
+    int status;
+    Tcl_Obj *listObj;
+    Tcl_Obj *pathObj;
+    Tcl_Obj *varObj;
+    Tcl_Obj **elementObjs;
+    const static char *switches[] = {"-scan", "--", NULL};
+    enum switchIndices {OPTION_SCAN, OPTION_LAST};
 
-    if (objc != 3) {
-        Tcl_WrongNumArgs(interp, 1, objv, "file varName");
-        return TCL_ERROR;
+    for (i = 1; i < objc; i++) {
+        if (Tcl_GetString(objv[i])[0] != '-') {
+            break;
+        }
+        if (Tcl_GetIndexFromObj(interp, objv[i], switches, "switch", TCL_EXACT, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (index == OPTION_LAST) {
+            i++;
+            break;
+        }
+        scan = 1;
     }
-    filePath = Tcl_GetTString(objv[1]);
-
-    if (MP3OpenFile(filePath, &MP3Info)) {
-        MP3TAG MP3Tag;
+    objc -= i;
 
-        if (MP3LoadHeader(&MP3Info)) {
-            BOOL isTagged = MP3GetTag(&MP3Info, &MP3Tag);
-            static char *unknown = "unknown";
-            unsigned long i;
-            Tcl_Obj *fieldObj;
-            Tcl_Obj *valueObj;
-
-            /* List of 'double' fields. */
-            struct {
-                char *field;
-                double value;
-            } doubleValues[] = {
-                {"version",   (double)MP3GetVersion(&MP3Info)},
-                {"id3",       isTagged ? (double)MP3Tag.Version : (double)0.0},
-                NULL
-            };
-
-            /* List of 'long' fields. */
-            struct {
-                char *field;
-                long value;
-            } longValues[] = {
-                {"bitrate",   MP3GetBitrate(&MP3Info)},
-                {"frames",    MP3GetFrames(&MP3Info)},
-                {"frequency", MP3GetFrequency(&MP3Info)},
-                {"layer",     MP3GetLayer(&MP3Info)},
-                {"length",    MP3GetLength(&MP3Info)},
-                {"year",      isTagged ? MP3Tag.Year : 0},
-                {"track",     isTagged ? MP3Tag.Track : 0},
-                NULL
-            };
-
-            /* List of 'string' fields. */
-            struct {
-                char *field;
-                char *value;
-            } stringValues[] = {
-                {"mode",      MP3GetMode(&MP3Info)},
-                {"type",      MP3Info.IsVbr ? "VBR" : "CBR"},
-                {"title",     isTagged ? MP3Tag.Title : unknown},
-                {"artist",    isTagged ? MP3Tag.Artist : unknown},
-                {"album",     isTagged ? MP3Tag.Album : unknown},
-                {"genre",     isTagged ? MP3Tag.Genre : unknown},
-                {"comment",   isTagged ? MP3Tag.Comment : unknown},
-                NULL
-            };
-
-            /*
-             * Tcl_ObjSetVar2() won't create a copy of the field object,
-             * so the caller must free the object once finished with it.
-             */
-            fieldObj = Tcl_NewObj();
-            Tcl_IncrRefCount(fieldObj);
-
-/* Easier then repeating this... */
-#define TCL_STORE_ARRAY(name, value)                                                      \
-    valueObj = (value);                                                                   \
-    Tcl_SetStringObj(fieldObj, (name), -1);                                               \
-    if (Tcl_ObjSetVar2(interp, objv[2], fieldObj, valueObj, TCL_LEAVE_ERR_MSG) == NULL) { \
-        Tcl_DecrRefCount(fieldObj);                                                       \
-        return TCL_ERROR;                                                                 \
+    if (scan) {
+        if (objc != 1) {
+            Tcl_WrongNumArgs(interp, 1, objv, "-scan ?--? dir");
+            return TCL_ERROR;
+        }
+        return Mp3Scan(interp, objv[i]);
+    }
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-scan? ?--? file varName");
+        return TCL_ERROR;
     }
+    pathObj = objv[i];
+    varObj  = objv[i+1];
 
-            for (i = 0; doubleValues[i].field != NULL; i++) {
-                TCL_STORE_ARRAY(doubleValues[i].field,
-                    Tcl_NewDoubleObj(doubleValues[i].value));
-            }
+    listObj = Tcl_NewObj();
+    Tcl_IncrRefCount(listObj);
+    status = Mp3GetFields(Tcl_GetTString(pathObj), listObj);
 
-            for (i = 0; longValues[i].field != NULL; i++) {
-                TCL_STORE_ARRAY(longValues[i].field,
-                    Tcl_NewLongObj(longValues[i].value));
-            }
+    if (status == 0) {
+        Tcl_ListObjGetElements(NULL, listObj, &listLength, &elementObjs);
 
-            for (i = 0; stringValues[i].field != NULL; i++) {
-                TCL_STORE_ARRAY(stringValues[i].field,
-                    Tcl_NewStringObj(stringValues[i].value, -1));
+        for (i = 0; i < listLength; i += 2) {
+            if (Tcl_ObjSetVar2(interp, varObj, elementObjs[i], elementObjs[i+1], TCL_LEAVE_ERR_MSG) == NULL) {
+                Tcl_DecrRefCount(listObj);
+                return TCL_ERROR;
             }
-
-            Tcl_DecrRefCount(fieldObj);
-            status = TCL_OK;
-        } else {
-            Tcl_AppendResult(interp, "unable to read \"",
-                Tcl_GetString(objv[1]), "\": not a valid MP3 file", NULL);
         }
+        Tcl_DecrRefCount(listObj);
+        return TCL_OK;
+    }
+    Tcl_DecrRefCount(listObj);
 
-        MP3CloseFile(&MP3Info);
+    if (status > 0) {
+        Tcl_AppendResult(interp, "unable to read \"",
+            Tcl_GetString(pathObj), "\": not a valid MP3 file", NULL);
     } else {
-        Tcl_AppendResult(interp, "unable to open \"",  Tcl_GetString(objv[1]),
+#ifdef _WIN32
+        Tcl_AppendResult(interp, "unable to open \"",  Tcl_GetString(pathObj),
             "\": ", TclSetWinError(interp, GetLastError()), NULL);
+#else
+        Tcl_SetErrno(errno);
+        Tcl_AppendResult(interp, "unable to open \"",  Tcl_GetString(pathObj),
+            "\": ", Tcl_PosixError(interp), NULL);
+#endif /* _WIN32 */
     }
-
-    return status;
+    return TCL_ERROR;
 }
@@ -1,10 +1,18 @@
 #include <nxHelper.h>
+#ifndef _WIN32
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* _WIN32 */
 
 // Function definitions
-static LONGLONG SeekFile(HANDLE FileHandle, LONGLONG Offset, ULONG MoveMethod);
+static ULONG MP3ReadFile(MP3INFO *MP3Info, LONGLONG Offset, BYTE *Buffer, ULONG Length);
 static VOID MP3CopyTag(BYTE *Source, CHAR *String, ULONG Length);
 static LONG MP3GetFrameBitrate(MP3INFO *MP3Info);
 static BOOL MP3ValidVbrHeader(BYTE *VbrBuffer, PLONG Frames);
+static BOOL MP3ValidVbriHeader(BYTE *VbrBuffer, PLONG Frames);
 
 FORCEINLINE ULONG MP3GetFrameHeader(BYTE *FrameBuffer)
 {
@@ -26,18 +34,30 @@ FORCEINLINE ULONG MP3GetFrameHeader(BYTE *FrameBuffer)
     (MP3GetEmphasisIndex(FrameHeader)  &    3) !=    2    \
 )
 
-static LONGLONG SeekFile(HANDLE FileHandle, LONGLONG Offset, ULONG MoveMethod)
+static ULONG MP3ReadFile(MP3INFO *MP3Info, LONGLONG Offset, BYTE *Buffer, ULONG Length)
 {
+#ifdef _WIN32
     LARGE_INTEGER LargeInt;
+    ULONG BytesRead;
 
+    // Reads never share the handle, so seek and read.
     LargeInt.QuadPart = Offset;
-    LargeInt.LowPart = SetFilePointer(FileHandle, LargeInt.LowPart, &LargeInt.HighPart, MoveMethod);
+    LargeInt.LowPart = SetFilePointer(MP3Info->FileHandle, LargeInt.LowPart, &LargeInt.HighPart, FILE_BEGIN);
 
-    if (LargeInt.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR) {
-        LargeInt.QuadPart = -1;
+    if ((LargeInt.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR) ||
+        !ReadFile(MP3Info->FileHandle, Buffer, Length, &BytesRead, NULL)) {
+        return 0;
     }
+    return BytesRead;
+#else
+    ssize_t BytesRead;
+
+    do {
+        BytesRead = pread(MP3Info->FileHandle, Buffer, Length, (off_t)Offset);
+    } while (BytesRead == -1 && errno == EINTR);
 
-    return LargeInt.QuadPart;
+    return (BytesRead > 0) ? (ULONG)BytesRead : 0;
+#endif /* _WIN32 */
 }
 
 static VOID MP3CopyTag(BYTE *Source, CHAR *String, ULONG Length)
@@ -123,8 +143,28 @@ static BOOL MP3ValidVbrHeader(BYTE *VbrBuffer, PLONG Frames)
     return TRUE;
 }
 
+static BOOL MP3ValidVbriHeader(BYTE *VbrBuffer, PLONG Frames)
+{
+    // Fraunhofer's VBR header begins with "VBRI", followed by the version,
+    // delay, quality, and byte count; the frame count is always present.
+    if (memcmp(VbrBuffer, "VBRI", 4) != 0) {
+        *Frames = -1;
+        return FALSE;
+    }
+
+    *Frames = (LONG)(
+        ((VbrBuffer[14] & 255) << 24) |
+        ((VbrBuffer[15] & 255) << 16) |
+        ((VbrBuffer[16] & 255) <<  8) |
+         (VbrBuffer[17] & 255)
+    );
+
+    return TRUE;
+}
+
 BOOL MP3OpenFile(const TCHAR *FilePath, MP3INFO *MP3Info)
 {
+#ifdef _WIN32
     ULONG SizeHigh;
     ULONG SizeLow;
 
@@ -148,46 +188,99 @@ BOOL MP3OpenFile(const TCHAR *FilePath, MP3INFO *MP3Info)
     } else {
         MP3Info->FileSize = ((LONGLONG)SizeHigh << 32) + SizeLow;
     }
+#else
+    struct stat FileStat;
+
+    MP3Info->FileHandle = open(FilePath, O_RDONLY | O_CLOEXEC);
+
+    if (MP3Info->FileHandle == -1) {
+        return FALSE;
+    }
+
+    if (fstat(MP3Info->FileHandle, &FileStat) != 0 || !S_ISREG(FileStat.st_mode)) {
+        MP3Info->FileSize = -1;
+    } else {
+        MP3Info->FileSize = (LONGLONG)FileStat.st_size;
+    }
+#endif /* _WIN32 */
 
     return TRUE;
 }
 
 BOOL MP3CloseFile(MP3INFO *MP3Info)
 {
+#ifdef _WIN32
     return CloseHandle(MP3Info->FileHandle);
+#else
+    return (close(MP3Info->FileHandle) == 0);
+#endif /* _WIN32 */
 }
 
 BOOL MP3LoadHeader(MP3INFO *MP3Info)
 {
     BYTE  Buffer[MP3_BUFFER];
-    LONGLONG VbrOffset;
+    BYTE  *Current;
+    BYTE  *End;
+    BYTE  *VbrHeader;
+    LONGLONG Offset = 0;
     ULONG BytesRead;
-    ULONG i;
+    ULONG Start = 0;
+    ULONG TagSize;
+    ULONG VbrOffset;
+
+    BytesRead = MP3ReadFile(MP3Info, 0, Buffer, MP3_BUFFER);
+
+    // Skip the ID3v2 tag, which may contain bytes that look like a frame
+    // header. Its size is stored in four bytes of seven bits each.
+    if (BytesRead >= 10 && memcmp(Buffer, "ID3", 3) == 0 &&
+            Buffer[3] != 0xFF && Buffer[4] != 0xFF &&
+            ((Buffer[6] | Buffer[7] | Buffer[8] | Buffer[9]) & 0x80) == 0) {
+
+        TagSize = 10 + (
+            ((ULONG)Buffer[6] << 21) |
+            ((ULONG)Buffer[7] << 14) |
+            ((ULONG)Buffer[8] <<  7) |
+             (ULONG)Buffer[9]
+        );
 
-    SetFilePointer(MP3Info->FileHandle, 0, 0, FILE_BEGIN);
+        // Flag for a footer, a copy of the tag header at the end.
+        if (Buffer[5] & 0x10) {
+            TagSize += 10;
+        }
 
-    // Read a 256 byte chunk and proceed if 3 or more bytes
-    // were read, since the MP3 frame header is 4 byte long.
-    while (ReadFile(MP3Info->FileHandle, Buffer, MP3_BUFFER, &BytesRead, NULL) && BytesRead > 3) {
+        if (TagSize < BytesRead) {
+            Start = TagSize;
+        } else {
+            Offset = TagSize;
+            BytesRead = MP3ReadFile(MP3Info, Offset, Buffer, MP3_BUFFER);
+        }
+    }
 
-        // Process the data chunk 1 byte at a time.
-        for (i = 0; i < BytesRead - 4; i++) {
+    for (;;) {
+        // Every frame header begins with a 0xFF byte, let the C library
+        // find those instead of testing every offset.
+        End = Buffer + BytesRead;
+        Current = Buffer + Start;
+
+        while (End - Current >= 4 && (Current = memchr(Current, 0xFF, End - Current - 3)) != NULL) {
 
             // Validate the MP3 header.
-            MP3Info->FrameHeader = MP3GetFrameHeader(Buffer+i);
+            MP3Info->FrameHeader = MP3GetFrameHeader(Current);
             if (MP3ValidFrameHeader(MP3Info->FrameHeader)) {
-
-                // Save the file position following the frame header.
-                VbrOffset = SeekFile(MP3Info->FileHandle, 0, FILE_CURRENT) - BytesRead + i + 4;
                 goto ValidHeader;
             }
+            Current++;
         }
 
-        // Move the file pointer 3 bytes back for the next read.
-        SetFilePointer(MP3Info->FileHandle, -3, 0, FILE_CURRENT);
-    }
+        if (BytesRead < MP3_BUFFER) {
+            return FALSE;
+        }
 
-    return FALSE;
+        // Keep the last 3 bytes, a frame header may span both reads.
+        Offset += BytesRead - 3;
+        Start = 0;
+        BytesRead = MP3ReadFile(MP3Info, Offset, Buffer, MP3_BUFFER);
+    }
 
     ValidHeader:
 
@@ -198,28 +291,43 @@ BOOL MP3LoadHeader(MP3INFO *MP3Info)
         // MPEG version 1
         if (MP3GetModeIndex(MP3Info->FrameHeader) == 3) {
             // Single channel
-            VbrOffset += 17;
+            VbrOffset = 4 + 17;
         } else {
             // Dual channel
-            VbrOffset += 32;
+            VbrOffset = 4 + 32;
         }
     } else {
         // MPEG version 2 and 2.5
         if (MP3GetModeIndex(MP3Info->FrameHeader) == 3) {
             // Single channel
-            VbrOffset += 9;
+            VbrOffset = 4 + 9;
         } else {
             // Dual channel
-            VbrOffset += 17;
+            VbrOffset = 4 + 17;
         }
     }
 
-    // Read the next twelve bytes, which contain the VBR header.
-    SeekFile(MP3Info->FileHandle, VbrOffset, FILE_BEGIN);
-    ReadFile(MP3Info->FileHandle, Buffer, 12, &BytesRead, NULL);
+    // The VBR headers are usually in the buffer already, read them only
+    // when the frame header was found at the end of it.
+    if (End - Current < 4 + 32 + 18) {
+        Offset += Current - Buffer;
+        BytesRead = MP3ReadFile(MP3Info, Offset, Buffer, 4 + 32 + 18);
+        if (BytesRead < VbrOffset + 12) {
+            MP3Info->IsVbr = FALSE;
+            MP3Info->VbrFrames = -1;
+            return TRUE;
+        }
+        Current = Buffer;
+        End = Buffer + BytesRead;
+    }
+    VbrHeader = Current + VbrOffset;
 
-    // Validate the VBR header.
-    if (BytesRead == 12 && MP3ValidVbrHeader(Buffer, &(MP3Info->VbrFrames))) {
+    // Validate the Xing header, which follows the side information, or the
+    // VBRI header, which is always 32 bytes after the frame header.
+    if (MP3ValidVbrHeader(VbrHeader, &(MP3Info->VbrFrames))) {
+        MP3Info->IsVbr = TRUE;
+    } else if (End - Current >= 4 + 32 + 18 &&
+            MP3ValidVbriHeader(Current + 4 + 32, &(MP3Info->VbrFrames))) {
         MP3Info->IsVbr = TRUE;
     } else {
         MP3Info->IsVbr = FALSE;
@@ -263,11 +371,11 @@ BOOL MP3GetTag(MP3INFO *MP3Info, MP3TAG *MP3Tag)
         "Thrash Metal", "Anime", "JPop", "Synthpop", "Unknown"
     };
 
-    if (SeekFile(MP3Info->FileHandle, -128, FILE_END) == -1) {
+    if (MP3Info->FileSize < 128) {
         return FALSE;
     }
 
-    ReadFile(MP3Info->FileHandle, Buffer, 128, &BytesRead, NULL);
+    BytesRead = MP3ReadFile(MP3Info, MP3Info->FileSize - 128, Buffer, 128);
 
     if (BytesRead != 128 || memcmp(Buffer, "TAG", 3) != 0) {
         return FALSE;
@@ -297,7 +405,7 @@ BOOL MP3GetTag(MP3INFO *MP3Info, MP3TAG *MP3Tag)
     if (GenreIndex > 148) {
         GenreIndex = 148;
     }
-    StringCchCopyA(MP3Tag->Genre, 31, Genres[GenreIndex]);
+    MP3CopyTag((BYTE *)Genres[GenreIndex], MP3Tag->Genre, 30);
 
     return TRUE;
 }
@@ -1,8 +1,28 @@
 #ifndef _NXMP3INFO_H_
 #define _NXMP3INFO_H_
 
-/* Size of read buffer in bytes (must be at least 12). */
-#define MP3_BUFFER    512
+/* Size of read buffer in bytes (must be at least 36). */
+#define MP3_BUFFER    16384
+
+#ifndef _WIN32
+/* Windows types used by the MP3 functions. */
+typedef int           BOOL;
+typedef unsigned char BYTE;
+typedef char          CHAR;
+typedef float         FLOAT;
+typedef long          LONG;
+typedef long long     LONGLONG;
+typedef char          TCHAR;
+typedef unsigned long ULONG;
+typedef char         *PCHAR;
+typedef long         *PLONG;
+
+#define FALSE         0
+#define TRUE          1
+#define VOID          void
+#define FORCEINLINE   static inline
+#define CopyMemory    memcpy
+#endif /* _WIN32 */
 
 /* VBR header flags. */
 #define MP3_FLAG_VBR_FRAMES     0x0001
@@ -11,7 +31,11 @@
 #define MP3_FLAG_VBR_SCALE      0x0008
 
 typedef struct {
+#ifdef _WIN32
     HANDLE FileHandle;  // A handle to the MP3 file, with read rights
+#else
+    int FileHandle;     // A descriptor of the MP3 file, with read rights
+#endif
     LONGLONG FileSize;  // Size of MP3 file in bytes
     ULONG FrameHeader;  // The MP3 file's frame header
     BOOL  IsVbr;        // Indicates if the file has a variable bitrate
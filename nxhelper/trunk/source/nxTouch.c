@@ -10,7 +10,8 @@
  *
  * Abstract:
  *   Implements a method to change file and directory times both
- *   recursively and non-recursively.
+ *   recursively and non-recursively. See unix/nxUnixTouch.c for the POSIX
+ *   version, which walks directory trees on several threads.
  *
  *   Tcl Commands:
  *     ::nx::touch [switches] <path> [clockVal]
@@ -179,11 +180,11 @@ TouchObjCmd(
                 break;
             }
             case OPTION_CTIME: {
-                options |= TOUCH_FLAG_MTIME;
+                options |= TOUCH_FLAG_CTIME;
                 break;
             }
             case OPTION_MTIME: {
-                options |= TOUCH_FLAG_CTIME;
+                options |= TOUCH_FLAG_MTIME;
                 break;
             }
             case OPTION_RECURSE: {
@@ -14,6 +14,7 @@
 
 #include <nxHelper.h>
 
+#ifdef _WIN32
 #ifndef TCL_TSD_INIT
 #define TCL_TSD_INIT(keyPtr) (ThreadSpecificData *)Tcl_GetThreadData((keyPtr), sizeof(ThreadSpecificData))
 #endif
@@ -69,6 +70,7 @@ TclSetWinError(
     Tcl_SetErrorCode(interp, "WINDOWS", errorId, tsdPtr->message, NULL);
     return tsdPtr->message;
 }
+#endif /* _WIN32 */
 
 /*
  * TclSwitchCompare
@@ -162,6 +164,7 @@ TclGetPathFromObj(
 #endif
 
 
+#ifdef _WIN32
 BOOL
 GetTimeZoneBias(
     long *bias
@@ -236,3 +239,4 @@ SleepObjCmd(
 
     return TCL_OK;
 }
+#endif /* _WIN32 */
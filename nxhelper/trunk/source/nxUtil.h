@@ -15,11 +15,13 @@
 #ifndef _NXUTIL_H_
 #define _NXUTIL_H_
 
+#ifdef _WIN32
 char *
 TclSetWinError(
     Tcl_Interp *interp,
     DWORD errorCode
     );
+#endif /* _WIN32 */
 
 int
 TclSwitchCompare(
@@ -35,6 +37,7 @@ TclGetPathFromObj(
     );
 
 
+#ifdef _WIN32
 BOOL
 GetTimeZoneBias(
     long *bias
@@ -50,5 +53,6 @@ PosixEpochToFileTime(
     unsigned long epochTime,
     FILETIME *fileTime
     );
+#endif /* _WIN32 */
 
 #endif /* _NXUTIL_H_ */
@@ -12,7 +12,11 @@
 #   Basic regression tests for nxHelper.
 #
 
-load nxHelper.dll
+if {$argc > 0} {
+    load [lindex $argv 0]
+} else {
+    load nxHelper.dll
+}
 
 # Base64 and Zlib
 set testStrings {
@@ -44,16 +48,37 @@ foreach test $testStrings {
     ::nx::zlib crc32 $test
 }
 
-# Volume
-::nx::volume type "C:\\"
-::nx::volume info "C:\\" volC
-::nx::volume info "D:\\" volD
+if {$tcl_platform(platform) eq "windows"} {
+    # Volume
+    ::nx::volume type "C:\\"
+    ::nx::volume info "C:\\" volC
+    ::nx::volume info "D:\\" volD
 
-unset volC volD
+    unset volC volD
+}
 
 # MP3
 ::nx::mp3 test.mp3 mp3
-unset mp3
+if {$mp3(type) ne "VBR" || $mp3(frames) != 812 || $mp3(length) != 21 || $mp3(artist) ne "Adam Sandler"} {
+    error "mp3 info is wrong: [array get mp3]"
+}
+set scan [::nx::mp3 -scan [pwd]]
+if {[llength $scan] != 2 || [lindex $scan 0] ne "test.mp3"} {
+    error "mp3 scan is wrong: $scan"
+}
+array set scanned [lindex $scan 1]
+foreach name [array names mp3] {
+    if {$mp3($name) ne $scanned($name)} {
+        error "mp3 scan field $name is wrong: $scanned($name)"
+    }
+}
+if {![catch {::nx::mp3 nxHelper.tcl mp3}]} {
+    error "this is not an MP3 file"
+}
+if {![catch {::nx::mp3 scan mp3}] || ![catch {::nx::mp3 -scan}]} {
+    error "scan is a switch, and requires a directory"
+}
+unset mp3 scan scanned
 
 # Key
 ::nx::key set world {kind of big}
@@ -87,5 +112,77 @@ if {[::nx::key get world] ne [list the biggest now]} {
 ::nx::key unset -nocomplain invalid
 ::nx::key unset world
 
+if {[::nx::key incr counter] != 1 || [::nx::key incr counter 9] != 10} {
+    error "incr is wrong"
+}
+::nx::key set counter 41
+if {[::nx::key incr counter] != 42} {
+    error "incr of a set value is wrong"
+}
+if {[::nx::key append counter abc] != 5 || [::nx::key get counter] ne "42abc"} {
+    error "append is wrong"
+}
+if {![catch {::nx::key incr counter}]} {
+    error "incr of a string must fail"
+}
+::nx::key unset counter
+
+::nx::key set -ttl 1 expiring {gone soon}
+if {![::nx::key exists expiring]} {
+    error "this key has not expired yet"
+}
+after 1100
+if {[::nx::key exists expiring] || [lsearch -exact [::nx::key list] expiring] != -1} {
+    error "this key has expired"
+}
+
 ::nx::key set leak1 {blah blah}
 ::nx::key set leak2 {blah blah}
+
+# Touch
+set touchDir [file join [pwd] touchtest]
+file delete -force $touchDir
+foreach dir {a a/b a/b/c d} {
+    file mkdir [file join $touchDir $dir]
+    close [open [file join $touchDir $dir file.txt] w]
+}
+close [open [file join $touchDir .ioFTPD] w]
+file mtime [file join $touchDir .ioFTPD] 1000
+
+::nx::touch -recurse $touchDir 1200000000
+foreach path [glob -directory $touchDir -type {d f} * */* */*/* */*/*/*] {
+    if {[file mtime $path] != 1200000000} {
+        error "\"$path\" was not touched"
+    }
+}
+if {[file mtime [file join $touchDir .ioFTPD]] != 1000} {
+    error ".ioFTPD files must not be touched"
+}
+
+::nx::touch -atime [file join $touchDir a file.txt] 1300000000
+if {[file atime [file join $touchDir a file.txt]] != 1300000000 ||
+        [file mtime [file join $touchDir a file.txt]] != 1200000000} {
+    error "only the access time must be touched"
+}
+
+if {$tcl_platform(platform) ne "windows"} {
+    # Links are touched but not followed.
+    file link -symbolic [file join $touchDir link] [file join $touchDir a]
+    ::nx::touch -recurse -threads 4 -stats stats $touchDir 1400000000
+    if {$stats(dirs) != 5 || $stats(files) != 4 || $stats(links) != 1 || $stats(errors) != 0} {
+        error "stats are wrong: [array get stats]"
+    }
+    if {[file mtime [file join $touchDir a b c file.txt]] != 1400000000} {
+        error "the tree was not touched"
+    }
+    ::nx::touch [file join $touchDir link] 1500000000
+    if {[file mtime [file join $touchDir a]] != 1400000000} {
+        error "the link's target must not be touched"
+    }
+    if {![catch {::nx::touch -ctime $touchDir}]} {
+        error "the change time cannot be set on its own"
+    }
+    unset stats
+}
+file delete -force $touchDir
+unset touchDir
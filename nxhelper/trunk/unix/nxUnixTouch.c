@@ -0,0 +1,759 @@
+/*
+ * nxHelper - Tcl extension for nxTools.
+ * Copyright (c) 2004-2008 neoxed
+ *
+ * File Name:
+ *   nxUnixTouch.c
+ *
+ * Abstract:
+ *   Implements the "::nx::touch" command on POSIX systems, see nxTouch.c for
+ *   the Windows version.
+ *
+ *   A recursive touch is made by a pool of walker threads. Each directory is
+ *   opened relative to its parent's descriptor and every entry is touched
+ *   relative to it, so paths are never built. Walkers take directories from
+ *   the end of their own queue and steal from the start of the others'. Once
+ *   too many directories are queued, a walker descends into them itself, so
+ *   wide trees do not run out of descriptors.
+ *
+ *   As on Windows, ".ioFTPD" files are not touched and symbolic links are
+ *   touched but not followed. The change time cannot be set on POSIX systems,
+ *   "-ctime" is only accepted with "-atime" or "-mtime", which update it as a
+ *   side effect.
+ *
+ *   Tcl Commands:
+ *     ::nx::touch [switches] <path> [clockVal]
+ *       - If no time attributes are specified, all attributes are set.
+ *       - If "clockVal" is not specified, the current time is used.
+ *       - An error is raised if the time cannot be changed on the path itself;
+ *         entries below it that cannot be touched are counted in "-stats".
+ *       - Switches:
+ *         -atime    = Set file last-access time.
+ *         -ctime    = Set file change time, see above.
+ *         -mtime    = Set file modification time.
+ *         -recurse  = Recursively touch all files and directories.
+ *         -threads  = Number of walker threads, defaults to the number of processors.
+ *         -progress = Script evaluated about every second while recursing, with
+ *                     the number of directories and files touched so far appended.
+ *         -stats    = Name of an array variable to receive the number of "dirs",
+ *                     "files", "links", and "errors", the "elapsed" milliseconds,
+ *                     the "rate" of entries touched per second, and the first
+ *                     "error" message (empty if there were none).
+ *         --        = End of switches.
+ */
+
+#include <nxHelper.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TOUCH_MAX_THREADS   64      /* Maximum number of walker threads. */
+#define TOUCH_MAX_QUEUED    256     /* Directories queued before walkers descend themselves. */
+#define TOUCH_PROGRESS_MS   1000    /* Milliseconds between progress scripts. */
+
+typedef enum {
+    TOUCH_FLAG_ATIME   = 0x00000001,
+    TOUCH_FLAG_MTIME   = 0x00000002,
+    TOUCH_FLAG_CTIME   = 0x00000004,
+    TOUCH_FLAG_RECURSE = 0x00000010
+} TOUCH_FLAGS;
+
+typedef struct TouchPool TouchPool;
+
+typedef struct {
+    Tcl_Mutex mutex;        /* Mutex protecting the queue. */
+    int *fds;               /* Queued directory descriptors. */
+    int head;               /* Index of the first queued directory, stolen by other walkers. */
+    int tail;               /* Index past the last queued directory, taken by this walker. */
+    int size;               /* Number of descriptors allocated. */
+    long dirs;              /* Directories touched. */
+    long files;             /* Files touched. */
+    long links;             /* Symbolic links touched. */
+    long errors;            /* Entries that could not be touched or opened. */
+    TouchPool *pool;        /* Pool this walker belongs to. */
+    Tcl_ThreadId threadId;  /* Walker thread. */
+} TouchWalker;
+
+struct TouchPool {
+    struct timespec times[2];   /* Access and modification times to set. */
+    TouchWalker *walkers;       /* Array of walkers. */
+    int count;                  /* Number of walkers. */
+    volatile int idle;          /* Walkers waiting for work. */
+    volatile int stop;          /* Walkers must exit, set once no work is pending or on abort. */
+    volatile long pending;      /* Directories queued or being walked. */
+    volatile long queued;       /* Directories queued. */
+    volatile int firstError;    /* First error code, zero if none. */
+    char firstName[256];        /* Name of the entry with the first error. */
+    Tcl_Mutex mutex;            /* Mutex protecting the idle, stop, and error members. */
+    Tcl_Condition workCond;     /* Signalled when a directory is queued or the walk stops. */
+    Tcl_Condition doneCond;     /* Signalled when the walk stops. */
+};
+
+
+/*
+ * TouchGetTime
+ *
+ *   Retrieves the current time.
+ *
+ * Arguments:
+ *   None.
+ *
+ * Returns:
+ *   The time in milliseconds.
+ */
+static Tcl_WideInt
+TouchGetTime(
+    void
+    )
+{
+    Tcl_Time now;
+
+    Tcl_GetTime(&now);
+    return ((Tcl_WideInt)now.sec * 1000) + (now.usec / 1000);
+}
+
+/*
+ * TouchError
+ *
+ *   Counts an entry that could not be touched, and remembers the first.
+ *
+ * Arguments:
+ *   walker - Walker the error occurred on.
+ *   name   - Name of the entry.
+ *   error  - Error code.
+ *
+ * Returns:
+ *   None.
+ */
+static void
+TouchError(
+    TouchWalker *walker,
+    const char *name,
+    int error
+    )
+{
+    TouchPool *pool = walker->pool;
+
+    walker->errors++;
+
+    if (pool->firstError == 0) {
+        Tcl_MutexLock(&pool->mutex);
+        if (pool->firstError == 0) {
+            pool->firstError = error;
+            strncpy(pool->firstName, name, sizeof(pool->firstName) - 1);
+        }
+        Tcl_MutexUnlock(&pool->mutex);
+    }
+}
+
+/*
+ * TouchPush
+ *
+ *   Queues a directory on a walker.
+ *
+ * Arguments:
+ *   walker - Walker to queue the directory on.
+ *   fd     - Descriptor of the directory, owned by the queue.
+ *
+ * Returns:
+ *   None.
+ */
+static void
+TouchPush(
+    TouchWalker *walker,
+    int fd
+    )
+{
+    TouchPool *pool = walker->pool;
+
+    __sync_add_and_fetch(&pool->pending, 1);
+    __sync_add_and_fetch(&pool->queued, 1);
+
+    Tcl_MutexLock(&walker->mutex);
+    if (walker->tail == walker->size) {
+        /* Move the queue to the start before growing it. */
+        if (walker->head > 0) {
+            memmove(walker->fds, walker->fds + walker->head,
+                (walker->tail - walker->head) * sizeof(int));
+            walker->tail -= walker->head;
+            walker->head = 0;
+        } else {
+            walker->size = (walker->size > 0) ? walker->size * 2 : 64;
+            walker->fds = (int *)ckrealloc((char *)walker->fds, walker->size * sizeof(int));
+        }
+    }
+    walker->fds[walker->tail++] = fd;
+    Tcl_MutexUnlock(&walker->mutex);
+
+    /* Wake an idle walker to steal it. */
+    if (pool->idle > 0) {
+        Tcl_MutexLock(&pool->mutex);
+        Tcl_ConditionNotify(&pool->workCond);
+        Tcl_MutexUnlock(&pool->mutex);
+    }
+}
+
+/*
+ * TouchPop
+ *
+ *   Takes the last directory queued on a walker, or steals the first
+ *   directory queued on another walker.
+ *
+ * Arguments:
+ *   walker - Walker looking for work.
+ *
+ * Returns:
+ *   A directory descriptor, or -1 if no directories are queued.
+ */
+static int
+TouchPop(
+    TouchWalker *walker
+    )
+{
+    int fd = -1;
+    int i;
+    TouchPool *pool = walker->pool;
+    TouchWalker *victim;
+
+    Tcl_MutexLock(&walker->mutex);
+    if (walker->tail > walker->head) {
+        fd = walker->fds[--walker->tail];
+    }
+    Tcl_MutexUnlock(&walker->mutex);
+
+    /* Steal the oldest, and likely largest, directory from another walker. */
+    for (i = 1; fd == -1 && i < pool->count; i++) {
+        victim = &pool->walkers[(walker - pool->walkers + i) % pool->count];
+
+        if (victim->tail > victim->head) {
+            Tcl_MutexLock(&victim->mutex);
+            if (victim->tail > victim->head) {
+                fd = victim->fds[victim->head++];
+            }
+            Tcl_MutexUnlock(&victim->mutex);
+        }
+    }
+
+    if (fd != -1) {
+        __sync_sub_and_fetch(&pool->queued, 1);
+    }
+    return fd;
+}
+
+/*
+ * TouchWalk
+ *
+ *   Touches a directory and its entries, queueing its subdirectories.
+ *
+ * Arguments:
+ *   walker - Walker touching the directory.
+ *   fd     - Descriptor of the directory, closed by this function.
+ *
+ * Returns:
+ *   None.
+ */
+static void
+TouchWalk(
+    TouchWalker *walker,
+    int fd
+    )
+{
+    int childFd;
+    int dirFd;
+    unsigned char type;
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    TouchPool *pool = walker->pool;
+
+    /* Touch the directory we're entering. */
+    if (futimens(fd, pool->times) == 0) {
+        walker->dirs++;
+    } else {
+        TouchError(walker, ".", errno);
+    }
+
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+        TouchError(walker, ".", errno);
+        close(fd);
+        return;
+    }
+    dirFd = dirfd(dir);
+
+    while (!pool->stop && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' ||
+                (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+
+        type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            /* Some file systems do not return the type. */
+            if (fstatat(dirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                TouchError(walker, entry->d_name, errno);
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+        }
+
+        if (type == DT_LNK) {
+            /* Touch the link, but do not follow it (avoid possible infinite loops). */
+            if (utimensat(dirFd, entry->d_name, pool->times, AT_SYMLINK_NOFOLLOW) == 0) {
+                walker->links++;
+            } else {
+                TouchError(walker, entry->d_name, errno);
+            }
+
+        } else if (type == DT_DIR) {
+            childFd = openat(dirFd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (childFd == -1) {
+                TouchError(walker, entry->d_name, errno);
+            } else if (pool->queued < TOUCH_MAX_QUEUED) {
+                TouchPush(walker, childFd);
+            } else {
+                /* Enough work is queued, descend into this one directly. */
+                TouchWalk(walker, childFd);
+            }
+
+        } else if (strncasecmp(entry->d_name, ".ioFTPD", 7) != 0) {
+            /* Touch the file. */
+            if (utimensat(dirFd, entry->d_name, pool->times, AT_SYMLINK_NOFOLLOW) == 0) {
+                walker->files++;
+            } else {
+                TouchError(walker, entry->d_name, errno);
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+/*
+ * TouchRun
+ *
+ *   Touches queued directories until no more are pending.
+ *
+ * Arguments:
+ *   walker - Walker to run.
+ *
+ * Returns:
+ *   None.
+ */
+static void
+TouchRun(
+    TouchWalker *walker
+    )
+{
+    int fd;
+    Tcl_Time wait = {0, 1000};
+    TouchPool *pool = walker->pool;
+
+    while (!pool->stop) {
+        fd = TouchPop(walker);
+        if (fd != -1) {
+            TouchWalk(walker, fd);
+
+            /* The last walker to finish stops the pool. */
+            if (__sync_sub_and_fetch(&pool->pending, 1) == 0) {
+                Tcl_MutexLock(&pool->mutex);
+                pool->stop = 1;
+                Tcl_ConditionNotify(&pool->workCond);
+                Tcl_ConditionNotify(&pool->doneCond);
+                Tcl_MutexUnlock(&pool->mutex);
+            }
+            continue;
+        }
+
+        /* Nothing to take or steal, wait for another walker to queue more. */
+        Tcl_MutexLock(&pool->mutex);
+        if (!pool->stop) {
+            pool->idle++;
+            Tcl_ConditionWait(&pool->workCond, &pool->mutex, &wait);
+            pool->idle--;
+        }
+        Tcl_MutexUnlock(&pool->mutex);
+    }
+
+    /* Wake the other walkers, the notification only reaches one. */
+    Tcl_MutexLock(&pool->mutex);
+    Tcl_ConditionNotify(&pool->workCond);
+    Tcl_MutexUnlock(&pool->mutex);
+}
+
+/*
+ * TouchThread
+ *
+ *   Walker thread.
+ *
+ * Arguments:
+ *   clientData - Walker structure.
+ *
+ * Returns:
+ *   None.
+ */
+static Tcl_ThreadCreateType
+TouchThread(
+    ClientData clientData
+    )
+{
+    TouchRun((TouchWalker *)clientData);
+
+    Tcl_ExitThread(0);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * TouchProgress
+ *
+ *   Evaluates the progress script.
+ *
+ * Arguments:
+ *   interp    - Current interpreter.
+ *   scriptObj - Progress script.
+ *   pool      - Pool of walkers.
+ *
+ * Returns:
+ *   A standard Tcl result.
+ */
+static int
+TouchProgress(
+    Tcl_Interp *interp,
+    Tcl_Obj *scriptObj,
+    TouchPool *pool
+    )
+{
+    int i;
+    int result;
+    long dirs = 0;
+    long files = 0;
+    Tcl_Obj *commandObj;
+
+    for (i = 0; i < pool->count; i++) {
+        dirs  += pool->walkers[i].dirs;
+        files += pool->walkers[i].files;
+    }
+
+    commandObj = Tcl_DuplicateObj(scriptObj);
+    Tcl_IncrRefCount(commandObj);
+    Tcl_ListObjAppendElement(NULL, commandObj, Tcl_NewLongObj(dirs));
+    Tcl_ListObjAppendElement(NULL, commandObj, Tcl_NewLongObj(files));
+
+    result = Tcl_EvalObjEx(interp, commandObj, TCL_EVAL_GLOBAL);
+    Tcl_DecrRefCount(commandObj);
+    return result;
+}
+
+/*
+ * RecursiveTouch
+ *
+ *   Touches a directory tree with a pool of walker threads.
+ *
+ * Arguments:
+ *   interp      - Current interpreter.
+ *   fd          - Descriptor of the top directory, closed by this function.
+ *   times       - Access and modification times to set.
+ *   threads     - Number of walker threads.
+ *   progressObj - Progress script, NULL if none.
+ *   statsName   - Statistics array variable name, NULL if none.
+ *
+ * Returns:
+ *   A standard Tcl result.
+ */
+static int
+RecursiveTouch(
+    Tcl_Interp *interp,
+    int fd,
+    struct timespec *times,
+    int threads,
+    Tcl_Obj *progressObj,
+    const char *statsName
+    )
+{
+    int i;
+    int result = TCL_OK;
+    long dirs = 0;
+    long errors = 0;
+    long files = 0;
+    long links = 0;
+    Tcl_Obj *errorObj;
+    Tcl_Time wait;
+    Tcl_WideInt elapsed;
+    Tcl_WideInt next;
+    Tcl_WideInt now;
+    Tcl_WideInt start;
+    TouchPool pool;
+
+    memset(&pool, 0, sizeof(TouchPool));
+    pool.times[0] = times[0];
+    pool.times[1] = times[1];
+    pool.count    = threads;
+    pool.walkers  = (TouchWalker *)ckalloc(threads * sizeof(TouchWalker));
+    memset(pool.walkers, 0, threads * sizeof(TouchWalker));
+
+    for (i = 0; i < threads; i++) {
+        pool.walkers[i].pool = &pool;
+    }
+    TouchPush(&pool.walkers[0], fd);
+
+    start = TouchGetTime();
+    next  = start + TOUCH_PROGRESS_MS;
+
+    /*
+     * The walker count is not changed once a thread runs. Walkers without a
+     * thread keep their queue, which the running walkers steal from.
+     */
+    for (i = 0; i < threads; i++) {
+        if (Tcl_CreateThread(&pool.walkers[i].threadId, TouchThread, &pool.walkers[i],
+                TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+            pool.walkers[i].threadId = NULL;
+            break;
+        }
+    }
+    if (i == 0) {
+        /* Walk the tree on this thread. */
+        TouchRun(&pool.walkers[0]);
+    }
+
+    /* Wait for the walkers, evaluating the progress script in between. */
+    Tcl_MutexLock(&pool.mutex);
+    while (!pool.stop) {
+        now = TouchGetTime();
+        if (progressObj != NULL && now >= next) {
+            Tcl_MutexUnlock(&pool.mutex);
+            result = TouchProgress(interp, progressObj, &pool);
+            Tcl_MutexLock(&pool.mutex);
+
+            if (result != TCL_OK) {
+                /* Abort the walk, queued directories are closed below. */
+                pool.stop = 1;
+                Tcl_ConditionNotify(&pool.workCond);
+                break;
+            }
+            next = now + TOUCH_PROGRESS_MS;
+            continue;
+        }
+
+        wait.sec  = (long)((next - now) / 1000);
+        wait.usec = (long)((next - now) % 1000) * 1000;
+        Tcl_ConditionWait(&pool.doneCond, &pool.mutex, (progressObj != NULL) ? &wait : NULL);
+    }
+    Tcl_MutexUnlock(&pool.mutex);
+
+    for (i = 0; i < threads && pool.walkers[i].threadId != NULL; i++) {
+        Tcl_JoinThread(pool.walkers[i].threadId, NULL);
+    }
+    elapsed = TouchGetTime() - start;
+
+    for (i = 0; i < threads; i++) {
+        while (pool.walkers[i].tail > pool.walkers[i].head) {
+            close(pool.walkers[i].fds[--pool.walkers[i].tail]);
+        }
+        if (pool.walkers[i].fds != NULL) {
+            ckfree((char *)pool.walkers[i].fds);
+        }
+        Tcl_MutexFinalize(&pool.walkers[i].mutex);
+
+        dirs   += pool.walkers[i].dirs;
+        files  += pool.walkers[i].files;
+        links  += pool.walkers[i].links;
+        errors += pool.walkers[i].errors;
+    }
+    ckfree((char *)pool.walkers);
+
+    Tcl_ConditionFinalize(&pool.workCond);
+    Tcl_ConditionFinalize(&pool.doneCond);
+    Tcl_MutexFinalize(&pool.mutex);
+
+    if (result == TCL_OK && statsName != NULL) {
+        errorObj = Tcl_NewObj();
+        if (pool.firstError != 0) {
+            Tcl_AppendStringsToObj(errorObj, pool.firstName, ": ",
+                Tcl_ErrnoMsg(pool.firstError), NULL);
+        }
+
+        if (Tcl_SetVar2Ex(interp, statsName, "dirs",    Tcl_NewLongObj(dirs),   TCL_LEAVE_ERR_MSG) == NULL ||
+            Tcl_SetVar2Ex(interp, statsName, "files",   Tcl_NewLongObj(files),  TCL_LEAVE_ERR_MSG) == NULL ||
+            Tcl_SetVar2Ex(interp, statsName, "links",   Tcl_NewLongObj(links),  TCL_LEAVE_ERR_MSG) == NULL ||
+            Tcl_SetVar2Ex(interp, statsName, "errors",  Tcl_NewLongObj(errors), TCL_LEAVE_ERR_MSG) == NULL ||
+            Tcl_SetVar2Ex(interp, statsName, "elapsed", Tcl_NewWideIntObj(elapsed), TCL_LEAVE_ERR_MSG) == NULL ||
+            Tcl_SetVar2Ex(interp, statsName, "rate",
+                Tcl_NewWideIntObj(((Tcl_WideInt)(dirs + files + links) * 1000) / ((elapsed > 0) ? elapsed : 1)),
+                TCL_LEAVE_ERR_MSG) == NULL ||
+            Tcl_SetVar2Ex(interp, statsName, "error",   errorObj, TCL_LEAVE_ERR_MSG) == NULL) {
+            result = TCL_ERROR;
+        }
+    }
+    return result;
+}
+
+/*
+ * TouchObjCmd
+ *
+ *   This function provides the "::nx::touch" Tcl command.
+ *
+ * Arguments:
+ *   dummy  - Not used.
+ *   interp - Current interpreter.
+ *   objc   - Number of arguments.
+ *   objv   - Argument objects.
+ *
+ * Returns:
+ *   A standard Tcl result.
+ */
+int
+TouchObjCmd(
+    ClientData dummy,
+    Tcl_Interp *interp,
+    int objc,
+    Tcl_Obj *CONST objv[]
+    )
+{
+    const char      *filePath;
+    const char      *statsName = NULL;
+    int             fd;
+    int             i;
+    int             threads;
+    long            clockVal;
+    struct stat     st;
+    struct timespec times[2];
+    Tcl_Obj         *progressObj = NULL;
+    TOUCH_FLAGS     options = 0;
+    const static char *switches[] = {
+        "-atime", "-ctime", "-mtime", "-progress", "-recurse", "-stats", "-threads", "--", NULL
+    };
+    enum switchIndices {
+        OPTION_ATIME, OPTION_CTIME, OPTION_MTIME, OPTION_PROGRESS,
+        OPTION_RECURSE, OPTION_STATS, OPTION_THREADS, OPTION_LAST
+    };
+
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?switches? path ?clockVal?");
+        return TCL_ERROR;
+    }
+
+    for (i = 1; i < objc; i++) {
+        char *name;
+        int index;
+
+        name = Tcl_GetString(objv[i]);
+        if (name[0] != '-') {
+            break;
+        }
+        if (Tcl_GetIndexFromObj(interp, objv[i], switches, "switch", TCL_EXACT, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+
+        switch ((enum switchIndices) index) {
+            case OPTION_ATIME: {
+                options |= TOUCH_FLAG_ATIME;
+                break;
+            }
+            case OPTION_CTIME: {
+                options |= TOUCH_FLAG_CTIME;
+                break;
+            }
+            case OPTION_MTIME: {
+                options |= TOUCH_FLAG_MTIME;
+                break;
+            }
+            case OPTION_RECURSE: {
+                options |= TOUCH_FLAG_RECURSE;
+                break;
+            }
+            case OPTION_PROGRESS:
+            case OPTION_STATS:
+            case OPTION_THREADS: {
+                if (++i >= objc) {
+                    Tcl_AppendResult(interp, "missing value for \"", name, "\" switch", NULL);
+                    return TCL_ERROR;
+                }
+                if (index == OPTION_PROGRESS) {
+                    progressObj = objv[i];
+                } else if (index == OPTION_STATS) {
+                    statsName = Tcl_GetString(objv[i]);
+                } else if (Tcl_GetIntFromObj(interp, objv[i], &threads) != TCL_OK) {
+                    return TCL_ERROR;
+                } else if (threads < 1 || threads > TOUCH_MAX_THREADS) {
+                    Tcl_AppendResult(interp, "thread count must be from 1 to ",
+                        STRINGIFY(TOUCH_MAX_THREADS), NULL);
+                    return TCL_ERROR;
+                }
+                break;
+            }
+            case OPTION_LAST: {
+                i++;
+                goto endOfForLoop;
+            }
+            default: {
+                /* This point is never reached. */
+                assert(0);
+                return TCL_ERROR;
+            }
+        }
+    }
+
+    endOfForLoop:
+    objc -= i;
+    if (objc < 1 || objc > 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?switches? path ?clockVal?");
+        return TCL_ERROR;
+    }
+
+    /* Validate the file or directory's existence. */
+    filePath = Tcl_FSGetNativePath(objv[i]);
+    if (filePath == NULL || lstat(filePath, &st) != 0) {
+        Tcl_AppendResult(interp, "unable to touch \"", Tcl_GetString(objv[i]),
+            "\": no such file or directory", NULL);
+        return TCL_ERROR;
+    }
+
+    if (objc == 2) {
+        if (Tcl_GetLongFromObj(interp, objv[i+1], &clockVal) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        times[0].tv_sec  = (time_t)clockVal;
+        times[0].tv_nsec = 0;
+    } else {
+        times[0].tv_sec  = 0;
+        times[0].tv_nsec = UTIME_NOW;
+    }
+    times[1] = times[0];
+
+    /* If no file times are specified, then all times are implied. */
+    if (!(options & (TOUCH_FLAG_ATIME | TOUCH_FLAG_CTIME | TOUCH_FLAG_MTIME))) {
+        options |= (TOUCH_FLAG_ATIME | TOUCH_FLAG_CTIME | TOUCH_FLAG_MTIME);
+    } else if (!(options & (TOUCH_FLAG_ATIME | TOUCH_FLAG_MTIME))) {
+        Tcl_SetResult(interp, "the change time cannot be set on its own: "
+            "specify \"-atime\" or \"-mtime\" as well", TCL_STATIC);
+        return TCL_ERROR;
+    }
+    if (!(options & TOUCH_FLAG_ATIME)) {
+        times[0].tv_nsec = UTIME_OMIT;
+    }
+    if (!(options & TOUCH_FLAG_MTIME)) {
+        times[1].tv_nsec = UTIME_OMIT;
+    }
+
+    if (S_ISDIR(st.st_mode) && (options & TOUCH_FLAG_RECURSE)) {
+        fd = open(filePath, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd != -1) {
+            return RecursiveTouch(interp, fd, times, threads, progressObj, statsName);
+        }
+    } else if (utimensat(AT_FDCWD, filePath, times, AT_SYMLINK_NOFOLLOW) == 0) {
+        return TCL_OK;
+    }
+
+    Tcl_SetErrno(errno);
+    Tcl_AppendResult(interp, "unable to touch \"", Tcl_GetString(objv[i]), "\": ",
+        Tcl_PosixError(interp), NULL);
+    return TCL_ERROR;
+}
@@ -0,0 +1,463 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    User Cache Benchmark
+
+Abstract:
+    Measures user opens during a login storm against a local MySQL or MariaDB
+    server. Worker threads open users the way UserOpen() does, most of them
+    from a small set of active users, and write some of them back. A sync
+    thread runs the incremental synchronization the way SyncTimer() does,
+    after another "server" changed a few users directly in the database.
+
+    The "database" pass reads every user from the database. The "cached" pass
+    creates the user cache, so opens are served from memory between
+    synchronizations. After the cached pass, every user still cached is
+    compared with the same user read from the database.
+
+    The database must already contain the tables from schema.sql. All users
+    in it are deleted.
+
+    Usage:
+      cachebench [-h host] [-P port] [-u user] [-p password] [-d database]
+                 [-n users] [-o opens] [-t threads] [-a active-users]
+                 [-w write-every] [-s sync-ms] [-r remote-writes] [-c cache-size]
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <database.h>
+#include <procstub.h>
+
+#define GROUP_COUNT  10
+#define THREAD_MAX   64
+
+typedef struct {
+    DB_CONTEXT  db;         // Connection used by the thread
+    INT         index;      // Thread index
+    INT         reads;      // Opens read from the database
+    INT         writes;     // Writes performed
+    INT         failures;   // Calls that failed
+    UINT        seed;       // Random number seed
+    float       *samples;   // Latency of each open, in microseconds
+} WORKER;
+
+static CHAR     *dbHost     = "localhost";
+static CHAR     *dbUser     = "root";
+static CHAR     *dbPassword = NULL;
+static CHAR     *dbDatabase = "ioftpd";
+static INT      dbPort      = 0;
+
+static INT      activeCount  = 50;
+static INT      cacheSize    = 0;
+static INT      openCount    = 5000;
+static INT      remoteWrites = 5;
+static INT      syncMs       = 200;
+static INT      threadCount  = 8;
+static INT      userCount    = 1000;
+static INT      writeEvery   = 20;
+
+static DB_SYNC       dbSync;
+static volatile BOOL stopSync;
+static INT           syncCount;
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static INT CompareFloat(const VOID *elem1, const VOID *elem2)
+{
+    float value1 = *(const float *)elem1;
+    float value2 = *(const float *)elem2;
+
+    return (value1 > value2) - (value1 < value2);
+}
+
+static BOOL Connect(DB_CONTEXT *db)
+{
+    ZeroMemory(db, sizeof(DB_CONTEXT));
+
+    db->handle = mysql_init(NULL);
+    if (mysql_real_connect(db->handle, dbHost, dbUser, dbPassword, dbDatabase, dbPort, NULL, 0) == NULL) {
+        fprintf(stderr, "Unable to connect: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+    db->threadId = mysql_thread_id(db->handle);
+    return TRUE;
+}
+
+static VOID Disconnect(DB_CONTEXT *db)
+{
+    DbStmtFlush(db);
+    mysql_close(db->handle);
+}
+
+static BOOL Populate(DB_CONTEXT *db)
+{
+    CHAR        groupName[_MAX_NAME + 1];
+    CHAR        userName[_MAX_NAME + 1];
+    DWORD       error;
+    INT         i;
+    USERFILE    userFile;
+
+    if (mysql_query(db->handle, "DELETE FROM io_user") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_admins") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_groups") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_hosts") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_changes") != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+
+    for (i = 0; i < userCount; i++) {
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "user%05d", i);
+        StringCchPrintfA(groupName, ELEMENT_COUNT(groupName), "group%d", i % GROUP_COUNT);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        userFile.Gid            = ProcStubAddGroup(groupName);
+        userFile.Groups[0]      = userFile.Gid;
+        userFile.Groups[1]      = INVALID_GROUP;
+        userFile.AdminGroups[0] = INVALID_GROUP;
+        StringCchCopyA(userFile.Tagline, ELEMENT_COUNT(userFile.Tagline), "Tagline");
+        StringCchCopyA(userFile.Flags, ELEMENT_COUNT(userFile.Flags), "3");
+        StringCchCopyA(userFile.Home, ELEMENT_COUNT(userFile.Home), "/");
+        StringCchPrintfA(userFile.Ip[0], ELEMENT_COUNT(userFile.Ip[0]), "*@10.0.%d.%d", (i >> 8) & 255, i & 255);
+
+        error = DbUserCreate(db, userName, &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create user \"%s\" (error %lu).\n", userName, (unsigned long)error);
+            return FALSE;
+        }
+
+        // Synchronization updates the users ioFTPD knows
+        ProcStubAddUser(userName);
+    }
+
+    // The created users are already known, skip their changes
+    if (mysql_query(db->handle, "DELETE FROM io_user_changes") != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL OpenUser(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile, INT *reads)
+{
+    // Same order as UserOpen()
+    if (DbUserCacheOpen(userName, userFile)) {
+        return TRUE;
+    }
+
+    (*reads)++;
+    return (DbUserOpen(db, userName, userFile) == ERROR_SUCCESS);
+}
+
+static VOID SyncOnce(DB_CONTEXT *db)
+{
+    LONG version;
+
+    // Same order as SyncTimer()
+    DbUserStatsFlush(db, NULL);
+
+    version = CacheVersion(&dbUserCache);
+    dbSync.currUpdate = (ULONG)time(NULL);
+
+    if (DbUserSync(db, &dbSync) == ERROR_SUCCESS) {
+        CacheSynced(&dbUserCache, version);
+        dbSync.prevUpdate = dbSync.currUpdate;
+    }
+    syncCount++;
+}
+
+static VOID *SyncThread(VOID *argument)
+{
+    CHAR        query[128];
+    DB_CONTEXT  *db = argument;
+    INT         i;
+    UINT        seed = 12345;
+
+    mysql_thread_init();
+
+    while (!stopSync) {
+        usleep(syncMs * 1000);
+
+        // Another server changes a few of the active users
+        for (i = 0; i < remoteWrites; i++) {
+            StringCchPrintfA(query, ELEMENT_COUNT(query),
+                "UPDATE io_user SET description='Remote %d', updated=UNIX_TIMESTAMP()"
+                "  WHERE name='user%05d'", rand_r(&seed), rand_r(&seed) % activeCount);
+
+            if (mysql_query(db->handle, query) != 0) {
+                fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+            }
+        }
+
+        SyncOnce(db);
+    }
+
+    mysql_thread_end();
+    return NULL;
+}
+
+static VOID *WorkerThread(VOID *argument)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    INT         i;
+    INT         user;
+    USERFILE    userFile;
+    WORKER      *worker = argument;
+    double      start;
+
+    mysql_thread_init();
+
+    for (i = 0; i < openCount; i++) {
+        // Nine of ten logins are by an active user
+        if (rand_r(&worker->seed) % 10 != 0) {
+            user = rand_r(&worker->seed) % activeCount;
+        } else {
+            user = rand_r(&worker->seed) % userCount;
+        }
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "user%05d", user);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        start = TimeNow();
+        if (!OpenUser(&worker->db, userName, &userFile, &worker->reads)) {
+            worker->samples[i] = (float)((TimeNow() - start) * 1e6);
+            worker->failures++;
+            continue;
+        }
+        worker->samples[i] = (float)((TimeNow() - start) * 1e6);
+
+        if (writeEvery > 0 && i % writeEvery == 0) {
+            userFile.LogonCount++;
+            userFile.LogonLast = time(NULL);
+            userFile.AllUp[0] += 1024;
+            StringCchPrintfA(userFile.LogonHost, ELEMENT_COUNT(userFile.LogonHost), "10.1.%d.%d", worker->index, i & 255);
+
+            if (DbUserWrite(&worker->db, userName, &userFile) != ERROR_SUCCESS) {
+                worker->failures++;
+            }
+            worker->writes++;
+        }
+    }
+
+    mysql_thread_end();
+    return NULL;
+}
+
+static INT Verify(DB_CONTEXT *db, INT *compared)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    INT         i;
+    INT         stale = 0;
+    USERFILE    cached;
+    USERFILE    stored;
+
+    *compared = 0;
+    for (i = 0; i < userCount; i++) {
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "user%05d", i);
+
+        ZeroMemory(&cached, sizeof(USERFILE));
+        if (!DbUserCacheOpen(userName, &cached)) {
+            continue;
+        }
+
+        ZeroMemory(&stored, sizeof(USERFILE));
+        if (DbUserOpen(db, userName, &stored) != ERROR_SUCCESS) {
+            stale++;
+            continue;
+        }
+
+        (*compared)++;
+        if (memcmp(&cached, &stored, offsetof(USERFILE, lpInternal)) != 0) {
+            if (stale == 0) {
+                fprintf(stderr, "User \"%s\" differs from the database (tagline \"%s\", \"%s\").\n",
+                    userName, cached.Tagline, stored.Tagline);
+            }
+            stale++;
+        }
+    }
+    return stale;
+}
+
+static BOOL RunPass(const CHAR *passName, BOOL cached)
+{
+    CACHE_COUNTERS  counters;
+    DB_CONTEXT      syncDb;
+    DWORD           error;
+    INT             compared;
+    INT             failures;
+    INT             i;
+    INT             opens;
+    INT             reads;
+    INT             stale;
+    INT             writes;
+    LONG            lookups;
+    float           *samples;
+    double          elapsed;
+    double          start;
+    pthread_t       syncThread;
+    pthread_t       threads[THREAD_MAX];
+    WORKER          workers[THREAD_MAX];
+
+    if (cached) {
+        error = CacheCreate(&dbUserCache, offsetof(USERFILE, lpInternal), cacheSize, syncMs * 2);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create cache (error %lu).\n", (unsigned long)error);
+            return FALSE;
+        }
+    }
+
+    if (!Connect(&syncDb)) {
+        return FALSE;
+    }
+    ZeroMemory(&dbSync, sizeof(DB_SYNC));
+    dbSync.prevUpdate = (ULONG)time(NULL);
+    syncCount = 0;
+    stopSync  = FALSE;
+
+    opens   = threadCount * openCount;
+    samples = malloc(sizeof(float) * opens);
+    ZeroMemory(workers, sizeof(workers));
+
+    for (i = 0; i < threadCount; i++) {
+        if (!Connect(&workers[i].db)) {
+            return FALSE;
+        }
+        workers[i].index   = i;
+        workers[i].seed    = i + 1;
+        workers[i].samples = samples + i * openCount;
+    }
+
+    start = TimeNow();
+    pthread_create(&syncThread, NULL, SyncThread, &syncDb);
+    for (i = 0; i < threadCount; i++) {
+        pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = TimeNow() - start;
+
+    stopSync = TRUE;
+    pthread_join(syncThread, NULL);
+
+    failures = reads = writes = 0;
+    for (i = 0; i < threadCount; i++) {
+        failures += workers[i].failures;
+        reads    += workers[i].reads;
+        writes   += workers[i].writes;
+    }
+    qsort(samples, opens, sizeof(float), CompareFloat);
+
+    printf("%s: %d opens in %.1f ms, %.0f opens/s, %d failures\n",
+        passName, opens, elapsed * 1000.0, opens / elapsed, failures);
+    printf("  open us:     p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f\n",
+        samples[opens / 2], samples[(opens * 90) / 100], samples[(opens * 99) / 100], samples[opens - 1]);
+    printf("  database:    %d user reads (%.1f%% of opens), %d writes, %d synchronizations\n",
+        reads, 100.0 * reads / opens, writes, syncCount);
+
+    if (cached) {
+        CacheGetCounters(&dbUserCache, &counters);
+        lookups = counters.hits + counters.misses + counters.expired;
+
+        printf("  cache:       %d hits, %d misses, %d expired (%.1f%% hit rate), %d updates, %d invalidations, %d evictions\n",
+            counters.hits, counters.misses, counters.expired, lookups ? 100.0 * counters.hits / lookups : 0.0,
+            counters.updates, counters.invalidations, counters.evictions);
+
+        // Read the last changes, then compare the cache with the database
+        SyncOnce(&syncDb);
+        stale = Verify(&syncDb, &compared);
+        printf("  consistency: %d cached users compared with the database, %d differ\n", compared, stale);
+
+        CacheDestroy(&dbUserCache);
+    }
+    printf("\n");
+
+    for (i = 0; i < threadCount; i++) {
+        Disconnect(&workers[i].db);
+    }
+    Disconnect(&syncDb);
+    free(samples);
+    return TRUE;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-h host] [-P port] [-u user] [-p password] [-d database]\n"
+           "       %*s [-n users] [-o opens] [-t threads] [-a active-users]\n"
+           "       %*s [-w write-every] [-s sync-ms] [-r remote-writes] [-c cache-size]\n",
+           argv0, (INT)strlen(argv0), "", (INT)strlen(argv0), "");
+}
+
+int main(int argc, char **argv)
+{
+    DB_CONTEXT  db;
+    INT         opt;
+
+    while ((opt = getopt(argc, argv, "h:P:u:p:d:n:o:t:a:w:s:r:c:")) != -1) {
+        switch (opt) {
+            case 'h': dbHost       = optarg; break;
+            case 'P': dbPort       = atoi(optarg); break;
+            case 'u': dbUser       = optarg; break;
+            case 'p': dbPassword   = optarg; break;
+            case 'd': dbDatabase   = optarg; break;
+            case 'n': userCount    = atoi(optarg); break;
+            case 'o': openCount    = atoi(optarg); break;
+            case 't': threadCount  = atoi(optarg); break;
+            case 'a': activeCount  = atoi(optarg); break;
+            case 'w': writeEvery   = atoi(optarg); break;
+            case 's': syncMs       = atoi(optarg); break;
+            case 'r': remoteWrites = atoi(optarg); break;
+            case 'c': cacheSize    = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (threadCount <= 0 || threadCount > THREAD_MAX || userCount <= 0 || openCount <= 0 ||
+            activeCount <= 0 || activeCount > userCount || writeEvery < 0 || syncMs <= 0 ||
+            remoteWrites < 0 || cacheSize < 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+    if (cacheSize == 0) {
+        cacheSize = userCount;
+    }
+
+    ProcStubInit(LOG_LEVEL_ERROR);
+    DbUserStatsInit();
+    mysql_library_init(0, NULL, NULL);
+
+    if (!Connect(&db)) {
+        return 1;
+    }
+    printf("Server:  %s (%s)\n", mysql_get_server_info(db.handle), mysql_get_host_info(db.handle));
+    printf("Opens:   %d per thread, %d threads, %d users (%d active)\n",
+        openCount, threadCount, userCount, activeCount);
+    printf("Writes:  every %d opens, sync every %d ms with %d remote writes, %d cached users\n\n",
+        writeEvery, syncMs, remoteWrites, cacheSize);
+
+    if (!Populate(&db)) {
+        return 1;
+    }
+    Disconnect(&db);
+
+    if (!RunPass("Database", FALSE) || !RunPass("Cached", TRUE)) {
+        return 1;
+    }
+
+    mysql_library_end();
+    DbUserStatsFinalize();
+    ProcStubFinalize();
+    return 0;
+}
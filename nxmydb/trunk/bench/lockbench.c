@@ -0,0 +1,376 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Lock Contention Benchmark
+
+Abstract:
+    Measures user lock contention between several servers sharing a local
+    MySQL or MariaDB server. Every simulated server is a separate process with
+    its own lock owner UUID, running a number of threads that lock one of a
+    few "hot" users, hold it for a while, and unlock it.
+
+    The "poll" pass retries a contended lock every 200 milliseconds on the
+    same connection, as the io_user_lock procedure used to. The "backoff"
+    pass retries like UserLock() does: the connection is released between
+    attempts and the delay grows from DB_BACKOFF_MIN to DB_BACKOFF_MAX.
+
+    The database must already contain the tables from schema.sql. All users
+    in it are deleted.
+
+    Usage:
+      lockbench [-h host] [-P port] [-u user] [-p password] [-d database]
+                [-s servers] [-t threads] [-k users] [-l locks] [-w hold-ms]
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <config.h>
+#include <database.h>
+#include <procstub.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define POLL_INTERVAL   200
+#define SERVER_MAX      32
+#define THREAD_MAX      32
+
+typedef struct {
+    float   waitMs;     // Time until the lock was taken or the timeout elapsed
+    float   heldMs;     // Time a connection was held while taking the lock
+    INT     attempts;   // Lock attempts made
+    BOOL    locked;     // Lock was taken
+} SAMPLE;
+
+typedef struct {
+    INT     server;     // Simulated server index
+    INT     thread;     // Thread index within the server
+    SAMPLE  *samples;   // Samples of this thread
+} WORKER;
+
+static CHAR     *dbHost     = "localhost";
+static CHAR     *dbUser     = "root";
+static CHAR     *dbPassword = NULL;
+static CHAR     *dbDatabase = "ioftpd";
+static INT      dbPort      = 0;
+
+static BOOL     backoffPass;
+static INT      holdMs      = 5;
+static INT      hotCount    = 4;
+static INT      lockCount   = 50;
+static INT      serverCount = 4;
+static INT      threadCount = 4;
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static INT CompareFloat(const VOID *elem1, const VOID *elem2)
+{
+    float value1 = *(const float *)elem1;
+    float value2 = *(const float *)elem2;
+
+    return (value1 > value2) - (value1 < value2);
+}
+
+static BOOL Connect(DB_CONTEXT *db)
+{
+    ZeroMemory(db, sizeof(DB_CONTEXT));
+
+    db->handle = mysql_init(NULL);
+    if (mysql_real_connect(db->handle, dbHost, dbUser, dbPassword, dbDatabase, dbPort, NULL, 0) == NULL) {
+        fprintf(stderr, "Unable to connect: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+    db->threadId = mysql_thread_id(db->handle);
+    return TRUE;
+}
+
+static VOID Disconnect(DB_CONTEXT *db)
+{
+    DbStmtFlush(db);
+    mysql_close(db->handle);
+}
+
+static BOOL Populate(DB_CONTEXT *db)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    DWORD       error;
+    INT         i;
+    USERFILE    userFile;
+
+    if (mysql_query(db->handle, "DELETE FROM io_user") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_admins") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_groups") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_hosts") != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+
+    for (i = 0; i < hotCount; i++) {
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "hot%02d", i);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        userFile.Groups[0]      = NOGROUP_ID;
+        userFile.Groups[1]      = INVALID_GROUP;
+        userFile.AdminGroups[0] = INVALID_GROUP;
+
+        error = DbUserCreate(db, userName, &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create user \"%s\" (error %lu).\n", userName, (unsigned long)error);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static DWORD LockPoll(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile, SAMPLE *sample)
+{
+    DWORD   error;
+    DWORD   start;
+
+    // The connection is held for the whole wait, as it was by the procedure
+    start = GetTickCount();
+    for (;;) {
+        sample->attempts++;
+        error = DbUserLock(db, userName, userFile);
+        if (error != ERROR_USER_LOCK_FAILED ||
+                GetTickCount() - start + POLL_INTERVAL > dbConfigLock.timeoutMili) {
+            break;
+        }
+        Sleep(POLL_INTERVAL);
+    }
+
+    sample->heldMs = (float)(GetTickCount() - start);
+    return error;
+}
+
+static DWORD LockBackoff(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile, SAMPLE *sample)
+{
+    DB_BACKOFF  backoff;
+    DWORD       error;
+    double      start;
+
+    // The connection would be released to the pool between attempts
+    DbBackoffInit(&backoff, dbConfigLock.timeoutMili);
+    do {
+        sample->attempts++;
+
+        start = TimeNow();
+        error = DbUserLock(db, userName, userFile);
+        sample->heldMs += (float)((TimeNow() - start) * 1000.0);
+    } while (error == ERROR_USER_LOCK_FAILED && DbBackoffWait(&backoff));
+
+    return error;
+}
+
+static VOID *WorkerThread(VOID *argument)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    DB_CONTEXT  db;
+    DWORD       error;
+    INT         i;
+    SAMPLE      *sample;
+    UINT        seed;
+    USERFILE    userFile;
+    WORKER      *worker = argument;
+    double      start;
+
+    mysql_thread_init();
+    if (!Connect(&db)) {
+        return NULL;
+    }
+    seed = (UINT)(worker->server * THREAD_MAX + worker->thread + 1);
+
+    for (i = 0; i < lockCount; i++) {
+        sample = &worker->samples[i];
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "hot%02d", rand_r(&seed) % hotCount);
+
+        start = TimeNow();
+        if (backoffPass) {
+            error = LockBackoff(&db, userName, &userFile, sample);
+        } else {
+            error = LockPoll(&db, userName, &userFile, sample);
+        }
+        sample->waitMs = (float)((TimeNow() - start) * 1000.0);
+
+        if (error == ERROR_SUCCESS) {
+            sample->locked = TRUE;
+
+            // Simulate the work done while the user is locked
+            Sleep(holdMs);
+            DbUserUnlock(&db, userName);
+        }
+    }
+
+    Disconnect(&db);
+    mysql_thread_end();
+    return NULL;
+}
+
+static VOID RunServer(INT server, SAMPLE *samples)
+{
+    INT         i;
+    pthread_t   threads[THREAD_MAX];
+    WORKER      workers[THREAD_MAX];
+
+    // Each server has its own lock owner
+    StringCchPrintfA(dbConfigLock.owner, ELEMENT_COUNT(dbConfigLock.owner),
+        "00000000-0000-0000-0000-%012d", server);
+    dbConfigLock.ownerLength = strlen(dbConfigLock.owner);
+
+    mysql_library_init(0, NULL, NULL);
+
+    for (i = 0; i < threadCount; i++) {
+        workers[i].server  = server;
+        workers[i].thread  = i;
+        workers[i].samples = samples + ((server * threadCount) + i) * lockCount;
+        pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    mysql_library_end();
+}
+
+static BOOL RunPass(const CHAR *passName, BOOL backoff)
+{
+    DB_CONTEXT  db;
+    INT         attempts;
+    INT         i;
+    INT         locked;
+    INT         total;
+    SAMPLE      *samples;
+    float       *waits;
+    double      elapsed;
+    double      heldMs;
+    double      start;
+    double      waitMs;
+    pid_t       children[SERVER_MAX];
+
+    // Release locks left by a previous pass
+    if (!Connect(&db)) {
+        return FALSE;
+    }
+    if (mysql_query(db.handle, "UPDATE io_user SET lockowner=NULL, locktime=0") != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(db.handle));
+        return FALSE;
+    }
+    Disconnect(&db);
+
+    total   = serverCount * threadCount * lockCount;
+    samples = mmap(NULL, sizeof(SAMPLE) * total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED) {
+        perror("mmap");
+        return FALSE;
+    }
+    ZeroMemory(samples, sizeof(SAMPLE) * total);
+    backoffPass = backoff;
+
+    start = TimeNow();
+    for (i = 0; i < serverCount; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            RunServer(i, samples);
+            _exit(0);
+        }
+    }
+    for (i = 0; i < serverCount; i++) {
+        waitpid(children[i], NULL, 0);
+    }
+    elapsed = TimeNow() - start;
+
+    attempts = locked = 0;
+    heldMs = waitMs = 0.0;
+    waits = malloc(sizeof(float) * total);
+    for (i = 0; i < total; i++) {
+        attempts += samples[i].attempts;
+        locked   += samples[i].locked ? 1 : 0;
+        heldMs   += samples[i].heldMs;
+        waitMs   += samples[i].waitMs;
+        waits[i]  = samples[i].waitMs;
+    }
+    qsort(waits, total, sizeof(float), CompareFloat);
+
+    printf("%s: %d/%d locks in %.1f ms, %.0f locks/s, %.2f attempts per lock\n",
+        passName, locked, total, elapsed * 1000.0, locked / elapsed, (double)attempts / total);
+    printf("  lock wait ms:      avg %7.1f  p50 %7.1f  p95 %7.1f  p99 %7.1f  max %7.1f\n",
+        waitMs / total, waits[total / 2], waits[(total * 95) / 100],
+        waits[(total * 99) / 100], waits[total - 1]);
+    printf("  connection held:   avg %7.1f ms per lock\n\n", heldMs / total);
+
+    free(waits);
+    munmap(samples, sizeof(SAMPLE) * total);
+    return TRUE;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-h host] [-P port] [-u user] [-p password] [-d database]\n"
+           "       %*s [-s servers] [-t threads] [-k users] [-l locks] [-w hold-ms]\n",
+           argv0, (INT)strlen(argv0), "");
+}
+
+int main(int argc, char **argv)
+{
+    DB_CONTEXT  db;
+    INT         opt;
+
+    while ((opt = getopt(argc, argv, "h:P:u:p:d:s:t:k:l:w:")) != -1) {
+        switch (opt) {
+            case 'h': dbHost      = optarg; break;
+            case 'P': dbPort      = atoi(optarg); break;
+            case 'u': dbUser      = optarg; break;
+            case 'p': dbPassword  = optarg; break;
+            case 'd': dbDatabase  = optarg; break;
+            case 's': serverCount = atoi(optarg); break;
+            case 't': threadCount = atoi(optarg); break;
+            case 'k': hotCount    = atoi(optarg); break;
+            case 'l': lockCount   = atoi(optarg); break;
+            case 'w': holdMs      = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (serverCount <= 0 || serverCount > SERVER_MAX || threadCount <= 0 ||
+            threadCount > THREAD_MAX || hotCount <= 0 || lockCount <= 0 || holdMs < 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_ERROR);
+    DbUserStatsInit();
+    mysql_library_init(0, NULL, NULL);
+
+    if (!Connect(&db)) {
+        return 1;
+    }
+    printf("Server:  %s (%s)\n", mysql_get_server_info(db.handle), mysql_get_host_info(db.handle));
+    printf("Servers: %d x %d threads, %d hot users, %d locks per thread, held %d ms\n\n",
+        serverCount, threadCount, hotCount, lockCount, holdMs);
+
+    if (!Populate(&db)) {
+        return 1;
+    }
+    Disconnect(&db);
+    mysql_library_end();
+
+    if (!RunPass("Poll", FALSE) || !RunPass("Backoff", TRUE)) {
+        return 1;
+    }
+
+    DbUserStatsFinalize();
+    ProcStubFinalize();
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Log Benchmark
+
+Abstract:
+    Measures the throughput of the log file writer in logfile.c. Several
+    threads log messages and trace lines as fast as they can, as the module
+    does with debug logging during a synchronization storm. The time until
+    LogFileFinalize() has written every queued line gives the writer's
+    throughput; the time the threads took gives the cost to the callers.
+
+    Without rotation, the log file is checked for every line.
+
+    Usage:
+      logbench [-t threads] [-n lines] [-s size_kb] [-d directory]
+
+*/
+
+#include <base.h>
+#include <config.h>
+#include <procstub.h>
+
+typedef struct {
+    INT         index;      // Thread index
+    INT         lines;      // Lines to log
+} BENCH_THREAD;
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static VOID *LogThread(VOID *arg)
+{
+    BENCH_THREAD    *thread = arg;
+    INT             i;
+
+    for (i = 0; i < thread->lines; i++) {
+        // Alternate between messages and trace lines, as a debug build logs
+        if (i & 1) {
+            LogFileTrace(__FILE__, "UserSyncIncr", __LINE__,
+                "Update(user%05d) from thread %d, line %d." CRLF, i % 5000, thread->index, i);
+        } else {
+            LogFileFormat("Unable to update user \"user%05d\" from thread %d, line %d (error %lu)." CRLF,
+                i % 5000, thread->index, i, 1359UL);
+        }
+    }
+    return NULL;
+}
+
+static LONG CountLines(const CHAR *path, UINT64 *bytes)
+{
+    CHAR    buffer[65536];
+    FILE    *file;
+    LONG    lines = 0;
+    SIZE_T  i;
+    SIZE_T  length;
+
+    *bytes = 0;
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (i = 0; i < length; i++) {
+            if (buffer[i] == '\n') {
+                lines++;
+            }
+        }
+        *bytes += length;
+    }
+    fclose(file);
+    return lines;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-t threads] [-n lines] [-s size_kb] [-d directory]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    BENCH_THREAD    *threads;
+    CHAR            *directory = "/tmp";
+    CHAR            path[_MAX_PATH];
+    CHAR            prefix[_MAX_PATH];
+    INT             i;
+    INT             lines = 200000;
+    INT             opt;
+    INT             size = 0;
+    INT             threadCount = 8;
+    LONG            logged;
+    LONG            found;
+    UINT64          bytes;
+    double          start;
+    double          queued;
+    double          written;
+    pthread_t       *handles;
+
+    while ((opt = getopt(argc, argv, "t:n:s:d:")) != -1) {
+        switch (opt) {
+            case 't': threadCount = atoi(optarg); break;
+            case 'n': lines       = atoi(optarg); break;
+            case 's': size        = atoi(optarg); break;
+            case 'd': directory   = optarg; break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (threadCount <= 0 || lines <= 0 || size < 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_WARN);
+
+    // Log files are written to the given directory
+    StringCchPrintfA(prefix, ELEMENT_COUNT(prefix), "%s/", directory);
+    stubPathPrefix = prefix;
+    StringCchPrintfA(path, ELEMENT_COUNT(path), "%snxMyDB.log", prefix);
+    unlink(path);
+
+    // Rotation settings normally read by config.c
+    dbConfigGlobal.logSize      = size;
+    dbConfigGlobal.logSizeBytes = (DWORD)size * 1024;
+
+    printf("Threads: %d, %d lines, rotation %s\n\n", threadCount, lines, (size > 0) ? "on" : "off");
+
+    if (LogFileInit() != ERROR_SUCCESS) {
+        fprintf(stderr, "Unable to initialize the log.\n");
+        return 1;
+    }
+
+    threads = calloc(threadCount, sizeof(BENCH_THREAD));
+    handles = calloc(threadCount, sizeof(pthread_t));
+    logged  = 0;
+
+    start = TimeNow();
+    for (i = 0; i < threadCount; i++) {
+        threads[i].index = i;
+        threads[i].lines = lines / threadCount + ((i < lines % threadCount) ? 1 : 0);
+        logged += threads[i].lines;
+        pthread_create(&handles[i], NULL, LogThread, &threads[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    queued = TimeNow() - start;
+
+    // Writes whatever the writer has not reached yet
+    LogFileFinalize();
+    written = TimeNow() - start;
+
+    found = CountLines(path, &bytes);
+
+    printf("Logged:   %9.1f ms  %10.0f lines/s  (callers)\n", queued * 1000.0, logged / queued);
+    printf("Written:  %9.1f ms  %10.0f lines/s  %7.1f MB/s\n",
+        written * 1000.0, logged / written, (double)bytes / written / 1048576.0);
+    printf("Log file: %ld lines, %llu bytes\n", (long)found, (unsigned long long)bytes);
+
+    free(threads);
+    free(handles);
+    ProcStubFinalize();
+
+    // The header line is written as well
+    if (size == 0 && found != logged + 1) {
+        fprintf(stderr, "Log file has %ld of %ld lines.\n", (long)found, (long)logged + 1);
+        return 1;
+    }
+    return 0;
+}
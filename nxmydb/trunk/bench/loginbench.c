@@ -0,0 +1,343 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Login Storm Benchmark
+
+Abstract:
+    Measures the latency of the calls made for every user login against a
+    local MySQL or MariaDB server: DbUserLock() (which also reads the user),
+    DbUserWrite() for the logon statistics, and DbUserUnlock(). Each thread
+    has its own connection, as it would have from the pool, and logs in its
+    share of the users in turn.
+
+    The "uncached" pass flushes the statement cache before every call, so all
+    statements are prepared again as they were before the cache existed. The
+    "cached" pass prepares each statement once per connection.
+
+    The database must already contain the tables from schema.sql. All users
+    in it are deleted.
+
+    Usage:
+      loginbench [-h host] [-P port] [-u user] [-p password] [-d database]
+                 [-n users] [-l logins] [-t threads]
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <database.h>
+#include <procstub.h>
+
+#define GROUP_COUNT  10
+#define THREAD_MAX   64
+
+typedef enum {
+    OP_LOCK = 0,
+    OP_WRITE,
+    OP_UNLOCK,
+    OP_COUNT
+} OPERATION;
+
+static const CHAR *opNames[OP_COUNT] = {"DbUserLock", "DbUserWrite", "DbUserUnlock"};
+
+typedef struct {
+    DB_CONTEXT  db;                 // Connection used by the thread
+    INT         index;              // Thread index
+    INT         logins;             // Logins performed
+    INT         failures;           // Calls that failed
+    double      *samples[OP_COUNT]; // Latency of each call, in seconds
+} WORKER;
+
+static CHAR     *dbHost     = "localhost";
+static CHAR     *dbUser     = "root";
+static CHAR     *dbPassword = NULL;
+static CHAR     *dbDatabase = "ioftpd";
+static INT      dbPort      = 0;
+
+static BOOL     flushCache;
+static INT      loginCount  = 20000;
+static INT      threadCount = 4;
+static INT      userCount   = 1000;
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static INT CompareDouble(const VOID *elem1, const VOID *elem2)
+{
+    double value1 = *(const double *)elem1;
+    double value2 = *(const double *)elem2;
+
+    return (value1 > value2) - (value1 < value2);
+}
+
+static BOOL Connect(DB_CONTEXT *db)
+{
+    ZeroMemory(db, sizeof(DB_CONTEXT));
+
+    db->handle = mysql_init(NULL);
+    if (mysql_real_connect(db->handle, dbHost, dbUser, dbPassword, dbDatabase, dbPort, NULL, 0) == NULL) {
+        fprintf(stderr, "Unable to connect: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+    db->threadId = mysql_thread_id(db->handle);
+    return TRUE;
+}
+
+static VOID Disconnect(DB_CONTEXT *db)
+{
+    DbStmtFlush(db);
+    mysql_close(db->handle);
+}
+
+static BOOL Populate(DB_CONTEXT *db)
+{
+    CHAR        groupName[_MAX_NAME + 1];
+    CHAR        userName[_MAX_NAME + 1];
+    DWORD       error;
+    INT         i;
+    USERFILE    userFile;
+
+    if (mysql_query(db->handle, "DELETE FROM io_user") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_admins") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_groups") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_hosts") != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+
+    for (i = 0; i < userCount; i++) {
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "user%05d", i);
+        StringCchPrintfA(groupName, ELEMENT_COUNT(groupName), "group%d", i % GROUP_COUNT);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        userFile.Gid            = ProcStubAddGroup(groupName);
+        userFile.Groups[0]      = userFile.Gid;
+        userFile.Groups[1]      = INVALID_GROUP;
+        userFile.AdminGroups[0] = INVALID_GROUP;
+        StringCchCopyA(userFile.Tagline, ELEMENT_COUNT(userFile.Tagline), "Tagline");
+        StringCchCopyA(userFile.Flags, ELEMENT_COUNT(userFile.Flags), "3");
+        StringCchCopyA(userFile.Home, ELEMENT_COUNT(userFile.Home), "/");
+        StringCchPrintfA(userFile.Ip[0], ELEMENT_COUNT(userFile.Ip[0]), "*@10.0.%d.%d", (i >> 8) & 255, i & 255);
+
+        error = DbUserCreate(db, userName, &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create user \"%s\" (error %lu).\n", userName, (unsigned long)error);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static VOID *WorkerThread(VOID *argument)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    DWORD       error;
+    INT         i;
+    INT         perThread;
+    USERFILE    userFile;
+    WORKER      *worker = argument;
+    double      start;
+
+    mysql_thread_init();
+
+    // Each thread logs in its own share of the users, so locks never collide
+    perThread = userCount / threadCount;
+
+    for (i = 0; i < loginCount / threadCount; i++) {
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "user%05d",
+            worker->index + (i % perThread) * threadCount);
+
+        if (flushCache) {
+            DbStmtFlush(&worker->db);
+        }
+        start = TimeNow();
+        error = DbUserLock(&worker->db, userName, &userFile);
+        worker->samples[OP_LOCK][i] = TimeNow() - start;
+        if (error != ERROR_SUCCESS) {
+            worker->failures++;
+            continue;
+        }
+
+        userFile.LogonCount++;
+        userFile.LogonLast = time(NULL);
+        StringCchCopyA(userFile.LogonHost, ELEMENT_COUNT(userFile.LogonHost), "127.0.0.1");
+
+        if (flushCache) {
+            DbStmtFlush(&worker->db);
+        }
+        start = TimeNow();
+        error = DbUserWrite(&worker->db, userName, &userFile);
+        worker->samples[OP_WRITE][i] = TimeNow() - start;
+        if (error != ERROR_SUCCESS) {
+            worker->failures++;
+        }
+
+        if (flushCache) {
+            DbStmtFlush(&worker->db);
+        }
+        start = TimeNow();
+        error = DbUserUnlock(&worker->db, userName);
+        worker->samples[OP_UNLOCK][i] = TimeNow() - start;
+        if (error != ERROR_SUCCESS) {
+            worker->failures++;
+        }
+
+        worker->logins++;
+    }
+
+    mysql_thread_end();
+    return NULL;
+}
+
+static BOOL RunPass(const CHAR *passName, BOOL flush)
+{
+    double      *merged;
+    double      elapsed;
+    double      start;
+    double      total;
+    INT         count;
+    INT         failures;
+    INT         i;
+    INT         logins;
+    INT         op;
+    INT         perThread;
+    ULONG       hits;
+    ULONG       misses;
+    pthread_t   threads[THREAD_MAX];
+    WORKER      workers[THREAD_MAX];
+
+    flushCache = flush;
+    perThread  = loginCount / threadCount;
+
+    for (i = 0; i < threadCount; i++) {
+        if (!Connect(&workers[i].db)) {
+            return FALSE;
+        }
+        workers[i].index    = i;
+        workers[i].logins   = 0;
+        workers[i].failures = 0;
+        for (op = 0; op < OP_COUNT; op++) {
+            workers[i].samples[op] = calloc(perThread, sizeof(double));
+        }
+    }
+
+    start = TimeNow();
+    for (i = 0; i < threadCount; i++) {
+        pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = TimeNow() - start;
+
+    failures = logins = 0;
+    hits = misses = 0;
+    for (i = 0; i < threadCount; i++) {
+        failures += workers[i].failures;
+        logins   += workers[i].logins;
+        hits     += workers[i].db.stmtHits;
+        misses   += workers[i].db.stmtMisses;
+    }
+
+    printf("%s: %d logins in %.1f ms, %.0f logins/s, %d failures\n",
+        passName, logins, elapsed * 1000.0, logins / elapsed, failures);
+    printf("  statement cache: %lu hits, %lu misses (prepares)\n",
+        (unsigned long)hits, (unsigned long)misses);
+    printf("  %-14s %10s %10s %10s %10s\n", "operation", "avg us", "p50 us", "p95 us", "p99 us");
+
+    merged = malloc(sizeof(double) * perThread * threadCount);
+    for (op = 0; op < OP_COUNT; op++) {
+        count = 0;
+        total = 0.0;
+        for (i = 0; i < threadCount; i++) {
+            memcpy(merged + count, workers[i].samples[op], sizeof(double) * perThread);
+            count += perThread;
+        }
+        for (i = 0; i < count; i++) {
+            total += merged[i];
+        }
+        qsort(merged, count, sizeof(double), CompareDouble);
+
+        printf("  %-14s %10.1f %10.1f %10.1f %10.1f\n", opNames[op],
+            total / count * 1e6,
+            merged[count / 2] * 1e6,
+            merged[(count * 95) / 100] * 1e6,
+            merged[(count * 99) / 100] * 1e6);
+    }
+    printf("\n");
+    free(merged);
+
+    for (i = 0; i < threadCount; i++) {
+        for (op = 0; op < OP_COUNT; op++) {
+            free(workers[i].samples[op]);
+        }
+        Disconnect(&workers[i].db);
+    }
+    return TRUE;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-h host] [-P port] [-u user] [-p password] [-d database]\n"
+           "       %*s [-n users] [-l logins] [-t threads]\n", argv0, (INT)strlen(argv0), "");
+}
+
+int main(int argc, char **argv)
+{
+    DB_CONTEXT  db;
+    INT         opt;
+
+    while ((opt = getopt(argc, argv, "h:P:u:p:d:n:l:t:")) != -1) {
+        switch (opt) {
+            case 'h': dbHost      = optarg; break;
+            case 'P': dbPort      = atoi(optarg); break;
+            case 'u': dbUser      = optarg; break;
+            case 'p': dbPassword  = optarg; break;
+            case 'd': dbDatabase  = optarg; break;
+            case 'n': userCount   = atoi(optarg); break;
+            case 'l': loginCount  = atoi(optarg); break;
+            case 't': threadCount = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (threadCount <= 0 || threadCount > THREAD_MAX ||
+            userCount < threadCount || loginCount < threadCount) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_WARN);
+    DbUserStatsInit();
+    mysql_library_init(0, NULL, NULL);
+
+    if (!Connect(&db)) {
+        return 1;
+    }
+    printf("Server:  %s (%s)\n", mysql_get_server_info(db.handle), mysql_get_host_info(db.handle));
+    printf("Logins:  %d, %d users, %d threads\n\n", loginCount, userCount, threadCount);
+
+    if (!Populate(&db)) {
+        return 1;
+    }
+    Disconnect(&db);
+
+    if (!RunPass("Uncached", TRUE) || !RunPass("Cached", FALSE)) {
+        return 1;
+    }
+
+    mysql_library_end();
+    DbUserStatsFinalize();
+    ProcStubFinalize();
+    return 0;
+}
@@ -0,0 +1,414 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Pool Stress Benchmark
+
+Abstract:
+    Measures connection pool throughput and acquire latency with many threads
+    sharing a small pool. No database is used: a resource costs a delay to
+    create (the connect time) and, optionally, to validate (a ping).
+
+    The "single lock" pass uses a pool built like the previous implementation,
+    where every acquire and release takes the pool's critical section and
+    resources are validated while holding it. The "lock-free" pass uses
+    PoolAcquire() and PoolRelease(), and also prints the pool statistics.
+
+    The "idle" pass parks a resource for each of "maximum - 1" threads that
+    then exit, and expires those resources. The pool must remove them while
+    another thread keeps using its own resource.
+
+    Usage:
+      poolbench [-t threads] [-m maximum] [-a acquires] [-w hold-us]
+                [-k think-us] [-c connect-us] [-v validate-us] [-T timeout-ms]
+
+*/
+
+#include <base.h>
+#include <condvar.h>
+#include <pool.h>
+#include <procstub.h>
+
+#define THREAD_MAX  256
+
+typedef struct {
+    INT     thread;     // Thread index
+    float   *samples;   // Acquire latencies of this thread, in microseconds
+    INT     failures;   // Acquires that failed or timed out
+} WORKER;
+
+//
+// Pool built like the previous implementation
+//
+
+typedef struct {
+    VOID            **idle;     // Stack of idle resources
+    LONG            idleCount;  // Number of idle resources
+    LONG            total;      // Total number of resources
+    LONG            maximum;    // Maximum number of resources
+    CONDITION_VAR   condition;  // Signaled when a resource is released
+    CRITICAL_SECTION lock;      // Taken by every acquire and release
+} SIMPLE_POOL;
+
+static INT      acquireCount = 2000;
+static INT      connectUs    = 2000;
+static INT      holdUs       = 100;
+static INT      poolMaximum  = 8;
+static INT      thinkUs      = 50;
+static INT      threadCount  = 32;
+static INT      timeoutMs    = 10000;
+static INT      validateUs   = 20;
+
+static BOOL         lockFreePass;
+static POOL         pool;
+static SIMPLE_POOL  simplePool;
+
+static volatile LONG resourceCount;
+static VOID          *resourceKept;     // Resource that stays valid in the idle pass
+static BOOL          resourceExpired;   // All other resources fail validation
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static INT CompareFloat(const VOID *elem1, const VOID *elem2)
+{
+    float value1 = *(const float *)elem1;
+    float value2 = *(const float *)elem2;
+
+    return (value1 > value2) - (value1 < value2);
+}
+
+static VOID Spin(INT microseconds)
+{
+    double end = TimeNow() + microseconds / 1e6;
+
+    // A ping keeps the thread busy, it does not give up the processor
+    while (TimeNow() < end);
+}
+
+static BOOL FCALL ResourceOpen(VOID *context, VOID **data)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    usleep(connectUs);
+    *data = malloc(sizeof(LONG));
+    if (*data == NULL) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+    *(LONG *)*data = InterlockedIncrement(&resourceCount);
+    return TRUE;
+}
+
+static BOOL FCALL ResourceCheck(VOID *context, VOID *data)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    if (validateUs > 0) {
+        Spin(validateUs);
+    }
+    if (resourceExpired && data != resourceKept) {
+        SetLastError(ERROR_CONTEXT_EXPIRED);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static VOID FCALL ResourceClose(VOID *context, VOID *data)
+{
+    UNREFERENCED_PARAMETER(context);
+
+    free(data);
+}
+
+static BOOL SimpleAcquire(VOID **data)
+{
+    EnterCriticalSection(&simplePool.lock);
+    for (;;) {
+        if (simplePool.idleCount > 0) {
+            *data = simplePool.idle[--simplePool.idleCount];
+
+            // Validated while holding the lock, as before
+            ResourceCheck(NULL, *data);
+            break;
+        }
+
+        if (simplePool.total < simplePool.maximum) {
+            simplePool.total++;
+            LeaveCriticalSection(&simplePool.lock);
+
+            if (!ResourceOpen(NULL, data)) {
+                EnterCriticalSection(&simplePool.lock);
+                simplePool.total--;
+                LeaveCriticalSection(&simplePool.lock);
+                return FALSE;
+            }
+            return TRUE;
+        }
+
+        if (!ConditionVariableWait(&simplePool.condition, &simplePool.lock, timeoutMs)) {
+            LeaveCriticalSection(&simplePool.lock);
+            SetLastError(ERROR_TIMEOUT);
+            return FALSE;
+        }
+    }
+    LeaveCriticalSection(&simplePool.lock);
+    return TRUE;
+}
+
+static VOID SimpleRelease(VOID *data)
+{
+    EnterCriticalSection(&simplePool.lock);
+    simplePool.idle[simplePool.idleCount++] = data;
+    ConditionVariableSignal(&simplePool.condition);
+    LeaveCriticalSection(&simplePool.lock);
+}
+
+static VOID *WorkerThread(VOID *argument)
+{
+    BOOL    result;
+    INT     i;
+    VOID    *data;
+    WORKER  *worker = argument;
+    double  start;
+
+    for (i = 0; i < acquireCount; i++) {
+        start = TimeNow();
+        if (lockFreePass) {
+            result = PoolAcquire(&pool, &data);
+        } else {
+            result = SimpleAcquire(&data);
+        }
+        worker->samples[i] = (float)((TimeNow() - start) * 1e6);
+
+        if (!result) {
+            worker->failures++;
+            continue;
+        }
+
+        // Simulate a query, then the work done between queries
+        usleep(holdUs);
+        if (lockFreePass) {
+            PoolRelease(&pool, data);
+        } else {
+            SimpleRelease(data);
+        }
+        if (thinkUs > 0) {
+            usleep(thinkUs);
+        }
+    }
+    return NULL;
+}
+
+static BOOL RunPass(const CHAR *passName, BOOL lockFree)
+{
+    DWORD       error;
+    DWORD       i;
+    INT         failures;
+    INT         total;
+    POOL_STATS  stats;
+    WORKER      workers[THREAD_MAX];
+    float       *samples;
+    double      elapsed;
+    double      start;
+    pthread_t   threads[THREAD_MAX];
+
+    resourceCount = 0;
+    lockFreePass  = lockFree;
+
+    if (lockFree) {
+        error = PoolCreate(&pool, MAX(1, poolMaximum / 4), MAX(1, poolMaximum / 2), poolMaximum,
+            timeoutMs, ResourceOpen, ResourceCheck, ResourceClose, NULL);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create pool (error %lu).\n", (unsigned long)error);
+            return FALSE;
+        }
+    } else {
+        ZeroMemory(&simplePool, sizeof(SIMPLE_POOL));
+        simplePool.idle    = malloc(sizeof(VOID *) * poolMaximum);
+        simplePool.maximum = poolMaximum;
+        InitializeCriticalSectionAndSpinCount(&simplePool.lock, 250);
+        ConditionVariableCreate(&simplePool.condition);
+    }
+
+    total   = threadCount * acquireCount;
+    samples = malloc(sizeof(float) * total);
+    ZeroMemory(workers, sizeof(workers));
+
+    start = TimeNow();
+    for (i = 0; i < (DWORD)threadCount; i++) {
+        workers[i].thread  = i;
+        workers[i].samples = samples + i * acquireCount;
+        pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+    }
+    failures = 0;
+    for (i = 0; i < (DWORD)threadCount; i++) {
+        pthread_join(threads[i], NULL);
+        failures += workers[i].failures;
+    }
+    elapsed = TimeNow() - start;
+
+    qsort(samples, total, sizeof(float), CompareFloat);
+
+    printf("%s: %d acquires in %.1f ms, %.0f acquires/s, %d failed, %d resources created\n",
+        passName, total - failures, elapsed * 1000.0, (total - failures) / elapsed,
+        failures, resourceCount);
+    printf("  acquire us:  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f\n",
+        samples[total / 2], samples[(total * 90) / 100], samples[(total * 99) / 100], samples[total - 1]);
+
+    if (lockFree) {
+        PoolGetStats(&pool, &stats);
+        printf("  pool stats:  %d acquires, %d affinity (%.1f%%), %d waits, %d timeouts, %d created, %d destroyed\n",
+            stats.acquires, stats.affinity, stats.acquires ? 100.0 * stats.affinity / stats.acquires : 0.0,
+            stats.waits, stats.timeouts, stats.creations, stats.destructions);
+        printf("  wait ms:    ");
+        for (i = 0; i < POOL_WAIT_BUCKETS - 1; i++) {
+            printf(" <%lu:%d", 1UL << i, stats.waitTime[i]);
+        }
+        printf(" >=%lu:%d\n", 1UL << i, stats.waitTime[i]);
+
+        PoolDestroy(&pool);
+    } else {
+        while (simplePool.idleCount > 0) {
+            ResourceClose(NULL, simplePool.idle[--simplePool.idleCount]);
+        }
+        ConditionVariableDestroy(&simplePool.condition);
+        DeleteCriticalSection(&simplePool.lock);
+        free(simplePool.idle);
+    }
+    printf("\n");
+
+    free(samples);
+    return TRUE;
+}
+
+static VOID *ParkThread(VOID *argument)
+{
+    BOOL                result;
+    VOID                *data;
+    pthread_barrier_t   *barrier = argument;
+
+    // Hold the resource until every thread has one, so each parks its own
+    result = PoolAcquire(&pool, &data);
+    pthread_barrier_wait(barrier);
+
+    if (result) {
+        PoolRelease(&pool, data);
+    }
+    return NULL;
+}
+
+static BOOL RunIdlePass(VOID)
+{
+    DWORD               error;
+    INT                 i;
+    INT                 parked;
+    VOID                *data;
+    pthread_barrier_t   barrier;
+    pthread_t           threads[THREAD_MAX];
+
+    parked = MIN(poolMaximum, THREAD_MAX) - 1;
+    if (parked <= MAX(1, poolMaximum / 2)) {
+        return TRUE;
+    }
+
+    error = PoolCreate(&pool, MAX(1, poolMaximum / 4), MAX(1, poolMaximum / 2), poolMaximum,
+        timeoutMs, ResourceOpen, ResourceCheck, ResourceClose, NULL);
+    if (error != ERROR_SUCCESS) {
+        fprintf(stderr, "Unable to create pool (error %lu).\n", (unsigned long)error);
+        return FALSE;
+    }
+
+    // This thread holds its resource while the others park theirs
+    if (!PoolAcquire(&pool, &data)) {
+        fprintf(stderr, "Unable to acquire resource (error %lu).\n", (unsigned long)GetLastError());
+        PoolDestroy(&pool);
+        return FALSE;
+    }
+    resourceKept = data;
+
+    pthread_barrier_init(&barrier, NULL, parked + 1);
+    for (i = 0; i < parked; i++) {
+        pthread_create(&threads[i], NULL, ParkThread, &barrier);
+    }
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < parked; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    PoolRelease(&pool, data);
+    printf("Idle: %ld resources, %ld idle after %d threads parked theirs and exited\n",
+        (long)pool.total, (long)pool.idle, parked);
+
+    // The parked resources expire, while this thread keeps using its own
+    resourceExpired = TRUE;
+    for (i = 0; i < poolMaximum * 2; i++) {
+        if (PoolAcquire(&pool, &data)) {
+            PoolRelease(&pool, data);
+        }
+    }
+    resourceExpired = FALSE;
+
+    printf("  expired:     %ld resources, %ld idle after %d releases (average %d)\n\n",
+        (long)pool.total, (long)pool.idle, poolMaximum * 2, MAX(1, poolMaximum / 2));
+    if (pool.total > MAX(1, poolMaximum / 2)) {
+        fprintf(stderr, "Parked resources were not removed.\n");
+    }
+
+    PoolDestroy(&pool);
+    return TRUE;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-t threads] [-m maximum] [-a acquires] [-w hold-us]\n"
+           "       %*s [-k think-us] [-c connect-us] [-v validate-us] [-T timeout-ms]\n",
+           argv0, (INT)strlen(argv0), "");
+}
+
+int main(int argc, char **argv)
+{
+    INT opt;
+
+    while ((opt = getopt(argc, argv, "t:m:a:w:k:c:v:T:")) != -1) {
+        switch (opt) {
+            case 't': threadCount  = atoi(optarg); break;
+            case 'm': poolMaximum  = atoi(optarg); break;
+            case 'a': acquireCount = atoi(optarg); break;
+            case 'w': holdUs       = atoi(optarg); break;
+            case 'k': thinkUs      = atoi(optarg); break;
+            case 'c': connectUs    = atoi(optarg); break;
+            case 'v': validateUs   = atoi(optarg); break;
+            case 'T': timeoutMs    = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (threadCount <= 0 || threadCount > THREAD_MAX || poolMaximum <= 0 || acquireCount <= 0 ||
+            holdUs < 0 || thinkUs < 0 || connectUs < 0 || validateUs < 0 || timeoutMs <= 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_ERROR);
+
+    printf("Threads: %d, pool maximum %d, %d acquires per thread\n", threadCount, poolMaximum, acquireCount);
+    printf("Costs:   connect %d us, validate %d us, held %d us, think %d us\n\n",
+        connectUs, validateUs, holdUs, thinkUs);
+
+    if (!RunPass("Single lock", FALSE) || !RunPass("Lock-free", TRUE) || !RunIdlePass()) {
+        return 1;
+    }
+
+    ProcStubFinalize();
+    return 0;
+}
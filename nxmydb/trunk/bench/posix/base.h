@@ -0,0 +1,923 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    POSIX Common Header
+
+Abstract:
+    Replacement for the common header when building the module's core on
+    POSIX systems. It provides the subset of the Win32 API and the ioFTPD
+    structures used by the database code, so the sync and storage backends
+    can be benchmarked against a local MySQL or MariaDB server.
+
+    This directory must be searched before the "include" directory.
+
+*/
+
+#ifndef BASE_H_INCLUDED
+#define BASE_H_INCLUDED
+
+#define _GNU_SOURCE
+
+// Standard headers
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// MySQL headers
+#include <mysql.h>
+#include <errmsg.h>
+
+//
+// Win32 types
+//
+
+typedef void            VOID;
+typedef char            CHAR;
+typedef unsigned char   UCHAR;
+typedef unsigned char   BYTE;
+typedef uint16_t        WORD;
+typedef int             BOOL;
+typedef int             INT;
+typedef unsigned int    UINT;
+typedef int32_t         INT32;
+typedef uint32_t        UINT32;
+typedef int64_t         INT64;
+typedef int64_t         LONGLONG;
+typedef uint64_t        UINT64;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef uint32_t        DWORD;
+typedef size_t          SIZE_T;
+typedef intptr_t        INT_PTR;
+typedef void           *HANDLE;
+
+typedef struct {
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME;
+
+typedef union {
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct {
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+} SYSTEMTIME;
+
+#ifndef TRUE
+#   define TRUE  1
+#   define FALSE 0
+#endif
+
+#define INVALID_HANDLE_VALUE    ((HANDLE)(intptr_t)-1)
+#define INFINITE                0xFFFFFFFF
+#define WAIT_OBJECT_0           0
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+#define TLS_OUT_OF_INDEXES      0xFFFFFFFF
+#define UNREFERENCED_PARAMETER(p) ((VOID)(p))
+
+//
+// Win32 error codes used by the module
+//
+
+#define ERROR_SUCCESS               0
+#define ERROR_INVALID_FUNCTION      1
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_PATH_NOT_FOUND        3
+#define ERROR_ACCESS_DENIED         5
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_SHARING_VIOLATION     32
+#define ERROR_LOCK_VIOLATION        33
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_BAD_DEV_TYPE          66
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_CONNECTION_UNAVAIL    1201
+#define ERROR_CONNECTION_REFUSED    1225
+#define ERROR_INTERNAL_ERROR        1359
+#define ERROR_TIMEOUT               1460
+#define ERROR_CONTEXT_EXPIRED       1931
+#define ERROR_NOT_CONNECTED         2250
+
+// ioFTPD error codes
+#define ERROR_USER_NOT_FOUND        0x20000001
+#define ERROR_GROUP_NOT_FOUND       0x20000002
+#define ERROR_ID_NOT_FOUND          0x20000003
+#define ERROR_USER_LOCK_FAILED      0x20000004
+#define ERROR_GROUP_LOCK_FAILED     0x20000005
+
+//
+// Calling conventions and compiler macros
+//
+
+#define CCALL
+#define FCALL
+#define SCALL
+
+// Forced like __forceinline, so "INLINE" functions need no external definition,
+// and sources can declare them "static INLINE". Variadic functions cannot be
+// forced inline, so the ones below are "static inline".
+#define INLINE inline __attribute__((always_inline))
+
+#define __FUNCTION__ __func__
+
+#if defined(DEBUG) && !defined(NDEBUG)
+#   define ASSERT(expr) assert(expr)
+#else
+#   define ASSERT(expr) ((VOID)0)
+#endif
+
+#define ELEMENT_COUNT(array) (sizeof(array) / sizeof(array[0]))
+#define IS_EOL(ch)          ((ch) == '\n' || (ch) == '\r')
+#define IS_SPACE(ch)        ((ch) == ' ' || (ch) == '\f' || (ch) == '\t' || (ch) == '\v')
+#define MAX(a, b)           (((a) > (b)) ? (a) : (b))
+#define MIN(a, b)           (((a) < (b)) ? (a) : (b))
+#define STRINGIFY(s)        STRINGIFY_HELPER(s)
+#define STRINGIFY_HELPER(s)  #s
+
+#define ZeroMemory(dest, length)        memset((dest), 0, (length))
+#define CopyMemory(dest, src, length)   memcpy((dest), (src), (length))
+#define MoveMemory(dest, src, length)   memmove((dest), (src), (length))
+#define UInt32x32To64(a, b)             ((UINT64)(DWORD)(a) * (UINT64)(DWORD)(b))
+#define _stricmp                        strcasecmp
+#define _strnicmp                       strncasecmp
+
+//
+// Thread error code
+//
+
+extern __thread DWORD posixLastError;
+
+INLINE DWORD GetLastError(VOID)
+{
+    return posixLastError;
+}
+
+INLINE VOID SetLastError(DWORD error)
+{
+    posixLastError = error;
+}
+
+INLINE DWORD GetCurrentThreadId(VOID)
+{
+    return (DWORD)(uintptr_t)pthread_self();
+}
+
+INLINE DWORD GetCurrentProcessId(VOID)
+{
+    return (DWORD)getpid();
+}
+
+INLINE VOID Sleep(DWORD milliseconds)
+{
+    usleep((useconds_t)milliseconds * 1000);
+}
+
+INLINE DWORD SleepEx(DWORD milliseconds, BOOL alertable)
+{
+    UNREFERENCED_PARAMETER(alertable);
+    Sleep(milliseconds);
+    return 0;
+}
+
+//
+// Time functions
+//
+
+INLINE VOID GetSystemTimeAsFileTime(FILETIME *fileTime)
+{
+    struct timespec now;
+    UINT64 value;
+
+    // 100 nanosecond intervals since January 1, 1601
+    clock_gettime(CLOCK_REALTIME, &now);
+    value = ((UINT64)now.tv_sec + 11644473600ULL) * 10000000ULL + (UINT64)now.tv_nsec / 100;
+
+    fileTime->dwLowDateTime  = (DWORD)value;
+    fileTime->dwHighDateTime = (DWORD)(value >> 32);
+}
+
+INLINE VOID GetLocalTime(SYSTEMTIME *systemTime)
+{
+    struct timespec now;
+    struct tm       local;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    localtime_r(&now.tv_sec, &local);
+
+    systemTime->wYear         = (WORD)(local.tm_year + 1900);
+    systemTime->wMonth        = (WORD)(local.tm_mon + 1);
+    systemTime->wDayOfWeek    = (WORD)local.tm_wday;
+    systemTime->wDay          = (WORD)local.tm_mday;
+    systemTime->wHour         = (WORD)local.tm_hour;
+    systemTime->wMinute       = (WORD)local.tm_min;
+    systemTime->wSecond       = (WORD)local.tm_sec;
+    systemTime->wMilliseconds = (WORD)(now.tv_nsec / 1000000);
+}
+
+INLINE DWORD GetTickCount(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (DWORD)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+INLINE BOOL QueryPerformanceCounter(LARGE_INTEGER *count)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    count->QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+    return TRUE;
+}
+
+INLINE BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+//
+// Interlocked operations
+//
+
+#define InterlockedIncrement(target)    __sync_add_and_fetch((target), 1)
+#define InterlockedDecrement(target)    __sync_sub_and_fetch((target), 1)
+#define InterlockedExchange(target, value) __sync_lock_test_and_set((target), (value))
+#define InterlockedCompareExchange(target, exchange, comparand) \
+    __sync_val_compare_and_swap((target), (comparand), (exchange))
+#define InterlockedCompareExchange64(target, exchange, comparand) \
+    __sync_val_compare_and_swap((target), (comparand), (exchange))
+
+//
+// Critical sections
+//
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+INLINE BOOL InitializeCriticalSectionAndSpinCount(CRITICAL_SECTION *critSection, DWORD spinCount)
+{
+    pthread_mutexattr_t attr;
+
+    UNREFERENCED_PARAMETER(spinCount);
+
+    // Win32 critical sections are recursive
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(critSection, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return TRUE;
+}
+
+#define InitializeCriticalSection(cs)   InitializeCriticalSectionAndSpinCount((cs), 0)
+#define DeleteCriticalSection(cs)       pthread_mutex_destroy(cs)
+#define EnterCriticalSection(cs)        pthread_mutex_lock(cs)
+#define LeaveCriticalSection(cs)        pthread_mutex_unlock(cs)
+
+//
+// Semaphores
+//
+
+//
+// Handles are tagged with their type, so CloseHandle() can close either one
+//
+
+#define POSIX_HANDLE_SEMAPHORE  1
+#define POSIX_HANDLE_FILE       2
+
+typedef struct {
+    DWORD           type;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    LONG            count;
+    LONG            maximum;
+} POSIX_SEMAPHORE;
+
+typedef struct {
+    DWORD           type;
+    int             fd;
+} POSIX_FILE;
+
+// The maximum is a "long" since callers pass LONG_MAX, which is wider than LONG here
+INLINE HANDLE CreateSemaphore(VOID *attributes, LONG initial, long maximum, const CHAR *name)
+{
+    POSIX_SEMAPHORE *sem;
+
+    UNREFERENCED_PARAMETER(attributes);
+    UNREFERENCED_PARAMETER(name);
+
+    sem = malloc(sizeof(POSIX_SEMAPHORE));
+    if (sem == NULL) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    pthread_mutex_init(&sem->mutex, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->type    = POSIX_HANDLE_SEMAPHORE;
+    sem->count   = initial;
+    sem->maximum = (LONG)MIN(maximum, INT32_MAX);
+    return sem;
+}
+
+INLINE BOOL ReleaseSemaphore(HANDLE handle, LONG count, LONG *previous)
+{
+    POSIX_SEMAPHORE *sem = handle;
+
+    pthread_mutex_lock(&sem->mutex);
+    if (previous != NULL) {
+        *previous = sem->count;
+    }
+    if (count > sem->maximum - sem->count) {
+        pthread_mutex_unlock(&sem->mutex);
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    sem->count += count;
+    pthread_cond_broadcast(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+    return TRUE;
+}
+
+INLINE DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+    POSIX_SEMAPHORE *sem = handle;
+    struct timespec deadline;
+    DWORD result = WAIT_OBJECT_0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += milliseconds / 1000;
+    deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&sem->mutex);
+    while (sem->count == 0) {
+        if (milliseconds == INFINITE) {
+            pthread_cond_wait(&sem->cond, &sem->mutex);
+        } else if (pthread_cond_timedwait(&sem->cond, &sem->mutex, &deadline) == ETIMEDOUT) {
+            result = WAIT_TIMEOUT;
+            break;
+        }
+    }
+    if (result == WAIT_OBJECT_0) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return result;
+}
+
+INLINE BOOL CloseHandle(HANDLE handle)
+{
+    POSIX_FILE      *file = handle;
+    POSIX_SEMAPHORE *sem  = handle;
+
+    if (file->type == POSIX_HANDLE_FILE) {
+        close(file->fd);
+        free(file);
+        return TRUE;
+    }
+
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+    return TRUE;
+}
+
+//
+// Files, only what logfile.c and namelist.c need; share modes are not enforced
+//
+
+#define GENERIC_READ                0x80000000
+#define GENERIC_WRITE               0x40000000
+#define FILE_SHARE_READ             0x00000001
+#define FILE_SHARE_WRITE            0x00000002
+#define FILE_SHARE_DELETE           0x00000004
+#define CREATE_ALWAYS               2
+#define OPEN_EXISTING               3
+#define OPEN_ALWAYS                 4
+#define FILE_BEGIN                  0
+#define FILE_CURRENT                1
+#define FILE_END                    2
+#define INVALID_SET_FILE_POINTER    0xFFFFFFFF
+#define INVALID_FILE_SIZE           0xFFFFFFFF
+#define MOVEFILE_REPLACE_EXISTING   0x00000001
+
+INLINE DWORD PosixMapErrno(int error)
+{
+    switch (error) {
+        case ENOENT: return ERROR_FILE_NOT_FOUND;
+        case ENOTDIR: return ERROR_PATH_NOT_FOUND;
+        case EACCES:
+        case EPERM:  return ERROR_ACCESS_DENIED;
+        case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    return ERROR_INVALID_FUNCTION;
+}
+
+INLINE HANDLE CreateFileA(const CHAR *path, DWORD access, DWORD share, VOID *attributes,
+    DWORD disposition, DWORD flags, HANDLE templateFile)
+{
+    POSIX_FILE  *file;
+    int         fd;
+    int         mode;
+
+    UNREFERENCED_PARAMETER(share);
+    UNREFERENCED_PARAMETER(attributes);
+    UNREFERENCED_PARAMETER(flags);
+    UNREFERENCED_PARAMETER(templateFile);
+
+    if ((access & GENERIC_READ) && (access & GENERIC_WRITE)) {
+        mode = O_RDWR;
+    } else if (access & GENERIC_WRITE) {
+        mode = O_WRONLY;
+    } else {
+        mode = O_RDONLY;
+    }
+
+    switch (disposition) {
+        case CREATE_ALWAYS: mode |= O_CREAT | O_TRUNC; break;
+        case OPEN_ALWAYS:   mode |= O_CREAT; break;
+    }
+
+    fd = open(path, mode | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        SetLastError(PosixMapErrno(errno));
+        return INVALID_HANDLE_VALUE;
+    }
+
+    file = malloc(sizeof(POSIX_FILE));
+    file->type = POSIX_HANDLE_FILE;
+    file->fd   = fd;
+    return file;
+}
+
+INLINE BOOL WriteFile(HANDLE handle, const VOID *buffer, DWORD length, DWORD *written, VOID *overlapped)
+{
+    POSIX_FILE  *file = handle;
+    ssize_t     result;
+    DWORD       total = 0;
+
+    UNREFERENCED_PARAMETER(overlapped);
+
+    while (total < length) {
+        result = write(file->fd, (const BYTE *)buffer + total, length - total);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SetLastError(PosixMapErrno(errno));
+            *written = total;
+            return FALSE;
+        }
+        total += (DWORD)result;
+    }
+
+    *written = total;
+    return TRUE;
+}
+
+INLINE DWORD SetFilePointer(HANDLE handle, LONG distance, LONG *distanceHigh, DWORD method)
+{
+    POSIX_FILE  *file = handle;
+    off_t       offset;
+
+    offset = (off_t)distance;
+    if (distanceHigh != NULL) {
+        offset = (off_t)(((INT64)*distanceHigh << 32) | (UINT32)distance);
+    }
+
+    offset = lseek(file->fd, offset,
+        (method == FILE_END) ? SEEK_END : (method == FILE_CURRENT) ? SEEK_CUR : SEEK_SET);
+    if (offset == (off_t)-1) {
+        SetLastError(PosixMapErrno(errno));
+        return INVALID_SET_FILE_POINTER;
+    }
+
+    if (distanceHigh != NULL) {
+        *distanceHigh = (LONG)((INT64)offset >> 32);
+    }
+    return (DWORD)offset;
+}
+
+INLINE DWORD GetFileSize(HANDLE handle, DWORD *sizeHigh)
+{
+    POSIX_FILE  *file = handle;
+    struct stat info;
+
+    if (fstat(file->fd, &info) != 0) {
+        SetLastError(PosixMapErrno(errno));
+        return INVALID_FILE_SIZE;
+    }
+
+    if (sizeHigh != NULL) {
+        *sizeHigh = (DWORD)((UINT64)info.st_size >> 32);
+    }
+    return (DWORD)info.st_size;
+}
+
+INLINE BOOL ReadFile(HANDLE handle, VOID *buffer, DWORD length, DWORD *bytesRead, VOID *overlapped)
+{
+    POSIX_FILE  *file = handle;
+    ssize_t     result;
+    DWORD       total = 0;
+
+    UNREFERENCED_PARAMETER(overlapped);
+
+    // Reads until the buffer is full or the end of the file
+    while (total < length) {
+        result = read(file->fd, (BYTE *)buffer + total, length - total);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SetLastError(PosixMapErrno(errno));
+            *bytesRead = total;
+            return FALSE;
+        }
+        if (result == 0) {
+            break;
+        }
+        total += (DWORD)result;
+    }
+
+    *bytesRead = total;
+    return TRUE;
+}
+
+INLINE BOOL MoveFileExA(const CHAR *existingPath, const CHAR *newPath, DWORD flags)
+{
+    if (!(flags & MOVEFILE_REPLACE_EXISTING) && access(newPath, F_OK) == 0) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+    if (rename(existingPath, newPath) != 0) {
+        SetLastError(PosixMapErrno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//
+// Thread local storage
+//
+
+INLINE DWORD TlsAlloc(VOID)
+{
+    pthread_key_t key;
+
+    if (pthread_key_create(&key, NULL) != 0) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return TLS_OUT_OF_INDEXES;
+    }
+    return (DWORD)key;
+}
+
+INLINE BOOL TlsFree(DWORD index)
+{
+    return (pthread_key_delete((pthread_key_t)index) == 0) ? TRUE : FALSE;
+}
+
+INLINE VOID *TlsGetValue(DWORD index)
+{
+    return pthread_getspecific((pthread_key_t)index);
+}
+
+INLINE BOOL TlsSetValue(DWORD index, VOID *value)
+{
+    return (pthread_setspecific((pthread_key_t)index, value) == 0) ? TRUE : FALSE;
+}
+
+//
+// UUID functions, only what config.c needs
+//
+
+#define RPC_S_OK                    0
+#define RPC_S_UUID_NO_ADDRESS       1739
+#define RPC_S_UUID_LOCAL_ONLY       1824
+
+typedef UCHAR *RPC_CSTR;
+
+typedef struct {
+    BYTE data[16];
+} UUID;
+
+INLINE DWORD UuidCreate(UUID *uuid)
+{
+    FILE    *file;
+    SIZE_T  i;
+
+    // Version 4 UUID, from the kernel's random source when it is available
+    file = fopen("/dev/urandom", "rb");
+    if (file == NULL || fread(uuid->data, 1, sizeof(uuid->data), file) != sizeof(uuid->data)) {
+        for (i = 0; i < sizeof(uuid->data); i++) {
+            uuid->data[i] = (BYTE)rand();
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    uuid->data[6] = (uuid->data[6] & 0x0F) | 0x40;
+    uuid->data[8] = (uuid->data[8] & 0x3F) | 0x80;
+    return RPC_S_OK;
+}
+
+INLINE DWORD UuidToStringA(UUID *uuid, RPC_CSTR *string)
+{
+    const BYTE *d = uuid->data;
+    CHAR *buffer;
+
+    buffer = malloc(37);
+    if (buffer == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    snprintf(buffer, 37, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+        d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7],
+        d[8], d[9], d[10], d[11], d[12], d[13], d[14], d[15]);
+
+    *string = (RPC_CSTR)buffer;
+    return RPC_S_OK;
+}
+
+INLINE DWORD RpcStringFree(RPC_CSTR *string)
+{
+    free(*string);
+    *string = NULL;
+    return RPC_S_OK;
+}
+
+//
+// Safe string functions
+//
+
+typedef int HRESULT;
+
+#define S_OK                            0
+#define STRSAFE_E_INSUFFICIENT_BUFFER   ((HRESULT)0x8007007A)
+#define SUCCEEDED(hr)                   ((HRESULT)(hr) >= 0)
+#define FAILED(hr)                      ((HRESULT)(hr) < 0)
+
+INLINE HRESULT StringCchCopyExA(CHAR *dest, SIZE_T destLength, const CHAR *src, CHAR **destEnd, SIZE_T *remaining, DWORD flags)
+{
+    SIZE_T length;
+
+    UNREFERENCED_PARAMETER(flags);
+    if (destLength == 0) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    length = strnlen(src, destLength - 1);
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+
+    if (destEnd != NULL) {
+        *destEnd = dest + length;
+    }
+    if (remaining != NULL) {
+        *remaining = destLength - length;
+    }
+    return (src[length] == '\0') ? S_OK : STRSAFE_E_INSUFFICIENT_BUFFER;
+}
+
+INLINE HRESULT StringCchCopyA(CHAR *dest, SIZE_T destLength, const CHAR *src)
+{
+    return StringCchCopyExA(dest, destLength, src, NULL, NULL, 0);
+}
+
+INLINE HRESULT StringCchCopyNA(CHAR *dest, SIZE_T destLength, const CHAR *src, SIZE_T srcLength)
+{
+    SIZE_T length;
+
+    if (destLength == 0) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    length = strnlen(src, MIN(srcLength, destLength - 1));
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+    return S_OK;
+}
+
+INLINE HRESULT StringCchCatA(CHAR *dest, SIZE_T destLength, const CHAR *src)
+{
+    SIZE_T length = strnlen(dest, destLength);
+
+    if (length >= destLength) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    return StringCchCopyA(dest + length, destLength - length, src);
+}
+
+INLINE HRESULT StringCchVPrintfExA(CHAR *dest, SIZE_T destLength, CHAR **destEnd, SIZE_T *remaining, DWORD flags, const CHAR *format, va_list argList)
+{
+    CHAR        buffer[512];
+    const CHAR  *src;
+    INT         length;
+    SIZE_T      i;
+
+    UNREFERENCED_PARAMETER(flags);
+    if (destLength == 0) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    // Translate the Microsoft "%I64" length modifier, glibc reads it as a flag and width
+    if (strstr(format, "%I64") != NULL) {
+        for (i = 0, src = format; *src != '\0' && i < sizeof(buffer) - 3; src++) {
+            if (src[0] == '%' && src[1] == 'I' && src[2] == '6' && src[3] == '4') {
+                buffer[i++] = '%';
+                buffer[i++] = 'l';
+                buffer[i++] = 'l';
+                src += 3;
+            } else {
+                buffer[i++] = *src;
+            }
+        }
+        buffer[i] = '\0';
+        format = buffer;
+    }
+
+    length = vsnprintf(dest, destLength, format, argList);
+    if (length < 0 || (SIZE_T)length >= destLength) {
+        length = (INT)destLength - 1;
+    }
+
+    if (destEnd != NULL) {
+        *destEnd = dest + length;
+    }
+    if (remaining != NULL) {
+        *remaining = destLength - (SIZE_T)length;
+    }
+    return S_OK;
+}
+
+INLINE HRESULT StringCchVPrintfA(CHAR *dest, SIZE_T destLength, const CHAR *format, va_list argList)
+{
+    return StringCchVPrintfExA(dest, destLength, NULL, NULL, 0, format, argList);
+}
+
+static inline HRESULT StringCchPrintfExA(CHAR *dest, SIZE_T destLength, CHAR **destEnd, SIZE_T *remaining, DWORD flags, const CHAR *format, ...)
+{
+    HRESULT result;
+    va_list argList;
+
+    va_start(argList, format);
+    result = StringCchVPrintfExA(dest, destLength, destEnd, remaining, flags, format, argList);
+    va_end(argList);
+    return result;
+}
+
+static inline HRESULT StringCchPrintfA(CHAR *dest, SIZE_T destLength, const CHAR *format, ...)
+{
+    HRESULT result;
+    va_list argList;
+
+    va_start(argList, format);
+    result = StringCchVPrintfExA(dest, destLength, NULL, NULL, 0, format, argList);
+    va_end(argList);
+    return result;
+}
+
+#define StringCchCopy       StringCchCopyA
+#define StringCchPrintf     StringCchPrintfA
+
+//
+// ioFTPD definitions, laid out as in ioFTPD v7
+//
+
+#define _MAX_NAME           64
+#define _MAX_PATH           260
+#define _IP_LINE_LENGTH     96
+#define MAX_SECTIONS        25
+#define MAX_GROUPS          32
+#define MAX_IPS             16
+
+#define INVALID_GROUP       -1
+#define INVALID_USER        -1
+#define NOGROUP_ID          1
+
+#define JOB_PRIORITY_HIGH   0
+#define JOB_PRIORITY_NORMAL 1
+#define JOB_PRIORITY_LOW    2
+
+typedef struct CONFIG_FILE  CONFIG_FILE;
+typedef struct TIMER        TIMER;
+
+// Split string, the layout is private to the procedure table stub
+typedef struct {
+    CHAR    *buffer;    // Copy of the string, with the items null-terminated
+    CHAR    **items;    // Pointers to each item in the buffer
+    DWORD   count;      // Number of items
+} IO_STRING;
+
+#define GetStringItems(string)  ((string)->count)
+
+typedef struct {
+    CHAR   *buf;
+    DWORD   size;
+    DWORD   len;
+} BUFFER;
+
+typedef struct {
+    INT32   Gid;
+    CHAR    szDescription[128 + 1];
+    INT32   Slots[2];
+    INT32   Users;
+    CHAR    szVfsFile[_MAX_PATH + 1];
+    VOID   *lpInternal;
+    VOID   *lpParent;
+} GROUPFILE;
+
+typedef struct {
+    INT32   Uid;
+    INT32   Gid;
+    CHAR    Tagline[128 + 1];
+    CHAR    MountFile[_MAX_PATH + 1];
+    CHAR    Home[_MAX_PATH + 1];
+    CHAR    Flags[32 + 1];
+    INT32   Limits[5];
+    UCHAR   Password[20];
+    INT32   Ratio[MAX_SECTIONS];
+    INT64   Credits[MAX_SECTIONS];
+    INT64   DayUp[MAX_SECTIONS * 3];
+    INT64   DayDn[MAX_SECTIONS * 3];
+    INT64   WkUp[MAX_SECTIONS * 3];
+    INT64   WkDn[MAX_SECTIONS * 3];
+    INT64   MonthUp[MAX_SECTIONS * 3];
+    INT64   MonthDn[MAX_SECTIONS * 3];
+    INT64   AllUp[MAX_SECTIONS * 3];
+    INT64   AllDn[MAX_SECTIONS * 3];
+    INT32   AdminGroups[MAX_GROUPS];
+    INT32   Groups[MAX_GROUPS];
+    CHAR    Ip[MAX_IPS][_IP_LINE_LENGTH + 1];
+    INT32   CreatorUid;
+    CHAR    CreatorName[_MAX_NAME + 1];
+    INT64   CreatedOn;
+    INT32   LogonCount;
+    INT64   LogonLast;
+    CHAR    LogonHost[_IP_LINE_LENGTH + 1];
+    INT32   MaxUploads;
+    INT32   MaxDownloads;
+    INT32   LimitPerIP;
+    INT64   ExpiresAt;
+    INT64   DeletedOn;
+    INT32   DeletedBy;
+    CHAR    DeletedMsg[_MAX_NAME + 1];
+    INT32   Theme;
+    CHAR    Opaque[256 + 1];
+    VOID   *lpInternal;
+    VOID   *lpParent;
+} USERFILE;
+
+
+// Project headers
+#include <proctable.h>
+#include <logging.h>
+#include <alloc.h>
+#include <debug.h>
+
+//
+// GCC requires "##" to drop the comma before an empty __VA_ARGS__, which the
+// Microsoft compiler does implicitly.
+//
+
+#undef LOG_ERROR
+#undef LOG_WARN
+#undef LOG_INFO
+#undef TRACE
+
+#define LOG_ERROR(format, ...)  LogFormat(LOG_LEVEL_ERROR, format CRLF, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)   LogFormat(LOG_LEVEL_WARN,  format CRLF, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)   LogFormat(LOG_LEVEL_INFO,  format CRLF, ##__VA_ARGS__)
+
+#if LOG_OPTION_TRACE
+#   define TRACE(format, ...)   LogDebuggerTrace(__FILE__, __FUNCTION__, __LINE__, format CRLF, ##__VA_ARGS__)
+#else
+#   define TRACE(format, ...)   ((VOID)0)
+#endif
+
+#endif // BASE_H_INCLUDED
@@ -0,0 +1,115 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Benchmark Stub
+
+Abstract:
+    Replaces config.c, log.c, and the connection pool in database.c for the
+    benchmarks that drive one backend directly, with their own connections.
+    Log messages are written to stderr, and the configuration is set by each
+    benchmark. The replay harness links the real files instead.
+
+*/
+
+#include <base.h>
+#include <config.h>
+#include <database.h>
+
+DB_CONFIG_GLOBAL dbConfigGlobal;
+DB_CONFIG_LOCK   dbConfigLock;
+
+
+//
+// Logging
+//
+
+static VOID LogWrite(const CHAR *format, va_list argList)
+{
+    CHAR        buffer[512];
+    const CHAR  *src;
+    SIZE_T      i;
+
+    // Translate the Microsoft "%I64" length modifier
+    for (i = 0, src = format; *src != '\0' && i < sizeof(buffer) - 3; src++) {
+        if (src[0] == '%' && src[1] == 'I' && src[2] == '6' && src[3] == '4') {
+            buffer[i++] = '%';
+            buffer[i++] = 'l';
+            buffer[i++] = 'l';
+            src += 3;
+        } else {
+            buffer[i++] = *src;
+        }
+    }
+    buffer[i] = '\0';
+
+    vfprintf(stderr, buffer, argList);
+}
+
+VOID FCALL LogFormatV(LOG_LEVEL level, const CHAR *format, va_list argList)
+{
+    if (level <= dbConfigGlobal.logLevel) {
+        LogWrite(format, argList);
+    }
+}
+
+VOID CCALL LogFormat(LOG_LEVEL level, const CHAR *format, ...)
+{
+    va_list argList;
+
+    va_start(argList, format);
+    LogFormatV(level, format, argList);
+    va_end(argList);
+}
+
+VOID CCALL LogTrace(const CHAR *file, const CHAR *func, INT line, LOG_LEVEL level, const CHAR *format, ...)
+{
+    va_list argList;
+
+    UNREFERENCED_PARAMETER(file);
+    UNREFERENCED_PARAMETER(func);
+    UNREFERENCED_PARAMETER(line);
+
+    va_start(argList, format);
+    LogFormatV(level, format, argList);
+    va_end(argList);
+}
+
+VOID CCALL LogDebuggerTrace(const CHAR *file, const CHAR *func, INT line, const CHAR *format, ...)
+{
+    UNREFERENCED_PARAMETER(file);
+    UNREFERENCED_PARAMETER(func);
+    UNREFERENCED_PARAMETER(line);
+    UNREFERENCED_PARAMETER(format);
+}
+
+
+//
+// Connection pool
+//
+
+BOOL FCALL DbAcquire(DB_CONTEXT **dbPtr)
+{
+    // Benchmarks read from one server, so nothing is read from the primary
+    SetLastError(ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+VOID FCALL DbRelease(DB_CONTEXT *db)
+{
+}
+
+DWORD FCALL DbMapError(UINT error)
+{
+    switch (error) {
+        case CR_OUT_OF_MEMORY:
+            return ERROR_NOT_ENOUGH_MEMORY;
+
+        case CR_SERVER_GONE_ERROR:
+        case CR_SERVER_LOST:
+            return ERROR_NOT_CONNECTED;
+    }
+    return ERROR_INVALID_FUNCTION;
+}
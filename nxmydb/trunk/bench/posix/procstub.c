@@ -0,0 +1,1055 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Procedure Table Stub
+
+Abstract:
+    Simulated ioFTPD user and group tables, used to run the module's core
+    outside of ioFTPD. User and group files are kept in memory, and the
+    module functions that would normally call into ioFTPD (registration and
+    the local user/group files) operate on these tables instead.
+
+    ProcStubGetProc() resolves ioFTPD's procedures for ProcTableInit(). The
+    configuration is read from an in-memory INI, the ID tables are written
+    to a temporary directory when namelist.c asks for their path, and timers
+    only run when ProcStubRunTimers() is called.
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <config.h>
+#include <procstub.h>
+
+//
+// Simulated ID table
+//
+
+typedef struct {
+    INT32   id;                     // User or group ID, -1 if deleted
+    CHAR    name[_MAX_NAME + 1];    // User or group name
+    union {
+        GROUPFILE group;
+        USERFILE  user;
+    } file;
+} STUB_ENTRY;
+
+typedef struct {
+    STUB_ENTRY  **entries;  // Entries indexed by ID
+    INT32       count;      // Number of entries used
+    INT32       total;      // Number of entries allocated
+    INT32       *hash;      // Open-addressed hash of names to IDs
+    INT32       hashSize;   // Number of hash slots, a power of two
+} STUB_TABLE;
+
+#define HASH_EMPTY   -1
+#define HASH_DELETED -2
+
+//
+// Simulated INI file and timers
+//
+
+typedef struct STUB_OPTION {
+    CHAR                *array;     // Array name, without the brackets
+    CHAR                *variable;  // Variable name
+    CHAR                *value;     // Value, as written in the file
+    struct STUB_OPTION  *next;
+} STUB_OPTION;
+
+struct CONFIG_FILE {
+    STUB_OPTION *options;   // Options, most recently set first
+};
+
+struct TIMER {
+    Io_TimerProc    *proc;      // Timer procedure
+    VOID            *context;   // Context passed to the procedure
+    DWORD           timeout;    // Milliseconds until ioFTPD would run it
+    struct TIMER    *next;
+};
+
+static CRITICAL_SECTION stubLock;
+static CRITICAL_SECTION stubTimerLock;
+static STUB_TABLE       stubGroupTable;
+static STUB_TABLE       stubUserTable;
+static CONFIG_FILE      stubConfig;
+static TIMER            *stubTimers;
+static CHAR             stubTableDir[] = "/tmp/nxstubXXXXXX";
+
+__thread DWORD posixLastError;
+
+STUB_COUNTERS   stubGroups;
+STUB_COUNTERS   stubUsers;
+DWORD           stubWriteDelay;
+DWORD           stubJobDelay;
+const CHAR      *stubPathPrefix = "";
+
+
+static UINT HashName(const CHAR *name)
+{
+    UINT hash = 2166136261U;
+
+    // FNV-1a
+    while (*name != '\0') {
+        hash ^= (UCHAR)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static INT32 *TableSlot(STUB_TABLE *table, const CHAR *name)
+{
+    INT32 *deleted = NULL;
+    INT32 *slot;
+    UINT  index;
+
+    index = HashName(name) & (table->hashSize - 1);
+    for (;;) {
+        slot = &table->hash[index];
+
+        if (*slot == HASH_EMPTY) {
+            return (deleted != NULL) ? deleted : slot;
+        }
+        if (*slot == HASH_DELETED) {
+            if (deleted == NULL) {
+                deleted = slot;
+            }
+        } else if (strcmp(table->entries[*slot]->name, name) == 0) {
+            return slot;
+        }
+        index = (index + 1) & (table->hashSize - 1);
+    }
+}
+
+static STUB_ENTRY *TableLookup(STUB_TABLE *table, const CHAR *name)
+{
+    INT32 *slot;
+
+    if (table->hashSize == 0) {
+        return NULL;
+    }
+    slot = TableSlot(table, name);
+    return (*slot >= 0) ? table->entries[*slot] : NULL;
+}
+
+static VOID TableRehash(STUB_TABLE *table, INT32 hashSize)
+{
+    INT32 i;
+
+    free(table->hash);
+    table->hash     = malloc(hashSize * sizeof(INT32));
+    table->hashSize = hashSize;
+
+    for (i = 0; i < hashSize; i++) {
+        table->hash[i] = HASH_EMPTY;
+    }
+    for (i = 0; i < table->count; i++) {
+        if (table->entries[i]->id != -1) {
+            *TableSlot(table, table->entries[i]->name) = i;
+        }
+    }
+}
+
+static STUB_ENTRY *TableInsert(STUB_TABLE *table, const CHAR *name)
+{
+    STUB_ENTRY *entry;
+
+    if (TableLookup(table, name) != NULL) {
+        return NULL;
+    }
+
+    if (table->count == table->total) {
+        table->total   = MAX(64, table->total * 2);
+        table->entries = realloc(table->entries, table->total * sizeof(STUB_ENTRY *));
+    }
+    if (table->count * 2 >= table->hashSize) {
+        TableRehash(table, MAX(128, table->hashSize * 2));
+    }
+
+    entry = calloc(1, sizeof(STUB_ENTRY));
+    entry->id = table->count;
+    StringCchCopyA(entry->name, ELEMENT_COUNT(entry->name), name);
+
+    table->entries[table->count] = entry;
+    *TableSlot(table, name) = table->count;
+    table->count++;
+
+    return entry;
+}
+
+static VOID TableRemove(STUB_TABLE *table, STUB_ENTRY *entry)
+{
+    INT32 *slot = TableSlot(table, entry->name);
+
+    ASSERT(*slot == entry->id);
+    *slot = HASH_DELETED;
+    entry->id = -1;
+}
+
+static VOID TableRename(STUB_TABLE *table, STUB_ENTRY *entry, const CHAR *newName)
+{
+    INT32 id = entry->id;
+
+    TableRemove(table, entry);
+    entry->id = id;
+    StringCchCopyA(entry->name, ELEMENT_COUNT(entry->name), newName);
+    *TableSlot(table, newName) = id;
+}
+
+static VOID TableFree(STUB_TABLE *table)
+{
+    INT32 i;
+
+    for (i = 0; i < table->count; i++) {
+        free(table->entries[i]);
+    }
+    free(table->entries);
+    free(table->hash);
+    ZeroMemory(table, sizeof(STUB_TABLE));
+}
+
+static CHAR *TableWriteIds(STUB_TABLE *table, const CHAR *fileName)
+{
+    CHAR    path[_MAX_PATH];
+    FILE    *file;
+    INT32   i;
+
+    StringCchPrintfA(path, ELEMENT_COUNT(path), "%s/%s", stubTableDir, fileName);
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // Same format as ioFTPD's ID tables, "name:id:module" on each line
+    EnterCriticalSection(&stubLock);
+    for (i = 0; i < table->count; i++) {
+        if (table->entries[i]->id != -1) {
+            fprintf(file, "%s:%d:%s\r\n", table->entries[i]->name, i, MODULE_NAME);
+        }
+    }
+    LeaveCriticalSection(&stubLock);
+
+    fclose(file);
+    return strdup(path);
+}
+
+
+//
+// ioFTPD procedures
+//
+
+static INT32 StubGroup2Gid(CHAR *groupName)
+{
+    STUB_ENTRY *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubGroupTable, groupName);
+    LeaveCriticalSection(&stubLock);
+
+    if (entry == NULL) {
+        SetLastError(ERROR_GROUP_NOT_FOUND);
+        return INVALID_GROUP;
+    }
+    return entry->id;
+}
+
+static CHAR *StubGid2Group(INT32 groupId)
+{
+    if (groupId < 0 || groupId >= stubGroupTable.count || stubGroupTable.entries[groupId]->id == -1) {
+        return NULL;
+    }
+    return stubGroupTable.entries[groupId]->name;
+}
+
+static INT32 StubUser2Uid(CHAR *userName)
+{
+    STUB_ENTRY *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubUserTable, userName);
+    LeaveCriticalSection(&stubLock);
+
+    if (entry == NULL) {
+        SetLastError(ERROR_USER_NOT_FOUND);
+        return -1;
+    }
+    return entry->id;
+}
+
+static CHAR *StubUid2User(INT32 userId)
+{
+    if (userId < 0 || userId >= stubUserTable.count || stubUserTable.entries[userId]->id == -1) {
+        return NULL;
+    }
+    return stubUserTable.entries[userId]->name;
+}
+
+static VOID *StubAllocate(DWORD size)
+{
+    return malloc(size);
+}
+
+static VOID *StubReAllocate(VOID *memory, DWORD size)
+{
+    return realloc(memory, size);
+}
+
+static BOOL StubFree(VOID *memory)
+{
+    free(memory);
+    return TRUE;
+}
+
+static STUB_OPTION *ConfigFind(CONFIG_FILE *configFile, const CHAR *array, const CHAR *variable)
+{
+    STUB_OPTION *option;
+
+    for (option = configFile->options; option != NULL; option = option->next) {
+        if (_stricmp(option->array, array) == 0 && _stricmp(option->variable, variable) == 0) {
+            return option;
+        }
+    }
+    return NULL;
+}
+
+static CONFIG_FILE *StubConfigGetIniFile(VOID)
+{
+    return &stubConfig;
+}
+
+static CHAR *StubConfigGet(CONFIG_FILE *configFile, CHAR *array, CHAR *variable, CHAR *buffer, INT *offset)
+{
+    STUB_OPTION *option;
+
+    UNREFERENCED_PARAMETER(buffer);
+    UNREFERENCED_PARAMETER(offset);
+
+    // The ID tables are written when namelist.c reads them
+    if (_stricmp(array, "Locations") == 0) {
+        if (_stricmp(variable, "Group_Id_Table") == 0) {
+            return TableWriteIds(&stubGroupTable, "GroupIdTable");
+        }
+        if (_stricmp(variable, "User_Id_Table") == 0) {
+            return TableWriteIds(&stubUserTable, "UserIdTable");
+        }
+    }
+
+    option = ConfigFind(configFile, array, variable);
+    return (option != NULL) ? strdup(option->value) : NULL;
+}
+
+static BOOL StubConfigGetBool(CONFIG_FILE *configFile, CHAR *array, CHAR *variable, BOOL *value)
+{
+    STUB_OPTION *option = ConfigFind(configFile, array, variable);
+
+    if (option == NULL) {
+        return FALSE;
+    }
+    if (_stricmp(option->value, "True") == 0 || _stricmp(option->value, "Yes") == 0
+            || _stricmp(option->value, "On") == 0 || strcmp(option->value, "1") == 0) {
+        *value = TRUE;
+        return TRUE;
+    }
+    if (_stricmp(option->value, "False") == 0 || _stricmp(option->value, "No") == 0
+            || _stricmp(option->value, "Off") == 0 || strcmp(option->value, "0") == 0) {
+        *value = FALSE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL StubConfigGetInt(CONFIG_FILE *configFile, CHAR *array, CHAR *variable, INT *value)
+{
+    CHAR        *stop;
+    LONG        number;
+    STUB_OPTION *option = ConfigFind(configFile, array, variable);
+
+    if (option == NULL) {
+        return FALSE;
+    }
+    number = strtol(option->value, &stop, 10);
+    if (stop == option->value) {
+        return FALSE;
+    }
+    *value = number;
+    return TRUE;
+}
+
+static CHAR *StubConfigGetPath(CONFIG_FILE *configFile, CHAR *array, CHAR *variable, CHAR *suffix, CHAR *buffer)
+{
+    CHAR    *path;
+    SIZE_T  length;
+
+    UNREFERENCED_PARAMETER(configFile);
+    UNREFERENCED_PARAMETER(array);
+    UNREFERENCED_PARAMETER(variable);
+    UNREFERENCED_PARAMETER(buffer);
+
+    // Paths are the suffix, in the directory set by the benchmark
+    length = strlen(stubPathPrefix) + strlen(suffix) + 1;
+    path = malloc(length);
+    StringCchCopyA(path, length, stubPathPrefix);
+    StringCchCatA(path, length, suffix);
+    return path;
+}
+
+// Returns zero on success, as ioFTPD does
+static BOOL StubSplitString(CHAR *stringIn, IO_STRING *stringOut)
+{
+    CHAR    *p;
+    DWORD   total = 8;
+
+    ZeroMemory(stringOut, sizeof(IO_STRING));
+    stringOut->buffer = strdup(stringIn);
+    stringOut->items  = malloc(total * sizeof(CHAR *));
+
+    // Items are separated by whitespace
+    for (p = strtok(stringOut->buffer, " \t"); p != NULL; p = strtok(NULL, " \t")) {
+        if (stringOut->count == total) {
+            total *= 2;
+            stringOut->items = realloc(stringOut->items, total * sizeof(CHAR *));
+        }
+        stringOut->items[stringOut->count++] = p;
+    }
+    return FALSE;
+}
+
+static CHAR *StubGetStringIndexStatic(IO_STRING *string, DWORD index)
+{
+    return (index < string->count) ? string->items[index] : NULL;
+}
+
+static CHAR *StubGetStringIndex(IO_STRING *string, DWORD index)
+{
+    return (index < string->count) ? strdup(string->items[index]) : NULL;
+}
+
+static VOID StubFreeString(IO_STRING *string)
+{
+    free(string->items);
+    free(string->buffer);
+    ZeroMemory(string, sizeof(IO_STRING));
+}
+
+static BOOL StubPutlog(DWORD logCode, const CHAR *format, ...)
+{
+    UNREFERENCED_PARAMETER(logCode);
+    UNREFERENCED_PARAMETER(format);
+    return TRUE;
+}
+
+static TIMER *StubStartIoTimer(TIMER *timer, Io_TimerProc *proc, VOID *context, DWORD timeout)
+{
+    UNREFERENCED_PARAMETER(timer);
+
+    // Timers only run when ProcStubRunTimers() is called
+    timer = malloc(sizeof(TIMER));
+    timer->proc    = proc;
+    timer->context = context;
+    timer->timeout = timeout;
+
+    EnterCriticalSection(&stubTimerLock);
+    timer->next = stubTimers;
+    stubTimers  = timer;
+    LeaveCriticalSection(&stubTimerLock);
+    return timer;
+}
+
+static BOOL StubStopIoTimer(TIMER *timer, BOOL inTimerProc)
+{
+    TIMER **link;
+
+    UNREFERENCED_PARAMETER(inTimerProc);
+
+    EnterCriticalSection(&stubTimerLock);
+    for (link = &stubTimers; *link != NULL; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            free(timer);
+            break;
+        }
+    }
+    LeaveCriticalSection(&stubTimerLock);
+    return TRUE;
+}
+
+//
+// Procedures the module's core does not call, they fail if they are called
+//
+
+#define STUB_UNSUPPORTED(name, type, params, value)                             \
+static type name params                                                         \
+{                                                                               \
+    SetLastError(ERROR_NOT_SUPPORTED);                                          \
+    return value;                                                               \
+}
+
+STUB_UNSUPPORTED(StubGetGroups,              INT32 *, (DWORD *count), NULL)
+STUB_UNSUPPORTED(StubAscii2GroupFile,        BOOL, (CHAR *buffer, DWORD size, GROUPFILE *groupFile), FALSE)
+STUB_UNSUPPORTED(StubGroupFile2Ascii,        BOOL, (BUFFER *buffer, GROUPFILE *groupFile), FALSE)
+STUB_UNSUPPORTED(StubGroupFileOpen,          BOOL, (CHAR *groupName, GROUPFILE **groupFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubGroupFileOpenPrimitive, BOOL, (INT32 groupId, GROUPFILE **groupFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubGroupFileLock,          BOOL, (GROUPFILE **groupFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubGroupFileUnlock,        BOOL, (GROUPFILE **groupFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubGroupFileClose,         BOOL, (GROUPFILE **groupFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubGetUsers,               INT32 *, (DWORD *count), NULL)
+STUB_UNSUPPORTED(StubAscii2UserFile,         BOOL, (CHAR *buffer, DWORD size, USERFILE *userFile), FALSE)
+STUB_UNSUPPORTED(StubUserFile2Ascii,         BOOL, (BUFFER *buffer, USERFILE *userFile), FALSE)
+STUB_UNSUPPORTED(StubUserFileOpen,           BOOL, (CHAR *userName, USERFILE **userFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubUserFileOpenPrimitive,  BOOL, (INT32 userId, USERFILE **userFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubUserFileLock,           BOOL, (USERFILE **userFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubUserFileUnlock,         BOOL, (USERFILE **userFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubUserFileClose,          BOOL, (USERFILE **userFile, DWORD flags), FALSE)
+STUB_UNSUPPORTED(StubConcatString,           BOOL, (IO_STRING *stringDest, IO_STRING *stringSource), TRUE)
+STUB_UNSUPPORTED(StubGetStringRange,         CHAR *, (IO_STRING *string, DWORD beginIndex, DWORD endIndex), NULL)
+
+typedef struct {
+    Io_JobProc  *proc;
+    VOID        *context;
+    DWORD       delay;      // Milliseconds to wait before running the job
+} STUB_JOB;
+
+static VOID *StubJobThread(VOID *arg)
+{
+    STUB_JOB job = *(STUB_JOB *)arg;
+
+    free(arg);
+
+    // Simulates ioFTPD's job threads being busy with other work
+    if (job.delay > 0) {
+        usleep(job.delay * 1000);
+    }
+    job.proc(job.context);
+    return NULL;
+}
+
+static BOOL StubQueueJob(Io_JobProc *proc, VOID *context, DWORD priority)
+{
+    pthread_attr_t  attr;
+    pthread_t       thread;
+    STUB_JOB        *job;
+    INT             result;
+
+    UNREFERENCED_PARAMETER(priority);
+
+    // Each job runs on its own detached thread, instead of ioFTPD's job threads
+    job = malloc(sizeof(STUB_JOB));
+    job->proc    = proc;
+    job->context = context;
+    job->delay   = stubJobDelay;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    result = pthread_create(&thread, &attr, StubJobThread, job);
+    pthread_attr_destroy(&attr);
+
+    if (result != 0) {
+        free(job);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static VOID StubWrite(VOID)
+{
+    // Local user and group files are written to disk by ioFTPD
+    if (stubWriteDelay > 0) {
+        usleep(stubWriteDelay);
+    }
+}
+
+
+//
+// Module functions, normally in user.c, group.c, userfile.c and groupfile.c
+//
+
+BOOL UserExists(CHAR *userName)
+{
+    return (StubUser2Uid(userName) != -1);
+}
+
+DWORD UserRegister(CHAR *userName, USERFILE *userFile, INT32 *userIdPtr)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubUserTable, userName);
+    if (entry == NULL) {
+        entry = TableInsert(&stubUserTable, userName);
+    }
+
+    userFile->Uid = entry->id;
+    CopyMemory(&entry->file.user, userFile, sizeof(USERFILE));
+    *userIdPtr = entry->id;
+    InterlockedIncrement(&stubUsers.creates);
+
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD UserRegisterAs(CHAR *userName, CHAR *newName)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubUserTable, userName);
+    if (entry == NULL) {
+        result = ERROR_USER_NOT_FOUND;
+    } else if (TableLookup(&stubUserTable, newName) != NULL) {
+        result = ERROR_INVALID_PARAMETER;
+    } else {
+        TableRename(&stubUserTable, entry, newName);
+        InterlockedIncrement(&stubUsers.renames);
+    }
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD UserUnregister(CHAR *userName)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubUserTable, userName);
+    if (entry == NULL) {
+        result = ERROR_USER_NOT_FOUND;
+    } else {
+        TableRemove(&stubUserTable, entry);
+        InterlockedIncrement(&stubUsers.deletes);
+    }
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD UserUpdate(USERFILE *userFile)
+{
+    CHAR *userName = StubUid2User(userFile->Uid);
+
+    return (userName != NULL) ? UserUpdateByName(userName, userFile) : ERROR_USER_NOT_FOUND;
+}
+
+DWORD UserUpdateByName(CHAR *userName, USERFILE *userFile)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubUserTable, userName);
+    if (entry == NULL) {
+        result = ERROR_USER_NOT_FOUND;
+    } else {
+        userFile->Uid        = entry->id;
+        userFile->lpInternal = entry;
+        CopyMemory(&entry->file.user, userFile, sizeof(USERFILE));
+        InterlockedIncrement(&stubUsers.updates);
+    }
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD FileUserCreate(INT32 userId, USERFILE *userFile)
+{
+    UNREFERENCED_PARAMETER(userId);
+    UNREFERENCED_PARAMETER(userFile);
+    return ERROR_SUCCESS;
+}
+
+DWORD FileUserDelete(INT32 userId)
+{
+    UNREFERENCED_PARAMETER(userId);
+    return ERROR_SUCCESS;
+}
+
+DWORD FileUserOpen(INT32 userId, USERFILE *userFile)
+{
+    UNREFERENCED_PARAMETER(userId);
+    UNREFERENCED_PARAMETER(userFile);
+    return ERROR_SUCCESS;
+}
+
+DWORD FileUserWrite(USERFILE *userFile)
+{
+    UNREFERENCED_PARAMETER(userFile);
+    StubWrite();
+    return ERROR_SUCCESS;
+}
+
+DWORD FileUserClose(USERFILE *userFile)
+{
+    userFile->lpInternal = NULL;
+    return ERROR_SUCCESS;
+}
+
+BOOL GroupExists(CHAR *groupName)
+{
+    return (StubGroup2Gid(groupName) != INVALID_GROUP);
+}
+
+DWORD GroupRegister(CHAR *groupName, GROUPFILE *groupFile, INT32 *groupIdPtr)
+{
+    STUB_ENTRY *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubGroupTable, groupName);
+    if (entry == NULL) {
+        entry = TableInsert(&stubGroupTable, groupName);
+    }
+
+    groupFile->Gid = entry->id;
+    CopyMemory(&entry->file.group, groupFile, sizeof(GROUPFILE));
+    *groupIdPtr = entry->id;
+    InterlockedIncrement(&stubGroups.creates);
+
+    LeaveCriticalSection(&stubLock);
+    return ERROR_SUCCESS;
+}
+
+DWORD GroupRegisterAs(CHAR *groupName, CHAR *newName)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubGroupTable, groupName);
+    if (entry == NULL) {
+        result = ERROR_GROUP_NOT_FOUND;
+    } else if (TableLookup(&stubGroupTable, newName) != NULL) {
+        result = ERROR_INVALID_PARAMETER;
+    } else {
+        TableRename(&stubGroupTable, entry, newName);
+        InterlockedIncrement(&stubGroups.renames);
+    }
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD GroupUnregister(CHAR *groupName)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubGroupTable, groupName);
+    if (entry == NULL) {
+        result = ERROR_GROUP_NOT_FOUND;
+    } else {
+        TableRemove(&stubGroupTable, entry);
+        InterlockedIncrement(&stubGroups.deletes);
+    }
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD GroupUpdate(GROUPFILE *groupFile)
+{
+    CHAR *groupName = StubGid2Group(groupFile->Gid);
+
+    return (groupName != NULL) ? GroupUpdateByName(groupName, groupFile) : ERROR_GROUP_NOT_FOUND;
+}
+
+DWORD GroupUpdateByName(CHAR *groupName, GROUPFILE *groupFile)
+{
+    DWORD       result = ERROR_SUCCESS;
+    STUB_ENTRY  *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubGroupTable, groupName);
+    if (entry == NULL) {
+        result = ERROR_GROUP_NOT_FOUND;
+    } else {
+        groupFile->Gid        = entry->id;
+        groupFile->lpInternal = entry;
+        CopyMemory(&entry->file.group, groupFile, sizeof(GROUPFILE));
+        InterlockedIncrement(&stubGroups.updates);
+    }
+    LeaveCriticalSection(&stubLock);
+    return result;
+}
+
+DWORD FileGroupCreate(INT32 groupId, GROUPFILE *groupFile)
+{
+    UNREFERENCED_PARAMETER(groupId);
+    UNREFERENCED_PARAMETER(groupFile);
+    return ERROR_SUCCESS;
+}
+
+DWORD FileGroupDelete(INT32 groupId)
+{
+    UNREFERENCED_PARAMETER(groupId);
+    return ERROR_SUCCESS;
+}
+
+DWORD FileGroupOpen(INT32 groupId, GROUPFILE *groupFile)
+{
+    UNREFERENCED_PARAMETER(groupId);
+    UNREFERENCED_PARAMETER(groupFile);
+    return ERROR_SUCCESS;
+}
+
+DWORD FileGroupWrite(GROUPFILE *groupFile)
+{
+    UNREFERENCED_PARAMETER(groupFile);
+    StubWrite();
+    return ERROR_SUCCESS;
+}
+
+DWORD FileGroupClose(GROUPFILE *groupFile)
+{
+    groupFile->lpInternal = NULL;
+    return ERROR_SUCCESS;
+}
+
+#ifdef DEBUG
+BOOL FCALL IsCriticalSectionOwned(CRITICAL_SECTION *critSection)
+{
+    return (critSection->__data.__owner != 0) ? TRUE : FALSE;
+}
+
+BOOL FCALL IsCriticalSectionCurrentOwner(CRITICAL_SECTION *critSection)
+{
+    return (critSection->__data.__owner == gettid()) ? TRUE : FALSE;
+}
+#endif
+
+
+//
+// Stub management
+//
+
+typedef struct {
+    const CHAR  *name;
+    VOID        *proc;
+} STUB_PROC;
+
+static const STUB_PROC stubProcs[] = {
+    {"Config_GetIniFile",       StubConfigGetIniFile},
+    {"Config_Get",              StubConfigGet},
+    {"Config_GetBool",          StubConfigGetBool},
+    {"Config_GetInt",           StubConfigGetInt},
+    {"Config_GetPath",          StubConfigGetPath},
+
+    {"GetGroups",               StubGetGroups},
+    {"Gid2Group",               StubGid2Group},
+    {"Group2Gid",               StubGroup2Gid},
+    {"Ascii2GroupFile",         StubAscii2GroupFile},
+    {"GroupFile2Ascii",         StubGroupFile2Ascii},
+    {"GroupFile_Open",          StubGroupFileOpen},
+    {"GroupFile_OpenPrimitive", StubGroupFileOpenPrimitive},
+    {"GroupFile_Lock",          StubGroupFileLock},
+    {"GroupFile_Unlock",        StubGroupFileUnlock},
+    {"GroupFile_Close",         StubGroupFileClose},
+
+    {"GetUsers",                StubGetUsers},
+    {"Uid2User",                StubUid2User},
+    {"User2Uid",                StubUser2Uid},
+    {"Ascii2UserFile",          StubAscii2UserFile},
+    {"UserFile2Ascii",          StubUserFile2Ascii},
+    {"UserFile_Open",           StubUserFileOpen},
+    {"UserFile_OpenPrimitive",  StubUserFileOpenPrimitive},
+    {"UserFile_Lock",           StubUserFileLock},
+    {"UserFile_Unlock",         StubUserFileUnlock},
+    {"UserFile_Close",          StubUserFileClose},
+
+    {"Allocate",                StubAllocate},
+    {"ReAllocate",              StubReAllocate},
+    {"Free",                    StubFree},
+
+    {"ConcatString",            StubConcatString},
+    {"SplitString",             StubSplitString},
+    {"GetStringIndex",          StubGetStringIndex},
+    {"GetStringIndexStatic",    StubGetStringIndexStatic},
+    {"GetStringRange",          StubGetStringRange},
+    {"FreeString",              StubFreeString},
+
+    {"Putlog",                  StubPutlog},
+    {"QueueJob",                StubQueueJob},
+    {"StartIoTimer",            StubStartIoTimer},
+    {"StopIoTimer",             StubStopIoTimer},
+};
+
+VOID *ProcStubGetProc(CHAR *name)
+{
+    SIZE_T i;
+
+    for (i = 0; i < ELEMENT_COUNT(stubProcs); i++) {
+        if (strcmp(stubProcs[i].name, name) == 0) {
+            return stubProcs[i].proc;
+        }
+    }
+    return NULL;
+}
+
+VOID ProcStubInit(LOG_LEVEL logLevel)
+{
+    InitializeCriticalSectionAndSpinCount(&stubLock, 0);
+    InitializeCriticalSectionAndSpinCount(&stubTimerLock, 0);
+
+    // ID tables are written to a directory of their own
+    if (mkdtemp(stubTableDir) == NULL) {
+        fprintf(stderr, "Unable to create a directory for the ID tables.\n");
+        exit(1);
+    }
+
+    // Resolved as ioFTPD's GetProc would, for DbInit()
+    ProcTableInit(ProcStubGetProc);
+
+    // Settings normally read by config.c
+    dbConfigGlobal.logLevel = logLevel;
+    dbConfigLock.expire  = 60;
+    dbConfigLock.timeout = 5;
+    dbConfigLock.timeoutMili = dbConfigLock.timeout * 1000;
+    StringCchCopyA(dbConfigLock.owner, ELEMENT_COUNT(dbConfigLock.owner), "00000000-0000-0000-0000-000000000000");
+    dbConfigLock.ownerLength = strlen(dbConfigLock.owner);
+
+    // Group ID 1 is always "NoGroup"
+    ProcStubAddGroup("Admin");
+    ProcStubAddGroup("NoGroup");
+}
+
+VOID ProcStubFinalize(VOID)
+{
+    CHAR        path[_MAX_PATH];
+    STUB_OPTION *option;
+    TIMER       *timer;
+
+    TableFree(&stubGroupTable);
+    TableFree(&stubUserTable);
+
+    while ((option = stubConfig.options) != NULL) {
+        stubConfig.options = option->next;
+        free(option->array);
+        free(option->variable);
+        free(option->value);
+        free(option);
+    }
+    while ((timer = stubTimers) != NULL) {
+        stubTimers = timer->next;
+        free(timer);
+    }
+
+    StringCchPrintfA(path, ELEMENT_COUNT(path), "%s/GroupIdTable", stubTableDir);
+    unlink(path);
+    StringCchPrintfA(path, ELEMENT_COUNT(path), "%s/UserIdTable", stubTableDir);
+    unlink(path);
+    rmdir(stubTableDir);
+
+    DeleteCriticalSection(&stubTimerLock);
+    DeleteCriticalSection(&stubLock);
+}
+
+VOID ProcStubSetConfig(const CHAR *array, const CHAR *variable, const CHAR *value)
+{
+    STUB_OPTION *option = ConfigFind(&stubConfig, array, variable);
+
+    if (option != NULL) {
+        free(option->value);
+    } else {
+        option = malloc(sizeof(STUB_OPTION));
+        option->array    = strdup(array);
+        option->variable = strdup(variable);
+        option->next     = stubConfig.options;
+        stubConfig.options = option;
+    }
+    option->value = strdup(value);
+}
+
+DWORD ProcStubLoadConfig(const CHAR *path)
+{
+    CHAR    array[_MAX_NAME + 1] = "";
+    CHAR    line[1024];
+    CHAR    *end;
+    CHAR    *p;
+    CHAR    *value;
+    FILE    *file;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return PosixMapErrno(errno);
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        // Strip leading and trailing whitespace
+        for (p = line; IS_SPACE(*p); p++);
+        end = p + strlen(p);
+        while (end > p && (IS_SPACE(end[-1]) || IS_EOL(end[-1]))) {
+            *--end = '\0';
+        }
+
+        if (*p == '[') {
+            end = strchr(p, ']');
+            if (end != NULL) {
+                *end = '\0';
+                StringCchCopyA(array, ELEMENT_COUNT(array), p + 1);
+            }
+        } else if (*p != '\0' && *p != '#' && *p != ';' && array[0] != '\0') {
+            // Comments after the value are stripped by config.c
+            value = strchr(p, '=');
+            if (value != NULL) {
+                for (end = value; end > p && IS_SPACE(end[-1]); end--);
+                *end = '\0';
+                for (value++; IS_SPACE(*value); value++);
+                ProcStubSetConfig(array, p, value);
+            }
+        }
+    }
+
+    fclose(file);
+    return ERROR_SUCCESS;
+}
+
+VOID ProcStubRunTimers(VOID)
+{
+    TIMER *timer;
+
+    // Timers run one at a time, and each one once, as if all of them expired
+    EnterCriticalSection(&stubTimerLock);
+    for (timer = stubTimers; timer != NULL; timer = timer->next) {
+        timer->timeout = timer->proc(timer->context, timer);
+    }
+    LeaveCriticalSection(&stubTimerLock);
+}
+
+INT32 ProcStubAddGroup(const CHAR *groupName)
+{
+    STUB_ENTRY *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubGroupTable, groupName);
+    if (entry == NULL) {
+        entry = TableInsert(&stubGroupTable, groupName);
+    }
+    LeaveCriticalSection(&stubLock);
+    return entry->id;
+}
+
+INT32 ProcStubAddUser(const CHAR *userName)
+{
+    STUB_ENTRY *entry;
+
+    EnterCriticalSection(&stubLock);
+    entry = TableLookup(&stubUserTable, userName);
+    if (entry == NULL) {
+        entry = TableInsert(&stubUserTable, userName);
+    }
+    LeaveCriticalSection(&stubLock);
+    return entry->id;
+}
+
+GROUPFILE *ProcStubGetGroup(const CHAR *groupName)
+{
+    STUB_ENTRY *entry = TableLookup(&stubGroupTable, groupName);
+    return (entry != NULL) ? &entry->file.group : NULL;
+}
+
+USERFILE *ProcStubGetUser(const CHAR *userName)
+{
+    STUB_ENTRY *entry = TableLookup(&stubUserTable, userName);
+    return (entry != NULL) ? &entry->file.user : NULL;
+}
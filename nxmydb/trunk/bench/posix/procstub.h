@@ -0,0 +1,45 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Procedure Table Stub
+
+Abstract:
+    Simulated ioFTPD user and group tables and procedures, used to run the
+    module's core outside of ioFTPD.
+
+*/
+
+#ifndef PROCSTUB_H_INCLUDED
+#define PROCSTUB_H_INCLUDED
+
+typedef struct {
+    LONG    creates;    // Users or groups created by the module
+    LONG    updates;    // Users or groups updated by the module
+    LONG    renames;    // Users or groups renamed by the module
+    LONG    deletes;    // Users or groups deleted by the module
+} STUB_COUNTERS;
+
+extern STUB_COUNTERS stubUsers;
+extern STUB_COUNTERS stubGroups;
+extern DWORD         stubWriteDelay;   // Microseconds each user or group file write takes
+extern DWORD         stubJobDelay;     // Milliseconds each queued job waits before it starts
+extern const CHAR    *stubPathPrefix;  // Prefix of paths returned by Io_ConfigGetPath()
+
+VOID *ProcStubGetProc(CHAR *name);
+VOID  ProcStubInit(LOG_LEVEL logLevel);
+VOID  ProcStubFinalize(VOID);
+
+VOID  ProcStubSetConfig(const CHAR *array, const CHAR *variable, const CHAR *value);
+DWORD ProcStubLoadConfig(const CHAR *path);
+VOID  ProcStubRunTimers(VOID);
+
+INT32 ProcStubAddGroup(const CHAR *groupName);
+INT32 ProcStubAddUser(const CHAR *userName);
+
+GROUPFILE *ProcStubGetGroup(const CHAR *groupName);
+USERFILE  *ProcStubGetUser(const CHAR *userName);
+
+#endif // PROCSTUB_H_INCLUDED
@@ -0,0 +1,1017 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Replay Harness
+
+Abstract:
+    Replays a recorded workload against the module's core and a local MySQL
+    or MariaDB server. Unlike the other benchmarks, the module is loaded as
+    ioFTPD would load it: DbInit() resolves the procedure table stub, reads
+    the configuration, opens the log file and the connection pool, and the
+    synchronization runs from its timer. Each operation makes the same module
+    calls as user.c and group.c do for ioFTPD, on several threads.
+
+    Throughput, latency percentiles, and the queries sent to the server are
+    reported for each operation. Queries are counted by wrapping the client
+    library's query, prepare, and execute functions at link time.
+
+    Workload files have one operation on each line, lines starting with "#"
+    are comments. Operations are replayed in order, as fast as possible, and
+    the next operation is started as soon as a thread is free.
+
+      gcreate <group>          Create a group.
+      create <user> <group>    Create a user.
+      delete <user>            Delete a user.
+      rename <user> <new>      Rename a user.
+      login <user>             Lock the user, update the logon statistics, write, and unlock.
+      upload <user> <kb>       Lock the user, add to the upload statistics and credits, write, and unlock.
+      download <user> <kb>     Lock the user, add to the download statistics, write, and unlock.
+      sync                     Run the module's timers: synchronization and statistics flush.
+      purge                    Purge old entries from the changes tables.
+      barrier                  Wait for all previous operations to finish.
+
+    Users are opened the first time an operation uses them, and kept open
+    until they are deleted or the replay ends, as ioFTPD keeps them.
+
+    The "-g" option writes a workload instead: groups and users are created,
+    then logins and transfers are made by random users, with a few renames
+    and a sync every "-s" operations. The options in "[nxMyDB]" and "[Local]"
+    may be overridden with an INI file given to "-c".
+
+    The database must already contain the tables from schema.sql. The "-r"
+    option deletes all users and groups in it first.
+
+    Usage:
+      replay [-h host] [-P port] [-u user] [-p password] [-d database]
+             [-c ini_file] [-o log_dir] [-t threads] [-r] workload
+      replay -g workload [-n users] [-l operations] [-s sync_every]
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <config.h>
+#include <database.h>
+#include <procstub.h>
+
+#define GROUP_COUNT     10
+#define THREAD_MAX      64
+#define USER_BUCKETS    4096
+
+typedef enum {
+    OP_GCREATE = 0,
+    OP_CREATE,
+    OP_DELETE,
+    OP_RENAME,
+    OP_LOGIN,
+    OP_UPLOAD,
+    OP_DOWNLOAD,
+    OP_SYNC,
+    OP_PURGE,
+    OP_BARRIER,
+    OP_COUNT
+} OPERATION;
+
+static const CHAR *opNames[OP_COUNT] = {
+    "gcreate", "create", "delete", "rename", "login", "upload", "download", "sync", "purge", "barrier"
+};
+
+typedef struct {
+    OPERATION   type;
+    CHAR        name[_MAX_NAME + 1];    // User or group name
+    CHAR        arg[_MAX_NAME + 1];     // Group of a new user, or new name of a renamed user
+    INT64       kb;                     // Kilobytes transferred
+    LONG        gate;                   // Operations that must finish before this one starts
+} REPLAY_OP;
+
+typedef struct REPLAY_USER {
+    CHAR                name[_MAX_NAME + 1];
+    USERFILE            file;   // User file, as kept open by ioFTPD
+    struct REPLAY_USER  *next;
+} REPLAY_USER;
+
+typedef struct {
+    pthread_mutex_t lock;   // Held during an operation on any of the bucket's users
+    REPLAY_USER     *head;
+} USER_BUCKET;
+
+typedef struct {
+    double      *samples;   // Latency of each call, in seconds
+    LONG        count;      // Operations replayed
+    LONG        total;      // Samples allocated
+    LONG        failures;   // Operations that failed
+    UINT64      queries;    // Queries and statement executions sent
+    UINT64      prepares;   // Statements prepared
+} OP_STATS;
+
+typedef struct {
+    INT         index;              // Thread index
+    OP_STATS    stats[OP_COUNT];    // Statistics for each operation
+} WORKER;
+
+static CHAR     *dbHost     = "localhost";
+static CHAR     *dbUser     = "root";
+static CHAR     *dbPassword = NULL;
+static CHAR     *dbDatabase = "ioftpd";
+static CHAR     *dbPort     = NULL;
+
+static REPLAY_OP    *ops;
+static LONG         opCount;
+static LONG volatile opNext;
+static LONG volatile opDone;
+static USER_BUCKET  buckets[USER_BUCKETS];
+
+static __thread UINT64 threadQueries;
+static __thread UINT64 threadPrepares;
+
+//
+// Query counters, the linker sends the client library calls here
+//
+
+int __real_mysql_query(MYSQL *mysql, const char *query);
+int __real_mysql_real_query(MYSQL *mysql, const char *query, unsigned long length);
+int __real_mysql_stmt_execute(MYSQL_STMT *stmt);
+int __real_mysql_stmt_prepare(MYSQL_STMT *stmt, const char *query, unsigned long length);
+
+int __wrap_mysql_query(MYSQL *mysql, const char *query)
+{
+    threadQueries++;
+    return __real_mysql_query(mysql, query);
+}
+
+int __wrap_mysql_real_query(MYSQL *mysql, const char *query, unsigned long length)
+{
+    threadQueries++;
+    return __real_mysql_real_query(mysql, query, length);
+}
+
+int __wrap_mysql_stmt_execute(MYSQL_STMT *stmt)
+{
+    threadQueries++;
+    return __real_mysql_stmt_execute(stmt);
+}
+
+int __wrap_mysql_stmt_prepare(MYSQL_STMT *stmt, const char *query, unsigned long length)
+{
+    threadPrepares++;
+    return __real_mysql_stmt_prepare(stmt, query, length);
+}
+
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static INT CompareDouble(const VOID *elem1, const VOID *elem2)
+{
+    double value1 = *(const double *)elem1;
+    double value2 = *(const double *)elem2;
+
+    return (value1 > value2) - (value1 < value2);
+}
+
+static USER_BUCKET *UserBucket(const CHAR *userName)
+{
+    UINT hash = 2166136261U;
+
+    // FNV-1a
+    while (*userName != '\0') {
+        hash ^= (UCHAR)*userName++;
+        hash *= 16777619U;
+    }
+    return &buckets[hash & (USER_BUCKETS - 1)];
+}
+
+static REPLAY_USER **UserFind(USER_BUCKET *bucket, const CHAR *userName)
+{
+    REPLAY_USER **link;
+
+    for (link = &bucket->head; *link != NULL; link = &(*link)->next) {
+        if (strcmp((*link)->name, userName) == 0) {
+            break;
+        }
+    }
+    return link;
+}
+
+
+//
+// Module calls, made in the same order as user.c and group.c make them
+//
+
+static DWORD ModuleGroupCreate(CHAR *groupName)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+    GROUPFILE   groupFile;
+    INT32       groupId;
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+
+    ZeroMemory(&groupFile, sizeof(GROUPFILE));
+    groupFile.Slots[0] = -1;
+    groupFile.Slots[1] = -1;
+
+    result = GroupRegister(groupName, &groupFile, &groupId);
+    if (result == ERROR_SUCCESS) {
+        result = FileGroupCreate(groupId, &groupFile);
+        if (result == ERROR_SUCCESS) {
+            result = DbGroupCreate(db, groupName, &groupFile);
+        }
+        if (result != ERROR_SUCCESS) {
+            FileGroupDelete(groupId);
+            GroupUnregister(groupName);
+        }
+    }
+
+    DbRelease(db);
+    return result;
+}
+
+static DWORD ModuleCreate(CHAR *userName, CHAR *groupName)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+    INT32       groupId;
+    INT32       userId;
+    USERFILE    userFile;
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+
+    groupId = Io_Group2Gid(groupName);
+    if (groupId == INVALID_GROUP) {
+        groupId = NOGROUP_ID;
+    }
+
+    ZeroMemory(&userFile, sizeof(USERFILE));
+    userFile.Gid            = groupId;
+    userFile.Groups[0]      = groupId;
+    userFile.Groups[1]      = -1;
+    userFile.AdminGroups[0] = -1;
+    userFile.CreatorUid     = -1;
+    userFile.MaxUploads     = -1;
+    userFile.MaxDownloads   = -1;
+    userFile.Ratio[0]       = 3;
+    StringCchCopyA(userFile.Flags, ELEMENT_COUNT(userFile.Flags), "3");
+    StringCchCopyA(userFile.Home, ELEMENT_COUNT(userFile.Home), "/");
+    StringCchCopyA(userFile.Ip[0], ELEMENT_COUNT(userFile.Ip[0]), "*@*");
+
+    result = UserRegister(userName, &userFile, &userId);
+    if (result == ERROR_SUCCESS) {
+        result = FileUserCreate(userId, &userFile);
+        if (result == ERROR_SUCCESS) {
+            result = DbUserCreate(db, userName, &userFile);
+        }
+        if (result != ERROR_SUCCESS) {
+            FileUserDelete(userId);
+            UserUnregister(userName);
+        }
+    }
+
+    DbRelease(db);
+    return result;
+}
+
+static DWORD ModuleOpen(CHAR *userName, USERFILE *userFile)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+
+    ZeroMemory(userFile, sizeof(USERFILE));
+    userFile->Uid = Io_User2Uid(userName);
+    if (userFile->Uid == -1) {
+        return ERROR_USER_NOT_FOUND;
+    }
+
+    result = FileUserOpen(userFile->Uid, userFile);
+    if (result != ERROR_SUCCESS) {
+        return result;
+    }
+
+    // Read the cached record, or the database record from a replica
+    if (DbUserCacheOpen(userName, userFile)) {
+        result = ERROR_SUCCESS;
+    } else if (!DbAcquireRead(&db, &dbUserCache, userName)) {
+        result = GetLastError();
+    } else {
+        result = DbUserOpen(db, userName, userFile);
+        DbRelease(db);
+    }
+
+    if (result != ERROR_SUCCESS) {
+        FileUserClose(userFile);
+    }
+    return result;
+}
+
+static VOID ModuleClose(CHAR *userName, USERFILE *userFile)
+{
+    DB_CONTEXT *db;
+
+    // Merge the statistics of a user that is no longer in use
+    if (DbUserStatsPending(userName) && DbAcquire(&db)) {
+        DbUserStatsFlush(db, userName);
+        DbRelease(db);
+    }
+    DbUserStatsClose(userName);
+
+    FileUserClose(userFile);
+    DbUserClose(userFile);
+}
+
+static DWORD ModuleLock(CHAR *userName, USERFILE *userFile)
+{
+    DB_BACKOFF  backoff;
+    DB_CONTEXT  *db;
+    DWORD       result;
+
+    DbBackoffInit(&backoff, dbConfigLock.timeoutMili);
+    do {
+        if (!DbAcquire(&db)) {
+            return GetLastError();
+        }
+        result = DbUserLock(db, userName, userFile);
+        DbRelease(db);
+    } while (result == ERROR_USER_LOCK_FAILED && DbBackoffWait(&backoff));
+
+    return result;
+}
+
+static DWORD ModuleWriteUnlock(CHAR *userName, USERFILE *userFile)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+
+    // ioFTPD writes the user, then unlocks it
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+    FileUserWrite(userFile);
+    result = DbUserWrite(db, userName, userFile);
+    if (result == ERROR_SUCCESS && dbConfigStats.flush == 0) {
+        result = DbUserStatsFlush(db, userName);
+    }
+    DbRelease(db);
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+    if (result == ERROR_SUCCESS) {
+        result = DbUserUnlock(db, userName);
+    } else {
+        DbUserUnlock(db, userName);
+    }
+    DbRelease(db);
+
+    return result;
+}
+
+static DWORD ModuleRename(CHAR *userName, CHAR *newName)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+    result = DbUserRename(db, userName, newName);
+    if (result == ERROR_SUCCESS) {
+        result = UserRegisterAs(userName, newName);
+    }
+    DbRelease(db);
+    return result;
+}
+
+static DWORD ModuleDelete(CHAR *userName)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+    INT32       userId;
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+    userId = Io_User2Uid(userName);
+    if (userId != -1) {
+        FileUserDelete(userId);
+    }
+    result = DbUserDelete(db, userName);
+    if (result == ERROR_SUCCESS) {
+        result = UserUnregister(userName);
+    }
+    DbRelease(db);
+    return result;
+}
+
+
+//
+// Operations
+//
+
+static DWORD ReplayUserUpdate(REPLAY_OP *op)
+{
+    DWORD           result;
+    INT             i;
+    REPLAY_USER     **link;
+    REPLAY_USER     *user;
+    USER_BUCKET     *bucket;
+
+    bucket = UserBucket(op->name);
+    pthread_mutex_lock(&bucket->lock);
+
+    // Open the user if ioFTPD does not have it open yet
+    link = UserFind(bucket, op->name);
+    user = *link;
+    if (user == NULL) {
+        user = calloc(1, sizeof(REPLAY_USER));
+        StringCchCopyA(user->name, ELEMENT_COUNT(user->name), op->name);
+
+        result = ModuleOpen(user->name, &user->file);
+        if (result != ERROR_SUCCESS) {
+            free(user);
+            pthread_mutex_unlock(&bucket->lock);
+            return result;
+        }
+        user->next   = bucket->head;
+        bucket->head = user;
+    }
+
+    result = ModuleLock(user->name, &user->file);
+    if (result == ERROR_SUCCESS) {
+        switch (op->type) {
+            case OP_LOGIN:
+                user->file.LogonCount++;
+                user->file.LogonLast = (INT64)time(NULL);
+                StringCchCopyA(user->file.LogonHost, ELEMENT_COUNT(user->file.LogonHost), "replay@127.0.0.1");
+                break;
+
+            case OP_UPLOAD:
+                // Statistics for the day, week, month, and all time
+                for (i = 0; i < 3; i++) {
+                    user->file.DayUp[i]   += (i == 0) ? op->kb : 1;
+                    user->file.WkUp[i]    += (i == 0) ? op->kb : 1;
+                    user->file.MonthUp[i] += (i == 0) ? op->kb : 1;
+                    user->file.AllUp[i]   += (i == 0) ? op->kb : 1;
+                }
+                user->file.Credits[0] += op->kb * MAX(user->file.Ratio[0], 0);
+                break;
+
+            default:
+                for (i = 0; i < 3; i++) {
+                    user->file.DayDn[i]   += (i == 0) ? op->kb : 1;
+                    user->file.WkDn[i]    += (i == 0) ? op->kb : 1;
+                    user->file.MonthDn[i] += (i == 0) ? op->kb : 1;
+                    user->file.AllDn[i]   += (i == 0) ? op->kb : 1;
+                }
+                if (user->file.Ratio[0] > 0) {
+                    user->file.Credits[0] -= op->kb;
+                }
+                break;
+        }
+        result = ModuleWriteUnlock(user->name, &user->file);
+    }
+
+    pthread_mutex_unlock(&bucket->lock);
+    return result;
+}
+
+static DWORD ReplayUserRename(REPLAY_OP *op)
+{
+    DWORD           result;
+    REPLAY_USER     **link;
+    REPLAY_USER     *user;
+    USER_BUCKET     *bucket;
+    USER_BUCKET     *newBucket;
+
+    // Buckets are locked in address order
+    bucket    = UserBucket(op->name);
+    newBucket = UserBucket(op->arg);
+    pthread_mutex_lock(MIN(bucket, newBucket) == bucket ? &bucket->lock : &newBucket->lock);
+    if (newBucket != bucket) {
+        pthread_mutex_lock(MAX(bucket, newBucket) == bucket ? &bucket->lock : &newBucket->lock);
+    }
+
+    result = ModuleRename(op->name, op->arg);
+    if (result == ERROR_SUCCESS) {
+        // An open user stays open under its new name
+        link = UserFind(bucket, op->name);
+        user = *link;
+        if (user != NULL) {
+            *link = user->next;
+            StringCchCopyA(user->name, ELEMENT_COUNT(user->name), op->arg);
+            user->next      = newBucket->head;
+            newBucket->head = user;
+        }
+    }
+
+    if (newBucket != bucket) {
+        pthread_mutex_unlock(&newBucket->lock);
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    return result;
+}
+
+static DWORD ReplayUserDelete(REPLAY_OP *op)
+{
+    DWORD           result;
+    REPLAY_USER     **link;
+    REPLAY_USER     *user;
+    USER_BUCKET     *bucket;
+
+    bucket = UserBucket(op->name);
+    pthread_mutex_lock(&bucket->lock);
+
+    result = ModuleDelete(op->name);
+    if (result == ERROR_SUCCESS) {
+        // ioFTPD closes a deleted user once it is no longer used
+        link = UserFind(bucket, op->name);
+        user = *link;
+        if (user != NULL) {
+            *link = user->next;
+            ModuleClose(user->name, &user->file);
+            free(user);
+        }
+    }
+
+    pthread_mutex_unlock(&bucket->lock);
+    return result;
+}
+
+static VOID ReplayUserCloseAll(VOID)
+{
+    INT         i;
+    REPLAY_USER *user;
+
+    for (i = 0; i < USER_BUCKETS; i++) {
+        while ((user = buckets[i].head) != NULL) {
+            buckets[i].head = user->next;
+            ModuleClose(user->name, &user->file);
+            free(user);
+        }
+    }
+}
+
+static DWORD Replay(REPLAY_OP *op)
+{
+    switch (op->type) {
+        case OP_GCREATE:
+            return ModuleGroupCreate(op->name);
+
+        case OP_CREATE:
+            return ModuleCreate(op->name, op->arg);
+
+        case OP_DELETE:
+            return ReplayUserDelete(op);
+
+        case OP_RENAME:
+            return ReplayUserRename(op);
+
+        case OP_LOGIN:
+        case OP_UPLOAD:
+        case OP_DOWNLOAD:
+            return ReplayUserUpdate(op);
+
+        case OP_SYNC:
+            ProcStubRunTimers();
+            return ERROR_SUCCESS;
+
+        case OP_PURGE:
+            DbSyncPurge();
+            return ERROR_SUCCESS;
+
+        default:
+            return ERROR_SUCCESS;
+    }
+}
+
+static VOID *ReplayThread(VOID *arg)
+{
+    DWORD       result;
+    double      start;
+    LONG        index;
+    OP_STATS    *stats;
+    REPLAY_OP   *op;
+    UINT64      prepares;
+    UINT64      queries;
+    WORKER      *worker = arg;
+
+    for (;;) {
+        index = InterlockedIncrement(&opNext) - 1;
+        if (index >= opCount) {
+            break;
+        }
+        op = &ops[index];
+
+        // Wait for the operations before the last barrier
+        while (opDone < op->gate) {
+            usleep(100);
+        }
+
+        queries  = threadQueries;
+        prepares = threadPrepares;
+        start    = TimeNow();
+
+        result = Replay(op);
+
+        stats = &worker->stats[op->type];
+        if (stats->count == stats->total) {
+            stats->total   = MAX(1024, stats->total * 2);
+            stats->samples = realloc(stats->samples, stats->total * sizeof(double));
+        }
+        stats->samples[stats->count++] = TimeNow() - start;
+        stats->queries  += threadQueries - queries;
+        stats->prepares += threadPrepares - prepares;
+        if (result != ERROR_SUCCESS) {
+            stats->failures++;
+        }
+
+        InterlockedIncrement(&opDone);
+    }
+    return NULL;
+}
+
+
+//
+// Workload files
+//
+
+static BOOL WorkloadLoad(const CHAR *path)
+{
+    CHAR        line[512];
+    CHAR        type[32];
+    FILE        *file;
+    INT         fields;
+    INT         i;
+    LONG        gate = 0;
+    LONG        lineNumber = 0;
+    LONG        total = 0;
+    REPLAY_OP   *op;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open workload \"%s\": %s\n", path, strerror(errno));
+        return FALSE;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        if (opCount == total) {
+            total = MAX(4096, total * 2);
+            ops   = realloc(ops, total * sizeof(REPLAY_OP));
+        }
+        op = &ops[opCount];
+        ZeroMemory(op, sizeof(REPLAY_OP));
+
+        fields = sscanf(line, "%31s %64s %64s", type, op->name, op->arg);
+        for (i = 0; i < OP_COUNT && strcmp(type, opNames[i]) != 0; i++);
+        op->type = (OPERATION)i;
+
+        switch (op->type) {
+            case OP_CREATE:
+            case OP_RENAME:
+                fields -= 2;
+                break;
+            case OP_UPLOAD:
+            case OP_DOWNLOAD:
+                op->kb = strtoll(op->arg, NULL, 10);
+                fields -= 2;
+                break;
+            case OP_GCREATE:
+            case OP_DELETE:
+            case OP_LOGIN:
+                fields -= 1;
+                break;
+            case OP_SYNC:
+            case OP_PURGE:
+            case OP_BARRIER:
+                break;
+            default:
+                fields = 0;
+                break;
+        }
+        if (fields != 1) {
+            fprintf(stderr, "Invalid operation on line %ld of \"%s\".\n", (long)lineNumber, path);
+            fclose(file);
+            return FALSE;
+        }
+
+        // A barrier waits for everything before it, and everything after it
+        // waits for the barrier
+        if (op->type == OP_BARRIER) {
+            op->gate = opCount;
+            gate     = opCount + 1;
+        } else {
+            op->gate = gate;
+        }
+        opCount++;
+    }
+
+    fclose(file);
+    return TRUE;
+}
+
+static BOOL WorkloadGenerate(const CHAR *path, INT userCount, INT opTotal, INT syncEvery)
+{
+    CHAR    (*names)[_MAX_NAME + 1];
+    FILE    *file;
+    INT     i;
+    INT     renames = 0;
+    INT     roll;
+    INT     user;
+    INT     userLive;
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to create workload \"%s\": %s\n", path, strerror(errno));
+        return FALSE;
+    }
+
+    // Same workload for every run
+    srand(1);
+
+    fprintf(file, "# nxMyDB replay workload: %d users, %d operations, sync every %d\n", userCount, opTotal, syncEvery);
+    for (i = 0; i < GROUP_COUNT; i++) {
+        fprintf(file, "gcreate group%d\n", i);
+    }
+    fprintf(file, "barrier\n");
+
+    names = calloc(userCount, sizeof(*names));
+    for (i = 0; i < userCount; i++) {
+        StringCchPrintfA(names[i], ELEMENT_COUNT(names[i]), "user%05d", i);
+        fprintf(file, "create %s group%d\n", names[i], i % GROUP_COUNT);
+    }
+    fprintf(file, "barrier\nsync\nbarrier\n");
+
+    // Renamed users are moved past the end, and no longer used
+    userLive = userCount;
+    for (i = 0; i < opTotal; i++) {
+        if (syncEvery > 0 && i > 0 && i % syncEvery == 0) {
+            fprintf(file, "sync\n");
+        }
+
+        user = rand() % userLive;
+        roll = rand() % 1000;
+        if (roll < 550) {
+            fprintf(file, "login %s\n", names[user]);
+        } else if (roll < 775) {
+            fprintf(file, "upload %s %d\n", names[user], 1 + rand() % 102400);
+        } else if (roll < 999 || userLive < 2) {
+            fprintf(file, "download %s %d\n", names[user], 1 + rand() % 102400);
+        } else {
+            fprintf(file, "rename %s %sr%d\n", names[user], names[user], renames++);
+            userLive--;
+            StringCchCopyA(names[user], ELEMENT_COUNT(names[user]), names[userLive]);
+        }
+    }
+    fprintf(file, "sync\n");
+
+    free(names);
+    fclose(file);
+    return TRUE;
+}
+
+
+//
+// Reporting
+//
+
+static VOID Report(WORKER *workers, INT threadCount, double elapsed)
+{
+    double      *merged;
+    INT         i;
+    INT         op;
+    LONG        count;
+    LONG        failures;
+    LONG        totalOps = 0;
+    UINT64      prepares;
+    UINT64      queries;
+    UINT64      totalPrepares = 0;
+    UINT64      totalQueries = 0;
+
+    printf("%-9s %8s %7s %9s %9s %9s %9s %9s %10s\n",
+        "Operation", "Count", "Failed", "Ops/s", "p50 ms", "p90 ms", "p99 ms", "Max ms", "Queries/op");
+
+    for (op = 0; op < OP_COUNT; op++) {
+        if (op == OP_BARRIER) {
+            continue;
+        }
+
+        count = failures = 0;
+        queries = prepares = 0;
+        for (i = 0; i < threadCount; i++) {
+            count    += workers[i].stats[op].count;
+            failures += workers[i].stats[op].failures;
+            queries  += workers[i].stats[op].queries;
+            prepares += workers[i].stats[op].prepares;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        merged = malloc(count * sizeof(double));
+        count  = 0;
+        for (i = 0; i < threadCount; i++) {
+            CopyMemory(&merged[count], workers[i].stats[op].samples, workers[i].stats[op].count * sizeof(double));
+            count += workers[i].stats[op].count;
+        }
+        qsort(merged, count, sizeof(double), CompareDouble);
+
+        printf("%-9s %8ld %7ld %9.0f %9.3f %9.3f %9.3f %9.3f %10.2f\n",
+            opNames[op], (long)count, (long)failures, count / elapsed,
+            merged[count / 2] * 1000.0,
+            merged[(count * 90) / 100] * 1000.0,
+            merged[(count * 99) / 100] * 1000.0,
+            merged[count - 1] * 1000.0,
+            (double)queries / count);
+
+        totalOps      += count;
+        totalQueries  += queries;
+        totalPrepares += prepares;
+        free(merged);
+    }
+
+    printf("\nTotal:   %ld operations in %.1f ms, %.0f ops/s, %llu queries, %llu statements prepared\n",
+        (long)totalOps, elapsed * 1000.0, totalOps / elapsed,
+        (unsigned long long)totalQueries, (unsigned long long)totalPrepares);
+    printf("Local users: %d created, %d updated, %d renamed, %d deleted\n",
+        stubUsers.creates, stubUsers.updates, stubUsers.renames, stubUsers.deletes);
+}
+
+static BOOL Reset(VOID)
+{
+    DB_CONTEXT  *db;
+    INT         i;
+    static const CHAR *tables[] = {
+        "io_user", "io_user_admins", "io_user_groups", "io_user_hosts", "io_user_changes",
+        "io_group", "io_group_changes"
+    };
+    CHAR        query[64];
+
+    if (!DbAcquire(&db)) {
+        return FALSE;
+    }
+    for (i = 0; i < (INT)ELEMENT_COUNT(tables); i++) {
+        StringCchPrintfA(query, ELEMENT_COUNT(query), "DELETE FROM %s", tables[i]);
+        if (mysql_query(db->handle, query) != 0) {
+            fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+            DbRelease(db);
+            return FALSE;
+        }
+    }
+    DbRelease(db);
+    return TRUE;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-h host] [-P port] [-u user] [-p password] [-d database]\n"
+           "       %*s [-c ini_file] [-o log_dir] [-t threads] [-r] workload\n"
+           "       %s -g workload [-n users] [-l operations] [-s sync_every]\n",
+           argv0, (INT)strlen(argv0), "", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    BOOL        reset = FALSE;
+    CHAR        logDir[_MAX_PATH] = "/tmp/";
+    CHAR        *generate = NULL;
+    CHAR        *iniFile = NULL;
+    double      elapsed;
+    double      start;
+    DWORD       result;
+    INT         i;
+    INT         opt;
+    INT         opTotal = 100000;
+    INT         syncEvery = 5000;
+    INT         threadCount = 8;
+    INT         userCount = 1000;
+    pthread_t   handles[THREAD_MAX];
+    WORKER      *workers;
+
+    while ((opt = getopt(argc, argv, "h:P:u:p:d:c:o:t:rg:n:l:s:")) != -1) {
+        switch (opt) {
+            case 'h': dbHost      = optarg; break;
+            case 'P': dbPort      = optarg; break;
+            case 'u': dbUser      = optarg; break;
+            case 'p': dbPassword  = optarg; break;
+            case 'd': dbDatabase  = optarg; break;
+            case 'c': iniFile     = optarg; break;
+            case 'o': StringCchPrintfA(logDir, ELEMENT_COUNT(logDir), "%s/", optarg); break;
+            case 't': threadCount = atoi(optarg); break;
+            case 'r': reset       = TRUE; break;
+            case 'g': generate    = optarg; break;
+            case 'n': userCount   = atoi(optarg); break;
+            case 'l': opTotal     = atoi(optarg); break;
+            case 's': syncEvery   = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (generate != NULL) {
+        if (userCount <= 0 || opTotal < 0 || syncEvery < 0) {
+            Usage(argv[0]);
+            return 1;
+        }
+        return WorkloadGenerate(generate, userCount, opTotal, syncEvery) ? 0 : 1;
+    }
+    if (optind != argc - 1 || threadCount <= 0 || threadCount > THREAD_MAX) {
+        Usage(argv[0]);
+        return 1;
+    }
+    if (!WorkloadLoad(argv[optind])) {
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_ERROR);
+    stubPathPrefix = logDir;
+
+    // Options read by config.c, the INI file may override them
+    ProcStubSetConfig("nxMyDB", "Servers", "Local");
+    ProcStubSetConfig("nxMyDB", "Sync", "True");
+    ProcStubSetConfig("nxMyDB", "Log_Level", "2");
+    ProcStubSetConfig("Local", "Host", dbHost);
+    ProcStubSetConfig("Local", "User", dbUser);
+    ProcStubSetConfig("Local", "Database", dbDatabase);
+    if (dbPassword != NULL) {
+        ProcStubSetConfig("Local", "Password", dbPassword);
+    }
+    if (dbPort != NULL) {
+        ProcStubSetConfig("Local", "Port", dbPort);
+    }
+    if (iniFile != NULL) {
+        result = ProcStubLoadConfig(iniFile);
+        if (result != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to read \"%s\" (error %lu).\n", iniFile, (unsigned long)result);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < USER_BUCKETS; i++) {
+        pthread_mutex_init(&buckets[i].lock, NULL);
+    }
+
+    // Loaded as ioFTPD loads the module, and started as on the server start event
+    if (!DbInit(ProcStubGetProc)) {
+        fprintf(stderr, "Unable to initialize the module, see %snxMyDB.log.\n", logDir);
+        return 1;
+    }
+    if (reset && !Reset()) {
+        DbFinalize();
+        return 1;
+    }
+    DbSyncStart();
+
+    printf("Workload: %s, %ld operations, %d threads\n", argv[optind], (long)opCount, threadCount);
+    printf("Config:   Sync %s, Sync_Threads %d, Cache_Size %d, Stats_Flush %ds, Pool %d-%d\n\n",
+        dbConfigSync.enabled ? "on" : "off", dbConfigSync.threads, dbConfigCache.size,
+        dbConfigStats.flush / 1000, dbConfigPool.minimum, dbConfigPool.maximum);
+
+    workers = calloc(threadCount, sizeof(WORKER));
+
+    start = TimeNow();
+    for (i = 0; i < threadCount; i++) {
+        workers[i].index = i;
+        pthread_create(&handles[i], NULL, ReplayThread, &workers[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    elapsed = TimeNow() - start;
+
+    Report(workers, threadCount, elapsed);
+
+    // Users are closed and the module unloaded as on the server stop event,
+    // the pool and cache statistics are written to the log
+    ReplayUserCloseAll();
+    DbSyncStop();
+    DbFinalize();
+
+    printf("Log file:    %snxMyDB.log\n", logDir);
+
+    for (i = 0; i < threadCount; i++) {
+        for (opt = 0; opt < OP_COUNT; opt++) {
+            free(workers[i].stats[opt].samples);
+        }
+    }
+    free(workers);
+    free(ops);
+    ProcStubFinalize();
+    return 0;
+}
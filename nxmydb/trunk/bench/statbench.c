@@ -0,0 +1,656 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Statistics Replay Benchmark
+
+Abstract:
+    Replays a trace of transfers against a local MySQL or MariaDB server, from
+    several simulated servers sharing the database. Every simulated server is
+    a separate process that keeps its own copy of each user-file, as ioFTPD
+    does, and updates the copy's statistics and credits for each transfer.
+
+    The "full row" pass writes the whole user after every transfer, the way
+    DbUserWrite() used to: one UPDATE of every io_user column, and the user's
+    admin-groups, groups, and hosts deleted and inserted again. The
+    "coalesced" pass calls DbUserWrite(), which buffers the changes, and a
+    flush thread merges them every few hundred milliseconds.
+
+    Afterwards, the statistics and credits of every user are compared with
+    the totals of the trace. Writing whole rows loses the transfers of the
+    other servers; merging the changes must not.
+
+    The database must already contain the tables from schema.sql. All users
+    in it, and the batches recorded in io_user_flush, are deleted.
+
+    Usage:
+      statbench [-h host] [-P port] [-u user] [-p password] [-d database]
+                [-s servers] [-t threads] [-n users] [-e events] [-f flush-ms]
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <config.h>
+#include <database.h>
+#include <procstub.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SERVER_MAX      32
+#define THREAD_MAX      32
+#define CREDIT_RATIO    3
+
+//
+// Statements of the legacy write, executed in one transaction
+//
+
+typedef enum {
+    LEGACY_USERS = 0,
+    LEGACY_DEL_ADMINS,
+    LEGACY_DEL_GROUPS,
+    LEGACY_ADD_GROUPS,
+    LEGACY_DEL_HOSTS,
+    LEGACY_ADD_HOSTS,
+    LEGACY_COUNT
+} LEGACY_STMT;
+
+static const CHAR *legacyQueries[LEGACY_COUNT] = {
+    "UPDATE io_user SET description=?, flags=?, home=?, limits=?,"
+    " password=?, vfsfile=?, credits=?, ratio=?, alldn=?, allup=?,"
+    " daydn=?, dayup=?, monthdn=?, monthup=?, wkdn=?, wkup=?,"
+    " creator=?, createdon=?, logoncount=?, logonlast=?, logonhost=?,"
+    " maxups=?, maxdowns=?, maxlogins=?, expiresat=?, deletedon=?,"
+    " deletedby=?, deletedmsg=?, theme=?, opaque=?,"
+    " updated=UNIX_TIMESTAMP()"
+    "   WHERE name=?",
+    "DELETE FROM io_user_admins WHERE uname=?",
+    "DELETE FROM io_user_groups WHERE uname=?",
+    "REPLACE INTO io_user_groups(uname,gname,idx) VALUES(?,?,0)",
+    "DELETE FROM io_user_hosts WHERE uname=?",
+    "REPLACE INTO io_user_hosts(uname,host) VALUES(?,?)",
+};
+
+// Columns of the legacy UPDATE, a size of zero is a null-terminated string
+static const struct {
+    enum enum_field_types   type;
+    SIZE_T                  offset;
+    SIZE_T                  size;
+} legacyColumns[] = {
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, Tagline),      0},
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, Flags),        0},
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, Home),         0},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, Limits),       sizeof(((USERFILE *)0)->Limits)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, Password),     sizeof(((USERFILE *)0)->Password)},
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, MountFile),    0},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, Credits),      sizeof(((USERFILE *)0)->Credits)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, Ratio),        sizeof(((USERFILE *)0)->Ratio)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, AllDn),        sizeof(((USERFILE *)0)->AllDn)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, AllUp),        sizeof(((USERFILE *)0)->AllUp)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, DayDn),        sizeof(((USERFILE *)0)->DayDn)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, DayUp),        sizeof(((USERFILE *)0)->DayUp)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, MonthDn),      sizeof(((USERFILE *)0)->MonthDn)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, MonthUp),      sizeof(((USERFILE *)0)->MonthUp)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, WkDn),         sizeof(((USERFILE *)0)->WkDn)},
+    {MYSQL_TYPE_BLOB,     offsetof(USERFILE, WkUp),         sizeof(((USERFILE *)0)->WkUp)},
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, CreatorName),  0},
+    {MYSQL_TYPE_LONGLONG, offsetof(USERFILE, CreatedOn),    sizeof(INT64)},
+    {MYSQL_TYPE_LONG,     offsetof(USERFILE, LogonCount),   sizeof(INT32)},
+    {MYSQL_TYPE_LONGLONG, offsetof(USERFILE, LogonLast),    sizeof(INT64)},
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, LogonHost),    0},
+    {MYSQL_TYPE_LONG,     offsetof(USERFILE, MaxUploads),   sizeof(INT32)},
+    {MYSQL_TYPE_LONG,     offsetof(USERFILE, MaxDownloads), sizeof(INT32)},
+    {MYSQL_TYPE_LONG,     offsetof(USERFILE, LimitPerIP),   sizeof(INT32)},
+    {MYSQL_TYPE_LONGLONG, offsetof(USERFILE, ExpiresAt),    sizeof(INT64)},
+    {MYSQL_TYPE_LONGLONG, offsetof(USERFILE, DeletedOn),    sizeof(INT64)},
+    {MYSQL_TYPE_STRING,   0,                                0}, // deletedby
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, DeletedMsg),   0},
+    {MYSQL_TYPE_LONG,     offsetof(USERFILE, Theme),        sizeof(INT32)},
+    {MYSQL_TYPE_STRING,   offsetof(USERFILE, Opaque),       0},
+};
+
+#define DELETED_BY_COLUMN 26
+
+//
+// Totals of the trace for one user, shared by all simulated servers
+//
+
+typedef struct {
+    INT64   filesUp;    // Files uploaded
+    INT64   bytesUp;    // Kilobytes uploaded
+    INT64   filesDn;    // Files downloaded
+    INT64   bytesDn;    // Kilobytes downloaded
+    INT64   credits;    // Credits earned and spent
+} TOTALS;
+
+typedef struct {
+    CHAR            name[_MAX_NAME + 1];    // User name
+    pthread_mutex_t mutex;                  // Serializes changes to the user-file
+    USERFILE        userFile;               // Server's copy of the user-file
+} CACHED_USER;
+
+typedef struct {
+    INT     server;                     // Simulated server index
+    INT     thread;                     // Thread index within the server
+    LONG    statements;                 // Statements executed for legacy writes
+    LONG    failures;                   // Writes that failed
+} WORKER;
+
+static CHAR     *dbHost     = "localhost";
+static CHAR     *dbUser     = "root";
+static CHAR     *dbPassword = NULL;
+static CHAR     *dbDatabase = "ioftpd";
+static INT      dbPort      = 0;
+
+static BOOL     coalescePass;
+static INT      eventCount  = 2000;
+static INT      flushMs     = 250;
+static INT      serverCount = 4;
+static INT      threadCount = 4;
+static INT      userCount   = 200;
+
+static CACHED_USER  *cache;             // Users of the simulated server
+static TOTALS       *totals;            // Shared trace totals, one per user
+static LONG         *results;           // Shared statement and failure counts
+static volatile BOOL flushStop;
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static BOOL Connect(DB_CONTEXT *db)
+{
+    ZeroMemory(db, sizeof(DB_CONTEXT));
+
+    db->handle = mysql_init(NULL);
+    if (mysql_real_connect(db->handle, dbHost, dbUser, dbPassword, dbDatabase, dbPort, NULL, 0) == NULL) {
+        fprintf(stderr, "Unable to connect: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+    db->threadId = mysql_thread_id(db->handle);
+    return TRUE;
+}
+
+static VOID Disconnect(DB_CONTEXT *db)
+{
+    DbStmtFlush(db);
+    mysql_close(db->handle);
+}
+
+static VOID UserNameFormat(CHAR *buffer, SIZE_T length, INT index)
+{
+    StringCchPrintfA(buffer, length, "user%05d", index);
+}
+
+static BOOL Populate(DB_CONTEXT *db)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    DWORD       error;
+    INT         i;
+    USERFILE    userFile;
+
+    if (mysql_query(db->handle, "DELETE FROM io_user") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_admins") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_groups") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_hosts") != 0 ||
+            mysql_query(db->handle, "DELETE FROM io_user_flush") != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+
+    for (i = 0; i < userCount; i++) {
+        UserNameFormat(userName, ELEMENT_COUNT(userName), i);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        userFile.Groups[0]      = NOGROUP_ID;
+        userFile.Groups[1]      = INVALID_GROUP;
+        userFile.AdminGroups[0] = INVALID_GROUP;
+        userFile.Ratio[0]       = CREDIT_RATIO;
+        StringCchCopyA(userFile.Tagline, ELEMENT_COUNT(userFile.Tagline), "Tagline");
+        StringCchCopyA(userFile.Flags, ELEMENT_COUNT(userFile.Flags), "3");
+        StringCchCopyA(userFile.Home, ELEMENT_COUNT(userFile.Home), "/");
+        StringCchPrintfA(userFile.Ip[0], ELEMENT_COUNT(userFile.Ip[0]), "*@10.0.%d.%d", (i >> 8) & 255, i & 255);
+
+        error = DbUserCreate(db, userName, &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create user \"%s\" (error %lu).\n", userName, (unsigned long)error);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOL LegacyPrepare(DB_CONTEXT *db, MYSQL_STMT **stmts)
+{
+    INT i;
+
+    for (i = 0; i < LEGACY_COUNT; i++) {
+        stmts[i] = mysql_stmt_init(db->handle);
+        if (mysql_stmt_prepare(stmts[i], legacyQueries[i], strlen(legacyQueries[i])) != 0) {
+            fprintf(stderr, "Unable to prepare statement: %s\n", mysql_stmt_error(stmts[i]));
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static DWORD LegacyWrite(DB_CONTEXT *db, MYSQL_STMT **stmts, CHAR *userName, USERFILE *userFile, LONG *statements)
+{
+    BYTE            *base = (BYTE *)userFile;
+    CHAR            groupName[] = "NoGroup";
+    INT             i;
+    MYSQL_BIND      bindExtra[2];
+    MYSQL_BIND      bindUsers[ELEMENT_COUNT(legacyColumns) + 1];
+    unsigned long   userNameLength;
+
+    userNameLength = strlen(userName);
+
+    //
+    // Every column of the row, as the legacy DbUserWrite() bound them
+    //
+
+    ZeroMemory(&bindUsers, sizeof(bindUsers));
+    for (i = 0; i < (INT)ELEMENT_COUNT(legacyColumns); i++) {
+        bindUsers[i].buffer_type = legacyColumns[i].type;
+
+        if (i == DELETED_BY_COLUMN) {
+            bindUsers[i].buffer        = "";
+            bindUsers[i].buffer_length = 0;
+        } else if (legacyColumns[i].size == 0) {
+            bindUsers[i].buffer        = base + legacyColumns[i].offset;
+            bindUsers[i].buffer_length = strlen((CHAR *)base + legacyColumns[i].offset);
+        } else {
+            bindUsers[i].buffer        = base + legacyColumns[i].offset;
+            bindUsers[i].buffer_length = legacyColumns[i].size;
+        }
+    }
+    bindUsers[i].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[i].buffer        = userName;
+    bindUsers[i].buffer_length = userNameLength;
+
+    ZeroMemory(&bindExtra, sizeof(bindExtra));
+    bindExtra[0].buffer_type   = MYSQL_TYPE_STRING;
+    bindExtra[0].buffer        = userName;
+    bindExtra[0].buffer_length = userNameLength;
+
+    if (mysql_query(db->handle, "START TRANSACTION") != 0) {
+        return DbMapErrorFromConn(db->handle);
+    }
+    (*statements)++;
+
+    for (i = 0; i < LEGACY_COUNT; i++) {
+        switch (i) {
+            case LEGACY_USERS:
+                mysql_stmt_bind_param(stmts[i], bindUsers);
+                break;
+
+            case LEGACY_ADD_GROUPS:
+                bindExtra[1].buffer_type   = MYSQL_TYPE_STRING;
+                bindExtra[1].buffer        = groupName;
+                bindExtra[1].buffer_length = strlen(groupName);
+                mysql_stmt_bind_param(stmts[i], bindExtra);
+                break;
+
+            case LEGACY_ADD_HOSTS:
+                bindExtra[1].buffer_type   = MYSQL_TYPE_STRING;
+                bindExtra[1].buffer        = userFile->Ip[0];
+                bindExtra[1].buffer_length = strlen(userFile->Ip[0]);
+                mysql_stmt_bind_param(stmts[i], bindExtra);
+                break;
+
+            default:
+                mysql_stmt_bind_param(stmts[i], bindExtra);
+                break;
+        }
+
+        (*statements)++;
+        if (mysql_stmt_execute(stmts[i]) != 0) {
+            fprintf(stderr, "Unable to execute statement: %s\n", mysql_stmt_error(stmts[i]));
+            mysql_query(db->handle, "ROLLBACK");
+            return DbMapErrorFromStmt(stmts[i]);
+        }
+    }
+
+    (*statements)++;
+    if (mysql_query(db->handle, "COMMIT") != 0) {
+        return DbMapErrorFromConn(db->handle);
+    }
+    return ERROR_SUCCESS;
+}
+
+static VOID Transfer(USERFILE *userFile, TOTALS *total, BOOL upload, INT64 kiloBytes, INT64 seconds)
+{
+    INT64   *stats[4];
+    INT     i;
+
+    if (upload) {
+        stats[0] = userFile->AllUp;
+        stats[1] = userFile->DayUp;
+        stats[2] = userFile->WkUp;
+        stats[3] = userFile->MonthUp;
+    } else {
+        stats[0] = userFile->AllDn;
+        stats[1] = userFile->DayDn;
+        stats[2] = userFile->WkDn;
+        stats[3] = userFile->MonthDn;
+    }
+
+    // Section 0: files, kilobytes, and seconds
+    for (i = 0; i < 4; i++) {
+        stats[i][0] += 1;
+        stats[i][1] += kiloBytes;
+        stats[i][2] += seconds;
+    }
+
+    if (upload) {
+        userFile->Credits[0] += kiloBytes * CREDIT_RATIO;
+        __sync_fetch_and_add(&total->filesUp, 1);
+        __sync_fetch_and_add(&total->bytesUp, kiloBytes);
+        __sync_fetch_and_add(&total->credits, kiloBytes * CREDIT_RATIO);
+    } else {
+        userFile->Credits[0] -= kiloBytes;
+        __sync_fetch_and_add(&total->filesDn, 1);
+        __sync_fetch_and_add(&total->bytesDn, kiloBytes);
+        __sync_fetch_and_add(&total->credits, -kiloBytes);
+    }
+}
+
+static VOID *WorkerThread(VOID *argument)
+{
+    BOOL        upload;
+    CACHED_USER *user;
+    DB_CONTEXT  db;
+    DWORD       error;
+    INT         i;
+    INT         index;
+    INT64       kiloBytes;
+    INT64       seconds;
+    MYSQL_STMT  *stmts[LEGACY_COUNT];
+    UINT        seed;
+    WORKER      *worker = argument;
+
+    mysql_thread_init();
+    if (!Connect(&db) || (!coalescePass && !LegacyPrepare(&db, stmts))) {
+        worker->failures = eventCount;
+        return NULL;
+    }
+
+    // The same trace is replayed by both passes
+    seed = (UINT)(worker->server * THREAD_MAX + worker->thread + 1);
+
+    for (i = 0; i < eventCount; i++) {
+        // A fifth of the users make most of the transfers
+        if (rand_r(&seed) % 100 < 80) {
+            index = rand_r(&seed) % MAX(userCount / 5, 1);
+        } else {
+            index = rand_r(&seed) % userCount;
+        }
+        upload    = (rand_r(&seed) & 1) ? TRUE : FALSE;
+        kiloBytes = 1024 + rand_r(&seed) % (50 * 1024);
+        seconds   = 1 + rand_r(&seed) % 30;
+
+        user = &cache[index];
+        pthread_mutex_lock(&user->mutex);
+
+        Transfer(&user->userFile, &totals[index], upload, kiloBytes, seconds);
+        if (coalescePass) {
+            error = DbUserWrite(&db, user->name, &user->userFile);
+        } else {
+            error = LegacyWrite(&db, stmts, user->name, &user->userFile, &worker->statements);
+        }
+
+        pthread_mutex_unlock(&user->mutex);
+
+        if (error != ERROR_SUCCESS) {
+            worker->failures++;
+        }
+    }
+
+    if (!coalescePass) {
+        for (i = 0; i < LEGACY_COUNT; i++) {
+            mysql_stmt_close(stmts[i]);
+        }
+    }
+    Disconnect(&db);
+    mysql_thread_end();
+    return NULL;
+}
+
+static VOID *FlushThread(VOID *argument)
+{
+    DB_CONTEXT  *db = argument;
+
+    mysql_thread_init();
+    while (!flushStop) {
+        Sleep(flushMs);
+        DbUserStatsFlush(db, NULL);
+    }
+    mysql_thread_end();
+    return NULL;
+}
+
+static VOID RunServer(INT server)
+{
+    DB_CONTEXT      db;
+    DWORD           error;
+    INT             i;
+    pthread_t       flusher;
+    pthread_t       threads[THREAD_MAX];
+    STATS_COUNTERS  counters;
+    WORKER          workers[THREAD_MAX];
+
+    // Each server records its flushed batches under its own UUID
+    StringCchPrintfA(dbConfigLock.owner, ELEMENT_COUNT(dbConfigLock.owner),
+        "00000000-0000-0000-0000-%012d", server);
+    dbConfigLock.ownerLength = strlen(dbConfigLock.owner);
+
+    if (!Connect(&db)) {
+        return;
+    }
+
+    //
+    // Load the server's copy of each user, as a lock would
+    //
+
+    cache = calloc(userCount, sizeof(CACHED_USER));
+    for (i = 0; i < userCount; i++) {
+        UserNameFormat(cache[i].name, ELEMENT_COUNT(cache[i].name), i);
+        pthread_mutex_init(&cache[i].mutex, NULL);
+
+        error = DbUserRead(&db, cache[i].name, &cache[i].userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to read user \"%s\" (error %lu).\n", cache[i].name, (unsigned long)error);
+            return;
+        }
+        DbUserStatsLoad(cache[i].name, &cache[i].userFile, TRUE);
+    }
+
+    flushStop = FALSE;
+    if (coalescePass) {
+        pthread_create(&flusher, NULL, FlushThread, &db);
+    }
+
+    ZeroMemory(&workers, sizeof(workers));
+    for (i = 0; i < threadCount; i++) {
+        workers[i].server = server;
+        workers[i].thread = i;
+        pthread_create(&threads[i], NULL, WorkerThread, &workers[i]);
+    }
+    for (i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+        __sync_fetch_and_add(&results[0], workers[i].statements);
+        __sync_fetch_and_add(&results[1], workers[i].failures);
+    }
+
+    if (coalescePass) {
+        flushStop = TRUE;
+        pthread_join(flusher, NULL);
+
+        // Merge what is left, as the server would when it stops
+        DbUserStatsFlush(&db, NULL);
+
+        // Each batch is a transaction with a locking read, an update, and its sequence number
+        DbUserStatsCounters(&counters);
+        __sync_fetch_and_add(&results[0], counters.batches * 5);
+        __sync_fetch_and_add(&results[2], counters.rows);
+    }
+
+    Disconnect(&db);
+}
+
+static BOOL Verify(DB_CONTEXT *db, INT *mismatches, INT64 *lostKiloBytes)
+{
+    CHAR        userName[_MAX_NAME + 1];
+    DWORD       error;
+    INT         i;
+    USERFILE    userFile;
+
+    *mismatches    = 0;
+    *lostKiloBytes = 0;
+
+    for (i = 0; i < userCount; i++) {
+        UserNameFormat(userName, ELEMENT_COUNT(userName), i);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        error = DbUserRead(db, userName, &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to read user \"%s\" (error %lu).\n", userName, (unsigned long)error);
+            return FALSE;
+        }
+
+        if (userFile.AllUp[0]   != totals[i].filesUp || userFile.AllUp[1]   != totals[i].bytesUp ||
+                userFile.AllDn[0]   != totals[i].filesDn || userFile.AllDn[1]   != totals[i].bytesDn ||
+                userFile.DayUp[1]   != totals[i].bytesUp || userFile.MonthDn[1] != totals[i].bytesDn ||
+                userFile.Credits[0] != totals[i].credits) {
+            (*mismatches)++;
+        }
+        *lostKiloBytes += (totals[i].bytesUp - userFile.AllUp[1]) + (totals[i].bytesDn - userFile.AllDn[1]);
+    }
+
+    return TRUE;
+}
+
+static BOOL RunPass(const CHAR *passName, BOOL coalesce)
+{
+    DB_CONTEXT  db;
+    INT         events;
+    INT         i;
+    INT         mismatches;
+    INT64       lostKiloBytes;
+    double      elapsed;
+    double      start;
+    pid_t       children[SERVER_MAX];
+
+    if (!Connect(&db) || !Populate(&db)) {
+        return FALSE;
+    }
+
+    totals  = mmap(NULL, sizeof(TOTALS) * userCount, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    results = mmap(NULL, sizeof(LONG) * 3, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (totals == MAP_FAILED || results == MAP_FAILED) {
+        perror("mmap");
+        return FALSE;
+    }
+    ZeroMemory(totals, sizeof(TOTALS) * userCount);
+    ZeroMemory(results, sizeof(LONG) * 3);
+    coalescePass = coalesce;
+
+    start = TimeNow();
+    for (i = 0; i < serverCount; i++) {
+        children[i] = fork();
+        if (children[i] == 0) {
+            RunServer(i);
+            _exit(0);
+        }
+    }
+    for (i = 0; i < serverCount; i++) {
+        waitpid(children[i], NULL, 0);
+    }
+    elapsed = TimeNow() - start;
+
+    if (!Verify(&db, &mismatches, &lostKiloBytes)) {
+        return FALSE;
+    }
+    Disconnect(&db);
+
+    events = serverCount * threadCount * eventCount;
+    printf("%s: %d transfers in %.1f ms, %.0f transfers/s, %ld failures\n",
+        passName, events, elapsed * 1000.0, events / elapsed, (long)results[1]);
+    printf("  statements:        %ld (%.2f per transfer)\n",
+        (long)results[0], (double)results[0] / events);
+    if (coalesce) {
+        printf("  rows merged:       %ld (%.1f transfers per row)\n",
+            (long)results[2], (results[2] > 0) ? (double)events / results[2] : 0.0);
+    }
+    printf("  verified %d users: %d mismatches, %lld KB of transfers lost\n\n",
+        userCount, mismatches, (long long)lostKiloBytes);
+
+    munmap(totals, sizeof(TOTALS) * userCount);
+    munmap(results, sizeof(LONG) * 3);
+    return TRUE;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-h host] [-P port] [-u user] [-p password] [-d database]\n"
+           "       %*s [-s servers] [-t threads] [-n users] [-e events] [-f flush-ms]\n",
+           argv0, (INT)strlen(argv0), "");
+}
+
+int main(int argc, char **argv)
+{
+    DB_CONTEXT  db;
+    INT         opt;
+
+    while ((opt = getopt(argc, argv, "h:P:u:p:d:s:t:n:e:f:")) != -1) {
+        switch (opt) {
+            case 'h': dbHost      = optarg; break;
+            case 'P': dbPort      = atoi(optarg); break;
+            case 'u': dbUser      = optarg; break;
+            case 'p': dbPassword  = optarg; break;
+            case 'd': dbDatabase  = optarg; break;
+            case 's': serverCount = atoi(optarg); break;
+            case 't': threadCount = atoi(optarg); break;
+            case 'n': userCount   = atoi(optarg); break;
+            case 'e': eventCount  = atoi(optarg); break;
+            case 'f': flushMs     = atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (serverCount <= 0 || serverCount > SERVER_MAX || threadCount <= 0 ||
+            threadCount > THREAD_MAX || userCount <= 0 || eventCount <= 0 || flushMs <= 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_ERROR);
+    DbUserStatsInit();
+    mysql_library_init(0, NULL, NULL);
+
+    if (!Connect(&db)) {
+        return 1;
+    }
+    printf("Server:  %s (%s)\n", mysql_get_server_info(db.handle), mysql_get_host_info(db.handle));
+    printf("Replay:  %d servers x %d threads, %d transfers per thread, %d users, flush every %d ms\n\n",
+        serverCount, threadCount, eventCount, userCount, flushMs);
+    Disconnect(&db);
+
+    if (!RunPass("Full row", FALSE) || !RunPass("Coalesced", TRUE)) {
+        return 1;
+    }
+
+    mysql_library_end();
+    DbUserStatsFinalize();
+    ProcStubFinalize();
+    return 0;
+}
@@ -0,0 +1,500 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Full Sync Benchmark
+
+Abstract:
+    Measures a full user synchronization against a local MySQL or MariaDB
+    server. The "legacy" pass reads every user row and then queries the
+    admin-groups, groups, and hosts tables for each user, which is how the
+    full sync used to work. The "bulk" pass runs DbUserSync(), which reads
+    those tables once and merges them with the users. The merged user files
+    are then checked against DbUserReadExtra().
+
+    The "pipelined" pass runs the same full sync with a SYNC_QUEUE, so users
+    are applied by worker threads while the next rows are read. The "-w"
+    option simulates the time ioFTPD takes to write each local user file.
+    The "starved" pass delays the worker jobs past the end of the sync, which
+    must then apply every user on the reading thread.
+
+    Afterwards, new users are created through DbUserCreate() and applied by
+    an incremental sync, which reads io_user_changes from the last change
+    applied, a batch at a time. A change logged after a missing change ID is
+    then checked to be held back until the gap expires.
+
+    The database must already contain the tables from schema.sql. All users
+    in it are deleted.
+
+    Usage:
+      syncbench [-h host] [-P port] [-u user] [-p password] [-d database]
+                [-n users] [-r runs] [-c changes] [-t threads] [-w write_us]
+
+*/
+
+#include <base.h>
+#include <backends.h>
+#include <database.h>
+#include <procstub.h>
+
+#define GROUP_COUNT  10
+#define INSERT_BATCH 250
+
+static double TimeNow(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static VOID UserNameFormat(CHAR *buffer, SIZE_T length, INT index)
+{
+    //
+    // Mix upper-case, lower-case, and punctuation so the merge must agree with
+    // the server's ordering; "User", "user_" and "user" sort differently under
+    // a case-insensitive collation than they do byte-wise.
+    //
+    switch (index % 3) {
+        case 0:  StringCchPrintfA(buffer, length, "User%05d", index);  break;
+        case 1:  StringCchPrintfA(buffer, length, "user%05d", index);  break;
+        default: StringCchPrintfA(buffer, length, "user_%05d", index); break;
+    }
+}
+
+static BOOL Query(MYSQL *handle, const CHAR *query)
+{
+    if (mysql_query(handle, query) != 0) {
+        fprintf(stderr, "Query failed: %s\n", mysql_error(handle));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL Populate(MYSQL *handle, INT users)
+{
+    CHAR    *buffer;
+    CHAR    *end;
+    CHAR    userName[_MAX_NAME + 1];
+    INT     batch;
+    INT     i;
+    INT     pass;
+    INT     rows;
+    SIZE_T  remaining;
+    SIZE_T  size;
+
+    if (!Query(handle, "DELETE FROM io_user") ||
+            !Query(handle, "DELETE FROM io_user_admins") ||
+            !Query(handle, "DELETE FROM io_user_groups") ||
+            !Query(handle, "DELETE FROM io_user_hosts")) {
+        return FALSE;
+    }
+
+    size   = INSERT_BATCH * 512 + 512;
+    buffer = malloc(size);
+
+    // Pass 0 inserts users, 1 admin-groups, 2 groups, and 3 hosts
+    for (pass = 0; pass < 4; pass++) {
+        for (i = 0; i < users; i += INSERT_BATCH) {
+            static const CHAR *prefix[] = {
+                "INSERT INTO io_user (name,description,flags,home,limits,password,vfsfile,"
+                "credits,ratio,alldn,allup,daydn,dayup,monthdn,monthup,wkdn,wkup,creator,"
+                "createdon,logoncount,logonlast,logonhost,maxups,maxdowns,maxlogins,"
+                "expiresat,deletedon,deletedby,deletedmsg,theme,opaque) VALUES",
+                "INSERT INTO io_user_admins (uname,gname) VALUES",
+                "INSERT INTO io_user_groups (uname,gname,idx) VALUES",
+                "INSERT INTO io_user_hosts (uname,host) VALUES",
+            };
+
+            StringCchCopyExA(buffer, size, prefix[pass], &end, &remaining, 0);
+            rows = 0;
+
+            for (batch = i; batch < users && batch < i + INSERT_BATCH; batch++) {
+                UserNameFormat(userName, ELEMENT_COUNT(userName), batch);
+
+                switch (pass) {
+                    case 0:
+                        StringCchPrintfExA(end, remaining, &end, &remaining, 0,
+                            "%s('%s','Tagline','3','/','','','','','','','','','','','','','',"
+                            "'creator',0,%d,0,'127.0.0.1',-1,-1,-1,0,0,'','',0,'')",
+                            (rows++ == 0) ? "" : ",", userName, batch);
+                        break;
+
+                    case 1:
+                        // Every fifth user is a group admin
+                        if (batch % 5 == 0) {
+                            StringCchPrintfExA(end, remaining, &end, &remaining, 0,
+                                "%s('%s','group%d')", (rows++ == 0) ? "" : ",",
+                                userName, batch % GROUP_COUNT);
+                        }
+                        break;
+
+                    case 2:
+                        StringCchPrintfExA(end, remaining, &end, &remaining, 0,
+                            "%s('%s','group%d',0),('%s','group%d',1)",
+                            (rows++ == 0) ? "" : ",",
+                            userName, batch % GROUP_COUNT,
+                            userName, (batch + 3) % GROUP_COUNT);
+                        break;
+
+                    case 3:
+                        StringCchPrintfExA(end, remaining, &end, &remaining, 0,
+                            "%s('%s','*@10.0.%d.%d'),('%s','*@192.168.%d.*')",
+                            (rows++ == 0) ? "" : ",",
+                            userName, (batch >> 8) & 255, batch & 255,
+                            userName, batch & 255);
+                        break;
+                }
+            }
+
+            // An admin-groups batch may be empty
+            if (rows > 0 && !Query(handle, buffer)) {
+                free(buffer);
+                return FALSE;
+            }
+        }
+    }
+
+    free(buffer);
+    return TRUE;
+}
+
+static BOOL LegacySync(DB_CONTEXT *db, CHAR **names, INT *count)
+{
+    DWORD       error;
+    MYSQL_RES   *result;
+    MYSQL_ROW   row;
+    USERFILE    userFile;
+
+    //
+    // Read the same columns as the full sync, then query the admin-groups,
+    // groups, and hosts for each user.
+    //
+    if (!Query(db->handle,
+            "SELECT name,description,flags,home,limits,password,vfsfile,credits,"
+            "ratio,alldn,allup,daydn,dayup,monthdn,monthup,wkdn,wkup,"
+            "creator,createdon,logoncount,logonlast,logonhost,maxups,"
+            "maxdowns,maxlogins,expiresat,deletedon,deletedby,"
+            "deletedmsg,theme,opaque FROM io_user")) {
+        return FALSE;
+    }
+
+    result = mysql_store_result(db->handle);
+    if (result == NULL) {
+        fprintf(stderr, "Unable to store result: %s\n", mysql_error(db->handle));
+        return FALSE;
+    }
+
+    *count = 0;
+    while ((row = mysql_fetch_row(result)) != NULL) {
+        ZeroMemory(&userFile, sizeof(USERFILE));
+
+        error = DbUserReadExtra(db, row[0], &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to read user \"%s\" (error %u).\n", row[0], error);
+        }
+        if (names != NULL) {
+            names[*count] = strdup(row[0]);
+        }
+        (*count)++;
+    }
+
+    mysql_free_result(result);
+    return TRUE;
+}
+
+static INT Verify(DB_CONTEXT *db, CHAR **names, INT count)
+{
+    DWORD       error;
+    INT         i;
+    INT         mismatches = 0;
+    USERFILE    expected;
+    USERFILE    *actual;
+
+    for (i = 0; i < count; i++) {
+        ZeroMemory(&expected, sizeof(USERFILE));
+
+        error = DbUserReadExtra(db, names[i], &expected);
+        actual = ProcStubGetUser(names[i]);
+
+        if (error != ERROR_SUCCESS || actual == NULL ||
+                memcmp(expected.AdminGroups, actual->AdminGroups, sizeof(expected.AdminGroups)) != 0 ||
+                memcmp(expected.Groups, actual->Groups, sizeof(expected.Groups)) != 0 ||
+                memcmp(expected.Ip, actual->Ip, sizeof(expected.Ip)) != 0) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "Mismatch for user \"%s\".\n", names[i]);
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+static VOID Usage(const CHAR *argv0)
+{
+    printf("Usage: %s [-h host] [-P port] [-u user] [-p password] [-d database]\n"
+           "       %*s [-n users] [-r runs] [-c changes] [-t threads] [-w write_us]\n",
+           argv0, (INT)strlen(argv0), "");
+}
+
+int main(int argc, char **argv)
+{
+    CHAR        **names;
+    CHAR        *database = "ioftpd";
+    CHAR        *host     = "localhost";
+    CHAR        *password = NULL;
+    CHAR        *user     = "root";
+    CHAR        groupName[_MAX_NAME + 1];
+    CHAR        query[256];
+    CHAR        userName[_MAX_NAME + 1];
+    DB_CONTEXT  db;
+    DB_SYNC     sync;
+    DWORD       error;
+    DWORD       i;
+    INT         count;
+    INT         mismatches;
+    INT         changes = 2000;
+    INT         created;
+    INT         port  = 0;
+    INT         runs  = 5;
+    INT         threads = 4;
+    INT         users = 5000;
+    INT         opt;
+    INT         run;
+    double      bulkBest   = 1e9;
+    double      legacyBest = 1e9;
+    double      queueBest  = 1e9;
+    double      start;
+    double      elapsed;
+    SYNC_QUEUE  queue;
+    SYNC_QUEUE_COUNTERS counters;
+    UINT64      gapChange;
+    USERFILE    userFile;
+
+    while ((opt = getopt(argc, argv, "h:P:u:p:d:n:r:c:t:w:")) != -1) {
+        switch (opt) {
+            case 'h': host     = optarg; break;
+            case 'P': port     = atoi(optarg); break;
+            case 'u': user     = optarg; break;
+            case 'p': password = optarg; break;
+            case 'd': database = optarg; break;
+            case 'n': users    = atoi(optarg); break;
+            case 'r': runs     = atoi(optarg); break;
+            case 'c': changes  = atoi(optarg); break;
+            case 't': threads  = atoi(optarg); break;
+            case 'w': stubWriteDelay = (DWORD)atoi(optarg); break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+    if (users <= 0 || runs <= 0 || changes < 0 || threads <= 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    ProcStubInit(LOG_LEVEL_WARN);
+    DbUserStatsInit();
+    mysql_library_init(0, NULL, NULL);
+
+    for (i = 0; i < GROUP_COUNT; i++) {
+        StringCchPrintfA(groupName, ELEMENT_COUNT(groupName), "group%u", i);
+        ProcStubAddGroup(groupName);
+    }
+
+    //
+    // Connect as ConnectionOpen() does, statements are prepared on first use
+    //
+
+    ZeroMemory(&db, sizeof(DB_CONTEXT));
+    db.handle = mysql_init(NULL);
+    if (mysql_real_connect(db.handle, host, user, password, database, port, NULL, 0) == NULL) {
+        fprintf(stderr, "Unable to connect: %s\n", mysql_error(db.handle));
+        return 1;
+    }
+    printf("Server:  %s (%s)\n", mysql_get_server_info(db.handle), mysql_get_host_info(db.handle));
+    printf("Users:   %d, %d groups, %d runs, %u us per file write\n\n", users, GROUP_COUNT, runs, stubWriteDelay);
+
+    start = TimeNow();
+    if (!Populate(db.handle, users)) {
+        return 1;
+    }
+    printf("Populate:                %9.1f ms\n", (TimeNow() - start) * 1000.0);
+
+    //
+    // Legacy: one row query plus three queries per user
+    //
+
+    names = calloc(users, sizeof(CHAR *));
+    for (run = 0; run < runs; run++) {
+        start = TimeNow();
+        if (!LegacySync(&db, (run == 0) ? names : NULL, &count)) {
+            return 1;
+        }
+        elapsed = TimeNow() - start;
+        legacyBest = MIN(legacyBest, elapsed);
+    }
+    printf("Legacy full sync:        %9.1f ms  (%d statements)\n", legacyBest * 1000.0, 1 + count * 3);
+
+    //
+    // Bulk: DbUserSync() with no previous update performs a full sync. The
+    // first run creates the local users, later runs update them.
+    //
+
+    for (run = 0; run < runs; run++) {
+        ZeroMemory(&sync, sizeof(DB_SYNC));
+
+        start = TimeNow();
+        DbUserSync(&db, &sync);
+        elapsed = TimeNow() - start;
+
+        if (run == 0) {
+            printf("Bulk full sync (create): %9.1f ms  (5 statements)\n", elapsed * 1000.0);
+        } else {
+            bulkBest = MIN(bulkBest, elapsed);
+        }
+    }
+    if (runs > 1) {
+        printf("Bulk full sync (update): %9.1f ms  (5 statements)\n", bulkBest * 1000.0);
+        printf("Speed-up:                %9.1fx\n", legacyBest / bulkBest);
+    }
+
+    //
+    // Pipelined: the same full sync, with users applied by worker threads
+    //
+
+    for (run = 0; run < runs; run++) {
+        ZeroMemory(&sync, sizeof(DB_SYNC));
+        if (SyncQueueCreate(&queue, DB_SYNC_QUEUE, threads) != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create queue.\n");
+            return 1;
+        }
+        sync.queue = &queue;
+
+        start = TimeNow();
+        DbUserSync(&db, &sync);
+        elapsed = TimeNow() - start;
+
+        SyncQueueGetCounters(&queue, &counters);
+        SyncQueueDestroy(&queue);
+        sync.queue = NULL;
+
+        queueBest = MIN(queueBest, elapsed);
+    }
+    printf("Pipelined full sync:     %9.1f ms  (%d threads, %ld applied, %u ms blocked, %u ms drained)\n",
+        queueBest * 1000.0, threads, (long)counters.applied, counters.blocked, counters.drained);
+    if (runs > 1) {
+        printf("Speed-up:                %9.1fx  (over bulk)\n", bulkBest / queueBest);
+    }
+
+    //
+    // Starved: the worker jobs start long after the sync, the reading thread
+    // applies the users itself instead of waiting for them
+    //
+
+    ZeroMemory(&sync, sizeof(DB_SYNC));
+    stubJobDelay = 5000;
+    if (SyncQueueCreate(&queue, DB_SYNC_QUEUE, threads) != ERROR_SUCCESS) {
+        fprintf(stderr, "Unable to create queue.\n");
+        return 1;
+    }
+    sync.queue = &queue;
+
+    start = TimeNow();
+    DbUserSync(&db, &sync);
+    SyncQueueGetCounters(&queue, &counters);
+    SyncQueueDestroy(&queue);
+    elapsed = TimeNow() - start;
+
+    sync.queue = NULL;
+    stubJobDelay = 0;
+
+    printf("Starved full sync:       %9.1f ms  (%ld applied by threads, %ld by the reading thread)\n",
+        elapsed * 1000.0, (long)counters.applied, (long)counters.direct);
+    if (counters.applied + counters.direct != users) {
+        fprintf(stderr, "Starved sync applied %ld of %d users.\n",
+            (long)(counters.applied + counters.direct), users);
+    }
+
+    //
+    // Incremental: the full sync above recorded the last change, so only the
+    // changes logged by these creates are read.
+    //
+
+    for (i = 0; i < (DWORD)changes; i++) {
+        StringCchPrintfA(userName, ELEMENT_COUNT(userName), "new%05u", i);
+
+        ZeroMemory(&userFile, sizeof(USERFILE));
+        userFile.Groups[0]      = NOGROUP_ID;
+        userFile.Groups[1]      = INVALID_GROUP;
+        userFile.AdminGroups[0] = INVALID_GROUP;
+        StringCchCopyA(userFile.Home, ELEMENT_COUNT(userFile.Home), "/");
+
+        error = DbUserCreate(&db, userName, &userFile);
+        if (error != ERROR_SUCCESS) {
+            fprintf(stderr, "Unable to create user \"%s\" (error %u).\n", userName, error);
+            return 1;
+        }
+    }
+
+    sync.prevUpdate = sync.currUpdate = (ULONG)time(NULL);
+    created = stubUsers.creates;
+
+    start = TimeNow();
+    DbUserSync(&db, &sync);
+    elapsed = TimeNow() - start;
+
+    printf("Incremental sync:        %9.1f ms  (%d changes, %d batches)\n",
+        elapsed * 1000.0, changes, changes / DB_SYNC_BATCH + 1);
+    created = stubUsers.creates - created;
+    if (created != changes) {
+        fprintf(stderr, "Incremental sync created %d of %d users.\n", created, changes);
+    }
+
+    //
+    // Gap: a change logged after a missing ID is held back until the missing
+    // ID is DB_SYNC_GAP seconds old, it may belong to an open transaction
+    //
+
+    gapChange = sync.userChange;
+    StringCchPrintfA(query, ELEMENT_COUNT(query),
+        "INSERT INTO io_user_changes (id,time,type,name) VALUES(%llu,UNIX_TIMESTAMP(),%d,'new00000')",
+        (unsigned long long)gapChange + 2, SYNC_EVENT_DELETE);
+
+    if (!Query(db.handle, query)) {
+        return 1;
+    }
+
+    DbUserSync(&db, &sync);
+    if (sync.userChange != gapChange) {
+        fprintf(stderr, "Incremental sync skipped a recent gap.\n");
+    }
+
+    sync.prevUpdate = sync.currUpdate = (ULONG)time(NULL) + DB_SYNC_GAP;
+    DbUserSync(&db, &sync);
+    if (sync.userChange != gapChange + 2 || stubUsers.deletes != 1) {
+        fprintf(stderr, "Incremental sync did not skip an expired gap.\n");
+    }
+    printf("Change ID gap:           held until %d seconds old\n", DB_SYNC_GAP);
+
+    printf("\nLocal users: %ld created, %ld updated, %ld deleted\n",
+        (long)stubUsers.creates, (long)stubUsers.updates, (long)stubUsers.deletes);
+
+    mismatches = Verify(&db, names, count);
+    printf("Verified %d users: %d mismatches\n", count, mismatches);
+
+    for (i = 0; i < (DWORD)count; i++) {
+        free(names[i]);
+    }
+    free(names);
+
+    DbStmtFlush(&db);
+    mysql_close(db.handle);
+    mysql_library_end();
+    DbUserStatsFinalize();
+    ProcStubFinalize();
+
+    return (mismatches == 0 && created == changes) ? 0 : 1;
+}
@@ -14,6 +14,7 @@ Abstract:
 
 */
 
+#include <cache.h>
 #include <database.h>
 
 #ifndef BACKENDS_H_INCLUDED
@@ -46,6 +47,8 @@ DWORD GroupUpdateByName(CHAR *groupName, GROUPFILE *groupFile);
 // Group database backend
 //
 
+extern CACHE dbGroupCache;
+
 DWORD DbGroupRead(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile);
 
 DWORD DbGroupCreate(DB_CONTEXT *dbContext, CHAR *groupName, GROUPFILE *groupFile);
@@ -54,6 +57,7 @@ DWORD DbGroupDelete(DB_CONTEXT *dbContext, CHAR *groupName);
 DWORD DbGroupLock(DB_CONTEXT *dbContext, CHAR *groupName, GROUPFILE *groupFile);
 DWORD DbGroupUnlock(DB_CONTEXT *dbContext, CHAR *groupName);
 DWORD DbGroupOpen(DB_CONTEXT *dbContext, CHAR *groupName, GROUPFILE *groupFile);
+BOOL  DbGroupCacheOpen(CHAR *groupName, GROUPFILE *groupFile);
 DWORD DbGroupWrite(DB_CONTEXT *dbContext, CHAR *groupName, GROUPFILE *groupFile);
 DWORD DbGroupClose(GROUPFILE *groupFile);
 
@@ -85,6 +89,8 @@ DWORD UserUpdateByName(CHAR *userName, USERFILE *userFile);
 // User database backend
 //
 
+extern CACHE dbUserCache;
+
 DWORD DbUserRead(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile);
 DWORD DbUserReadExtra(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile);
 
@@ -94,9 +100,37 @@ DWORD DbUserDelete(DB_CONTEXT *dbContext, CHAR *userName);
 DWORD DbUserLock(DB_CONTEXT *dbContext, CHAR *userName, USERFILE *userFile);
 DWORD DbUserUnlock(DB_CONTEXT *dbContext, CHAR *userName);
 DWORD DbUserOpen(DB_CONTEXT *dbContext, CHAR *userName, USERFILE *userFile);
+BOOL  DbUserCacheOpen(CHAR *userName, USERFILE *userFile);
 DWORD DbUserWrite(DB_CONTEXT *dbContext, CHAR *userName, USERFILE *userFile);
 DWORD DbUserClose(USERFILE *userFile);
 
+//
+// User statistics buffer
+//
+
+typedef struct {
+    LONG    writes;     // Writes that changed the statistics
+    LONG    rows;       // Rows merged by flushes
+    LONG    batches;    // Batches merged by flushes
+} STATS_COUNTERS;
+
+#define STATS_WRITE_INFO        0x0001  // Fields other than the statistics changed
+#define STATS_WRITE_ABSOLUTE    0x0002  // Statistics must be written as they are
+
+DWORD DbUserStatsInit(VOID);
+VOID  DbUserStatsFinalize(VOID);
+VOID  DbUserStatsCounters(STATS_COUNTERS *counters);
+BOOL  DbUserStatsPending(CHAR *userName);
+
+VOID  DbUserStatsLoad(CHAR *userName, USERFILE *userFile, BOOL create);
+VOID  DbUserStatsCopyInfo(USERFILE *userFile, const USERFILE *source);
+DWORD DbUserStatsUpdate(CHAR *userName, USERFILE *userFile);
+VOID  DbUserStatsInvalidate(CHAR *userName);
+VOID  DbUserStatsRename(CHAR *userName, CHAR *newName);
+VOID  DbUserStatsDiscard(CHAR *userName);
+VOID  DbUserStatsClose(CHAR *userName);
+DWORD DbUserStatsFlush(DB_CONTEXT *db, CHAR *userName);
+
 //
 // User file backend
 //
@@ -120,10 +154,10 @@ typedef enum {
     SYNC_EVENT_DELETE = 2,
 } SYNC_EVENT;
 
-DWORD DbGroupPurge(DB_CONTEXT *db, INT age);
+DWORD DbGroupPurge(DB_CONTEXT *db, INT age, UINT64 *purged);
 DWORD DbGroupSync(DB_CONTEXT *db, DB_SYNC *sync);
 
-DWORD DbUserPurge(DB_CONTEXT *db, INT age);
+DWORD DbUserPurge(DB_CONTEXT *db, INT age, UINT64 *purged);
 DWORD DbUserSync(DB_CONTEXT *db, DB_SYNC *sync);
 
 #endif // BACKENDS_H_INCLUDED
@@ -0,0 +1,103 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Cache
+
+Abstract:
+    Record cache declarations.
+
+*/
+
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+/*++
+
+CACHE_UPDATE_PROC
+
+    Changes a cached record.
+
+Arguments:
+    context - Opaque context passed to <CacheApply>.
+
+    data    - Cached record.
+
+Return Values:
+    None.
+
+Remarks:
+    This callback is called while the cache is locked.
+
+--*/
+typedef VOID (FCALL CACHE_UPDATE_PROC)(VOID *context, VOID *data);
+
+//
+// Cache entry
+//
+
+typedef struct {
+    CHAR    name[_MAX_NAME + 1];    // User or group name
+    LONG    version;                // Cache version when the entry last changed
+    ULONG   stamp;                  // Update time of the database row
+    DWORD   used;                   // Tick count of the last hit
+    DWORD   changed;                // Tick count of the last change
+    VOID    *data;                  // Cached record, null if the record is not known
+} CACHE_ENTRY;
+
+//
+// Cache counters
+//
+
+typedef struct {
+    LONG    hits;           // Records returned from the cache
+    LONG    misses;         // Records that had to be read
+    LONG    expired;        // Records not returned since synchronization stopped
+    LONG    updates;        // Records changed by writes and synchronization
+    LONG    invalidations;  // Records discarded because they changed
+    LONG    evictions;      // Records discarded to make room
+} CACHE_COUNTERS;
+
+//
+// Cache structure
+//
+
+typedef struct {
+    CACHE_ENTRY       **array;      // Entries sorted by name
+    SIZE_T            count;        // Number of entries
+    SIZE_T            total;        // Number of entries allocated
+    SIZE_T            records;      // Number of entries with a record
+    SIZE_T            maximum;      // Maximum number of entries with a record
+    SIZE_T            size;         // Size of a record, in bytes
+    DWORD             maxAge;       // Milliseconds a synchronization keeps records current, zero if forever
+    DWORD             synced;       // Tick count of the last synchronization
+    LONG              version;      // Incremented for each change
+    LONG              floor;        // Reads started before this version are not cached
+    LONG              purge;        // Version at the start of the previous synchronization
+    DWORD             changed;      // Tick count of the last change made without an entry
+    CACHE_COUNTERS    counters;     // Cache counters
+    CRITICAL_SECTION  lock;         // Synchronize access to the cache
+} CACHE;
+
+//
+// Cache functions
+//
+
+DWORD FCALL CacheCreate(CACHE *cache, SIZE_T size, SIZE_T maximum, DWORD maxAge);
+VOID  FCALL CacheDestroy(CACHE *cache);
+
+LONG  FCALL CacheVersion(CACHE *cache);
+BOOL  FCALL CacheGet(CACHE *cache, const CHAR *name, VOID *data);
+VOID  FCALL CachePut(CACHE *cache, const CHAR *name, const VOID *data, ULONG stamp, LONG version, BOOL create);
+BOOL  FCALL CacheChanged(CACHE *cache, const CHAR *name, DWORD age);
+
+VOID  FCALL CacheApply(CACHE *cache, const CHAR *name, CACHE_UPDATE_PROC *proc, VOID *context);
+VOID  FCALL CacheInvalidate(CACHE *cache, const CHAR *name);
+VOID  FCALL CacheFlush(CACHE *cache);
+VOID  FCALL CacheSynced(CACHE *cache, LONG version);
+
+VOID  FCALL CacheGetCounters(CACHE *cache, CACHE_COUNTERS *counters);
+
+#endif // CACHE_H_INCLUDED
@@ -27,11 +27,14 @@ typedef struct {
     INT       connAttempts; // Number of connection attempts to make
     INT       connTimeout;  // Connection timeout in seconds
     LOG_LEVEL logLevel;     // Level of log verbosity
+    INT       logSize;      // Kilobytes the log file may reach before it is rotated, zero to never rotate it
+    DWORD     logSizeBytes; // Same amount, but in bytes
 } DB_CONFIG_GLOBAL;
 
 typedef struct {
     INT     expire;         // Seconds until a lock expires
     INT     timeout;        // Seconds to wait for a lock to become available
+    DWORD   timeoutMili;    // Same amount, but in milliseconds
     CHAR    owner[64];      // Lock owner UUID
     SIZE_T  ownerLength;    // Length of the owner UUID
 } DB_CONFIG_LOCK;
@@ -49,8 +52,21 @@ typedef struct {
     UINT64  expireNano;     // Same amount, but in 100 nanosecond intervals
 } DB_CONFIG_POOL;
 
+typedef struct {
+    INT     size;           // Maximum number of cached users, and of cached groups
+    DWORD   maxAge;         // Milliseconds cached records stay current after a synchronization
+} DB_CONFIG_CACHE;
+
+typedef struct {
+    INT     check;          // Seconds between each replica health check
+    DWORD   checkMili;      // Same amount, but in milliseconds
+    INT     maxLag;         // Seconds a replica may fall behind before reads use the primary
+    DWORD   window;         // Milliseconds this server's own changes are read from the primary
+} DB_CONFIG_REPLICA;
+
 typedef struct {
     CHAR    name[32];       // Configuration array name
+    BOOL     replica;       // Server is a read-only replica of the primary
     CHAR    *host;          // MySQL Server host
     CHAR    *user;          // MySQL Server username
     CHAR    *password;      // MySQL Server password
@@ -65,20 +81,28 @@ typedef struct {
     CHAR    *sslCAPath;     // Path to the directory containing CA certificates
 } DB_CONFIG_SERVER;
 
+typedef struct {
+    INT     flush;          // Milliseconds between each flush of buffered statistics
+} DB_CONFIG_STATS;
+
 typedef struct {
     BOOL         enabled;   // Allow synchronization
     INT          first;     // Milliseconds until the first synchronization
     INT          interval;  // Milliseconds between each database refresh
     INT          purge;     // Seconds to purge old changes entries
+    INT          threads;   // Threads applying updates, zero to apply them on the synchronizing thread
 } DB_CONFIG_SYNC;
 
 //
 // Configuration globals
 //
 
+extern DB_CONFIG_CACHE   dbConfigCache;
 extern DB_CONFIG_GLOBAL  dbConfigGlobal;
 extern DB_CONFIG_LOCK    dbConfigLock;
 extern DB_CONFIG_POOL    dbConfigPool;
+extern DB_CONFIG_REPLICA dbConfigReplica;
+extern DB_CONFIG_STATS   dbConfigStats;
 extern DB_CONFIG_SYNC    dbConfigSync;
 
 extern DB_CONFIG_SERVER  *dbConfigServers;
@@ -14,6 +14,9 @@ Abstract:
 
 */
 
+#include <cache.h>
+#include <syncqueue.h>
+
 #ifndef DATABASE_H_INCLUDED
 #define DATABASE_H_INCLUDED
 
@@ -26,24 +29,122 @@ typedef union {
     UINT64      value;      // Unsigned 64bit value
 } DB_TIME;
 
+//
+// Prepared statement identifiers, one for each distinct query
+//
+
+typedef enum {
+    DB_STMT_SYNC_TIME = 0,
+
+    DB_STMT_GROUP_READ,
+    DB_STMT_GROUP_CREATE,
+    DB_STMT_GROUP_RENAME,
+    DB_STMT_GROUP_RENAME_ADMINS,
+    DB_STMT_GROUP_RENAME_GROUPS,
+    DB_STMT_GROUP_DELETE,
+    DB_STMT_GROUP_LOCK,
+    DB_STMT_GROUP_UNLOCK,
+    DB_STMT_GROUP_WRITE,
+    DB_STMT_GROUP_CHANGES,
+    DB_STMT_GROUP_CHANGES_INFO,
+    DB_STMT_GROUP_SYNC_FULL,
+    DB_STMT_GROUP_SYNC_CURSOR,
+    DB_STMT_GROUP_SYNC_CHANGES,
+    DB_STMT_GROUP_SYNC_UPDATES,
+    DB_STMT_GROUP_PURGE,
+    DB_STMT_GROUP_PURGE_RANGE,
+
+    DB_STMT_USER_READ,
+    DB_STMT_USER_READ_ADMINS,
+    DB_STMT_USER_READ_GROUPS,
+    DB_STMT_USER_READ_HOSTS,
+    DB_STMT_USER_CREATE,
+    DB_STMT_USER_RENAME,
+    DB_STMT_USER_RENAME_ADMINS,
+    DB_STMT_USER_RENAME_GROUPS,
+    DB_STMT_USER_RENAME_HOSTS,
+    DB_STMT_USER_DELETE,
+    DB_STMT_USER_LOCK,
+    DB_STMT_USER_UNLOCK,
+    DB_STMT_USER_WRITE,
+    DB_STMT_USER_WRITE_STATS,
+    DB_STMT_USER_ADD_ADMINS,
+    DB_STMT_USER_ADD_GROUPS,
+    DB_STMT_USER_ADD_HOSTS,
+    DB_STMT_USER_DEL_ADMINS,
+    DB_STMT_USER_DEL_GROUPS,
+    DB_STMT_USER_DEL_HOSTS,
+    DB_STMT_USER_CHANGES,
+    DB_STMT_USER_CHANGES_INFO,
+    DB_STMT_USER_SYNC_FULL,
+    DB_STMT_USER_SYNC_ADMINS,
+    DB_STMT_USER_SYNC_GROUPS,
+    DB_STMT_USER_SYNC_HOSTS,
+    DB_STMT_USER_SYNC_CURSOR,
+    DB_STMT_USER_SYNC_CHANGES,
+    DB_STMT_USER_SYNC_UPDATES,
+    DB_STMT_USER_PURGE,
+    DB_STMT_USER_PURGE_RANGE,
+    DB_STMT_USER_STATS_READ,
+    DB_STMT_USER_STATS_WRITE,
+    DB_STMT_USER_STATS_RECORD,
+    DB_STMT_USER_STATS_CHECK,
+    DB_STMT_USER_STATS_PURGE,
+
+    DB_STMT_COUNT
+} DB_STMT_ID;
+
 typedef struct {
-    MYSQL      *handle;     // MySQL connection handle
-    MYSQL_STMT *stmt[8];    // Pre-compiled SQL statements (eighth statement for refresh)
-    LONG        index;      // Index in the server configuration array
-    DB_TIME     created;    // Time this context was created
-    DB_TIME     used;       // Time this context was last used
+    MYSQL      *handle;                 // MySQL connection handle
+    MYSQL_STMT *stmt[DB_STMT_COUNT];    // Prepared statements, indexed by DB_STMT_ID
+#ifdef DEBUG
+    const CHAR *query[DB_STMT_COUNT];   // Query text each statement was prepared from
+#endif // DEBUG
+    ULONG       stmtHits;               // Statements reused from the cache
+    ULONG       stmtMisses;             // Statements prepared on first use
+    ULONG       threadId;               // Server thread ID the statements belong to
+    LONG        index;                  // Index in the server configuration array
+    BOOL        replica;                // Connected to a replica server
+    DB_TIME     created;                // Time this context was created
+    DB_TIME     used;                   // Time this context was last used
 } DB_CONTEXT;
 
 typedef struct {
-    ULONG       currUpdate; // Server time for the current update
-    ULONG       prevUpdate; // Server time of the last update
-    TIMER       *timer;     // Synchronization timer
+    MYSQL       *handle;    // Connection used for health checks
+    INT64       rtt;        // Rolling average of the ping round trip, in microseconds
+    INT         lag;        // Seconds behind the primary, -1 if replication is stopped
+    BOOL        usable;     // Replica answered the last check within the lag limit
+} DB_REPLICA;
+
+typedef struct {
+    DWORD       start;      // Tick count of the first lock attempt
+    DWORD       timeout;    // Milliseconds to keep retrying
+    DWORD       delay;      // Current upper bound of the delay, in milliseconds
+    DWORD       attempts;   // Number of failed lock attempts
+} DB_BACKOFF;
+
+typedef struct {
+    ULONG       currUpdate;     // Server time for the current update
+    ULONG       prevUpdate;     // Server time of the last update
+    UINT64      groupChange;    // ID of the last change applied from io_group_changes, all earlier IDs were applied or skipped
+    UINT64      userChange;     // ID of the last change applied from io_user_changes, all earlier IDs were applied or skipped
+    DWORD       window;         // Milliseconds this server's changes are read from the primary, zero if reading from it
+    SYNC_QUEUE  *queue;         // Queue of updates applied by worker threads, null to apply them when read
+    TIMER       *timer;         // Synchronization timer
 } DB_SYNC;
 
 //
 // Database macros
 //
 
+#define DB_BACKOFF_MIN  2       // Initial delay between lock attempts, in milliseconds
+#define DB_BACKOFF_MAX  128     // Maximum delay between lock attempts, in milliseconds
+#define DB_PURGE_BATCH  1000    // Maximum change IDs deleted by each purge query
+#define DB_PURGE_YIELD  20      // Delay between purge queries, in milliseconds
+#define DB_SYNC_BATCH   500     // Maximum changes read by each incremental sync query
+#define DB_SYNC_GAP     60      // Seconds a missing change ID is waited for before it is skipped
+#define DB_SYNC_QUEUE   64      // Maximum updates read ahead of the synchronization threads
+
 #ifdef DEBUG
 
 #define DB_CHECK_PARAMS(binds, stmt)                                            \
@@ -76,10 +177,14 @@ VOID FCALL DbSyncStart(VOID);
 VOID FCALL DbSyncStop(VOID);
 
 BOOL FCALL DbAcquire(DB_CONTEXT **dbPtr);
+BOOL FCALL DbAcquireRead(DB_CONTEXT **dbPtr, CACHE *cache, const CHAR *name);
 VOID FCALL DbRelease(DB_CONTEXT *db);
 
 DWORD FCALL DbMapError(UINT error);
 
+MYSQL_STMT *FCALL DbStmtPrepare(DB_CONTEXT *db, DB_STMT_ID id, const CHAR *query);
+VOID FCALL DbStmtFlush(DB_CONTEXT *db);
+
 INLINE DWORD FCALL DbMapErrorFromConn(MYSQL *mysql)
 {
     ASSERT(mysql != NULL);
@@ -92,4 +197,72 @@ INLINE DWORD FCALL DbMapErrorFromStmt(MYSQL_STMT *stmt)
     return DbMapError(mysql_stmt_errno(stmt));
 }
 
+/*++
+
+DbBackoffInit
+
+    Starts the retry period for a contended lock.
+
+Arguments:
+    backoff - Pointer to the DB_BACKOFF structure.
+
+    timeout - Milliseconds to keep retrying.
+
+Return Values:
+    None.
+
+--*/
+INLINE VOID FCALL DbBackoffInit(DB_BACKOFF *backoff, DWORD timeout)
+{
+    ASSERT(backoff != NULL);
+
+    backoff->start    = GetTickCount();
+    backoff->timeout  = timeout;
+    backoff->delay    = DB_BACKOFF_MIN;
+    backoff->attempts = 0;
+}
+
+/*++
+
+DbBackoffWait
+
+    Waits before the next attempt on a contended lock.
+
+Arguments:
+    backoff - Pointer to the DB_BACKOFF structure.
+
+Return Values:
+    If another attempt should be made, the return is nonzero (true).
+
+    If the timeout has elapsed, the return is zero (false).
+
+Remarks:
+    The delay doubles after every attempt, up to DB_BACKOFF_MAX. A random
+    part of it is skipped, so servers that lost the same lock at the same
+    time do not retry in lockstep.
+
+--*/
+INLINE BOOL FCALL DbBackoffWait(DB_BACKOFF *backoff)
+{
+    DWORD elapsed;
+    DWORD jitter;
+    DWORD wait;
+
+    ASSERT(backoff != NULL);
+
+    elapsed = GetTickCount() - backoff->start;
+    if (elapsed >= backoff->timeout) {
+        return FALSE;
+    }
+    backoff->attempts++;
+
+    // Wait between half of the delay and the full delay
+    jitter = (GetTickCount() ^ (GetCurrentThreadId() << 8) ^ backoff->attempts) * 2654435761U;
+    wait   = backoff->delay / 2 + (jitter >> 16) % (backoff->delay / 2 + 1);
+    Sleep(MIN(wait, backoff->timeout - elapsed));
+
+    backoff->delay = MIN(backoff->delay * 2, DB_BACKOFF_MAX);
+    return TRUE;
+}
+
 #endif // DATABASE_H_INCLUDED
@@ -15,7 +15,6 @@ Abstract:
 */
 
 #include <condvar.h>
-#include <queue.h>
 
 #ifndef POOL_H_INCLUDED
 #define POOL_H_INCLUDED
@@ -82,37 +81,63 @@ Return Values:
 typedef VOID (FCALL POOL_DESTRUCTOR_PROC)(VOID *context, VOID *data);
 
 //
-// Pool resource
+// Pool slot states
 //
 
-struct POOL_RESOURCE {
-    VOID *data;                         // Opaque data set by the constructor callback
-    TAILQ_ENTRY(POOL_RESOURCE) link;    // Link to the previous and next resources
-};
-typedef struct POOL_RESOURCE POOL_RESOURCE;
+#define POOL_SLOT_EMPTY     0   // No resource
+#define POOL_SLOT_LISTED    1   // Idle resource on the free list
+#define POOL_SLOT_PARKED    2   // Idle resource kept for the thread that released it
+#define POOL_SLOT_USED      3   // Resource in use, or being created or destroyed
 
 //
-// Pool structure
+// Pool slot
 //
 
-TAILQ_HEAD(POOL_TAIL_QUEUE, POOL_RESOURCE);
-typedef struct POOL_TAIL_QUEUE POOL_TAIL_QUEUE;
+typedef struct {
+    VOID            *data;      // Opaque data set by the constructor callback
+    volatile LONG   state;      // State of the slot, POOL_SLOT_*
+    volatile LONG   next;       // Next slot on the free list, plus one (zero ends the list)
+} POOL_SLOT;
+
+//
+// Pool statistics
+//
+
+#define POOL_WAIT_BUCKETS   12  // Bucket n counts waits under 2^n milliseconds, the last one the rest
 
 typedef struct {
-    DWORD                 idle;         // Number of idle resources
-    DWORD                 total;        // Total number of resources
+    LONG    acquires;                       // Resources acquired
+    LONG    affinity;                       // Resources acquired from the thread's last resource
+    LONG    waits;                          // Acquires that blocked for a resource
+    LONG    timeouts;                       // Acquires that timed out
+    LONG    creations;                      // Resources created
+    LONG    destructions;                   // Resources destroyed
+    LONG    waitTime[POOL_WAIT_BUCKETS];    // Histogram of acquire wait times
+} POOL_STATS;
+
+//
+// Pool structure
+//
+
+typedef struct {
+    volatile LONG         idle;         // Number of idle resources
+    volatile LONG         total;        // Total number of resources
+    volatile LONG         waiting;      // Number of threads blocked for a resource
     DWORD                 minimum;      // Minimum number of resources to have available
     DWORD                 average;      // Average number of resources to have available
     DWORD                 maximum;      // Maximum number of resources to have available
     DWORD                 timeout;      // Milliseconds to wait for a resource to become available
+    DWORD                 tlsIndex;     // Thread local storage index of each thread's last slot
     POOL_CONSTRUCTOR_PROC *constructor; // Procedure called when a resource is created
     POOL_VALIDATOR_PROC   *validator;   // Procedure called when a resource requires validation
     POOL_DESTRUCTOR_PROC  *destructor;  // Procedure called when a resource is destroyed
     VOID                  *context;     // Opaque argument passed to the constructor and destructor
-    POOL_TAIL_QUEUE       resQueue;     // Queue of resources
-    POOL_TAIL_QUEUE       conQueue;     // Queue of containers
-    CONDITION_VAR         condition;    // Condition signaled when a used resource becomes available
-    CRITICAL_SECTION      lock;         // Synchronize access to the pool structure
+    POOL_SLOT             *slots;       // Array of "maximum" resource slots
+    volatile LONGLONG     freeList;     // Free list head: update count in the high 32 bits, slot plus one in the low
+    volatile LONG         unpark;       // Slot last checked by SlotUnpark()
+    POOL_STATS            stats;        // Pool statistics
+    CONDITION_VAR         condition;    // Condition signaled when a resource is released or destroyed
+    CRITICAL_SECTION      lock;         // Synchronize threads waiting for a resource
 } POOL;
 
 //
@@ -139,4 +164,6 @@ BOOL FCALL PoolRelease(POOL *pool, VOID *data);
 BOOL FCALL PoolValidate(POOL *pool, VOID *data);
 VOID FCALL PoolInvalidate(POOL *pool, VOID *data);
 
+VOID FCALL PoolGetStats(POOL *pool, POOL_STATS *stats);
+
 #endif // POOL_H_INCLUDED
@@ -0,0 +1,101 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Sync Queue
+
+Abstract:
+    Synchronization queue declarations.
+
+*/
+
+#ifndef SYNCQUEUE_H_INCLUDED
+#define SYNCQUEUE_H_INCLUDED
+
+#include <condvar.h>
+
+#define SYNC_QUEUE_WAIT 100     // Milliseconds the reading thread waits for a worker before applying an item itself
+
+/*++
+
+SYNC_APPLY_PROC
+
+    Applies a user or group read by the synchronization.
+
+Arguments:
+    name    - Pointer to a null-terminated string that specifies the user or group name.
+
+    file    - Pointer to the USERFILE or GROUPFILE structure.
+
+Return Values:
+    None.
+
+Remarks:
+    This callback is called by a worker thread, or by the reading thread when
+    no worker took the item in time, without the queue locked.
+
+--*/
+typedef VOID (FCALL SYNC_APPLY_PROC)(CHAR *name, VOID *file);
+
+//
+// Queued item
+//
+
+typedef struct {
+    SYNC_APPLY_PROC *proc;                  // Procedure to apply the item
+    CHAR            name[_MAX_NAME + 1];    // User or group name
+    union {
+        GROUPFILE   group;
+        USERFILE    user;
+    } file;                                 // Record read from the database
+} SYNC_ITEM;
+
+//
+// Queue counters
+//
+
+typedef struct {
+    LONG    applied;        // Items applied by the worker threads
+    LONG    direct;         // Items applied by the reading thread, no worker thread took them in time
+    DWORD   blocked;        // Milliseconds the reading thread waited for a free slot
+    DWORD   drained;        // Milliseconds the reading thread waited for the queue to drain
+} SYNC_QUEUE_COUNTERS;
+
+//
+// Queue structure
+//
+
+typedef struct SYNC_WORKER SYNC_WORKER;
+
+typedef struct {
+    SYNC_ITEM           *items;     // Circular buffer of queued items
+    LONG                capacity;   // Number of items allocated
+    LONG                head;       // Index of the first queued item
+    LONG                count;      // Number of queued items
+    LONG                active;     // Number of items being applied
+    LONG                threads;    // Number of worker jobs that started and have not exited
+    LONG                exited;     // Number of worker jobs that started and exited
+    INT                 workers;    // Number of worker jobs queued
+    SYNC_WORKER         **worker;   // Worker jobs, which may not have started yet
+    BOOL                closed;     // Worker threads must exit once the queue is empty
+    SYNC_QUEUE_COUNTERS counters;   // Queue counters
+    CONDITION_VAR       ready;      // Signalled when an item is queued, or the queue is closed
+    CONDITION_VAR       done;       // Signalled when a slot is freed, an item applied, or a thread exits
+    CRITICAL_SECTION    lock;       // Synchronize access to the queue
+} SYNC_QUEUE;
+
+//
+// Queue functions
+//
+
+DWORD FCALL SyncQueueCreate(SYNC_QUEUE *queue, LONG capacity, INT threads);
+VOID  FCALL SyncQueueDestroy(SYNC_QUEUE *queue);
+
+VOID  FCALL SyncQueuePush(SYNC_QUEUE *queue, SYNC_APPLY_PROC *proc, CHAR *name, VOID *file, SIZE_T size);
+VOID  FCALL SyncQueueDrain(SYNC_QUEUE *queue);
+
+VOID  FCALL SyncQueueGetCounters(SYNC_QUEUE *queue, SYNC_QUEUE_COUNTERS *counters);
+
+#endif // SYNCQUEUE_H_INCLUDED
@@ -12,50 +12,6 @@
 --  3. Create a MySQL user to access the "ioftpd" database.
 --
 
---
--- Procedures
---
-
-CREATE PROCEDURE io_user_lock(IN pName VARCHAR(65), IN pExpire INT, IN pTimeout INT, IN pOwner VARCHAR(36))
-BEGIN
-  DECLARE elapsed FLOAT UNSIGNED DEFAULT 0;
-  DECLARE sleep   FLOAT UNSIGNED DEFAULT 0.2;
-
-  SPIN:BEGIN
-    WHILE elapsed < pTimeout DO
-      UPDATE io_user SET lockowner=pOwner, locktime=UNIX_TIMESTAMP()
-        WHERE name=pName AND (lockowner IS NULL OR (UNIX_TIMESTAMP() - locktime) > pExpire);
-
-      IF ROW_COUNT() > 0 THEN
-        LEAVE SPIN;
-      END IF;
-
-      SET elapsed = elapsed + sleep;
-      DO SLEEP(sleep);
-    END WHILE;
-  END SPIN;
-END;
-
-CREATE PROCEDURE io_group_lock(IN pName VARCHAR(65), IN pExpire INT, IN pTimeout INT, IN pOwner VARCHAR(36))
-BEGIN
-  DECLARE elapsed FLOAT UNSIGNED DEFAULT 0;
-  DECLARE sleep   FLOAT UNSIGNED DEFAULT 0.2;
-
-  SPIN:BEGIN
-    WHILE elapsed < pTimeout DO
-      UPDATE io_group SET lockowner=pOwner, locktime=UNIX_TIMESTAMP()
-        WHERE name=pName AND (lockowner IS NULL OR (UNIX_TIMESTAMP() - locktime) > pExpire);
-
-      IF ROW_COUNT() > 0 THEN
-        LEAVE SPIN;
-      END IF;
-
-      SET elapsed = elapsed + sleep;
-      DO SLEEP(sleep);
-    END WHILE;
-  END SPIN;
-END;
-
 --
 -- Tables
 --
@@ -69,7 +25,8 @@ CREATE TABLE io_group (
   updated     INT UNSIGNED NOT NULL DEFAULT 0,
   lockowner   VARCHAR(36)           DEFAULT NULL,
   locktime    INT UNSIGNED NOT NULL DEFAULT 0,
-  PRIMARY KEY (name)
+  PRIMARY KEY (name),
+  KEY updated (updated)
 );
 
 CREATE TABLE io_group_changes (
@@ -78,7 +35,8 @@ CREATE TABLE io_group_changes (
   type        TINYINT UNSIGNED NOT NULL,
   name        VARCHAR(65)      NOT NULL,
   info        VARCHAR(255)     DEFAULT NULL,
-  PRIMARY KEY (id)
+  PRIMARY KEY (id),
+  KEY time (time)
 );
 
 CREATE TABLE io_user (
@@ -116,7 +74,8 @@ CREATE TABLE io_user (
   updated     INT UNSIGNED NOT NULL DEFAULT 0,
   lockowner   VARCHAR(36)           DEFAULT NULL,
   locktime    INT UNSIGNED NOT NULL DEFAULT 0,
-  PRIMARY KEY (name)
+  PRIMARY KEY (name),
+  KEY updated (updated)
 );
 
 CREATE TABLE io_user_changes (
@@ -125,7 +84,8 @@ CREATE TABLE io_user_changes (
   type        TINYINT UNSIGNED NOT NULL,
   name        VARCHAR(65)      NOT NULL,
   info        VARCHAR(255)     DEFAULT NULL,
-  PRIMARY KEY (id)
+  PRIMARY KEY (id),
+  KEY time (time)
 );
 
 CREATE TABLE io_user_admins (
@@ -146,3 +106,11 @@ CREATE TABLE io_user_hosts (
   host        VARCHAR(97) NOT NULL,
   PRIMARY KEY (uname,host)
 );
+
+CREATE TABLE io_user_flush (
+  owner       VARCHAR(36)     NOT NULL,
+  seq         BIGINT UNSIGNED NOT NULL,
+  time        INT UNSIGNED    NOT NULL,
+  PRIMARY KEY (owner,seq),
+  KEY time (time)
+);
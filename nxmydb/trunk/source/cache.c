@@ -0,0 +1,670 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Cache
+
+Abstract:
+    Record cache functions. User and group records are kept in memory, by name,
+    so they can be opened without a query.
+
+    Valid Entry   - An entry with a copy of the database row and its update time.
+    Tombstone     - An entry without a record, kept so a read that started before
+                    the record changed is not cached.
+
+    Every change increments the cache version and stamps the entry with it. A
+    reader captures the version before querying the database, and its record
+    is only cached if the entry did not change since. Tombstones are discarded
+    once a synchronization has started after them; reads older than that are
+    not cached at all.
+
+    Records are only returned while the synchronization that keeps them current
+    is running; they expire when it has not completed within "maxAge".
+
+*/
+
+#include <base.h>
+#include <array.h>
+#include <cache.h>
+
+static INT CompareName(const VOID *elem1, const VOID *elem2)
+{
+    const CACHE_ENTRY **entry1 = elem1;
+    const CACHE_ENTRY **entry2 = elem2;
+
+    return strcmp(entry1[0]->name, entry2[0]->name);
+}
+
+static CACHE_ENTRY *EntrySearch(CACHE *cache, const CHAR *name)
+{
+    CACHE_ENTRY *entry;
+    CACHE_ENTRY **vector;
+
+    // Move the "name" pointer by its offset in the CACHE_ENTRY structure,
+    // the same as NameListExists() does.
+    entry = (CACHE_ENTRY *)((BYTE *)name - offsetof(CACHE_ENTRY, name));
+
+    vector = ArrayPtrSearch(entry, cache->array, cache->count, CompareName);
+    return (vector != NULL) ? vector[0] : NULL;
+}
+
+static CACHE_ENTRY *EntryInsert(CACHE *cache, const CHAR *name)
+{
+    CACHE_ENTRY *entry;
+    CACHE_ENTRY **vector;
+    VOID        *newMem;
+
+    if (cache->count >= cache->total) {
+        // Increase the size of the array by 64 entries
+        newMem = MemReallocate(cache->array, (cache->total + 64) * sizeof(CACHE_ENTRY *));
+        if (newMem == NULL) {
+            return NULL;
+        }
+
+        cache->array = newMem;
+        cache->total += 64;
+    }
+
+    entry = MemAllocate(sizeof(CACHE_ENTRY));
+    if (entry == NULL) {
+        return NULL;
+    }
+    ZeroMemory(entry, sizeof(CACHE_ENTRY));
+    StringCchCopyA(entry->name, ELEMENT_COUNT(entry->name), name);
+
+    vector = ArrayPtrInsert(entry, cache->array, cache->count, CompareName);
+    if (vector != NULL) {
+        // Entry already exists
+        MemFree(entry);
+        return vector[0];
+    }
+    cache->count++;
+
+    return entry;
+}
+
+static VOID EntryClear(CACHE *cache, CACHE_ENTRY *entry)
+{
+    if (entry->data != NULL) {
+        MemFree(entry->data);
+        entry->data = NULL;
+        cache->records--;
+    }
+}
+
+static VOID EntryEvict(CACHE *cache)
+{
+    CACHE_ENTRY *entry;
+    CACHE_ENTRY *oldest = NULL;
+    DWORD       now;
+    SIZE_T      i;
+
+    // Discard the record that was used least recently, the entry is kept
+    // as a tombstone since it may have changed.
+    now = GetTickCount();
+    for (i = 0; i < cache->count; i++) {
+        entry = cache->array[i];
+
+        if (entry->data != NULL && (oldest == NULL || now - entry->used > now - oldest->used)) {
+            oldest = entry;
+        }
+    }
+
+    if (oldest != NULL) {
+        EntryClear(cache, oldest);
+        cache->counters.evictions++;
+    }
+}
+
+static VOID EntryChanged(CACHE *cache, const CHAR *name)
+{
+    CACHE_ENTRY *entry;
+
+    entry = EntrySearch(cache, name);
+    if (entry == NULL) {
+        entry = EntryInsert(cache, name);
+    }
+
+    if (entry != NULL) {
+        if (entry->data != NULL) {
+            cache->counters.invalidations++;
+        }
+        EntryClear(cache, entry);
+        entry->version = ++cache->version;
+        entry->changed = GetTickCount();
+    } else {
+        // Without a tombstone, no read in progress can be cached
+        cache->floor   = ++cache->version;
+        cache->changed = GetTickCount();
+    }
+}
+
+
+/*++
+
+CacheCreate
+
+    Creates a record cache.
+
+Arguments:
+    cache   - Pointer to the CACHE structure to be initialized.
+
+    size    - Size of a record, in bytes.
+
+    maximum - Maximum number of records to keep.
+
+    maxAge  - Milliseconds records stay current after a synchronization. If
+              this argument is zero, they never expire.
+
+Return Values:
+    A Windows API error code.
+
+--*/
+DWORD FCALL CacheCreate(CACHE *cache, SIZE_T size, SIZE_T maximum, DWORD maxAge)
+{
+    ASSERT(cache != NULL);
+
+    if (size == 0 || maximum == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(cache, sizeof(CACHE));
+    cache->size    = size;
+    cache->maximum = maximum;
+    cache->maxAge  = maxAge;
+    cache->synced  = GetTickCount();
+    cache->total   = 64;
+
+    if (!InitializeCriticalSectionAndSpinCount(&cache->lock, 100)) {
+        return GetLastError();
+    }
+
+    cache->array = MemAllocate(cache->total * sizeof(CACHE_ENTRY *));
+    if (cache->array == NULL) {
+        DeleteCriticalSection(&cache->lock);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+/*++
+
+CacheDestroy
+
+    Destroys a record cache.
+
+Arguments:
+    cache   - Pointer to the CACHE structure to be destroyed.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL CacheDestroy(CACHE *cache)
+{
+    ASSERT(cache != NULL);
+
+    // Cache was never created
+    if (cache->array == NULL) {
+        return;
+    }
+
+    CacheFlush(cache);
+
+    DeleteCriticalSection(&cache->lock);
+    MemFree(cache->array);
+
+    ZeroMemory(cache, sizeof(CACHE));
+}
+
+/*++
+
+CacheVersion
+
+    Retrieves the cache version, which must be done before reading a record
+    from the database.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+Return Values:
+    Current cache version.
+
+--*/
+LONG FCALL CacheVersion(CACHE *cache)
+{
+    LONG version;
+
+    ASSERT(cache != NULL);
+
+    if (cache->array == NULL) {
+        return 0;
+    }
+
+    EnterCriticalSection(&cache->lock);
+    version = cache->version;
+    LeaveCriticalSection(&cache->lock);
+
+    return version;
+}
+
+/*++
+
+CacheGet
+
+    Retrieves a record from the cache.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+    name    - Name of the record.
+
+    data    - Buffer to receive the record.
+
+Return Values:
+    If the record was found, the return is nonzero (true).
+
+    If the record was not found or is too old, the return is zero (false).
+
+--*/
+BOOL FCALL CacheGet(CACHE *cache, const CHAR *name, VOID *data)
+{
+    BOOL        result = FALSE;
+    CACHE_ENTRY *entry;
+    DWORD       now;
+
+    ASSERT(cache != NULL);
+    ASSERT(name != NULL);
+    ASSERT(data != NULL);
+
+    if (cache->array == NULL) {
+        return FALSE;
+    }
+
+    EnterCriticalSection(&cache->lock);
+
+    entry = EntrySearch(cache, name);
+    if (entry == NULL || entry->data == NULL) {
+        cache->counters.misses++;
+    } else {
+        now = GetTickCount();
+
+        if (cache->maxAge != 0 && now - cache->synced > cache->maxAge) {
+            // Changes made by other servers are no longer being read
+            cache->counters.expired++;
+        } else {
+            CopyMemory(data, entry->data, cache->size);
+            entry->used = now;
+            cache->counters.hits++;
+            result = TRUE;
+        }
+    }
+
+    LeaveCriticalSection(&cache->lock);
+    return result;
+}
+
+/*++
+
+CachePut
+
+    Stores a record read from the database.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+    name    - Name of the record.
+
+    data    - Record read from the database.
+
+    stamp   - Update time of the database row.
+
+    version - Cache version retrieved before the record was read.
+
+    create  - Cache the record if it is not already. Otherwise, only a record
+              that is already cached is refreshed.
+
+Return Values:
+    None.
+
+Remarks:
+    The record is not stored if the entry changed after "version".
+
+--*/
+VOID FCALL CachePut(CACHE *cache, const CHAR *name, const VOID *data, ULONG stamp, LONG version, BOOL create)
+{
+    CACHE_ENTRY *entry;
+
+    ASSERT(cache != NULL);
+    ASSERT(name != NULL);
+    ASSERT(data != NULL);
+
+    if (cache->array == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&cache->lock);
+
+    if (version < cache->floor) {
+        // Read started before tombstones were discarded
+        goto end;
+    }
+
+    entry = EntrySearch(cache, name);
+    if (entry == NULL) {
+        if (!create) {
+            // A read in progress may have the previous record
+            EntryChanged(cache, name);
+            goto end;
+        }
+
+        entry = EntryInsert(cache, name);
+        if (entry == NULL) {
+            goto end;
+        }
+        entry->version = version;
+
+    } else if (entry->version > version) {
+        // Entry changed while the record was read
+        goto end;
+
+    } else if (entry->data != NULL) {
+        if (stamp < entry->stamp) {
+            goto end;
+        }
+
+        if (stamp == entry->stamp) {
+            // Rows are stamped to the second, so it is not known which
+            // record is newer when they differ.
+            if (memcmp(entry->data, data, cache->size) != 0) {
+                EntryChanged(cache, name);
+            }
+            goto end;
+        }
+
+        CopyMemory(entry->data, data, cache->size);
+        entry->stamp   = stamp;
+        entry->version = ++cache->version;
+        cache->counters.updates++;
+        goto end;
+
+    } else if (!create) {
+        entry->version = ++cache->version;
+        goto end;
+    }
+
+    // Store the record in an empty entry
+    if (cache->records >= cache->maximum) {
+        EntryEvict(cache);
+    }
+
+    entry->data = MemAllocate(cache->size);
+    if (entry->data != NULL) {
+        CopyMemory(entry->data, data, cache->size);
+        entry->stamp = stamp;
+        entry->used  = GetTickCount();
+        cache->records++;
+    }
+
+end:
+    LeaveCriticalSection(&cache->lock);
+}
+
+/*++
+
+CacheChanged
+
+    Checks if a record changed recently.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+    name    - Name of the record.
+
+    age     - Milliseconds a change is considered recent.
+
+Return Values:
+    If the record changed within "age" milliseconds, or it is not known, the
+    return value is nonzero (true).
+
+    If the record did not change recently, the return value is zero (false).
+
+Remarks:
+    Writes and invalidations change a record, reading or refreshing it from
+    the database does not.
+
+--*/
+BOOL FCALL CacheChanged(CACHE *cache, const CHAR *name, DWORD age)
+{
+    BOOL        changed;
+    CACHE_ENTRY *entry;
+    DWORD       now;
+
+    ASSERT(cache != NULL);
+    ASSERT(name != NULL);
+
+    if (cache->array == NULL) {
+        return TRUE;
+    }
+
+    EnterCriticalSection(&cache->lock);
+
+    now = GetTickCount();
+    if (now - cache->changed < age) {
+        // A change was made without an entry to record it
+        changed = TRUE;
+    } else {
+        entry = EntrySearch(cache, name);
+        changed = (entry != NULL && now - entry->changed < age);
+    }
+
+    LeaveCriticalSection(&cache->lock);
+    return changed;
+}
+
+/*++
+
+CacheApply
+
+    Changes a cached record after it was written to the database.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+    name    - Name of the record.
+
+    proc    - Procedure called to change the record.
+
+    context - Opaque argument passed to the procedure.
+
+Return Values:
+    None.
+
+Remarks:
+    If the record is not cached, reads in progress are prevented from
+    caching it.
+
+--*/
+VOID FCALL CacheApply(CACHE *cache, const CHAR *name, CACHE_UPDATE_PROC *proc, VOID *context)
+{
+    CACHE_ENTRY *entry;
+
+    ASSERT(cache != NULL);
+    ASSERT(name != NULL);
+    ASSERT(proc != NULL);
+
+    if (cache->array == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&cache->lock);
+
+    entry = EntrySearch(cache, name);
+    if (entry != NULL && entry->data != NULL) {
+        proc(context, entry->data);
+        entry->version = ++cache->version;
+        entry->changed = GetTickCount();
+        cache->counters.updates++;
+    } else {
+        EntryChanged(cache, name);
+    }
+
+    LeaveCriticalSection(&cache->lock);
+}
+
+/*++
+
+CacheInvalidate
+
+    Discards a cached record.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+    name    - Name of the record.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL CacheInvalidate(CACHE *cache, const CHAR *name)
+{
+    ASSERT(cache != NULL);
+    ASSERT(name != NULL);
+
+    if (cache->array == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&cache->lock);
+    EntryChanged(cache, name);
+    LeaveCriticalSection(&cache->lock);
+}
+
+/*++
+
+CacheFlush
+
+    Discards all cached records.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL CacheFlush(CACHE *cache)
+{
+    SIZE_T i;
+
+    ASSERT(cache != NULL);
+
+    if (cache->array == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&cache->lock);
+
+    cache->counters.invalidations += (LONG)cache->records;
+    for (i = 0; i < cache->count; i++) {
+        if (cache->array[i]->data != NULL) {
+            MemFree(cache->array[i]->data);
+        }
+        MemFree(cache->array[i]);
+    }
+    cache->count   = 0;
+    cache->records = 0;
+
+    // Reads in progress may have records from before the flush, and the
+    // changes made by this server are no longer known
+    cache->floor   = ++cache->version;
+    cache->changed = GetTickCount();
+
+    LeaveCriticalSection(&cache->lock);
+}
+
+/*++
+
+CacheSynced
+
+    Called when a synchronization completes.
+
+Arguments:
+    cache   - Pointer to a CACHE structure.
+
+    version - Cache version retrieved before the synchronization started.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL CacheSynced(CACHE *cache, LONG version)
+{
+    CACHE_ENTRY *entry;
+    SIZE_T      i;
+    SIZE_T      j;
+
+    ASSERT(cache != NULL);
+
+    if (cache->array == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&cache->lock);
+
+    cache->synced = GetTickCount();
+
+    // Discard tombstones older than the previous synchronization, along with
+    // any read that started before them.
+    for (i = 0, j = 0; i < cache->count; i++) {
+        entry = cache->array[i];
+
+        if (entry->data == NULL && entry->version <= cache->purge) {
+            MemFree(entry);
+        } else {
+            cache->array[j++] = entry;
+        }
+    }
+    cache->count = j;
+
+    if (cache->purge >= cache->floor) {
+        cache->floor = cache->purge + 1;
+    }
+    cache->purge = version;
+
+    LeaveCriticalSection(&cache->lock);
+}
+
+/*++
+
+CacheGetCounters
+
+    Retrieves the cache counters.
+
+Arguments:
+    cache    - Pointer to a CACHE structure.
+
+    counters - Pointer to a CACHE_COUNTERS structure that receives the counters.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL CacheGetCounters(CACHE *cache, CACHE_COUNTERS *counters)
+{
+    ASSERT(cache != NULL);
+    ASSERT(counters != NULL);
+
+    if (cache->array == NULL) {
+        ZeroMemory(counters, sizeof(CACHE_COUNTERS));
+        return;
+    }
+
+    EnterCriticalSection(&cache->lock);
+    CopyMemory(counters, &cache->counters, sizeof(CACHE_COUNTERS));
+    LeaveCriticalSection(&cache->lock);
+}
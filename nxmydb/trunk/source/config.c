@@ -21,9 +21,12 @@ Abstract:
 // Global configuration variables
 //
 
+DB_CONFIG_CACHE   dbConfigCache;
 DB_CONFIG_GLOBAL  dbConfigGlobal;
 DB_CONFIG_LOCK    dbConfigLock;
 DB_CONFIG_POOL    dbConfigPool;
+DB_CONFIG_REPLICA dbConfigReplica;
+DB_CONFIG_STATS   dbConfigStats;
 DB_CONFIG_SYNC    dbConfigSync;
 
 DB_CONFIG_SERVER  *dbConfigServers;
@@ -161,9 +164,12 @@ static VOID FCALL ZeroConfig(VOID)
     dbConfigServers     = NULL;
     dbConfigServerCount = 0;
 
+    ZeroMemory(&dbConfigCache,  sizeof(DB_CONFIG_CACHE));
     ZeroMemory(&dbConfigGlobal, sizeof(DB_CONFIG_GLOBAL));
     ZeroMemory(&dbConfigLock,   sizeof(DB_CONFIG_LOCK));
     ZeroMemory(&dbConfigPool,   sizeof(DB_CONFIG_POOL));
+    ZeroMemory(&dbConfigReplica, sizeof(DB_CONFIG_REPLICA));
+    ZeroMemory(&dbConfigStats,  sizeof(DB_CONFIG_STATS));
     ZeroMemory(&dbConfigSync,   sizeof(DB_CONFIG_SYNC));
 }
 
@@ -212,6 +218,14 @@ static DWORD FCALL LoadGlobal(CONFIG_FILE *configFile)
     }
     dbConfigGlobal.logLevel = (LOG_LEVEL)value;
 
+    dbConfigGlobal.logSize = 5120;
+    if (Io_ConfigGetInt(configFile, "nxMyDB", "Log_Size", &dbConfigGlobal.logSize)
+            && (dbConfigGlobal.logSize < 0 || dbConfigGlobal.logSize > 1048576)) {
+        LOG_ERROR("Configuration option 'Log_Size' must be between 0 and 1048576.");
+        return ERROR_INVALID_PARAMETER;
+    }
+    dbConfigGlobal.logSizeBytes = (DWORD)dbConfigGlobal.logSize * 1024; // KB to bytes
+
     //
     // Read lock options
     //
@@ -229,6 +243,7 @@ static DWORD FCALL LoadGlobal(CONFIG_FILE *configFile)
         LOG_ERROR("Configuration option 'Lock_Timeout' must be greater than zero.");
         return ERROR_INVALID_PARAMETER;
     }
+    dbConfigLock.timeoutMili = dbConfigLock.timeout * 1000; // sec to msec
 
     //
     // Read pool options
@@ -279,6 +294,18 @@ static DWORD FCALL LoadGlobal(CONFIG_FILE *configFile)
     }
     dbConfigPool.checkNano = UInt32x32To64(dbConfigPool.check, 10000000); // sec to 100nsec
 
+    //
+    // Read statistics options
+    //
+
+    dbConfigStats.flush = 10;
+    if (Io_ConfigGetInt(configFile, "nxMyDB", "Stats_Flush", &dbConfigStats.flush)
+            && dbConfigStats.flush < 0) {
+        LOG_ERROR("Configuration option 'Stats_Flush' must be zero or greater.");
+        return ERROR_INVALID_PARAMETER;
+    }
+    dbConfigStats.flush = dbConfigStats.flush * 1000; // sec to msec
+
     //
     // Read sync options
     //
@@ -302,12 +329,64 @@ static DWORD FCALL LoadGlobal(CONFIG_FILE *configFile)
         }
         dbConfigSync.interval = dbConfigSync.interval * 1000; // sec to msec
 
-        dbConfigSync.purge = dbConfigSync.interval * 100;
+        // Purge age is kept in seconds, it is compared with the server time
+        dbConfigSync.purge = (dbConfigSync.interval / 1000) * 100;
         if (Io_ConfigGetInt(configFile, "nxMyDB", "Sync_Purge", &dbConfigSync.purge)
-                && dbConfigSync.purge <= dbConfigSync.interval) {
+                && dbConfigSync.purge <= dbConfigSync.interval / 1000) {
             LOG_ERROR("Configuration option 'Sync_Purge' must be greater than 'Sync_Interval'.");
             return ERROR_INVALID_PARAMETER;
         }
+
+        dbConfigSync.threads = 4;
+        if (Io_ConfigGetInt(configFile, "nxMyDB", "Sync_Threads", &dbConfigSync.threads)
+                && dbConfigSync.threads < 0) {
+            LOG_ERROR("Configuration option 'Sync_Threads' must be zero or greater.");
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    //
+    // Read cache options
+    //
+
+    // Records are only cached while synchronization reads the changes
+    // made by other servers.
+    if (dbConfigSync.enabled) {
+        dbConfigCache.size = 1000;
+        if (Io_ConfigGetInt(configFile, "nxMyDB", "Cache_Size", &dbConfigCache.size)
+                && dbConfigCache.size < 0) {
+            LOG_ERROR("Configuration option 'Cache_Size' must be zero or greater.");
+            return ERROR_INVALID_PARAMETER;
+        }
+        dbConfigCache.maxAge = (DWORD)dbConfigSync.interval * 2;
+    }
+
+    //
+    // Read replica options
+    //
+
+    dbConfigReplica.check = 5;
+    if (Io_ConfigGetInt(configFile, "nxMyDB", "Replica_Check", &dbConfigReplica.check)
+            && dbConfigReplica.check <= 0) {
+        LOG_ERROR("Configuration option 'Replica_Check' must be greater than zero.");
+        return ERROR_INVALID_PARAMETER;
+    }
+    dbConfigReplica.checkMili = dbConfigReplica.check * 1000; // sec to msec
+
+    dbConfigReplica.maxLag = 5;
+    if (Io_ConfigGetInt(configFile, "nxMyDB", "Replica_Lag", &dbConfigReplica.maxLag)
+            && dbConfigReplica.maxLag < 0) {
+        LOG_ERROR("Configuration option 'Replica_Lag' must be zero or greater.");
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // The lag is reported in whole seconds, so allow for one more. Changes
+    // must be remembered by the caches for that long, and they are only
+    // guaranteed to be remembered for one synchronization interval.
+    dbConfigReplica.window = (dbConfigReplica.maxLag + 2) * 1000; // sec to msec
+    if (dbConfigSync.enabled && dbConfigReplica.window > (DWORD)dbConfigSync.interval) {
+        LOG_ERROR("Configuration option 'Replica_Lag' must be at least two seconds less than 'Sync_Interval'.");
+        return ERROR_INVALID_PARAMETER;
     }
 
     return ERROR_SUCCESS;
@@ -329,12 +408,12 @@ Arguments:
 Return Values:
     A Windows API error code.
 
-Remarks:
-    This function always succeeds.
-
 --*/
 static DWORD FCALL LoadServer(CONFIG_FILE *configFile, CHAR *array, DB_CONFIG_SERVER *server)
 {
+    CHAR    *role;
+    DWORD   result = ERROR_SUCCESS;
+
     ASSERT(configFile != NULL);
     ASSERT(array != NULL);
     ASSERT(server != NULL);
@@ -358,7 +437,19 @@ static DWORD FCALL LoadServer(CONFIG_FILE *configFile, CHAR *array, DB_CONFIG_SE
     server->sslCAFile   = GetString(configFile, array, "SSL_CA_File");
     server->sslCAPath   = GetString(configFile, array, "SSL_CA_Path");
 
-    return ERROR_SUCCESS;
+    // Role options, a mistyped role must not send writes to a replica
+    role = GetString(configFile, array, "Role");
+    if (role != NULL) {
+        if (_stricmp(role, "Replica") == 0) {
+            server->replica = TRUE;
+        } else if (_stricmp(role, "Primary") != 0) {
+            LOG_ERROR("Configuration option 'Role' for server [%s] must be \"Primary\" or \"Replica\".", array);
+            result = ERROR_INVALID_PARAMETER;
+        }
+        Io_Free(role);
+    }
+
+    return result;
 }
 
 /*++
@@ -376,6 +467,7 @@ Return Values:
 --*/
 static DWORD FCALL LoadAllServers(CONFIG_FILE *configFile)
 {
+    BOOL        primary;
     CHAR        *name;
     CHAR        *servers;
     DWORD       count;
@@ -410,19 +502,31 @@ static DWORD FCALL LoadAllServers(CONFIG_FILE *configFile)
                 result = ERROR_NOT_ENOUGH_MEMORY;
 
             } else {
+                ZeroMemory(dbConfigServers, sizeof(DB_CONFIG_SERVER) * count);
+
                 // Load the server configuration for each array
+                result  = ERROR_SUCCESS;
+                primary = FALSE;
                 for (i = 0; i < count; i++) {
                     name = Io_GetStringIndexStatic(&serverList, i);
 
-                    // The success of LoadServer() does not matter
-                    LoadServer(configFile, name, &dbConfigServers[i]);
+                    // Only an invalid role fails, other options have defaults
+                    if (LoadServer(configFile, name, &dbConfigServers[i]) != ERROR_SUCCESS) {
+                        result = ERROR_INVALID_PARAMETER;
+                    }
+                    if (!dbConfigServers[i].replica) {
+                        primary = TRUE;
+                    }
                 }
 
                 // Update global count
                 dbConfigServerCount = count;
 
-                // Succesfully loaded at least one server configuration
-                result = ERROR_SUCCESS;
+                // Writes and locks require a primary server
+                if (result == ERROR_SUCCESS && !primary) {
+                    LOG_ERROR("Configuration option 'Servers' must contain at least one primary server.");
+                    result = ERROR_INVALID_PARAMETER;
+                }
             }
         }
         Io_FreeString(&serverList);
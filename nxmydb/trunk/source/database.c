@@ -24,11 +24,16 @@ Abstract:
 // Database variables
 //
 
-static DB_SYNC  dbSync; // Database synchronization
-static POOL     dbPool; // Database connection pool
+static DB_SYNC    dbSync;        // Database synchronization
+static POOL       dbPool;        // Database connection pool
+static POOL       replicaPool;   // Replica connection pool
+static DB_REPLICA *replicas;     // Replica health, indexed like the server configuration
+static TIMER      *replicaTimer; // Replica health check timer
+static TIMER      *statsTimer;   // Statistics flush timer
 
-static LONG volatile dbIndex  = 0; // Server configuration index
-static LONG volatile refCount = 0; // Reference count initialization calls
+static LONG volatile dbIndex      = 0;  // Server configuration index
+static LONG volatile replicaIndex = -1; // Replica configuration index, -1 if reads use the primary
+static LONG volatile refCount     = 0;  // Reference count initialization calls
 
 //
 // Function declarations
@@ -38,17 +43,124 @@ static POOL_CONSTRUCTOR_PROC ConnectionOpen;
 static POOL_VALIDATOR_PROC   ConnectionCheck;
 static POOL_DESTRUCTOR_PROC  ConnectionClose;
 
+static Io_TimerProc ReplicaTimer;
+static Io_TimerProc StatsTimer;
 static Io_TimerProc SyncTimer;
 
 
 /*++
 
+ServerNext
+
+    Retrieves the next primary server, for failover.
+
+Arguments:
+    index   - Index of the current server, -1 for the first primary server.
+
+Return Values:
+    Index of the next primary server.
+
+--*/
+static LONG ServerNext(LONG index)
+{
+    DWORD i;
+
+    for (i = 0; i < dbConfigServerCount; i++) {
+        index++;
+        if (index >= (LONG)dbConfigServerCount) {
+            index = 0;
+        }
+
+        if (!dbConfigServers[index].replica) {
+            break;
+        }
+    }
+    return index;
+}
+
+/*++
+
+ServerConnect
+
+    Connects to a server.
+
+Arguments:
+    handle  - MySQL handle, from mysql_init().
+
+    server  - Pointer to the DB_CONFIG_SERVER structure.
+
+Return Values:
+    If the function succeeds, the return value is nonzero (true).
+
+    If the function fails, the return value is zero (false).
+
+--*/
+static BOOL ServerConnect(MYSQL *handle, DB_CONFIG_SERVER *server)
+{
+    MYSQL       *connection;
+    my_bool     optReconnect;
+    UINT        optTimeout;
+
+    ASSERT(handle != NULL);
+    ASSERT(server != NULL);
+
+    // Set connection options
+    optTimeout = (UINT)dbConfigGlobal.connTimeout;
+    if (mysql_options(handle, MYSQL_OPT_CONNECT_TIMEOUT, &optTimeout) != 0) {
+        TRACE("Failed to set connection timeout option.");
+    }
+
+    optReconnect = FALSE;
+    if (mysql_options(handle, MYSQL_OPT_RECONNECT, &optReconnect) != 0) {
+        TRACE("Failed to set reconnection option.");
+    }
+
+    if (server->compression) {
+        if (mysql_options(handle, MYSQL_OPT_COMPRESS, 0) != 0) {
+            TRACE("Failed to set compression option.");
+        }
+    }
+
+    if (server->sslEnable) {
+        //
+        // This function always returns 0. If the SSL setup is incorrect,
+        // the call to mysql_real_connect() will return an error.
+        //
+        mysql_ssl_set(handle, server->sslKeyFile, server->sslCertFile,
+            server->sslCAFile, server->sslCAPath, server->sslCiphers);
+    }
+
+    // Attempt connection with server
+    connection = mysql_real_connect(handle,
+        server->host, server->user, server->password,
+        server->database, server->port, NULL, CLIENT_INTERACTIVE);
+
+    if (connection == NULL) {
+        LOG_ERROR("Unable to connect to server [%s]: %s",
+            server->name, mysql_error(handle));
+        return FALSE;
+    }
+
+    if (mysql_get_server_version(handle) < 50019) {
+        LOG_ERROR("Unsupported version of MySQL Server [%s]: running v%s, must be v5.0.19 or newer.",
+            server->name, mysql_get_server_info(handle));
+        return FALSE;
+    }
+
+    // Pointer values should be the same as from mysql_init()
+    ASSERT(connection == handle);
+    return TRUE;
+}
+
+/*++
+
 ConnectionOpen
 
     Opens a server connection.
 
 Arguments:
-    context - Opaque context passed to <PoolCreate>.
+    context - Opaque context passed to <PoolCreate>, the replica pool for
+              replica connections.
 
     data    - Pointer to a pointer that receives the DB_CONTEXT structure.
 
@@ -63,16 +175,10 @@ static BOOL FCALL ConnectionOpen(VOID *context, VOID **data)
     DB_CONTEXT          *db;
     DB_CONFIG_SERVER    *server;
     DWORD               error;
-    DWORD               i;
     INT                 attempt;
     INT                 attemptMax;
     LONG                serverIndex;
-    LONG                serverNextIndex;
-    MYSQL               *connection;
-    my_bool             optReconnect;
-    UINT                optTimeout;
 
-    UNREFERENCED_PARAMETER(context);
     ASSERT(data != NULL);
     TRACE("context=%p data=%p", context, data);
 
@@ -97,110 +203,79 @@ static BOOL FCALL ConnectionOpen(VOID *context, VOID **data)
         goto failed;
     }
 
-    // If the maximum number of attempts were not specified, try all servers
-    if (dbConfigGlobal.connAttempts > 0) {
-        attemptMax = dbConfigGlobal.connAttempts;
-    } else {
-        attemptMax = dbConfigServerCount;
-    }
-
-    for (attempt = 0; attempt < attemptMax; attempt++) {
-        // Use the most recent server for the connection attempt
-        serverIndex = dbIndex;
-        server      = &dbConfigServers[serverIndex];
-
-        TRACE("Connecting to server #%d [%s] on attempt %lu/%lu.",
-            serverIndex, server->name, attempt+1, attemptMax);
-
-        // Set connection options
-        optTimeout = (UINT)dbConfigGlobal.connTimeout;
-        if (mysql_options(db->handle, MYSQL_OPT_CONNECT_TIMEOUT, &optTimeout) != 0) {
-            TRACE("Failed to set connection timeout option.");
+    if (context == &replicaPool) {
+        // Use the replica chosen by the last health check, there is no failover
+        serverIndex = replicaIndex;
+        if (serverIndex < 0) {
+            error = ERROR_CONNECTION_UNAVAIL;
+            goto failed;
         }
+        server = &dbConfigServers[serverIndex];
 
-        optReconnect = FALSE;
-        if (mysql_options(db->handle, MYSQL_OPT_RECONNECT, &optReconnect) != 0) {
-            TRACE("Failed to set reconnection option.");
-        }
+        TRACE("Connecting to replica #%d [%s].", serverIndex, server->name);
 
-        if (server->compression) {
-            if (mysql_options(db->handle, MYSQL_OPT_COMPRESS, 0) != 0) {
-                TRACE("Failed to set compression option.");
-            }
+        if (!ServerConnect(db->handle, server)) {
+            error = ERROR_CONNECTION_REFUSED;
+            goto failed;
         }
+        db->replica = TRUE;
 
-        if (server->sslEnable) {
-            //
-            // This function always returns 0. If the SSL setup is incorrect,
-            // the call to mysql_real_connect() will return an error.
-            //
-            mysql_ssl_set(db->handle, server->sslKeyFile, server->sslCertFile,
-                server->sslCAFile, server->sslCAPath, server->sslCiphers);
+    } else {
+        // If the maximum number of attempts were not specified, try all servers
+        if (dbConfigGlobal.connAttempts > 0) {
+            attemptMax = dbConfigGlobal.connAttempts;
+        } else {
+            attemptMax = dbConfigServerCount;
         }
 
-        // Attempt connection with server
-        connection = mysql_real_connect(db->handle,
-            server->host, server->user, server->password,
-            server->database, server->port, NULL, CLIENT_INTERACTIVE);
+        for (attempt = 0; attempt < attemptMax; attempt++) {
+            // Use the most recent server for the connection attempt
+            serverIndex = dbIndex;
+            server      = &dbConfigServers[serverIndex];
 
-        if (connection == NULL) {
-            LOG_ERROR("Unable to connect to server [%s]: %s",
-                server->name, mysql_error(db->handle));
+            TRACE("Connecting to server #%d [%s] on attempt %lu/%lu.",
+                serverIndex, server->name, attempt+1, attemptMax);
 
-        } else if (mysql_get_server_version(db->handle) < 50019) {
-            LOG_ERROR("Unsupported version of MySQL Server [%s]: running v%s, must be v5.0.19 or newer.",
-                server->name, mysql_get_server_info(db->handle));
-
-        } else {
-            // Pointer values should be the same as from mysql_init()
-            ASSERT(connection == db->handle);
-
-            // Allocate pre-compiled statement structures
-            for (i = 0; i < ELEMENT_COUNT(db->stmt); i++) {
-                db->stmt[i] = mysql_stmt_init(db->handle);
-                if (db->stmt[i] == NULL) {
-                    LOG_ERROR("Unable to allocate memory for statement structure.");
-
-                    error = ERROR_NOT_ENOUGH_MEMORY;
-                    goto failed;
-                }
+            if (ServerConnect(db->handle, server)) {
+                break;
             }
 
-            // Successfully connected, set the global server index
-            InterlockedExchange(&dbIndex, serverIndex);
-
-            // Update context's server index and time stamps
-            db->index = serverIndex;
-            GetSystemTimeAsFileTime(&db->created.fileTime);
-            db->used.value = db->created.value;
-
-            LOG_INFO("Connected to %s [%s], running MySQL Server v%s.",
-                mysql_get_host_info(db->handle), server->name,
-                mysql_get_server_info(db->handle));
-
-            *data = db;
-            return TRUE;
+            //
+            // Unsuccessful connection, continue to the next server. Compare the
+            // current server index before swapping values in the event that
+            // another thread has already changed the index.
+            //
+            InterlockedCompareExchange(&dbIndex, ServerNext(serverIndex), serverIndex);
         }
 
-        // Unsuccessful connection, continue to the next server
-        serverNextIndex = serverIndex + 1;
-        if (serverNextIndex >= (LONG)dbConfigServerCount) {
-            serverNextIndex = 0;
+        if (attempt >= attemptMax) {
+            // Unable to connect to any servers
+            error = ERROR_CONNECTION_REFUSED;
+            goto failed;
         }
 
-        //
-        // Compare the current server index before swapping values in the
-        // event that another thread has already changed the index.
-        //
-        InterlockedCompareExchange(&dbIndex, serverNextIndex, serverIndex);
+        // Successfully connected, set the global server index
+        InterlockedExchange(&dbIndex, serverIndex);
     }
 
-    // Unable to connect to any servers
-    error = ERROR_CONNECTION_REFUSED;
+    // Statements are prepared on first use, see DbStmtPrepare()
+    db->threadId = mysql_thread_id(db->handle);
+
+    // Update context's server index and time stamps
+    db->index = serverIndex;
+    GetSystemTimeAsFileTime(&db->created.fileTime);
+    db->used.value = db->created.value;
+
+    LOG_INFO("Connected to %s [%s], running MySQL Server v%s.",
+        mysql_get_host_info(db->handle), server->name,
+        mysql_get_server_info(db->handle));
+
+    *data = db;
+    return TRUE;
 
 failed:
     if (db != NULL) {
-        ConnectionClose(NULL, db);
+        ConnectionClose(context, db);
     }
     SetLastError(error);
     return FALSE;
@@ -234,7 +309,7 @@ static BOOL FCALL ConnectionCheck(VOID *context, VOID *data)
     TRACE("context=%p data=%p", context, data);
 
     // Check if server changed
-    if (db->index != dbIndex) {
+    if (db->index != (db->replica ? replicaIndex : dbIndex)) {
         LOG_INFO("Closing connection for server configuration change.");
         SetLastError(ERROR_BAD_DEV_TYPE);
         return FALSE;
@@ -263,6 +338,16 @@ static BOOL FCALL ConnectionCheck(VOID *context, VOID *data)
             return FALSE;
         }
 
+        //
+        // Prepared statements are bound to the server session, so they must be
+        // prepared again if the client library re-established the connection.
+        //
+        if (db->threadId != mysql_thread_id(db->handle)) {
+            LOG_INFO("Server connection was re-established, flushing prepared statements.");
+            DbStmtFlush(db);
+            db->threadId = mysql_thread_id(db->handle);
+        }
+
         // Update last-use time stamp
         GetSystemTimeAsFileTime(&db->used.fileTime);
     }
@@ -288,19 +373,19 @@ Return Values:
 static VOID FCALL ConnectionClose(VOID *context, VOID *data)
 {
     DB_CONTEXT  *db = data;
-    DWORD       i;
 
     UNREFERENCED_PARAMETER(context);
     ASSERT(data != NULL);
     TRACE("context=%p data=%p", context, data);
 
-    // Free pre-compiled statement structures
-    for (i = 0; i < ELEMENT_COUNT(db->stmt); i++) {
-        if (db->stmt[i] != NULL) {
-            mysql_stmt_close(db->stmt[i]);
-        }
+    if (db->stmtMisses > 0) {
+        LOG_INFO("Closing connection, statement cache had %lu hits and %lu misses.",
+            db->stmtHits, db->stmtMisses);
     }
 
+    // Free prepared statement structures
+    DbStmtFlush(db);
+
     // Free handle structure
     if (db->handle != NULL) {
         mysql_close(db->handle);
@@ -336,18 +421,15 @@ static DWORD SyncGetTime(DB_CONTEXT *db, ULONG *timePtr)
     ASSERT(db != NULL);
     ASSERT(timePtr != NULL);
 
-    stmt = db->stmt[0];
-
     //
     // Prepare statement and bind parameters
     //
 
     query = "SELECT UNIX_TIMESTAMP()";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_SYNC_TIME, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     metadata = mysql_stmt_result_metadata(stmt);
@@ -414,35 +496,116 @@ Return Values:
 static DWORD SyncTimer(VOID *context, TIMER *timer)
 {
     DB_CONTEXT  *db;
+    DWORD       groupResult;
+    DWORD       groupTime;
     DWORD       result;
+    DWORD       start;
+    DWORD       userResult;
+    DWORD       userTime;
+    LONG        groupVersion;
+    LONG        threads;
+    LONG        userVersion;
     ULONG       currentTime;
+    SYNC_QUEUE  queue;
+    SYNC_QUEUE_COUNTERS counters;
 
     UNREFERENCED_PARAMETER(context);
     UNREFERENCED_PARAMETER(timer);
 
     TRACE("context=%p timer=%p", context, timer);
 
-    if (DbAcquire(&db)) {
-        // Retrieve the current server time
-        result = SyncGetTime(db, &currentTime);
+    if (!DbAcquire(&db)) {
+        return dbConfigSync.interval;
+    }
+
+    // Merge this server's statistics before reading everyone else's
+    DbUserStatsFlush(db, NULL);
+
+    // Incremental synchronizations may read from a replica, the full one
+    // always reads from the primary
+    if (dbSync.prevUpdate != 0) {
+        DbRelease(db);
+        if (!DbAcquireRead(&db, NULL, NULL)) {
+            return dbConfigSync.interval;
+        }
+    }
+
+    // Retrieve the current server time
+    result = SyncGetTime(db, &currentTime);
+    if (result != ERROR_SUCCESS) {
+        LOG_ERROR("Unable to retrieve server timestamp (error %lu).", result);
+
+    } else {
+        if (db->replica) {
+            // Rows the replica has not applied yet are read by the next
+            // synchronization, and this server's own changes from the primary
+            currentTime -= dbConfigReplica.maxLag + 1;
+            dbSync.window = dbConfigReplica.window;
+        } else {
+            dbSync.window = 0;
+        }
+
+        // Update the current time
+        dbSync.currUpdate = currentTime;
+
+        // Cached records changed before now are read by this synchronization
+        groupVersion = CacheVersion(&dbGroupCache);
+        userVersion  = CacheVersion(&dbUserCache);
+
+        // Users and groups are read by this thread and applied by the
+        // queue's worker threads, or by this thread if it has none
+        result = SyncQueueCreate(&queue, DB_SYNC_QUEUE, dbConfigSync.threads);
         if (result != ERROR_SUCCESS) {
-            LOG_ERROR("Unable to retrieve server timestamp (error %lu).", result);
+            LOG_WARN("Unable to create synchronization queue (error %lu).", result);
+            dbSync.queue = NULL;
+        } else {
+            dbSync.queue = &queue;
+        }
 
+        // Groups must be updated before users, each stage returns once
+        // everything it read has been applied
+        start = GetTickCount();
+        groupResult = DbGroupSync(db, &dbSync);
+        groupTime = GetTickCount() - start;
+
+        start = GetTickCount();
+        userResult = DbUserSync(db, &dbSync);
+        userTime = GetTickCount() - start;
+
+        if (dbSync.queue != NULL) {
+            threads = queue.threads;
+            SyncQueueGetCounters(&queue, &counters);
+            SyncQueueDestroy(&queue);
+            dbSync.queue = NULL;
         } else {
-            // Update the current time
-            dbSync.currUpdate = currentTime;
+            threads = 0;
+            ZeroMemory(&counters, sizeof(SYNC_QUEUE_COUNTERS));
+        }
 
-            // Groups must be updated before users
-            DbGroupSync(db, &dbSync);
-            DbUserSync(db, &dbSync);
+        LOG_INFO("Synchronized groups in %lums and users in %lums, %ld applied by %ld threads and %ld by this one "
+            "(reading waited %lums for a free slot and %lums for them to finish).",
+            groupTime, userTime, counters.applied, threads, counters.direct, counters.blocked, counters.drained);
 
-            // Update the previous time
-            dbSync.prevUpdate = currentTime;
+        if (groupTime + userTime > (DWORD)dbConfigSync.interval) {
+            LOG_WARN("Synchronization took %lums, longer than the 'Sync_Interval' option.", groupTime + userTime);
         }
 
-        DbRelease(db);
+        if (groupResult == ERROR_SUCCESS) {
+            CacheSynced(&dbGroupCache, groupVersion);
+        }
+        if (userResult == ERROR_SUCCESS) {
+            CacheSynced(&dbUserCache, userVersion);
+        }
+
+        // Update the previous time, unless rows updated since then
+        // must be read again by the next synchronization
+        if (groupResult == ERROR_SUCCESS && userResult == ERROR_SUCCESS) {
+            dbSync.prevUpdate = currentTime;
+        }
     }
 
+    DbRelease(db);
+
     // Execute the timer again
     return dbConfigSync.interval;
 }
@@ -450,6 +613,311 @@ static DWORD SyncTimer(VOID *context, TIMER *timer)
 
 /*++
 
+StatsTimer
+
+    Flushes buffered user statistics.
+
+Arguments:
+    context - Pointer to the timer context.
+
+    timer   - Pointer to the current TIMER structure.
+
+Return Values:
+    Number of milliseconds in which to execute this timer again.
+
+--*/
+static DWORD StatsTimer(VOID *context, TIMER *timer)
+{
+    DB_CONTEXT  *db;
+
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(timer);
+
+    TRACE("context=%p timer=%p", context, timer);
+
+    if (DbUserStatsPending(NULL) && DbAcquire(&db)) {
+        DbUserStatsFlush(db, NULL);
+        DbRelease(db);
+    }
+
+    // Execute the timer again
+    return dbConfigStats.flush;
+}
+
+
+/*++
+
+ReplicaGetLag
+
+    Retrieves how far a replica is behind its primary.
+
+Arguments:
+    handle  - MySQL handle connected to the replica.
+
+    server  - Pointer to the replica's DB_CONFIG_SERVER structure.
+
+Return Values:
+    Seconds behind the primary, or -1 if replication is not running.
+
+--*/
+static INT ReplicaGetLag(MYSQL *handle, DB_CONFIG_SERVER *server)
+{
+    INT         lag = -1;
+    MYSQL_FIELD *fields;
+    MYSQL_RES   *result;
+    MYSQL_ROW   row;
+    UINT        i;
+
+    ASSERT(handle != NULL);
+    ASSERT(server != NULL);
+
+    // MySQL Server v8.0.22 renamed the statement and v8.4 removed the old name
+    if (mysql_query(handle, "SHOW SLAVE STATUS") != 0
+            && mysql_query(handle, "SHOW REPLICA STATUS") != 0) {
+        LOG_WARN("Unable to retrieve replication status of server [%s]: %s",
+            server->name, mysql_error(handle));
+        return -1;
+    }
+
+    result = mysql_store_result(handle);
+    if (result == NULL) {
+        LOG_WARN("Unable to retrieve replication status of server [%s]: %s",
+            server->name, mysql_error(handle));
+        return -1;
+    }
+
+    // There are no rows if the server is not a replica
+    row = mysql_fetch_row(result);
+    if (row != NULL) {
+        fields = mysql_fetch_fields(result);
+
+        for (i = 0; i < mysql_num_fields(result); i++) {
+            if (strcmp(fields[i].name, "Seconds_Behind_Master") == 0
+                    || strcmp(fields[i].name, "Seconds_Behind_Source") == 0) {
+
+                // The column is null while replication is stopped
+                if (row[i] != NULL) {
+                    lag = atoi(row[i]);
+                }
+                break;
+            }
+        }
+    }
+
+    mysql_free_result(result);
+    return lag;
+}
+
+/*++
+
+ReplicaCheck
+
+    Measures the round trip time and lag of a replica.
+
+Arguments:
+    index   - Index of the replica in the server configuration array.
+
+Return Values:
+    If the replica may be read from, the return value is nonzero (true).
+
+    If the replica is down or too far behind, the return value is zero (false).
+
+--*/
+static BOOL ReplicaCheck(LONG index)
+{
+    BOOL                connected = FALSE;
+    BOOL                report;
+    DB_CONFIG_SERVER    *server;
+    DB_REPLICA          *replica;
+    INT64               sample;
+    LARGE_INTEGER       frequency;
+    LARGE_INTEGER       start;
+    LARGE_INTEGER       stop;
+
+    server  = &dbConfigServers[index];
+    replica = &replicas[index];
+
+    if (replica->handle == NULL) {
+        replica->handle = mysql_init(NULL);
+        if (replica->handle == NULL) {
+            LOG_ERROR("Unable to allocate memory for MySQL handle.");
+            return FALSE;
+        }
+
+        if (!ServerConnect(replica->handle, server)) {
+            mysql_close(replica->handle);
+            replica->handle = NULL;
+            return FALSE;
+        }
+        replica->rtt = -1;
+        connected    = TRUE;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    if (mysql_ping(replica->handle) != 0) {
+        LOG_WARN("Lost connection to replica [%s]: %s", server->name, mysql_error(replica->handle));
+
+        mysql_close(replica->handle);
+        replica->handle = NULL;
+        return FALSE;
+    }
+
+    QueryPerformanceCounter(&stop);
+    sample = ((stop.QuadPart - start.QuadPart) * 1000000) / frequency.QuadPart;
+
+    // Rolling average over about the last eight checks
+    if (replica->rtt < 0) {
+        replica->rtt = sample;
+    } else {
+        replica->rtt = (replica->rtt * 7 + sample) / 8;
+    }
+
+    // Only log when the replica stops being usable, or after connecting
+    report = (replica->usable || connected);
+
+    replica->lag = ReplicaGetLag(replica->handle, server);
+    if (replica->lag < 0) {
+        if (report) {
+            LOG_WARN("Replication is not running on server [%s], reading from other servers.", server->name);
+        }
+        return FALSE;
+    }
+    if (replica->lag > dbConfigReplica.maxLag) {
+        if (report) {
+            LOG_WARN("Replica [%s] is %d seconds behind (%d second limit), reading from other servers.",
+                server->name, replica->lag, dbConfigReplica.maxLag);
+        }
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*++
+
+ReplicaTimer
+
+    Checks the replicas and chooses the one reads are sent to.
+
+Arguments:
+    context - Pointer to the timer context.
+
+    timer   - Pointer to the current TIMER structure.
+
+Return Values:
+    Number of milliseconds in which to execute this timer again.
+
+--*/
+static DWORD ReplicaTimer(VOID *context, TIMER *timer)
+{
+    LONG    best = -1;
+    LONG    i;
+
+    UNREFERENCED_PARAMETER(context);
+    UNREFERENCED_PARAMETER(timer);
+
+    TRACE("context=%p timer=%p", context, timer);
+
+    // Reads are sent to the fastest replica that is not too far behind
+    for (i = 0; i < (LONG)dbConfigServerCount; i++) {
+        if (dbConfigServers[i].replica) {
+            replicas[i].usable = ReplicaCheck(i);
+
+            if (replicas[i].usable && (best < 0 || replicas[i].rtt < replicas[best].rtt)) {
+                best = i;
+            }
+        }
+    }
+
+    if (best != replicaIndex) {
+        if (best < 0) {
+            LOG_WARN("No replica can be read from, reading from the primary.");
+        } else {
+            LOG_INFO("Reading from replica [%s], %I64d microsecond round trip and %d seconds behind.",
+                dbConfigServers[best].name, replicas[best].rtt, replicas[best].lag);
+        }
+
+        // Connections to the previous replica are closed when released
+        InterlockedExchange(&replicaIndex, best);
+    }
+
+    // Execute the timer again
+    return dbConfigReplica.checkMili;
+}
+
+/*++
+
+PoolLogStats
+
+    Logs the connection pool statistics.
+
+Arguments:
+    name    - Name of the connection pool.
+
+    pool    - Pointer to the POOL structure.
+
+Return Values:
+    None.
+
+--*/
+static VOID PoolLogStats(const CHAR *name, POOL *pool)
+{
+    CHAR       buffer[256];
+    CHAR       *end;
+    DWORD      i;
+    POOL_STATS stats;
+    SIZE_T     remaining;
+
+    PoolGetStats(pool, &stats);
+
+    LOG_INFO("%s: %d acquires (%d affinity), %d waits, %d timeouts, %d opened, %d closed.",
+        name, stats.acquires, stats.affinity, stats.waits, stats.timeouts, stats.creations, stats.destructions);
+
+    // Bucket n counts the waits under 2^n milliseconds
+    end = buffer;
+    remaining = ELEMENT_COUNT(buffer);
+    buffer[0] = '\0';
+    for (i = 0; i < POOL_WAIT_BUCKETS - 1; i++) {
+        StringCchPrintfExA(end, remaining, &end, &remaining, 0, " <%lums:%d", 1UL << i, stats.waitTime[i]);
+    }
+    StringCchPrintfExA(end, remaining, &end, &remaining, 0, " >=%lums:%d", 1UL << i, stats.waitTime[i]);
+
+    LOG_INFO("%s wait times:%s", name, buffer);
+}
+
+/*++
+
+CacheLogStats
+
+    Logs the counters of a record cache.
+
+Arguments:
+    name    - Name of the records cached.
+
+    cache   - Pointer to the CACHE structure.
+
+Return Values:
+    None.
+
+--*/
+static VOID CacheLogStats(const CHAR *name, CACHE *cache)
+{
+    CACHE_COUNTERS counters;
+    LONG           lookups;
+
+    CacheGetCounters(cache, &counters);
+
+    lookups = counters.hits + counters.misses + counters.expired;
+    LOG_INFO("%s cache: %d hits, %d misses, %d expired (%d%% hit rate), %d updates, %d invalidations, %d evictions.",
+        name, counters.hits, counters.misses, counters.expired,
+        (lookups > 0) ? (INT)((counters.hits * (INT64)100) / lookups) : 0,
+        counters.updates, counters.invalidations, counters.evictions);
+}
+
+/*++
+
 DbInit
 
     Initializes the procedure table and database connection pool.
@@ -465,6 +933,7 @@ Return Values:
 --*/
 BOOL FCALL DbInit(Io_GetProc *getProc)
 {
+    DWORD i;
     DWORD result;
 
 #if 0
@@ -515,7 +984,31 @@ BOOL FCALL DbInit(Io_GetProc *getProc)
         return FALSE;
     }
 
-    // Create connection pool
+    // Initialize user statistics buffer
+    result = DbUserStatsInit();
+    if (result != ERROR_SUCCESS) {
+        LOG_ERROR("Unable to initialize statistics buffer (error %lu).", result);
+
+        DbFinalize();
+        return FALSE;
+    }
+
+    // Create user and group caches
+    if (dbConfigCache.size > 0) {
+        result = CacheCreate(&dbGroupCache, offsetof(GROUPFILE, lpInternal), dbConfigCache.size, dbConfigCache.maxAge);
+        if (result == ERROR_SUCCESS) {
+            result = CacheCreate(&dbUserCache, offsetof(USERFILE, lpInternal), dbConfigCache.size, dbConfigCache.maxAge);
+        }
+        if (result != ERROR_SUCCESS) {
+            LOG_ERROR("Unable to initialize user and group caches (error %lu).", result);
+
+            DbFinalize();
+            return FALSE;
+        }
+    }
+
+    // Create connection pool, starting with the first primary server
+    dbIndex = ServerNext(-1);
     result = PoolCreate(&dbPool,
         dbConfigPool.minimum, dbConfigPool.average,
         dbConfigPool.maximum, dbConfigPool.timeoutMili,
@@ -527,6 +1020,35 @@ BOOL FCALL DbInit(Io_GetProc *getProc)
         return FALSE;
     }
 
+    // Create replica connection pool, reads can only be sent to a replica
+    // while the caches remember which records this server changed
+    for (i = 0; i < dbConfigServerCount && !dbConfigServers[i].replica; i++);
+
+    if (i < dbConfigServerCount) {
+        if (dbUserCache.array == NULL) {
+            LOG_WARN("Replica servers are only read from when Sync is enabled and Cache_Size is greater than zero.");
+        } else {
+            replicas = MemAllocate(sizeof(DB_REPLICA) * dbConfigServerCount);
+            if (replicas == NULL) {
+                result = ERROR_NOT_ENOUGH_MEMORY;
+            } else {
+                ZeroMemory(replicas, sizeof(DB_REPLICA) * dbConfigServerCount);
+
+                // Connections are only opened once a replica is chosen
+                result = PoolCreate(&replicaPool,
+                    dbConfigPool.minimum, dbConfigPool.average,
+                    dbConfigPool.maximum, dbConfigPool.timeoutMili,
+                    ConnectionOpen, ConnectionCheck, ConnectionClose, &replicaPool);
+            }
+            if (result != ERROR_SUCCESS) {
+                LOG_ERROR("Unable to initialize replica connection pool (error %lu).", result);
+
+                DbFinalize();
+                return FALSE;
+            }
+        }
+    }
+
     LOG_INFO("nxMyDB v%s loaded, using MySQL Client Library v%s.",
         STRINGIFY(VERSION), mysql_get_client_info());
 
@@ -551,6 +1073,8 @@ Remarks:
 --*/
 VOID FCALL DbFinalize(VOID)
 {
+    DWORD i;
+
     TRACE("refCount=%d", refCount);
 
     //
@@ -563,12 +1087,45 @@ VOID FCALL DbFinalize(VOID)
     if (InterlockedDecrement(&refCount) == 0) {
         TRACE("Finalizing subsystems for shut down.");
 
-        // Stop the sync timer
+        // Stop the sync timer and flush statistics
         DbSyncStop();
 
-        // Destroy connection pool
+        // Destroy connection pools
+        if (dbPool.slots != NULL) {
+            PoolLogStats("Connection pool", &dbPool);
+        }
         PoolDestroy(&dbPool);
 
+        if (replicaPool.slots != NULL) {
+            PoolLogStats("Replica connection pool", &replicaPool);
+        }
+        PoolDestroy(&replicaPool);
+
+        // Close replica health check connections
+        if (replicas != NULL) {
+            for (i = 0; i < dbConfigServerCount; i++) {
+                if (replicas[i].handle != NULL) {
+                    mysql_close(replicas[i].handle);
+                }
+            }
+            MemFree(replicas);
+            replicas = NULL;
+        }
+        replicaIndex = -1;
+
+        // Free user and group caches, after the last statistics were merged
+        if (dbUserCache.array != NULL) {
+            CacheLogStats("User", &dbUserCache);
+        }
+        if (dbGroupCache.array != NULL) {
+            CacheLogStats("Group", &dbGroupCache);
+        }
+        CacheDestroy(&dbUserCache);
+        CacheDestroy(&dbGroupCache);
+
+        // Free user statistics buffer
+        DbUserStatsFinalize();
+
         // Free configuration options
         ConfigFinalize();
 
@@ -595,16 +1152,34 @@ Return Values:
 --*/
 VOID FCALL DbSyncPurge(VOID)
 {
-    DB_CONTEXT *db;
+    DB_CONTEXT  *db;
+    DWORD       elapsed;
+    DWORD       groupResult;
+    DWORD       start;
+    DWORD       userResult;
+    UINT64      groupPurged;
+    UINT64      userPurged;
 
     TRACE("enabled=%d", dbConfigSync.enabled);
 
     if (dbConfigSync.enabled && DbAcquire(&db)) {
-        // Purge changes tables for groups and users
-        DbGroupPurge(db, dbConfigSync.purge);
-        DbUserPurge(db, dbConfigSync.purge);
+        // Purge changes tables for groups and users, in batches
+        start = GetTickCount();
+        groupResult = DbGroupPurge(db, dbConfigSync.purge, &groupPurged);
+        userResult = DbUserPurge(db, dbConfigSync.purge, &userPurged);
+        elapsed = GetTickCount() - start;
 
         DbRelease(db);
+
+        if (groupResult != ERROR_SUCCESS) {
+            LOG_ERROR("Unable to purge the group changes table (error %lu).", groupResult);
+        }
+        if (userResult != ERROR_SUCCESS) {
+            LOG_ERROR("Unable to purge the user changes table (error %lu).", userResult);
+        }
+
+        LOG_INFO("Purged %I64u group and %I64u user changes in %lums (%I64u entries/s).",
+            groupPurged, userPurged, elapsed, ((groupPurged + userPurged) * 1000) / MAX(elapsed, 1));
     }
 }
 
@@ -612,7 +1187,7 @@ VOID FCALL DbSyncPurge(VOID)
 
 DbSyncStart
 
-    Starts the database synchronization timer.
+    Starts the database synchronization, statistics, and replica timers.
 
 Arguments:
     None.
@@ -629,13 +1204,22 @@ VOID FCALL DbSyncStart(VOID)
         ZeroMemory(&dbSync, sizeof(DB_SYNC));
         dbSync.timer = Io_StartIoTimer(NULL, SyncTimer, NULL, dbConfigSync.first);
     }
+
+    if (dbConfigStats.flush > 0) {
+        statsTimer = Io_StartIoTimer(NULL, StatsTimer, NULL, dbConfigStats.flush);
+    }
+
+    if (replicas != NULL) {
+        replicaTimer = Io_StartIoTimer(NULL, ReplicaTimer, NULL, dbConfigReplica.checkMili);
+    }
 }
 
 /*++
 
 DbSyncStop
 
-    Stops the database synchronization timer.
+    Stops the database synchronization, statistics, and replica timers, and
+    flushes buffered statistics.
 
 Arguments:
     None.
@@ -646,19 +1230,37 @@ Return Values:
 --*/
 VOID FCALL DbSyncStop(VOID)
 {
+    DB_CONTEXT *db;
+
     TRACE("enabled=%d", dbConfigSync.enabled);
 
     if (dbSync.timer != NULL) {
         Io_StopIoTimer(dbSync.timer, FALSE);
         dbSync.timer = NULL;
     }
+
+    if (statsTimer != NULL) {
+        Io_StopIoTimer(statsTimer, FALSE);
+        statsTimer = NULL;
+    }
+
+    if (replicaTimer != NULL) {
+        Io_StopIoTimer(replicaTimer, FALSE);
+        replicaTimer = NULL;
+    }
+
+    if (DbUserStatsPending(NULL) && DbAcquire(&db)) {
+        DbUserStatsFlush(db, NULL);
+        DbRelease(db);
+    }
 }
 
 /*++
 
 DbAcquire
 
-    Acquires a database context from the connection pool.
+    Acquires a database context for the primary server, which is used for
+    writes and locks.
 
 Arguments:
     dbPtr   - Pointer to a pointer that receives the DB_CONTEXT structure.
@@ -685,9 +1287,49 @@ BOOL FCALL DbAcquire(DB_CONTEXT **dbPtr)
 
 /*++
 
+DbAcquireRead
+
+    Acquires a database context for reading.
+
+Arguments:
+    dbPtr   - Pointer to a pointer that receives the DB_CONTEXT structure.
+
+    cache   - Pointer to the CACHE structure of the record read, or null if
+              the read is not for one record.
+
+    name    - Name of the record read, or null.
+
+Return Values:
+    If the function succeeds, the return value is nonzero (true).
+
+    If the function fails, the return value is zero (false).
+
+Remarks:
+    The context is for the fastest replica within the lag limit, or the primary
+    if there is none. A record this server changed recently is read from the
+    primary, since the replica may not have the change yet.
+
+--*/
+BOOL FCALL DbAcquireRead(DB_CONTEXT **dbPtr, CACHE *cache, const CHAR *name)
+{
+    ASSERT(dbPtr != NULL);
+    TRACE("dbPtr=%p cache=%p name=%s", dbPtr, cache, name);
+
+    if (replicaIndex >= 0 && (cache == NULL || !CacheChanged(cache, name, dbConfigReplica.window))) {
+        if (PoolAcquire(&replicaPool, dbPtr)) {
+            return TRUE;
+        }
+        LOG_WARN("Unable to acquire a replica context, reading from the primary (error %lu).", GetLastError());
+    }
+
+    return DbAcquire(dbPtr);
+}
+
+/*++
+
 DbRelease
 
-    Releases a database context back into the connection pool.
+    Releases a database context back into its connection pool.
 
 Arguments:
     db  - Pointer to the DB_CONTEXT structure.
@@ -698,19 +1340,23 @@ Return Values:
 --*/
 VOID FCALL DbRelease(DB_CONTEXT *db)
 {
+    POOL *pool;
+
     ASSERT(db != NULL);
     TRACE("db=%p", db);
 
-    if (db->index != dbIndex) {
+    pool = db->replica ? &replicaPool : &dbPool;
+
+    if (db->index != (db->replica ? replicaIndex : dbIndex)) {
         // Server changed, invalidate connection
-        PoolInvalidate(&dbPool, db);
+        PoolInvalidate(pool, db);
 
     } else {
         // Update last-use time stamp
         GetSystemTimeAsFileTime(&db->used.fileTime);
 
         // Release the database context
-        if (!PoolRelease(&dbPool, db)) {
+        if (!PoolRelease(pool, db)) {
             LOG_ERROR("Unable to release a database context to the connection pool (error %lu).", GetLastError());
         }
     }
@@ -16,6 +16,7 @@ Abstract:
 
 #include <base.h>
 #include <backends.h>
+#include <config.h>
 #include <database.h>
 
 static INT   GroupFinalize(VOID);
@@ -215,6 +216,7 @@ static INT GroupDelete(CHAR *groupName, INT32 groupId)
 static INT GroupLock(GROUPFILE *groupFile)
 {
     CHAR       *groupName;
+    DB_BACKOFF  backoff;
     DB_CONTEXT *db;
     DWORD       result;
 
@@ -224,24 +226,33 @@ static INT GroupLock(GROUPFILE *groupFile)
     // Check if ioFTPD wiped out the module context pointer
     ASSERT(groupFile->lpInternal != NULL);
 
-    if (!DbAcquire(&db)) {
-        return GM_ERROR;
-    }
-
     // Resolve group ID to group name
     groupName = Io_Gid2Group(groupFile->Gid);
     if (groupName == NULL) {
-        result = ERROR_ID_NOT_FOUND;
+        SetLastError(ERROR_ID_NOT_FOUND);
+        return GM_ERROR;
+    }
+
+    //
+    // A lock attempt does not wait for the current owner. The connection is
+    // released while backing off, so it is not held for the lock timeout.
+    //
+    DbBackoffInit(&backoff, dbConfigLock.timeoutMili);
+    do {
+        if (!DbAcquire(&db)) {
+            return GM_ERROR;
+        }
 
-    } else {
         // Lock group
         result = DbGroupLock(db, groupName, groupFile);
-        if (result != ERROR_SUCCESS) {
-            LOG_ERROR("Unable to lock group \"%s\" (error %lu).", groupName, result);
-        }
-    }
 
-    DbRelease(db);
+        DbRelease(db);
+    } while (result == ERROR_GROUP_LOCK_FAILED && DbBackoffWait(&backoff));
+
+    if (result != ERROR_SUCCESS) {
+        LOG_ERROR("Unable to lock group \"%s\" after %lu attempts (error %lu).",
+            groupName, backoff.attempts + 1, result);
+    }
 
     SetLastError(result);
     return (result == ERROR_SUCCESS) ? GM_SUCCESS : GM_ERROR;
@@ -292,11 +303,6 @@ static INT GroupOpen(CHAR *groupName, GROUPFILE *groupFile)
     ASSERT(groupFile != NULL);
     TRACE("groupName=%s groupFile=%p", groupName, groupFile);
 
-    if (!DbAcquire(&db)) {
-        // Return GM_DELETED instead of GM_ERROR to work around a bug in ioFTPD.
-        return GM_DELETED;
-    }
-
     // Module context is required for all file operations
     mod = MemAllocate(sizeof(MOD_CONTEXT));
     if (mod == NULL) {
@@ -314,8 +320,16 @@ static INT GroupOpen(CHAR *groupName, GROUPFILE *groupFile)
             LOG_WARN("Unable to open group file for \"%s\" (error %lu).", groupName, result);
         } else {
 
-            // Read database record
-            result = DbGroupOpen(db, groupName, groupFile);
+            // Read the cached record, or the database record from a replica
+            if (DbGroupCacheOpen(groupName, groupFile)) {
+                result = ERROR_SUCCESS;
+            } else if (!DbAcquireRead(&db, &dbGroupCache, groupName)) {
+                result = GetLastError();
+            } else {
+                result = DbGroupOpen(db, groupName, groupFile);
+                DbRelease(db);
+            }
+
             if (result == ERROR_SUCCESS) {
                 // Make sure we haven't wiped out the module context pointer
                 ASSERT(groupFile->lpInternal != NULL);
@@ -334,8 +348,6 @@ static INT GroupOpen(CHAR *groupName, GROUPFILE *groupFile)
         }
     }
 
-    DbRelease(db);
-
     //
     // Return GM_DELETED instead of GM_ERROR to work around a bug in ioFTPD. If
     // GM_ERROR is returned, ioFTPD frees part of the GROUPFILE structure and
@@ -19,14 +19,22 @@ Abstract:
 #include <backends.h>
 #include <database.h>
 
+//
+// Group record cache
+//
+
+CACHE dbGroupCache;
+
 DWORD DbGroupRead(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFilePtr)
 {
     CHAR        *query;
     INT         result;
+    LONG        version;
     SIZE_T      groupNameLength;
+    ULONG       updated;
     GROUPFILE   groupFile;
     MYSQL_BIND  bindInput[1];
-    MYSQL_BIND  bindOutput[4];
+    MYSQL_BIND  bindOutput[5];
     MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
@@ -40,21 +48,21 @@ DWORD DbGroupRead(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFilePtr)
     // is completely finished.
     ZeroMemory(&groupFile, sizeof(GROUPFILE));
 
-    stmt = db->stmt[0];
-
     groupNameLength = strlen(groupName);
 
+    // The record is only cached if it did not change while it was read
+    version = CacheVersion(&dbGroupCache);
+
     //
     // Prepare statement and bind parameters
     //
 
-    query = "SELECT description, slots, users, vfsfile"
+    query = "SELECT description, slots, users, vfsfile, updated"
             "  FROM io_group WHERE name=?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_READ, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInput, stmt);
@@ -113,6 +121,11 @@ DWORD DbGroupRead(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFilePtr)
     bindOutput[3].buffer        = groupFile.szVfsFile;
     bindOutput[3].buffer_length = sizeof(groupFile.szVfsFile);
 
+    // SELECT updated
+    bindOutput[4].buffer_type   = MYSQL_TYPE_LONG;
+    bindOutput[4].buffer        = &updated;
+    bindOutput[4].is_unsigned   = TRUE;
+
     result = mysql_stmt_bind_result(stmt, bindOutput);
     if (result != 0) {
         LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
@@ -147,6 +160,8 @@ DWORD DbGroupRead(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFilePtr)
 
     CopyMemory(groupFilePtr, &groupFile, offsetof(GROUPFILE, lpInternal));
 
+    CachePut(&dbGroupCache, groupName, &groupFile, updated, version, TRUE);
+
     return ERROR_SUCCESS;
 }
 
@@ -167,9 +182,6 @@ DWORD DbGroupCreate(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
     ASSERT(groupFile != NULL);
     TRACE("db=%p groupName=%s groupFile=%p", db, groupName, groupFile);
 
-    stmtGroup   = db->stmt[0];
-    stmtChanges = db->stmt[1];
-
     groupNameLength = strlen(groupName);
 
     //
@@ -180,10 +192,9 @@ DWORD DbGroupCreate(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
             " (name,description,slots,users,vfsfile)"
             " VALUES(?,?,?,?,?)";
 
-    result = mysql_stmt_prepare(stmtGroup, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroup));
-        return DbMapErrorFromStmt(stmtGroup);
+    stmtGroup = DbStmtPrepare(db, DB_STMT_GROUP_CREATE, query);
+    if (stmtGroup == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindGroup, stmtGroup);
@@ -227,10 +238,9 @@ DWORD DbGroupCreate(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
             " (time,type,name)"
             " VALUES(UNIX_TIMESTAMP(),?,?)";
 
-    result = mysql_stmt_prepare(stmtChanges, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtChanges));
-        return DbMapErrorFromStmt(stmtChanges);
+    stmtChanges = DbStmtPrepare(db, DB_STMT_GROUP_CHANGES, query);
+    if (stmtChanges == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindChanges, stmtChanges);
@@ -293,6 +303,8 @@ DWORD DbGroupCreate(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
         return DbMapErrorFromConn(db->handle);
     }
 
+    CacheInvalidate(&dbGroupCache, groupName);
+
     return ERROR_SUCCESS;
 
 rollback:
@@ -331,11 +343,6 @@ DWORD DbGroupRename(DB_CONTEXT *db, CHAR *groupName, CHAR *newName)
     ASSERT(newName != NULL);
     TRACE("db=%p groupName=%s newName=%s", db, groupName, newName);
 
-    stmtMain    = db->stmt[0];
-    stmtAdmins  = db->stmt[1];
-    stmtGroups  = db->stmt[2];
-    stmtChanges = db->stmt[3];
-
     groupNameLength = strlen(groupName);
     newNameLength   = strlen(newName);
 
@@ -345,10 +352,9 @@ DWORD DbGroupRename(DB_CONTEXT *db, CHAR *groupName, CHAR *newName)
 
     query = "UPDATE io_group SET name=? WHERE name=?";
 
-    result = mysql_stmt_prepare(stmtMain, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtMain));
-        return DbMapErrorFromStmt(stmtMain);
+    stmtMain = DbStmtPrepare(db, DB_STMT_GROUP_RENAME, query);
+    if (stmtMain == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindMain, stmtMain);
@@ -376,10 +382,9 @@ DWORD DbGroupRename(DB_CONTEXT *db, CHAR *groupName, CHAR *newName)
 
     query = "UPDATE io_user_admins SET gname=? WHERE gname=?";
 
-    result = mysql_stmt_prepare(stmtAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAdmins));
-        return DbMapErrorFromStmt(stmtAdmins);
+    stmtAdmins = DbStmtPrepare(db, DB_STMT_GROUP_RENAME_ADMINS, query);
+    if (stmtAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAdmins, stmtAdmins);
@@ -407,10 +412,9 @@ DWORD DbGroupRename(DB_CONTEXT *db, CHAR *groupName, CHAR *newName)
 
     query = "UPDATE io_user_groups SET gname=? WHERE gname=?";
 
-    result = mysql_stmt_prepare(stmtGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroups));
-        return DbMapErrorFromStmt(stmtGroups);
+    stmtGroups = DbStmtPrepare(db, DB_STMT_GROUP_RENAME_GROUPS, query);
+    if (stmtGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindGroups, stmtGroups);
@@ -440,10 +444,9 @@ DWORD DbGroupRename(DB_CONTEXT *db, CHAR *groupName, CHAR *newName)
             " (time,type,name,info)"
             " VALUES(UNIX_TIMESTAMP(),?,?,?)";
 
-    result = mysql_stmt_prepare(stmtChanges, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtChanges));
-        return DbMapErrorFromStmt(stmtChanges);
+    stmtChanges = DbStmtPrepare(db, DB_STMT_GROUP_CHANGES_INFO, query);
+    if (stmtChanges == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindChanges, stmtChanges);
@@ -533,6 +536,9 @@ DWORD DbGroupRename(DB_CONTEXT *db, CHAR *groupName, CHAR *newName)
         return DbMapErrorFromConn(db->handle);
     }
 
+    CacheInvalidate(&dbGroupCache, groupName);
+    CacheInvalidate(&dbGroupCache, newName);
+
     //
     // Check for deleted rows
     //
@@ -574,9 +580,6 @@ DWORD DbGroupDelete(DB_CONTEXT *db, CHAR *groupName)
     ASSERT(groupName != NULL);
     TRACE("db=%p groupName=%s", db, groupName);
 
-    stmtGroup   = db->stmt[0];
-    stmtChanges = db->stmt[1];
-
     groupNameLength = strlen(groupName);
 
     //
@@ -585,10 +588,9 @@ DWORD DbGroupDelete(DB_CONTEXT *db, CHAR *groupName)
 
     query = "DELETE FROM io_group WHERE name=?";
 
-    result = mysql_stmt_prepare(stmtGroup, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroup));
-        return DbMapErrorFromStmt(stmtGroup);
+    stmtGroup = DbStmtPrepare(db, DB_STMT_GROUP_DELETE, query);
+    if (stmtGroup == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindGroup, stmtGroup);
@@ -613,10 +615,9 @@ DWORD DbGroupDelete(DB_CONTEXT *db, CHAR *groupName)
             " (time,type,name)"
             " VALUES(UNIX_TIMESTAMP(),?,?)";
 
-    result = mysql_stmt_prepare(stmtChanges, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtChanges));
-        return DbMapErrorFromStmt(stmtChanges);
+    stmtChanges = DbStmtPrepare(db, DB_STMT_GROUP_CHANGES, query);
+    if (stmtChanges == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindChanges, stmtChanges);
@@ -684,6 +685,8 @@ DWORD DbGroupDelete(DB_CONTEXT *db, CHAR *groupName)
         return DbMapErrorFromConn(db->handle);
     }
 
+    CacheInvalidate(&dbGroupCache, groupName);
+
     //
     // Check for deleted rows
     //
@@ -714,7 +717,7 @@ DWORD DbGroupLock(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
     DWORD       error;
     INT         result;
     INT64       affectedRows;
-    MYSQL_BIND  bind[4];
+    MYSQL_BIND  bind[3];
     MYSQL_STMT  *stmt;
 
     ASSERT(db != NULL);
@@ -722,40 +725,37 @@ DWORD DbGroupLock(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
     ASSERT(groupFile != NULL);
     TRACE("db=%p groupName=%s groupFile=%p", db, groupName, groupFile);
 
-    stmt = db->stmt[0];
-
     //
     // Prepare statement and bind parameters
     //
 
-    // Parameters: group, expire, timeout, owner
-    query = "CALL io_group_lock(?,?,?,?)";
+    // Take the lease if it is free or expired, the caller backs off and retries
+    query = "UPDATE io_group SET lockowner=?, locktime=UNIX_TIMESTAMP()"
+            "  WHERE name=? AND (lockowner IS NULL OR (UNIX_TIMESTAMP() - locktime) > ?)";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_LOCK, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bind, stmt);
     ZeroMemory(&bind, sizeof(bind));
 
+    // SET lockowner=?
     bind[0].buffer_type   = MYSQL_TYPE_STRING;
-    bind[0].buffer        = groupName;
-    bind[0].buffer_length = strlen(groupName);
+    bind[0].buffer        = dbConfigLock.owner;
+    bind[0].buffer_length = dbConfigLock.ownerLength;
 
-    bind[1].buffer_type   = MYSQL_TYPE_LONG;
-    bind[1].buffer        = &dbConfigLock.expire;
-    bind[1].is_unsigned   = TRUE;
+    // WHERE name=?
+    bind[1].buffer_type   = MYSQL_TYPE_STRING;
+    bind[1].buffer        = groupName;
+    bind[1].buffer_length = strlen(groupName);
 
+    // (UNIX_TIMESTAMP() - locktime) > ?
     bind[2].buffer_type   = MYSQL_TYPE_LONG;
-    bind[2].buffer        = &dbConfigLock.timeout;
+    bind[2].buffer        = &dbConfigLock.expire;
     bind[2].is_unsigned   = TRUE;
 
-    bind[3].buffer_type   = MYSQL_TYPE_STRING;
-    bind[3].buffer        = dbConfigLock.owner;
-    bind[3].buffer_length = dbConfigLock.ownerLength;
-
     result = mysql_stmt_bind_param(stmt, bind);
     if (result != 0) {
         LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
@@ -778,7 +778,8 @@ DWORD DbGroupLock(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
 
     affectedRows = mysql_stmt_affected_rows(stmt);
     if (affectedRows == 0) {
-        LOG_WARN("Unable to lock group: no affected rows");
+        // Held by another owner, or the group does not exist
+        TRACE("Unable to lock group: no affected rows");
         return ERROR_GROUP_LOCK_FAILED;
     }
 
@@ -808,8 +809,6 @@ DWORD DbGroupUnlock(DB_CONTEXT *db, CHAR *groupName)
     ASSERT(groupName != NULL);
     TRACE("db=%p groupName=%s", db, groupName);
 
-    stmt = db->stmt[0];
-
     //
     // Prepare statement and bind parameters
     //
@@ -817,10 +816,9 @@ DWORD DbGroupUnlock(DB_CONTEXT *db, CHAR *groupName)
     query = "UPDATE io_group SET lockowner=NULL, locktime=0"
             "  WHERE name=? AND lockowner=?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_UNLOCK, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bind, stmt);
@@ -869,6 +867,30 @@ DWORD DbGroupOpen(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
     return DbGroupRead(db, groupName, groupFile);
 }
 
+BOOL DbGroupCacheOpen(CHAR *groupName, GROUPFILE *groupFilePtr)
+{
+    GROUPFILE groupFile;
+
+    ASSERT(groupName != NULL);
+    ASSERT(groupFilePtr != NULL);
+    TRACE("groupName=%s groupFilePtr=%p", groupName, groupFilePtr);
+
+    if (!CacheGet(&dbGroupCache, groupName, &groupFile)) {
+        return FALSE;
+    }
+
+    // Keep the caller's GID, the cached record may not have it
+    groupFile.Gid = groupFilePtr->Gid;
+    CopyMemory(groupFilePtr, &groupFile, offsetof(GROUPFILE, lpInternal));
+
+    return TRUE;
+}
+
+static VOID FCALL CacheWrite(VOID *context, VOID *data)
+{
+    CopyMemory(data, context, offsetof(GROUPFILE, lpInternal));
+}
+
 DWORD DbGroupWrite(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
 {
     CHAR        *query;
@@ -882,8 +904,6 @@ DWORD DbGroupWrite(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
     ASSERT(groupFile != NULL);
     TRACE("db=%p groupName=%s groupFile=%p", db, groupName, groupFile);
 
-    stmt = db->stmt[0];
-
     groupNameLength = strlen(groupName);
 
     //
@@ -894,10 +914,9 @@ DWORD DbGroupWrite(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
             " users=?, vfsfile=?, updated=UNIX_TIMESTAMP()"
             "   WHERE name=?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_WRITE, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bind, stmt);
@@ -940,9 +959,12 @@ DWORD DbGroupWrite(DB_CONTEXT *db, CHAR *groupName, GROUPFILE *groupFile)
     result = mysql_stmt_execute(stmt);
     if (result != 0) {
         LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        CacheInvalidate(&dbGroupCache, groupName);
         return DbMapErrorFromStmt(stmt);
     }
 
+    CacheApply(&dbGroupCache, groupName, CacheWrite, groupFile);
+
     return ERROR_SUCCESS;
 }
 
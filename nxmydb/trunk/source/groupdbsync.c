@@ -148,8 +148,28 @@ static DWORD GroupEventUpdate(CHAR *groupName, GROUPFILE *groupFile)
     return result;
 }
 
+static VOID FCALL GroupApplyCreate(CHAR *groupName, VOID *groupFile)
+{
+    DWORD error;
+
+    error = GroupEventCreate(groupName, groupFile);
+    if (error != ERROR_SUCCESS) {
+        LOG_WARN("Unable to create group \"%s\" (error %lu).", groupName, error);
+    }
+}
+
+static VOID FCALL GroupApplyUpdate(CHAR *groupName, VOID *groupFile)
+{
+    DWORD error;
+
+    error = GroupEventUpdate(groupName, groupFile);
+    if (error != ERROR_SUCCESS) {
+        LOG_WARN("Unable to update group \"%s\" (error %lu).", groupName, error);
+    }
+}
+
 
-static DWORD GroupSyncFull(DB_CONTEXT *db)
+static DWORD GroupSyncFull(DB_CONTEXT *db, DB_SYNC *sync)
 {
     CHAR        *query;
     CHAR        groupName[_MAX_NAME + 1];
@@ -164,7 +184,8 @@ static DWORD GroupSyncFull(DB_CONTEXT *db)
     MYSQL_STMT  *stmt;
 
     ASSERT(db != NULL);
-    TRACE("db=%p", db);
+    ASSERT(sync != NULL);
+    TRACE("db=%p sync=%p", db, sync);
 
     //
     // Build list of group IDs
@@ -180,15 +201,12 @@ static DWORD GroupSyncFull(DB_CONTEXT *db)
     // Prepare and execute statement
     //
 
-    stmt = db->stmt[7];
-
     query = "SELECT name, description, slots, users, vfsfile"
             "  FROM io_group";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_SYNC_FULL, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     metadata = mysql_stmt_result_metadata(stmt);
@@ -265,22 +283,17 @@ static DWORD GroupSyncFull(DB_CONTEXT *db)
             TRACE("GroupSyncFull: Create(%s)", groupName);
 
             // Group does not exist locally, create it.
-            error = GroupEventCreate(groupName, &groupFile);
-            if (error != ERROR_SUCCESS) {
-                LOG_WARN("Unable to create group \"%s\" (error %lu).", groupName, error);
-            }
+            SyncQueuePush(sync->queue, GroupApplyCreate, groupName, &groupFile, sizeof(GROUPFILE));
         } else {
             TRACE("GroupSyncFull: Update(%s)", groupName);
 
             // Group already exists locally, update it.
-            error = GroupEventUpdate(groupName, &groupFile);
-            if (error != ERROR_SUCCESS) {
-                LOG_WARN("Unable to update group \"%s\" (error %lu).", groupName, error);
-            }
+            SyncQueuePush(sync->queue, GroupApplyUpdate, groupName, &groupFile, sizeof(GROUPFILE));
         }
     }
 
     mysql_free_result(metadata);
+    mysql_stmt_free_result(stmt);
 
     //
     // Delete remaining groups
@@ -302,6 +315,77 @@ static DWORD GroupSyncFull(DB_CONTEXT *db)
     return ERROR_SUCCESS;
 }
 
+static DWORD GroupSyncCursor(DB_CONTEXT *db, DB_SYNC *sync)
+{
+    CHAR        *query;
+    INT         result;
+    MYSQL_BIND  bind[1];
+    MYSQL_RES   *metadata;
+    MYSQL_STMT  *stmt;
+
+    ASSERT(db != NULL);
+    ASSERT(sync != NULL);
+
+    //
+    // Prepare and execute statement
+    //
+
+    query = "SELECT COALESCE(MAX(id),0) FROM io_group_changes";
+
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_SYNC_CURSOR, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
+    metadata = mysql_stmt_result_metadata(stmt);
+    if (metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    //
+    // Bind and fetch results
+    //
+
+    DB_CHECK_RESULTS(bind, metadata);
+    ZeroMemory(&bind, sizeof(bind));
+
+    // SELECT MAX(id)
+    bind[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bind[0].buffer      = &sync->groupChange;
+    bind[0].is_unsigned = TRUE;
+
+    result = mysql_stmt_bind_result(stmt, bind);
+    if (result != 0) {
+        LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_store_result(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_fetch(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to fetch results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    mysql_free_result(metadata);
+    mysql_stmt_free_result(stmt);
+
+    TRACE("GroupSyncCursor: Last change %I64u.", sync->groupChange);
+    return ERROR_SUCCESS;
+}
+
 static DWORD GroupSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
 {
     CHAR        *query;
@@ -311,8 +395,12 @@ static DWORD GroupSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
     DWORD       error;
     GROUPFILE   groupFile;
     INT         result;
+    UINT        batch;
+    UINT        rows;
+    UINT64      changeId;
+    ULONG       changeTime;
     MYSQL_BIND  bindInput[2];
-    MYSQL_BIND  bindOutput[3];
+    MYSQL_BIND  bindOutput[5];
     MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
@@ -323,29 +411,27 @@ static DWORD GroupSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
     // Prepare statement and bind parameters
     //
 
-    stmt = db->stmt[7];
+    query = "SELECT id, name, type, info, time FROM io_group_changes"
+            "  WHERE id > ?"
+            "  ORDER BY id ASC LIMIT ?";
 
-    query = "SELECT name, type, info FROM io_group_changes"
-            "  WHERE time BETWEEN ? AND ?"
-            "  ORDER BY id ASC";
-
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_SYNC_CHANGES, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInput, stmt);
     ZeroMemory(&bindInput, sizeof(bindInput));
 
-    // BETWEEN ?
-    bindInput[0].buffer_type = MYSQL_TYPE_LONG;
-    bindInput[0].buffer      = &sync->prevUpdate;
+    // WHERE id > ?
+    bindInput[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bindInput[0].buffer      = &sync->groupChange;
     bindInput[0].is_unsigned = TRUE;
 
-    // AND ?
+    // LIMIT ?
+    batch = DB_SYNC_BATCH;
     bindInput[1].buffer_type = MYSQL_TYPE_LONG;
-    bindInput[1].buffer      = &sync->currUpdate;
+    bindInput[1].buffer      = &batch;
     bindInput[1].is_unsigned = TRUE;
 
     result = mysql_stmt_bind_param(stmt, bindInput);
@@ -360,16 +446,6 @@ static DWORD GroupSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
         return DbMapErrorFromStmt(stmt);
     }
 
-    //
-    // Execute prepared statement
-    //
-
-    result = mysql_stmt_execute(stmt);
-    if (result != 0) {
-        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
-    }
-
     //
     // Bind and fetch results
     //
@@ -377,20 +453,30 @@ static DWORD GroupSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
     DB_CHECK_RESULTS(bindOutput, metadata);
     ZeroMemory(&bindOutput, sizeof(bindOutput));
 
+    // SELECT id
+    bindOutput[0].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindOutput[0].buffer        = &changeId;
+    bindOutput[0].is_unsigned   = TRUE;
+
     // SELECT name
-    bindOutput[0].buffer_type   = MYSQL_TYPE_STRING;
-    bindOutput[0].buffer        = groupName;
-    bindOutput[0].buffer_length = sizeof(groupName);
+    bindOutput[1].buffer_type   = MYSQL_TYPE_STRING;
+    bindOutput[1].buffer        = groupName;
+    bindOutput[1].buffer_length = sizeof(groupName);
 
     // SELECT type
-    bindOutput[1].buffer_type   = MYSQL_TYPE_TINY;
-    bindOutput[1].buffer        = &syncEvent;
-    bindOutput[1].is_unsigned   = TRUE;
+    bindOutput[2].buffer_type   = MYSQL_TYPE_TINY;
+    bindOutput[2].buffer        = &syncEvent;
+    bindOutput[2].is_unsigned   = TRUE;
 
     // SELECT info
-    bindOutput[2].buffer_type   = MYSQL_TYPE_STRING;
-    bindOutput[2].buffer        = syncInfo;
-    bindOutput[2].buffer_length = sizeof(syncInfo);
+    bindOutput[3].buffer_type   = MYSQL_TYPE_STRING;
+    bindOutput[3].buffer        = syncInfo;
+    bindOutput[3].buffer_length = sizeof(syncInfo);
+
+    // SELECT time
+    bindOutput[4].buffer_type   = MYSQL_TYPE_LONG;
+    bindOutput[4].buffer        = &changeTime;
+    bindOutput[4].is_unsigned   = TRUE;
 
     result = mysql_stmt_bind_result(stmt, bindOutput);
     if (result != 0) {
@@ -398,69 +484,116 @@ static DWORD GroupSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
         return DbMapErrorFromStmt(stmt);
     }
 
-    result = mysql_stmt_store_result(stmt);
-    if (result != 0) {
-        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
-    }
-
     //
-    // Process result set
+    // Apply changes in order, a batch at a time
     //
 
-    for (;;) {
-        if (mysql_stmt_fetch(stmt) != 0) {
-            break;
+    do {
+        result = mysql_stmt_execute(stmt);
+        if (result != 0) {
+            LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+            return DbMapErrorFromStmt(stmt);
+        }
+
+        result = mysql_stmt_store_result(stmt);
+        if (result != 0) {
+            LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+            return DbMapErrorFromStmt(stmt);
         }
 
-        switch ((SYNC_EVENT)syncEvent) {
-            case SYNC_EVENT_CREATE:
-                TRACE("GroupSyncIncr: Create(%s)", groupName);
+        for (rows = 0; ; rows++) {
+            if (mysql_stmt_fetch(stmt) != 0) {
+                break;
+            }
 
-                // Read group file from database
-                ZeroMemory(&groupFile, sizeof(GROUPFILE));
-                error = DbGroupRead(db, groupName, &groupFile);
-                if (error != ERROR_SUCCESS) {
-                    LOG_WARN("Unable to read group \"%s\" (error %lu).", groupName, error);
-                } else {
+            // IDs are assigned when a change is logged but become visible when
+            // its transaction commits, so a missing ID may still be committed.
+            // Later changes wait until it is older than DB_SYNC_GAP seconds,
+            // after which it is taken to be a rolled back transaction.
+            if (changeId != sync->groupChange + 1 && changeTime + DB_SYNC_GAP > sync->currUpdate) {
+                TRACE("GroupSyncIncr: Waiting for changes %I64u to %I64u.", sync->groupChange + 1, changeId - 1);
+                break;
+            }
 
-                    // Create local user
-                    error = GroupEventCreate(groupName, &groupFile);
+            switch ((SYNC_EVENT)syncEvent) {
+                case SYNC_EVENT_CREATE:
+                    TRACE("GroupSyncIncr: Create(%s)", groupName);
+
+                    // Read group file from database
+                    ZeroMemory(&groupFile, sizeof(GROUPFILE));
+                    error = DbGroupRead(db, groupName, &groupFile);
                     if (error != ERROR_SUCCESS) {
-                        LOG_WARN("Unable to create group \"%s\" (error %lu).", groupName, error);
+                        LOG_WARN("Unable to read group \"%s\" (error %lu).", groupName, error);
+                    } else {
+
+                        // Create local user
+                        error = GroupEventCreate(groupName, &groupFile);
+                        if (error != ERROR_SUCCESS) {
+                            LOG_WARN("Unable to create group \"%s\" (error %lu).", groupName, error);
+                        }
                     }
-                }
-                break;
+                    break;
 
-            case SYNC_EVENT_RENAME:
-                TRACE("GroupSyncIncr: Rename(%s,%s)", groupName, syncInfo);
+                case SYNC_EVENT_RENAME:
+                    TRACE("GroupSyncIncr: Rename(%s,%s)", groupName, syncInfo);
 
-                error = GroupEventRename(groupName, syncInfo);
-                if (error != ERROR_SUCCESS) {
-                    LOG_WARN("Unable to rename group \"%s\" to \"%s\" (error %lu).", groupName, syncInfo, error);
-                }
-                break;
+                    CacheInvalidate(&dbGroupCache, groupName);
+                    CacheInvalidate(&dbGroupCache, syncInfo);
 
-            case SYNC_EVENT_DELETE:
-                TRACE("GroupSyncIncr: Delete(%s)", groupName);
+                    error = GroupEventRename(groupName, syncInfo);
+                    if (error != ERROR_SUCCESS) {
+                        LOG_WARN("Unable to rename group \"%s\" to \"%s\" (error %lu).", groupName, syncInfo, error);
+                    }
+                    break;
 
-                error = GroupEventDelete(groupName);
-                if (error != ERROR_SUCCESS) {
-                    LOG_WARN("Unable to delete group \"%s\" (error %lu).", groupName, error);
-                }
-                break;
+                case SYNC_EVENT_DELETE:
+                    TRACE("GroupSyncIncr: Delete(%s)", groupName);
 
-            default:
-                LOG_ERROR("Unknown sync event %d.", syncEvent);
-                break;
+                    CacheInvalidate(&dbGroupCache, groupName);
+
+                    error = GroupEventDelete(groupName);
+                    if (error != ERROR_SUCCESS) {
+                        LOG_WARN("Unable to delete group \"%s\" (error %lu).", groupName, error);
+                    }
+                    break;
+
+                default:
+                    LOG_ERROR("Unknown sync event %d.", syncEvent);
+                    break;
+            }
+
+            // The next batch starts after the last change applied
+            sync->groupChange = changeId;
         }
-    }
+
+        mysql_stmt_free_result(stmt);
+        TRACE("GroupSyncIncr: Applied %u changes, last change %I64u.", rows, sync->groupChange);
+    } while (rows == batch);
 
     mysql_free_result(metadata);
 
     return ERROR_SUCCESS;
 }
 
+static DWORD GroupSyncReadPrimary(CHAR *groupName, GROUPFILE *groupFile)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+
+    ASSERT(groupName != NULL);
+    ASSERT(groupFile != NULL);
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+
+    // Also refreshes the cached record
+    result = DbGroupRead(db, groupName, groupFile);
+    DbRelease(db);
+
+    return result;
+}
+
 static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
 {
     CHAR        *query;
@@ -468,8 +601,10 @@ static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     DWORD       error;
     GROUPFILE   groupFile;
     INT         result;
+    LONG        version;
+    ULONG       updated;
     MYSQL_BIND  bindInput[2];
-    MYSQL_BIND  bindOutput[5];
+    MYSQL_BIND  bindOutput[6];
     MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
@@ -480,16 +615,13 @@ static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     // Prepare statement and bind parameters
     //
 
-    stmt = db->stmt[7];
-
-    query = "SELECT name, description, slots, users, vfsfile"
+    query = "SELECT name, description, slots, users, vfsfile, updated"
             "  FROM io_group"
             "  WHERE updated BETWEEN ? AND ?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_SYNC_UPDATES, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInput, stmt);
@@ -521,6 +653,9 @@ static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     // Execute prepared statement
     //
 
+    // Cached groups are refreshed if they did not change while this is read
+    version = CacheVersion(&dbGroupCache);
+
     result = mysql_stmt_execute(stmt);
     if (result != 0) {
         LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
@@ -558,6 +693,11 @@ static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     bindOutput[4].buffer        = groupFile.szVfsFile;
     bindOutput[4].buffer_length = sizeof(groupFile.szVfsFile);
 
+    // SELECT updated
+    bindOutput[5].buffer_type   = MYSQL_TYPE_LONG;
+    bindOutput[5].buffer        = &updated;
+    bindOutput[5].is_unsigned   = TRUE;
+
     result = mysql_stmt_bind_result(stmt, bindOutput);
     if (result != 0) {
         LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
@@ -581,10 +721,18 @@ static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
         }
         TRACE("GroupSyncIncr: Update(%s)", groupName);
 
-        error = GroupEventUpdate(groupName, &groupFile);
-        if (error != ERROR_SUCCESS) {
-            LOG_WARN("Unable to update group \"%s\" (error %lu).", groupName, error);
+        if (sync->window > 0 && CacheChanged(&dbGroupCache, groupName, sync->window)) {
+            // The replica may not have this server's latest change yet
+            error = GroupSyncReadPrimary(groupName, &groupFile);
+            if (error != ERROR_SUCCESS) {
+                LOG_WARN("Unable to read group \"%s\" from the primary (error %lu).", groupName, error);
+                continue;
+            }
+        } else {
+            CachePut(&dbGroupCache, groupName, &groupFile, updated, version, FALSE);
         }
+
+        SyncQueuePush(sync->queue, GroupApplyUpdate, groupName, &groupFile, sizeof(GROUPFILE));
     }
 
     mysql_free_result(metadata);
@@ -594,6 +742,7 @@ static DWORD GroupSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
 
 static DWORD GroupSyncIncr(DB_CONTEXT *db, DB_SYNC *sync)
 {
+    DWORD error;
     DWORD result;
 
     ASSERT(db != NULL);
@@ -601,9 +750,9 @@ static DWORD GroupSyncIncr(DB_CONTEXT *db, DB_SYNC *sync)
     TRACE("db=%p sync=%p", db, sync);
 
     // Process events from the "io_group_changes" table
-    result = GroupSyncIncrChanges(db, sync);
-    if (result != ERROR_SUCCESS) {
-        LOG_ERROR("Unable to sync incremental changes (error %lu).", result);
+    error = GroupSyncIncrChanges(db, sync);
+    if (error != ERROR_SUCCESS) {
+        LOG_ERROR("Unable to sync incremental changes (error %lu).", error);
     }
 
     // Process updates from the "io_group" table
@@ -612,40 +761,160 @@ static DWORD GroupSyncIncr(DB_CONTEXT *db, DB_SYNC *sync)
         LOG_ERROR("Unable to sync incremental updates (error %lu).", result);
     }
 
-    return result;
+    return (error != ERROR_SUCCESS) ? error : result;
 }
 
 
-DWORD DbGroupPurge(DB_CONTEXT *db, INT age)
+static DWORD GroupPurgeRange(DB_CONTEXT *db, INT age, UINT64 *first, UINT64 *last)
 {
     CHAR        *query;
     INT         result;
-    MYSQL_BIND  bind[1];
+    MYSQL_BIND  bindInput[1];
+    MYSQL_BIND  bindOutput[2];
+    MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
     ASSERT(db != NULL);
-    TRACE("db=%p age=%d", db, age);
-
-    stmt = db->stmt[0];
+    ASSERT(first != NULL);
+    ASSERT(last != NULL);
 
     //
     // Prepare statement and bind parameters
     //
 
-    query = "DELETE FROM io_group_changes WHERE time < (UNIX_TIMESTAMP() - ?)";
+    // The oldest change, and the newest change older than the purge age (read from the time index)
+    query = "SELECT COALESCE(MIN(id),0),"
+            "  COALESCE((SELECT MAX(id) FROM io_group_changes WHERE time < (UNIX_TIMESTAMP() - ?)),0)"
+            "  FROM io_group_changes";
+
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_PURGE_RANGE, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
+    DB_CHECK_PARAMS(bindInput, stmt);
+    ZeroMemory(&bindInput, sizeof(bindInput));
+
+    // UNIX_TIMESTAMP() - ?
+    bindInput[0].buffer_type = MYSQL_TYPE_LONG;
+    bindInput[0].buffer      = &age;
+
+    result = mysql_stmt_bind_param(stmt, bindInput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    metadata = mysql_stmt_result_metadata(stmt);
+    if (metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        mysql_free_result(metadata);
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    //
+    // Bind and fetch results
+    //
+
+    DB_CHECK_RESULTS(bindOutput, metadata);
+    ZeroMemory(&bindOutput, sizeof(bindOutput));
+
+    // SELECT MIN(id)
+    bindOutput[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bindOutput[0].buffer      = first;
+    bindOutput[0].is_unsigned = TRUE;
+
+    // SELECT MAX(id)
+    bindOutput[1].buffer_type = MYSQL_TYPE_LONGLONG;
+    bindOutput[1].buffer      = last;
+    bindOutput[1].is_unsigned = TRUE;
+
+    mysql_free_result(metadata);
+
+    result = mysql_stmt_bind_result(stmt, bindOutput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_store_result(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
+    result = mysql_stmt_fetch(stmt);
+    mysql_stmt_free_result(stmt);
     if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
+        LOG_WARN("Unable to fetch results: %s", mysql_stmt_error(stmt));
         return DbMapErrorFromStmt(stmt);
     }
 
+    return ERROR_SUCCESS;
+}
+
+DWORD DbGroupPurge(DB_CONTEXT *db, INT age, UINT64 *purged)
+{
+    CHAR        *query;
+    DWORD       error;
+    INT         result;
+    MYSQL_BIND  bind[3];
+    MYSQL_STMT  *stmt;
+    UINT64      first;
+    UINT64      last;
+    UINT64      lower;
+    UINT64      upper;
+
+    ASSERT(db != NULL);
+    ASSERT(purged != NULL);
+    TRACE("db=%p age=%d purged=%p", db, age, purged);
+
+    *purged = 0;
+
+    // Find the range of IDs to purge, deleting everything older than the
+    // purge age with one statement locks the table for every other server
+    error = GroupPurgeRange(db, age, &first, &last);
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+    if (last == 0) {
+        TRACE("No entries to purge from the group changes table.");
+        return ERROR_SUCCESS;
+    }
+
+    //
+    // Prepare statement and bind parameters
+    //
+
+    query = "DELETE FROM io_group_changes"
+            "  WHERE id BETWEEN ? AND ? AND time < (UNIX_TIMESTAMP() - ?)";
+
+    stmt = DbStmtPrepare(db, DB_STMT_GROUP_PURGE, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
     DB_CHECK_PARAMS(bind, stmt);
     ZeroMemory(&bind, sizeof(bind));
 
+    // WHERE id BETWEEN ? AND ?
+    bind[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bind[0].buffer      = &lower;
+    bind[0].is_unsigned = TRUE;
+
+    bind[1].buffer_type = MYSQL_TYPE_LONGLONG;
+    bind[1].buffer      = &upper;
+    bind[1].is_unsigned = TRUE;
+
     // UNIX_TIMESTAMP() - ?
-    bind[0].buffer_type = MYSQL_TYPE_LONG;
-    bind[0].buffer      = &age;
+    bind[2].buffer_type = MYSQL_TYPE_LONG;
+    bind[2].buffer      = &age;
 
     result = mysql_stmt_bind_param(stmt, bind);
     if (result != 0) {
@@ -654,16 +923,26 @@ DWORD DbGroupPurge(DB_CONTEXT *db, INT age)
     }
 
     //
-    // Execute prepared statement
+    // Delete a batch of IDs at a time, pausing in between so the sync and
+    // lock queries of other servers are not held up
     //
 
-    result = mysql_stmt_execute(stmt);
-    if (result != 0) {
-        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    for (lower = first; lower <= last; lower = upper + 1) {
+        upper = MIN(lower + DB_PURGE_BATCH - 1, last);
+
+        result = mysql_stmt_execute(stmt);
+        if (result != 0) {
+            LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+            return DbMapErrorFromStmt(stmt);
+        }
+        *purged += mysql_stmt_affected_rows(stmt);
+
+        if (upper < last) {
+            Sleep(DB_PURGE_YIELD);
+        }
     }
 
-    TRACE("Purged %I64u entries from the group changes table.", mysql_stmt_affected_rows(stmt));
+    TRACE("Purged %I64u entries from the group changes table (IDs %I64u to %I64u).", *purged, first, last);
 
     return ERROR_SUCCESS;
 }
@@ -678,11 +957,21 @@ DWORD DbGroupSync(DB_CONTEXT *db, DB_SYNC *sync)
 
     if (sync->prevUpdate == 0) {
         // If there was no previous update time, we perform a full group synchronization.
-        result = GroupSyncFull(db);
+        // Changes logged while it runs are applied by the next incremental one.
+        result = GroupSyncCursor(db, sync);
+        if (result != ERROR_SUCCESS) {
+            LOG_ERROR("Unable to retrieve the last group change (error %lu).", result);
+        } else {
+            CacheFlush(&dbGroupCache);
+            result = GroupSyncFull(db, sync);
+        }
     } else {
         ASSERT(sync->currUpdate != 0);
         result = GroupSyncIncr(db, sync);
     }
 
+    // Groups read so far must be applied before returning, users refer to them
+    SyncQueueDrain(sync->queue);
+
     return result;
 }
@@ -15,6 +15,7 @@ Abstract:
 */
 
 #include <base.h>
+#include <config.h>
 #include <logging.h>
 #include <queue.h>
 
@@ -36,41 +37,75 @@ typedef struct LOG_QUEUE LOG_QUEUE;
 #define LOG_STATUS_SHUTDOWN 1       // Log system is shutting down
 #define LOG_STATUS_INACTIVE 2       // Log system is inactive
 
+#define LOG_BUFFER_SIZE     65536   // Bytes of formatted entries written at once
+#define LOG_SPARE_MAX       256     // Maximum number of entries kept for reuse
+#define LOG_STAMP_LENGTH    20      // Length of the time stamp, "MM-DD-YYYY HH:MM:SS "
+
 //
 // Log variables
 //
 
-static CRITICAL_SECTION logLock;    // Lock to protect access to the handle and queue
-static CHAR             *logPath;   // File name of the log file
-static LOG_QUEUE        logQueue;   // Queue of log entries to write
+static CRITICAL_SECTION logLock;        // Lock to protect access to the queues
+static CRITICAL_SECTION logWriteLock;   // Lock to protect access to the file and buffer, taken before logLock
+static CHAR             *logPath;       // File name of the log file
+static CHAR             *logOldPath;    // File name the log file is rotated to
+static HANDLE           logFile;        // Handle to the log file, kept open between writes
+static DWORD            logSize;        // Size of the log file, in bytes
+static CHAR             logBuffer[LOG_BUFFER_SIZE]; // Formatted entries waiting to be written
+static LOG_QUEUE        logQueue;       // Queue of log entries to write
+static LOG_QUEUE        logSpare;       // Written log entries, kept for reuse
+static LONG             logSpareCount;  // Number of entries in the spare list
 static volatile LONG    logStatus = LOG_STATUS_INACTIVE;
 
-
+
 static INLINE LOG_ENTRY *GetSpareEntry(VOID)
 {
+    LOG_ENTRY *entry;
+
     if (logStatus != LOG_STATUS_ACTIVE) {
         // Logging system must be active
         return NULL;
     }
-    return MemAllocate(sizeof(LOG_ENTRY));
+
+    EnterCriticalSection(&logLock);
+
+    // Reuse an entry that was already written
+    entry = STAILQ_FIRST(&logSpare);
+    if (entry != NULL) {
+        STAILQ_REMOVE_HEAD(&logSpare, link);
+        logSpareCount--;
+    }
+
+    LeaveCriticalSection(&logLock);
+
+    if (entry == NULL) {
+        entry = MemAllocate(sizeof(LOG_ENTRY));
+    }
+    return entry;
 }
 
-static INLINE LOG_ENTRY *GetQueueEntry(VOID)
+static INLINE VOID PutSpareEntries(LOG_QUEUE *queue)
 {
     LOG_ENTRY *entry;
 
     EnterCriticalSection(&logLock);
 
-    // Pop the first entry off the queue
-    if (STAILQ_EMPTY(&logQueue)) {
-        entry = NULL;
-    } else {
-        entry = STAILQ_FIRST(&logQueue);
-        STAILQ_REMOVE_HEAD(&logQueue, link);
+    while (logSpareCount < LOG_SPARE_MAX && !STAILQ_EMPTY(queue)) {
+        entry = STAILQ_FIRST(queue);
+        STAILQ_REMOVE_HEAD(queue, link);
+
+        STAILQ_INSERT_HEAD(&logSpare, entry, link);
+        logSpareCount++;
     }
 
     LeaveCriticalSection(&logLock);
-    return entry;
+
+    // Free entries beyond the spare limit, after a burst
+    while (!STAILQ_EMPTY(queue)) {
+        entry = STAILQ_FIRST(queue);
+        STAILQ_REMOVE_HEAD(queue, link);
+        MemFree(entry);
+    }
 }
 
 static INLINE HANDLE FileOpen(const CHAR *filePath, DWORD access, DWORD share, DWORD retryMax)
@@ -108,13 +143,73 @@ static INLINE HANDLE FileOpen(const CHAR *filePath, DWORD access, DWORD share, D
     return fileHandle;
 }
 
+static BOOL FileReady(VOID)
+{
+    DWORD position;
+
+    ASSERT_CS_IS_CURRENT_OWNER(&logWriteLock);
+
+    if (logFile != INVALID_HANDLE_VALUE) {
+        return TRUE;
+    }
+
+    logFile = FileOpen(logPath, GENERIC_WRITE, FILE_SHARE_READ, 10);
+    if (logFile == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+
+    // Entries are appended, nothing else writes to the file
+    position = SetFilePointer(logFile, 0, NULL, FILE_END);
+    logSize = (position != INVALID_SET_FILE_POINTER) ? position : 0;
+
+    return TRUE;
+}
+
+static VOID FileRotate(VOID)
+{
+    ASSERT_CS_IS_CURRENT_OWNER(&logWriteLock);
+
+    CloseHandle(logFile);
+    logFile = INVALID_HANDLE_VALUE;
+
+    // If the file is being read (e.g. downloaded), it is rotated after the next write
+    if (!MoveFileExA(logPath, logOldPath, MOVEFILE_REPLACE_EXISTING)) {
+        TRACE("Unable to rotate log file \"%s\" (error %lu).", logPath, GetLastError());
+    }
+}
+
+static VOID FileWrite(SIZE_T length)
+{
+    DWORD written;
+
+    ASSERT_CS_IS_CURRENT_OWNER(&logWriteLock);
+    ASSERT(logFile != INVALID_HANDLE_VALUE);
+
+    if (length == 0) {
+        return;
+    }
+
+    if (!WriteFile(logFile, logBuffer, (DWORD)length, &written, NULL)) {
+        TRACE("Unable to write log file (error %lu).", GetLastError());
+    }
+    logSize += written;
+
+    if (dbConfigGlobal.logSizeBytes > 0 && logSize >= dbConfigGlobal.logSizeBytes) {
+        FileRotate();
+
+        // Reopen the file for the rest of the batch
+        FileReady();
+    }
+}
+
 static VOID CCALL QueueWrite(VOID *context)
 {
-    CHAR        buffer[128];
-    DWORD       written;
-    HANDLE      file;
+    CHAR        *end;
+    CHAR        stamp[LOG_STAMP_LENGTH + 1];
     LOG_ENTRY   *entry;
-    size_t      remaining;
+    LOG_QUEUE   batch;
+    SIZE_T      length;
+    SYSTEMTIME  stampTime;
 
     UNREFERENCED_PARAMETER(context);
 
@@ -123,38 +218,74 @@ static VOID CCALL QueueWrite(VOID *context)
         return;
     }
 
-    file = FileOpen(logPath, GENERIC_WRITE, FILE_SHARE_READ, 10);
-    if (file == INVALID_HANDLE_VALUE) {
+    //
+    // Only one thread writes at a time, and it takes the queue while holding
+    // the write lock so batches are written in the order they were queued.
+    //
+    EnterCriticalSection(&logWriteLock);
+
+    EnterCriticalSection(&logLock);
+    STAILQ_INIT(&batch);
+    STAILQ_CONCAT(&batch, &logQueue);
+    LeaveCriticalSection(&logLock);
+
+    if (STAILQ_EMPTY(&batch)) {
+        LeaveCriticalSection(&logWriteLock);
+        return;
+    }
+
+    if (!FileReady() && logStatus == LOG_STATUS_ACTIVE) {
+        // Put the entries back, they are written with the next batch
+        EnterCriticalSection(&logLock);
+        STAILQ_CONCAT(&batch, &logQueue);
+        STAILQ_CONCAT(&logQueue, &batch);
+        LeaveCriticalSection(&logLock);
+
+        LeaveCriticalSection(&logWriteLock);
         return;
     }
 
-    // Process all queued log entries
-    for (;;) {
-        entry = GetQueueEntry();
-        if (entry == NULL) {
-            break;
+    //
+    // Format the batch into the buffer, writing it whenever it is full
+    //
+    ZeroMemory(&stampTime, sizeof(SYSTEMTIME));
+    stamp[0] = '\0';
+    length   = 0;
+
+    STAILQ_FOREACH(entry, &batch, link) {
+        if (length + LOG_STAMP_LENGTH + entry->length > LOG_BUFFER_SIZE) {
+            if (logFile != INVALID_HANDLE_VALUE) {
+                FileWrite(length);
+            }
+            length = 0;
         }
 
-        // Format the time stamp
-        StringCchPrintfExA(buffer, ELEMENT_COUNT(buffer), NULL, &remaining, 0,
-            "%02d-%02d-%04d %02d:%02d:%02d ",
-            entry->time.wMonth, entry->time.wDay, entry->time.wYear,
-            entry->time.wHour, entry->time.wMinute, entry->time.wSecond);
+        // Entries logged within the same second share the time stamp
+        if (entry->time.wSecond != stampTime.wSecond || entry->time.wMinute != stampTime.wMinute ||
+                entry->time.wHour != stampTime.wHour || entry->time.wDay != stampTime.wDay ||
+                entry->time.wMonth != stampTime.wMonth || entry->time.wYear != stampTime.wYear) {
+            stampTime = entry->time;
 
-        // Seek to the end of the log file
-        SetFilePointer(file, 0, 0, FILE_END);
-
-        if (!WriteFile(file, buffer, ELEMENT_COUNT(buffer) - remaining, &written, NULL)) {
-            TRACE("Unable to write log file (error %lu).", GetLastError());
-        }
-        if (!WriteFile(file, entry->message, entry->length, &written, NULL)) {
-            TRACE("Unable to write log file (error %lu).", GetLastError());
+            StringCchPrintfA(stamp, ELEMENT_COUNT(stamp),
+                "%02d-%02d-%04d %02d:%02d:%02d ",
+                stampTime.wMonth, stampTime.wDay, stampTime.wYear,
+                stampTime.wHour, stampTime.wMinute, stampTime.wSecond);
         }
 
-        MemFree(entry);
+        end = logBuffer + length;
+        CopyMemory(end, stamp, LOG_STAMP_LENGTH);
+        CopyMemory(end + LOG_STAMP_LENGTH, entry->message, entry->length);
+        length += LOG_STAMP_LENGTH + entry->length;
+    }
+
+    if (logFile != INVALID_HANDLE_VALUE) {
+        FileWrite(length);
     }
 
-    CloseHandle(file);
+    LeaveCriticalSection(&logWriteLock);
+
+    // Recycle the written entries
+    PutSpareEntries(&batch);
 }
 
 static VOID FCALL QueueInsert(LOG_ENTRY *entry)
@@ -178,13 +309,17 @@ static VOID FCALL QueueInsert(LOG_ENTRY *entry)
     LeaveCriticalSection(&logLock);
 }
 
-
+
 DWORD FCALL LogFileInit(VOID)
 {
-    DWORD result;
+    DWORD   result;
+    SIZE_T  length;
 
     InterlockedExchange(&logStatus, LOG_STATUS_INACTIVE);
     STAILQ_INIT(&logQueue);
+    STAILQ_INIT(&logSpare);
+    logSpareCount = 0;
+    logFile = INVALID_HANDLE_VALUE;
 
     logPath = Io_ConfigGetPath(Io_ConfigGetIniFile(), "Locations", "Log_Files",
         "nxMyDB.log", NULL);
@@ -192,8 +327,25 @@ DWORD FCALL LogFileInit(VOID)
         return ERROR_NOT_ENOUGH_MEMORY;
     }
 
+    // The log file is rotated to "nxMyDB.log.old"
+    length = strlen(logPath) + 5;
+    logOldPath = MemAllocate(length);
+    if (logOldPath == NULL) {
+        Io_Free(logPath);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    StringCchCopyA(logOldPath, length, logPath);
+    StringCchCatA(logOldPath, length, ".old");
+
     if (!InitializeCriticalSectionAndSpinCount(&logLock, 50)) {
         result = GetLastError();
+        MemFree(logOldPath);
+        Io_Free(logPath);
+
+    } else if (!InitializeCriticalSectionAndSpinCount(&logWriteLock, 50)) {
+        result = GetLastError();
+        DeleteCriticalSection(&logLock);
+        MemFree(logOldPath);
         Io_Free(logPath);
 
     } else {
@@ -211,16 +363,38 @@ DWORD FCALL LogFileInit(VOID)
 
 DWORD FCALL LogFileFinalize(VOID)
 {
+    LOG_ENTRY *entry;
+
     // Write all pending log entries
     InterlockedExchange(&logStatus, LOG_STATUS_SHUTDOWN);
     QueueWrite(NULL);
+
+    // Wait for a writer that is still running
+    EnterCriticalSection(&logWriteLock);
     InterlockedExchange(&logStatus, LOG_STATUS_INACTIVE);
 
+    if (logFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(logFile);
+        logFile = INVALID_HANDLE_VALUE;
+    }
+    LeaveCriticalSection(&logWriteLock);
+
+    // Free spare entries, and any the writer could not write
+    STAILQ_CONCAT(&logSpare, &logQueue);
+    while (!STAILQ_EMPTY(&logSpare)) {
+        entry = STAILQ_FIRST(&logSpare);
+        STAILQ_REMOVE_HEAD(&logSpare, link);
+        MemFree(entry);
+    }
+    logSpareCount = 0;
+
     // Clean-up
+    DeleteCriticalSection(&logWriteLock);
     DeleteCriticalSection(&logLock);
 
     ASSERT(logPath != NULL);
     Io_Free(logPath);
+    MemFree(logOldPath);
 
     return ERROR_SUCCESS;
 }
@@ -62,6 +62,12 @@ static INLINE DWORD TableRead(const CHAR *path, CHAR **buffer, SIZE_T *bufferLen
     dataLength = GetFileSize(handle, NULL);
     if (dataLength == INVALID_FILE_SIZE) {
         result = GetLastError();
+    } else if (dataLength == 0) {
+
+        //  Table is empty, there is nothing to read
+        *buffer       = NULL;
+        *bufferLength = 0;
+        result        = ERROR_SUCCESS;
     } else {
 
         //  Allocate read buffer
@@ -229,7 +235,7 @@ DWORD FCALL NameListCreate(NAME_LIST *list, const CHAR *path)
 
     // Buffer the ID table file
     result = TableRead(path, &buffer, &bufferLength);
-    if (result == ERROR_SUCCESS) {
+    if (result == ERROR_SUCCESS && buffer != NULL) {
 
         // Parse the ID table file
         result = TableParse(list, buffer, bufferLength);
@@ -10,336 +10,426 @@ Author:
     neoxed (neoxed@gmail.com) Jun 14, 2006
 
 Abstract:
-    Resource pool functions. This implementation is based on APR resource lists,
-    but rewritten to use different list, locking, and synchronization constructs.
-
-    Container     - An empty resource (yet to be populated).
-    Idle Resource - A populated resource that is not in use.
-    Used Resource - A populated resource that is in use.
-
-    LeaveCriticalSection() appears not to alter the system error code in free builds
-    of Windows, however it could in checked builds (but who really uses those anyway :P).
+    Resource pool functions. This implementation was based on APR resource lists,
+    but resources are now kept in a fixed array of slots so they can be acquired
+    and released without taking a lock.
+
+    Empty Slot    - A slot without a resource.
+    Listed Slot   - An idle resource on the free list, a lock-free stack of slots.
+    Parked Slot   - An idle resource remembered by the thread that released it,
+                    which that thread takes back first. Any thread may take it
+                    when the free list is empty, and it is checked for removal
+                    like a listed slot once the free list is empty.
+    Used Slot     - A resource that is in use, or being created or destroyed.
+
+    The critical section and condition variable are only used by threads that
+    must wait for a resource. Resources are validated by the thread acquiring
+    them, without holding any lock.
 
 */
 
 #include <base.h>
 #include <condvar.h>
 #include <pool.h>
-#include <queue.h>
 
+#ifdef _MSC_VER
 // Silence C4127: conditional expression is constant
 #pragma warning(disable : 4127)
 
-
+// Windows 2000 does not export InterlockedCompareExchange64(), use the intrinsic
+#include <intrin.h>
+#pragma intrinsic(_InterlockedCompareExchange64)
+#undef  InterlockedCompareExchange64
+#define InterlockedCompareExchange64 _InterlockedCompareExchange64
+#endif
+
+// Results of SlotTake() and SlotCreate() other than a slot index
+#define POOL_EXHAUSTED  (-1)
+#define POOL_FAILED     (-2)
+
+// Free list head, the slot index plus one is in the low 32 bits
+#define LIST_SLOT(head)         ((LONG)((UINT64)(head) & 0xFFFFFFFF))
+#define LIST_HEAD(head, slot)   ((LONGLONG)(((((UINT64)(head) >> 32) + 1) << 32) | (UINT32)(slot)))
+
+
 /*++
 
-ContainerPush
+FreeListPush
 
-    Places a container at the tail of the container queue.
+    Places an idle resource on the free list.
 
 Arguments:
-    pool        - Pointer to an initialized POOL structure.
+    pool    - Pointer to an initialized POOL structure.
 
-    container   - Pointer to the POOL_RESOURCE structure (container) to be placed
-                  on the container queue.
+    index   - Index of the slot, its state must be POOL_SLOT_USED.
 
 Return Values:
     None.
 
 Remarks:
-    This function assumes the pool is locked.
+    The count in the high 32 bits of the head changes with every push and pop,
+    so a pop that raced with others cannot succeed with a stale "next" value.
 
 --*/
-static INLINE VOID ContainerPush(POOL *pool, POOL_RESOURCE *container)
+static INLINE VOID FreeListPush(POOL *pool, LONG index)
 {
+    LONGLONG head;
+
     ASSERT(pool != NULL);
-    ASSERT(container != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
+    ASSERT(index >= 0 && (DWORD)index < pool->maximum);
+    ASSERT(pool->slots[index].state == POOL_SLOT_USED);
 
-    // Clear the data member since the pointer should
-    // be considered invalid (or lost) at this point.
-    container->data = NULL;
+    InterlockedExchange(&pool->slots[index].state, POOL_SLOT_LISTED);
+    InterlockedIncrement(&pool->idle);
 
-    // Insert container at the tail
-    TAILQ_INSERT_TAIL(&pool->conQueue, container, link);
+    do {
+        head = pool->freeList;
+        pool->slots[index].next = LIST_SLOT(head);
+    } while (InterlockedCompareExchange64(&pool->freeList, LIST_HEAD(head, index + 1), head) != head);
 }
 
 /*++
 
-ContainerPop
+FreeListPop
 
-    Retrieves an existing container or allocates a new one.
+    Removes an idle resource from the free list.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
 
 Return Values:
-    If the function succeeds, the return value is a pointer to a POOL_RESOURCE
-    structure (container).
-
-    If the function fails, the return value is null. To get extended error
-    information, call GetLastError.
+    If the free list is not empty, the return value is the index of the slot,
+    its state is changed to POOL_SLOT_USED.
 
-Remarks:
-    This function assumes the pool is locked.
+    If the free list is empty, the return value is POOL_EXHAUSTED.
 
 --*/
-static INLINE POOL_RESOURCE *ContainerPop(POOL *pool)
+static INLINE LONG FreeListPop(POOL *pool)
 {
-    POOL_RESOURCE *container;
+    LONG        slot;
+    LONGLONG    head;
 
     ASSERT(pool != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
 
-    if (!TAILQ_EMPTY(&pool->conQueue)) {
-        // Retrieve an existing container
-        container = TAILQ_FIRST(&pool->conQueue);
-        TAILQ_REMOVE(&pool->conQueue, container, link);
-    } else {
-        // Allocate a new container
-        container = MemAllocate(sizeof(POOL_RESOURCE));
-        if (container == NULL) {
-            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    for (;;) {
+        head = pool->freeList;
+        slot = LIST_SLOT(head);
+        if (slot == 0) {
+            return POOL_EXHAUSTED;
+        }
+
+        // A torn read of the head is retried, the exchange would fail anyway
+        if ((DWORD)slot > pool->maximum) {
+            continue;
+        }
+
+        if (InterlockedCompareExchange64(&pool->freeList, LIST_HEAD(head, pool->slots[slot - 1].next), head) == head) {
+            break;
         }
     }
 
-    return container;
+    ASSERT(pool->slots[slot - 1].state == POOL_SLOT_LISTED);
+    InterlockedExchange(&pool->slots[slot - 1].state, POOL_SLOT_USED);
+    InterlockedDecrement(&pool->idle);
+
+    return slot - 1;
 }
 
 /*++
 
-ResourceCreate
+SlotNotify
 
-    Creates a new idle resource.
+    Wakes a thread waiting for a resource.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
 
 Return Values:
-    If the function succeeds, the return value is a pointer to a POOL_RESOURCE
-    structure (idle resource).
-
-    If the function fails, the return value is null. To get extended error
-    information, call GetLastError.
+    None.
 
 Remarks:
-    This function assumes the pool is locked.
+    The caller must have made a resource available (or a resource slot empty)
+    before calling this function.
 
 --*/
-static INLINE POOL_RESOURCE *ResourceCreate(POOL *pool)
+static INLINE VOID SlotNotify(POOL *pool)
 {
-    BOOL            result;
-    POOL_RESOURCE   *container;
-
     ASSERT(pool != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
 
-    // Retrieve a container for the resource
-    container = ContainerPop(pool);
-    if (container == NULL) {
-        return NULL;
+    if (pool->waiting > 0) {
+        EnterCriticalSection(&pool->lock);
+        ConditionVariableSignal(&pool->condition);
+        LeaveCriticalSection(&pool->lock);
     }
+}
 
-    //
-    // Increment the total number of resources now in case another
-    // thread gets takes ownership of the lock while we drop it to
-    // create a resource.
-    //
-    pool->total++;
+/*++
 
-    // Populate the container (without blocking access to the pool)
-    LeaveCriticalSection(&pool->lock);
-    result = pool->constructor(pool->context, &container->data);
-    EnterCriticalSection(&pool->lock);
+SlotFind
 
-    if (!result) {
-        ASSERT(GetLastError() != ERROR_SUCCESS);
+    Finds the slot of a resource that is in use.
+
+Arguments:
+    pool    - Pointer to an initialized POOL structure.
+
+    data    - Pointer to the data provided by PoolAcquire().
+
+Return Values:
+    If the resource is found, the return value is the index of its slot.
 
-        // Resource was not actually created, so decrease counter
-        pool->total--;
+    If the resource is not found, the return value is POOL_EXHAUSTED.
 
-        // Place container back in the queue
-        ContainerPush(pool, container);
-        return NULL;
+--*/
+static INLINE LONG SlotFind(POOL *pool, VOID *data)
+{
+    DWORD i;
+    LONG  index;
+
+    ASSERT(pool != NULL);
+    ASSERT(data != NULL);
+
+    // The calling thread usually releases the resource it acquired last
+    index = (LONG)(INT_PTR)TlsGetValue(pool->tlsIndex) - 1;
+    if (index >= 0 && pool->slots[index].data == data) {
+        return index;
     }
 
-    return container;
+    for (i = 0; i < pool->maximum; i++) {
+        if (pool->slots[i].data == data) {
+            return (LONG)i;
+        }
+    }
+    return POOL_EXHAUSTED;
 }
 
 /*++
 
-ResourceCheck
+SlotTake
 
-    Validates an existing idle resource.
+    Takes an idle resource.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
 
-    resData - Pointer to the POOL_RESOURCE structure's "data" member.
-
 Return Values:
-    If the resource is still valid, the return value is nonzero (true).
+    If an idle resource is available, the return value is the index of its
+    slot, the state of the slot is changed to POOL_SLOT_USED.
 
-    If the resource is no longer valid, the return value is zero (false). To get
-    extended error information, call GetLastError.
+    If no resources are idle, the return value is POOL_EXHAUSTED.
 
 --*/
-static INLINE BOOL ResourceCheck(POOL *pool, VOID *resData)
+static LONG SlotTake(POOL *pool)
 {
+    DWORD i;
+    LONG  index;
+
     ASSERT(pool != NULL);
-    ASSERT(resData != NULL);
 
-    if (!pool->validator(pool->context, resData)) {
-        ASSERT(GetLastError() != ERROR_SUCCESS);
-        return FALSE;
+    // Resource last released by this thread
+    index = (LONG)(INT_PTR)TlsGetValue(pool->tlsIndex) - 1;
+    if (index >= 0 && InterlockedCompareExchange(&pool->slots[index].state,
+            POOL_SLOT_USED, POOL_SLOT_PARKED) == POOL_SLOT_PARKED) {
+
+        InterlockedDecrement(&pool->idle);
+        InterlockedIncrement(&pool->stats.affinity);
+        return index;
     }
-    return TRUE;
+
+    // Resources on the free list
+    index = FreeListPop(pool);
+    if (index >= 0) {
+        return index;
+    }
+
+    // Resources last released by other threads
+    if (pool->idle > 0) {
+        for (i = 0; i < pool->maximum; i++) {
+            if (InterlockedCompareExchange(&pool->slots[i].state,
+                    POOL_SLOT_USED, POOL_SLOT_PARKED) == POOL_SLOT_PARKED) {
+
+                InterlockedDecrement(&pool->idle);
+                return (LONG)i;
+            }
+        }
+    }
+
+    return POOL_EXHAUSTED;
 }
 
 /*++
 
-ResourceDestroy
+SlotUnpark
 
-    Destroys an existing idle resource.
+    Takes an idle resource parked by another thread.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
 
-    resData - Pointer to the POOL_RESOURCE structure's "data" member.
-
 Return Values:
-    None.
+    If a parked resource was found, the return value is the index of its slot,
+    the state of the slot is POOL_SLOT_USED.
 
-Remarks:
-    This function assumes the pool is locked.
+    If no other thread has a parked resource, the return value is POOL_EXHAUSTED.
 
 --*/
-static INLINE VOID ResourceDestroy(POOL *pool, VOID *resData)
+static LONG SlotUnpark(POOL *pool)
 {
+    DWORD i;
+    LONG  index;
+    LONG  parked;
+
     ASSERT(pool != NULL);
-    ASSERT(resData != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
 
-    pool->destructor(pool->context, resData);
-    pool->total--;
+    // Resource last released by this thread, which it takes back first
+    parked = (LONG)(INT_PTR)TlsGetValue(pool->tlsIndex) - 1;
+
+    // Continue after the slot taken last, so each parked resource is reached in turn
+    for (i = 0; i < pool->maximum; i++) {
+        index = (LONG)((DWORD)InterlockedIncrement(&pool->unpark) % pool->maximum);
+
+        if (index != parked && InterlockedCompareExchange(&pool->slots[index].state,
+                POOL_SLOT_USED, POOL_SLOT_PARKED) == POOL_SLOT_PARKED) {
+
+            InterlockedDecrement(&pool->idle);
+            return index;
+        }
+    }
+
+    return POOL_EXHAUSTED;
 }
 
 /*++
 
-ResourcePush
+SlotCreate
 
-    Places a resource at the tail of the resource queue.
+    Creates a new resource in an empty slot.
 
 Arguments:
-    pool        - Pointer to an initialized POOL structure.
-
-    resource    - Pointer to the POOL_RESOURCE structure.
+    pool    - Pointer to an initialized POOL structure.
 
 Return Values:
-    None.
+    If the resource was created, the return value is the index of its slot,
+    the state of the slot is POOL_SLOT_USED.
 
-Remarks:
-    This function assumes the pool is locked.
+    If the pool has the maximum number of resources, the return value is
+    POOL_EXHAUSTED.
+
+    If the resource could not be created, the return value is POOL_FAILED. To
+    get extended error information, call GetLastError.
 
 --*/
-static INLINE VOID ResourcePush(POOL *pool, POOL_RESOURCE *resource)
+static LONG SlotCreate(POOL *pool)
 {
+    DWORD error;
+    LONG  index;
+
     ASSERT(pool != NULL);
-    ASSERT(resource != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
 
-    // Insert resource at the tail
-    TAILQ_INSERT_TAIL(&pool->resQueue, resource, link);
-    pool->idle++;
+    //
+    // Reserve a resource before looking for its slot. Slots are emptied before
+    // the total is decremented, so a reservation always finds an empty slot.
+    //
+    if (InterlockedIncrement(&pool->total) > (LONG)pool->maximum) {
+        InterlockedDecrement(&pool->total);
+        return POOL_EXHAUSTED;
+    }
+
+    for (index = 0; ; index = (index + 1) % (LONG)pool->maximum) {
+        if (InterlockedCompareExchange(&pool->slots[index].state,
+                POOL_SLOT_USED, POOL_SLOT_EMPTY) == POOL_SLOT_EMPTY) {
+            break;
+        }
+    }
+
+    // Populate the slot (without blocking access to the pool)
+    if (!pool->constructor(pool->context, &pool->slots[index].data)) {
+        error = GetLastError();
+        ASSERT(error != ERROR_SUCCESS);
+
+        // Resource was not actually created, so release the reservation
+        pool->slots[index].data = NULL;
+        InterlockedExchange(&pool->slots[index].state, POOL_SLOT_EMPTY);
+        InterlockedDecrement(&pool->total);
+        SlotNotify(pool);
+
+        SetLastError(error);
+        return POOL_FAILED;
+    }
+
+    InterlockedIncrement(&pool->stats.creations);
+    return index;
 }
 
 /*++
 
-ResourcePop
+SlotDestroy
 
-    Retrieves and removes a resource from the head of the resource queue.
+    Destroys the resource in a slot.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
 
-Return Values:
-    The return value is a pointer to a POOL_RESOURCE structure.
+    index   - Index of the slot, its state must be POOL_SLOT_USED.
 
-Remarks:
-    This function assumes the pool is locked.
+Return Values:
+    None.
 
 --*/
-static INLINE POOL_RESOURCE *ResourcePop(POOL *pool)
+static VOID SlotDestroy(POOL *pool, LONG index)
 {
-    POOL_RESOURCE *resource;
-
     ASSERT(pool != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
+    ASSERT(index >= 0 && (DWORD)index < pool->maximum);
+    ASSERT(pool->slots[index].state == POOL_SLOT_USED);
+
+    pool->destructor(pool->context, pool->slots[index].data);
+    pool->slots[index].data = NULL;
 
-    // Remove the first resource
-    resource = TAILQ_FIRST(&pool->resQueue);
-    TAILQ_REMOVE(&pool->resQueue, resource, link);
+    InterlockedExchange(&pool->slots[index].state, POOL_SLOT_EMPTY);
+    InterlockedDecrement(&pool->total);
+    InterlockedIncrement(&pool->stats.destructions);
 
-    pool->idle--;
-    return resource;
+    // A waiting thread may now create a resource
+    SlotNotify(pool);
 }
 
 /*++
 
-ResourcePopCheck
+ResourceCheck
 
-    Retrieves, removes, and checks a resource from the head of the resource queue.
+    Validates an existing resource.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
 
-Return Values:
-    If a valid resource is found, the return value is a pointer to a
-    POOL_RESOURCE structure.
+    resData - Pointer to the POOL_SLOT structure's "data" member.
 
-    If no valid resources are found, the return value is null.
+Return Values:
+    If the resource is still valid, the return value is nonzero (true).
 
-Remarks:
-    This function assumes the pool is locked.
+    If the resource is no longer valid, the return value is zero (false). To get
+    extended error information, call GetLastError.
 
 --*/
-static POOL_RESOURCE *ResourcePopCheck(POOL *pool)
+static INLINE BOOL ResourceCheck(POOL *pool, VOID *resData)
 {
-    POOL_RESOURCE *resource;
-
     ASSERT(pool != NULL);
-    ASSERT_CS_IS_CURRENT_OWNER(&pool->lock);
-
-    // Try to find a valid idle resource
-    while (pool->idle > 0) {
-        resource = ResourcePop(pool);
-
-        // Determine if the resource is valid
-        if (ResourceCheck(pool, resource->data)) {
-            return resource;
-        }
-
-        // Destroy invalid resource
-        ResourceDestroy(pool, resource->data);
+    ASSERT(resData != NULL);
 
-        // Place container back in the queue
-        ContainerPush(pool, resource);
+    if (!pool->validator(pool->context, resData)) {
+        ASSERT(GetLastError() != ERROR_SUCCESS);
+        return FALSE;
     }
-
-    // Nothing found
-    return NULL;
+    return TRUE;
 }
 
 /*++
 
 ResourceUpdate
 
-    Updates the resource queue.
+    Updates the idle resources.
 
 Arguments:
-    pool        - Pointer to an initialized POOL structure.
-
-    resource    - Pointer to the POOL_RESOURCE structure.
+    pool    - Pointer to an initialized POOL structure.
 
 Return Values:
     If the function succeeds, the return value is nonzero (true).
@@ -347,69 +437,99 @@ Return Values:
     If the function fails, the return value is zero (false).
 
 Remarks:
-    This function may create or destroy expired resources.
+    This function may create resources, or destroy one invalid resource.
 
 --*/
 static BOOL FCALL ResourceUpdate(POOL *pool)
 {
-    BOOL newResource = FALSE;
-    POOL_RESOURCE *resource;
-    POOL_RESOURCE *resourceTemp;
+    LONG index;
 
     ASSERT(pool != NULL);
 
-    EnterCriticalSection(&pool->lock);
-
     // Create more resources if we're under the minimum and maximum limits
-    while (pool->idle < pool->minimum && pool->total < pool->maximum) {
-        // Create a new resource
-        resource = ResourceCreate(pool);
-        if (resource == NULL) {
+    while (pool->idle < (LONG)pool->minimum) {
+        index = SlotCreate(pool);
+        if (index < 0) {
             // Fail silently if we cannot create a resource
-            break;
+            return TRUE;
         }
 
-        // Add resource to the queue
-        ResourcePush(pool, resource);
+        // Add resource to the free list and notify waiting threads
+        FreeListPush(pool, index);
+        SlotNotify(pool);
+    }
 
-        // Notify waiting threads that a new resource is available
-        if (!ConditionVariableSignal(&pool->condition)) {
-            LeaveCriticalSection(&pool->lock);
-            return FALSE;
+    // Check if an idle resource can be removed, resources parked by threads
+    // that stopped using the pool are only reached once the free list is empty
+    if (pool->idle > (LONG)pool->average) {
+        index = FreeListPop(pool);
+        if (index < 0) {
+            index = SlotUnpark(pool);
+        }
+        if (index >= 0) {
+            if (ResourceCheck(pool, pool->slots[index].data)) {
+                FreeListPush(pool, index);
+            } else {
+                SlotDestroy(pool, index);
+            }
         }
-        newResource = TRUE;
     }
 
-    // If a resource was created, we're already under the maximum limit
-    if (newResource) {
-        LeaveCriticalSection(&pool->lock);
-        return TRUE;
-    }
+    return TRUE;
+}
 
-    // Check if any idle resources can be removed
-    if (pool->idle > 0 && pool->idle > pool->average) {
-        TAILQ_FOREACH_SAFE(resource, &pool->resQueue, link, resourceTemp) {
-            if (ResourceCheck(pool, resource->data)) {
-                // Ignore valid resources
-                continue;
-            }
-            ResourceDestroy(pool, resource->data);
+/*++
+
+PoolWait
+
+    Waits until a resource might be available.
+
+Arguments:
+    pool    - Pointer to an initialized POOL structure.
+
+    start   - Tick count when the caller started waiting.
+
+Return Values:
+    If a resource might be available, the return value is nonzero (true).
+
+    If the wait timed out, the return value is zero (false).
+
+--*/
+static BOOL PoolWait(POOL *pool, DWORD start)
+{
+    BOOL  result = TRUE;
+    DWORD elapsed;
+
+    ASSERT(pool != NULL);
 
-            // The idle counter is usually decremented by ResourcePop(), but since
-            // we're removing queue items on our own, we have to decrement it.
-            pool->idle--;
+    EnterCriticalSection(&pool->lock);
 
-            // Remove resource from queue and add it to the container queue
-            TAILQ_REMOVE(&pool->resQueue, resource, link);
-            ContainerPush(pool, resource);
+    //
+    // Count this thread as waiting before checking the pool, a thread that
+    // releases a resource after the check will see the count and signal.
+    //
+    InterlockedIncrement(&pool->waiting);
+
+    if (pool->idle <= 0 && pool->total >= (LONG)pool->maximum) {
+        if (pool->timeout == INFINITE) {
+            result = ConditionVariableWait(&pool->condition, &pool->lock, INFINITE);
+        } else {
+            elapsed = GetTickCount() - start;
+            if (elapsed < pool->timeout) {
+                result = ConditionVariableWait(&pool->condition, &pool->lock, pool->timeout - elapsed);
+            } else {
+                result = FALSE;
+            }
         }
     }
 
+    InterlockedDecrement(&pool->waiting);
     LeaveCriticalSection(&pool->lock);
-    return TRUE;
+
+    return result;
 }
 
-
+
 /*++
 
 PoolCreate
@@ -465,8 +585,7 @@ DWORD SCALL PoolCreate(
     }
 
     // Initialize pool structure
-    pool->idle        = 0;
-    pool->total       = 0;
+    ZeroMemory(pool, sizeof(POOL));
     pool->minimum     = minimum;
     pool->average     = average;
     pool->maximum     = maximum;
@@ -476,16 +595,34 @@ DWORD SCALL PoolCreate(
     pool->destructor  = destructor;
     pool->context     = context;
 
-    TAILQ_INIT(&pool->resQueue);
-    TAILQ_INIT(&pool->conQueue);
+    pool->slots = MemAllocate(sizeof(POOL_SLOT) * maximum);
+    if (pool->slots == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+    ZeroMemory(pool->slots, sizeof(POOL_SLOT) * maximum);
+
+    pool->tlsIndex = TlsAlloc();
+    if (pool->tlsIndex == TLS_OUT_OF_INDEXES) {
+        result = GetLastError();
+        MemFree(pool->slots);
+        pool->slots = NULL;
+        return result;
+    }
 
     if (!InitializeCriticalSectionAndSpinCount(&pool->lock, 250)) {
-        return GetLastError();
+        result = GetLastError();
+        TlsFree(pool->tlsIndex);
+        MemFree(pool->slots);
+        pool->slots = NULL;
+        return result;
     }
 
     result = ConditionVariableCreate(&pool->condition);
     if (result != ERROR_SUCCESS) {
         DeleteCriticalSection(&pool->lock);
+        TlsFree(pool->tlsIndex);
+        MemFree(pool->slots);
+        pool->slots = NULL;
         return result;
     }
 
@@ -507,35 +644,37 @@ Arguments:
 Return Values:
     A Windows API error code.
 
+Remarks:
+    All resources must have been released.
+
 --*/
 DWORD FCALL PoolDestroy(POOL *pool)
 {
-    POOL_RESOURCE *resource;
+    DWORD i;
 
     ASSERT(pool != NULL);
 
-    EnterCriticalSection(&pool->lock);
-
-    //
-    // TODO: fix memleak with conQueue
-    //
+    // Pool was never created
+    if (pool->slots == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
 
-    while (pool->idle > 0) {
-        // Remove from the resource queue
-        resource = ResourcePop(pool);
+    for (i = 0; i < pool->maximum; i++) {
+        ASSERT(pool->slots[i].state != POOL_SLOT_USED);
 
-        // Destroy resource and free the structure
-        ResourceDestroy(pool, resource->data);
-        MemFree(resource);
+        if (pool->slots[i].state != POOL_SLOT_EMPTY) {
+            pool->destructor(pool->context, pool->slots[i].data);
+            pool->total--;
+        }
     }
 
-    ASSERT(pool->idle == 0);
     ASSERT(pool->total == 0);
-    ASSERT(TAILQ_EMPTY(&pool->conQueue));
-    ASSERT(TAILQ_EMPTY(&pool->resQueue));
+    ASSERT(pool->waiting == 0);
 
     ConditionVariableDestroy(&pool->condition);
     DeleteCriticalSection(&pool->lock);
+    TlsFree(pool->tlsIndex);
+    MemFree(pool->slots);
 
     ZeroMemory(pool, sizeof(POOL));
     return ERROR_SUCCESS;
@@ -545,7 +684,7 @@ DWORD FCALL PoolDestroy(POOL *pool)
 
 PoolAcquire
 
-    Acquires a resource from the resource queue.
+    Acquires a resource from the pool.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
@@ -565,51 +704,70 @@ Remarks:
 --*/
 BOOL FCALL PoolAcquire(POOL *pool, VOID **data)
 {
-    POOL_RESOURCE *resource;
+    BOOL  waited = FALSE;
+    DWORD bucket;
+    DWORD elapsed;
+    DWORD start;
+    LONG  index;
 
     ASSERT(pool != NULL);
     ASSERT(data != NULL);
 
-    EnterCriticalSection(&pool->lock);
+    for (;;) {
+        // Use idle resources, if available
+        index = SlotTake(pool);
+        if (index == POOL_EXHAUSTED) {
+            // Create a new resource since there are no available ones
+            index = SlotCreate(pool);
+        }
+
+        if (index == POOL_FAILED) {
+            return FALSE;
+        }
 
-    // Use idle resources, if available
-    resource = ResourcePopCheck(pool);
-    if (resource == NULL) {
-        // If we've hit the maximum limit, block until a resource
-        // becomes available or we're allowed to create one.
-        while (pool->idle <= 0 && pool->total >= pool->maximum) {
-            if (!ConditionVariableWait(&pool->condition, &pool->lock, pool->timeout)) {
-                LeaveCriticalSection(&pool->lock);
+        if (index == POOL_EXHAUSTED) {
+            // If we've hit the maximum limit, block until a resource
+            // becomes available or we're allowed to create one.
+            if (!waited) {
+                waited = TRUE;
+                start = GetTickCount();
+                InterlockedIncrement(&pool->stats.waits);
+            }
+
+            if (!PoolWait(pool, start)) {
+                InterlockedIncrement(&pool->stats.timeouts);
+                SetLastError(ERROR_TIMEOUT);
                 return FALSE;
             }
+            continue;
         }
 
-        // Check if any resources became available
-        resource = ResourcePopCheck(pool);
-        if (resource == NULL && pool->total < pool->maximum) {
-
-            // Create a new resource since there are no available ones
-            resource = ResourceCreate(pool);
+        // Validate the resource without holding any lock
+        if (ResourceCheck(pool, pool->slots[index].data)) {
+            break;
         }
+        SlotDestroy(pool, index);
     }
 
-    if (resource != NULL) {
-        *data = resource->data;
-        ContainerPush(pool, resource);
+    // Remember the slot for PoolRelease() and the next PoolAcquire()
+    TlsSetValue(pool->tlsIndex, (VOID *)(INT_PTR)(index + 1));
+    *data = pool->slots[index].data;
 
-        LeaveCriticalSection(&pool->lock);
-        return TRUE;
-    }
+    // Wait time histogram, in powers of two milliseconds
+    elapsed = waited ? GetTickCount() - start : 0;
+    for (bucket = 0; bucket < POOL_WAIT_BUCKETS - 1 && elapsed >= (1UL << bucket); bucket++);
 
-    LeaveCriticalSection(&pool->lock);
-    return FALSE;
+    InterlockedIncrement(&pool->stats.acquires);
+    InterlockedIncrement(&pool->stats.waitTime[bucket]);
+
+    return TRUE;
 }
 
 /*++
 
 PoolRelease
 
-    Returns a resource back to the resource queue.
+    Returns a resource back to the pool.
 
 Arguments:
     pool    - Pointer to an initialized POOL structure.
@@ -626,34 +784,42 @@ Return Values:
 --*/
 BOOL FCALL PoolRelease(POOL *pool, VOID *data)
 {
-    DWORD error;
-    POOL_RESOURCE *container;
+    LONG index;
+    LONG parked;
 
     ASSERT(pool != NULL);
     ASSERT(data != NULL);
 
-    EnterCriticalSection(&pool->lock);
-
-    // Retrieve a container for the data
-    container = ContainerPop(pool);
-    if (container == NULL) {
-        error = GetLastError();
-        ResourceDestroy(pool, data);
-        LeaveCriticalSection(&pool->lock);
-
-        // Restore system error code in case the destructor changed it
-        SetLastError(error);
+    index = SlotFind(pool, data);
+    if (index < 0) {
+        SetLastError(ERROR_INVALID_PARAMETER);
         return FALSE;
     }
+    ASSERT(pool->slots[index].state == POOL_SLOT_USED);
 
-    // Add resource back to the queue
-    container->data = data;
-    ResourcePush(pool, container);
+    if (pool->waiting > 0) {
+        // Threads are waiting, hand the resource to them
+        FreeListPush(pool, index);
+        SlotNotify(pool);
 
-    // Notify waiting threads that a new resource is available
-    ConditionVariableSignal(&pool->condition);
+    } else {
+        // Keep the resource for this thread, and list the one it kept before
+        parked = (LONG)(INT_PTR)TlsGetValue(pool->tlsIndex) - 1;
+        if (parked >= 0 && parked != index && InterlockedCompareExchange(&pool->slots[parked].state,
+                POOL_SLOT_USED, POOL_SLOT_PARKED) == POOL_SLOT_PARKED) {
+
+            InterlockedDecrement(&pool->idle);
+            FreeListPush(pool, parked);
+        }
+
+        TlsSetValue(pool->tlsIndex, (VOID *)(INT_PTR)(index + 1));
+        InterlockedIncrement(&pool->idle);
+        InterlockedExchange(&pool->slots[index].state, POOL_SLOT_PARKED);
+
+        // A thread may have started waiting before the resource was parked
+        SlotNotify(pool);
+    }
 
-    LeaveCriticalSection(&pool->lock);
     return ResourceUpdate(pool);
 }
 
@@ -710,13 +876,38 @@ Return Values:
 --*/
 VOID FCALL PoolInvalidate(POOL *pool, VOID *data)
 {
+    LONG index;
+
     ASSERT(pool != NULL);
     ASSERT(data != NULL);
 
-    EnterCriticalSection(&pool->lock);
-
     // Destroy resource
-    ResourceDestroy(pool, data);
+    index = SlotFind(pool, data);
+    ASSERT(index >= 0);
+    if (index >= 0) {
+        SlotDestroy(pool, index);
+    }
+}
 
-    LeaveCriticalSection(&pool->lock);
+/*++
+
+PoolGetStats
+
+    Retrieves the pool statistics.
+
+Arguments:
+    pool    - Pointer to an initialized POOL structure.
+
+    stats   - Pointer to a POOL_STATS structure that receives the statistics.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL PoolGetStats(POOL *pool, POOL_STATS *stats)
+{
+    ASSERT(pool != NULL);
+    ASSERT(stats != NULL);
+
+    CopyMemory(stats, &pool->stats, sizeof(POOL_STATS));
 }
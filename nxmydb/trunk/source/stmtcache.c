@@ -0,0 +1,110 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Statement Cache
+
+Abstract:
+    Per-connection cache of prepared statements. Each query is prepared on
+    the server the first time a connection uses it, and the statement handle
+    is reused until the connection is closed or the server session changes.
+
+*/
+
+#include <base.h>
+#include <database.h>
+
+/*++
+
+DbStmtPrepare
+
+    Retrieves the prepared statement for a query, preparing it on first use.
+
+Arguments:
+    db      - Pointer to the DB_CONTEXT structure.
+
+    id      - Identifier of the query.
+
+    query   - Text of the query, only sent to the server on first use.
+
+Return Values:
+    If the function succeeds, the return value is a pointer to the statement.
+
+    If the function fails, the return value is null.
+
+Remarks:
+    The system error code is set on failure. Parameters and results must be
+    bound again by the caller, since the buffers belong to the previous caller.
+
+--*/
+MYSQL_STMT *FCALL DbStmtPrepare(DB_CONTEXT *db, DB_STMT_ID id, const CHAR *query)
+{
+    MYSQL_STMT  *stmt;
+
+    ASSERT(db != NULL);
+    ASSERT(id >= 0 && id < DB_STMT_COUNT);
+    ASSERT(query != NULL);
+
+    stmt = db->stmt[id];
+    if (stmt != NULL) {
+        // The same identifier must always be used with the same query
+        ASSERT(strcmp(db->query[id], query) == 0);
+
+        // Release rows buffered by the previous execution
+        mysql_stmt_free_result(stmt);
+
+        db->stmtHits++;
+        return stmt;
+    }
+
+    stmt = mysql_stmt_init(db->handle);
+    if (stmt == NULL) {
+        LOG_ERROR("Unable to allocate memory for statement structure.");
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    if (mysql_stmt_prepare(stmt, query, strlen(query)) != 0) {
+        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
+        SetLastError(DbMapErrorFromStmt(stmt));
+
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+
+    db->stmt[id] = stmt;
+#ifdef DEBUG
+    db->query[id] = query;
+#endif
+    db->stmtMisses++;
+    return stmt;
+}
+
+/*++
+
+DbStmtFlush
+
+    Closes all prepared statements of a connection.
+
+Arguments:
+    db  - Pointer to the DB_CONTEXT structure.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL DbStmtFlush(DB_CONTEXT *db)
+{
+    DWORD i;
+
+    ASSERT(db != NULL);
+
+    for (i = 0; i < ELEMENT_COUNT(db->stmt); i++) {
+        if (db->stmt[i] != NULL) {
+            mysql_stmt_close(db->stmt[i]);
+            db->stmt[i] = NULL;
+        }
+    }
+}
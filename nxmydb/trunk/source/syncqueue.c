@@ -0,0 +1,422 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    Sync Queue
+
+Abstract:
+    Synchronization queue functions. The synchronizing thread reads users and
+    groups from the database and pushes them onto a bounded queue, while worker
+    threads apply them to ioFTPD and write the local user and group files.
+
+    Reading Thread - Pushes items, and waits for a free slot once the queue
+                     is full; reads never run far ahead of the updates. An
+                     item no worker takes within SYNC_QUEUE_WAIT milliseconds
+                     is applied by the reading thread.
+    Worker Thread  - Runs on ioFTPD's job threads, and exits once the queue is
+                     closed and empty.
+
+    Worker jobs share ioFTPD's job threads, and may start late or not at all.
+    A worker only counts once its job has started, and a job that starts after
+    the queue was destroyed returns without touching it.
+
+    Items in a queue must be independent of each other, since they are applied
+    in no particular order. Changes that depend on each other (creates, renames,
+    and deletes from the changes tables) are applied by the reading thread, and
+    the queue is drained before anything that depends on its items.
+
+*/
+
+#include <base.h>
+#include <syncqueue.h>
+
+//
+// Worker job structure
+//
+
+#define SYNC_WORKER_QUEUED      0   // Job has not started yet
+#define SYNC_WORKER_STARTED     1   // Job started before the queue was destroyed
+#define SYNC_WORKER_CANCELLED   2   // Queue was destroyed before the job started
+
+struct SYNC_WORKER {
+    LONG        refs;   // References held by the queue and the job
+    LONG        state;  // State of the job, SYNC_WORKER_*
+    SYNC_QUEUE  *queue; // Queue the worker applies items from
+};
+
+static VOID SyncWorkerRelease(SYNC_WORKER *worker)
+{
+    ASSERT(worker != NULL);
+
+    if (InterlockedDecrement(&worker->refs) == 0) {
+        MemFree(worker);
+    }
+}
+
+static VOID SyncQueueApplyNext(SYNC_QUEUE *queue)
+{
+    SYNC_ITEM item;
+
+    ASSERT(queue != NULL);
+    ASSERT(queue->count > 0);
+    ASSERT_CS_IS_CURRENT_OWNER(&queue->lock);
+
+    // Remove the first item, its slot is free while it is applied
+    CopyMemory(&item, &queue->items[queue->head], sizeof(SYNC_ITEM));
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    queue->active++;
+
+    ConditionVariableSignal(&queue->done);
+    LeaveCriticalSection(&queue->lock);
+
+    item.proc(item.name, &item.file);
+
+    EnterCriticalSection(&queue->lock);
+    queue->active--;
+
+    if (queue->count == 0 && queue->active == 0) {
+        ConditionVariableSignal(&queue->done);
+    }
+}
+
+static VOID CCALL SyncQueueWorker(VOID *context)
+{
+    SYNC_QUEUE  *queue;
+    SYNC_WORKER *worker = context;
+
+    ASSERT(worker != NULL);
+
+    // The queue no longer exists if it was destroyed before this job started
+    if (InterlockedCompareExchange(&worker->state, SYNC_WORKER_STARTED,
+            SYNC_WORKER_QUEUED) != SYNC_WORKER_QUEUED) {
+        SyncWorkerRelease(worker);
+        return;
+    }
+
+    queue = worker->queue;
+    SyncWorkerRelease(worker);
+
+    EnterCriticalSection(&queue->lock);
+    queue->threads++;
+
+    for (;;) {
+        while (queue->count == 0 && !queue->closed) {
+            ConditionVariableWait(&queue->ready, &queue->lock, INFINITE);
+        }
+        if (queue->count == 0) {
+            // Queue is closed and empty
+            break;
+        }
+
+        SyncQueueApplyNext(queue);
+        queue->counters.applied++;
+    }
+
+    queue->threads--;
+    queue->exited++;
+    ConditionVariableSignal(&queue->done);
+
+    LeaveCriticalSection(&queue->lock);
+}
+
+
+/*++
+
+SyncQueueCreate
+
+    Creates a synchronization queue, and queues its worker jobs.
+
+Arguments:
+    queue    - Pointer to the SYNC_QUEUE structure to be initialized.
+
+    capacity - Maximum number of items waiting to be applied.
+
+    threads  - Number of worker jobs. If this argument is zero, or no job
+               could be queued, items are applied by the thread pushing them.
+
+Return Values:
+    A Windows API error code.
+
+--*/
+DWORD FCALL SyncQueueCreate(SYNC_QUEUE *queue, LONG capacity, INT threads)
+{
+    DWORD       result;
+    INT         i;
+    SYNC_WORKER *worker;
+
+    ASSERT(queue != NULL);
+
+    if (capacity <= 0 || threads < 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(queue, sizeof(SYNC_QUEUE));
+    queue->capacity = capacity;
+
+    if (!InitializeCriticalSectionAndSpinCount(&queue->lock, 100)) {
+        return GetLastError();
+    }
+
+    result = ConditionVariableCreate(&queue->ready);
+    if (result != ERROR_SUCCESS) {
+        goto failed;
+    }
+
+    result = ConditionVariableCreate(&queue->done);
+    if (result != ERROR_SUCCESS) {
+        goto failed;
+    }
+
+    if (threads > 0) {
+        queue->items  = MemAllocate(capacity * sizeof(SYNC_ITEM));
+        queue->worker = MemAllocate(threads * sizeof(SYNC_WORKER *));
+        if (queue->items == NULL || queue->worker == NULL) {
+            result = ERROR_NOT_ENOUGH_MEMORY;
+            goto failed;
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        worker = MemAllocate(sizeof(SYNC_WORKER));
+        if (worker == NULL) {
+            break;
+        }
+        worker->refs  = 2;
+        worker->state = SYNC_WORKER_QUEUED;
+        worker->queue = queue;
+
+        if (!Io_QueueJob(SyncQueueWorker, worker, JOB_PRIORITY_NORMAL)) {
+            LOG_WARN("Unable to queue synchronization job %d of %d (error %lu).",
+                i + 1, threads, GetLastError());
+            MemFree(worker);
+            break;
+        }
+        queue->worker[queue->workers++] = worker;
+    }
+
+    return ERROR_SUCCESS;
+
+failed:
+    if (queue->items != NULL) {
+        MemFree(queue->items);
+    }
+    if (queue->worker != NULL) {
+        MemFree(queue->worker);
+    }
+    ConditionVariableDestroy(&queue->ready);
+    ConditionVariableDestroy(&queue->done);
+    DeleteCriticalSection(&queue->lock);
+
+    return result;
+}
+
+/*++
+
+SyncQueueDestroy
+
+    Applies the remaining items, and destroys the synchronization queue.
+
+Arguments:
+    queue   - Pointer to an initialized SYNC_QUEUE structure.
+
+Return Values:
+    None.
+
+Remarks:
+    Worker jobs that have not started are cancelled, and items no worker took
+    are applied by the calling thread. Waits for the started workers to exit.
+
+--*/
+VOID FCALL SyncQueueDestroy(SYNC_QUEUE *queue)
+{
+    INT i;
+    INT started = 0;
+
+    ASSERT(queue != NULL);
+
+    EnterCriticalSection(&queue->lock);
+
+    queue->closed = TRUE;
+    ConditionVariableBroadcast(&queue->ready);
+
+    // Jobs cancelled here will not touch the queue once they start
+    for (i = 0; i < queue->workers; i++) {
+        if (InterlockedCompareExchange(&queue->worker[i]->state, SYNC_WORKER_CANCELLED,
+                SYNC_WORKER_QUEUED) != SYNC_WORKER_QUEUED) {
+            started++;
+        }
+        SyncWorkerRelease(queue->worker[i]);
+    }
+
+    while (queue->count > 0) {
+        SyncQueueApplyNext(queue);
+        queue->counters.direct++;
+    }
+
+    while (queue->exited < started) {
+        ConditionVariableWait(&queue->done, &queue->lock, INFINITE);
+    }
+    ASSERT(queue->count == 0);
+    ASSERT(queue->active == 0);
+
+    LeaveCriticalSection(&queue->lock);
+
+    ConditionVariableDestroy(&queue->ready);
+    ConditionVariableDestroy(&queue->done);
+    DeleteCriticalSection(&queue->lock);
+
+    if (queue->items != NULL) {
+        MemFree(queue->items);
+    }
+    if (queue->worker != NULL) {
+        MemFree(queue->worker);
+    }
+    ZeroMemory(queue, sizeof(SYNC_QUEUE));
+}
+
+/*++
+
+SyncQueuePush
+
+    Queues a user or group to be applied by a worker thread.
+
+Arguments:
+    queue   - Pointer to an initialized SYNC_QUEUE structure. If this argument
+              is null, the item is applied by the calling thread.
+
+    proc    - Procedure to apply the item.
+
+    name    - Pointer to a null-terminated string that specifies the user or group name.
+
+    file    - Pointer to the USERFILE or GROUPFILE structure, it is copied.
+
+    size    - Size of the structure, in bytes.
+
+Return Values:
+    None.
+
+Remarks:
+    If the queue is full, waits for a free slot. The calling thread applies
+    the first queued item itself if no worker has started, or none frees a
+    slot within SYNC_QUEUE_WAIT milliseconds.
+
+--*/
+VOID FCALL SyncQueuePush(SYNC_QUEUE *queue, SYNC_APPLY_PROC *proc, CHAR *name, VOID *file, SIZE_T size)
+{
+    DWORD       start;
+    SYNC_ITEM   *item;
+
+    ASSERT(proc != NULL);
+    ASSERT(name != NULL);
+    ASSERT(file != NULL);
+    ASSERT(size <= sizeof(item->file));
+
+    if (queue == NULL || queue->workers == 0) {
+        proc(name, file);
+        return;
+    }
+
+    EnterCriticalSection(&queue->lock);
+
+    if (queue->count >= queue->capacity) {
+        start = GetTickCount();
+        do {
+            if (queue->threads == 0 ||
+                    !ConditionVariableWait(&queue->done, &queue->lock, SYNC_QUEUE_WAIT)) {
+                if (queue->count >= queue->capacity) {
+                    SyncQueueApplyNext(queue);
+                    queue->counters.direct++;
+                }
+            }
+        } while (queue->count >= queue->capacity);
+
+        queue->counters.blocked += GetTickCount() - start;
+    }
+
+    item = &queue->items[(queue->head + queue->count) % queue->capacity];
+    item->proc = proc;
+    StringCchCopyA(item->name, ELEMENT_COUNT(item->name), name);
+    CopyMemory(&item->file, file, size);
+
+    queue->count++;
+    ConditionVariableSignal(&queue->ready);
+
+    LeaveCriticalSection(&queue->lock);
+}
+
+/*++
+
+SyncQueueDrain
+
+    Waits until all queued items have been applied.
+
+Arguments:
+    queue   - Pointer to an initialized SYNC_QUEUE structure, or null.
+
+Return Values:
+    None.
+
+Remarks:
+    Queued items are applied by the calling thread if no worker has started,
+    or none takes one within SYNC_QUEUE_WAIT milliseconds.
+
+--*/
+VOID FCALL SyncQueueDrain(SYNC_QUEUE *queue)
+{
+    DWORD start;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&queue->lock);
+
+    if (queue->count > 0 || queue->active > 0) {
+        start = GetTickCount();
+        do {
+            if (queue->count == 0) {
+                // The remaining items are being applied
+                ConditionVariableWait(&queue->done, &queue->lock, INFINITE);
+
+            } else if (queue->threads == 0 ||
+                    !ConditionVariableWait(&queue->done, &queue->lock, SYNC_QUEUE_WAIT)) {
+                if (queue->count > 0) {
+                    SyncQueueApplyNext(queue);
+                    queue->counters.direct++;
+                }
+            }
+        } while (queue->count > 0 || queue->active > 0);
+
+        queue->counters.drained += GetTickCount() - start;
+    }
+
+    LeaveCriticalSection(&queue->lock);
+}
+
+/*++
+
+SyncQueueGetCounters
+
+    Retrieves the counters of a synchronization queue.
+
+Arguments:
+    queue    - Pointer to an initialized SYNC_QUEUE structure.
+
+    counters - Pointer to a SYNC_QUEUE_COUNTERS structure that receives the counters.
+
+Return Values:
+    None.
+
+--*/
+VOID FCALL SyncQueueGetCounters(SYNC_QUEUE *queue, SYNC_QUEUE_COUNTERS *counters)
+{
+    ASSERT(queue != NULL);
+    ASSERT(counters != NULL);
+
+    EnterCriticalSection(&queue->lock);
+    CopyMemory(counters, &queue->counters, sizeof(SYNC_QUEUE_COUNTERS));
+    LeaveCriticalSection(&queue->lock);
+}
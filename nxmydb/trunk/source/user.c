@@ -16,6 +16,7 @@ Abstract:
 
 #include <base.h>
 #include <backends.h>
+#include <config.h>
 #include <database.h>
 
 static INT   UserFinalize(VOID);
@@ -221,6 +222,7 @@ static INT UserDelete(CHAR *userName, INT32 userId)
 static INT UserLock(USERFILE *userFile)
 {
     CHAR       *userName;
+    DB_BACKOFF  backoff;
     DB_CONTEXT *db;
     DWORD       result;
 
@@ -230,24 +232,33 @@ static INT UserLock(USERFILE *userFile)
     // Check if ioFTPD wiped out the module context pointer
     ASSERT(userFile->lpInternal != NULL);
 
-    if (!DbAcquire(&db)) {
-        return UM_ERROR;
-    }
-
     // Resolve user ID to user name
     userName = Io_Uid2User(userFile->Uid);
     if (userName == NULL) {
-        result = ERROR_ID_NOT_FOUND;
+        SetLastError(ERROR_ID_NOT_FOUND);
+        return UM_ERROR;
+    }
+
+    //
+    // A lock attempt does not wait for the current owner. The connection is
+    // released while backing off, so it is not held for the lock timeout.
+    //
+    DbBackoffInit(&backoff, dbConfigLock.timeoutMili);
+    do {
+        if (!DbAcquire(&db)) {
+            return UM_ERROR;
+        }
 
-    } else {
         // Lock user
         result = DbUserLock(db, userName, userFile);
-        if (result != ERROR_SUCCESS) {
-            LOG_ERROR("Unable to lock user \"%s\" (error %lu).", userName, result);
-        }
-    }
 
-    DbRelease(db);
+        DbRelease(db);
+    } while (result == ERROR_USER_LOCK_FAILED && DbBackoffWait(&backoff));
+
+    if (result != ERROR_SUCCESS) {
+        LOG_ERROR("Unable to lock user \"%s\" after %lu attempts (error %lu).",
+            userName, backoff.attempts + 1, result);
+    }
 
     SetLastError(result);
     return (result == ERROR_SUCCESS) ? UM_SUCCESS : UM_ERROR;
@@ -298,11 +309,6 @@ static INT UserOpen(CHAR *userName, USERFILE *userFile)
     ASSERT(userFile != NULL);
     TRACE("userName=%s userFile=%p", userName, userFile);
 
-    if (!DbAcquire(&db)) {
-        // Return UM_DELETED instead of UM_ERROR to work around a bug in ioFTPD.
-        return UM_DELETED;
-    }
-
     // Module context is required for all file operations
     mod = MemAllocate(sizeof(MOD_CONTEXT));
     if (mod == NULL) {
@@ -320,8 +326,16 @@ static INT UserOpen(CHAR *userName, USERFILE *userFile)
             LOG_WARN("Unable to open user file for \"%s\" (error %lu).", userName, result);
         } else {
 
-            // Read database record
-            result = DbUserOpen(db, userName, userFile);
+            // Read the cached record, or the database record from a replica
+            if (DbUserCacheOpen(userName, userFile)) {
+                result = ERROR_SUCCESS;
+            } else if (!DbAcquireRead(&db, &dbUserCache, userName)) {
+                result = GetLastError();
+            } else {
+                result = DbUserOpen(db, userName, userFile);
+                DbRelease(db);
+            }
+
             if (result == ERROR_SUCCESS) {
                 // Make sure we haven't wiped out the module context pointer
                 ASSERT(userFile->lpInternal != NULL);
@@ -340,8 +354,6 @@ static INT UserOpen(CHAR *userName, USERFILE *userFile)
         }
     }
 
-    DbRelease(db);
-
     //
     // Return UM_DELETED instead of UM_ERROR to work around a bug in ioFTPD. If
     // UM_ERROR is returned, ioFTPD frees part of the USERFILE structure and
@@ -383,6 +395,10 @@ static INT UserWrite(USERFILE *userFile)
         result = DbUserWrite(db, userName, userFile);
         if (result != ERROR_SUCCESS) {
             LOG_WARN("Unable to write user database record for \"%s\" (error %lu).", userName, result);
+
+        } else if (dbConfigStats.flush == 0) {
+            // Statistics are not buffered, merge them now
+            result = DbUserStatsFlush(db, userName);
         }
     }
 
@@ -394,6 +410,8 @@ static INT UserWrite(USERFILE *userFile)
 
 static INT UserClose(USERFILE *userFile)
 {
+    CHAR        *userName;
+    DB_CONTEXT  *db;
     DWORD       result;
     MOD_CONTEXT *mod;
 
@@ -401,6 +419,19 @@ static INT UserClose(USERFILE *userFile)
 
     mod = userFile->lpInternal;
 
+    // Merge the statistics of a user that is no longer in use
+    userName = Io_Uid2User(userFile->Uid);
+    if (userName != NULL) {
+        if (DbUserStatsPending(userName) && DbAcquire(&db)) {
+            result = DbUserStatsFlush(db, userName);
+            if (result != ERROR_SUCCESS) {
+                LOG_WARN("Unable to flush statistics of \"%s\" (error %lu).", userName, result);
+            }
+            DbRelease(db);
+        }
+        DbUserStatsClose(userName);
+    }
+
     if (mod != NULL) {
         // Close user file (success does not matter)
         result = FileUserClose(userFile);
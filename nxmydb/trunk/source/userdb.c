@@ -19,6 +19,12 @@ Abstract:
 #include <config.h>
 #include <database.h>
 
+//
+// User record cache
+//
+
+CACHE dbUserCache;
+
 static VOID CopyHost(CHAR *host, CHAR *buffer, SIZE_T inLength, SIZE_T *outLength)
 {
     size_t remaining;
@@ -85,10 +91,6 @@ DWORD DbUserReadExtra(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     ASSERT(sizeof(buffer) > _MAX_NAME);
     ZeroMemory(buffer, sizeof(buffer));
 
-    stmtAdmins = db->stmt[0];
-    stmtGroups = db->stmt[1];
-    stmtHosts  = db->stmt[2];
-
     userNameLength = strlen(userName);
 
     //
@@ -97,10 +99,9 @@ DWORD DbUserReadExtra(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "SELECT gname FROM io_user_admins WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAdmins));
-        return DbMapErrorFromStmt(stmtAdmins);
+    stmtAdmins = DbStmtPrepare(db, DB_STMT_USER_READ_ADMINS, query);
+    if (stmtAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInputAdmins, stmtAdmins);
@@ -129,10 +130,9 @@ DWORD DbUserReadExtra(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "SELECT gname FROM io_user_groups WHERE uname=? ORDER BY idx ASC";
 
-    result = mysql_stmt_prepare(stmtGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroups));
-        return DbMapErrorFromStmt(stmtGroups);
+    stmtGroups = DbStmtPrepare(db, DB_STMT_USER_READ_GROUPS, query);
+    if (stmtGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInputGroups, stmtGroups);
@@ -161,10 +161,9 @@ DWORD DbUserReadExtra(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "SELECT host FROM io_user_hosts  WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtHosts, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtHosts));
-        return DbMapErrorFromStmt(stmtHosts);
+    stmtHosts = DbStmtPrepare(db, DB_STMT_USER_READ_HOSTS, query);
+    if (stmtHosts == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInputHosts, stmtHosts);
@@ -337,10 +336,12 @@ DWORD DbUserRead(DB_CONTEXT *db, CHAR *userName, USERFILE *userFilePtr)
     CHAR        *query;
     DWORD       error;
     INT         result;
+    LONG        version;
     SIZE_T      userNameLength;
+    ULONG       updated;
     USERFILE    userFile;
     MYSQL_BIND  bindInput[1];
-    MYSQL_BIND  bindOutput[30];
+    MYSQL_BIND  bindOutput[31];
     MYSQL_STMT  *stmt;
     MYSQL_RES   *metadata;
 
@@ -354,10 +355,11 @@ DWORD DbUserRead(DB_CONTEXT *db, CHAR *userName, USERFILE *userFilePtr)
     // is completely finished.
     ZeroMemory(&userFile, sizeof(USERFILE));
 
-    stmt = db->stmt[0];
-
     userNameLength = strlen(userName);
 
+    // The record is only cached if it did not change while it was read
+    version = CacheVersion(&dbUserCache);
+
     //
     // Prepare statement and bind parameters
     //
@@ -366,14 +368,13 @@ DWORD DbUserRead(DB_CONTEXT *db, CHAR *userName, USERFILE *userFilePtr)
             "       ratio,alldn,allup,daydn,dayup,monthdn,monthup,wkdn,wkup,"
             "       creator,createdon,logoncount,logonlast,logonhost,maxups,"
             "       maxdowns,maxlogins,expiresat,deletedon,deletedby,"
-            "       deletedmsg,theme,opaque"
+            "       deletedmsg,theme,opaque,updated"
             "  FROM io_user"
             "  WHERE name=?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_USER_READ, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInput, stmt);
@@ -550,6 +551,11 @@ DWORD DbUserRead(DB_CONTEXT *db, CHAR *userName, USERFILE *userFilePtr)
     bindOutput[29].buffer        = &userFile.Opaque;
     bindOutput[29].buffer_length = sizeof(userFile.Opaque);
 
+    // SELECT updated
+    bindOutput[30].buffer_type   = MYSQL_TYPE_LONG;
+    bindOutput[30].buffer        = &updated;
+    bindOutput[30].is_unsigned   = TRUE;
+
     result = mysql_stmt_bind_result(stmt, bindOutput);
     if (result != 0) {
         LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
@@ -598,6 +604,8 @@ DWORD DbUserRead(DB_CONTEXT *db, CHAR *userName, USERFILE *userFilePtr)
 
     CopyMemory(userFilePtr, &userFile, offsetof(USERFILE, lpInternal));
 
+    CachePut(&dbUserCache, userName, &userFile, updated, version, TRUE);
+
     return ERROR_SUCCESS;
 }
 
@@ -635,12 +643,6 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     ASSERT(sizeof(buffer) > _MAX_NAME);
     ZeroMemory(buffer, sizeof(buffer));
 
-    stmtUsers   = db->stmt[0];
-    stmtAdmins  = db->stmt[1];
-    stmtGroups  = db->stmt[2];
-    stmtHosts   = db->stmt[3];
-    stmtChanges = db->stmt[4];
-
     userNameLength = strlen(userName);
 
     //
@@ -654,10 +656,9 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
             "maxlogins,expiresat,deletedon,deletedby,deletedmsg,theme,opaque)"
             " VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)";
 
-    result = mysql_stmt_prepare(stmtUsers, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtUsers));
-        return DbMapErrorFromStmt(stmtUsers);
+    stmtUsers = DbStmtPrepare(db, DB_STMT_USER_CREATE, query);
+    if (stmtUsers == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindUsers, stmtUsers);
@@ -825,10 +826,9 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "REPLACE INTO io_user_admins(uname,gname) VALUES(?,?)";
 
-    result = mysql_stmt_prepare(stmtAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAdmins));
-        return DbMapErrorFromStmt(stmtAdmins);
+    stmtAdmins = DbStmtPrepare(db, DB_STMT_USER_ADD_ADMINS, query);
+    if (stmtAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAdmins, stmtAdmins);
@@ -857,10 +857,9 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "REPLACE INTO io_user_groups(uname,gname,idx) VALUES(?,?,?)";
 
-    result = mysql_stmt_prepare(stmtGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroups));
-        return DbMapErrorFromStmt(stmtGroups);
+    stmtGroups = DbStmtPrepare(db, DB_STMT_USER_ADD_GROUPS, query);
+    if (stmtGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindGroups, stmtGroups);
@@ -893,10 +892,9 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "REPLACE INTO io_user_hosts(uname,host) VALUES(?,?)";
 
-    result = mysql_stmt_prepare(stmtHosts, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtHosts));
-        return DbMapErrorFromStmt(stmtHosts);
+    stmtHosts = DbStmtPrepare(db, DB_STMT_USER_ADD_HOSTS, query);
+    if (stmtHosts == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindHosts, stmtHosts);
@@ -927,10 +925,9 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
             " (time,type,name)"
             " VALUES(UNIX_TIMESTAMP(),?,?)";
 
-    result = mysql_stmt_prepare(stmtChanges, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtChanges));
-        return DbMapErrorFromStmt(stmtChanges);
+    stmtChanges = DbStmtPrepare(db, DB_STMT_USER_CHANGES, query);
+    if (stmtChanges == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindChanges, stmtChanges);
@@ -1038,6 +1035,10 @@ DWORD DbUserCreate(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
         return DbMapErrorFromConn(db->handle);
     }
 
+    // Later writes are merged with the statistics the user was created with
+    DbUserStatsLoad(userName, userFile, TRUE);
+    CacheInvalidate(&dbUserCache, userName);
+
     return ERROR_SUCCESS;
 
 rollback:
@@ -1078,25 +1079,24 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
     ASSERT(newName != NULL);
     TRACE("db=%p userName=%s newName=%s", db, userName, newName);
 
-    stmtUsers   = db->stmt[0];
-    stmtAdmins  = db->stmt[1];
-    stmtGroups  = db->stmt[2];
-    stmtHosts   = db->stmt[3];
-    stmtChanges = db->stmt[4];
-
     userNameLength = strlen(userName);
     newNameLength  = strlen(newName);
 
+    // Merge pending statistics while the row has the old name
+    error = DbUserStatsFlush(db, userName);
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+
     //
     // Prepare users statement and bind parameters
     //
 
     query = "UPDATE io_user SET name=? WHERE name=?";
 
-    result = mysql_stmt_prepare(stmtUsers, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtUsers));
-        return DbMapErrorFromStmt(stmtUsers);
+    stmtUsers = DbStmtPrepare(db, DB_STMT_USER_RENAME, query);
+    if (stmtUsers == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindUsers, stmtUsers);
@@ -1124,10 +1124,9 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
 
     query = "UPDATE io_user_admins SET uname=? WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAdmins));
-        return DbMapErrorFromStmt(stmtAdmins);
+    stmtAdmins = DbStmtPrepare(db, DB_STMT_USER_RENAME_ADMINS, query);
+    if (stmtAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAdmins, stmtAdmins);
@@ -1155,10 +1154,9 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
 
     query = "UPDATE io_user_groups SET uname=? WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroups));
-        return DbMapErrorFromStmt(stmtGroups);
+    stmtGroups = DbStmtPrepare(db, DB_STMT_USER_RENAME_GROUPS, query);
+    if (stmtGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindGroups, stmtGroups);
@@ -1186,10 +1184,9 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
 
     query = "UPDATE io_user_hosts SET uname=? WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtHosts, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtHosts));
-        return DbMapErrorFromStmt(stmtHosts);
+    stmtHosts = DbStmtPrepare(db, DB_STMT_USER_RENAME_HOSTS, query);
+    if (stmtHosts == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindHosts, stmtHosts);
@@ -1219,10 +1216,9 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
             " (time,type,name,info)"
             " VALUES(UNIX_TIMESTAMP(),?,?,?)";
 
-    result = mysql_stmt_prepare(stmtChanges, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtChanges));
-        return DbMapErrorFromStmt(stmtChanges);
+    stmtChanges = DbStmtPrepare(db, DB_STMT_USER_CHANGES_INFO, query);
+    if (stmtChanges == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindChanges, stmtChanges);
@@ -1316,6 +1312,9 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
         return DbMapErrorFromConn(db->handle);
     }
 
+    CacheInvalidate(&dbUserCache, userName);
+    CacheInvalidate(&dbUserCache, newName);
+
     //
     // Check for modified rows
     //
@@ -1325,6 +1324,8 @@ DWORD DbUserRename(DB_CONTEXT *db, CHAR *userName, CHAR *newName)
         return ERROR_USER_NOT_FOUND;
     }
 
+    DbUserStatsRename(userName, newName);
+
     return ERROR_SUCCESS;
 
 rollback:
@@ -1363,12 +1364,6 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
     ASSERT(userName != NULL);
     TRACE("db=%p userName=%s", db, userName);
 
-    stmtUsers   = db->stmt[0];
-    stmtAdmins  = db->stmt[1];
-    stmtGroups  = db->stmt[2];
-    stmtHosts   = db->stmt[3];
-    stmtChanges = db->stmt[4];
-
     userNameLength = strlen(userName);
 
     //
@@ -1377,10 +1372,9 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
 
     query = "DELETE FROM io_user WHERE name=?";
 
-    result = mysql_stmt_prepare(stmtUsers, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtUsers));
-        return DbMapErrorFromStmt(stmtUsers);
+    stmtUsers = DbStmtPrepare(db, DB_STMT_USER_DELETE, query);
+    if (stmtUsers == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindUsers, stmtUsers);
@@ -1403,10 +1397,9 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
 
     query = "DELETE FROM io_user_admins WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAdmins));
-        return DbMapErrorFromStmt(stmtAdmins);
+    stmtAdmins = DbStmtPrepare(db, DB_STMT_USER_DEL_ADMINS, query);
+    if (stmtAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAdmins, stmtAdmins);
@@ -1429,10 +1422,9 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
 
     query = "DELETE FROM io_user_groups WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtGroups));
-        return DbMapErrorFromStmt(stmtGroups);
+    stmtGroups = DbStmtPrepare(db, DB_STMT_USER_DEL_GROUPS, query);
+    if (stmtGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindGroups, stmtGroups);
@@ -1455,10 +1447,9 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
 
     query = "DELETE FROM io_user_hosts WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtHosts, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtHosts));
-        return DbMapErrorFromStmt(stmtHosts);
+    stmtHosts = DbStmtPrepare(db, DB_STMT_USER_DEL_HOSTS, query);
+    if (stmtHosts == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindHosts, stmtHosts);
@@ -1483,10 +1474,9 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
             " (time,type,name)"
             " VALUES(UNIX_TIMESTAMP(),?,?)";
 
-    result = mysql_stmt_prepare(stmtChanges, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtChanges));
-        return DbMapErrorFromStmt(stmtChanges);
+    stmtChanges = DbStmtPrepare(db, DB_STMT_USER_CHANGES, query);
+    if (stmtChanges == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindChanges, stmtChanges);
@@ -1575,6 +1565,8 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
         return DbMapErrorFromConn(db->handle);
     }
 
+    CacheInvalidate(&dbUserCache, userName);
+
     //
     // Check for deleted rows
     //
@@ -1584,6 +1576,8 @@ DWORD DbUserDelete(DB_CONTEXT *db, CHAR *userName)
         return ERROR_USER_NOT_FOUND;
     }
 
+    DbUserStatsDiscard(userName);
+
     return ERROR_SUCCESS;
 
 rollback:
@@ -1605,7 +1599,7 @@ DWORD DbUserLock(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     DWORD       error;
     INT         result;
     INT64       affectedRows;
-    MYSQL_BIND  bind[4];
+    MYSQL_BIND  bind[3];
     MYSQL_STMT  *stmt;
 
     ASSERT(db != NULL);
@@ -1613,40 +1607,37 @@ DWORD DbUserLock(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     ASSERT(userFile != NULL);
     TRACE("db=%p userName=%s userFile=%p", db, userName, userFile);
 
-    stmt = db->stmt[0];
-
     //
     // Prepare statement and bind parameters
     //
 
-    // Parameters: user, expire, timeout, owner
-    query = "CALL io_user_lock(?,?,?,?)";
+    // Take the lease if it is free or expired, the caller backs off and retries
+    query = "UPDATE io_user SET lockowner=?, locktime=UNIX_TIMESTAMP()"
+            "  WHERE name=? AND (lockowner IS NULL OR (UNIX_TIMESTAMP() - locktime) > ?)";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_USER_LOCK, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bind, stmt);
     ZeroMemory(&bind, sizeof(bind));
 
+    // SET lockowner=?
     bind[0].buffer_type   = MYSQL_TYPE_STRING;
-    bind[0].buffer        = userName;
-    bind[0].buffer_length = strlen(userName);
+    bind[0].buffer        = dbConfigLock.owner;
+    bind[0].buffer_length = dbConfigLock.ownerLength;
 
-    bind[1].buffer_type   = MYSQL_TYPE_LONG;
-    bind[1].buffer        = &dbConfigLock.expire;
-    bind[1].is_unsigned   = TRUE;
+    // WHERE name=?
+    bind[1].buffer_type   = MYSQL_TYPE_STRING;
+    bind[1].buffer        = userName;
+    bind[1].buffer_length = strlen(userName);
 
+    // (UNIX_TIMESTAMP() - locktime) > ?
     bind[2].buffer_type   = MYSQL_TYPE_LONG;
-    bind[2].buffer        = &dbConfigLock.timeout;
+    bind[2].buffer        = &dbConfigLock.expire;
     bind[2].is_unsigned   = TRUE;
 
-    bind[3].buffer_type   = MYSQL_TYPE_STRING;
-    bind[3].buffer        = dbConfigLock.owner;
-    bind[3].buffer_length = dbConfigLock.ownerLength;
-
     result = mysql_stmt_bind_param(stmt, bind);
     if (result != 0) {
         LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
@@ -1669,7 +1660,8 @@ DWORD DbUserLock(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     affectedRows = mysql_stmt_affected_rows(stmt);
     if (affectedRows == 0) {
-        LOG_WARN("Unable to lock user: no affected rows");
+        // Held by another owner, or the user does not exist
+        TRACE("Unable to lock user: no affected rows");
         return ERROR_USER_LOCK_FAILED;
     }
 
@@ -1682,6 +1674,9 @@ DWORD DbUserLock(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     error = DbUserRead(db, userName, userFile);
     if (error != ERROR_SUCCESS) {
         LOG_WARN("Unable to update user \"%s\" on lock (error %lu).", userName, error);
+    } else {
+        // The user is about to be written, start buffering its statistics
+        DbUserStatsLoad(userName, userFile, TRUE);
     }
 
     return error;
@@ -1699,8 +1694,6 @@ DWORD DbUserUnlock(DB_CONTEXT *db, CHAR *userName)
     ASSERT(userName != NULL);
     TRACE("db=%p userName=%s", db, userName);
 
-    stmt = db->stmt[0];
-
     //
     // Prepare statement and bind parameters
     //
@@ -1708,10 +1701,9 @@ DWORD DbUserUnlock(DB_CONTEXT *db, CHAR *userName)
     query = "UPDATE io_user SET lockowner=NULL, locktime=0"
             "  WHERE name=? AND lockowner=?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_USER_UNLOCK, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bind, stmt);
@@ -1752,15 +1744,53 @@ DWORD DbUserUnlock(DB_CONTEXT *db, CHAR *userName)
 
 DWORD DbUserOpen(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 {
+    DWORD error;
+
     ASSERT(db != NULL);
     ASSERT(userName != NULL);
     ASSERT(userFile != NULL);
     TRACE("db=%p userName=%s userFile=%p", db, userName, userFile);
 
-    return DbUserRead(db, userName, userFile);
+    error = DbUserRead(db, userName, userFile);
+    if (error == ERROR_SUCCESS) {
+        DbUserStatsLoad(userName, userFile, FALSE);
+    }
+
+    return error;
 }
 
-DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
+BOOL DbUserCacheOpen(CHAR *userName, USERFILE *userFilePtr)
+{
+    USERFILE userFile;
+
+    ASSERT(userName != NULL);
+    ASSERT(userFilePtr != NULL);
+    TRACE("userName=%s userFilePtr=%p", userName, userFilePtr);
+
+    if (!CacheGet(&dbUserCache, userName, &userFile)) {
+        return FALSE;
+    }
+
+    // Keep the caller's UID, the cached record may not have it
+    userFile.Uid = userFilePtr->Uid;
+    CopyMemory(userFilePtr, &userFile, offsetof(USERFILE, lpInternal));
+
+    DbUserStatsLoad(userName, userFilePtr, FALSE);
+    return TRUE;
+}
+
+static VOID FCALL CacheWriteAll(VOID *context, VOID *data)
+{
+    CopyMemory(data, context, offsetof(USERFILE, lpInternal));
+}
+
+static VOID FCALL CacheWriteInfo(VOID *context, VOID *data)
+{
+    // Statistics and credits are cached as they are in the database
+    DbUserStatsCopyInfo(data, context);
+}
+
+static DWORD UserWriteInfo(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile, BOOL absolute)
 {
     CHAR        buffer[128];
     CHAR        *deletedBy;
@@ -1778,51 +1808,44 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     MYSQL_BIND  bindDelAdmins[1];
     MYSQL_BIND  bindDelGroups[1];
     MYSQL_BIND  bindDelHosts[1];
-    MYSQL_BIND  bindUsers[31];
+    MYSQL_BIND  bindStats[10];
+    MYSQL_BIND  bindUsers[22];
     MYSQL_STMT  *stmtAddAdmins;
     MYSQL_STMT  *stmtAddGroups;
     MYSQL_STMT  *stmtAddHosts;
     MYSQL_STMT  *stmtDelAdmins;
     MYSQL_STMT  *stmtDelGroups;
     MYSQL_STMT  *stmtDelHosts;
+    MYSQL_STMT  *stmtStats;
     MYSQL_STMT  *stmtUsers;
 
     ASSERT(db != NULL);
     ASSERT(userName != NULL);
     ASSERT(userFile != NULL);
-    TRACE("db=%p userName=%s userFile=%p", db, userName, userFile);
+    TRACE("db=%p userName=%s userFile=%p absolute=%d", db, userName, userFile, absolute);
 
     ASSERT(sizeof(buffer) > _IP_LINE_LENGTH);
     ASSERT(sizeof(buffer) > _MAX_NAME);
     ZeroMemory(buffer, sizeof(buffer));
 
-    stmtUsers     = db->stmt[0];
-    stmtAddAdmins = db->stmt[1];
-    stmtAddGroups = db->stmt[2];
-    stmtAddHosts  = db->stmt[3];
-    stmtDelAdmins = db->stmt[4];
-    stmtDelGroups = db->stmt[5];
-    stmtDelHosts  = db->stmt[6];
-
     userNameLength = strlen(userName);
 
     //
     // Prepare users statement and bind parameters
     //
 
+    // Statistics and credits are merged by DbUserStatsFlush()
     query = "UPDATE io_user SET description=?, flags=?, home=?, limits=?,"
-            " password=?, vfsfile=?, credits=?, ratio=?, alldn=?, allup=?,"
-            " daydn=?, dayup=?, monthdn=?, monthup=?, wkdn=?, wkup=?,"
+            " password=?, vfsfile=?, ratio=?,"
             " creator=?, createdon=?, logoncount=?, logonlast=?, logonhost=?,"
             " maxups=?, maxdowns=?, maxlogins=?, expiresat=?, deletedon=?,"
             " deletedby=?, deletedmsg=?, theme=?, opaque=?,"
             " updated=UNIX_TIMESTAMP()"
             "   WHERE name=?";
 
-    result = mysql_stmt_prepare(stmtUsers, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtUsers));
-        return DbMapErrorFromStmt(stmtUsers);
+    stmtUsers = DbStmtPrepare(db, DB_STMT_USER_WRITE, query);
+    if (stmtUsers == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindUsers, stmtUsers);
@@ -1858,125 +1881,80 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
     bindUsers[5].buffer        = userFile->MountFile;
     bindUsers[5].buffer_length = strlen(userFile->MountFile);
 
-    // SET credits=?
-    bindUsers[6].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[6].buffer        = &userFile->Credits;
-    bindUsers[6].buffer_length = sizeof(userFile->Credits);
-
     // SET ratio=?
-    bindUsers[7].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[7].buffer        = &userFile->Ratio;
-    bindUsers[7].buffer_length = sizeof(userFile->Ratio);
-
-    // SET alldn=?
-    bindUsers[8].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[8].buffer        = &userFile->AllDn;
-    bindUsers[8].buffer_length = sizeof(userFile->AllDn);
-
-    // SET allup=?
-    bindUsers[9].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[9].buffer        = &userFile->AllUp;
-    bindUsers[9].buffer_length = sizeof(userFile->AllUp);
-
-    // SET daydn=?
-    bindUsers[10].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[10].buffer        = &userFile->DayDn;
-    bindUsers[10].buffer_length = sizeof(userFile->DayDn);
-
-    // SET dayup=?
-    bindUsers[11].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[11].buffer        = &userFile->DayUp;
-    bindUsers[11].buffer_length = sizeof(userFile->DayUp);
-
-    // SET monthdn=?
-    bindUsers[12].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[12].buffer        = &userFile->MonthDn;
-    bindUsers[12].buffer_length = sizeof(userFile->MonthDn);
-
-    // SET monthup=?
-    bindUsers[13].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[13].buffer        = &userFile->MonthUp;
-    bindUsers[13].buffer_length = sizeof(userFile->MonthUp);
-
-    // SET wkdn=?
-    bindUsers[14].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[14].buffer        = &userFile->WkDn;
-    bindUsers[14].buffer_length = sizeof(userFile->WkDn);
-
-    // SET wkup=?
-    bindUsers[15].buffer_type   = MYSQL_TYPE_BLOB;
-    bindUsers[15].buffer        = &userFile->WkUp;
-    bindUsers[15].buffer_length = sizeof(userFile->WkUp);
+    bindUsers[6].buffer_type   = MYSQL_TYPE_BLOB;
+    bindUsers[6].buffer        = &userFile->Ratio;
+    bindUsers[6].buffer_length = sizeof(userFile->Ratio);
 
     // SET creator=?
-    bindUsers[16].buffer_type   = MYSQL_TYPE_STRING;
-    bindUsers[16].buffer        = userFile->CreatorName;
-    bindUsers[16].buffer_length = strlen(userFile->CreatorName);
+    bindUsers[7].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[7].buffer        = userFile->CreatorName;
+    bindUsers[7].buffer_length = strlen(userFile->CreatorName);
 
     // SET createdon=?
-    bindUsers[17].buffer_type   = MYSQL_TYPE_LONGLONG;
-    bindUsers[17].buffer        = &userFile->CreatedOn;
+    bindUsers[8].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindUsers[8].buffer        = &userFile->CreatedOn;
 
     // SET logoncount=?
-    bindUsers[18].buffer_type   = MYSQL_TYPE_LONG;
-    bindUsers[18].buffer        = &userFile->LogonCount;
+    bindUsers[9].buffer_type   = MYSQL_TYPE_LONG;
+    bindUsers[9].buffer        = &userFile->LogonCount;
 
     // SET logonlast=?
-    bindUsers[19].buffer_type   = MYSQL_TYPE_LONGLONG;
-    bindUsers[19].buffer        = &userFile->LogonLast;
+    bindUsers[10].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindUsers[10].buffer        = &userFile->LogonLast;
 
     // SET logonhost=?
-    bindUsers[20].buffer_type   = MYSQL_TYPE_STRING;
-    bindUsers[20].buffer        = userFile->LogonHost;
-    bindUsers[20].buffer_length = strlen(userFile->LogonHost);
+    bindUsers[11].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[11].buffer        = userFile->LogonHost;
+    bindUsers[11].buffer_length = strlen(userFile->LogonHost);
 
     // SET maxups=?
-    bindUsers[21].buffer_type   = MYSQL_TYPE_LONG;
-    bindUsers[21].buffer        = &userFile->MaxUploads;
+    bindUsers[12].buffer_type   = MYSQL_TYPE_LONG;
+    bindUsers[12].buffer        = &userFile->MaxUploads;
 
     // SET maxdowns=?
-    bindUsers[22].buffer_type   = MYSQL_TYPE_LONG;
-    bindUsers[22].buffer        = &userFile->MaxDownloads;
+    bindUsers[13].buffer_type   = MYSQL_TYPE_LONG;
+    bindUsers[13].buffer        = &userFile->MaxDownloads;
 
     // SET maxlogins=?
-    bindUsers[23].buffer_type   = MYSQL_TYPE_LONG;
-    bindUsers[23].buffer        = &userFile->LimitPerIP;
+    bindUsers[14].buffer_type   = MYSQL_TYPE_LONG;
+    bindUsers[14].buffer        = &userFile->LimitPerIP;
 
     // SET expiresat=?
-    bindUsers[24].buffer_type   = MYSQL_TYPE_LONGLONG;
-    bindUsers[24].buffer        = &userFile->ExpiresAt;
+    bindUsers[15].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindUsers[15].buffer        = &userFile->ExpiresAt;
 
     // SET deletedon=?
-    bindUsers[25].buffer_type   = MYSQL_TYPE_LONGLONG;
-    bindUsers[25].buffer        = &userFile->DeletedOn;
+    bindUsers[16].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindUsers[16].buffer        = &userFile->DeletedOn;
 
     // SET deletedby=?
     deletedBy = Io_Uid2User(userFile->DeletedBy);
     if (deletedBy == NULL) {
         deletedBy = "";
     }
-    bindUsers[26].buffer_type   = MYSQL_TYPE_STRING;
-    bindUsers[26].buffer        = deletedBy;
-    bindUsers[26].buffer_length = strlen(deletedBy);
+    bindUsers[17].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[17].buffer        = deletedBy;
+    bindUsers[17].buffer_length = strlen(deletedBy);
 
     // SET deletedmsg=?
-    bindUsers[27].buffer_type   = MYSQL_TYPE_STRING;
-    bindUsers[27].buffer        = userFile->DeletedMsg;
-    bindUsers[27].buffer_length = strlen(userFile->DeletedMsg);
+    bindUsers[18].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[18].buffer        = userFile->DeletedMsg;
+    bindUsers[18].buffer_length = strlen(userFile->DeletedMsg);
 
     // SET theme=?
-    bindUsers[28].buffer_type   = MYSQL_TYPE_LONG;
-    bindUsers[28].buffer        = &userFile->Theme;
+    bindUsers[19].buffer_type   = MYSQL_TYPE_LONG;
+    bindUsers[19].buffer        = &userFile->Theme;
 
     // SET opaque=?
-    bindUsers[29].buffer_type   = MYSQL_TYPE_STRING;
-    bindUsers[29].buffer        = userFile->Opaque;
-    bindUsers[29].buffer_length = strlen(userFile->Opaque);
+    bindUsers[20].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[20].buffer        = userFile->Opaque;
+    bindUsers[20].buffer_length = strlen(userFile->Opaque);
 
     // WHERE name=?
-    bindUsers[30].buffer_type   = MYSQL_TYPE_STRING;
-    bindUsers[30].buffer        = userName;
-    bindUsers[30].buffer_length = userNameLength;
+    bindUsers[21].buffer_type   = MYSQL_TYPE_STRING;
+    bindUsers[21].buffer        = userName;
+    bindUsers[21].buffer_length = userNameLength;
 
     result = mysql_stmt_bind_param(stmtUsers, bindUsers);
     if (result != 0) {
@@ -1984,16 +1962,90 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
         return DbMapErrorFromStmt(stmtUsers);
     }
 
+    //
+    // Prepare statistics statement and bind parameters
+    //
+
+    stmtStats = NULL;
+    if (absolute) {
+        query = "UPDATE io_user SET credits=?, alldn=?, allup=?, daydn=?, dayup=?,"
+                " monthdn=?, monthup=?, wkdn=?, wkup=?"
+                "   WHERE name=?";
+
+        stmtStats = DbStmtPrepare(db, DB_STMT_USER_WRITE_STATS, query);
+        if (stmtStats == NULL) {
+            return GetLastError();
+        }
+
+        DB_CHECK_PARAMS(bindStats, stmtStats);
+        ZeroMemory(&bindStats, sizeof(bindStats));
+
+        // SET credits=?
+        bindStats[0].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[0].buffer        = &userFile->Credits;
+        bindStats[0].buffer_length = sizeof(userFile->Credits);
+
+        // SET alldn=?
+        bindStats[1].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[1].buffer        = &userFile->AllDn;
+        bindStats[1].buffer_length = sizeof(userFile->AllDn);
+
+        // SET allup=?
+        bindStats[2].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[2].buffer        = &userFile->AllUp;
+        bindStats[2].buffer_length = sizeof(userFile->AllUp);
+
+        // SET daydn=?
+        bindStats[3].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[3].buffer        = &userFile->DayDn;
+        bindStats[3].buffer_length = sizeof(userFile->DayDn);
+
+        // SET dayup=?
+        bindStats[4].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[4].buffer        = &userFile->DayUp;
+        bindStats[4].buffer_length = sizeof(userFile->DayUp);
+
+        // SET monthdn=?
+        bindStats[5].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[5].buffer        = &userFile->MonthDn;
+        bindStats[5].buffer_length = sizeof(userFile->MonthDn);
+
+        // SET monthup=?
+        bindStats[6].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[6].buffer        = &userFile->MonthUp;
+        bindStats[6].buffer_length = sizeof(userFile->MonthUp);
+
+        // SET wkdn=?
+        bindStats[7].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[7].buffer        = &userFile->WkDn;
+        bindStats[7].buffer_length = sizeof(userFile->WkDn);
+
+        // SET wkup=?
+        bindStats[8].buffer_type   = MYSQL_TYPE_BLOB;
+        bindStats[8].buffer        = &userFile->WkUp;
+        bindStats[8].buffer_length = sizeof(userFile->WkUp);
+
+        // WHERE name=?
+        bindStats[9].buffer_type   = MYSQL_TYPE_STRING;
+        bindStats[9].buffer        = userName;
+        bindStats[9].buffer_length = userNameLength;
+
+        result = mysql_stmt_bind_param(stmtStats, bindStats);
+        if (result != 0) {
+            LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmtStats));
+            return DbMapErrorFromStmt(stmtStats);
+        }
+    }
+
     //
     // Prepare admins statement and bind parameters
     //
 
     query = "REPLACE INTO io_user_admins(uname,gname) VALUES(?,?)";
 
-    result = mysql_stmt_prepare(stmtAddAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAddAdmins));
-        return DbMapErrorFromStmt(stmtAddAdmins);
+    stmtAddAdmins = DbStmtPrepare(db, DB_STMT_USER_ADD_ADMINS, query);
+    if (stmtAddAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAddAdmins, stmtAddAdmins);
@@ -2022,10 +2074,9 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "REPLACE INTO io_user_groups(uname,gname,idx) VALUES(?,?,?)";
 
-    result = mysql_stmt_prepare(stmtAddGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAddGroups));
-        return DbMapErrorFromStmt(stmtAddGroups);
+    stmtAddGroups = DbStmtPrepare(db, DB_STMT_USER_ADD_GROUPS, query);
+    if (stmtAddGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAddGroups, stmtAddGroups);
@@ -2058,10 +2109,9 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "REPLACE INTO io_user_hosts(uname,host) VALUES(?,?)";
 
-    result = mysql_stmt_prepare(stmtAddHosts, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtAddHosts));
-        return DbMapErrorFromStmt(stmtAddHosts);
+    stmtAddHosts = DbStmtPrepare(db, DB_STMT_USER_ADD_HOSTS, query);
+    if (stmtAddHosts == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindAddHosts, stmtAddHosts);
@@ -2090,10 +2140,9 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "DELETE FROM io_user_admins WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtDelAdmins, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtDelAdmins));
-        return DbMapErrorFromStmt(stmtDelAdmins);
+    stmtDelAdmins = DbStmtPrepare(db, DB_STMT_USER_DEL_ADMINS, query);
+    if (stmtDelAdmins == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindDelAdmins, stmtDelAdmins);
@@ -2116,10 +2165,9 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "DELETE FROM io_user_groups WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtDelGroups, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtDelGroups));
-        return DbMapErrorFromStmt(stmtDelGroups);
+    stmtDelGroups = DbStmtPrepare(db, DB_STMT_USER_DEL_GROUPS, query);
+    if (stmtDelGroups == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindDelGroups, stmtDelGroups);
@@ -2142,10 +2190,9 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
 
     query = "DELETE FROM io_user_hosts WHERE uname=?";
 
-    result = mysql_stmt_prepare(stmtDelHosts, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmtDelHosts));
-        return DbMapErrorFromStmt(stmtDelHosts);
+    stmtDelHosts = DbStmtPrepare(db, DB_STMT_USER_DEL_HOSTS, query);
+    if (stmtDelHosts == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindDelHosts, stmtDelHosts);
@@ -2183,6 +2230,15 @@ DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
         goto rollback;
     }
 
+    if (stmtStats != NULL) {
+        result = mysql_stmt_execute(stmtStats);
+        if (result != 0) {
+            LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmtStats));
+            error = DbMapErrorFromStmt(stmtStats);
+            goto rollback;
+        }
+    }
+
     result = mysql_stmt_execute(stmtDelAdmins);
     if (result != 0) {
         LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmtDelAdmins));
@@ -2274,6 +2330,44 @@ rollback:
     return error;
 }
 
+DWORD DbUserWrite(DB_CONTEXT *db, CHAR *userName, USERFILE *userFile)
+{
+    DWORD   error;
+    DWORD   flags;
+
+    ASSERT(db != NULL);
+    ASSERT(userName != NULL);
+    ASSERT(userFile != NULL);
+    TRACE("db=%p userName=%s userFile=%p", db, userName, userFile);
+
+    //
+    // Changes to the statistics and credits are buffered, the remaining
+    // fields are only written when they changed.
+    //
+
+    flags = DbUserStatsUpdate(userName, userFile);
+    if (!(flags & STATS_WRITE_INFO)) {
+        return ERROR_SUCCESS;
+    }
+
+    error = UserWriteInfo(db, userName, userFile, (flags & STATS_WRITE_ABSOLUTE) ? TRUE : FALSE);
+    if (error == ERROR_SUCCESS) {
+        CacheApply(&dbUserCache, userName, (flags & STATS_WRITE_ABSOLUTE) ? CacheWriteAll : CacheWriteInfo, userFile);
+    } else {
+        CacheInvalidate(&dbUserCache, userName);
+
+        if (flags & STATS_WRITE_ABSOLUTE) {
+            // The statistics were not written, start over on the next write
+            DbUserStatsDiscard(userName);
+        } else {
+            // Write the remaining fields again on the next write
+            DbUserStatsInvalidate(userName);
+        }
+    }
+
+    return error;
+}
+
 DWORD DbUserClose(USERFILE *userFile)
 {
     UNREFERENCED_PARAMETER(userFile);
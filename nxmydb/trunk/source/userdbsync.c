@@ -134,6 +134,9 @@ static DWORD UserEventUpdate(CHAR *userName, USERFILE *userFile)
     ASSERT(userName != NULL);
     ASSERT(userFile != NULL);
 
+    // Include statistics this server has not merged yet
+    DbUserStatsLoad(userName, userFile, FALSE);
+
     // Update ioFTPD's user file structure
     result = UserUpdateByName(userName, userFile);
 
@@ -148,8 +151,219 @@ static DWORD UserEventUpdate(CHAR *userName, USERFILE *userFile)
     return result;
 }
 
+static VOID FCALL UserApplyCreate(CHAR *userName, VOID *userFile)
+{
+    DWORD error;
+
+    error = UserEventCreate(userName, userFile);
+    if (error != ERROR_SUCCESS) {
+        LOG_WARN("Unable to create user \"%s\" (error %lu).", userName, error);
+    }
+}
+
+static VOID FCALL UserApplyUpdate(CHAR *userName, VOID *userFile)
+{
+    DWORD error;
+
+    error = UserEventUpdate(userName, userFile);
+    if (error != ERROR_SUCCESS) {
+        LOG_WARN("Unable to update user \"%s\" (error %lu).", userName, error);
+    }
+}
+
 
-static DWORD UserSyncFull(DB_CONTEXT *db)
+//
+// Cursor over one of the user's extra tables (admin-groups, groups, or hosts),
+// ordered by the user name. A full sync reads each table once and merges it
+// with the io_user result set, instead of querying the tables for every user.
+//
+
+typedef struct {
+    BOOL        valid;                      // Current row is valid
+    CHAR        userName[_MAX_NAME + 1];    // User name of the current row
+    CHAR        value[128];                 // Group name or host mask of the current row
+    MYSQL_BIND  bind[2];                    // Result bindings
+    MYSQL_RES   *metadata;                  // Result metadata
+    MYSQL_STMT  *stmt;                      // Statement the cursor is reading from
+} SYNC_CURSOR;
+
+static DWORD SyncCursorOpen(SYNC_CURSOR *cursor, DB_CONTEXT *db, DB_STMT_ID id, CHAR *query)
+{
+    INT         result;
+    MYSQL_STMT  *stmt;
+
+    ASSERT(cursor != NULL);
+    ASSERT(db != NULL);
+    ASSERT(query != NULL);
+
+    // Buffer must be large enough to hold a group-name or host-mask.
+    ASSERT(sizeof(cursor->value) > _IP_LINE_LENGTH);
+    ASSERT(sizeof(cursor->value) > _MAX_NAME);
+
+    ZeroMemory(cursor, sizeof(SYNC_CURSOR));
+
+    stmt = DbStmtPrepare(db, id, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+    cursor->stmt = stmt;
+
+    cursor->metadata = mysql_stmt_result_metadata(stmt);
+    if (cursor->metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    DB_CHECK_RESULTS(cursor->bind, cursor->metadata);
+
+    // SELECT uname
+    cursor->bind[0].buffer_type   = MYSQL_TYPE_STRING;
+    cursor->bind[0].buffer        = cursor->userName;
+    cursor->bind[0].buffer_length = sizeof(cursor->userName);
+
+    // SELECT gname/host
+    cursor->bind[1].buffer_type   = MYSQL_TYPE_STRING;
+    cursor->bind[1].buffer        = cursor->value;
+    cursor->bind[1].buffer_length = sizeof(cursor->value);
+
+    result = mysql_stmt_bind_result(stmt, cursor->bind);
+    if (result != 0) {
+        LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_store_result(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    // Position the cursor on the first row
+    cursor->valid = (mysql_stmt_fetch(stmt) == 0);
+
+    return ERROR_SUCCESS;
+}
+
+static VOID SyncCursorClose(SYNC_CURSOR *cursor)
+{
+    ASSERT(cursor != NULL);
+
+    if (cursor->metadata != NULL) {
+        mysql_free_result(cursor->metadata);
+        cursor->metadata = NULL;
+    }
+
+    // Release the buffered table, the statement stays cached
+    if (cursor->stmt != NULL) {
+        mysql_stmt_free_result(cursor->stmt);
+    }
+    cursor->valid = FALSE;
+}
+
+static BOOL SyncCursorMatch(SYNC_CURSOR *cursor, const CHAR *userName)
+{
+    INT compare;
+
+    ASSERT(cursor != NULL);
+    ASSERT(userName != NULL);
+
+    //
+    // Skip rows belonging to users that sort before the requested user. These
+    // are either orphaned rows or rows left over from a user whose array was
+    // already full. Both result sets are sorted by BINARY name, so a byte-wise
+    // comparison matches the server's ordering.
+    //
+    while (cursor->valid) {
+        compare = strcmp(cursor->userName, userName);
+        if (compare >= 0) {
+            return (compare == 0);
+        }
+        cursor->valid = (mysql_stmt_fetch(cursor->stmt) == 0);
+    }
+
+    return FALSE;
+}
+
+static VOID SyncCursorNext(SYNC_CURSOR *cursor)
+{
+    ASSERT(cursor != NULL);
+
+    if (cursor->valid) {
+        cursor->valid = (mysql_stmt_fetch(cursor->stmt) == 0);
+    }
+}
+
+static VOID UserSyncReadExtra(SYNC_CURSOR *admins, SYNC_CURSOR *groups, SYNC_CURSOR *hosts, CHAR *userName, USERFILE *userFile)
+{
+    INT index;
+
+    ASSERT(admins != NULL);
+    ASSERT(groups != NULL);
+    ASSERT(hosts != NULL);
+    ASSERT(userName != NULL);
+    ASSERT(userFile != NULL);
+
+    //
+    // This function mirrors DbUserReadExtra(), but reads from the cursors
+    // opened by UserSyncFull() instead of querying the database.
+    //
+
+    index = 0;
+    while (index < MAX_GROUPS && SyncCursorMatch(admins, userName)) {
+
+        // Resolve group names to IDs
+        userFile->AdminGroups[index] = Io_Group2Gid(admins->value);
+        if (userFile->AdminGroups[index] == INVALID_GROUP) {
+            LOG_WARN("Unable to resolve group \"%s\".", admins->value);
+        } else {
+            index++;
+        }
+        SyncCursorNext(admins);
+    }
+
+    if (index < MAX_GROUPS) {
+        // Terminate the admin groups array.
+        userFile->AdminGroups[index] = INVALID_GROUP;
+    }
+
+    index = 0;
+    while (index < MAX_GROUPS && SyncCursorMatch(groups, userName)) {
+
+        // Resolve group names to IDs
+        userFile->Groups[index] = Io_Group2Gid(groups->value);
+        if (userFile->Groups[index] == INVALID_GROUP) {
+            LOG_WARN("Unable to resolve group \"%s\".", groups->value);
+        } else {
+            index++;
+        }
+        SyncCursorNext(groups);
+    }
+
+    if (index == 0) {
+        // No groups, set to "NoGroup" and terminate the groups array.
+        userFile->Groups[0] = NOGROUP_ID;
+        userFile->Groups[1] = INVALID_GROUP;
+
+    } else if (index < MAX_GROUPS) {
+        // Terminate the groups array.
+        userFile->Groups[index] = INVALID_GROUP;
+    }
+
+    index = 0;
+    while (index < MAX_IPS && SyncCursorMatch(hosts, userName)) {
+        StringCchCopy(userFile->Ip[index], ELEMENT_COUNT(userFile->Ip[0]), hosts->value);
+        index++;
+        SyncCursorNext(hosts);
+    }
+}
+
+static DWORD UserSyncFull(DB_CONTEXT *db, DB_SYNC *sync)
 {
     BOOL        removed;
     CHAR        *query;
@@ -161,12 +375,16 @@ static DWORD UserSyncFull(DB_CONTEXT *db)
     INT         result;
     NAME_ENTRY  *entry;
     NAME_LIST   list;
+    SYNC_CURSOR admins;
+    SYNC_CURSOR groups;
+    SYNC_CURSOR hosts;
     MYSQL_BIND  bind[31];
     MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
     ASSERT(db != NULL);
-    TRACE("db=%p", db);
+    ASSERT(sync != NULL);
+    TRACE("db=%p sync=%p", db, sync);
 
     //
     // Build list of user IDs
@@ -178,35 +396,65 @@ static DWORD UserSyncFull(DB_CONTEXT *db)
         return error;
     }
 
+    ZeroMemory(&admins, sizeof(SYNC_CURSOR));
+    ZeroMemory(&groups, sizeof(SYNC_CURSOR));
+    ZeroMemory(&hosts, sizeof(SYNC_CURSOR));
+    metadata = NULL;
+
     //
-    // Prepare and execute statement
+    // Read the admin-groups, groups, and hosts tables in bulk. The result sets
+    // are buffered on the client, and sorted by user name so they can be merged
+    // with the users result set in a single pass.
     //
 
-    stmt = db->stmt[7];
+    error = SyncCursorOpen(&admins, db, DB_STMT_USER_SYNC_ADMINS,
+        "SELECT uname, gname FROM io_user_admins ORDER BY BINARY uname");
+    if (error != ERROR_SUCCESS) {
+        goto failed;
+    }
+
+    error = SyncCursorOpen(&groups, db, DB_STMT_USER_SYNC_GROUPS,
+        "SELECT uname, gname FROM io_user_groups ORDER BY BINARY uname, idx ASC");
+    if (error != ERROR_SUCCESS) {
+        goto failed;
+    }
+
+    error = SyncCursorOpen(&hosts, db, DB_STMT_USER_SYNC_HOSTS,
+        "SELECT uname, host FROM io_user_hosts ORDER BY BINARY uname");
+    if (error != ERROR_SUCCESS) {
+        goto failed;
+    }
+
+    //
+    // Prepare and execute statement
+    //
 
     query = "SELECT name,description,flags,home,limits,password,vfsfile,credits,"
             "       ratio,alldn,allup,daydn,dayup,monthdn,monthup,wkdn,wkup,"
             "       creator,createdon,logoncount,logonlast,logonhost,maxups,"
             "       maxdowns,maxlogins,expiresat,deletedon,deletedby,"
             "       deletedmsg,theme,opaque"
-            "  FROM io_user";
+            "  FROM io_user"
+            "  ORDER BY BINARY name";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_USER_SYNC_FULL, query);
+    if (stmt == NULL) {
+        error = GetLastError();
+        goto failed;
     }
 
     metadata = mysql_stmt_result_metadata(stmt);
     if (metadata == NULL) {
         LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+        error = DbMapErrorFromStmt(stmt);
+        goto failed;
     }
 
     result = mysql_stmt_execute(stmt);
     if (result != 0) {
         LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+        error = DbMapErrorFromStmt(stmt);
+        goto failed;
     }
 
     //
@@ -365,13 +613,15 @@ static DWORD UserSyncFull(DB_CONTEXT *db)
     result = mysql_stmt_bind_result(stmt, bind);
     if (result != 0) {
         LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+        error = DbMapErrorFromStmt(stmt);
+        goto failed;
     }
 
     result = mysql_stmt_store_result(stmt);
     if (result != 0) {
         LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+        error = DbMapErrorFromStmt(stmt);
+        goto failed;
     }
 
     //
@@ -384,15 +634,11 @@ static DWORD UserSyncFull(DB_CONTEXT *db)
             break;
         }
 
-        // Remove user from the list beforehand in case DbUserReadExtra() fails
+        // Remove user from the list of local users
         removed = NameListRemove(&list, userName);
 
-        // Read the user's admin-groups, groups, and hosts
-        error = DbUserReadExtra(db, userName, &userFile);
-        if (error != ERROR_SUCCESS) {
-            LOG_WARN("Unable to read user \"%s\" (error %lu).", userName, error);
-            continue;
-        }
+        // Merge the user's admin-groups, groups, and hosts
+        UserSyncReadExtra(&admins, &groups, &hosts, userName, &userFile);
 
         // Initialize remaining values of the user-file structure.
         userFile.Gid        = userFile.Groups[0];
@@ -408,22 +654,21 @@ static DWORD UserSyncFull(DB_CONTEXT *db)
             TRACE("UserSyncFull: Create(%s)", userName);
 
             // User does not exist locally, create it.
-            error = UserEventCreate(userName, &userFile);
-            if (error != ERROR_SUCCESS) {
-                LOG_WARN("Unable to create user \"%s\" (error %lu).", userName, error);
-            }
+            SyncQueuePush(sync->queue, UserApplyCreate, userName, &userFile, sizeof(USERFILE));
         } else {
             TRACE("UserSyncFull: Update(%s)", userName);
 
             // User already exists locally, update it.
-            error = UserEventUpdate(userName, &userFile);
-            if (error != ERROR_SUCCESS) {
-                LOG_WARN("Unable to update user \"%s\" (error %lu).", userName, error);
-            }
+            SyncQueuePush(sync->queue, UserApplyUpdate, userName, &userFile, sizeof(USERFILE));
         }
     }
 
     mysql_free_result(metadata);
+    mysql_stmt_free_result(stmt);
+
+    SyncCursorClose(&admins);
+    SyncCursorClose(&groups);
+    SyncCursorClose(&hosts);
 
     //
     // Delete remaining users
@@ -443,6 +688,89 @@ static DWORD UserSyncFull(DB_CONTEXT *db)
     NameListDestroy(&list);
 
     return ERROR_SUCCESS;
+
+failed:
+    if (metadata != NULL) {
+        mysql_free_result(metadata);
+    }
+    SyncCursorClose(&admins);
+    SyncCursorClose(&groups);
+    SyncCursorClose(&hosts);
+
+    NameListDestroy(&list);
+
+    return error;
+}
+
+static DWORD UserSyncCursor(DB_CONTEXT *db, DB_SYNC *sync)
+{
+    CHAR        *query;
+    INT         result;
+    MYSQL_BIND  bind[1];
+    MYSQL_RES   *metadata;
+    MYSQL_STMT  *stmt;
+
+    ASSERT(db != NULL);
+    ASSERT(sync != NULL);
+
+    //
+    // Prepare and execute statement
+    //
+
+    query = "SELECT COALESCE(MAX(id),0) FROM io_user_changes";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_SYNC_CURSOR, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
+    metadata = mysql_stmt_result_metadata(stmt);
+    if (metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    //
+    // Bind and fetch results
+    //
+
+    DB_CHECK_RESULTS(bind, metadata);
+    ZeroMemory(&bind, sizeof(bind));
+
+    // SELECT MAX(id)
+    bind[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bind[0].buffer      = &sync->userChange;
+    bind[0].is_unsigned = TRUE;
+
+    result = mysql_stmt_bind_result(stmt, bind);
+    if (result != 0) {
+        LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_store_result(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_fetch(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to fetch results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    mysql_free_result(metadata);
+    mysql_stmt_free_result(stmt);
+
+    TRACE("UserSyncCursor: Last change %I64u.", sync->userChange);
+    return ERROR_SUCCESS;
 }
 
 static DWORD UserSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
@@ -454,8 +782,12 @@ static DWORD UserSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
     DWORD       error;
     USERFILE    userFile;
     INT         result;
+    UINT        batch;
+    UINT        rows;
+    UINT64      changeId;
+    ULONG       changeTime;
     MYSQL_BIND  bindInput[2];
-    MYSQL_BIND  bindOutput[3];
+    MYSQL_BIND  bindOutput[5];
     MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
@@ -466,29 +798,27 @@ static DWORD UserSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
     // Prepare statement and bind parameters
     //
 
-    stmt = db->stmt[7];
-
-    query = "SELECT name, type, info FROM io_user_changes"
-            "  WHERE time BETWEEN ? AND ?"
-            "  ORDER BY id ASC";
+    query = "SELECT id, name, type, info, time FROM io_user_changes"
+            "  WHERE id > ?"
+            "  ORDER BY id ASC LIMIT ?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_USER_SYNC_CHANGES, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInput, stmt);
     ZeroMemory(&bindInput, sizeof(bindInput));
 
-    // BETWEEN ?
-    bindInput[0].buffer_type = MYSQL_TYPE_LONG;
-    bindInput[0].buffer      = &sync->prevUpdate;
+    // WHERE id > ?
+    bindInput[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bindInput[0].buffer      = &sync->userChange;
     bindInput[0].is_unsigned = TRUE;
 
-    // AND ?
+    // LIMIT ?
+    batch = DB_SYNC_BATCH;
     bindInput[1].buffer_type = MYSQL_TYPE_LONG;
-    bindInput[1].buffer      = &sync->currUpdate;
+    bindInput[1].buffer      = &batch;
     bindInput[1].is_unsigned = TRUE;
 
     result = mysql_stmt_bind_param(stmt, bindInput);
@@ -503,16 +833,6 @@ static DWORD UserSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
         return DbMapErrorFromStmt(stmt);
     }
 
-    //
-    // Execute prepared statement
-    //
-
-    result = mysql_stmt_execute(stmt);
-    if (result != 0) {
-        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
-    }
-
     //
     // Bind and fetch results
     //
@@ -520,20 +840,30 @@ static DWORD UserSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
     DB_CHECK_RESULTS(bindOutput, metadata);
     ZeroMemory(&bindOutput, sizeof(bindOutput));
 
+    // SELECT id
+    bindOutput[0].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindOutput[0].buffer        = &changeId;
+    bindOutput[0].is_unsigned   = TRUE;
+
     // SELECT name
-    bindOutput[0].buffer_type   = MYSQL_TYPE_STRING;
-    bindOutput[0].buffer        = userName;
-    bindOutput[0].buffer_length = sizeof(userName);
+    bindOutput[1].buffer_type   = MYSQL_TYPE_STRING;
+    bindOutput[1].buffer        = userName;
+    bindOutput[1].buffer_length = sizeof(userName);
 
     // SELECT type
-    bindOutput[1].buffer_type   = MYSQL_TYPE_TINY;
-    bindOutput[1].buffer        = &syncEvent;
-    bindOutput[1].is_unsigned   = TRUE;
+    bindOutput[2].buffer_type   = MYSQL_TYPE_TINY;
+    bindOutput[2].buffer        = &syncEvent;
+    bindOutput[2].is_unsigned   = TRUE;
 
     // SELECT info
-    bindOutput[2].buffer_type   = MYSQL_TYPE_STRING;
-    bindOutput[2].buffer        = syncInfo;
-    bindOutput[2].buffer_length = sizeof(syncInfo);
+    bindOutput[3].buffer_type   = MYSQL_TYPE_STRING;
+    bindOutput[3].buffer        = syncInfo;
+    bindOutput[3].buffer_length = sizeof(syncInfo);
+
+    // SELECT time
+    bindOutput[4].buffer_type   = MYSQL_TYPE_LONG;
+    bindOutput[4].buffer        = &changeTime;
+    bindOutput[4].is_unsigned   = TRUE;
 
     result = mysql_stmt_bind_result(stmt, bindOutput);
     if (result != 0) {
@@ -541,69 +871,116 @@ static DWORD UserSyncIncrChanges(DB_CONTEXT *db, DB_SYNC *sync)
         return DbMapErrorFromStmt(stmt);
     }
 
-    result = mysql_stmt_store_result(stmt);
-    if (result != 0) {
-        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
-    }
-
     //
-    // Process result set
+    // Apply changes in order, a batch at a time
     //
 
-    for (;;) {
-        if (mysql_stmt_fetch(stmt) != 0) {
-            break;
+    do {
+        result = mysql_stmt_execute(stmt);
+        if (result != 0) {
+            LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+            return DbMapErrorFromStmt(stmt);
         }
 
-        switch ((SYNC_EVENT)syncEvent) {
-            case SYNC_EVENT_CREATE:
-                TRACE("UserSyncIncr: Create(%s)", userName);
+        result = mysql_stmt_store_result(stmt);
+        if (result != 0) {
+            LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+            return DbMapErrorFromStmt(stmt);
+        }
 
-                // Read user file from database
-                ZeroMemory(&userFile, sizeof(USERFILE));
-                error = DbUserRead(db, userName, &userFile);
-                if (error != ERROR_SUCCESS) {
-                    LOG_WARN("Unable to read user \"%s\" (error %lu).", userName, error);
-                } else {
+        for (rows = 0; ; rows++) {
+            if (mysql_stmt_fetch(stmt) != 0) {
+                break;
+            }
 
-                    // Create local user
-                    error = UserEventCreate(userName, &userFile);
+            // IDs are assigned when a change is logged but become visible when
+            // its transaction commits, so a missing ID may still be committed.
+            // Later changes wait until it is older than DB_SYNC_GAP seconds,
+            // after which it is taken to be a rolled back transaction.
+            if (changeId != sync->userChange + 1 && changeTime + DB_SYNC_GAP > sync->currUpdate) {
+                TRACE("UserSyncIncr: Waiting for changes %I64u to %I64u.", sync->userChange + 1, changeId - 1);
+                break;
+            }
+
+            switch ((SYNC_EVENT)syncEvent) {
+                case SYNC_EVENT_CREATE:
+                    TRACE("UserSyncIncr: Create(%s)", userName);
+
+                    // Read user file from database
+                    ZeroMemory(&userFile, sizeof(USERFILE));
+                    error = DbUserRead(db, userName, &userFile);
                     if (error != ERROR_SUCCESS) {
-                        LOG_WARN("Unable to create user \"%s\" (error %lu).", userName, error);
+                        LOG_WARN("Unable to read user \"%s\" (error %lu).", userName, error);
+                    } else {
+
+                        // Create local user
+                        error = UserEventCreate(userName, &userFile);
+                        if (error != ERROR_SUCCESS) {
+                            LOG_WARN("Unable to create user \"%s\" (error %lu).", userName, error);
+                        }
                     }
-                }
-                break;
+                    break;
 
-            case SYNC_EVENT_RENAME:
-                TRACE("UserSyncIncr: Rename(%s,%s)", userName, syncInfo);
+                case SYNC_EVENT_RENAME:
+                    TRACE("UserSyncIncr: Rename(%s,%s)", userName, syncInfo);
 
-                error = UserEventRename(userName, syncInfo);
-                if (error != ERROR_SUCCESS) {
-                    LOG_WARN("Unable to rename user \"%s\" to \"%s\" (error %lu).", userName, syncInfo, error);
-                }
-                break;
+                    CacheInvalidate(&dbUserCache, userName);
+                    CacheInvalidate(&dbUserCache, syncInfo);
+
+                    error = UserEventRename(userName, syncInfo);
+                    if (error != ERROR_SUCCESS) {
+                        LOG_WARN("Unable to rename user \"%s\" to \"%s\" (error %lu).", userName, syncInfo, error);
+                    }
+                    break;
 
-            case SYNC_EVENT_DELETE:
-                TRACE("UserSyncIncr: Delete(%s)", userName);
+                case SYNC_EVENT_DELETE:
+                    TRACE("UserSyncIncr: Delete(%s)", userName);
 
-                error = UserEventDelete(userName);
-                if (error != ERROR_SUCCESS) {
-                    LOG_WARN("Unable to delete user \"%s\" (error %lu).", userName, error);
-                }
-                break;
+                    CacheInvalidate(&dbUserCache, userName);
 
-            default:
-                LOG_ERROR("Unknown sync event %d.", syncEvent);
-                break;
+                    error = UserEventDelete(userName);
+                    if (error != ERROR_SUCCESS) {
+                        LOG_WARN("Unable to delete user \"%s\" (error %lu).", userName, error);
+                    }
+                    break;
+
+                default:
+                    LOG_ERROR("Unknown sync event %d.", syncEvent);
+                    break;
+            }
+
+            // The next batch starts after the last change applied
+            sync->userChange = changeId;
         }
-    }
+
+        mysql_stmt_free_result(stmt);
+        TRACE("UserSyncIncr: Applied %u changes, last change %I64u.", rows, sync->userChange);
+    } while (rows == batch);
 
     mysql_free_result(metadata);
 
     return ERROR_SUCCESS;
 }
 
+static DWORD UserSyncReadPrimary(CHAR *userName, USERFILE *userFile)
+{
+    DB_CONTEXT  *db;
+    DWORD       result;
+
+    ASSERT(userName != NULL);
+    ASSERT(userFile != NULL);
+
+    if (!DbAcquire(&db)) {
+        return GetLastError();
+    }
+
+    // Also refreshes the cached record
+    result = DbUserRead(db, userName, userFile);
+    DbRelease(db);
+
+    return result;
+}
+
 static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
 {
     CHAR        *query;
@@ -611,9 +988,11 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     CHAR        userName[_MAX_NAME + 1];
     DWORD       error;
     INT         result;
+    LONG        version;
+    ULONG       updated;
     USERFILE    userFile;
     MYSQL_BIND  bindInput[2];
-    MYSQL_BIND  bindOutput[31];
+    MYSQL_BIND  bindOutput[32];
     MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
@@ -624,20 +1003,17 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     // Prepare statement and bind parameters
     //
 
-    stmt = db->stmt[7];
-
     query = "SELECT name,description,flags,home,limits,password,vfsfile,credits,"
             "       ratio,alldn,allup,daydn,dayup,monthdn,monthup,wkdn,wkup,"
             "       creator,createdon,logoncount,logonlast,logonhost,maxups,"
             "       maxdowns,maxlogins,expiresat,deletedon,deletedby,"
-            "       deletedmsg,theme,opaque"
+            "       deletedmsg,theme,opaque,updated"
             "  FROM io_user"
             "  WHERE updated BETWEEN ? AND ?";
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
-    if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    stmt = DbStmtPrepare(db, DB_STMT_USER_SYNC_UPDATES, query);
+    if (stmt == NULL) {
+        return GetLastError();
     }
 
     DB_CHECK_PARAMS(bindInput, stmt);
@@ -669,6 +1045,9 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     // Execute prepared statement
     //
 
+    // Cached users are refreshed if they did not change while this is read
+    version = CacheVersion(&dbUserCache);
+
     result = mysql_stmt_execute(stmt);
     if (result != 0) {
         LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
@@ -759,13 +1138,13 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
 
     // SELECT wkdn
     bindOutput[15].buffer_type   = MYSQL_TYPE_BLOB;
-    bindOutput[15].buffer        = &userFile.WkUp;
-    bindOutput[15].buffer_length = sizeof(userFile.WkUp);
+    bindOutput[15].buffer        = &userFile.WkDn;
+    bindOutput[15].buffer_length = sizeof(userFile.WkDn);
 
     // SELECT wkup
     bindOutput[16].buffer_type   = MYSQL_TYPE_BLOB;
-    bindOutput[16].buffer        = &userFile.WkDn;
-    bindOutput[16].buffer_length = sizeof(userFile.WkDn);
+    bindOutput[16].buffer        = &userFile.WkUp;
+    bindOutput[16].buffer_length = sizeof(userFile.WkUp);
 
     // SELECT creator
     bindOutput[17].buffer_type   = MYSQL_TYPE_STRING;
@@ -828,6 +1207,11 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
     bindOutput[30].buffer        = &userFile.Opaque;
     bindOutput[30].buffer_length = sizeof(userFile.Opaque);
 
+    // SELECT updated
+    bindOutput[31].buffer_type   = MYSQL_TYPE_LONG;
+    bindOutput[31].buffer        = &updated;
+    bindOutput[31].is_unsigned   = TRUE;
+
     result = mysql_stmt_bind_result(stmt, bindOutput);
     if (result != 0) {
         LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
@@ -851,22 +1235,32 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
         }
         TRACE("UserSyncIncr: Update(%s)", userName);
 
-        // Read the user's admin-groups, groups, and hosts
-        error = DbUserReadExtra(db, userName, &userFile);
-        if (error != ERROR_SUCCESS) {
-            LOG_WARN("Unable to read user \"%s\" (error %lu).", userName, error);
+        if (sync->window > 0 && CacheChanged(&dbUserCache, userName, sync->window)) {
+            // The replica may not have this server's latest change yet
+            error = UserSyncReadPrimary(userName, &userFile);
+            if (error != ERROR_SUCCESS) {
+                LOG_WARN("Unable to read user \"%s\" from the primary (error %lu).", userName, error);
+                continue;
+            }
         } else {
+            // Read the user's admin-groups, groups, and hosts
+            error = DbUserReadExtra(db, userName, &userFile);
+            if (error != ERROR_SUCCESS) {
+                LOG_WARN("Unable to read user \"%s\" (error %lu).", userName, error);
+                continue;
+            }
+
             // Initialize remaining values of the user-file structure.
             userFile.Gid        = userFile.Groups[0];
             userFile.CreatorUid = Io_User2Uid(userFile.CreatorName);
             userFile.DeletedBy  = Io_User2Uid(deletedBy);
 
-            // Update user file
-            error = UserEventUpdate(userName, &userFile);
-            if (error != ERROR_SUCCESS) {
-                LOG_WARN("Unable to update user \"%s\" (error %lu).", userName, error);
-            }
+            // Refresh the cached record before the buffered statistics are added
+            CachePut(&dbUserCache, userName, &userFile, updated, version, FALSE);
         }
+
+        // Update user file
+        SyncQueuePush(sync->queue, UserApplyUpdate, userName, &userFile, sizeof(USERFILE));
     }
 
     mysql_free_result(metadata);
@@ -876,6 +1270,7 @@ static DWORD UserSyncIncrUpdates(DB_CONTEXT *db, DB_SYNC *sync)
 
 static DWORD UserSyncIncr(DB_CONTEXT *db, DB_SYNC *sync)
 {
+    DWORD error;
     DWORD result;
 
     ASSERT(db != NULL);
@@ -883,9 +1278,9 @@ static DWORD UserSyncIncr(DB_CONTEXT *db, DB_SYNC *sync)
     TRACE("db=%p sync=%p", db, sync);
 
     // Process events from the "io_user_changes" table
-    result = UserSyncIncrChanges(db, sync);
-    if (result != ERROR_SUCCESS) {
-        LOG_ERROR("Unable to sync incremental changes (error %lu).", result);
+    error = UserSyncIncrChanges(db, sync);
+    if (error != ERROR_SUCCESS) {
+        LOG_ERROR("Unable to sync incremental changes (error %lu).", error);
     }
 
     // Process updates from the "io_user" table
@@ -894,40 +1289,160 @@ static DWORD UserSyncIncr(DB_CONTEXT *db, DB_SYNC *sync)
         LOG_ERROR("Unable to sync incremental updates (error %lu).", result);
     }
 
-    return result;
+    return (error != ERROR_SUCCESS) ? error : result;
 }
 
 
-DWORD DbUserPurge(DB_CONTEXT *db, INT age)
+static DWORD UserPurgeRange(DB_CONTEXT *db, INT age, UINT64 *first, UINT64 *last)
 {
     CHAR        *query;
     INT         result;
-    MYSQL_BIND  bind[1];
+    MYSQL_BIND  bindInput[1];
+    MYSQL_BIND  bindOutput[2];
+    MYSQL_RES   *metadata;
     MYSQL_STMT  *stmt;
 
     ASSERT(db != NULL);
-    TRACE("db=%p age=%d", db, age);
-
-    stmt = db->stmt[0];
+    ASSERT(first != NULL);
+    ASSERT(last != NULL);
 
     //
     // Prepare statement and bind parameters
     //
 
-    query = "DELETE FROM io_user_changes WHERE time < (UNIX_TIMESTAMP() - ?)";
+    // The oldest change, and the newest change older than the purge age (read from the time index)
+    query = "SELECT COALESCE(MIN(id),0),"
+            "  COALESCE((SELECT MAX(id) FROM io_user_changes WHERE time < (UNIX_TIMESTAMP() - ?)),0)"
+            "  FROM io_user_changes";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_PURGE_RANGE, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
+    DB_CHECK_PARAMS(bindInput, stmt);
+    ZeroMemory(&bindInput, sizeof(bindInput));
+
+    // UNIX_TIMESTAMP() - ?
+    bindInput[0].buffer_type = MYSQL_TYPE_LONG;
+    bindInput[0].buffer      = &age;
+
+    result = mysql_stmt_bind_param(stmt, bindInput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    metadata = mysql_stmt_result_metadata(stmt);
+    if (metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        mysql_free_result(metadata);
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    //
+    // Bind and fetch results
+    //
+
+    DB_CHECK_RESULTS(bindOutput, metadata);
+    ZeroMemory(&bindOutput, sizeof(bindOutput));
+
+    // SELECT MIN(id)
+    bindOutput[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bindOutput[0].buffer      = first;
+    bindOutput[0].is_unsigned = TRUE;
+
+    // SELECT MAX(id)
+    bindOutput[1].buffer_type = MYSQL_TYPE_LONGLONG;
+    bindOutput[1].buffer      = last;
+    bindOutput[1].is_unsigned = TRUE;
+
+    mysql_free_result(metadata);
+
+    result = mysql_stmt_bind_result(stmt, bindOutput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_store_result(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
 
-    result = mysql_stmt_prepare(stmt, query, strlen(query));
+    result = mysql_stmt_fetch(stmt);
+    mysql_stmt_free_result(stmt);
     if (result != 0) {
-        LOG_WARN("Unable to prepare statement: %s", mysql_stmt_error(stmt));
+        LOG_WARN("Unable to fetch results: %s", mysql_stmt_error(stmt));
         return DbMapErrorFromStmt(stmt);
     }
 
+    return ERROR_SUCCESS;
+}
+
+DWORD DbUserPurge(DB_CONTEXT *db, INT age, UINT64 *purged)
+{
+    CHAR        *query;
+    DWORD       error;
+    INT         result;
+    MYSQL_BIND  bind[3];
+    MYSQL_STMT  *stmt;
+    UINT64      first;
+    UINT64      last;
+    UINT64      lower;
+    UINT64      upper;
+
+    ASSERT(db != NULL);
+    ASSERT(purged != NULL);
+    TRACE("db=%p age=%d purged=%p", db, age, purged);
+
+    *purged = 0;
+
+    // Find the range of IDs to purge, deleting everything older than the
+    // purge age with one statement locks the table for every other server
+    error = UserPurgeRange(db, age, &first, &last);
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+    if (last == 0) {
+        TRACE("No entries to purge from the user changes table.");
+        return ERROR_SUCCESS;
+    }
+
+    //
+    // Prepare statement and bind parameters
+    //
+
+    query = "DELETE FROM io_user_changes"
+            "  WHERE id BETWEEN ? AND ? AND time < (UNIX_TIMESTAMP() - ?)";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_PURGE, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
     DB_CHECK_PARAMS(bind, stmt);
     ZeroMemory(&bind, sizeof(bind));
 
+    // WHERE id BETWEEN ? AND ?
+    bind[0].buffer_type = MYSQL_TYPE_LONGLONG;
+    bind[0].buffer      = &lower;
+    bind[0].is_unsigned = TRUE;
+
+    bind[1].buffer_type = MYSQL_TYPE_LONGLONG;
+    bind[1].buffer      = &upper;
+    bind[1].is_unsigned = TRUE;
+
     // UNIX_TIMESTAMP() - ?
-    bind[0].buffer_type = MYSQL_TYPE_LONG;
-    bind[0].buffer      = &age;
+    bind[2].buffer_type = MYSQL_TYPE_LONG;
+    bind[2].buffer      = &age;
 
     result = mysql_stmt_bind_param(stmt, bind);
     if (result != 0) {
@@ -936,16 +1451,26 @@ DWORD DbUserPurge(DB_CONTEXT *db, INT age)
     }
 
     //
-    // Execute prepared statement
+    // Delete a batch of IDs at a time, pausing in between so the sync and
+    // lock queries of other servers are not held up
     //
 
-    result = mysql_stmt_execute(stmt);
-    if (result != 0) {
-        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
-        return DbMapErrorFromStmt(stmt);
+    for (lower = first; lower <= last; lower = upper + 1) {
+        upper = MIN(lower + DB_PURGE_BATCH - 1, last);
+
+        result = mysql_stmt_execute(stmt);
+        if (result != 0) {
+            LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+            return DbMapErrorFromStmt(stmt);
+        }
+        *purged += mysql_stmt_affected_rows(stmt);
+
+        if (upper < last) {
+            Sleep(DB_PURGE_YIELD);
+        }
     }
 
-    TRACE("Purged %I64u entries from the user changes table.", mysql_stmt_affected_rows(stmt));
+    TRACE("Purged %I64u entries from the user changes table (IDs %I64u to %I64u).", *purged, first, last);
 
     return ERROR_SUCCESS;
 }
@@ -960,11 +1485,21 @@ DWORD DbUserSync(DB_CONTEXT *db, DB_SYNC *sync)
 
     if (sync->prevUpdate == 0) {
         // If there was no previous update time, we perform a full user synchronization.
-        result = UserSyncFull(db);
+        // Changes logged while it runs are applied by the next incremental one.
+        result = UserSyncCursor(db, sync);
+        if (result != ERROR_SUCCESS) {
+            LOG_ERROR("Unable to retrieve the last user change (error %lu).", result);
+        } else {
+            CacheFlush(&dbUserCache);
+            result = UserSyncFull(db, sync);
+        }
     } else {
         ASSERT(sync->currUpdate != 0);
         result = UserSyncIncr(db, sync);
     }
 
+    // Users read so far must be applied before returning
+    SyncQueueDrain(sync->queue);
+
     return result;
 }
@@ -0,0 +1,1301 @@
+/*
+
+nxMyDB - MySQL Database for ioFTPD
+Copyright (c) 2006-2009 neoxed
+
+Module Name:
+    User Statistics Buffer
+
+Abstract:
+    Write-behind buffer for user statistics and credits. Each user-file write
+    adds the difference from the values last seen by ioFTPD to the user's
+    pending changes, instead of overwriting the statistics in the database.
+    The pending changes are merged into the database in batches, so several
+    servers can update the same user without losing each other's transfers.
+
+    The statistics are stored as binary arrays, which the server is unable to
+    add to. A flush reads the rows of a batch with a locking read, adds the
+    pending changes, and writes the rows back with a single statement, all in
+    one transaction. On a storage engine without transactions (MyISAM), the
+    read and write are not atomic.
+
+    Each batch also records its sequence number in the io_user_flush table,
+    in the same transaction. If the commit fails, the connection may have
+    been lost after the server committed; the batch is kept aside until the
+    next flush looks up its sequence number, and its changes are only put
+    back if the batch was not committed.
+
+*/
+
+#include <base.h>
+#include <array.h>
+#include <backends.h>
+#include <config.h>
+#include <database.h>
+
+//
+// Statistics arrays of the USERFILE structure, in the order of the columns
+//
+
+static const struct {
+    SIZE_T  offset; // Offset of the array in the USERFILE structure
+    SIZE_T  count;  // Number of elements in the array
+} statsFields[] = {
+    {offsetof(USERFILE, Credits), MAX_SECTIONS},
+    {offsetof(USERFILE, AllDn),   MAX_SECTIONS * 3},
+    {offsetof(USERFILE, AllUp),   MAX_SECTIONS * 3},
+    {offsetof(USERFILE, DayDn),   MAX_SECTIONS * 3},
+    {offsetof(USERFILE, DayUp),   MAX_SECTIONS * 3},
+    {offsetof(USERFILE, MonthDn), MAX_SECTIONS * 3},
+    {offsetof(USERFILE, MonthUp), MAX_SECTIONS * 3},
+    {offsetof(USERFILE, WkDn),    MAX_SECTIONS * 3},
+    {offsetof(USERFILE, WkUp),    MAX_SECTIONS * 3},
+};
+
+#define STATS_FIELDS    ELEMENT_COUNT(statsFields)
+#define STATS_COUNT     (MAX_SECTIONS + (MAX_SECTIONS * 3) * 8)
+#define STATS_CREDITS   MAX_SECTIONS    // Credits are the first values
+
+//
+// Users merged by each flush statement. The statements always have this many
+// placeholders; a smaller batch repeats its first user.
+//
+
+#define STATS_BATCH     8
+
+// Seconds a batch's sequence number is kept, to resolve a failed commit
+#define STATS_FLUSH_AGE (24 * 60 * 60)
+
+// Batches between purges of the old sequence numbers
+#define STATS_PURGE     1024
+
+#define STATS_NAMES     "?,?,?,?,?,?,?,?"
+#define STATS_CASE(col) col "=CASE name WHEN ? THEN ? WHEN ? THEN ? WHEN ? THEN ? WHEN ? THEN ?" \
+                        " WHEN ? THEN ? WHEN ? THEN ? WHEN ? THEN ? WHEN ? THEN ? END"
+
+typedef struct {
+    CHAR    name[_MAX_NAME + 1];    // User name
+    BOOL    dirty;                  // Pending changes have not been flushed
+    BOOL    written;                // Remaining fields were written
+    UINT64  info;                   // Hash of the remaining fields, as last written
+    INT64   base[STATS_COUNT];      // Statistics as last seen by ioFTPD
+    INT64   delta[STATS_COUNT];     // Changes not yet merged into the database
+} STATS_ENTRY;
+
+typedef struct {
+    CHAR            name[_MAX_NAME + 1];    // User name
+    unsigned long   nameLength;             // Length of the user name
+    BOOL            found;                  // Row was read from the database
+    INT64           delta[STATS_COUNT];     // Changes taken from the entry
+    INT64           value[STATS_COUNT];     // Merged statistics
+} STATS_ROW;
+
+typedef struct STATS_DOUBT {
+    struct STATS_DOUBT  *next;              // Next batch whose commit failed
+    UINT64              sequence;           // Sequence number of the batch
+    SIZE_T              count;              // Number of rows in the batch
+    STATS_ROW           rows[STATS_BATCH];  // Rows of the batch
+} STATS_DOUBT;
+
+static CRITICAL_SECTION statsLock;
+static CRITICAL_SECTION statsResolveLock;
+static STATS_ENTRY      **statsArray = NULL;
+static SIZE_T           statsCount   = 0;
+static SIZE_T           statsTotal   = 0;
+static STATS_COUNTERS   statsCounters;
+static STATS_DOUBT      *statsDoubt  = NULL;    // Batches whose commit failed
+static UINT64           statsSequence = 0;      // Sequence number of the last batch
+
+
+static INT CompareName(const VOID *elem1, const VOID *elem2)
+{
+    const STATS_ENTRY **entry1 = elem1;
+    const STATS_ENTRY **entry2 = elem2;
+
+    return strcmp(entry1[0]->name, entry2[0]->name);
+}
+
+static STATS_ENTRY **EntrySearch(const CHAR *userName)
+{
+    STATS_ENTRY *entry;
+
+    // Move the "userName" pointer by its offset in the STATS_ENTRY structure,
+    // the same as NameListExists() does.
+    entry = (STATS_ENTRY *)((BYTE *)userName - offsetof(STATS_ENTRY, name));
+
+    return ArrayPtrSearch(entry, statsArray, statsCount, CompareName);
+}
+
+static STATS_ENTRY *EntryInsert(const CHAR *userName)
+{
+    STATS_ENTRY *entry;
+    STATS_ENTRY **vector;
+    VOID        *newMem;
+
+    if (statsCount >= statsTotal) {
+        // Increase the size of the array by 64 entries
+        newMem = MemReallocate(statsArray, (statsTotal + 64) * sizeof(STATS_ENTRY *));
+        if (newMem == NULL) {
+            return NULL;
+        }
+
+        statsArray = newMem;
+        statsTotal += 64;
+    }
+
+    entry = MemAllocate(sizeof(STATS_ENTRY));
+    if (entry == NULL) {
+        return NULL;
+    }
+    ZeroMemory(entry, sizeof(STATS_ENTRY));
+    StringCchCopyA(entry->name, ELEMENT_COUNT(entry->name), userName);
+
+    vector = ArrayPtrInsert(entry, statsArray, statsCount, CompareName);
+    if (vector != NULL) {
+        // Entry already exists
+        MemFree(entry);
+        return vector[0];
+    }
+    statsCount++;
+
+    return entry;
+}
+
+static VOID EntryRemove(STATS_ENTRY **vector)
+{
+    STATS_ENTRY *entry = vector[0];
+
+    ArrayPtrDelete(vector, statsArray, statsCount, CompareName);
+    statsCount--;
+
+    MemFree(entry);
+}
+
+static VOID StatsGet(const USERFILE *userFile, INT64 *values)
+{
+    SIZE_T i;
+
+    for (i = 0; i < STATS_FIELDS; i++) {
+        CopyMemory(values, (const BYTE *)userFile + statsFields[i].offset, statsFields[i].count * sizeof(INT64));
+        values += statsFields[i].count;
+    }
+}
+
+static VOID StatsSet(USERFILE *userFile, const INT64 *values)
+{
+    SIZE_T i;
+
+    for (i = 0; i < STATS_FIELDS; i++) {
+        CopyMemory((BYTE *)userFile + statsFields[i].offset, values, statsFields[i].count * sizeof(INT64));
+        values += statsFields[i].count;
+    }
+}
+
+static UINT64 InfoHash(const USERFILE *userFile)
+{
+    BYTE        *data;
+    SIZE_T      i;
+    UINT64      hash = 14695981039346656037ULL;
+    USERFILE    info;
+
+    // Hash everything but the statistics and the ioFTPD pointers (FNV-1a)
+    CopyMemory(&info, userFile, offsetof(USERFILE, lpInternal));
+    for (i = 0; i < STATS_FIELDS; i++) {
+        ZeroMemory((BYTE *)&info + statsFields[i].offset, statsFields[i].count * sizeof(INT64));
+    }
+
+    data = (BYTE *)&info;
+    for (i = 0; i < offsetof(USERFILE, lpInternal); i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static VOID FCALL CacheMerged(VOID *context, VOID *data)
+{
+    // The cached record has the statistics that are in the database
+    StatsSet(data, context);
+}
+
+static VOID RowMerge(STATS_ROW *row, const INT64 *current)
+{
+    INT64   value;
+    SIZE_T  i;
+
+    for (i = 0; i < STATS_COUNT; i++) {
+        value = current[i] + row->delta[i];
+
+        // Every server resets the day, week, and month statistics by its own
+        // base values, so a transfer statistic must not go below zero.
+        if (value < 0 && i >= STATS_CREDITS) {
+            value = 0;
+        }
+        row->value[i] = value;
+    }
+}
+
+static VOID RowTake(STATS_ROW *row, STATS_ENTRY *entry)
+{
+    StringCchCopyA(row->name, ELEMENT_COUNT(row->name), entry->name);
+    row->nameLength = strlen(entry->name);
+    row->found      = FALSE;
+    CopyMemory(row->delta, entry->delta, sizeof(entry->delta));
+
+    ZeroMemory(entry->delta, sizeof(entry->delta));
+    entry->dirty = FALSE;
+}
+
+static VOID RowRestore(STATS_ROW *row)
+{
+    SIZE_T      i;
+    STATS_ENTRY **vector;
+
+    vector = EntrySearch(row->name);
+    if (vector == NULL) {
+        LOG_WARN("Unable to restore statistics of user \"%s\", it was closed or deleted.", row->name);
+        return;
+    }
+
+    for (i = 0; i < STATS_COUNT; i++) {
+        vector[0]->delta[i] += row->delta[i];
+    }
+    vector[0]->dirty = TRUE;
+}
+
+static DWORD FlushBatch(DB_CONTEXT *db, STATS_ROW *rows, SIZE_T count, UINT64 sequence, BOOL *doubt)
+{
+    CHAR            *query;
+    CHAR            name[_MAX_NAME + 1];
+    DWORD           error;
+    INT             result;
+    INT64           *current;
+    MYSQL_BIND      bindInput[STATS_BATCH];
+    MYSQL_BIND      bindOutput[1 + STATS_FIELDS];
+    MYSQL_BIND      bindRecord[2];
+    MYSQL_BIND      bindUpdate[STATS_FIELDS * STATS_BATCH * 2 + STATS_BATCH];
+    MYSQL_RES       *metadata;
+    MYSQL_STMT      *stmt;
+    SIZE_T          found[STATS_BATCH];
+    SIZE_T          foundCount;
+    SIZE_T          i;
+    SIZE_T          j;
+    SIZE_T          k;
+    STATS_ROW       *row;
+    unsigned long   nameLength;
+
+    ASSERT(count > 0 && count <= STATS_BATCH);
+    ASSERT(doubt != NULL);
+
+    *doubt = FALSE;
+
+    current = MemAllocate(STATS_COUNT * sizeof(INT64));
+    if (current == NULL) {
+        LOG_ERROR("Unable to allocate memory for statistics.");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    //
+    // Begin transaction
+    //
+
+    result = mysql_query(db->handle, "START TRANSACTION");
+    if (result != 0) {
+        LOG_WARN("Unable to start transaction: %s", mysql_error(db->handle));
+        error = DbMapErrorFromConn(db->handle);
+        goto cleanup;
+    }
+
+    //
+    // Read and lock the rows of the batch
+    //
+
+    query = "SELECT name,credits,alldn,allup,daydn,dayup,monthdn,monthup,wkdn,wkup"
+            "  FROM io_user"
+            "  WHERE name IN (" STATS_NAMES ") FOR UPDATE";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_STATS_READ, query);
+    if (stmt == NULL) {
+        error = GetLastError();
+        goto rollback;
+    }
+
+    DB_CHECK_PARAMS(bindInput, stmt);
+    ZeroMemory(&bindInput, sizeof(bindInput));
+
+    // WHERE name IN (?,...)
+    for (i = 0; i < STATS_BATCH; i++) {
+        row = &rows[(i < count) ? i : 0];
+
+        bindInput[i].buffer_type   = MYSQL_TYPE_STRING;
+        bindInput[i].buffer        = row->name;
+        bindInput[i].buffer_length = row->nameLength;
+    }
+
+    result = mysql_stmt_bind_param(stmt, bindInput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    metadata = mysql_stmt_result_metadata(stmt);
+    if (metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        mysql_free_result(metadata);
+        goto rollback;
+    }
+
+    DB_CHECK_RESULTS(bindOutput, metadata);
+    ZeroMemory(&bindOutput, sizeof(bindOutput));
+
+    // SELECT name
+    bindOutput[0].buffer_type   = MYSQL_TYPE_STRING;
+    bindOutput[0].buffer        = name;
+    bindOutput[0].buffer_length = sizeof(name);
+    bindOutput[0].length        = &nameLength;
+
+    // SELECT credits,alldn,...
+    for (i = 0, k = 0; i < STATS_FIELDS; i++) {
+        bindOutput[i + 1].buffer_type   = MYSQL_TYPE_BLOB;
+        bindOutput[i + 1].buffer        = &current[k];
+        bindOutput[i + 1].buffer_length = statsFields[i].count * sizeof(INT64);
+        k += statsFields[i].count;
+    }
+
+    result = mysql_stmt_bind_result(stmt, bindOutput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind results: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        mysql_free_result(metadata);
+        goto rollback;
+    }
+
+    result = mysql_stmt_store_result(stmt);
+    if (result != 0) {
+        LOG_WARN("Unable to buffer results: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        mysql_free_result(metadata);
+        goto rollback;
+    }
+
+    foundCount = 0;
+    for (;;) {
+        // Columns shorter than expected leave the remaining values at zero
+        ZeroMemory(current, STATS_COUNT * sizeof(INT64));
+
+        result = mysql_stmt_fetch(stmt);
+        if (result != 0 && result != MYSQL_DATA_TRUNCATED) {
+            break;
+        }
+        name[MIN(nameLength, _MAX_NAME)] = '\0';
+
+        for (j = 0; j < count; j++) {
+            if (!rows[j].found && _stricmp(rows[j].name, name) == 0) {
+                rows[j].found = TRUE;
+                RowMerge(&rows[j], current);
+                found[foundCount++] = j;
+                break;
+            }
+        }
+    }
+
+    mysql_free_result(metadata);
+    mysql_stmt_free_result(stmt);
+
+    if (result != MYSQL_NO_DATA) {
+        LOG_WARN("Unable to fetch results: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    if (foundCount == 0) {
+        // Every user of the batch was deleted
+        error = ERROR_SUCCESS;
+        goto rollback;
+    }
+
+    //
+    // Write the merged rows with one statement
+    //
+
+    query = "UPDATE io_user SET "
+            STATS_CASE("credits") ","
+            STATS_CASE("alldn")   ","
+            STATS_CASE("allup")   ","
+            STATS_CASE("daydn")   ","
+            STATS_CASE("dayup")   ","
+            STATS_CASE("monthdn") ","
+            STATS_CASE("monthup") ","
+            STATS_CASE("wkdn")    ","
+            STATS_CASE("wkup")    ","
+            " updated=UNIX_TIMESTAMP()"
+            "  WHERE name IN (" STATS_NAMES ")";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_STATS_WRITE, query);
+    if (stmt == NULL) {
+        error = GetLastError();
+        goto rollback;
+    }
+
+    DB_CHECK_PARAMS(bindUpdate, stmt);
+    ZeroMemory(&bindUpdate, sizeof(bindUpdate));
+
+    for (i = 0, k = 0; i < STATS_FIELDS; i++) {
+        for (j = 0; j < STATS_BATCH; j++) {
+            row = &rows[found[(j < foundCount) ? j : 0]];
+
+            // WHEN ?
+            bindUpdate[(i * STATS_BATCH + j) * 2].buffer_type   = MYSQL_TYPE_STRING;
+            bindUpdate[(i * STATS_BATCH + j) * 2].buffer        = row->name;
+            bindUpdate[(i * STATS_BATCH + j) * 2].buffer_length = row->nameLength;
+
+            // THEN ?
+            bindUpdate[(i * STATS_BATCH + j) * 2 + 1].buffer_type   = MYSQL_TYPE_BLOB;
+            bindUpdate[(i * STATS_BATCH + j) * 2 + 1].buffer        = &row->value[k];
+            bindUpdate[(i * STATS_BATCH + j) * 2 + 1].buffer_length = statsFields[i].count * sizeof(INT64);
+        }
+        k += statsFields[i].count;
+    }
+
+    // WHERE name IN (?,...)
+    for (j = 0; j < STATS_BATCH; j++) {
+        row = &rows[found[(j < foundCount) ? j : 0]];
+
+        bindUpdate[STATS_FIELDS * STATS_BATCH * 2 + j].buffer_type   = MYSQL_TYPE_STRING;
+        bindUpdate[STATS_FIELDS * STATS_BATCH * 2 + j].buffer        = row->name;
+        bindUpdate[STATS_FIELDS * STATS_BATCH * 2 + j].buffer_length = row->nameLength;
+    }
+
+    result = mysql_stmt_bind_param(stmt, bindUpdate);
+    if (result != 0) {
+        LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    //
+    // Record the batch's sequence number
+    //
+
+    query = "INSERT INTO io_user_flush (owner,seq,time) VALUES(?,?,UNIX_TIMESTAMP())";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_STATS_RECORD, query);
+    if (stmt == NULL) {
+        error = GetLastError();
+        goto rollback;
+    }
+
+    DB_CHECK_PARAMS(bindRecord, stmt);
+    ZeroMemory(&bindRecord, sizeof(bindRecord));
+
+    // owner=?
+    bindRecord[0].buffer_type   = MYSQL_TYPE_STRING;
+    bindRecord[0].buffer        = dbConfigLock.owner;
+    bindRecord[0].buffer_length = dbConfigLock.ownerLength;
+
+    // seq=?
+    bindRecord[1].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindRecord[1].buffer        = &sequence;
+    bindRecord[1].is_unsigned   = TRUE;
+
+    result = mysql_stmt_bind_param(stmt, bindRecord);
+    if (result != 0) {
+        LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        error = DbMapErrorFromStmt(stmt);
+        goto rollback;
+    }
+
+    //
+    // Commit transaction
+    //
+
+    result = mysql_query(db->handle, "COMMIT");
+    if (result != 0) {
+        // The server may have committed before the error, e.g. a lost connection
+        LOG_WARN("Unable to commit transaction: %s", mysql_error(db->handle));
+        error = DbMapErrorFromConn(db->handle);
+        *doubt = TRUE;
+        goto cleanup;
+    }
+
+    InterlockedIncrement(&statsCounters.batches);
+    for (i = 0; i < foundCount; i++) {
+        InterlockedIncrement(&statsCounters.rows);
+
+        row = &rows[found[i]];
+        CacheApply(&dbUserCache, row->name, CacheMerged, row->value);
+    }
+
+    error = ERROR_SUCCESS;
+    goto cleanup;
+
+rollback:
+    //
+    // Rollback transaction on error
+    //
+
+    if (mysql_query(db->handle, "ROLLBACK") != 0) {
+        LOG_WARN("Unable to rollback transaction: %s", mysql_error(db->handle));
+    }
+
+cleanup:
+    MemFree(current);
+    return error;
+}
+
+static DWORD FlushCommitted(DB_CONTEXT *db, UINT64 sequence, BOOL *committed)
+{
+    CHAR        *query;
+    INT         result;
+    MYSQL_BIND  bindInput[2];
+    MYSQL_BIND  bindOutput[1];
+    MYSQL_RES   *metadata;
+    MYSQL_STMT  *stmt;
+    ULONG       found;
+
+    query = "SELECT COUNT(*) FROM io_user_flush WHERE owner=? AND seq=?";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_STATS_CHECK, query);
+    if (stmt == NULL) {
+        return GetLastError();
+    }
+
+    DB_CHECK_PARAMS(bindInput, stmt);
+    ZeroMemory(&bindInput, sizeof(bindInput));
+
+    // WHERE owner=?
+    bindInput[0].buffer_type   = MYSQL_TYPE_STRING;
+    bindInput[0].buffer        = dbConfigLock.owner;
+    bindInput[0].buffer_length = dbConfigLock.ownerLength;
+
+    // AND seq=?
+    bindInput[1].buffer_type   = MYSQL_TYPE_LONGLONG;
+    bindInput[1].buffer        = &sequence;
+    bindInput[1].is_unsigned   = TRUE;
+
+    result = mysql_stmt_bind_param(stmt, bindInput);
+    if (result != 0) {
+        LOG_WARN("Unable to bind parameters: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    metadata = mysql_stmt_result_metadata(stmt);
+    if (metadata == NULL) {
+        LOG_WARN("Unable to retrieve result metadata: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    result = mysql_stmt_execute(stmt);
+    if (result != 0) {
+        LOG_ERROR("Unable to execute statement: %s", mysql_stmt_error(stmt));
+        mysql_free_result(metadata);
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    DB_CHECK_RESULTS(bindOutput, metadata);
+    ZeroMemory(&bindOutput, sizeof(bindOutput));
+
+    // SELECT COUNT(*)
+    bindOutput[0].buffer_type = MYSQL_TYPE_LONG;
+    bindOutput[0].buffer      = &found;
+    bindOutput[0].is_unsigned = TRUE;
+
+    result = mysql_stmt_bind_result(stmt, bindOutput);
+    if (result == 0) {
+        result = mysql_stmt_store_result(stmt);
+    }
+    if (result == 0) {
+        result = mysql_stmt_fetch(stmt);
+    }
+    mysql_free_result(metadata);
+    mysql_stmt_free_result(stmt);
+
+    if (result != 0) {
+        LOG_WARN("Unable to fetch results: %s", mysql_stmt_error(stmt));
+        return DbMapErrorFromStmt(stmt);
+    }
+
+    *committed = (found > 0);
+    return ERROR_SUCCESS;
+}
+
+static VOID FlushPurge(DB_CONTEXT *db)
+{
+    CHAR        *query;
+    INT         result;
+    MYSQL_BIND  bind[1];
+    MYSQL_STMT  *stmt;
+    ULONG       age = STATS_FLUSH_AGE;
+
+    query = "DELETE FROM io_user_flush WHERE time < UNIX_TIMESTAMP() - ?";
+
+    stmt = DbStmtPrepare(db, DB_STMT_USER_STATS_PURGE, query);
+    if (stmt == NULL) {
+        return;
+    }
+
+    DB_CHECK_PARAMS(bind, stmt);
+    ZeroMemory(&bind, sizeof(bind));
+
+    bind[0].buffer_type = MYSQL_TYPE_LONG;
+    bind[0].buffer      = &age;
+    bind[0].is_unsigned = TRUE;
+
+    result = mysql_stmt_bind_param(stmt, bind);
+    if (result == 0) {
+        result = mysql_stmt_execute(stmt);
+    }
+    if (result != 0) {
+        LOG_WARN("Unable to purge flushed batches: %s", mysql_stmt_error(stmt));
+    }
+}
+
+static DWORD FlushResolve(DB_CONTEXT *db)
+{
+    BOOL        committed;
+    DWORD       error = ERROR_SUCCESS;
+    SIZE_T      i;
+    STATS_DOUBT *doubt;
+    STATS_DOUBT *last;
+
+    // Take the batches whose commit failed
+    EnterCriticalSection(&statsLock);
+    doubt = statsDoubt;
+    statsDoubt = NULL;
+    LeaveCriticalSection(&statsLock);
+
+    while (doubt != NULL) {
+        error = FlushCommitted(db, doubt->sequence, &committed);
+        if (error != ERROR_SUCCESS) {
+            // Resolve the remaining batches with the next flush
+            EnterCriticalSection(&statsLock);
+            for (last = doubt; last->next != NULL; last = last->next);
+            last->next = statsDoubt;
+            statsDoubt = doubt;
+            LeaveCriticalSection(&statsLock);
+            break;
+        }
+
+        if (committed) {
+            // The cached records do not have the merged statistics
+            for (i = 0; i < doubt->count; i++) {
+                CacheInvalidate(&dbUserCache, doubt->rows[i].name);
+            }
+        } else {
+            LOG_WARN("Batch %I64u of %lu users was not committed, restoring its statistics.",
+                doubt->sequence, (ULONG)doubt->count);
+
+            EnterCriticalSection(&statsLock);
+            for (i = 0; i < doubt->count; i++) {
+                RowRestore(&doubt->rows[i]);
+            }
+            LeaveCriticalSection(&statsLock);
+        }
+
+        last = doubt;
+        doubt = doubt->next;
+        MemFree(last);
+    }
+
+    return error;
+}
+
+
+/*++
+
+DbUserStatsInit
+
+    Initializes the user statistics buffer.
+
+Arguments:
+    None.
+
+Return Values:
+    A Windows API error code.
+
+--*/
+DWORD DbUserStatsInit(VOID)
+{
+    if (!InitializeCriticalSectionAndSpinCount(&statsLock, 100)) {
+        return GetLastError();
+    }
+    if (!InitializeCriticalSectionAndSpinCount(&statsResolveLock, 100)) {
+        DeleteCriticalSection(&statsLock);
+        return GetLastError();
+    }
+
+    ZeroMemory(&statsCounters, sizeof(STATS_COUNTERS));
+    statsCount = 0;
+    statsTotal = 64;
+    statsDoubt = NULL;
+    statsSequence = 0;
+
+    statsArray = MemAllocate(statsTotal * sizeof(STATS_ENTRY *));
+    if (statsArray == NULL) {
+        DeleteCriticalSection(&statsResolveLock);
+        DeleteCriticalSection(&statsLock);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+/*++
+
+DbUserStatsFinalize
+
+    Frees the user statistics buffer. Pending changes must be flushed first.
+
+Arguments:
+    None.
+
+Return Values:
+    None.
+
+--*/
+VOID DbUserStatsFinalize(VOID)
+{
+    SIZE_T      i;
+    STATS_DOUBT *doubt;
+
+    if (statsArray == NULL) {
+        // Not initialized
+        return;
+    }
+
+    if (statsCounters.writes > 0) {
+        LOG_INFO("Statistics buffer merged %ld writes into %ld rows with %ld batches.",
+            statsCounters.writes, statsCounters.rows, statsCounters.batches);
+    }
+
+    for (i = 0; i < statsCount; i++) {
+        if (statsArray[i]->dirty) {
+            LOG_WARN("Discarding unflushed statistics of user \"%s\".", statsArray[i]->name);
+        }
+        MemFree(statsArray[i]);
+    }
+    MemFree(statsArray);
+    statsArray = NULL;
+    statsCount = 0;
+    statsTotal = 0;
+
+    while (statsDoubt != NULL) {
+        doubt = statsDoubt;
+        statsDoubt = doubt->next;
+
+        LOG_WARN("Discarding batch %I64u of %lu users, its commit failed and was not resolved.",
+            doubt->sequence, (ULONG)doubt->count);
+        MemFree(doubt);
+    }
+
+    DeleteCriticalSection(&statsResolveLock);
+    DeleteCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsCounters
+
+    Retrieves the statistics buffer counters.
+
+Arguments:
+    counters - Pointer to a STATS_COUNTERS structure that receives the counters.
+
+Return Values:
+    None.
+
+--*/
+VOID DbUserStatsCounters(STATS_COUNTERS *counters)
+{
+    ASSERT(counters != NULL);
+
+    EnterCriticalSection(&statsLock);
+    CopyMemory(counters, &statsCounters, sizeof(STATS_COUNTERS));
+    LeaveCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsPending
+
+    Determines if a user, or any user, has pending changes.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+               If this argument is null, all users are checked.
+
+Return Values:
+    If there are pending changes, the return value is nonzero (true).
+
+    If there are no pending changes, the return value is zero (false).
+
+--*/
+BOOL DbUserStatsPending(CHAR *userName)
+{
+    BOOL        pending = FALSE;
+    SIZE_T      i;
+    STATS_ENTRY **vector;
+
+    if (statsArray == NULL) {
+        // Not initialized
+        return FALSE;
+    }
+
+    EnterCriticalSection(&statsLock);
+
+    if (statsDoubt != NULL) {
+        // The batches whose commit failed are resolved by the next flush
+        pending = TRUE;
+    } else if (userName != NULL) {
+        vector = EntrySearch(userName);
+        pending = (vector != NULL && vector[0]->dirty);
+    } else {
+        for (i = 0; i < statsCount && !pending; i++) {
+            pending = statsArray[i]->dirty;
+        }
+    }
+
+    LeaveCriticalSection(&statsLock);
+
+    return pending;
+}
+
+/*++
+
+DbUserStatsLoad
+
+    Applies a user's pending changes to statistics read from the database, and
+    remembers the result as the values ioFTPD has.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+
+    userFile - Pointer to the USERFILE structure read from the database.
+
+    create   - Start buffering the user, if it is not buffered already.
+
+Return Values:
+    None.
+
+Remarks:
+    Changes being flushed by another thread are not included, so the local
+    statistics may briefly be lower than the database's.
+
+--*/
+VOID DbUserStatsLoad(CHAR *userName, USERFILE *userFile, BOOL create)
+{
+    INT64       values[STATS_COUNT];
+    SIZE_T      i;
+    STATS_ENTRY *entry;
+    STATS_ENTRY **vector;
+
+    ASSERT(userName != NULL);
+    ASSERT(userFile != NULL);
+
+    EnterCriticalSection(&statsLock);
+
+    vector = EntrySearch(userName);
+    if (vector != NULL) {
+        entry = vector[0];
+    } else if (create) {
+        entry = EntryInsert(userName);
+    } else {
+        entry = NULL;
+    }
+
+    if (entry != NULL) {
+        StatsGet(userFile, values);
+        for (i = 0; i < STATS_COUNT; i++) {
+            values[i] += entry->delta[i];
+        }
+        StatsSet(userFile, values);
+        CopyMemory(entry->base, values, sizeof(values));
+
+        // The remaining fields now match the database
+        entry->info    = InfoHash(userFile);
+        entry->written = TRUE;
+    }
+
+    LeaveCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsCopyInfo
+
+    Copies the fields of a user-file other than the statistics and credits.
+
+Arguments:
+    userFile - Pointer to the USERFILE structure to be updated.
+
+    source   - Pointer to the USERFILE structure to copy from.
+
+Return Values:
+    None.
+
+--*/
+VOID DbUserStatsCopyInfo(USERFILE *userFile, const USERFILE *source)
+{
+    INT64 values[STATS_COUNT];
+
+    ASSERT(userFile != NULL);
+    ASSERT(source != NULL);
+
+    StatsGet(userFile, values);
+    CopyMemory(userFile, source, offsetof(USERFILE, lpInternal));
+    StatsSet(userFile, values);
+}
+
+/*++
+
+DbUserStatsUpdate
+
+    Adds the changes of a user-file write to the user's pending changes.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+
+    userFile - Pointer to the USERFILE structure being written.
+
+Return Values:
+    Combination of the STATS_WRITE_* flags that tells the caller what it must
+    write to the database now.
+
+--*/
+DWORD DbUserStatsUpdate(CHAR *userName, USERFILE *userFile)
+{
+    BOOL        changed = FALSE;
+    DWORD       flags = 0;
+    INT64       values[STATS_COUNT];
+    SIZE_T      i;
+    STATS_ENTRY *entry;
+    STATS_ENTRY **vector;
+    UINT64      info;
+
+    ASSERT(userName != NULL);
+    ASSERT(userFile != NULL);
+
+    info = InfoHash(userFile);
+    StatsGet(userFile, values);
+
+    EnterCriticalSection(&statsLock);
+
+    vector = EntrySearch(userName);
+    if (vector != NULL) {
+        entry = vector[0];
+
+        for (i = 0; i < STATS_COUNT; i++) {
+            if (values[i] != entry->base[i]) {
+                entry->delta[i] += values[i] - entry->base[i];
+                changed = TRUE;
+            }
+        }
+        if (changed) {
+            CopyMemory(entry->base, values, sizeof(values));
+            entry->dirty = TRUE;
+            statsCounters.writes++;
+        }
+
+    } else {
+        // Without the values ioFTPD started from, the statistics can only be
+        // written as they are.
+        entry = EntryInsert(userName);
+        if (entry != NULL) {
+            CopyMemory(entry->base, values, sizeof(values));
+        }
+        flags |= STATS_WRITE_ABSOLUTE;
+    }
+
+    if (entry == NULL || !entry->written || entry->info != info) {
+        flags |= STATS_WRITE_INFO;
+    }
+    if (entry != NULL) {
+        entry->info    = info;
+        entry->written = TRUE;
+    }
+
+    LeaveCriticalSection(&statsLock);
+
+    return flags;
+}
+
+/*++
+
+DbUserStatsInvalidate
+
+    Forces the next write of a user to write the remaining fields, after the
+    previous write failed.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+
+Return Values:
+    None.
+
+--*/
+VOID DbUserStatsInvalidate(CHAR *userName)
+{
+    STATS_ENTRY **vector;
+
+    ASSERT(userName != NULL);
+
+    EnterCriticalSection(&statsLock);
+
+    vector = EntrySearch(userName);
+    if (vector != NULL) {
+        vector[0]->written = FALSE;
+    }
+
+    LeaveCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsRename
+
+    Moves a user's buffered statistics to the user's new name.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+
+    newName  - Pointer to a null-terminated string that specifies the new name.
+
+Return Values:
+    None.
+
+--*/
+VOID DbUserStatsRename(CHAR *userName, CHAR *newName)
+{
+    STATS_ENTRY *entry;
+    STATS_ENTRY **vector;
+
+    ASSERT(userName != NULL);
+    ASSERT(newName != NULL);
+
+    EnterCriticalSection(&statsLock);
+
+    vector = EntrySearch(userName);
+    if (vector != NULL) {
+        entry = EntryInsert(newName);
+        if (entry != NULL) {
+            // Search again, the insert may have moved the old entry
+            vector = EntrySearch(userName);
+            CopyMemory((BYTE *)entry + offsetof(STATS_ENTRY, dirty),
+                (BYTE *)vector[0] + offsetof(STATS_ENTRY, dirty),
+                sizeof(STATS_ENTRY) - offsetof(STATS_ENTRY, dirty));
+        }
+        EntryRemove(vector);
+    }
+
+    LeaveCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsDiscard
+
+    Stops buffering a user's statistics, discarding the pending changes.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+
+Return Values:
+    None.
+
+--*/
+VOID DbUserStatsDiscard(CHAR *userName)
+{
+    STATS_ENTRY **vector;
+
+    ASSERT(userName != NULL);
+
+    EnterCriticalSection(&statsLock);
+
+    vector = EntrySearch(userName);
+    if (vector != NULL) {
+        EntryRemove(vector);
+    }
+
+    LeaveCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsClose
+
+    Stops buffering a user's statistics, unless there are pending changes.
+
+Arguments:
+    userName - Pointer to a null-terminated string that specifies the user name.
+
+Return Values:
+    None.
+
+Remarks:
+    A user whose flush failed, or who was written again meanwhile, stays
+    buffered until the next flush.
+
+--*/
+VOID DbUserStatsClose(CHAR *userName)
+{
+    STATS_ENTRY **vector;
+
+    ASSERT(userName != NULL);
+
+    EnterCriticalSection(&statsLock);
+
+    vector = EntrySearch(userName);
+    if (vector != NULL && !vector[0]->dirty) {
+        EntryRemove(vector);
+    }
+
+    LeaveCriticalSection(&statsLock);
+}
+
+/*++
+
+DbUserStatsFlush
+
+    Merges pending changes into the database.
+
+Arguments:
+    db       - Pointer to the DB_CONTEXT structure.
+
+    userName - Pointer to a null-terminated string that specifies the user name
+               to flush. If this argument is null, all users are flushed.
+
+Return Values:
+    A Windows API error code.
+
+Remarks:
+    Changes of a failed batch are put back, to be merged by the next flush.
+    If the commit of a batch failed, its changes are only put back once the
+    next flush finds that the batch was not committed.
+
+--*/
+DWORD DbUserStatsFlush(DB_CONTEXT *db, CHAR *userName)
+{
+    BOOL        doubt;
+    DWORD       error = ERROR_SUCCESS;
+    SIZE_T      count;
+    SIZE_T      i;
+    SIZE_T      passes;
+    STATS_DOUBT *failed;
+    STATS_ENTRY **vector;
+    STATS_ROW   *rows;
+    UINT64      sequence;
+
+    ASSERT(db != NULL);
+    TRACE("db=%p userName=%s", db, userName);
+
+    // Changes of a batch being resolved are not pending until it is resolved
+    EnterCriticalSection(&statsResolveLock);
+    error = FlushResolve(db);
+    LeaveCriticalSection(&statsResolveLock);
+
+    if (error != ERROR_SUCCESS) {
+        LOG_WARN("Unable to resolve failed statistics commits (error %lu).", error);
+        return error;
+    }
+
+    rows = MemAllocate(((userName != NULL) ? 1 : STATS_BATCH) * sizeof(STATS_ROW));
+    if (rows == NULL) {
+        LOG_ERROR("Unable to allocate memory for statistics.");
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // Users made dirty again while flushing wait for the next flush
+    EnterCriticalSection(&statsLock);
+    passes = (userName != NULL) ? 1 : statsCount / STATS_BATCH + 1;
+    LeaveCriticalSection(&statsLock);
+
+    for (; passes > 0; passes--) {
+        //
+        // Take the pending changes of a batch of users
+        //
+
+        count = 0;
+        EnterCriticalSection(&statsLock);
+
+        if (userName != NULL) {
+            vector = EntrySearch(userName);
+            if (vector != NULL && vector[0]->dirty) {
+                RowTake(&rows[count++], vector[0]);
+            }
+        } else {
+            for (i = 0; i < statsCount && count < STATS_BATCH; i++) {
+                if (statsArray[i]->dirty) {
+                    RowTake(&rows[count++], statsArray[i]);
+                }
+            }
+        }
+
+        sequence = (count > 0) ? ++statsSequence : 0;
+        LeaveCriticalSection(&statsLock);
+
+        if (count == 0) {
+            break;
+        }
+
+        //
+        // Merge the batch, and put the changes back if that failed
+        //
+
+        error = FlushBatch(db, rows, count, sequence, &doubt);
+        if (error != ERROR_SUCCESS) {
+            LOG_WARN("Unable to flush statistics of %lu users (error %lu).", (ULONG)count, error);
+
+            failed = doubt ? MemAllocate(sizeof(STATS_DOUBT)) : NULL;
+            if (failed != NULL) {
+                failed->sequence = sequence;
+                failed->count    = count;
+                CopyMemory(failed->rows, rows, count * sizeof(STATS_ROW));
+            } else if (doubt) {
+                LOG_ERROR("Unable to allocate memory for statistics, the changes may be merged twice.");
+            }
+
+            EnterCriticalSection(&statsLock);
+            if (failed != NULL) {
+                failed->next = statsDoubt;
+                statsDoubt = failed;
+            } else {
+                for (i = 0; i < count; i++) {
+                    RowRestore(&rows[i]);
+                }
+            }
+            LeaveCriticalSection(&statsLock);
+            break;
+        }
+
+        if (sequence % STATS_PURGE == 1) {
+            FlushPurge(db);
+        }
+    }
+
+    MemFree(rows);
+    return error;
+}
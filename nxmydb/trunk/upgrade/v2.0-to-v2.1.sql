@@ -0,0 +1,53 @@
+--
+-- nxMyDB - Upgrade from v2.0 to v2.1
+--
+-- Instructions:
+--
+--  1. Back up "ioftpd" database!!!
+--
+--  2. Upgrade the module on every server sharing the database. Servers still
+--     running v2.0 call the lock procedures that this script removes.
+--
+--  3. Run the upgrade script:
+--     mysql -u root -p -h 192.168.1.1 -D ioftpd --delimiter=$ < v2.0-to-v2.1.sql
+--
+
+--
+-- Remove lock procedures, locks are now taken by the module with a single
+-- UPDATE statement and retried with a backoff
+--
+
+DROP PROCEDURE IF EXISTS io_user_lock;
+
+DROP PROCEDURE IF EXISTS io_group_lock;
+
+--
+-- Index the update time, incremental synchronization reads the rows updated
+-- since the last one
+--
+
+ALTER TABLE io_group ADD INDEX updated (updated);
+
+ALTER TABLE io_user ADD INDEX updated (updated);
+
+--
+-- Index the change time, purges look up the newest change older than the
+-- purge age and delete the changes before it in batches
+--
+
+ALTER TABLE io_group_changes ADD INDEX time (time);
+
+ALTER TABLE io_user_changes ADD INDEX time (time);
+
+--
+-- Record the statistics flushed by each server, a server whose commit failed
+-- looks up the batch to find out whether it was committed
+--
+
+CREATE TABLE io_user_flush (
+  owner       VARCHAR(36)     NOT NULL,
+  seq         BIGINT UNSIGNED NOT NULL,
+  time        INT UNSIGNED    NOT NULL,
+  PRIMARY KEY (owner,seq),
+  KEY time (time)
+);
@@ -20,9 +20,18 @@ if {[IsTrue $misc(ReloadConfig)] && [catch {source "../scripts/init.itcl"} error
 namespace eval ::nxTools::Db {
     namespace import -force ::nxLib::*
     variable dbSchema
+    variable dbSearch
     variable dbTables
+    variable dbUpgrade
 
     # Table Formats
+    #
+    # dbSchema  - Current schema version, stored in the "user_version" pragma.
+    # dbSearch  - Optional search tables and their triggers, only created if
+    #             SQLite supports FTS5. They are not part of the schema version.
+    # dbTables  - Tables, indexes, and triggers, created in the listed order.
+    # dbUpgrade - Earlier schema versions whose tables are kept; only the
+    #             missing indexes and triggers are added to them.
     set dbSchema(Approves) 0
     set dbTables(Approves) {
         Approves {CREATE TABLE Approves(
@@ -32,7 +41,11 @@ namespace eval ::nxTools::Db {
         Release   TEXT default '')}
     }
 
-    set dbSchema(DupeDirs) 0
+    # The search tables index every three characters of the names for
+    # "SITE DUPE" and "SITE UNDUPE", they require SQLite v3.34 or newer
+    # with FTS5. Without them, the searches scan the tables instead.
+    set dbSchema(DupeDirs) 1
+    set dbUpgrade(DupeDirs) {0}
     set dbTables(DupeDirs) {
         DupeDirs {CREATE TABLE DupeDirs(
         TimeStamp INTEGER default 0,
@@ -40,9 +53,29 @@ namespace eval ::nxTools::Db {
         GroupName TEXT default '',
         DirPath   TEXT default '',
         DirName   TEXT default '')}
+
+        DupeDirsName {CREATE INDEX DupeDirsName ON DupeDirs(DirName COLLATE NOCASE)}
+
+        DupeDirsTime {CREATE INDEX DupeDirsTime ON DupeDirs(TimeStamp)}
+    }
+    set dbSearch(DupeDirs) {
+        DupeDirsSearch {CREATE VIRTUAL TABLE DupeDirsSearch USING fts5(
+        DirName, content='DupeDirs', tokenize='trigram');
+        INSERT INTO DupeDirsSearch(DupeDirsSearch) VALUES('rebuild')}
+
+        DupeDirsInsert {CREATE TRIGGER DupeDirsInsert AFTER INSERT ON DupeDirs BEGIN
+        INSERT INTO DupeDirsSearch(rowid,DirName) VALUES(new.rowid,new.DirName); END}
+
+        DupeDirsDelete {CREATE TRIGGER DupeDirsDelete AFTER DELETE ON DupeDirs BEGIN
+        INSERT INTO DupeDirsSearch(DupeDirsSearch,rowid,DirName) VALUES('delete',old.rowid,old.DirName); END}
+
+        DupeDirsUpdate {CREATE TRIGGER DupeDirsUpdate AFTER UPDATE OF DirName ON DupeDirs BEGIN
+        INSERT INTO DupeDirsSearch(DupeDirsSearch,rowid,DirName) VALUES('delete',old.rowid,old.DirName);
+        INSERT INTO DupeDirsSearch(rowid,DirName) VALUES(new.rowid,new.DirName); END}
     }
 
-    set dbSchema(DupeFiles) 1
+    set dbSchema(DupeFiles) 2
+    set dbUpgrade(DupeFiles) {1}
     set dbTables(DupeFiles) {
         DupeFiles {CREATE TABLE DupeFiles(
         TimeStamp INTEGER default 0,
@@ -50,6 +83,25 @@ namespace eval ::nxTools::Db {
         GroupName TEXT default '',
         FilePath  TEXT default '',
         FileName  TEXT default '')}
+
+        DupeFilesName {CREATE INDEX DupeFilesName ON DupeFiles(FileName COLLATE NOCASE)}
+
+        DupeFilesTime {CREATE INDEX DupeFilesTime ON DupeFiles(TimeStamp)}
+    }
+    set dbSearch(DupeFiles) {
+        DupeFilesSearch {CREATE VIRTUAL TABLE DupeFilesSearch USING fts5(
+        FileName, content='DupeFiles', tokenize='trigram');
+        INSERT INTO DupeFilesSearch(DupeFilesSearch) VALUES('rebuild')}
+
+        DupeFilesInsert {CREATE TRIGGER DupeFilesInsert AFTER INSERT ON DupeFiles BEGIN
+        INSERT INTO DupeFilesSearch(rowid,FileName) VALUES(new.rowid,new.FileName); END}
+
+        DupeFilesDelete {CREATE TRIGGER DupeFilesDelete AFTER DELETE ON DupeFiles BEGIN
+        INSERT INTO DupeFilesSearch(DupeFilesSearch,rowid,FileName) VALUES('delete',old.rowid,old.FileName); END}
+
+        DupeFilesUpdate {CREATE TRIGGER DupeFilesUpdate AFTER UPDATE OF FileName ON DupeFiles BEGIN
+        INSERT INTO DupeFilesSearch(DupeFilesSearch,rowid,FileName) VALUES('delete',old.rowid,old.FileName);
+        INSERT INTO DupeFilesSearch(rowid,FileName) VALUES(new.rowid,new.FileName); END}
     }
 
     set dbSchema(Links) 0
@@ -118,10 +170,29 @@ namespace eval ::nxTools::Db {
 # Database Procedures
 ######################################################################
 
+proc ::nxTools::Db::CreateObjects {objList} {
+    foreach {name query} $objList {
+        regexp -nocase -- {^CREATE (?:VIRTUAL )?(\w+)} $query -> type
+        set type [string tolower $type]
+
+        if {[db exists {SELECT 1 FROM sqlite_master WHERE name=$name}]} {
+            LinePuts "- The $type \"$name\" exists."
+        } elseif {[catch {db eval $query} error]} {
+            LinePuts "- Unable to create $type \"$name\": $error"
+            return 0
+        } else {
+            LinePuts "- Created $type \"$name\"."
+        }
+    }
+    return 1
+}
+
 proc ::nxTools::Db::Create {dbList} {
     global misc
     variable dbSchema
+    variable dbSearch
     variable dbTables
+    variable dbUpgrade
 
     if {![file exists $misc(DataPath)]} {
         catch {file mkdir $misc(DataPath)}
@@ -139,7 +210,11 @@ proc ::nxTools::Db::Create {dbList} {
         }
         set currentVer [db eval {PRAGMA user_version}]
 
-        if {$exists && $currentVer != $dbSchema($dbName)} {
+        if {$exists && $currentVer != $dbSchema($dbName) && [info exists dbUpgrade($dbName)] &&
+                [lsearch -exact $dbUpgrade($dbName) $currentVer] != -1} {
+            LinePuts "- Upgrading schema version (current: v$currentVer, required: v$dbSchema($dbName))."
+
+        } elseif {$exists && $currentVer != $dbSchema($dbName)} {
             LinePuts "- Invalid schema version (current: v$currentVer, required: v$dbSchema($dbName))."
             db close
 
@@ -159,13 +234,31 @@ proc ::nxTools::Db::Create {dbList} {
             }
         }
 
-        db eval "PRAGMA user_version=$dbSchema($dbName)"
-        foreach {table query} $dbTables($dbName) {
-            if {[db exists {SELECT 1 FROM sqlite_master WHERE name=$table AND type='table'}]} {
-                LinePuts "- Table \"$table\" exists."
+        db eval {BEGIN}
+        if {[CreateObjects $dbTables($dbName)]} {
+            db eval "PRAGMA user_version=$dbSchema($dbName)"
+            db eval {COMMIT}
+        } else {
+            db eval {ROLLBACK}
+            LinePuts "- Rolled back all changes, the database was not modified."
+            db close
+            continue
+        }
+
+        # The search tables are added separately, so they can be created by
+        # running this again after updating SQLite.
+        if {[info exists dbSearch($dbName)]} {
+            if {[catch {db eval {CREATE VIRTUAL TABLE temp.SearchCheck USING fts5(Name)}}]} {
+                LinePuts "- Skipped the search tables, this SQLite version does not support FTS5."
             } else {
-                LinePuts "- Creating table \"$table\"."
-                db eval $query
+                db eval {DROP TABLE temp.SearchCheck}
+                db eval {BEGIN}
+                if {[CreateObjects $dbSearch($dbName)]} {
+                    db eval {COMMIT}
+                } else {
+                    db eval {ROLLBACK}
+                    LinePuts "- Rolled back the search tables, searches scan the tables instead."
+                }
             }
         }
         db close
@@ -201,6 +294,11 @@ proc ::nxTools::Db::Optimize {dbList} {
             continue
         }
         db eval {VACUUM}
+
+        # Vacuuming renumbers the rows, so the search tables must be rebuilt.
+        foreach table [db eval {SELECT name FROM sqlite_master WHERE type='table' AND sql LIKE 'CREATE VIRTUAL TABLE % USING fts5%'}] {
+            db eval "INSERT INTO $table\($table\) VALUES('rebuild')"
+        }
         db close
     }
 }
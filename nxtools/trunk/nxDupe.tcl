@@ -25,6 +25,20 @@ namespace eval ::nxTools::Dupe {
 # Dupe Procedures
 ######################################################################
 
+proc ::nxTools::Dupe::SearchClause {dbProc tableName colName pattern} {
+    set clause "$colName LIKE '$pattern' ESCAPE '\\'"
+
+    # The trigram index of the search table is not used for patterns with an
+    # ESCAPE clause. Search it with wildcards in place of the escaped characters
+    # and narrow those rows down with the escaped pattern.
+    set searchTable "${tableName}Search"
+    if {[$dbProc exists {SELECT 1 FROM sqlite_master WHERE name=$searchTable}]} {
+        set search [string map {\\% % \\_ _} $pattern]
+        set clause "rowid IN (SELECT rowid FROM $searchTable WHERE $colName LIKE '$search') AND $clause"
+    }
+    return $clause
+}
+
 proc ::nxTools::Dupe::CheckDirs {virtualPath} {
     global dupe
     if {[ListMatch $dupe(CheckExempts) $virtualPath] || [ListMatchI $dupe(IgnoreDirs) $virtualPath]} {return 0}
@@ -32,7 +46,7 @@ proc ::nxTools::Dupe::CheckDirs {virtualPath} {
     if {![catch {DbOpenFile [namespace current]::DirDb "DupeDirs.db"} error]} {
         set dirName [file tail $virtualPath]
 
-        DirDb eval {SELECT * FROM DupeDirs WHERE StrCaseEq(DirName,$dirName) LIMIT 1} values {
+        DirDb eval {SELECT * FROM DupeDirs WHERE DirName=$dirName COLLATE NOCASE LIMIT 1} values {
             set age [FormatDuration [expr {[clock seconds] - $values(TimeStamp)}]]
             set path [file join $values(DirPath) $values(DirName)]
             iputs -noprefix "553-.-\[DupeCheck\]-------------------------------------------------."
@@ -53,7 +67,7 @@ proc ::nxTools::Dupe::CheckFiles {virtualPath} {
     if {![catch {DbOpenFile [namespace current]::FileDb "DupeFiles.db"} error]} {
         set fileName [file tail $virtualPath]
 
-        FileDb eval {SELECT * FROM DupeFiles WHERE StrCaseEq(FileName,$fileName) LIMIT 1} values {
+        FileDb eval {SELECT * FROM DupeFiles WHERE FileName=$fileName COLLATE NOCASE LIMIT 1} values {
             set age [FormatDuration [expr {[clock seconds] - $values(TimeStamp)}]]
             iputs -noprefix "553-.-\[DupeCheck\]-------------------------------------------------."
             iputs -noprefix "553-| [format %-59s "Dupe: $values(FileName)"] |"
@@ -117,7 +131,7 @@ proc ::nxTools::Dupe::UpdateFiles {command virtualPath} {
         set timeStamp [clock seconds]
         FileDb eval {INSERT INTO DupeFiles(TimeStamp,UserName,GroupName,FilePath,FileName) VALUES($timeStamp,$user,$group,$filePath,$fileName)}
     } elseif {$command eq "DELE" || $command eq "RNFR"} {
-        FileDb eval {DELETE FROM DupeFiles WHERE StrCaseEq(FileName,$fileName)}
+        FileDb eval {DELETE FROM DupeFiles WHERE FileName=$fileName COLLATE NOCASE}
     }
     FileDb close
     return 0
@@ -492,7 +506,7 @@ proc ::nxTools::Dupe::SiteApprove {event argList} {
                 # If the release already exists in the dupe database, approve that one.
                 set approved 0
                 if {![catch {DbOpenFile [namespace current]::DirDb "DupeDirs.db"} error]} {
-                    DirDb eval {SELECT DirName,DirPath FROM DupeDirs WHERE StrCaseEq(DirName,$release) ORDER BY TimeStamp DESC LIMIT 1} values {
+                    DirDb eval {SELECT DirName,DirPath FROM DupeDirs WHERE DirName=$release COLLATE NOCASE ORDER BY TimeStamp DESC LIMIT 1} values {
                         set virtualPath [file join $values(DirPath) $values(DirName)]
                         set approved [ApproveRelease $virtualPath $user $group]
                     }
@@ -564,9 +578,9 @@ proc ::nxTools::Dupe::SiteDupe {fileRoot limit pattern} {
     }
     OutputText $template(Header)
     set count 0
-    set pattern [DbPattern $pattern]
+    set clause [SearchClause DirDb DupeDirs DirName [DbPattern $pattern]]
 
-    DirDb eval "SELECT * FROM DupeDirs WHERE DirName LIKE '$pattern' ESCAPE '\\' ORDER BY TimeStamp DESC LIMIT $limit" values {
+    DirDb eval "SELECT * FROM DupeDirs WHERE $clause ORDER BY TimeStamp DESC LIMIT $limit" values {
         incr count
         set valueList [clock format $values(TimeStamp) -format {{%S} {%M} {%H} {%d} {%m} {%y} {%Y}} -gmt [IsTrue $misc(UtcTime)]]
         lappend valueList $count $values(UserName) $values(GroupName) $values(DirName) [file join $values(DirPath) $values(DirName)]
@@ -575,7 +589,7 @@ proc ::nxTools::Dupe::SiteDupe {fileRoot limit pattern} {
 
     if {!$count} {OutputText $template(None)}
     if {$count == $limit} {
-        set total [DirDb eval "SELECT COUNT(*) FROM DupeDirs WHERE DirName LIKE '$pattern' ESCAPE '\\'"]
+        set total [DirDb eval "SELECT COUNT(*) FROM DupeDirs WHERE $clause"]
     } else {
         set total $count
     }
@@ -596,9 +610,9 @@ proc ::nxTools::Dupe::SiteFileDupe {limit pattern} {
     }
     OutputText $template(Header)
     set count 0
-    set pattern [DbPattern $pattern]
+    set clause [SearchClause FileDb DupeFiles FileName [DbPattern $pattern]]
 
-    FileDb eval "SELECT * FROM DupeFiles WHERE FileName LIKE '$pattern' ESCAPE '\\' ORDER BY TimeStamp DESC LIMIT $limit" values {
+    FileDb eval "SELECT * FROM DupeFiles WHERE $clause ORDER BY TimeStamp DESC LIMIT $limit" values {
         incr count
         set valueList [clock format $values(TimeStamp) -format {{%S} {%M} {%H} {%d} {%m} {%y} {%Y}} -gmt [IsTrue $misc(UtcTime)]]
         lappend valueList $count $values(UserName) $values(GroupName) $values(FileName) [file join $values(FilePath) $values(FileName)]
@@ -607,7 +621,7 @@ proc ::nxTools::Dupe::SiteFileDupe {limit pattern} {
 
     if {!$count} {OutputText $template(None)}
     if {$count == $limit} {
-        set total [FileDb eval "SELECT COUNT(*) FROM DupeFiles WHERE FileName LIKE '$pattern' ESCAPE '\\'"]
+        set total [FileDb eval "SELECT COUNT(*) FROM DupeFiles WHERE $clause"]
     } else {
         set total $count
     }
@@ -705,7 +719,9 @@ proc ::nxTools::Dupe::SiteUndupe {argList} {
         set rowIds [list]
         set total [DupeDb eval "SELECT COUNT(*) FROM $dbName"]
 
-        DupeDb eval "SELECT $colName,rowid FROM $dbName WHERE $colName LIKE '$pattern' ESCAPE '\\' ORDER BY $colName ASC" values {
+        set clause [SearchClause DupeDb $dbName $colName $pattern]
+
+        DupeDb eval "SELECT $colName,rowid FROM $dbName WHERE $clause ORDER BY $colName ASC" values {
             incr removed
             LinePuts "Unduped: $values($colName)"
             lappend rowIds $values(rowid)